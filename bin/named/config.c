@@ -49,6 +49,8 @@
 static char defaultconf[] = "\
 options {\n\
 	answer-cookie true;\n\
+	async-logging no;\n\
+	async-logging-overflow block;\n\
 	automatic-interface-scan yes;\n\
 	bindkeys-file \"" NAMED_SYSCONFDIR "/bind.keys\";\n\
 #	blackhole {none;};\n"
@@ -117,6 +119,7 @@ options {\n\
 #	tkey-dhkey <none>\n\
 #	tkey-domain <none>\n\
 #	tkey-gssapi-credential <none>\n\
+	transfer-cache-size 32M;\n\
 	transfer-message-size 20480;\n\
 	transfers-in 10;\n\
 	transfers-out 10;\n\
@@ -192,6 +195,7 @@ options {\n\
 	resolver-retry-interval 800; /* in milliseconds */\n\
 #	rfc2308-type1 <obsolete>;\n\
 	root-key-sentinel yes;\n\
+	send-client-subnet no;\n\
 	servfail-ttl 1;\n\
 #	sortlist <none>\n\
 	stale-answer-enable false;\n\
@@ -223,6 +227,7 @@ options {\n\
 #	forwarders <none>\n\
 	inline-signing no;\n\
 	ixfr-from-differences false;\n\
+	journal-sync-delay 0;\n\
 #	maintain-ixfr-base <obsolete>;\n\
 #	max-ixfr-log-size <obsolete>\n\
 	max-journal-size default;\n\
@@ -141,5 +141,10 @@ named_geoip_load(char *dir) {
 		      method, "Domain");
 	init_geoip_db(&named_g_geoip->netspeed, GEOIP_NETSPEED_EDITION, 0,
 		      method, "NetSpeed");
+
+	/*
+	 * Results cached from the previous databases are now stale.
+	 */
+	dns_geoip_flushcache();
 #endif /* HAVE_GEOIP */
 }
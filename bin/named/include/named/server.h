@@ -39,6 +39,7 @@
 #define NAMED_EVENTCLASS		ISC_EVENTCLASS(0x4E43)
 #define NAMED_EVENT_RELOAD		(NAMED_EVENTCLASS + 0)
 #define NAMED_EVENT_DELZONE		(NAMED_EVENTCLASS + 1)
+#define NAMED_EVENT_CATZCHANGES		(NAMED_EVENTCLASS + 2)
 
 /*%
  * Name server state.  Better here than in lots of separate global variables.
@@ -65,6 +66,7 @@ struct named_server {
 	dns_loadmgr_t *		loadmgr;
 	dns_zonemgr_t *		zonemgr;
 	dns_viewlist_t		viewlist;
+	dns_viewindex_t *	viewindex;	/*%< Compiled view selection */
 	ns_interfacemgr_t *	interfacemgr;
 	dns_db_t *		in_roothints;
 
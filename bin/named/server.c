@@ -30,6 +30,7 @@
 #include <isc/file.h>
 #include <isc/hash.h>
 #include <isc/hex.h>
+#include <isc/histo.h>
 #include <isc/hmacsha.h>
 #include <isc/httpd.h>
 #include <isc/lex.h>
@@ -57,6 +58,7 @@
 
 #include <bind9/check.h>
 
+#include <dns/acl.h>
 #include <dns/adb.h>
 #include <dns/badcache.h>
 #include <dns/cache.h>
@@ -96,6 +98,7 @@
 #include <dns/tsig.h>
 #include <dns/ttl.h>
 #include <dns/view.h>
+#include <dns/viewindex.h>
 #include <dns/zone.h>
 #include <dns/zt.h>
 
@@ -104,7 +107,9 @@
 
 #include <ns/client.h>
 #include <ns/listenlist.h>
+#include <ns/qlog.h>
 #include <ns/interfacemgr.h>
+#include <ns/xfrout.h>
 
 #include <named/config.h>
 #include <named/control.h>
@@ -217,6 +222,9 @@
  */
 #define MAX_ADB_SIZE_FOR_CACHESHARE	8388608U
 
+/*% Default binary query log segment size */
+#define QLOG_DEFAULTSIZE		(64U * 1024 * 1024)
+
 struct named_dispatch {
 	isc_sockaddr_t			addr;
 	unsigned int			dispatchgen;
@@ -293,18 +301,26 @@ typedef struct {
 		isc_refcount_t refs;
 } ns_zoneload_t;
 
+typedef struct catz_chgzone_event catz_chgzone_event_t;
+typedef ISC_LIST(catz_chgzone_event_t) catz_chgzone_list_t;
+
 typedef struct {
 	named_server_t *server;
+	isc_mutex_t lock;
+	catz_chgzone_list_t changes;
 } catz_cb_data_t;
 
-typedef struct catz_chgzone_event {
+struct catz_chgzone_event {
 	ISC_EVENT_COMMON(struct catz_chgzone_event);
 	dns_catz_entry_t *entry;
 	dns_catz_zone_t *origin;
 	dns_view_t *view;
 	catz_cb_data_t *cbd;
 	bool mod;
-} catz_chgzone_event_t;
+	cfg_obj_t *zoneconf;
+	const cfg_obj_t *zoneobj;
+	bool configured;
+};
 
 /*
  * These zones should not leak onto the Internet.
@@ -2472,17 +2488,30 @@ configure_rpz(dns_view_t *view, const cfg_obj_t **maps,
 }
 
 static void
-catz_addmodzone_taskaction(isc_task_t *task, isc_event_t *event0) {
-	catz_chgzone_event_t *ev = (catz_chgzone_event_t *) event0;
+catz_chgzone_free(catz_chgzone_event_t *ev) {
+	ns_cfgctx_t *cfg;
+
+	if (ev->zoneconf != NULL) {
+		cfg = (ns_cfgctx_t *) ev->view->new_zone_config;
+		cfg_obj_destroy(cfg->add_parser, &ev->zoneconf);
+	}
+	dns_catz_entry_detach(ev->origin, &ev->entry);
+	dns_catz_zone_detach(&ev->origin);
+	dns_view_detach(&ev->view);
+	isc_event_free(ISC_EVENT_PTR(&ev));
+}
+
+/*
+ * Generate and parse the configuration of a zone that is to be added
+ * or modified.  This is done before the server is paused, so that the
+ * parsing cost of a large batch isn't paid in exclusive mode.
+ */
+static isc_result_t
+catz_addmodzone_prepare(catz_chgzone_event_t *ev, const char *nameb) {
 	isc_result_t result;
-	isc_buffer_t namebuf;
 	isc_buffer_t *confbuf;
-	char nameb[DNS_NAME_FORMATSIZE];
 	const cfg_obj_t *zlist = NULL;
-	cfg_obj_t *zoneconf = NULL;
-	cfg_obj_t *zoneobj = NULL;
 	ns_cfgctx_t *cfg;
-	dns_zone_t *zone = NULL;
 
 	cfg = (ns_cfgctx_t *) ev->view->new_zone_config;
 	if (cfg == NULL) {
@@ -2490,12 +2519,53 @@ catz_addmodzone_taskaction(isc_task_t *task, isc_event_t *event0) {
 			      NAMED_LOGMODULE_SERVER, ISC_LOG_ERROR,
 			      "catz: allow-new-zones statement missing from "
 			      "config; cannot add zone from the catalog");
-		goto cleanup;
+		return (ISC_R_FAILURE);
 	}
 
-	isc_buffer_init(&namebuf, nameb, DNS_NAME_FORMATSIZE);
-	dns_name_totext(dns_catz_entry_getname(ev->entry), true, &namebuf);
-	isc_buffer_putuint8(&namebuf, 0);
+	/* Create a config for new zone */
+	confbuf = NULL;
+	result = dns_catz_generate_zonecfg(ev->origin, ev->entry, &confbuf);
+	if (result == ISC_R_SUCCESS) {
+		cfg_parser_reset(cfg->add_parser);
+		result = cfg_parse_buffer3(cfg->add_parser, confbuf, "catz", 0,
+					   &cfg_type_addzoneconf,
+					   &ev->zoneconf);
+		isc_buffer_free(&confbuf);
+	}
+	/*
+	 * Fail if either dns_catz_generate_zonecfg() or cfg_parse_buffer3()
+	 * failed.
+	 */
+	if (result != ISC_R_SUCCESS) {
+		isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
+			      NAMED_LOGMODULE_SERVER, ISC_LOG_ERROR,
+			      "catz: error \"%s\" while trying to generate "
+			      "config for zone \"%s\"",
+			      isc_result_totext(result), nameb);
+		return (result);
+	}
+	CHECK(cfg_map_get(ev->zoneconf, "zone", &zlist));
+	if (!cfg_obj_islist(zlist))
+		CHECK(ISC_R_FAILURE);
+
+	/* For now we only support adding one zone at a time */
+	ev->zoneobj = cfg_listelt_value(cfg_list_first(zlist));
+
+ cleanup:
+	return (result);
+}
+
+/*
+ * Configure a zone being added or modified.  Must be called in
+ * exclusive mode with ev->view thawed.
+ */
+static isc_result_t
+catz_addmodzone_apply(catz_chgzone_event_t *ev, const char *nameb) {
+	isc_result_t result;
+	ns_cfgctx_t *cfg;
+	dns_zone_t *zone = NULL;
+
+	cfg = (ns_cfgctx_t *) ev->view->new_zone_config;
 
 	/* Zone shouldn't already exist */
 	result = dns_zt_find(ev->view->zonetable,
@@ -2517,22 +2587,22 @@ catz_addmodzone_taskaction(isc_task_t *task, isc_event_t *event0) {
 					      NAMED_LOGMODULE_SERVER,
 					      ISC_LOG_WARNING,
 					      "catz: "
-					      "catz_addmodzone_taskaction: "
+					      "catz_addmodzone_apply: "
 					      "zone '%s' is not a dynamically "
 					      "added zone",
 					      nameb);
-				goto cleanup;
+				CHECK(ISC_R_FAILURE);
 			}
 			if (dns_zone_get_parentcatz(zone) != ev->origin) {
 				isc_log_write(named_g_lctx,
 					      NAMED_LOGCATEGORY_GENERAL,
 					      NAMED_LOGMODULE_SERVER,
 					      ISC_LOG_WARNING,
-					      "catz: catz_delzone_taskaction: "
+					      "catz: catz_addmodzone_apply: "
 					      "zone '%s' exists in multiple "
 					      "catalog zones",
 					      nameb);
-				goto cleanup;
+				CHECK(ISC_R_FAILURE);
 			}
 			dns_zone_detach(&zone);
 		}
@@ -2545,6 +2615,8 @@ catz_addmodzone_taskaction(isc_task_t *task, isc_event_t *event0) {
 				      "add zone \"%s\"",
 				      isc_result_totext(result),
 				      nameb);
+			if (result == ISC_R_SUCCESS)
+				result = ISC_R_EXISTS;
 			goto cleanup;
 		} else { /* this can happen in case of DNS_R_PARTIALMATCH */
 			if (zone != NULL)
@@ -2552,57 +2624,44 @@ catz_addmodzone_taskaction(isc_task_t *task, isc_event_t *event0) {
 		}
 	}
 	RUNTIME_CHECK(zone == NULL);
-	/* Create a config for new zone */
-	confbuf = NULL;
-	result = dns_catz_generate_zonecfg(ev->origin, ev->entry, &confbuf);
-	if (result == ISC_R_SUCCESS) {
-		cfg_parser_reset(cfg->add_parser);
-		result = cfg_parse_buffer3(cfg->add_parser, confbuf, "catz", 0,
-					   &cfg_type_addzoneconf, &zoneconf);
-		isc_buffer_free(&confbuf);
-	}
-	/*
-	 * Fail if either dns_catz_generate_zonecfg() or cfg_parse_buffer3()
-	 * failed.
-	 */
-	if (result != ISC_R_SUCCESS) {
-		isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
-			      NAMED_LOGMODULE_SERVER, ISC_LOG_ERROR,
-			      "catz: error \"%s\" while trying to generate "
-			      "config for zone \"%s\"",
-			      isc_result_totext(result), nameb);
-		goto cleanup;
-	}
-	CHECK(cfg_map_get(zoneconf, "zone", &zlist));
-	if (!cfg_obj_islist(zlist))
-		CHECK(ISC_R_FAILURE);
-
-	/* For now we only support adding one zone at a time */
-	zoneobj = cfg_listelt_value(cfg_list_first(zlist));
-
-	/* Mark view unfrozen so that zone can be added */
 
-	result = isc_task_beginexclusive(task);
-	RUNTIME_CHECK(result == ISC_R_SUCCESS);
-	dns_view_thaw(ev->view);
-	result = configure_zone(cfg->config, zoneobj, cfg->vconfig,
+	result = configure_zone(cfg->config, ev->zoneobj, cfg->vconfig,
 				ev->cbd->server->mctx, ev->view,
 				&ev->cbd->server->viewlist, cfg->actx,
 				true, false, ev->mod);
-	dns_view_freeze(ev->view);
-	isc_task_endexclusive(task);
-
 	if (result != ISC_R_SUCCESS) {
 		isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
 			      NAMED_LOGMODULE_SERVER, ISC_LOG_WARNING,
 			      "catz: failed to configure zone \"%s\" - %d",
 			      nameb, result);
-		goto cleanup;
 	}
 
+ cleanup:
+	if (zone != NULL)
+		dns_zone_detach(&zone);
+	return (result);
+}
+
+/*
+ * Load a zone configured by catz_addmodzone_apply(), once the server
+ * has left exclusive mode.
+ */
+static void
+catz_addmodzone_load(catz_chgzone_event_t *ev, const char *nameb) {
+	isc_result_t result;
+	dns_zone_t *zone = NULL;
+
 	/* Is it there yet? */
-	CHECK(dns_zt_find(ev->view->zonetable,
-			dns_catz_entry_getname(ev->entry), 0, NULL, &zone));
+	result = dns_zt_find(ev->view->zonetable,
+			     dns_catz_entry_getname(ev->entry), 0, NULL, &zone);
+	if (result != ISC_R_SUCCESS) {
+		isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
+			      NAMED_LOGMODULE_SERVER, ISC_LOG_WARNING,
+			      "catz: zone \"%s\" not found after "
+			      "configuration - %s",
+			      nameb, isc_result_totext(result));
+		goto cleanup;
+	}
 
 	/*
 	 * Load the zone from the master file.	If this fails, we'll
@@ -2635,34 +2694,25 @@ catz_addmodzone_taskaction(isc_task_t *task, isc_event_t *event0) {
  cleanup:
 	if (zone != NULL)
 		dns_zone_detach(&zone);
-	if (zoneconf != NULL)
-		cfg_obj_destroy(cfg->add_parser, &zoneconf);
-	dns_catz_entry_detach(ev->origin, &ev->entry);
-	dns_catz_zone_detach(&ev->origin);
-	dns_view_detach(&ev->view);
-	isc_event_free(ISC_EVENT_PTR(&ev));
 }
 
+/*
+ * Remove a zone deleted from a catalog.  Must be called in exclusive
+ * mode.
+ */
 static void
-catz_delzone_taskaction(isc_task_t *task, isc_event_t *event0) {
-	catz_chgzone_event_t *ev = (catz_chgzone_event_t *) event0;
+catz_delzone_apply(catz_chgzone_event_t *ev, const char *cname) {
 	isc_result_t result;
 	dns_zone_t *zone = NULL;
 	dns_db_t *dbp = NULL;
-	char cname[DNS_NAME_FORMATSIZE];
 	const char * file;
 
-	result = isc_task_beginexclusive(task);
-	RUNTIME_CHECK(result == ISC_R_SUCCESS);
-
-	dns_name_format(dns_catz_entry_getname(ev->entry), cname,
-			DNS_NAME_FORMATSIZE);
 	result = dns_zt_find(ev->view->zonetable,
 			     dns_catz_entry_getname(ev->entry), 0, NULL, &zone);
 	if (result != ISC_R_SUCCESS) {
 		isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
 			      NAMED_LOGMODULE_SERVER, ISC_LOG_WARNING,
-			      "catz: catz_delzone_taskaction: "
+			      "catz: catz_delzone_apply: "
 			      "zone '%s' not found", cname);
 		goto cleanup;
 	}
@@ -2670,7 +2720,7 @@ catz_delzone_taskaction(isc_task_t *task, isc_event_t *event0) {
 	if (!dns_zone_getadded(zone)) {
 		isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
 			      NAMED_LOGMODULE_SERVER, ISC_LOG_WARNING,
-			      "catz: catz_delzone_taskaction: "
+			      "catz: catz_delzone_apply: "
 			      "zone '%s' is not a dynamically added zone",
 			      cname);
 		goto cleanup;
@@ -2679,7 +2729,7 @@ catz_delzone_taskaction(isc_task_t *task, isc_event_t *event0) {
 	if (dns_zone_get_parentcatz(zone) != ev->origin) {
 		isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
 			      NAMED_LOGMODULE_SERVER, ISC_LOG_WARNING,
-			      "catz: catz_delzone_taskaction: zone "
+			      "catz: catz_delzone_apply: zone "
 			      "'%s' exists in multiple catalog zones",
 			      cname);
 		goto cleanup;
@@ -2698,60 +2748,187 @@ catz_delzone_taskaction(isc_task_t *task, isc_event_t *event0) {
 
 	isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
 		      NAMED_LOGMODULE_SERVER, ISC_LOG_WARNING,
-		      "catz: catz_delzone_taskaction: "
+		      "catz: catz_delzone_apply: "
 		      "zone '%s' deleted", cname);
   cleanup:
-	isc_task_endexclusive(task);
 	if (zone != NULL)
 		dns_zone_detach(&zone);
-	dns_catz_entry_detach(ev->origin, &ev->entry);
-	dns_catz_zone_detach(&ev->origin);
-	dns_view_detach(&ev->view);
-	isc_event_free(ISC_EVENT_PTR(&ev));
 }
 
+/*
+ * Maximum number of member zone changes applied per exclusive-mode pass.
+ */
+#define CATZ_CHGZONES_QUANTUM 100
+
+/*
+ * Apply the member zone changes queued by catalog zone updates, up to
+ * CATZ_CHGZONES_QUANTUM of them at a time.  Configurations are generated
+ * and parsed first; then the additions, modifications and deletions are
+ * made in a single exclusive-mode pass, with each affected view thawed
+ * once, rather than pausing the server once per member zone.  Finally
+ * the new zones are loaded.  If more changes are queued, the event is
+ * sent again so that other tasks can run between passes.
+ */
+static void
+catz_chgzones_taskaction(isc_task_t *task, isc_event_t *event0) {
+	catz_cb_data_t *cbd = (catz_cb_data_t *) event0->ev_arg;
+	catz_chgzone_list_t changes;
+	catz_chgzone_event_t *ev, *next;
+	dns_view_t *view = NULL;
+	char nameb[DNS_NAME_FORMATSIZE];
+	unsigned int count = 0;
+	bool more;
+	isc_result_t result;
+
+	ISC_LIST_INIT(changes);
+	LOCK(&cbd->lock);
+	while ((ev = ISC_LIST_HEAD(cbd->changes)) != NULL &&
+	       count < CATZ_CHGZONES_QUANTUM)
+	{
+		ISC_LIST_UNLINK(cbd->changes, ev, ev_link);
+		ISC_LIST_APPEND(changes, ev, ev_link);
+		count++;
+	}
+	more = !ISC_LIST_EMPTY(cbd->changes);
+	UNLOCK(&cbd->lock);
+	count = 0;
+
+	for (ev = ISC_LIST_HEAD(changes); ev != NULL; ev = next) {
+		next = ISC_LIST_NEXT(ev, ev_link);
+		if (ev->ev_type == DNS_EVENT_CATZDELZONE)
+			continue;
+		dns_name_format(dns_catz_entry_getname(ev->entry), nameb,
+				sizeof(nameb));
+		if (catz_addmodzone_prepare(ev, nameb) != ISC_R_SUCCESS) {
+			ISC_LIST_UNLINK(changes, ev, ev_link);
+			catz_chgzone_free(ev);
+		}
+	}
+
+	if (ISC_LIST_EMPTY(changes))
+		goto done;
+
+	result = isc_task_beginexclusive(task);
+	RUNTIME_CHECK(result == ISC_R_SUCCESS);
+	for (ev = ISC_LIST_HEAD(changes);
+	     ev != NULL;
+	     ev = ISC_LIST_NEXT(ev, ev_link))
+	{
+		dns_name_format(dns_catz_entry_getname(ev->entry), nameb,
+				sizeof(nameb));
+		if (ev->ev_type == DNS_EVENT_CATZDELZONE) {
+			catz_delzone_apply(ev, nameb);
+			continue;
+		}
+
+		/* Mark view unfrozen so that zone can be added */
+		if (ev->view != view) {
+			if (view != NULL)
+				dns_view_freeze(view);
+			view = ev->view;
+			dns_view_thaw(view);
+		}
+		result = catz_addmodzone_apply(ev, nameb);
+		ev->configured = (result == ISC_R_SUCCESS);
+		count++;
+	}
+	if (view != NULL)
+		dns_view_freeze(view);
+	isc_task_endexclusive(task);
+
+	isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
+		      NAMED_LOGMODULE_SERVER, ISC_LOG_DEBUG(1),
+		      "catz: applied %u zone additions/modifications "
+		      "in one pass%s", count, more ? ", more queued" : "");
+
+	for (ev = ISC_LIST_HEAD(changes); ev != NULL; ev = next) {
+		next = ISC_LIST_NEXT(ev, ev_link);
+		ISC_LIST_UNLINK(changes, ev, ev_link);
+		if (ev->configured) {
+			dns_name_format(dns_catz_entry_getname(ev->entry),
+					nameb, sizeof(nameb));
+			catz_addmodzone_load(ev, nameb);
+		}
+		catz_chgzone_free(ev);
+	}
+
+ done:
+	/*
+	 * catz_create_chg_task() only sends an event when the queue
+	 * was empty, so the remaining changes are ours to schedule.
+	 */
+	if (more)
+		isc_task_send(task, &event0);
+	else
+		isc_event_free(&event0);
+}
+
+/*
+ * Queue a member zone change.  The changes are applied in batches by
+ * catz_chgzones_taskaction(), which is scheduled on the exclusive task
+ * whenever the queue becomes non-empty.
+ */
 static isc_result_t
 catz_create_chg_task(dns_catz_entry_t *entry, dns_catz_zone_t *origin,
 		     dns_view_t *view, isc_taskmgr_t *taskmgr, void *udata,
 		     isc_eventtype_t type)
 {
+	catz_cb_data_t *cbd = (catz_cb_data_t *) udata;
 	catz_chgzone_event_t *event;
+	isc_event_t *kick = NULL;
 	isc_task_t *task;
 	isc_result_t result;
-	isc_taskaction_t action;
 
 	switch (type) {
 	case DNS_EVENT_CATZADDZONE:
 	case DNS_EVENT_CATZMODZONE:
-		action = catz_addmodzone_taskaction;
-		break;
 	case DNS_EVENT_CATZDELZONE:
-		action = catz_delzone_taskaction;
 		break;
 	default:
 		REQUIRE(0);
 	}
 
 	event = (catz_chgzone_event_t *) isc_event_allocate(view->mctx, origin,
-							    type, action, NULL,
-							    sizeof(*event));
+							    type,
+							    catz_chgzones_taskaction,
+							    cbd, sizeof(*event));
 	if (event == NULL)
 		return (ISC_R_NOMEMORY);
 
-	event->cbd = (catz_cb_data_t *) udata;
+	event->cbd = cbd;
 	event->entry = NULL;
 	event->origin = NULL;
 	event->view = NULL;
 	event->mod = (type == DNS_EVENT_CATZMODZONE);
+	event->zoneconf = NULL;
+	event->zoneobj = NULL;
+	event->configured = false;
 	dns_catz_entry_attach(entry, &event->entry);
 	dns_catz_zone_attach(origin, &event->origin);
 	dns_view_attach(view, &event->view);
 
-	task = NULL;
-	result = isc_taskmgr_excltask(taskmgr, &task);
-	REQUIRE(result == ISC_R_SUCCESS);
-	isc_task_send(task, ISC_EVENT_PTR(&event));
-	isc_task_detach(&task);
+	LOCK(&cbd->lock);
+	if (ISC_LIST_EMPTY(cbd->changes)) {
+		kick = isc_event_allocate(cbd->server->mctx, cbd,
+					  NAMED_EVENT_CATZCHANGES,
+					  catz_chgzones_taskaction, cbd,
+					  sizeof(isc_event_t));
+		if (kick == NULL) {
+			UNLOCK(&cbd->lock);
+			catz_chgzone_free(event);
+			return (ISC_R_NOMEMORY);
+		}
+	}
+	ISC_LIST_APPEND(cbd->changes, event, ev_link);
+	UNLOCK(&cbd->lock);
+
+	if (kick != NULL) {
+		task = NULL;
+		result = isc_taskmgr_excltask(taskmgr, &task);
+		REQUIRE(result == ISC_R_SUCCESS);
+		isc_task_send(task, &kick);
+		isc_task_detach(&task);
+	}
 
 	return (ISC_R_SUCCESS);
 }
@@ -3592,6 +3769,21 @@ configure_dnstap(const cfg_obj_t **maps, dns_view_t *view) {
 	dns_dt_attach(named_g_server->dtenv, &view->dtenv);
 	view->dttypes = dttypes;
 
+	obj = NULL;
+	result = named_config_get(maps, "dnstap-sample", &obj);
+	if (result == ISC_R_SUCCESS) {
+		view->dtsample = cfg_obj_asuint32(obj);
+	}
+
+	obj = NULL;
+	result = named_config_get(maps, "dnstap-sample-prefix", &obj);
+	if (result == ISC_R_SUCCESS) {
+		obj2 = cfg_tuple_get(obj, "ipv4");
+		view->dtprefix4 = cfg_obj_asuint32(obj2);
+		obj2 = cfg_tuple_get(obj, "ipv6");
+		view->dtprefix6 = cfg_obj_asuint32(obj2);
+	}
+
 	result = ISC_R_SUCCESS;
 
  cleanup:
@@ -3683,6 +3875,7 @@ configure_view(dns_view_t *view, dns_viewlist_t *viewlist,
 	const cfg_obj_t *disablelist = NULL;
 	isc_stats_t *resstats = NULL;
 	dns_stats_t *resquerystats = NULL;
+	isc_histo_t *latency = NULL;
 	bool auto_root = false;
 	named_cache_t *nsc;
 	bool zero_no_soattl;
@@ -4100,10 +4293,30 @@ configure_view(dns_view_t *view, dns_viewlist_t *viewlist,
 	INSIST(result == ISC_R_SUCCESS);
 	view->staleanswersenable = cfg_obj_asboolean(obj);
 
+	obj = NULL;
+	result = named_config_get(maps, "send-client-subnet", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	view->sendclientsubnet = cfg_obj_asboolean(obj);
+
+	/*
+	 * Clients whose own CLIENT-SUBNET option may be used, and the
+	 * servers that client subnet information may be sent to.
+	 */
+	CHECK(configure_view_acl(vconfig, config, named_g_config,
+				 "accept-client-subnet", NULL, actx,
+				 named_g_mctx, &view->ecsclients));
+	CHECK(configure_view_acl(vconfig, config, named_g_config,
+				 "client-subnet-servers", NULL, actx,
+				 named_g_mctx, &view->ecsservers));
+
 	result = dns_viewlist_find(&named_g_server->viewlist, view->name,
 				   view->rdclass, &pview);
 	if (result == ISC_R_SUCCESS) {
 		view->staleanswersok = pview->staleanswersok;
+		/*
+		 * Latency histograms are kept across reconfiguration.
+		 */
+		dns_view_getlatency(pview, &latency);
 		dns_view_detach(&pview);
 	} else
 		view->staleanswersok = dns_stale_answer_conf;
@@ -4276,6 +4489,9 @@ configure_view(dns_view_t *view, dns_viewlist_t *viewlist,
 	if (resquerystats == NULL)
 		CHECK(dns_rdatatypestats_create(mctx, &resquerystats));
 	dns_view_setresquerystats(view, resquerystats);
+	if (latency == NULL)
+		CHECK(isc_histo_create(mctx, dns_latency_max, &latency));
+	dns_view_setlatency(view, latency);
 
 	ndisp = 4 * ISC_MIN(named_g_udpdisp, MAX_UDP_DISPATCH);
 	CHECK(dns_view_createresolver(view, named_g_taskmgr, RESOLVER_NTASKS,
@@ -5420,6 +5636,9 @@ configure_view(dns_view_t *view, dns_viewlist_t *viewlist,
 	if (resquerystats != NULL) {
 		dns_stats_detach(&resquerystats);
 	}
+	if (latency != NULL) {
+		isc_histo_detach(&latency);
+	}
 	if (order != NULL) {
 		dns_order_detach(&order);
 	}
@@ -6694,7 +6913,7 @@ dotat(dns_keytable_t *keytable, dns_keynode_t *keynode, void *arg) {
 		result = dns_resolver_createfetch(view->resolver, tatname,
 						  dns_rdatatype_null, domain,
 						  &nameservers, NULL, NULL, 0,
-						  0, 0, NULL, tat->task,
+						  NULL, 0, 0, NULL, tat->task,
 						  tat_done, tat,
 						  &tat->rdataset,
 						  &tat->sigrdataset,
@@ -7848,6 +8067,69 @@ check_lockfile(named_server_t *server, const cfg_obj_t *config,
 	return (ISC_R_FAILURE);
 }
 
+/*
+ * Set up, change or remove the binary query log.  If the log cannot be
+ * created we fall back to text query logging rather than failing the
+ * whole configuration.
+ */
+static void
+configure_querylog_binary(named_server_t *server, const cfg_obj_t **maps) {
+	const cfg_obj_t *obj = NULL, *obj2;
+	const char *path;
+	uint64_t size = QLOG_DEFAULTSIZE;
+	int versions = ISC_LOG_ROLLINFINITE;
+	isc_log_rollsuffix_t suffix = isc_log_rollsuffix_increment;
+	isc_result_t result;
+
+	result = named_config_get(maps, "querylog-binary", &obj);
+	if (result != ISC_R_SUCCESS) {
+		if (server->sctx->qlog != NULL)
+			ns_qlog_destroy(&server->sctx->qlog);
+		return;
+	}
+
+	path = cfg_obj_asstring(cfg_tuple_get(obj, "file"));
+
+	obj2 = cfg_tuple_get(obj, "versions");
+	if (obj2 != NULL && cfg_obj_isuint32(obj2))
+		versions = cfg_obj_asuint32(obj2);
+
+	obj2 = cfg_tuple_get(obj, "size");
+	if (obj2 != NULL && cfg_obj_isuint64(obj2))
+		size = cfg_obj_asuint64(obj2);
+	if (size < NS_QLOG_MINSIZE || size > NS_QLOG_MAXSIZE) {
+		cfg_obj_log(obj, named_g_lctx, ISC_LOG_WARNING,
+			    "querylog-binary size %" PRIu64 " out of range; "
+			    "using %u", size, QLOG_DEFAULTSIZE);
+		size = QLOG_DEFAULTSIZE;
+	}
+
+	obj2 = cfg_tuple_get(obj, "suffix");
+	if (obj2 != NULL && cfg_obj_isstring(obj2) &&
+	    strcasecmp(cfg_obj_asstring(obj2), "timestamp") == 0)
+	{
+		suffix = isc_log_rollsuffix_timestamp;
+	}
+
+	if (server->sctx->qlog != NULL) {
+		if (ns_qlog_matches(server->sctx->qlog, path, (size_t)size,
+				    versions, suffix))
+		{
+			return;
+		}
+		ns_qlog_destroy(&server->sctx->qlog);
+	}
+
+	result = ns_qlog_create(named_g_mctx, path, (size_t)size, versions,
+				suffix, &server->sctx->qlog);
+	if (result != ISC_R_SUCCESS) {
+		cfg_obj_log(obj, named_g_lctx, ISC_LOG_ERROR,
+			    "unable to set up binary query log '%s': %s; "
+			    "using text query logging", path,
+			    isc_result_totext(result));
+	}
+}
+
 static isc_result_t
 load_configuration(const char *filename, named_server_t *server,
 		   bool first_time)
@@ -7865,10 +8147,12 @@ load_configuration(const char *filename, named_server_t *server,
 	dns_view_t *view_next;
 	dns_viewlist_t tmpviewlist;
 	dns_viewlist_t viewlist, builtin_viewlist;
+	dns_viewindex_t *viewindex = NULL, *tmpviewindex;
 	in_port_t listen_port, udpport_low, udpport_high;
 	int i, backlog;
 	int num_zones = 0;
 	bool exclusive = false;
+	bool asynclog, asyncblock;
 	isc_interval_t interval;
 	isc_logconfig_t *logc = NULL;
 	isc_portset_t *v4portset = NULL;
@@ -8278,6 +8562,27 @@ load_configuration(const char *filename, named_server_t *server,
 	server->sctx->transfer_tcp_message_size =
 		(uint16_t) transfer_message_size;
 
+	/* Set the size of the outgoing AXFR cache */
+	obj = NULL;
+	result = named_config_get(maps, "transfer-cache-size", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	if (cfg_obj_isstring(obj)) {
+		INSIST(strcasecmp(cfg_obj_asstring(obj), "unlimited") == 0);
+		ns_xfrcache_setmaxsize(server->sctx->xfrcache, SIZE_MAX);
+	} else {
+		isc_resourcevalue_t value = cfg_obj_asuint64(obj);
+		if (value > SIZE_MAX)
+			value = SIZE_MAX;
+		ns_xfrcache_setmaxsize(server->sctx->xfrcache,
+				       (size_t)value);
+	}
+
+	/*
+	 * Zones may have been removed or reloaded by this
+	 * reconfiguration; start from an empty cache.
+	 */
+	ns_xfrcache_flush(server->sctx->xfrcache);
+
 	/*
 	 * Configure the zone manager.
 	 */
@@ -8624,6 +8929,12 @@ load_configuration(const char *filename, named_server_t *server,
 	/* Now combine the two viewlists into one */
 	ISC_LIST_APPENDLIST(viewlist, builtin_viewlist, link);
 
+	/*
+	 * Compile the views' match-clients, match-destinations and
+	 * match-recursive-only settings for get_matching_view().
+	 */
+	CHECK(dns_viewindex_create(named_g_mctx, &viewlist, &viewindex));
+
 	/*
 	 * Commit any dns_zone_setview() calls on all zones in the new
 	 * view.
@@ -8640,6 +8951,10 @@ load_configuration(const char *filename, named_server_t *server,
 	server->viewlist = viewlist;
 	viewlist = tmpviewlist;
 
+	tmpviewindex = server->viewindex;
+	server->viewindex = viewindex;
+	viewindex = tmpviewindex;
+
 	/* Make the view list available to each of the views */
 	view = ISC_LIST_HEAD(server->viewlist);
 	while (view != NULL) {
@@ -8779,6 +9094,28 @@ load_configuration(const char *filename, named_server_t *server,
 			      "config file");
 	}
 
+	/*
+	 * Switch to or from asynchronous logging.  Failing to start the
+	 * log writer is not fatal; we keep logging synchronously.
+	 */
+	obj = NULL;
+	result = named_config_get(maps, "async-logging", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	asynclog = cfg_obj_asboolean(obj);
+
+	obj = NULL;
+	result = named_config_get(maps, "async-logging-overflow", &obj);
+	INSIST(result == ISC_R_SUCCESS);
+	asyncblock = (strcasecmp(cfg_obj_asstring(obj), "block") == 0);
+
+	result = isc_log_setasync(named_g_lctx, asynclog, 0, asyncblock);
+	if (result != ISC_R_SUCCESS) {
+		isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
+			      NAMED_LOGMODULE_SERVER, ISC_LOG_WARNING,
+			      "unable to enable asynchronous logging: %s",
+			      isc_result_totext(result));
+	}
+
 	/*
 	 * Set the default value of the query logging flag depending
 	 * whether a "queries" category has been defined.  This is
@@ -8821,6 +9158,8 @@ load_configuration(const char *filename, named_server_t *server,
 		}
 	}
 
+	configure_querylog_binary(server, maps);
+
 	obj = NULL;
 	if (options != NULL &&
 	    cfg_map_get(options, "memstatistics", &obj) == ISC_R_SUCCESS)
@@ -9062,6 +9401,10 @@ load_configuration(const char *filename, named_server_t *server,
 		dns_view_detach(&view);
 	}
 
+	if (viewindex != NULL) {
+		dns_viewindex_destroy(&viewindex);
+	}
+
 	ISC_LIST_APPENDLIST(viewlist, builtin_viewlist, link);
 
 	/*
@@ -9359,6 +9702,15 @@ shutdown_server(isc_task_t *task, isc_event_t *event) {
 
 	(void) named_server_saventa(server);
 
+	/*
+	 * Cached AXFR spools hold references to zone databases, which
+	 * would keep the zone tasks alive.
+	 */
+	ns_xfrcache_flush(server->sctx->xfrcache);
+
+	if (server->viewindex != NULL)
+		dns_viewindex_destroy(&server->viewindex);
+
 	for (view = ISC_LIST_HEAD(server->viewlist);
 	     view != NULL;
 	     view = view_next) {
@@ -9400,6 +9752,7 @@ shutdown_server(isc_task_t *task, isc_event_t *event) {
 #ifdef HAVE_GEOIP
 	dns_geoip_shutdown();
 #endif
+	dns_acl_shutdown();
 
 	dns_db_detach(&server->in_roothints);
 
@@ -9418,43 +9771,15 @@ get_matching_view(isc_netaddr_t *srcaddr, isc_netaddr_t *destaddr,
 		  dns_message_t *message, dns_aclenv_t *env,
 		  isc_result_t *sigresult, dns_view_t **viewp)
 {
-	dns_view_t *view;
-
 	REQUIRE(message != NULL);
 	REQUIRE(sigresult != NULL);
 	REQUIRE(viewp != NULL && *viewp == NULL);
 
-	for (view = ISC_LIST_HEAD(named_g_server->viewlist);
-	     view != NULL;
-	     view = ISC_LIST_NEXT(view, link))
-	{
-		if (message->rdclass == view->rdclass ||
-		    message->rdclass == dns_rdataclass_any)
-		{
-			dns_name_t *tsig = NULL;
-
-			*sigresult = dns_message_rechecksig(message, view);
-			if (*sigresult == ISC_R_SUCCESS) {
-				dns_tsigkey_t *tsigkey;
-
-				tsigkey = message->tsigkey;
-				tsig = dns_tsigkey_identity(tsigkey);
-			}
-
-			if (dns_acl_allowed(srcaddr, tsig,
-					    view->matchclients, env) &&
-			    dns_acl_allowed(destaddr, tsig,
-					    view->matchdestinations, env) &&
-			    !(view->matchrecursiveonly &&
-			      (message->flags & DNS_MESSAGEFLAG_RD) == 0))
-			{
-				dns_view_attach(view, viewp);
-				return (ISC_R_SUCCESS);
-			}
-		}
-	}
+	if (named_g_server->viewindex == NULL)
+		return (ISC_R_NOTFOUND);
 
-	return (ISC_R_NOTFOUND);
+	return (dns_viewindex_find(named_g_server->viewindex, srcaddr,
+				   destaddr, message, env, sigresult, viewp));
 }
 
 void
@@ -9477,6 +9802,7 @@ named_server_create(isc_mem_t *mctx, named_server_t **serverp) {
 	/* Initialize server data structures. */
 	server->interfacemgr = NULL;
 	ISC_LIST_INIT(server->viewlist);
+	server->viewindex = NULL;
 	server->in_roothints = NULL;
 
 	/* Must be first. */
@@ -9489,6 +9815,9 @@ named_server_create(isc_mem_t *mctx, named_server_t **serverp) {
 
 	CHECKFATAL(isc_mutex_init(&server->reload_event_lock),
 		   "initializing reload event lock");
+	CHECKFATAL(isc_mutex_init(&ns_catz_cbdata.lock),
+		   "initializing catalog zone change lock");
+	ISC_LIST_INIT(ns_catz_cbdata.changes);
 	server->reload_event =
 		isc_event_allocate(named_g_mctx, server,
 				   NAMED_EVENT_RELOAD,
@@ -9661,6 +9990,8 @@ named_server_destroy(named_server_t **serverp) {
 
 	isc_event_free(&server->reload_event);
 
+	DESTROYLOCK(&ns_catz_cbdata.lock);
+
 	INSIST(ISC_LIST_EMPTY(server->viewlist));
 	INSIST(ISC_LIST_EMPTY(server->cachelist));
 
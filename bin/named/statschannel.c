@@ -13,14 +13,17 @@
 
 #include <config.h>
 
+#include <ctype.h>
 #include <inttypes.h>
 #include <stdbool.h>
 
 #include <isc/buffer.h>
+#include <isc/histo.h>
 #include <isc/httpd.h>
 #include <isc/json.h>
 #include <isc/mem.h>
 #include <isc/once.h>
+#include <isc/parseint.h>
 #include <isc/print.h>
 #include <isc/socket.h>
 #include <isc/stats.h>
@@ -30,6 +33,8 @@
 
 #include <dns/cache.h>
 #include <dns/db.h>
+#include <dns/fixedname.h>
+#include <dns/name.h>
 #include <dns/opcode.h>
 #include <dns/rcode.h>
 #include <dns/rdataclass.h>
@@ -37,6 +42,7 @@
 #include <dns/resolver.h>
 #include <dns/stats.h>
 #include <dns/view.h>
+#include <dns/zone.h>
 #include <dns/zt.h>
 
 #include <ns/stats.h>
@@ -76,13 +82,6 @@ stats_dumparg {
 
 static isc_once_t once = ISC_ONCE_INIT;
 
-#if defined(HAVE_LIBXML2) || defined(HAVE_JSON)
-#define EXTENDED_STATS
-#else
-#undef EXTENDED_STATS
-#endif
-
-#ifdef EXTENDED_STATS
 static const char *
 user_zonetype( dns_zone_t *zone ) {
 	dns_zonetype_t ztype;
@@ -115,7 +114,6 @@ user_zonetype( dns_zone_t *zone ) {
 		/* empty */;
 	return (tp->string);
 }
-#endif
 
 /*%
  * Statistics descriptions.  These could be statistically initialized at
@@ -134,7 +132,6 @@ static const char *tcpinsizestats_desc[dns_sizecounter_in_max];
 static const char *tcpoutsizestats_desc[dns_sizecounter_out_max];
 static const char *dnstapstats_desc[dns_dnstapcounter_max];
 static const char *gluecachestats_desc[dns_gluecachestatscounter_max];
-#if defined(EXTENDED_STATS)
 static const char *nsstats_xmldesc[ns_statscounter_max];
 static const char *resstats_xmldesc[dns_resstatscounter_max];
 static const char *adbstats_xmldesc[dns_adbstats_max];
@@ -147,20 +144,6 @@ static const char *tcpinsizestats_xmldesc[dns_sizecounter_in_max];
 static const char *tcpoutsizestats_xmldesc[dns_sizecounter_out_max];
 static const char *dnstapstats_xmldesc[dns_dnstapcounter_max];
 static const char *gluecachestats_xmldesc[dns_gluecachestatscounter_max];
-#else
-#define nsstats_xmldesc NULL
-#define resstats_xmldesc NULL
-#define adbstats_xmldesc NULL
-#define zonestats_xmldesc NULL
-#define sockstats_xmldesc NULL
-#define dnssecstats_xmldesc NULL
-#define udpinsizestats_xmldesc NULL
-#define udpoutsizestats_xmldesc NULL
-#define tcpinsizestats_xmldesc NULL
-#define tcpoutsizestats_xmldesc NULL
-#define dnstapstats_xmldesc NULL
-#define gluecachestats_xmldesc NULL
-#endif	/* EXTENDED_STATS */
 
 #define TRY0(a) do { xmlrc = (a); if (xmlrc < 0) goto error; } while(0)
 
@@ -188,17 +171,10 @@ set_desc(int counter, int maxcounter, const char *fdesc, const char **fdescs,
 {
 	REQUIRE(counter < maxcounter);
 	REQUIRE(fdescs != NULL && fdescs[counter] == NULL);
-#if defined(EXTENDED_STATS)
 	REQUIRE(xdescs != NULL && xdescs[counter] == NULL);
-#endif
 
 	fdescs[counter] = fdesc;
-#if defined(EXTENDED_STATS)
 	xdescs[counter] = xdesc;
-#else
-	UNUSED(xdesc);
-	UNUSED(xdescs);
-#endif
 }
 
 static void
@@ -208,10 +184,8 @@ init_desc(void) {
 	/* Initialize name server statistics */
 	for (i = 0; i < ns_statscounter_max; i++)
 		nsstats_desc[i] = NULL;
-#if defined(EXTENDED_STATS)
 	for (i = 0; i < ns_statscounter_max; i++)
 		nsstats_xmldesc[i] = NULL;
-#endif
 
 #define SET_NSSTATDESC(counterid, desc, xmldesc) \
 	do { \
@@ -314,15 +288,19 @@ init_desc(void) {
 		       "QryUsedStale");
 	SET_NSSTATDESC(prefetch, "queries triggered prefetch", "Prefetch");
 	SET_NSSTATDESC(keytagopt, "Keytag option received", "KeyTagOpt");
+	SET_NSSTATDESC(logdropped,
+		       "log messages dropped by asynchronous logging",
+		       "LogDropped");
+	SET_NSSTATDESC(qlogdropped,
+		       "binary query log records dropped",
+		       "QryLogDropped");
 	INSIST(i == ns_statscounter_max);
 
 	/* Initialize resolver statistics */
 	for (i = 0; i < dns_resstatscounter_max; i++)
 		resstats_desc[i] = NULL;
-#if defined(EXTENDED_STATS)
 	for (i = 0; i < dns_resstatscounter_max; i++)
 		resstats_xmldesc[i] = NULL;
-#endif
 
 #define SET_RESSTATDESC(counterid, desc, xmldesc) \
 	do { \
@@ -408,10 +386,8 @@ init_desc(void) {
 	/* Initialize adb statistics */
 	for (i = 0; i < dns_adbstats_max; i++)
 		adbstats_desc[i] = NULL;
-#if defined(EXTENDED_STATS)
 	for (i = 0; i < dns_adbstats_max; i++)
 		adbstats_xmldesc[i] = NULL;
-#endif
 
 #define SET_ADBSTATDESC(id, desc, xmldesc) \
 	do { \
@@ -430,10 +406,8 @@ init_desc(void) {
 	/* Initialize zone statistics */
 	for (i = 0; i < dns_zonestatscounter_max; i++)
 		zonestats_desc[i] = NULL;
-#if defined(EXTENDED_STATS)
 	for (i = 0; i < dns_zonestatscounter_max; i++)
 		zonestats_xmldesc[i] = NULL;
-#endif
 
 #define SET_ZONESTATDESC(counterid, desc, xmldesc) \
 	do { \
@@ -458,15 +432,17 @@ init_desc(void) {
 	SET_ZONESTATDESC(xfrsuccess, "transfer requests succeeded",
 			 "XfrSuccess");
 	SET_ZONESTATDESC(xfrfail, "transfer requests failed", "XfrFail");
+	SET_ZONESTATDESC(journaldeferred, "journal commits with deferred sync",
+			 "JournalDeferred");
+	SET_ZONESTATDESC(journalsync, "deferred journal syncs",
+			 "JournalSync");
 	INSIST(i == dns_zonestatscounter_max);
 
 	/* Initialize socket statistics */
 	for (i = 0; i < isc_sockstatscounter_max; i++)
 		sockstats_desc[i] = NULL;
-#if defined(EXTENDED_STATS)
 	for (i = 0; i < isc_sockstatscounter_max; i++)
 		sockstats_xmldesc[i] = NULL;
-#endif
 
 #define SET_SOCKSTATDESC(counterid, desc, xmldesc) \
 	do { \
@@ -582,10 +558,8 @@ init_desc(void) {
 	/* Initialize DNSSEC statistics */
 	for (i = 0; i < dns_dnssecstats_max; i++)
 		dnssecstats_desc[i] = NULL;
-#if defined(EXTENDED_STATS)
 	for (i = 0; i < dns_dnssecstats_max; i++)
 		dnssecstats_xmldesc[i] = NULL;
-#endif
 
 #define SET_DNSSECSTATDESC(counterid, desc, xmldesc) \
 	do { \
@@ -609,10 +583,8 @@ init_desc(void) {
 	/* Initialize dnstap statistics */
 	for (i = 0; i < dns_dnstapcounter_max; i++)
 		dnstapstats_desc[i] = NULL;
-#if defined(EXTENDED_STATS)
 	for (i = 0; i < dns_dnstapcounter_max; i++)
 		dnstapstats_xmldesc[i] = NULL;
-#endif
 
 #define SET_DNSTAPSTATDESC(counterid, desc, xmldesc) \
 	do { \
@@ -668,7 +640,6 @@ init_desc(void) {
 		INSIST(dnstapstats_desc[i] != NULL);
 	for (i = 0; i < dns_gluecachestatscounter_max; i++)
 		INSIST(gluecachestats_desc[i] != NULL);
-#if defined(EXTENDED_STATS)
 	for (i = 0; i < ns_statscounter_max; i++)
 		INSIST(nsstats_xmldesc[i] != NULL);
 	for (i = 0; i < dns_resstatscounter_max; i++)
@@ -685,24 +656,19 @@ init_desc(void) {
 		INSIST(dnstapstats_xmldesc[i] != NULL);
 	for (i = 0; i < dns_gluecachestatscounter_max; i++)
 		INSIST(gluecachestats_xmldesc[i] != NULL);
-#endif
 
 	/* Initialize traffic size statistics */
 	for (i = 0; i < dns_sizecounter_in_max; i++) {
 		udpinsizestats_desc[i] = NULL;
 		tcpinsizestats_desc[i] = NULL;
-#if defined(EXTENDED_STATS)
 		udpinsizestats_xmldesc[i] = NULL;
 		tcpinsizestats_xmldesc[i] = NULL;
-#endif
 	}
 	for (i = 0; i < dns_sizecounter_out_max; i++) {
 		udpoutsizestats_desc[i] = NULL;
 		tcpoutsizestats_desc[i] = NULL;
-#if defined(EXTENDED_STATS)
 		udpoutsizestats_xmldesc[i] = NULL;
 		tcpoutsizestats_xmldesc[i] = NULL;
-#endif
 	}
 
 #define SET_SIZESTATDESC(counterid, desc, xmldesc, inout) \
@@ -1023,7 +989,6 @@ init_desc(void) {
 		INSIST(udpoutsizestats_desc[i] != NULL);
 		INSIST(tcpoutsizestats_desc[i] != NULL);
 	}
-#if defined(EXTENDED_STATS)
 	for (i = 0; i < ns_statscounter_max; i++)
 		INSIST(nsstats_xmldesc[i] != NULL);
 	for (i = 0; i < dns_resstatscounter_max; i++)
@@ -1044,7 +1009,17 @@ init_desc(void) {
 		INSIST(udpoutsizestats_xmldesc[i] != NULL);
 		INSIST(tcpoutsizestats_xmldesc[i] != NULL);
 	}
-#endif
+}
+
+/*%
+ * The number of dropped log messages is kept by the logging context;
+ * copy it into the server statistics before they are dumped.
+ */
+static void
+update_logstats(named_server_t *server) {
+	isc_stats_set(ns_stats_get(server->sctx->nsstats),
+		      isc_log_getdropped(named_g_lctx),
+		      ns_statscounter_logdropped);
 }
 
 /*%
@@ -1075,7 +1050,7 @@ dump_counters(isc_stats_t *stats, isc_statsformat_t type, void *arg,
 	json_object *job, *cat, *counter;
 #endif
 
-#if !defined(EXTENDED_STATS)
+#if !defined(HAVE_LIBXML2) && !defined(HAVE_JSON)
 	UNUSED(category);
 #endif
 
@@ -1181,6 +1156,222 @@ dump_counters(isc_stats_t *stats, isc_statsformat_t type, void *arg,
 #endif
 }
 
+/*%
+ * Latency histograms (see dns/stats.h).
+ */
+static const char *latency_desc[dns_latency_max] = {
+	"client queries",
+	"recursions",
+	"resolver fetches",
+	"upstream server round trips"
+};
+
+#ifdef HAVE_LIBXML2
+static const char *latency_xmldesc[dns_latency_max] = {
+	"Query",
+	"Recursion",
+	"Fetch",
+	"RTT"
+};
+#endif
+
+static const double latency_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+static const char *latency_quantiledesc[] = { "p50", "p90", "p99", "p999" };
+
+#define LATENCY_NQUANTILES \
+	(sizeof(latency_quantiles) / sizeof(latency_quantiles[0]))
+
+#if defined(HAVE_LIBXML2) || defined(HAVE_JSON)
+static void
+latencybucket_dump(uint64_t min, uint64_t max, uint64_t count, void *arg) {
+	stats_dumparg_t *dumparg = arg;
+#ifdef HAVE_LIBXML2
+	xmlTextWriterPtr writer;
+	int xmlrc;
+#endif
+#ifdef HAVE_JSON
+	json_object *bucket, *obj;
+#endif
+
+	if (dumparg->result != ISC_R_SUCCESS)
+		return;
+
+	switch (dumparg->type) {
+	case isc_statsformat_file:
+		break;
+	case isc_statsformat_xml:
+#ifdef HAVE_LIBXML2
+		writer = dumparg->arg;
+		TRY0(xmlTextWriterStartElement(writer, ISC_XMLCHAR "bucket"));
+		TRY0(xmlTextWriterWriteFormatAttribute(writer,
+						       ISC_XMLCHAR "min",
+						       "%" PRIu64, min));
+		TRY0(xmlTextWriterWriteFormatAttribute(writer,
+						       ISC_XMLCHAR "max",
+						       "%" PRIu64, max));
+		TRY0(xmlTextWriterWriteFormatString(writer, "%" PRIu64,
+						    count));
+		TRY0(xmlTextWriterEndElement(writer)); /* bucket */
+#endif
+		break;
+	case isc_statsformat_json:
+#ifdef HAVE_JSON
+		bucket = json_object_new_array();
+		if (bucket == NULL) {
+			dumparg->result = ISC_R_NOMEMORY;
+			return;
+		}
+		json_object_array_add(dumparg->arg, bucket);
+		obj = json_object_new_int64(min);
+		if (obj == NULL) {
+			dumparg->result = ISC_R_NOMEMORY;
+			return;
+		}
+		json_object_array_add(bucket, obj);
+		obj = json_object_new_int64(max);
+		if (obj == NULL) {
+			dumparg->result = ISC_R_NOMEMORY;
+			return;
+		}
+		json_object_array_add(bucket, obj);
+		obj = json_object_new_int64(count);
+		if (obj == NULL) {
+			dumparg->result = ISC_R_NOMEMORY;
+			return;
+		}
+		json_object_array_add(bucket, obj);
+#endif
+		break;
+	}
+	return;
+#ifdef HAVE_LIBXML2
+ error:
+	isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
+		      NAMED_LOGMODULE_SERVER, ISC_LOG_ERROR,
+		      "failed at latencybucket_dump()");
+	dumparg->result = ISC_R_FAILURE;
+#endif
+}
+#endif /* HAVE_LIBXML2 || HAVE_JSON */
+
+/*%
+ * Dump the latency histograms in 'histo': the number of samples, their
+ * mean and some quantiles and, for XML and JSON, the non-empty buckets.
+ */
+static isc_result_t
+dump_latency(isc_histo_t *histo, isc_statsformat_t type, void *arg) {
+	uint64_t quantiles[LATENCY_NQUANTILES];
+	uint64_t count, sum;
+	unsigned int q;
+	int i;
+	FILE *fp;
+#if defined(HAVE_LIBXML2) || defined(HAVE_JSON)
+	stats_dumparg_t dumparg;
+#endif
+#ifdef HAVE_LIBXML2
+	xmlTextWriterPtr writer;
+	int xmlrc;
+#endif
+#ifdef HAVE_JSON
+	json_object *job, *h, *obj, *buckets;
+#endif
+
+	for (i = 0; i < dns_latency_max; i++) {
+		isc_histo_totals(histo, i, &count, &sum);
+		isc_histo_quantiles(histo, i, LATENCY_NQUANTILES,
+				    latency_quantiles, quantiles);
+
+		switch (type) {
+		case isc_statsformat_file:
+			fp = arg;
+			if (count == 0)
+				break;
+			fprintf(fp, "%20" PRIu64 " %s: mean %" PRIu64,
+				count, latency_desc[i], sum / count);
+			for (q = 0; q < LATENCY_NQUANTILES; q++)
+				fprintf(fp, " %s %" PRIu64,
+					latency_quantiledesc[q], quantiles[q]);
+			fprintf(fp, "\n");
+			break;
+		case isc_statsformat_xml:
+#ifdef HAVE_LIBXML2
+			writer = arg;
+			TRY0(xmlTextWriterStartElement(writer,
+						       ISC_XMLCHAR "latency"));
+			TRY0(xmlTextWriterWriteAttribute(writer,
+					 ISC_XMLCHAR "name",
+					 ISC_XMLCHAR latency_xmldesc[i]));
+			TRY0(xmlTextWriterWriteFormatAttribute(writer,
+					 ISC_XMLCHAR "count", "%" PRIu64,
+					 count));
+			TRY0(xmlTextWriterWriteFormatAttribute(writer,
+					 ISC_XMLCHAR "sum", "%" PRIu64, sum));
+			for (q = 0; q < LATENCY_NQUANTILES; q++) {
+				TRY0(xmlTextWriterStartElement(writer,
+						ISC_XMLCHAR "quantile"));
+				TRY0(xmlTextWriterWriteAttribute(writer,
+					 ISC_XMLCHAR "name",
+					 ISC_XMLCHAR latency_quantiledesc[q]));
+				TRY0(xmlTextWriterWriteFormatString(writer,
+						"%" PRIu64, quantiles[q]));
+				TRY0(xmlTextWriterEndElement(writer));
+			}
+			dumparg.type = type;
+			dumparg.arg = writer;
+			dumparg.result = ISC_R_SUCCESS;
+			isc_histo_dump(histo, i, latencybucket_dump, &dumparg);
+			if (dumparg.result != ISC_R_SUCCESS)
+				return (dumparg.result);
+			TRY0(xmlTextWriterEndElement(writer)); /* latency */
+#endif
+			break;
+		case isc_statsformat_json:
+#ifdef HAVE_JSON
+			job = arg;
+			h = json_object_new_object();
+			if (h == NULL)
+				return (ISC_R_NOMEMORY);
+			json_object_object_add(job, latency_xmldesc[i], h);
+			obj = json_object_new_int64(count);
+			if (obj == NULL)
+				return (ISC_R_NOMEMORY);
+			json_object_object_add(h, "count", obj);
+			obj = json_object_new_int64(sum);
+			if (obj == NULL)
+				return (ISC_R_NOMEMORY);
+			json_object_object_add(h, "sum", obj);
+			for (q = 0; q < LATENCY_NQUANTILES; q++) {
+				obj = json_object_new_int64(quantiles[q]);
+				if (obj == NULL)
+					return (ISC_R_NOMEMORY);
+				json_object_object_add(h,
+						       latency_quantiledesc[q],
+						       obj);
+			}
+			buckets = json_object_new_array();
+			if (buckets == NULL)
+				return (ISC_R_NOMEMORY);
+			json_object_object_add(h, "buckets", buckets);
+			dumparg.type = type;
+			dumparg.arg = buckets;
+			dumparg.result = ISC_R_SUCCESS;
+			isc_histo_dump(histo, i, latencybucket_dump, &dumparg);
+			if (dumparg.result != ISC_R_SUCCESS)
+				return (dumparg.result);
+#endif
+			break;
+		}
+	}
+	return (ISC_R_SUCCESS);
+#ifdef HAVE_LIBXML2
+ error:
+	isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
+		      NAMED_LOGMODULE_SERVER, ISC_LOG_ERROR,
+		      "failed at dump_latency()");
+	return (ISC_R_FAILURE);
+#endif
+}
+
 static void
 rdtypestat_dump(dns_rdatastatstype_t type, uint64_t val, void *arg) {
 	char typebuf[64];
@@ -1685,6 +1876,7 @@ generatexml(named_server_t *server, uint32_t flags,
 		TRY0(xmlTextWriterWriteAttribute(writer, ISC_XMLCHAR "type",
 						 ISC_XMLCHAR "nsstat"));
 
+		update_logstats(server);
 		result = dump_counters(ns_stats_get(server->sctx->nsstats),
 				       isc_statsformat_xml,
 				       writer, NULL, nsstats_xmldesc,
@@ -2000,6 +2192,17 @@ generatexml(named_server_t *server, uint32_t flags,
 		TRY0(dns_cache_renderxml(view->cache, writer));
 		TRY0(xmlTextWriterEndElement(writer)); /* </cachestats> */
 
+		/* <latencies> */
+		if (view->latency != NULL) {
+			TRY0(xmlTextWriterStartElement(writer,
+						       ISC_XMLCHAR "latencies"));
+			result = dump_latency(view->latency,
+					      isc_statsformat_xml, writer);
+			if (result != ISC_R_SUCCESS)
+				goto error;
+			TRY0(xmlTextWriterEndElement(writer)); /* </latencies> */
+		}
+
 		TRY0(xmlTextWriterEndElement(writer)); /* view */
 
 		view = ISC_LIST_NEXT(view, link);
@@ -2507,6 +2710,7 @@ generatejson(named_server_t *server, size_t *msglen,
 		dumparg.result = ISC_R_SUCCESS;
 		dumparg.arg = counters;
 
+		update_logstats(server);
 		result = dump_counters(ns_stats_get(server->sctx->nsstats),
 				       isc_statsformat_json,
 				       counters, NULL, nsstats_xmldesc,
@@ -2732,6 +2936,22 @@ generatejson(named_server_t *server, size_t *msglen,
 					json_object_object_add(res, "adb",
 							       counters);
 				}
+
+				if (view->latency != NULL) {
+					counters = json_object_new_object();
+					CHECKMEM(counters);
+
+					result = dump_latency(view->latency,
+							isc_statsformat_json,
+							counters);
+					if (result != ISC_R_SUCCESS) {
+						json_object_put(counters);
+						goto error;
+					}
+
+					json_object_object_add(v, "latency",
+							       counters);
+				}
 			}
 
 			view = ISC_LIST_NEXT(view, link);
@@ -3101,88 +3321,1093 @@ render_json_traffic(const char *url, isc_httpdurl_t *urlinfo,
 
 #endif /* HAVE_JSON */
 
-static isc_result_t
-render_xsl(const char *url, isc_httpdurl_t *urlinfo,
-	   const char *querystring, const char *headers,
-	   void *args, unsigned int *retcode, const char **retmsg,
-	   const char **mimetype, isc_buffer_t *b,
-	   isc_httpdfree_t **freecb, void **freecb_args)
-{
-	isc_result_t result;
-	char *_headers = NULL;
+/*
+ * Metrics in the Prometheus text exposition format.
+ *
+ * Unlike the XML and JSON documents, which are built in memory and
+ * then sent, metrics are streamed: each call to metrics_next() renders
+ * as much as fits into the buffer supplied by the HTTP server, and
+ * remembers where it stopped.  No lock is held between calls, so a
+ * scrape of a server with many zones does not block other work, and
+ * memory use does not grow with the number of zones.
+ *
+ * Each metric family is rendered in turn.  A family is rendered once
+ * for the server, once per view, or once per zone; one sample block
+ * (the samples for the server, a view or a zone) is the unit that is
+ * either written completely or, if it does not fit, rolled back and
+ * written into the next buffer.  Zones are walked in DNSSEC order with
+ * dns_zt_applyfrom(), resuming after the last zone rendered.
+ *
+ * The zone metrics can be filtered and paginated with query
+ * parameters:
+ *
+ *	view=NAME	only views called NAME
+ *	zone=NAME	only zones at or below NAME
+ *	after=NAME	only zones whose names sort after NAME
+ *	limit=N		at most N zones per view
+ *
+ * When a view has more zones than 'limit', a "# next:" comment
+ * gives the URL of the next page.
+ */
+#define METRICS_SERVER		0x01	/* server and view families */
+#define METRICS_ZONES		0x02	/* zone families */
+#define METRICS_ALL		0x03
 
-	UNUSED(url);
-	UNUSED(querystring);
-	UNUSED(args);
+#define METRICS_MIMETYPE	"text/plain; version=0.0.4"
 
-	*freecb = NULL;
-	*freecb_args = NULL;
-	*mimetype = "text/xslt+xml";
+#ifndef CHECK
+#define CHECK(m) do { \
+	result = (m); \
+	if (result != ISC_R_SUCCESS) \
+		goto error; \
+} while (0)
+#endif
 
-	if (urlinfo->isstatic) {
-		isc_time_t when;
-		char *line, *saveptr;
-		const char *if_modified_since = "If-Modified-Since: ";
-		_headers = strdup(headers);
+typedef enum {
+	metrics_scope_server,
+	metrics_scope_view,
+	metrics_scope_zone
+} metrics_scope_t;
+
+typedef struct metrics metrics_t;
+
+typedef struct metrics_family {
+	const char		*name;
+	const char		*type;
+	const char		*help;
+	metrics_scope_t		scope;
+	isc_result_t		(*render)(metrics_t *, dns_view_t *,
+					  dns_zone_t *);
+} metrics_family_t;
+
+struct metrics {
+	isc_mem_t		*mctx;
+	named_server_t		*server;
+	unsigned int		flags;
+	const char		*error;		/* bad request */
+
+	/* Filters */
+	char			*viewname;
+	dns_fixedname_t		fzone;
+	dns_name_t		*zone;
+	dns_fixedname_t		fafter;
+	dns_name_t		*after;
+	uint32_t		limit;
+
+	/* Position */
+	unsigned int		family;
+	const char		*name;		/* of the family */
+	bool			header;		/* HELP and TYPE written */
+	bool			nextlinks;	/* write "# next:" comments */
+	dns_view_t		*view;		/* weak reference */
+	dns_fixedname_t		fcursor;
+	dns_name_t		*cursor;	/* last zone in 'view' */
+	uint32_t		count;		/* zones seen in 'view' */
+
+	/* Rendering */
+	isc_buffer_t		*b;
+	char			labels[3 * DNS_NAME_FORMATSIZE];
+	isc_result_t		result;
+};
 
-		if (_headers == NULL) {
-			goto send;
+/*%
+ * Append 's' to 'b' escaped as a label value.
+ */
+static isc_result_t
+metrics_putlabel(isc_buffer_t *b, const char *s) {
+	for (; *s != '\0'; s++) {
+		if (isc_buffer_availablelength(b) < 2)
+			return (ISC_R_NOSPACE);
+		switch (*s) {
+		case '\\':
+		case '"':
+			isc_buffer_putuint8(b, '\\');
+			isc_buffer_putuint8(b, *s);
+			break;
+		case '\n':
+			isc_buffer_putuint8(b, '\\');
+			isc_buffer_putuint8(b, 'n');
+			break;
+		default:
+			isc_buffer_putuint8(b, *s);
 		}
+	}
+	return (ISC_R_SUCCESS);
+}
 
-		saveptr = NULL;
-		for (line = strtok_r(_headers, "\n", &saveptr);
-		     line;
-		     line = strtok_r(NULL, "\n", &saveptr)) {
-			if (strncasecmp(line, if_modified_since,
-					strlen(if_modified_since)) == 0) {
-				time_t t1, t2;
-				line += strlen(if_modified_since);
-				result = isc_time_parsehttptimestamp(line, &when);
-				if (result != ISC_R_SUCCESS) {
-					goto send;
-				}
-
-				result = isc_time_secondsastimet(&when, &t1);
-				if (result != ISC_R_SUCCESS) {
-					goto send;
-				}
-
-				result = isc_time_secondsastimet(&urlinfo->loadtime, &t2);
-				if (result != ISC_R_SUCCESS) {
-					goto send;
-				}
-
-				if (t1 < t2) {
-					goto send;
-				}
-
-				*retcode = 304;
-				*retmsg = "Not modified";
-				goto end;
-			}
+/*%
+ * Append 's' to 'b' percent-encoded for use in a query string.
+ */
+static isc_result_t
+metrics_putencoded(isc_buffer_t *b, const char *s) {
+	static const char hex[] = "0123456789ABCDEF";
+	unsigned char c;
+
+	for (; *s != '\0'; s++) {
+		c = *s;
+		if (isc_buffer_availablelength(b) < 3)
+			return (ISC_R_NOSPACE);
+		if (isalnum(c) || c == '-' || c == '.' || c == '_' ||
+		    c == '~')
+		{
+			isc_buffer_putuint8(b, c);
+		} else {
+			isc_buffer_putuint8(b, '%');
+			isc_buffer_putuint8(b, hex[c >> 4]);
+			isc_buffer_putuint8(b, hex[c & 0xf]);
 		}
 	}
-
- send:
-	*retcode = 200;
-	*retmsg = "OK";
-	isc_buffer_reinit(b, xslmsg, strlen(xslmsg));
-	isc_buffer_add(b, strlen(xslmsg));
-end:
-	free(_headers);
 	return (ISC_R_SUCCESS);
 }
 
-static void
-shutdown_listener(named_statschannel_t *listener) {
-	char socktext[ISC_SOCKADDR_FORMATSIZE];
-	isc_sockaddr_format(&listener->address, socktext, sizeof(socktext));
-	isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
-		      NAMED_LOGMODULE_SERVER, ISC_LOG_NOTICE,
-		      "stopping statistics channel on %s",
-		      socktext);
+/*%
+ * Set m->labels to the view and zone labels of a sample block,
+ * including a trailing comma if there are any.
+ */
+static isc_result_t
+metrics_setlabels(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	char zonebuf[DNS_NAME_FORMATSIZE];
+	isc_buffer_t b;
+	isc_result_t result;
 
-	isc_httpdmgr_shutdown(&listener->httpdmgr);
+	isc_buffer_init(&b, m->labels, sizeof(m->labels) - 1);
+	if (view != NULL) {
+		CHECK(isc_buffer_printf(&b, "view=\""));
+		CHECK(metrics_putlabel(&b, view->name));
+		CHECK(isc_buffer_printf(&b, "\","));
+	}
+	if (zone != NULL) {
+		dns_name_format(dns_zone_getorigin(zone), zonebuf,
+				sizeof(zonebuf));
+		CHECK(isc_buffer_printf(&b, "zone=\""));
+		CHECK(metrics_putlabel(&b, zonebuf));
+		CHECK(isc_buffer_printf(&b, "\","));
+	}
+	m->labels[isc_buffer_usedlength(&b)] = '\0';
+	return (ISC_R_SUCCESS);
+
+ error:
+	return (result);
+}
+
+/*%
+ * Write one sample for each counter in 'stats', labelled with the
+ * counter's short name.
+ */
+static isc_result_t
+metrics_counters(metrics_t *m, isc_stats_t *stats, const char **desc,
+		 int ncounters, int *indices, uint64_t *values, int options)
+{
+		stats_dumparg_t dumparg;
+	isc_result_t result;
+	int i, idx;
+
+	dumparg.ncounters = ncounters;
+	dumparg.counterindices = indices;
+	dumparg.countervalues = values;
+
+	memset(values, 0, sizeof(values[0]) * ncounters);
+	isc_stats_dump(stats, generalstat_dump, &dumparg, options);
+
+	for (i = 0; i < ncounters; i++) {
+		idx = indices[i];
+		if (values[idx] == 0 &&
+		    (options & ISC_STATSDUMP_VERBOSE) == 0)
+		{
+			continue;
+		}
+		result = isc_buffer_printf(m->b, "%s{%sname=\"%s\"} %" PRIu64
+					   "\n", m->name, m->labels, desc[idx],
+					   values[idx]);
+		if (result != ISC_R_SUCCESS)
+			return (result);
+	}
+
+	return (ISC_R_SUCCESS);
+}
+
+static void
+metrics_opcode(dns_opcode_t code, uint64_t val, void *arg) {
+	metrics_t *m = arg;
+	char codebuf[64];
+	isc_buffer_t b;
+
+	if (m->result != ISC_R_SUCCESS)
+		return;
+
+	isc_buffer_init(&b, codebuf, sizeof(codebuf) - 1);
+	dns_opcode_totext(code, &b);
+	codebuf[isc_buffer_usedlength(&b)] = '\0';
+
+	m->result = isc_buffer_printf(m->b, "%s{%sopcode=\"%s\"} %" PRIu64
+				      "\n", m->name,
+				      m->labels, codebuf, val);
+}
+
+static void
+metrics_rcode(dns_rcode_t code, uint64_t val, void *arg) {
+	metrics_t *m = arg;
+	char codebuf[64];
+	isc_buffer_t b;
+
+	if (m->result != ISC_R_SUCCESS)
+		return;
+
+	isc_buffer_init(&b, codebuf, sizeof(codebuf) - 1);
+	dns_rcode_totext(code, &b);
+	codebuf[isc_buffer_usedlength(&b)] = '\0';
+
+	m->result = isc_buffer_printf(m->b, "%s{%srcode=\"%s\"} %" PRIu64
+				      "\n", m->name,
+				      m->labels, codebuf, val);
+}
+
+static void
+metrics_rdtype(dns_rdatastatstype_t type, uint64_t val, void *arg) {
+	metrics_t *m = arg;
+	char typebuf[64];
+	const char *typestr;
+
+	if (m->result != ISC_R_SUCCESS)
+		return;
+
+	if ((DNS_RDATASTATSTYPE_ATTR(type) &
+	     DNS_RDATASTATSTYPE_ATTR_OTHERTYPE) == 0)
+	{
+		dns_rdatatype_format(DNS_RDATASTATSTYPE_BASE(type), typebuf,
+				     sizeof(typebuf));
+		typestr = typebuf;
+	} else
+		typestr = "Others";
+
+	m->result = isc_buffer_printf(m->b, "%s{%stype=\"%s\"} %" PRIu64
+				      "\n", m->name,
+				      m->labels, typestr, val);
+}
+
+static isc_result_t
+metrics_boottime(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	UNUSED(view);
+	UNUSED(zone);
+
+	return (isc_buffer_printf(m->b, "%s %u\n",
+				  m->name,
+				  isc_time_seconds(&named_g_boottime)));
+}
+
+static isc_result_t
+metrics_configtime(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	UNUSED(view);
+	UNUSED(zone);
+
+	return (isc_buffer_printf(m->b, "%s %u\n",
+				  m->name,
+				  isc_time_seconds(&named_g_configtime)));
+}
+
+static isc_result_t
+metrics_opcodes(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	UNUSED(view);
+	UNUSED(zone);
+
+	dns_opcodestats_dump(m->server->sctx->opcodestats, metrics_opcode,
+			     m, ISC_STATSDUMP_VERBOSE);
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+metrics_rcodes(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	UNUSED(view);
+	UNUSED(zone);
+
+	dns_rcodestats_dump(m->server->sctx->rcodestats, metrics_rcode,
+			    m, ISC_STATSDUMP_VERBOSE);
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+metrics_qtypes(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	UNUSED(view);
+	UNUSED(zone);
+
+	dns_rdatatypestats_dump(m->server->sctx->rcvquerystats,
+				metrics_rdtype, m, 0);
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+metrics_nsstats(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	uint64_t values[ns_statscounter_max];
+
+	UNUSED(view);
+	UNUSED(zone);
+
+	update_logstats(m->server);
+	return (metrics_counters(m, ns_stats_get(m->server->sctx->nsstats),
+				 nsstats_xmldesc, ns_statscounter_max,
+				 nsstats_index, values,
+				 ISC_STATSDUMP_VERBOSE));
+}
+
+static isc_result_t
+metrics_zonestats(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	uint64_t values[dns_zonestatscounter_max];
+
+	UNUSED(view);
+	UNUSED(zone);
+
+	return (metrics_counters(m, m->server->zonestats, zonestats_xmldesc,
+				 dns_zonestatscounter_max, zonestats_index,
+				 values, ISC_STATSDUMP_VERBOSE));
+}
+
+static isc_result_t
+metrics_sockstats(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	uint64_t values[isc_sockstatscounter_max];
+
+	UNUSED(view);
+	UNUSED(zone);
+
+	return (metrics_counters(m, m->server->sockstats, sockstats_xmldesc,
+				 isc_sockstatscounter_max, sockstats_index,
+				 values, ISC_STATSDUMP_VERBOSE));
+}
+
+static isc_result_t
+metrics_resstats(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	uint64_t values[dns_resstatscounter_max];
+
+	UNUSED(zone);
+
+	if (view->resstats == NULL)
+		return (ISC_R_SUCCESS);
+	return (metrics_counters(m, view->resstats, resstats_xmldesc,
+				 dns_resstatscounter_max, resstats_index,
+				 values, ISC_STATSDUMP_VERBOSE));
+}
+
+static isc_result_t
+metrics_resqtypes(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	UNUSED(zone);
+
+	if (view->resquerystats != NULL)
+		dns_rdatatypestats_dump(view->resquerystats, metrics_rdtype,
+					m, 0);
+	return (ISC_R_SUCCESS);
+}
+
+static void
+metrics_latencybucket(uint64_t min, uint64_t max, uint64_t count, void *arg) {
+	uint64_t *counts = arg;
+
+	UNUSED(min);
+
+	/*
+	 * Buckets do not straddle powers of two, so each one is counted
+	 * under the smallest "le" bound of 2^k - 1 that covers it.
+	 */
+	if (max == UINT64_MAX)
+		counts[ISC_HISTO_MAXBITS + 1] += count;
+	else if (max == 0)
+		counts[0] += count;
+	else {
+		unsigned int k = 0;
+
+		while ((max >> k) != 0)
+			k++;
+		counts[k] += count;
+	}
+}
+
+/*%
+ * Write the latency histograms of 'view' as Prometheus histograms,
+ * with cumulative buckets at each power of two.
+ */
+static isc_result_t
+metrics_latency(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	static const char *stages[dns_latency_max] = {
+		"query", "recursion", "fetch", "rtt"
+	};
+	uint64_t counts[ISC_HISTO_MAXBITS + 2];
+	uint64_t count, sum, total;
+	isc_result_t result;
+	unsigned int k;
+	int i;
+
+	UNUSED(zone);
+
+	if (view->latency == NULL)
+		return (ISC_R_SUCCESS);
+
+	for (i = 0; i < dns_latency_max; i++) {
+		memset(counts, 0, sizeof(counts));
+		isc_histo_dump(view->latency, i, metrics_latencybucket,
+			       counts);
+		isc_histo_totals(view->latency, i, &count, &sum);
+
+		total = 0;
+		for (k = 0; k <= ISC_HISTO_MAXBITS; k++) {
+			total += counts[k];
+			CHECK(isc_buffer_printf(m->b, "%s_bucket{%sstage=\"%s\","
+						"le=\"%" PRIu64 "\"} %" PRIu64
+						"\n", m->name, m->labels,
+						stages[i],
+						((uint64_t)1 << k) - 1,
+						total));
+		}
+		total += counts[ISC_HISTO_MAXBITS + 1];
+		CHECK(isc_buffer_printf(m->b, "%s_bucket{%sstage=\"%s\","
+					"le=\"+Inf\"} %" PRIu64 "\n",
+					m->name, m->labels,
+					stages[i], total));
+		CHECK(isc_buffer_printf(m->b, "%s_sum{%sstage=\"%s\"} %"
+					PRIu64 "\n", m->name, m->labels,
+					stages[i], sum));
+		CHECK(isc_buffer_printf(m->b, "%s_count{%sstage=\"%s\"} %"
+					PRIu64 "\n", m->name, m->labels,
+					stages[i], total));
+	}
+	return (ISC_R_SUCCESS);
+
+ error:
+	return (result);
+}
+
+static isc_result_t
+metrics_zoneserial(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	const char *ztype;
+	uint32_t serial;
+
+	UNUSED(view);
+
+	if (dns_zone_getstatlevel(zone) == dns_zonestat_none ||
+	    dns_zone_getserial(zone, &serial) != ISC_R_SUCCESS)
+	{
+		return (ISC_R_SUCCESS);
+	}
+
+	ztype = user_zonetype(zone);
+	return (isc_buffer_printf(m->b, "%s{%stype=\"%s\"} %u\n",
+				  m->name, m->labels,
+				  ztype != NULL ? ztype : "unknown", serial));
+}
+
+static isc_result_t
+metrics_zonensstats(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	uint64_t values[ns_statscounter_max];
+	isc_stats_t *zonestats;
+
+	UNUSED(view);
+
+	if (dns_zone_getstatlevel(zone) != dns_zonestat_full)
+		return (ISC_R_SUCCESS);
+	zonestats = dns_zone_getrequeststats(zone);
+	if (zonestats == NULL)
+		return (ISC_R_SUCCESS);
+	return (metrics_counters(m, zonestats, nsstats_xmldesc,
+				 ns_statscounter_max, nsstats_index,
+				 values, 0));
+}
+
+static isc_result_t
+metrics_zoneqtypes(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	dns_stats_t *rcvquerystats;
+
+	UNUSED(view);
+
+	if (dns_zone_getstatlevel(zone) != dns_zonestat_full)
+		return (ISC_R_SUCCESS);
+	rcvquerystats = dns_zone_getrcvquerystats(zone);
+	if (rcvquerystats != NULL)
+		dns_rdatatypestats_dump(rcvquerystats, metrics_rdtype, m, 0);
+	return (ISC_R_SUCCESS);
+}
+
+static const metrics_family_t metrics_families[] = {
+	{ "bind_boot_time_seconds", "gauge",
+	  "Time the server was started.",
+	  metrics_scope_server, metrics_boottime },
+	{ "bind_config_time_seconds", "gauge",
+	  "Time the server was last configured.",
+	  metrics_scope_server, metrics_configtime },
+	{ "bind_incoming_requests_total", "counter",
+	  "Requests received, by opcode.",
+	  metrics_scope_server, metrics_opcodes },
+	{ "bind_responses_total", "counter",
+	  "Responses sent, by rcode.",
+	  metrics_scope_server, metrics_rcodes },
+	{ "bind_incoming_queries_total", "counter",
+	  "Queries received, by type.",
+	  metrics_scope_server, metrics_qtypes },
+	{ "bind_nsstat_total", "counter",
+	  "Name server statistics.",
+	  metrics_scope_server, metrics_nsstats },
+	{ "bind_zonestat_total", "counter",
+	  "Zone maintenance statistics.",
+	  metrics_scope_server, metrics_zonestats },
+	{ "bind_sockstat_total", "counter",
+	  "Socket I/O statistics.",
+	  metrics_scope_server, metrics_sockstats },
+	{ "bind_resstat_total", "counter",
+	  "Resolver statistics, by view.",
+	  metrics_scope_view, metrics_resstats },
+	{ "bind_resolver_queries_total", "counter",
+	  "Queries sent by the resolver, by view and type.",
+	  metrics_scope_view, metrics_resqtypes },
+	{ "bind_latency_microseconds", "histogram",
+	  "Latency of query handling, recursion, resolver fetches and "
+	  "upstream server round trips, by view.",
+	  metrics_scope_view, metrics_latency },
+	{ "bind_zone_serial", "gauge",
+	  "Zone serial number.",
+	  metrics_scope_zone, metrics_zoneserial },
+	{ "bind_zone_nsstat_total", "counter",
+	  "Name server statistics, by zone.",
+	  metrics_scope_zone, metrics_zonensstats },
+	{ "bind_zone_incoming_queries_total", "counter",
+	  "Queries received, by zone and type.",
+	  metrics_scope_zone, metrics_zoneqtypes },
+};
+
+#define METRICS_NFAMILIES \
+	(sizeof(metrics_families) / sizeof(metrics_families[0]))
+
+static bool
+metrics_wanted(metrics_t *m, const metrics_family_t *f) {
+	if (f->scope == metrics_scope_zone)
+		return ((m->flags & METRICS_ZONES) != 0);
+	return ((m->flags & METRICS_SERVER) != 0);
+}
+
+/*%
+ * Make 'view' the current view, or clear it if 'view' is NULL, and
+ * start at the first zone.
+ */
+static void
+metrics_setview(metrics_t *m, dns_view_t *view) {
+	if (m->view != NULL)
+		dns_view_weakdetach(&m->view);
+	if (view != NULL)
+		dns_view_weakattach(view, &m->view);
+	m->cursor = m->after;
+	m->count = 0;
+}
+
+/*%
+ * Find the first view at or after 'view' that passes the view filter.
+ */
+static dns_view_t *
+metrics_matchview(metrics_t *m, dns_view_t *view) {
+	while (view != NULL && m->viewname != NULL &&
+	       strcmp(view->name, m->viewname) != 0)
+	{
+		view = ISC_LIST_NEXT(view, link);
+	}
+	return (view);
+}
+
+/*%
+ * Return true if the current view is still configured; views are
+ * only replaced while other tasks are paused, so the list is stable
+ * while we are running.
+ */
+static bool
+metrics_viewlisted(metrics_t *m) {
+	dns_view_t *view;
+
+	for (view = ISC_LIST_HEAD(m->server->viewlist);
+	     view != NULL;
+	     view = ISC_LIST_NEXT(view, link))
+	{
+		if (view == m->view)
+			return (true);
+	}
+	return (false);
+}
+
+/*%
+ * Render the samples of the current family for the server, 'view' or
+ * 'zone'.  If they do not all fit, roll the buffer back to where it
+ * was so that they can be written into the next buffer.
+ */
+static isc_result_t
+metrics_block(metrics_t *m, dns_view_t *view, dns_zone_t *zone) {
+	unsigned int used = isc_buffer_usedlength(m->b);
+	isc_result_t result;
+
+	result = metrics_setlabels(m, view, zone);
+	if (result == ISC_R_SUCCESS) {
+		m->result = ISC_R_SUCCESS;
+		result = metrics_families[m->family].render(m, view, zone);
+		if (result == ISC_R_SUCCESS)
+			result = m->result;
+	}
+	if (result != ISC_R_SUCCESS)
+		isc_buffer_subtract(m->b, isc_buffer_usedlength(m->b) - used);
+	return (result);
+}
+
+/*%
+ * Write a comment giving the URL of the next page of zones in the
+ * current view.
+ */
+static isc_result_t
+metrics_nextlink(metrics_t *m) {
+	char namebuf[DNS_NAME_FORMATSIZE];
+	unsigned int used = isc_buffer_usedlength(m->b);
+	isc_result_t result;
+
+	dns_name_format(m->cursor, namebuf, sizeof(namebuf));
+	CHECK(isc_buffer_printf(m->b, "# next: /metrics/zones?view="));
+	CHECK(metrics_putencoded(m->b, m->view->name));
+	CHECK(isc_buffer_printf(m->b, "&after="));
+	CHECK(metrics_putencoded(m->b, namebuf));
+	if (m->zone != NULL) {
+		dns_name_format(m->zone, namebuf, sizeof(namebuf));
+		CHECK(isc_buffer_printf(m->b, "&zone="));
+		CHECK(metrics_putencoded(m->b, namebuf));
+	}
+	CHECK(isc_buffer_printf(m->b, "&limit=%u\n", m->limit));
+	return (ISC_R_SUCCESS);
+
+ error:
+	isc_buffer_subtract(m->b, isc_buffer_usedlength(m->b) - used);
+	return (result);
+}
+
+/*%
+ * dns_zt_applyfrom() action: render the current family for one zone.
+ */
+static isc_result_t
+metrics_zone(dns_zone_t *zone, void *arg) {
+	metrics_t *m = arg;
+	dns_name_t *origin = dns_zone_getorigin(zone);
+	isc_result_t result;
+
+	/* The walk resumes at the last zone rendered. */
+	if (m->cursor != NULL && dns_name_equal(origin, m->cursor))
+		return (ISC_R_SUCCESS);
+
+	/*
+	 * The walk starts at the top of the subtree and the subtree is
+	 * contiguous in DNSSEC order, so the first zone outside it
+	 * ends the walk.
+	 */
+	if (m->zone != NULL && !dns_name_issubdomain(origin, m->zone)) {
+		if (dns_name_compare(origin, m->zone) > 0)
+			return (ISC_R_NOMORE);
+		return (ISC_R_SUCCESS);
+	}
+
+	if (m->limit != 0 && m->count >= m->limit) {
+		if (m->nextlinks) {
+			result = metrics_nextlink(m);
+			if (result != ISC_R_SUCCESS)
+				return (result);
+		}
+		return (ISC_R_NOMORE);
+	}
+
+	result = metrics_block(m, m->view, zone);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+
+	m->cursor = dns_fixedname_name(&m->fcursor);
+	(void)dns_name_copy(origin, m->cursor, NULL);
+	m->count++;
+	return (ISC_R_SUCCESS);
+}
+
+/*%
+ * Render the current family for the zones of the current view,
+ * resuming after the last zone rendered.
+ */
+static isc_result_t
+metrics_zones(metrics_t *m) {
+	dns_name_t *start = m->cursor;
+	isc_result_t result;
+
+	if (m->view->zonetable == NULL)
+		return (ISC_R_SUCCESS);
+
+	if (m->zone != NULL &&
+	    (start == NULL || dns_name_compare(start, m->zone) < 0))
+	{
+		start = m->zone;
+	}
+
+	result = dns_zt_applyfrom(m->view->zonetable, start,
+				  metrics_zone, m);
+	if (result == ISC_R_NOMORE)
+		result = ISC_R_SUCCESS;
+	return (result);
+}
+
+/*%
+ * Render the current family, resuming where the last call stopped.
+ */
+static isc_result_t
+metrics_family(metrics_t *m) {
+	const metrics_family_t *f = &metrics_families[m->family];
+	dns_view_t *view;
+	isc_result_t result;
+
+	if (!m->header) {
+		result = isc_buffer_printf(m->b, "# HELP %s %s\n"
+					   "# TYPE %s %s\n",
+					   f->name, f->help, f->name, f->type);
+		if (result != ISC_R_SUCCESS)
+			return (result);
+		m->header = true;
+		if (f->scope == metrics_scope_server)
+			return (metrics_block(m, NULL, NULL));
+		view = ISC_LIST_HEAD(m->server->viewlist);
+		metrics_setview(m, metrics_matchview(m, view));
+	} else if (f->scope == metrics_scope_server) {
+		return (metrics_block(m, NULL, NULL));
+	}
+
+	while (m->view != NULL) {
+		/*
+		 * If the view has gone away since the last call, we no
+		 * longer know where the next one is.
+		 */
+		if (!metrics_viewlisted(m)) {
+			metrics_setview(m, NULL);
+			break;
+		}
+
+		if (f->scope == metrics_scope_view)
+			result = metrics_block(m, m->view, NULL);
+		else
+			result = metrics_zones(m);
+		if (result != ISC_R_SUCCESS)
+			return (result);
+
+		view = ISC_LIST_NEXT(m->view, link);
+		metrics_setview(m, metrics_matchview(m, view));
+	}
+
+	return (ISC_R_SUCCESS);
+}
+
+static void
+metrics_destroy(metrics_t *m) {
+	if (m->view != NULL)
+		dns_view_weakdetach(&m->view);
+	if (m->viewname != NULL)
+		isc_mem_free(m->mctx, m->viewname);
+	isc_mem_putanddetach(&m->mctx, m, sizeof(*m));
+}
+
+/*%
+ * isc_httpdnext_t for the metrics URLs.
+ */
+static isc_result_t
+metrics_next(void *arg, isc_buffer_t *b) {
+	metrics_t *m = arg;
+	isc_result_t result;
+
+	if (b == NULL) {
+		metrics_destroy(m);
+		return (ISC_R_SUCCESS);
+	}
+
+	if (m->error != NULL) {
+		(void)isc_buffer_printf(b, "%s\n", m->error);
+		metrics_destroy(m);
+		return (ISC_R_NOMORE);
+	}
+
+	m->b = b;
+	while (m->family < METRICS_NFAMILIES) {
+		if (metrics_wanted(m, &metrics_families[m->family])) {
+			m->name = metrics_families[m->family].name;
+			result = metrics_family(m);
+			if (result == ISC_R_NOSPACE &&
+			    isc_buffer_usedlength(b) > 0)
+			{
+				/* Carry on in the next buffer. */
+				return (ISC_R_SUCCESS);
+			}
+			if (result != ISC_R_SUCCESS) {
+				isc_log_write(named_g_lctx,
+					      NAMED_LOGCATEGORY_GENERAL,
+					      NAMED_LOGMODULE_SERVER,
+					      ISC_LOG_ERROR,
+					      "rendering %s failed: %s",
+					      m->name,
+					      isc_result_totext(result));
+				metrics_destroy(m);
+				return (result);
+			}
+			if (metrics_families[m->family].scope ==
+			    metrics_scope_zone)
+			{
+				m->nextlinks = false;
+			}
+		}
+		m->family++;
+		m->header = false;
+	}
+
+	metrics_destroy(m);
+	return (ISC_R_NOMORE);
+}
+
+/*%
+ * Decode '%XX' escapes and '+' in a query string value in place.
+ */
+static void
+metrics_unescape(char *s) {
+	char *d = s;
+	unsigned int c;
+
+	for (; *s != '\0'; s++, d++) {
+		if (*s == '+') {
+			*d = ' ';
+		} else if (*s == '%' && isxdigit((unsigned char)s[1]) &&
+			   isxdigit((unsigned char)s[2]) &&
+			   sscanf(s + 1, "%2x", &c) == 1)
+		{
+			*d = (char)c;
+			s += 2;
+		} else {
+			*d = *s;
+		}
+	}
+	*d = '\0';
+}
+
+/*%
+ * Parse the query string of a metrics request into 'm'.  On a bad
+ * parameter, set m->error.
+ */
+static isc_result_t
+metrics_query(metrics_t *m, const char *querystring) {
+	char buf[1024];
+	char *param, *next, *value;
+	dns_name_t *name;
+	isc_result_t result;
+
+	if (querystring == NULL)
+		return (ISC_R_SUCCESS);
+
+	if (strlcpy(buf, querystring, sizeof(buf)) >= sizeof(buf)) {
+		m->error = "query string too long";
+		return (ISC_R_SUCCESS);
+	}
+
+	for (param = buf; param != NULL; param = next) {
+		next = strchr(param, '&');
+		if (next != NULL)
+			*next++ = '\0';
+		if (*param == '\0')
+			continue;
+		value = strchr(param, '=');
+		if (value == NULL) {
+			m->error = "missing parameter value";
+			return (ISC_R_SUCCESS);
+		}
+		*value++ = '\0';
+		metrics_unescape(value);
+
+		if (strcmp(param, "view") == 0) {
+			if (m->viewname != NULL)
+				isc_mem_free(m->mctx, m->viewname);
+			m->viewname = isc_mem_strdup(m->mctx, value);
+			if (m->viewname == NULL)
+				return (ISC_R_NOMEMORY);
+		} else if (strcmp(param, "zone") == 0 ||
+			   strcmp(param, "after") == 0)
+		{
+			if (strcmp(param, "zone") == 0)
+				name = m->zone =
+					dns_fixedname_initname(&m->fzone);
+			else
+				name = m->after =
+					dns_fixedname_initname(&m->fafter);
+			result = dns_name_fromstring(name, value, 0, NULL);
+			if (result != ISC_R_SUCCESS) {
+				m->error = "bad zone name";
+				return (ISC_R_SUCCESS);
+			}
+		} else if (strcmp(param, "limit") == 0) {
+			if (isc_parse_uint32(&m->limit, value, 10) !=
+			    ISC_R_SUCCESS)
+			{
+				m->error = "bad limit";
+				return (ISC_R_SUCCESS);
+			}
+		} else {
+			m->error = "unknown parameter";
+			return (ISC_R_SUCCESS);
+		}
+	}
+
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+render_metrics(unsigned int flags, const char *querystring, void *arg,
+	       unsigned int *retcode, const char **retmsg,
+	       const char **mimetype, void **statep)
+{
+	named_server_t *server = arg;
+	metrics_t *m;
+	isc_result_t result;
+
+	m = isc_mem_get(server->mctx, sizeof(*m));
+	if (m == NULL)
+		return (ISC_R_NOMEMORY);
+	memset(m, 0, sizeof(*m));
+	isc_mem_attach(server->mctx, &m->mctx);
+	m->server = server;
+	m->flags = flags;
+	m->nextlinks = true;
+	dns_fixedname_init(&m->fcursor);
+
+	result = metrics_query(m, querystring);
+	if (result != ISC_R_SUCCESS) {
+		metrics_destroy(m);
+		return (result);
+	}
+
+	if (m->error != NULL) {
+		*retcode = 400;
+		*retmsg = "Bad Request";
+		*mimetype = "text/plain";
+	} else {
+		*retcode = 200;
+		*retmsg = "OK";
+		*mimetype = METRICS_MIMETYPE;
+	}
+	*statep = m;
+
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+render_metrics_all(const char *url, isc_httpdurl_t *urlinfo,
+		   const char *querystring, const char *headers, void *arg,
+		   unsigned int *retcode, const char **retmsg,
+		   const char **mimetype, void **statep)
+{
+	UNUSED(url);
+	UNUSED(urlinfo);
+	UNUSED(headers);
+	return (render_metrics(METRICS_ALL, querystring, arg, retcode,
+			       retmsg, mimetype, statep));
+}
+
+static isc_result_t
+render_metrics_server(const char *url, isc_httpdurl_t *urlinfo,
+		      const char *querystring, const char *headers,
+		      void *arg, unsigned int *retcode, const char **retmsg,
+		      const char **mimetype, void **statep)
+{
+	UNUSED(url);
+	UNUSED(urlinfo);
+	UNUSED(headers);
+	return (render_metrics(METRICS_SERVER, querystring, arg, retcode,
+			       retmsg, mimetype, statep));
+}
+
+static isc_result_t
+render_metrics_zones(const char *url, isc_httpdurl_t *urlinfo,
+		     const char *querystring, const char *headers,
+		     void *arg, unsigned int *retcode, const char **retmsg,
+		     const char **mimetype, void **statep)
+{
+	UNUSED(url);
+	UNUSED(urlinfo);
+	UNUSED(headers);
+	return (render_metrics(METRICS_ZONES, querystring, arg, retcode,
+			       retmsg, mimetype, statep));
+}
+
+static isc_result_t
+render_xsl(const char *url, isc_httpdurl_t *urlinfo,
+	   const char *querystring, const char *headers,
+	   void *args, unsigned int *retcode, const char **retmsg,
+	   const char **mimetype, isc_buffer_t *b,
+	   isc_httpdfree_t **freecb, void **freecb_args)
+{
+	isc_result_t result;
+	char *_headers = NULL;
+
+	UNUSED(url);
+	UNUSED(querystring);
+	UNUSED(args);
+
+	*freecb = NULL;
+	*freecb_args = NULL;
+	*mimetype = "text/xslt+xml";
+
+	if (urlinfo->isstatic) {
+		isc_time_t when;
+		char *line, *saveptr;
+		const char *if_modified_since = "If-Modified-Since: ";
+		_headers = strdup(headers);
+
+		if (_headers == NULL) {
+			goto send;
+		}
+
+		saveptr = NULL;
+		for (line = strtok_r(_headers, "\n", &saveptr);
+		     line;
+		     line = strtok_r(NULL, "\n", &saveptr)) {
+			if (strncasecmp(line, if_modified_since,
+					strlen(if_modified_since)) == 0) {
+				time_t t1, t2;
+				line += strlen(if_modified_since);
+				result = isc_time_parsehttptimestamp(line, &when);
+				if (result != ISC_R_SUCCESS) {
+					goto send;
+				}
+
+				result = isc_time_secondsastimet(&when, &t1);
+				if (result != ISC_R_SUCCESS) {
+					goto send;
+				}
+
+				result = isc_time_secondsastimet(&urlinfo->loadtime, &t2);
+				if (result != ISC_R_SUCCESS) {
+					goto send;
+				}
+
+				if (t1 < t2) {
+					goto send;
+				}
+
+				*retcode = 304;
+				*retmsg = "Not modified";
+				goto end;
+			}
+		}
+	}
+
+ send:
+	*retcode = 200;
+	*retmsg = "OK";
+	isc_buffer_reinit(b, xslmsg, strlen(xslmsg));
+	isc_buffer_add(b, strlen(xslmsg));
+end:
+	free(_headers);
+	return (ISC_R_SUCCESS);
+}
+
+static void
+shutdown_listener(named_statschannel_t *listener) {
+	char socktext[ISC_SOCKADDR_FORMATSIZE];
+	isc_sockaddr_format(&listener->address, socktext, sizeof(socktext));
+	isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
+		      NAMED_LOGMODULE_SERVER, ISC_LOG_NOTICE,
+		      "stopping statistics channel on %s",
+		      socktext);
+
+	isc_httpdmgr_shutdown(&listener->httpdmgr);
 }
 
 static bool
@@ -3339,6 +4564,12 @@ add_listener(named_server_t *server, named_statschannel_t **listenerp,
 	isc_httpdmgr_addurl(listener->httpdmgr, "/json/v1/traffic",
 			    render_json_traffic, server);
 #endif
+	isc_httpdmgr_addstream(listener->httpdmgr, "/metrics",
+			       render_metrics_all, metrics_next, server);
+	isc_httpdmgr_addstream(listener->httpdmgr, "/metrics/server",
+			       render_metrics_server, metrics_next, server);
+	isc_httpdmgr_addstream(listener->httpdmgr, "/metrics/zones",
+			       render_metrics_zones, metrics_next, server);
 	isc_httpdmgr_addurl2(listener->httpdmgr, "/bind9.xsl", true,
 			     render_xsl, server);
 
@@ -3442,12 +4673,12 @@ named_statschannels_configure(named_server_t *server, const cfg_obj_t *config,
 	 * address-in-use error.
 	 */
 	if (statschannellist != NULL) {
-#ifndef EXTENDED_STATS
+#if !defined(HAVE_LIBXML2) && !defined(HAVE_JSON)
 		isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
 			      NAMED_LOGMODULE_SERVER, ISC_LOG_WARNING,
-			      "statistics-channels specified but not effective "
-			      "due to missing XML and/or JSON library");
-#else /* EXTENDED_STATS */
+			      "statistics-channels: XML and JSON libraries "
+			      "missing, only metrics will be available");
+#else
 #ifndef HAVE_LIBXML2
 		isc_log_write(named_g_lctx, NAMED_LOGCATEGORY_GENERAL,
 			      NAMED_LOGMODULE_SERVER, ISC_LOG_WARNING,
@@ -3460,7 +4691,7 @@ named_statschannels_configure(named_server_t *server, const cfg_obj_t *config,
 			      "statistics-channels: JSON library missing, "
 			      "only XML stats will be available");
 #endif /* !HAVE_JSON */
-#endif /* EXTENDED_STATS */
+#endif
 
 		for (element = cfg_list_first(statschannellist);
 		     element != NULL;
@@ -3612,6 +4843,7 @@ named_stats_dump(named_server_t *server, FILE *fp) {
 	}
 
 	fprintf(fp, "++ Name Server Statistics ++\n");
+	update_logstats(server);
 	(void) dump_counters(ns_stats_get(server->sctx->nsstats),
 			     isc_statsformat_file, fp, NULL,
 			     nsstats_desc, ns_statscounter_max,
@@ -3699,6 +4931,19 @@ named_stats_dump(named_server_t *server, FILE *fp) {
 				     adbstats_index, adbstat_values, 0);
 	}
 
+	fprintf(fp, "++ Latency (microseconds) ++\n");
+	for (view = ISC_LIST_HEAD(server->viewlist);
+	     view != NULL;
+	     view = ISC_LIST_NEXT(view, link)) {
+		if (view->latency == NULL)
+			continue;
+		if (strcmp(view->name, "_default") == 0)
+			fprintf(fp, "[View: default]\n");
+		else
+			fprintf(fp, "[View: %s]\n", view->name);
+		(void) dump_latency(view->latency, isc_statsformat_file, fp);
+	}
+
 	fprintf(fp, "++ Socket I/O Statistics ++\n");
 	(void) dump_counters(server->sockstats, isc_statsformat_file, fp, NULL,
 			     sockstats_desc, isc_sockstatscounter_max,
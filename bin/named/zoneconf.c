@@ -43,6 +43,7 @@
 #include <dns/zone.h>
 
 #include <ns/client.h>
+#include <ns/xfrout.h>
 
 #include <named/config.h>
 #include <named/globals.h>
@@ -828,6 +829,21 @@ isself(dns_view_t *myview, dns_tsigkey_t *mykey,
 	return (view == myview);
 }
 
+/*
+ * Callback to drop the outgoing AXFR messages cached for a zone
+ * database once the zone stops serving it, so that the cache does
+ * not keep superseded or deleted versions of the zone alive.
+ */
+static void
+dbreleased(dns_zone_t *zone, dns_db_t *db, void *arg) {
+	ns_xfrcache_t *cache = (ns_xfrcache_t *) arg;
+
+	UNUSED(zone);
+
+	if (cache != NULL)
+		ns_xfrcache_flushdb(cache, db);
+}
+
 
 isc_result_t
 named_zone_configure(const cfg_obj_t *config, const cfg_obj_t *vconfig,
@@ -1238,6 +1254,8 @@ named_zone_configure(const cfg_obj_t *config, const cfg_obj_t *vconfig,
 				   cfg_obj_asboolean(obj));
 
 		dns_zone_setisself(zone, isself, named_g_server->interfacemgr);
+		dns_zone_setdbreleased(zone, dbreleased,
+				       named_g_server->sctx->xfrcache);
 
 		RETERR(configure_zone_acl(zconfig, vconfig, config,
 					  allow_transfer, ac, zone,
@@ -1689,6 +1707,11 @@ named_zone_configure(const cfg_obj_t *config, const cfg_obj_t *vconfig,
 		else
 			dns_zone_setserialupdatemethod(zone,
 						  dns_updatemethod_increment);
+
+		obj = NULL;
+		result = named_config_get(maps, "journal-sync-delay", &obj);
+		INSIST(result == ISC_R_SUCCESS && obj != NULL);
+		dns_zone_setjournalsyncdelay(zone, cfg_obj_asuint32(obj));
 	}
 
 	/*
@@ -11,7 +11,7 @@
 
 rm -f */named.conf
 rm -f */named.memstats
-rm -f */named.run
-rm -f raw* output*
+rm -f */named.run */named.run.prev
+rm -f raw* output* rndc.out.*
 rm -f ns*/named.lock
 rm -f ns*/managed-keys.bind*
@@ -0,0 +1,105 @@
+#!/usr/bin/perl
+#
+# Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+#
+# This Source Code Form is subject to the terms of the Mozilla Public
+# License, v. 2.0. If a copy of the MPL was not distributed with this
+# file, You can obtain one at http://mozilla.org/MPL/2.0/.
+#
+# See the COPYRIGHT file distributed with this work for additional
+# information regarding copyright ownership.
+
+# Send several requests in a single write on one TCP connection, and
+# print one line per response in the order the responses arrive:
+#
+#     <name> <opcode> <rcode>
+#
+# A request is given as a name, for an A query with RD set, or as
+# "name/notify" for a NOTIFY of the SOA of that name.
+#
+# With -c, the connection is reset after a short pause, without
+# reading any responses.
+#
+# Usage: pipeline.pl [-a address] [-p port] [-c] request ...
+
+require 5.006_001;
+
+use strict;
+use Getopt::Std;
+use IO::Socket;
+use Socket;
+
+my %opcodes = (0 => "QUERY", 4 => "NOTIFY", 5 => "UPDATE");
+my @rcodes = ("NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP",
+	      "REFUSED", "YXDOMAIN", "YXRRSET", "NXRRSET", "NOTAUTH",
+	      "NOTZONE");
+
+my %options = ();
+getopts("a:p:c", \%options);
+
+my $addr = "10.53.0.4";
+$addr = $options{a} if defined $options{a};
+
+my $port = 53;
+$port = $options{p} if defined $options{p};
+
+@ARGV > 0 or die "usage: pipeline.pl [-a address] [-p port] [-c] " .
+		 "request ...\n";
+
+sub request {
+	my ($id, $arg) = @_;
+	my ($name, $op) = split(/\//, $arg);
+	my ($flags, $qtype);
+	my $qname = "";
+
+	if (defined $op && $op eq "notify") {
+		$flags = 4 << 11;	# NOTIFY, AA clear
+		$qtype = 6;		# SOA
+	} else {
+		$flags = 0x0100;	# QUERY, RD
+		$qtype = 1;		# A
+	}
+	foreach my $label (split(/\./, $name)) {
+		$qname .= pack("C", length $label) . $label;
+	}
+	my $msg = pack("nnnnnn", $id, $flags, 1, 0, 0, 0) . $qname .
+		  pack("Cnn", 0, $qtype, 1);
+	return (pack("n", length $msg) . $msg);
+}
+
+my $sock = IO::Socket::INET->new(PeerAddr => $addr, PeerPort => $port,
+				 Proto => "tcp") or die "$!";
+
+my $data = "";
+for (my $i = 0; $i < @ARGV; $i++) {
+	$data .= request($i, $ARGV[$i]);
+}
+$sock->syswrite($data, length $data);
+
+if ($options{c}) {
+	select(undef, undef, undef, 0.1);
+	setsockopt($sock, SOL_SOCKET, SO_LINGER, pack("ii", 1, 0));
+	$sock->close;
+	exit 0;
+}
+
+sub readn {
+	my ($n) = @_;
+	my $buf = "";
+	while (length $buf < $n) {
+		my $got = $sock->sysread($buf, $n - length $buf, length $buf);
+		die "short read" unless $got;
+	}
+	return ($buf);
+}
+
+for (my $i = 0; $i < @ARGV; $i++) {
+	my $len = unpack("n", readn(2));
+	my ($id, $flags) = unpack("nn", readn($len));
+	my ($name) = split(/\//, $ARGV[$id]);
+	my $opcode = ($flags >> 11) & 0xf;
+	my $rcode = $flags & 0xf;
+	print "$name $opcodes{$opcode} $rcodes[$rcode]\n";
+}
+
+$sock->close;
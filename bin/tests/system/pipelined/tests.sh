@@ -57,6 +57,22 @@ diff refb outputb.mdig || ret=1
 if [ $ret != 0 ]; then echo_i "failed"; fi
 status=`expr $status + $ret`
 
+echo_i "check non-query requests are not pipelined"
+ret=0
+# flush resolver so that a.exampleb is slow to answer
+$RNDCCMD 10.53.0.4 flush
+sleep 1
+# the NOTIFY is answered at once, but a.examplea must wait until the
+# query for a.exampleb ahead of it has been answered too
+$PERL pipeline.pl -a 10.53.0.4 -p ${PORT} \
+	a.exampleb examplea/notify a.examplea > raw.notify || ret=1
+order=`awk '{ print $1 }' < raw.notify | tr '\n' ' '`
+[ "$order" = "examplea a.exampleb a.examplea " ] || {
+	ret=1; echo_i "unexpected order: $order";
+}
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
 echo_i "check mdig -4 -6"
 ret=0
 $MDIG $MDIGOPTS -4 -6 -f input @10.53.0.4 > output46.mdig 2>&1 && ret=1
@@ -71,5 +87,52 @@ grep "address family not supported" output4.mdig > /dev/null || ret=1
 if [ $ret != 0 ]; then echo_i "failed"; fi
 status=`expr $status + $ret`
 
+echo_i "reconfiguring ns4 with a small tcp-clients quota"
+copy_setports ns4/named2.conf.in ns4/named.conf
+$RNDCCMD 10.53.0.4 reconfig 2>&1 | sed 's/^/ns4 /' | cat_i
+sleep 1
+
+SLOW="a.exampleb b.exampleb c.exampleb d.exampleb"
+SLOW="$SLOW e.exampleb f.exampleb g.exampleb h.exampleb"
+
+# wait for all the tcp-clients quota to be released
+tcpidle () {
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		$RNDCCMD 10.53.0.4 status > rndc.out.$1 2>&1
+		grep "tcp clients: 0/3" rndc.out.$1 > /dev/null && return 0
+		sleep 1
+	done
+	return 1
+}
+
+echo_i "check requests deferred for lack of tcp-clients quota are answered"
+ret=0
+$RNDCCMD 10.53.0.4 flush
+sleep 1
+nextpart ns4/named.run > /dev/null
+# the connection and the clients for the first three requests use up
+# the quota, so the fourth has to wait for them
+$PERL pipeline.pl -a 10.53.0.4 -p ${PORT} $SLOW > raw.quota || ret=1
+lines=`grep -c "QUERY NOERROR" raw.quota`
+[ "$lines" -eq 8 ] || { ret=1; echo_i "only $lines answers"; }
+nextpart ns4/named.run | grep "request deferred" > /dev/null || ret=1
+tcpidle quota || { ret=1; echo_i "tcp-clients quota not released"; }
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
+echo_i "check closing a connection with a deferred request"
+ret=0
+$RNDCCMD 10.53.0.4 flush
+sleep 1
+nextpart ns4/named.run > /dev/null
+$PERL pipeline.pl -a 10.53.0.4 -p ${PORT} -c $SLOW || ret=1
+tcpidle close || { ret=1; echo_i "tcp-clients quota not released"; }
+nextpart ns4/named.run | grep "request deferred" > /dev/null || ret=1
+$PERL pipeline.pl -a 10.53.0.4 -p ${PORT} a.examplea > raw.close || ret=1
+grep "a.examplea QUERY NOERROR" raw.close > /dev/null || ret=1
+if [ $ret != 0 ]; then echo_i "failed"; fi
+status=`expr $status + $ret`
+
 echo_i "exit status: $status"
 [ $status -eq 0 ] || exit 1
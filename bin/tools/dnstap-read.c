@@ -49,6 +49,7 @@
 #include <dns/result.h>
 
 isc_mem_t *mctx = NULL;
+bool bulk = false;
 bool memrecord = false;
 bool printmessage = false;
 bool hexmessage = false;
@@ -83,7 +84,8 @@ fatal(const char *format, ...) {
 
 static void
 usage(void) {
-	fprintf(stderr, "dnstap-read [-mpxy] [filename]\n");
+	fprintf(stderr, "dnstap-read [-bmpxy] [filename]\n");
+	fprintf(stderr, "\t-b\tbulk mode: print summaries quickly\n");
 	fprintf(stderr, "\t-m\ttrace memory allocations\n");
 	fprintf(stderr, "\t-p\tprint the full DNS message\n");
 	fprintf(stderr, "\t-x\tuse hex format to print DNS message\n");
@@ -302,6 +304,51 @@ print_yaml(dns_dtdata_t *dt) {
 	}
 };
 
+/*
+ * Print one-line summaries of all the frames in 'handle', decoding
+ * them directly rather than with dns_dt_parse() and reusing a single
+ * output buffer.
+ */
+static void
+bulk_read(dns_dthandle_t *handle) {
+	static char obuf[1024 * 1024];
+	isc_result_t result;
+	isc_buffer_t *b = NULL;
+
+	(void)setvbuf(stdout, obuf, _IOFBF, sizeof(obuf));
+
+	isc_buffer_allocate(mctx, &b, 2048);
+	if (b == NULL)
+		fatal("out of memory");
+
+	for (;;) {
+		isc_region_t input;
+		uint8_t *data;
+		size_t datalen;
+
+		result = dns_dt_getframe(handle, &data, &datalen);
+		if (result == ISC_R_NOMORE)
+			break;
+		else
+			CHECKM(result, "dns_dt_getframe");
+
+		input.base = data;
+		input.length = datalen;
+
+		isc_buffer_clear(b);
+		if (dns_dt_frametotext(&input, &b) != ISC_R_SUCCESS)
+			continue;
+
+		fputs((char *) isc_buffer_base(b), stdout);
+		putchar('\n');
+	}
+
+ cleanup:
+	isc_buffer_free(&b);
+	if (fflush(stdout) != 0)
+		fatal("write error");
+}
+
 int
 main(int argc, char *argv[]) {
 	isc_result_t result;
@@ -311,8 +358,11 @@ main(int argc, char *argv[]) {
 	dns_dthandle_t *handle = NULL;
 	int rv = 0, ch;
 
-	while ((ch = isc_commandline_parse(argc, argv, "mpxy")) != -1) {
+	while ((ch = isc_commandline_parse(argc, argv, "bmpxy")) != -1) {
 		switch (ch) {
+			case 'b':
+				bulk = true;
+				break;
 			case 'm':
 				isc_mem_debugging |= ISC_MEM_DEBUGRECORD;
 				memrecord = true;
@@ -340,6 +390,9 @@ main(int argc, char *argv[]) {
 	if (argc < 1)
 		fatal("no file specified");
 
+	if (bulk && (printmessage || hexmessage || yaml))
+		fatal("-b cannot be used with -p, -x or -y");
+
 	RUNTIME_CHECK(isc_mem_create(0, 0, &mctx) == ISC_R_SUCCESS);
 
 	dns_result_register();
@@ -347,6 +400,11 @@ main(int argc, char *argv[]) {
 	CHECKM(dns_dt_open(argv[0], dns_dtmode_file, mctx, &handle),
 	       "dns_dt_openfile");
 
+	if (bulk) {
+		bulk_read(handle);
+		goto cleanup;
+	}
+
 	for (;;) {
 		isc_region_t input;
 		uint8_t *data;
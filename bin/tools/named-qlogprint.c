@@ -0,0 +1,298 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+/*
+ * Print binary query log segments (see <ns/qlog.h>) in the format
+ * of the text query log.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include <isc/buffer.h>
+#include <isc/commandline.h>
+#include <isc/net.h>
+#include <isc/netaddr.h>
+#include <isc/print.h>
+#include <isc/result.h>
+#include <isc/string.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/compress.h>
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/rdataclass.h>
+#include <dns/rdatatype.h>
+
+#include <ns/qlog.h>
+
+const char *program = "named-qlogprint";
+
+ISC_PLATFORM_NORETURN_PRE static void
+fatal(const char *format, ...) ISC_PLATFORM_NORETURN_POST;
+
+static void
+fatal(const char *format, ...) {
+	va_list args;
+
+	fprintf(stderr, "%s: ", program);
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+static void
+usage(void) {
+	fprintf(stderr, "Usage: %s [-l] file ...\n", program);
+	exit(1);
+}
+
+static void
+printaddr(const unsigned char *addr, uint8_t family, char *buf, size_t len) {
+	isc_netaddr_t netaddr;
+	struct in_addr in;
+	struct in6_addr in6;
+
+	if (family == 6) {
+		memmove(&in6, addr, 16);
+		isc_netaddr_fromin6(&netaddr, &in6);
+	} else {
+		memmove(&in, addr, 4);
+		isc_netaddr_fromin(&netaddr, &in);
+	}
+	isc_netaddr_format(&netaddr, buf, (unsigned int)len);
+}
+
+static void
+printrecord(const ns_qlogrec_t *rec, const unsigned char *data,
+	    bool uselocal)
+{
+	char timebuf[64];
+	char clientbuf[ISC_NETADDR_FORMATSIZE];
+	char localbuf[ISC_NETADDR_FORMATSIZE];
+	char namebuf[DNS_NAME_FORMATSIZE];
+	char typebuf[DNS_RDATATYPE_FORMATSIZE];
+	char classbuf[DNS_RDATACLASS_FORMATSIZE];
+	char viewbuf[256];
+	char ednsbuf[sizeof("E(255)")] = { 0 };
+	dns_decompress_t dctx;
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	isc_buffer_t b;
+	isc_time_t when;
+	uint16_t flags;
+
+	isc_time_set(&when, ntohl(rec->seconds), ntohl(rec->nanoseconds));
+	if (uselocal)
+		isc_time_formattimestamp(&when, timebuf, sizeof(timebuf));
+	else
+		isc_time_formatISO8601ms(&when, timebuf, sizeof(timebuf));
+
+	printaddr(rec->client, rec->family, clientbuf, sizeof(clientbuf));
+	printaddr(rec->local, rec->family, localbuf, sizeof(localbuf));
+
+	name = dns_fixedname_initname(&fixed);
+	isc_buffer_constinit(&b, data, rec->qnamelen);
+	isc_buffer_add(&b, rec->qnamelen);
+	isc_buffer_setactive(&b, rec->qnamelen);
+	dns_decompress_init(&dctx, -1, DNS_DECOMPRESS_NONE);
+	if (dns_name_fromwire(name, &b, &dctx, 0, NULL) == ISC_R_SUCCESS)
+		dns_name_format(name, namebuf, sizeof(namebuf));
+	else
+		strlcpy(namebuf, "<invalid name>", sizeof(namebuf));
+	dns_decompress_invalidate(&dctx);
+
+	memmove(viewbuf, data + rec->qnamelen, rec->viewlen);
+	viewbuf[rec->viewlen] = '\0';
+
+	dns_rdatatype_format(ntohs(rec->qtype), typebuf, sizeof(typebuf));
+	dns_rdataclass_format(ntohs(rec->qclass), classbuf, sizeof(classbuf));
+
+	flags = ntohs(rec->flags);
+	if ((flags & NS_QLOG_EDNS) != 0)
+		snprintf(ednsbuf, sizeof(ednsbuf), "E(%u)", rec->ednsversion);
+
+	printf("%s client %s#%u (%s): view %s: query: %s %s %s %s%s%s%s%s%s%s "
+	       "(%s)%s\n", timebuf, clientbuf, ntohs(rec->port), namebuf,
+	       viewbuf, namebuf, classbuf, typebuf,
+	       (flags & NS_QLOG_RECURSE) != 0 ? "+" : "-",
+	       (flags & NS_QLOG_SIGNED) != 0 ? "S" : "", ednsbuf,
+	       (flags & NS_QLOG_TCP) != 0 ? "T" : "",
+	       (flags & NS_QLOG_DNSSECOK) != 0 ? "D" : "",
+	       (flags & NS_QLOG_CHECKINGDISABLED) != 0 ? "C" : "",
+	       (flags & NS_QLOG_HAVECOOKIE) != 0 ? "V" :
+	       (flags & NS_QLOG_WANTCOOKIE) != 0 ? "K" : "",
+	       localbuf, (flags & NS_QLOG_ECS) != 0 ? " [ECS]" : "");
+}
+
+/*
+ * Is the rest of the file, starting with the 'len' bytes already read
+ * into 'buf', all zero?  This is how the unused tail of a segment that
+ * is still being written looks.
+ */
+static bool
+zerotail(FILE *fp, const unsigned char *buf, size_t len) {
+	unsigned char tail[1024];
+	size_t i;
+
+	for (;;) {
+		for (i = 0; i < len; i++) {
+			if (buf[i] != 0)
+				return (false);
+		}
+		len = fread(tail, 1, sizeof(tail), fp);
+		if (len == 0)
+			return (true);
+		buf = tail;
+	}
+}
+
+/*
+ * Print all the complete records in a segment file.  A record whose
+ * length was never written is skipped if its size can be worked out
+ * from the rest of its header; otherwise the remaining records cannot
+ * be found, and this is reported unless nothing but zeros follows.
+ */
+static isc_result_t
+printfile(const char *filename, bool uselocal) {
+	unsigned char header[NS_QLOG_FILEHDRSIZE];
+	unsigned char data[512];
+	ns_qlogrec_t rec;
+	uint32_t val, length;
+	size_t datalen, n;
+	long offset;
+	isc_result_t result = ISC_R_SUCCESS;
+	FILE *fp;
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "%s: %s: %s\n", program, filename,
+			strerror(errno));
+		return (ISC_R_FAILURE);
+	}
+
+	if (fread(header, sizeof(header), 1, fp) != 1 ||
+	    memcmp(header, NS_QLOG_MAGIC, 8) != 0)
+	{
+		fprintf(stderr, "%s: %s: not a query log file\n",
+			program, filename);
+		fclose(fp);
+		return (ISC_R_FAILURE);
+	}
+	memmove(&val, header + 8, sizeof(val));
+	if (ntohl(val) != NS_QLOG_VERSION) {
+		fprintf(stderr, "%s: %s: unsupported version %u\n",
+			program, filename, ntohl(val));
+		fclose(fp);
+		return (ISC_R_FAILURE);
+	}
+	memmove(&val, header + 12, sizeof(val));
+	if (ntohl(val) != NS_QLOG_FILEHDRSIZE) {
+		fprintf(stderr, "%s: %s: bad header size %u\n",
+			program, filename, ntohl(val));
+		fclose(fp);
+		return (ISC_R_FAILURE);
+	}
+
+	for (;;) {
+		offset = ftell(fp);
+		n = fread(&rec, 1, sizeof(rec), fp);
+		if (n == 0)
+			break;
+		if (n != sizeof(rec)) {
+			fprintf(stderr, "%s: %s: truncated record at "
+				"offset %ld\n", program, filename, offset);
+			result = ISC_R_FAILURE;
+			break;
+		}
+		length = ntohl(rec.length);
+		if (length == 0 && rec.qnamelen != 0) {
+			length = sizeof(rec) + rec.qnamelen + rec.viewlen;
+			length = (length + NS_QLOG_ALIGN - 1) &
+				 ~(NS_QLOG_ALIGN - 1);
+			fprintf(stderr, "%s: %s: skipping incomplete record "
+				"at offset %ld\n", program, filename, offset);
+			if (fseek(fp, offset + length, SEEK_SET) != 0)
+				break;
+			continue;
+		}
+		if (length == 0) {
+			if (!zerotail(fp, (unsigned char *)&rec, sizeof(rec))) {
+				fprintf(stderr, "%s: %s: unreadable data "
+					"after offset %ld, file truncated\n",
+					program, filename, offset);
+				result = ISC_R_FAILURE;
+			}
+			break;
+		}
+		datalen = length - sizeof(rec);
+		if (length < sizeof(rec) || datalen > sizeof(data) ||
+		    (size_t)rec.qnamelen + rec.viewlen > datalen ||
+		    (rec.family != 4 && rec.family != 6))
+		{
+			fprintf(stderr, "%s: %s: corrupt record\n",
+				program, filename);
+			fclose(fp);
+			return (ISC_R_FAILURE);
+		}
+		if (fread(data, datalen, 1, fp) != 1) {
+			fprintf(stderr, "%s: %s: truncated record at "
+				"offset %ld\n", program, filename, offset);
+			result = ISC_R_FAILURE;
+			break;
+		}
+		printrecord(&rec, data, uselocal);
+	}
+
+	fclose(fp);
+	return (result);
+}
+
+int
+main(int argc, char **argv) {
+	bool uselocal = false;
+	int ch, status = 0;
+
+	while ((ch = isc_commandline_parse(argc, argv, "l")) != -1) {
+		switch (ch) {
+		case 'l':
+			uselocal = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= isc_commandline_index;
+	argv += isc_commandline_index;
+
+	if (argc < 1)
+		usage();
+
+	for (; argc > 0; argc--, argv++) {
+		if (printfile(argv[0], uselocal) != ISC_R_SUCCESS)
+			status = 1;
+	}
+
+	if (fflush(stdout) != 0)
+		fatal("write error");
+
+	return (status);
+}
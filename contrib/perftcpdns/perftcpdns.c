@@ -250,6 +250,7 @@ char *servername;			/* server */
 int ixann;				/* ixann NXDOMAIN */
 int udp;				/* use UDP in place of TCP */
 int minport, maxport, curport;		/* port range */
+int numidle;				/* idle keepalive connections */
 
 /*
  * global variables
@@ -276,6 +277,9 @@ struct timespec due;			/* the date of next connect */
 struct timespec dreport;		/* the date of next reporting */
 struct timespec finished;		/* the date of finish */
 
+int *idlefds;				/* idle connection sockets */
+int openidle;				/* number of open idle connections */
+
 /*
  * template
  */
@@ -1620,6 +1624,122 @@ getlocaladdr(void)
 	freeaddrinfo(res);
 }
 
+/*
+ * open the idle connections (-I<idle>): each sends a query with
+ * the EDNS TCP keepalive option, gets the response and is then
+ * left open (and silent) for the whole test
+ */
+
+void
+openidles(void)
+{
+	uint8_t query[64], resp[4096];
+	uint8_t *p;
+	struct timeval tv;
+	socklen_t slen;
+	size_t len;
+	ssize_t cc;
+	int i, sock;
+
+	idlefds = calloc((size_t) numidle, sizeof(int));
+	if (idlefds == NULL) {
+		perror("calloc(idle)");
+		exit(1);
+	}
+
+	/* ./NS query with an OPT carrying an empty edns-tcp-keepalive */
+	memset(query, 0, sizeof(query));
+	p = query + 2;
+	p[NS_OFF_QDCOUNT + 1] = 1;
+	p[NS_OFF_ARCOUNT + 1] = 1;
+	p += NS_OFF_QUESTION;
+	/* root name, type NS, class IN */
+	p += 2;
+	*p++ = NS_TYPE_NS;
+	p++;
+	*p++ = NS_CLASS_IN;
+	/* root name, type OPT, class UDP length */
+	p += 2;
+	*p++ = NS_TYPE_OPT;
+	*p++ = 4096 >> 8;
+	*p++ = 4096 & 0xff;
+	/* extended rcode, version, flags */
+	p += 4;
+	/* rdlength */
+	p++;
+	*p++ = 4;
+	/* option code 11 (edns-tcp-keepalive), option length 0 */
+	p++;
+	*p++ = 11;
+	p += 2;
+	len = p - query;
+	query[0] = (len - 2) >> 8;
+	query[1] = (len - 2) & 0xff;
+
+	if (ipversion == 4)
+		slen = sizeof(struct sockaddr_in);
+	else
+		slen = sizeof(struct sockaddr_in6);
+	tv.tv_sec = (time_t) losttime[1];
+	tv.tv_usec = (suseconds_t) ((losttime[1] - tv.tv_sec) * 1e6);
+
+	for (i = 0; i < numidle; i++) {
+		sock = socket(serveraddr.ss_family, SOCK_STREAM, IPPROTO_TCP);
+		if (sock < 0) {
+			perror("socket(idle)");
+			break;
+		}
+		if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO,
+			       &tv, sizeof(tv)) < 0 ||
+		    connect(sock, (struct sockaddr *) &serveraddr,
+			    slen) < 0) {
+			perror("connect(idle)");
+			(void) close(sock);
+			break;
+		}
+		query[2 + NS_OFF_ID] = (i >> 8) & 0xff;
+		query[2 + NS_OFF_ID + 1] = i & 0xff;
+		if (send(sock, query, len, 0) != (ssize_t) len) {
+			perror("send(idle)");
+			(void) close(sock);
+			break;
+		}
+		cc = recv(sock, resp, 2, MSG_WAITALL);
+		if (cc == 2)
+			cc = recv(sock, resp,
+				  ((size_t) resp[0] << 8) | resp[1],
+				  MSG_WAITALL);
+		if (cc <= 0) {
+			fprintf(stderr, "recv(idle): %s\n",
+				cc < 0 ? strerror(errno) : "closed");
+			(void) close(sock);
+			break;
+		}
+		idlefds[openidle++] = sock;
+	}
+	printf("idle connections: %d opened\n", openidle);
+}
+
+/*
+ * count (and close) the idle connections which are still open
+ */
+
+int
+closeidles(void)
+{
+	int i, stillopen = 0;
+	char c;
+
+	for (i = 0; i < openidle; i++) {
+		if ((recv(idlefds[i], &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0) &&
+		    ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+			stillopen++;
+		(void) close(idlefds[i]);
+	}
+	free(idlefds);
+	return stillopen;
+}
+
 /*
  * intermediate reporting
  * (note: an in-transit packet can be reported as lost)
@@ -1705,7 +1825,7 @@ usage(void)
 "perftcpdns [-huvX0] [-4|-6] [-r<rate>] [-t<report>] [-p<test-period>]\n"
 "    [-n<num-request>]* [-d<lost-time>]* [-D<max-loss>]* [-T<template-file>]\n"
 "    [-l<local-addr>] [-L<local-port>]* [-a<aggressiveness>] [-s<seed>]\n"
-"    [-M<memory>] [-x<diagnostic-selector>] [-P<port>] server\n"
+"    [-M<memory>] [-x<diagnostic-selector>] [-P<port>] [-I<idle>] server\n"
 "\f\n"
 "The server argument is the name/address of the DNS server to contact.\n"
 "\n"
@@ -1719,6 +1839,9 @@ usage(void)
 "    treated as having been lost. The value is given in seconds and\n"
 "    may contain a fractional component. The default is 1 second.\n"
 "-h: Print this help.\n"
+"-I<idle>: Before the test, open <idle> connections which send one query\n"
+"    with the EDNS TCP keepalive option and then stay silent. The final\n"
+"    report gives how many of them were still open at the end.\n"
 "-l<local-addr>: Specify the local hostname/address to use when\n"
 "    communicating with the server.\n"
 "-L<local-port>: Specify the (minimal and maximal) local port number\n"
@@ -1798,7 +1921,7 @@ main(const int argc, char * const argv[])
 	extern char *optarg;
 	extern int optind;
 
-#define OPTIONS	"hv46u0XM:r:t:R:b:n:p:d:D:l:L:a:s:T:O:x:P:"
+#define OPTIONS	"hv46u0XM:r:t:R:b:n:p:d:D:l:L:a:s:T:O:x:P:I:"
 
 	/* decode options */
 	while ((opt = getopt(argc, argv, OPTIONS)) != -1)
@@ -2052,6 +2175,16 @@ main(const int argc, char * const argv[])
 		port = (in_port_t) i;
 		break;
 
+	case 'I':
+		numidle = atoi(optarg);
+		if (numidle <= 0) {
+			fprintf(stderr,
+				"idle must be a positive integer\n");
+			usage();
+			exit(2);
+		}
+		break;
+
 	default:
 		usage();
 		exit(2);
@@ -2122,6 +2255,8 @@ main(const int argc, char * const argv[])
 				printf("*");
 		}
 		printf(" aggressiveness=%d", aggressiveness);
+		if (numidle != 0)
+			printf(" idle=%d", numidle);
 		if (seeded)
 			printf(" seed=%u", seed);
 		if (templatefile != NULL)
@@ -2222,6 +2357,10 @@ main(const int argc, char * const argv[])
 	else
 		get_template_query();
 
+	/* open the idle connections */
+	if (numidle != 0)
+		openidles();
+
 	/* boot is done! */
 	if (clock_gettime(CLOCK_REALTIME, &boot) < 0) {
 		perror("clock_gettime(boot)");
@@ -2393,6 +2532,9 @@ main(const int argc, char * const argv[])
 	       (unsigned long long) rcodes[NS_RCODE_NOIMP],
 	       (unsigned long long) rcodes[NS_RCODE_REFUSED],
 	       (unsigned long long) rcodes[NS_RCODE_LAST]);
+	if (numidle != 0)
+		printf("idle connections: %d, still open: %d\n",
+		       openidle, closeidles());
 
 	/* print the rates */
 	if (finished.tv_sec != 0) {
@@ -1556,6 +1556,30 @@ check_options(const cfg_obj_t *options, isc_log_t *logctx, isc_mem_t *mctx,
 			}
 		}
 	}
+
+	obj = NULL;
+	(void) cfg_map_get(options, "dnstap-sample", &obj);
+	if (obj != NULL && cfg_obj_asuint32(obj) == 0U) {
+		cfg_obj_log(obj, logctx, ISC_LOG_ERROR,
+			    "dnstap-sample must be greater than zero");
+		if (result == ISC_R_SUCCESS)
+			result = ISC_R_RANGE;
+	}
+
+	obj = NULL;
+	(void) cfg_map_get(options, "dnstap-sample-prefix", &obj);
+	if (obj != NULL) {
+		uint32_t v4 = cfg_obj_asuint32(cfg_tuple_get(obj, "ipv4"));
+		uint32_t v6 = cfg_obj_asuint32(cfg_tuple_get(obj, "ipv6"));
+
+		if (v4 == 0U || v4 > 32U || v6 == 0U || v6 > 128U) {
+			cfg_obj_log(obj, logctx, ISC_LOG_ERROR,
+				    "dnstap-sample-prefix '%u %u' out of "
+				    "range (1..32 1..128)", v4, v6);
+			if (result == ISC_R_SUCCESS)
+				result = ISC_R_RANGE;
+		}
+	}
 #endif
 
 	obj = NULL;
@@ -17,13 +17,176 @@
 #include <stdbool.h>
 
 #include <isc/mem.h>
+#include <isc/mutex.h>
 #include <isc/once.h>
+#include <isc/platform.h>
 #include <isc/string.h>
+#include <isc/thread.h>
 #include <isc/util.h>
 
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+#include <stdatomic.h>
+#endif
+
 #include <dns/acl.h>
 #include <dns/iptable.h>
 
+/*
+ * Each thread keeps a small cache of recent dns_acl_match() results,
+ * keyed by ACL, ACL environment and client address.  A query is
+ * typically checked against several ACLs (allow-query, allow-recursion,
+ * blackhole, ...) and a client usually sends more than one query, so
+ * most checks against large ACLs are answered from the cache.
+ *
+ * The cache is organized as CACHE_SETS sets of CACHE_WAYS entries,
+ * each set kept in most-recently-used order.  Entries are stamped with
+ * a global epoch which is advanced whenever an ACL or IP table is
+ * created or changed, invalidating everything cached before; in named
+ * this happens on every reconfiguration and interface rescan.
+ *
+ * Results for signed requests are not cached, as they may depend on
+ * the key name.  ACLs which consist of only a few IP table nodes are
+ * cheaper to evaluate than to look up, and bypass the cache too.
+ */
+#if defined(ISC_PLATFORM_HAVESTDATOMIC) && defined(ATOMIC_INT_LOCK_FREE)
+#define ACL_CACHE 1
+#endif
+
+#ifdef ACL_CACHE
+#define CACHE_BITS	8
+#define CACHE_SETS	(1 << CACHE_BITS)
+#define CACHE_WAYS	4
+#define CACHE_MINNODES	8
+
+typedef struct aclcache_entry {
+	const dns_acl_t			*acl;
+	const dns_aclenv_t		*env;
+	const dns_aclelement_t		*matchelt;
+	unsigned int			epoch;
+	int				match;
+	uint16_t			family;	/*%< 0 if unused */
+	bool				mapped;
+	unsigned char			addr[16];
+} aclcache_entry_t;
+
+typedef struct aclcache {
+	isc_mem_t			*mctx;
+	aclcache_entry_t		sets[CACHE_SETS][CACHE_WAYS];
+} aclcache_t;
+
+static atomic_uint_fast32_t	cache_epoch;
+static isc_once_t		cache_once = ISC_ONCE_INIT;
+static isc_mutex_t		cache_lock;
+static bool			cache_key_ok = false;
+static isc_thread_key_t		cache_key;
+static isc_mem_t		*cache_mctx = NULL;
+
+static void
+free_cache(void *arg) {
+	aclcache_t *cache = arg;
+
+	if (cache != NULL)
+		isc_mem_putanddetach(&cache->mctx, cache, sizeof(*cache));
+	isc_thread_key_setspecific(cache_key, NULL);
+}
+
+static void
+cache_initialize(void) {
+	RUNTIME_CHECK(isc_mutex_init(&cache_lock) == ISC_R_SUCCESS);
+}
+
+/*
+ * Return this thread's cache, creating it if necessary, or NULL if
+ * that is not possible.
+ */
+static aclcache_t *
+getcache(void) {
+	aclcache_t *cache;
+	isc_mem_t *mctx = NULL;
+
+	if (!cache_key_ok) {
+		if (isc_once_do(&cache_once, cache_initialize) !=
+		    ISC_R_SUCCESS)
+		{
+			return (NULL);
+		}
+		LOCK(&cache_lock);
+		if (!cache_key_ok) {
+			cache_key_ok = (isc_thread_key_create(&cache_key,
+							      free_cache) == 0);
+		}
+		UNLOCK(&cache_lock);
+		if (!cache_key_ok)
+			return (NULL);
+	}
+
+	cache = isc_thread_key_getspecific(cache_key);
+	if (cache != NULL)
+		return (cache);
+
+	LOCK(&cache_lock);
+	if (cache_mctx == NULL &&
+	    isc_mem_create2(0, 0, &cache_mctx, 0) == ISC_R_SUCCESS)
+	{
+		isc_mem_setname(cache_mctx, "acl_cache", NULL);
+		isc_mem_setdestroycheck(cache_mctx, false);
+	}
+	if (cache_mctx != NULL)
+		isc_mem_attach(cache_mctx, &mctx);
+	UNLOCK(&cache_lock);
+	if (mctx == NULL)
+		return (NULL);
+
+	cache = isc_mem_get(mctx, sizeof(*cache));
+	if (cache == NULL) {
+		isc_mem_detach(&mctx);
+		return (NULL);
+	}
+	memset(cache, 0, sizeof(*cache));
+	cache->mctx = mctx;
+	if (isc_thread_key_setspecific(cache_key, cache) != 0) {
+		isc_mem_putanddetach(&cache->mctx, cache, sizeof(*cache));
+		return (NULL);
+	}
+
+	return (cache);
+}
+
+static inline unsigned int
+cache_hash(const dns_acl_t *acl, const unsigned char *addr, size_t len) {
+	uint32_t h = (uint32_t)((uintptr_t)acl >> 4);
+	uint32_t w;
+	size_t i;
+
+	for (i = 0; i < len; i += 4) {
+		memmove(&w, addr + i, 4);
+		h = (h ^ w) * 0x9e3779b1U;
+	}
+
+	/* The high bits of the product depend on all input bits. */
+	return (h >> (32 - CACHE_BITS));
+}
+#endif /* ACL_CACHE */
+
+void
+dns_acl_flushcache(void) {
+#ifdef ACL_CACHE
+	atomic_fetch_add_explicit(&cache_epoch, 1, memory_order_release);
+#endif
+}
+
+void
+dns_acl_shutdown(void) {
+#ifdef ACL_CACHE
+	if (isc_once_do(&cache_once, cache_initialize) != ISC_R_SUCCESS)
+		return;
+
+	LOCK(&cache_lock);
+	if (cache_mctx != NULL)
+		isc_mem_detach(&cache_mctx);
+	UNLOCK(&cache_lock);
+#endif
+}
 
 /*
  * Create a new ACL, including an IP table and an array with room
@@ -67,6 +230,12 @@ dns_acl_create(isc_mem_t *mctx, int n, dns_acl_t **target) {
 	acl->length = 0;
 	acl->has_negatives = false;
 
+	/*
+	 * A new ACL may be allocated where a freed one used to be;
+	 * don't let it inherit that ACL's cached results.
+	 */
+	dns_acl_flushcache();
+
 	ISC_LINK_INIT(acl, nextincache);
 	/*
 	 * Must set magic early because we use dns_acl_detach() to clean up.
@@ -175,54 +344,36 @@ dns_acl_isnone(dns_acl_t *acl)
 	return (dns_acl_isanyornone(acl, false));
 }
 
+static bool
+element_match(const isc_netaddr_t *reqaddr, isc_prefix_t *pfx,
+	      const dns_name_t *reqsigner, const dns_aclelement_t *e,
+	      const dns_aclenv_t *env, const dns_aclelement_t **matchelt);
+
 /*
- * Determine whether a given address or signer matches a given ACL.
- * For a match with a positive ACL element or iptable radix entry,
- * return with a positive value in match; for a match with a negated ACL
- * element or radix entry, return with a negative value in match.
+ * Match 'pfx', the host prefix of 'reqaddr' after any v4-mapped
+ * conversion, against 'acl'.  Nested ACLs are matched against the
+ * same prefix rather than converting the address again for each.
  */
-
-isc_result_t
-dns_acl_match(const isc_netaddr_t *reqaddr,
-	      const dns_name_t *reqsigner,
-	      const dns_acl_t *acl,
-	      const dns_aclenv_t *env,
-	      int *match,
-	      const dns_aclelement_t **matchelt)
+static void
+acl_match(const isc_netaddr_t *reqaddr, isc_prefix_t *pfx,
+	  const dns_name_t *reqsigner, const dns_acl_t *acl,
+	  const dns_aclenv_t *env, int *match,
+	  const dns_aclelement_t **matchelt)
 {
-	uint16_t bitlen;
-	isc_prefix_t pfx;
 	isc_radix_node_t *node = NULL;
-	const isc_netaddr_t *addr = reqaddr;
-	isc_netaddr_t v4addr;
 	isc_result_t result;
 	int match_num = -1;
 	unsigned int i;
 
-	REQUIRE(reqaddr != NULL);
-	REQUIRE(matchelt == NULL || *matchelt == NULL);
-
-	if (env != NULL && env->match_mapped &&
-	    addr->family == AF_INET6 &&
-	    IN6_IS_ADDR_V4MAPPED(&addr->type.in6))
-	{
-		isc_netaddr_fromv4mapped(&v4addr, addr);
-		addr = &v4addr;
-	}
-
-	/* Always match with host addresses. */
-	bitlen = (addr->family == AF_INET6) ? 128 : 32;
-	NETADDR_TO_PREFIX_T(addr, pfx, bitlen);
-
 	/* Assume no match. */
 	*match = 0;
 
 	/* Search radix. */
-	result = isc_radix_search(acl->iptable->radix, &node, &pfx);
+	result = isc_radix_search(acl->iptable->radix, &node, pfx);
 
 	/* Found a match. */
 	if (result == ISC_R_SUCCESS && node != NULL) {
-		int fam = ISC_RADIX_FAMILY(&pfx);
+		int fam = ISC_RADIX_FAMILY(pfx);
 		match_num = node->node_num[fam];
 		if (*(bool *) node->data[fam]) {
 			*match = match_num;
@@ -231,8 +382,6 @@ dns_acl_match(const isc_netaddr_t *reqaddr,
 		}
 	}
 
-	isc_refcount_destroy(&pfx.refcount);
-
 	/* Now search non-radix elements for a match with a lower node_num. */
 	for (i = 0; i < acl->length; i++) {
 		dns_aclelement_t *e = &acl->elements[i];
@@ -242,8 +391,7 @@ dns_acl_match(const isc_netaddr_t *reqaddr,
 			break;
 		}
 
-		if (dns_aclelement_match(reqaddr, reqsigner, e, env, matchelt))
-		{
+		if (element_match(reqaddr, pfx, reqsigner, e, env, matchelt)) {
 			if (match_num == -1 || e->node_num < match_num) {
 				if (e->negative)
 					*match = -e->node_num;
@@ -253,6 +401,118 @@ dns_acl_match(const isc_netaddr_t *reqaddr,
 			break;
 		}
 	}
+}
+
+/*
+ * Set 'pfx' to the host prefix to be matched for 'reqaddr' in 'env'.
+ */
+static void
+make_prefix(const isc_netaddr_t *reqaddr, const dns_aclenv_t *env,
+	    isc_prefix_t *pfx)
+{
+	const isc_netaddr_t *addr = reqaddr;
+	isc_netaddr_t v4addr;
+	uint16_t bitlen;
+
+	if (env != NULL && env->match_mapped &&
+	    addr->family == AF_INET6 &&
+	    IN6_IS_ADDR_V4MAPPED(&addr->type.in6))
+	{
+		isc_netaddr_fromv4mapped(&v4addr, addr);
+		addr = &v4addr;
+	}
+
+	/* Always match with host addresses. */
+	bitlen = (addr->family == AF_INET6) ? 128 : 32;
+	NETADDR_TO_PREFIX_T(addr, *pfx, bitlen);
+}
+
+/*
+ * Determine whether a given address or signer matches a given ACL.
+ * For a match with a positive ACL element or iptable radix entry,
+ * return with a positive value in match; for a match with a negated ACL
+ * element or radix entry, return with a negative value in match.
+ */
+
+isc_result_t
+dns_acl_match(const isc_netaddr_t *reqaddr,
+	      const dns_name_t *reqsigner,
+	      const dns_acl_t *acl,
+	      const dns_aclenv_t *env,
+	      int *match,
+	      const dns_aclelement_t **matchelt)
+{
+	isc_prefix_t pfx;
+#ifdef ACL_CACHE
+	aclcache_t *cache = NULL;
+	aclcache_entry_t *set = NULL, *entry;
+	const dns_aclelement_t *elt = NULL, **eltp = matchelt;
+	unsigned int epoch = 0, i;
+	size_t len = 0;
+	bool mapped = false;
+#endif
+
+	REQUIRE(reqaddr != NULL);
+	REQUIRE(matchelt == NULL || *matchelt == NULL);
+
+#ifdef ACL_CACHE
+	if (reqsigner == NULL &&
+	    (reqaddr->family == AF_INET || reqaddr->family == AF_INET6) &&
+	    (acl->length != 0 || acl->node_count > CACHE_MINNODES))
+	{
+		cache = getcache();
+	}
+	if (cache != NULL) {
+		len = (reqaddr->family == AF_INET6) ? 16 : 4;
+		mapped = (env != NULL && env->match_mapped);
+		epoch = (unsigned int)atomic_load_explicit(&cache_epoch,
+							   memory_order_acquire);
+		set = cache->sets[cache_hash(acl, (const unsigned char *)
+						  &reqaddr->type, len)];
+		for (i = 0; i < CACHE_WAYS; i++) {
+			entry = &set[i];
+			if (entry->acl != acl || entry->env != env ||
+			    entry->epoch != epoch ||
+			    entry->family != reqaddr->family ||
+			    entry->mapped != mapped ||
+			    memcmp(entry->addr, &reqaddr->type, len) != 0)
+			{
+				continue;
+			}
+			*match = entry->match;
+			if (matchelt != NULL)
+				*matchelt = entry->matchelt;
+			if (i != 0) {
+				aclcache_entry_t hit = *entry;
+				memmove(&set[1], &set[0], i * sizeof(*entry));
+				set[0] = hit;
+			}
+			return (ISC_R_SUCCESS);
+		}
+		eltp = &elt;
+	}
+#endif
+
+	make_prefix(reqaddr, env, &pfx);
+	acl_match(reqaddr, &pfx, reqsigner, acl, env, match, eltp);
+	isc_refcount_destroy(&pfx.refcount);
+
+#ifdef ACL_CACHE
+	if (cache != NULL) {
+		memmove(&set[1], &set[0], (CACHE_WAYS - 1) * sizeof(*set));
+		entry = &set[0];
+		entry->acl = acl;
+		entry->env = env;
+		entry->matchelt = elt;
+		entry->epoch = epoch;
+		entry->match = *match;
+		entry->family = reqaddr->family;
+		entry->mapped = mapped;
+		memmove(entry->addr, &reqaddr->type, len);
+		if (matchelt != NULL)
+			*matchelt = elt;
+	}
+#endif
 
 	return (ISC_R_SUCCESS);
 }
@@ -382,10 +642,24 @@ dns_aclelement_match(const isc_netaddr_t *reqaddr,
 		     const dns_aclelement_t *e,
 		     const dns_aclenv_t *env,
 		     const dns_aclelement_t **matchelt)
+{
+	isc_prefix_t pfx;
+	bool matched;
+
+	make_prefix(reqaddr, env, &pfx);
+	matched = element_match(reqaddr, &pfx, reqsigner, e, env, matchelt);
+	isc_refcount_destroy(&pfx.refcount);
+
+	return (matched);
+}
+
+static bool
+element_match(const isc_netaddr_t *reqaddr, isc_prefix_t *pfx,
+	      const dns_name_t *reqsigner, const dns_aclelement_t *e,
+	      const dns_aclenv_t *env, const dns_aclelement_t **matchelt)
 {
 	dns_acl_t *inner = NULL;
 	int indirectmatch;
-	isc_result_t result;
 
 	switch (e->type) {
 	case dns_aclelementtype_keyname:
@@ -424,9 +698,7 @@ dns_aclelement_match(const isc_netaddr_t *reqaddr,
 		INSIST(0);
 	}
 
-	result = dns_acl_match(reqaddr, reqsigner, inner, env,
-			       &indirectmatch, matchelt);
-	INSIST(result == ISC_R_SUCCESS);
+	acl_match(reqaddr, pfx, reqsigner, inner, env, &indirectmatch, matchelt);
 
 	/*
 	 * Treat negative matches in indirect ACLs as "no match".
@@ -665,6 +937,7 @@ dns_aclenv_copy(dns_aclenv_t *t, dns_aclenv_t *s) {
 #ifdef HAVE_GEOIP
 	t->geoip = s->geoip;
 #endif
+	dns_acl_flushcache();
 }
 
 void
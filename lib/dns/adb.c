@@ -4049,7 +4049,7 @@ fetch_name(dns_adbname_t *adbname, bool start_at_zone,
 
 	result = dns_resolver_createfetch(adb->view->resolver, &adbname->name,
 					  type, name, nameservers, NULL,
-					  NULL, 0, options, depth, qc,
+					  NULL, 0, NULL, options, depth, qc,
 					  adb->task, fetch_callback, adbname,
 					  &fetch->rdataset, NULL,
 					  &fetch->fetch);
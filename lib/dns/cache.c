@@ -1423,6 +1423,12 @@ dns_cache_dumpstats(dns_cache_t *cache, FILE *fp) {
 	fprintf(fp, "%20" PRIu64 " %s\n",
 		values[dns_cachestatscounter_deletettl],
 		"cache records deleted due to TTL expiration");
+	fprintf(fp, "%20" PRIu64 " %s\n",
+		values[dns_cachestatscounter_scopedhits],
+		"cache hits (client subnet scoped)");
+	fprintf(fp, "%20" PRIu64 " %s\n",
+		values[dns_cachestatscounter_scopedmisses],
+		"cache misses (client subnet scoped)");
 	fprintf(fp, "%20u %s\n", dns_db_nodecount(cache->db),
 		"cache database nodes");
 	fprintf(fp, "%20" PRIu64 " %s\n",
@@ -1490,6 +1496,10 @@ dns_cache_renderxml(dns_cache_t *cache, xmlTextWriterPtr writer) {
 		   values[dns_cachestatscounter_deletelru], writer));
 	TRY0(renderstat("DeleteTTL",
 		   values[dns_cachestatscounter_deletettl], writer));
+	TRY0(renderstat("ScopedHits",
+		   values[dns_cachestatscounter_scopedhits], writer));
+	TRY0(renderstat("ScopedMisses",
+		   values[dns_cachestatscounter_scopedmisses], writer));
 
 	TRY0(renderstat("CacheNodes", dns_db_nodecount(cache->db), writer));
 	TRY0(renderstat("CacheBuckets", dns_db_hashsize(cache->db), writer));
@@ -1550,6 +1560,14 @@ dns_cache_renderjson(dns_cache_t *cache, json_object *cstats) {
 	CHECKMEM(obj);
 	json_object_object_add(cstats, "DeleteTTL", obj);
 
+	obj = json_object_new_int64(values[dns_cachestatscounter_scopedhits]);
+	CHECKMEM(obj);
+	json_object_object_add(cstats, "ScopedHits", obj);
+
+	obj = json_object_new_int64(values[dns_cachestatscounter_scopedmisses]);
+	CHECKMEM(obj);
+	json_object_object_add(cstats, "ScopedMisses", obj);
+
 	obj = json_object_new_int64(dns_db_nodecount(cache->db));
 	CHECKMEM(obj);
 	json_object_object_add(cstats, "CacheNodes", obj);
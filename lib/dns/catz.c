@@ -73,6 +73,16 @@ struct dns_catz_zone {
 	isc_refcount_t		refs;
 };
 
+/*%
+ * Size limits (in bits) of the member zone hash tables.  isc_ht tables
+ * don't grow, so they are sized from the expected number of members.
+ */
+#define CATZ_HT_MINBITS		4
+#define CATZ_HT_MAXBITS		20
+
+static isc_result_t
+catz_new_zone(dns_catz_zones_t *catzs, dns_catz_zone_t **zonep,
+	      const dns_name_t *name, uint8_t bits);
 static isc_result_t
 catz_process_zones_entry(dns_catz_zone_t *zone, dns_rdataset_t *value,
 			 dns_label_t *mhash);
@@ -95,6 +105,20 @@ struct dns_catz_zones {
 	isc_task_t			*updater;
 };
 
+/*
+ * Return the number of bits for a hash table expected to hold 'count'
+ * entries.
+ */
+static uint8_t
+catz_htbits(unsigned int count) {
+	uint8_t bits = CATZ_HT_MINBITS;
+
+	while (bits < CATZ_HT_MAXBITS && ((size_t)1 << bits) < count)
+		bits++;
+
+	return (bits);
+}
+
 void
 dns_catz_options_init(dns_catz_options_t *options) {
 	dns_ipkeylist_init(&options->masters);
@@ -341,6 +365,7 @@ dns_catz_zones_merge(dns_catz_zone_t *target, dns_catz_zone_t *newzone) {
 	char czname[DNS_NAME_FORMATSIZE];
 	char zname[DNS_NAME_FORMATSIZE];
 	dns_catz_zoneop_fn_t addzone, modzone, delzone;
+	uint8_t bits;
 
 	REQUIRE(target != NULL);
 	REQUIRE(newzone != NULL);
@@ -361,11 +386,12 @@ dns_catz_zones_merge(dns_catz_zone_t *target, dns_catz_zone_t *newzone) {
 
 	dns_name_format(&target->name, czname, DNS_NAME_FORMATSIZE);
 
-	result = isc_ht_init(&toadd, target->catzs->mctx, 16);
+	bits = catz_htbits(isc_ht_count(newzone->entries));
+	result = isc_ht_init(&toadd, target->catzs->mctx, bits);
 	if (result != ISC_R_SUCCESS)
 		goto cleanup;
 
-	result = isc_ht_init(&tomod, target->catzs->mctx, 16);
+	result = isc_ht_init(&tomod, target->catzs->mctx, bits);
 	if (result != ISC_R_SUCCESS)
 		goto cleanup;
 
@@ -418,12 +444,14 @@ dns_catz_zones_merge(dns_catz_zone_t *target, dns_catz_zone_t *newzone) {
 			continue;
 		}
 
-		dns_name_format(&nentry->name, zname, DNS_NAME_FORMATSIZE);
-
-		isc_log_write(dns_lctx, DNS_LOGCATEGORY_GENERAL,
-			      DNS_LOGMODULE_MASTER, ISC_LOG_DEBUG(3),
-			      "catz: iterating over '%s' from catalog '%s'",
-			      zname, czname);
+		if (isc_log_wouldlog(dns_lctx, ISC_LOG_DEBUG(3))) {
+			dns_name_format(&nentry->name, zname,
+					DNS_NAME_FORMATSIZE);
+			isc_log_write(dns_lctx, DNS_LOGCATEGORY_GENERAL,
+				      DNS_LOGMODULE_MASTER, ISC_LOG_DEBUG(3),
+				      "catz: iterating over '%s' from "
+				      "catalog '%s'", zname, czname);
+		}
 		dns_catz_options_setdefault(target->catzs->mctx,
 					    &target->zoneoptions,
 					    &nentry->opts);
@@ -433,7 +461,9 @@ dns_catz_zones_merge(dns_catz_zone_t *target, dns_catz_zone_t *newzone) {
 		if (result != ISC_R_SUCCESS) {
 			result = isc_ht_add(toadd, key, (uint32_t)keysize,
 					    nentry);
-			if (result != ISC_R_SUCCESS)
+			if (result != ISC_R_SUCCESS) {
+				dns_name_format(&nentry->name, zname,
+						DNS_NAME_FORMATSIZE);
 				isc_log_write(dns_lctx, DNS_LOGCATEGORY_GENERAL,
 					      DNS_LOGMODULE_MASTER,
 					      ISC_LOG_ERROR,
@@ -441,13 +471,16 @@ dns_catz_zones_merge(dns_catz_zone_t *target, dns_catz_zone_t *newzone) {
 					      "from catalog '%s' - %s",
 					      zname, czname,
 					      isc_result_totext(result));
+			}
 			continue;
 		}
 
 		if (dns_catz_entry_cmp(oentry, nentry) != true) {
 			result = isc_ht_add(tomod, key, (uint32_t)keysize,
 					    nentry);
-			if (result != ISC_R_SUCCESS)
+			if (result != ISC_R_SUCCESS) {
+				dns_name_format(&nentry->name, zname,
+						DNS_NAME_FORMATSIZE);
 				isc_log_write(dns_lctx, DNS_LOGCATEGORY_GENERAL,
 					      DNS_LOGMODULE_MASTER,
 					      ISC_LOG_ERROR,
@@ -455,6 +488,7 @@ dns_catz_zones_merge(dns_catz_zone_t *target, dns_catz_zone_t *newzone) {
 					      "from catalog '%s' - %s",
 					      zname, czname,
 					      isc_result_totext(result));
+			}
 		}
 		dns_catz_entry_detach(target, &oentry);
 		result = isc_ht_delete(target->entries, key,
@@ -515,6 +549,8 @@ dns_catz_zones_merge(dns_catz_zone_t *target, dns_catz_zone_t *newzone) {
 	{
 		dns_catz_entry_t *entry;
 		isc_ht_iter_current(itermod, (void **) &entry);
+
+		dns_name_format(&entry->name, zname, DNS_NAME_FORMATSIZE);
 		result = modzone(entry, target, target->catzs->view,
 				 target->catzs->taskmgr,
 				 target->catzs->zmm->udata);
@@ -613,6 +649,13 @@ dns_catz_catzs_set_view(dns_catz_zones_t *catzs, dns_view_t *view) {
 isc_result_t
 dns_catz_new_zone(dns_catz_zones_t *catzs, dns_catz_zone_t **zonep,
 		  const dns_name_t *name)
+{
+	return (catz_new_zone(catzs, zonep, name, CATZ_HT_MINBITS));
+}
+
+static isc_result_t
+catz_new_zone(dns_catz_zones_t *catzs, dns_catz_zone_t **zonep,
+	      const dns_name_t *name, uint8_t bits)
 {
 	isc_result_t result;
 	dns_catz_zone_t *new_zone;
@@ -631,7 +674,7 @@ dns_catz_new_zone(dns_catz_zones_t *catzs, dns_catz_zone_t **zonep,
 	if (result != ISC_R_SUCCESS)
 		goto cleanup_newzone;
 
-	result = isc_ht_init(&new_zone->entries, catzs->mctx, 4);
+	result = isc_ht_init(&new_zone->entries, catzs->mctx, bits);
 	if (result != ISC_R_SUCCESS)
 		goto cleanup_name;
 
@@ -1785,7 +1828,13 @@ dns_catz_update_from_db(dns_db_t *db, dns_catz_zones_t *catzs) {
 		      "catz: updating catalog zone '%s' with serial %d",
 		      bname, vers);
 
-	result = dns_catz_new_zone(catzs, &newzone, &db->origin);
+	/*
+	 * The catalog has at most one member per node, so size the new
+	 * member table from the node count; this keeps the parse linear
+	 * in the size of very large catalogs.
+	 */
+	result = catz_new_zone(catzs, &newzone, &db->origin,
+			       catz_htbits(dns_db_nodecount(db)));
 	if (result != ISC_R_SUCCESS) {
 		dns_db_closeversion(db, &oldzone->dbversion, false);
 		isc_log_write(dns_lctx, DNS_LOGCATEGORY_GENERAL,
@@ -774,7 +774,7 @@ start_fetch(resctx_t *rctx) {
 	result = dns_resolver_createfetch(rctx->view->resolver,
 					  dns_fixedname_name(&rctx->name),
 					  rctx->type,
-					  NULL, NULL, NULL, NULL, 0,
+					  NULL, NULL, NULL, NULL, 0, NULL,
 					  fopts, 0, NULL,
 					  rctx->task, fetch_done, rctx,
 					  rctx->rdataset,
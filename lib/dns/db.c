@@ -31,6 +31,7 @@
 #include <dns/clientinfo.h>
 #include <dns/db.h>
 #include <dns/dbiterator.h>
+#include <dns/ecs.h>
 #include <dns/log.h>
 #include <dns/master.h>
 #include <dns/rdata.h>
@@ -743,6 +744,34 @@ dns_db_addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 					   options, addedrdataset));
 }
 
+isc_result_t
+dns_db_addscopedrdataset(dns_db_t *db, dns_dbnode_t *node, isc_stdtime_t now,
+			 dns_rdataset_t *rdataset, unsigned int options,
+			 const dns_ecs_t *ecs, dns_rdataset_t *addedrdataset)
+{
+	REQUIRE(DNS_DB_VALID(db));
+	REQUIRE((db->attributes & DNS_DBATTR_CACHE) != 0);
+	REQUIRE(node != NULL);
+	REQUIRE((options & DNS_DBADD_MERGE) == 0);
+	REQUIRE(DNS_RDATASET_VALID(rdataset));
+	REQUIRE(dns_rdataset_isassociated(rdataset));
+	REQUIRE(rdataset->rdclass == db->rdclass);
+	REQUIRE(addedrdataset == NULL ||
+		(DNS_RDATASET_VALID(addedrdataset) &&
+		 ! dns_rdataset_isassociated(addedrdataset)));
+
+	if (ecs == NULL || ecs->scope == 0)
+		return ((db->methods->addrdataset)(db, node, NULL, now,
+						   rdataset, options,
+						   addedrdataset));
+
+	if (db->methods->addscopedrdataset == NULL)
+		return (ISC_R_NOTIMPLEMENTED);
+
+	return ((db->methods->addscopedrdataset)(db, node, now, rdataset,
+						 options, ecs, addedrdataset));
+}
+
 isc_result_t
 dns_db_subtractrdataset(dns_db_t *db, dns_dbnode_t *node,
 			dns_dbversion_t *version, dns_rdataset_t *rdataset,
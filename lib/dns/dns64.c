@@ -11,6 +11,7 @@
 
 #include <config.h>
 
+#include <inttypes.h>
 #include <stdbool.h>
 
 #include <isc/list.h>
@@ -121,12 +122,38 @@ dns_dns64_destroy(dns_dns64_t **dns64p) {
 	isc_mem_putanddetach(&dns64->mctx, dns64, sizeof(*dns64));
 }
 
+/*
+ * Write to 'aaaa' the address synthesized by 'dns64' from 'a'.
+ */
+static void
+synthesize(const dns_dns64_t *dns64, const unsigned char *a,
+	   unsigned char *aaaa)
+{
+	unsigned int nbytes, i;
+
+	nbytes = dns64->prefixlen / 8;
+	INSIST(nbytes <= 12);
+	/* Copy prefix. */
+	memmove(aaaa, dns64->bits, nbytes);
+	/* Bits 64-71 are zeros. rfc6052.txt */
+	if (nbytes == 8)
+		aaaa[nbytes++] = 0;
+	/* Copy mapped address. */
+	for (i = 0; i < 4U; i++) {
+		aaaa[nbytes++] = a[i];
+		/* Bits 64-71 are zeros. rfc6052.txt */
+		if (nbytes == 8)
+			aaaa[nbytes++] = 0;
+	}
+	/* Copy suffix. */
+	memmove(aaaa + nbytes, dns64->bits + nbytes, 16 - nbytes);
+}
+
 isc_result_t
 dns_dns64_aaaafroma(const dns_dns64_t *dns64, const isc_netaddr_t *reqaddr,
 		    const dns_name_t *reqsigner, const dns_aclenv_t *env,
 		    unsigned int flags, unsigned char *a, unsigned char *aaaa)
 {
-	unsigned int nbytes, i;
 	isc_result_t result;
 	int match;
 
@@ -161,22 +188,119 @@ dns_dns64_aaaafroma(const dns_dns64_t *dns64, const isc_netaddr_t *reqaddr,
 			return (DNS_R_DISALLOWED);
 	}
 
-	nbytes = dns64->prefixlen / 8;
-	INSIST(nbytes <= 12);
-	/* Copy prefix. */
-	memmove(aaaa, dns64->bits, nbytes);
-	/* Bits 64-71 are zeros. rfc6052.txt */
-	if (nbytes == 8)
-		aaaa[nbytes++] = 0;
-	/* Copy mapped address. */
-	for (i = 0; i < 4U; i++) {
-		aaaa[nbytes++] = a[i];
-		/* Bits 64-71 are zeros. rfc6052.txt */
-		if (nbytes == 8)
-			aaaa[nbytes++] = 0;
+	synthesize(dns64, a, aaaa);
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Whether 'dns64' applies to the client described by 'reqaddr',
+ * 'reqsigner' and 'flags'.
+ */
+static bool
+dns64_applies(const dns_dns64_t *dns64, const isc_netaddr_t *reqaddr,
+	      const dns_name_t *reqsigner, const dns_aclenv_t *env,
+	      unsigned int flags)
+{
+	isc_result_t result;
+	int match;
+
+	if ((dns64->flags & DNS_DNS64_RECURSIVE_ONLY) != 0 &&
+	    (flags & DNS_DNS64_RECURSIVE) == 0)
+		return (false);
+
+	if ((dns64->flags & DNS_DNS64_BREAK_DNSSEC) == 0 &&
+	    (flags & DNS_DNS64_DNSSEC) != 0)
+		return (false);
+
+	if (dns64->clients != NULL) {
+		result = dns_acl_match(reqaddr, reqsigner, dns64->clients,
+				       env, &match, NULL);
+		if (result != ISC_R_SUCCESS || match <= 0)
+			return (false);
 	}
-	/* Copy suffix. */
-	memmove(aaaa + nbytes, dns64->bits + nbytes, 16 - nbytes);
+
+	return (true);
+}
+
+isc_result_t
+dns_dns64_aaaafromrdataset(const dns_dns64_t *dns64,
+			   const isc_netaddr_t *reqaddr,
+			   const dns_name_t *reqsigner,
+			   const dns_aclenv_t *env, unsigned int flags,
+			   dns_rdataset_t *rdataset, unsigned char *aaaa,
+			   size_t aaaalen, unsigned int *countp)
+{
+	const dns_dns64_t *d;
+	uint64_t applies = 0;
+	unsigned int i, count = 0;
+	isc_result_t result;
+
+	REQUIRE(rdataset != NULL);
+	REQUIRE(rdataset->type == dns_rdatatype_a);
+	REQUIRE(rdataset->rdclass == dns_rdataclass_in);
+	REQUIRE(aaaa != NULL);
+	REQUIRE(countp != NULL);
+
+	/*
+	 * Decide once which records apply to this client.  Records
+	 * beyond the first 64 are checked for each address.
+	 */
+	for (d = dns64, i = 0; d != NULL && i < 64;
+	     d = ISC_LIST_NEXT(d, link), i++)
+	{
+		if (dns64_applies(d, reqaddr, reqsigner, env, flags))
+			applies |= (uint64_t)1 << i;
+	}
+	if (applies == 0 && d == NULL) {
+		*countp = 0;
+		return (ISC_R_SUCCESS);
+	}
+
+	for (result = dns_rdataset_first(rdataset);
+	     result == ISC_R_SUCCESS;
+	     result = dns_rdataset_next(rdataset))
+	{
+		dns_rdata_t rdata = DNS_RDATA_INIT;
+
+		dns_rdataset_current(rdataset, &rdata);
+		INSIST(rdata.length == 4);
+
+		for (d = dns64, i = 0; d != NULL;
+		     d = ISC_LIST_NEXT(d, link), i++)
+		{
+			if (i < 64) {
+				if ((applies & ((uint64_t)1 << i)) == 0)
+					continue;
+			} else if (!dns64_applies(d, reqaddr, reqsigner,
+						  env, flags))
+			{
+				continue;
+			}
+
+			if (d->mapped != NULL) {
+				struct in_addr ina;
+				isc_netaddr_t netaddr;
+				int match;
+
+				memmove(&ina.s_addr, rdata.data, 4);
+				isc_netaddr_fromin(&netaddr, &ina);
+				result = dns_acl_match(&netaddr, NULL,
+						       d->mapped, env,
+						       &match, NULL);
+				if (result != ISC_R_SUCCESS || match <= 0)
+					continue;
+			}
+
+			if ((count + 1) * 16 > aaaalen)
+				return (ISC_R_NOSPACE);
+			synthesize(d, rdata.data, aaaa + count * 16);
+			count++;
+		}
+	}
+	if (result != ISC_R_NOMORE)
+		return (result);
+
+	*countp = count;
 	return (ISC_R_SUCCESS);
 }
 
@@ -965,7 +965,8 @@ static dns_dbmethods_t rpsdb_db_methods = {
 	NULL,			/* getsize */
 	NULL,			/* setservestalettl */
 	NULL,			/* getservestalettl */
-	NULL			/* setgluecachestats */
+	NULL,			/* setgluecachestats */
+	NULL			/* addscopedrdataset */
 };
 
 static dns_rdatasetmethods_t rpsdb_rdataset_methods = {
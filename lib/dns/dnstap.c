@@ -55,20 +55,28 @@
 
 #include <isc/buffer.h>
 #include <isc/file.h>
+#include <isc/hash.h>
 #include <isc/log.h>
 #include <isc/mem.h>
 #include <isc/mutex.h>
 #include <isc/once.h>
 #include <isc/print.h>
 #include <isc/sockaddr.h>
+#include <isc/stdtime.h>
 #include <isc/task.h>
 #include <isc/thread.h>
 #include <isc/time.h>
 #include <isc/types.h>
 #include <isc/util.h>
 
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+#include <stdatomic.h>
+#endif
+
+#include <dns/compress.h>
 #include <dns/dnstap.h>
 #include <dns/events.h>
+#include <dns/fixedname.h>
 #include <dns/log.h>
 #include <dns/message.h>
 #include <dns/name.h>
@@ -85,15 +93,105 @@
 #define VALID_DTENV(env)		ISC_MAGIC_VALID(env, DTENV_MAGIC)
 
 #define DNSTAP_CONTENT_TYPE	"protobuf:dnstap.Dnstap"
-#define DNSTAP_INITIAL_BUF_SIZE 256
 
+/*
+ * Outgoing messages are encoded directly in the protobuf wire format
+ * rather than by filling in Dnstap__Dnstap structures and packing them
+ * with protobuf-c.  A field key is the field number (from dnstap.proto)
+ * shifted left three bits, or'ed with the wire type; all the keys used
+ * here fit in a single byte.
+ */
+#define PB_VARINT		0
+#define PB_FIXED64		1
+#define PB_LENGTH		2
+#define PB_FIXED32		5
+#define PB_KEY(f, t)		(((f) << 3) | (t))
+
+#define DT_IDENTITY		PB_KEY(1, PB_LENGTH)
+#define DT_VERSION		PB_KEY(2, PB_LENGTH)
+#define DT_MESSAGE		PB_KEY(14, PB_LENGTH)
+#define DT_TYPE			PB_KEY(15, PB_VARINT)
+
+#define DTM_TYPE		PB_KEY(1, PB_VARINT)
+#define DTM_FAMILY		PB_KEY(2, PB_VARINT)
+#define DTM_PROTOCOL		PB_KEY(3, PB_VARINT)
+#define DTM_QADDR		PB_KEY(4, PB_LENGTH)
+#define DTM_RADDR		PB_KEY(5, PB_LENGTH)
+#define DTM_QPORT		PB_KEY(6, PB_VARINT)
+#define DTM_RPORT		PB_KEY(7, PB_VARINT)
+#define DTM_QSEC		PB_KEY(8, PB_VARINT)
+#define DTM_QNSEC		PB_KEY(9, PB_FIXED32)
+#define DTM_QMSG		PB_KEY(10, PB_LENGTH)
+#define DTM_ZONE		PB_KEY(11, PB_LENGTH)
+#define DTM_RSEC		PB_KEY(12, PB_VARINT)
+#define DTM_RNSEC		PB_KEY(13, PB_FIXED32)
+#define DTM_RMSG		PB_KEY(14, PB_LENGTH)
+
+/*
+ * The fields of an outgoing dnstap message.  Fields which are zero,
+ * or regions with a NULL base, are not encoded; ports are encoded
+ * with their addresses.
+ */
 struct dns_dtmsg {
-	void *buf;
-	size_t len;
-	Dnstap__Dnstap d;
-	Dnstap__Message m;
+	uint32_t type;
+	uint32_t family;
+	uint32_t protocol;
+	isc_region_t qaddr;
+	isc_region_t raddr;
+	uint32_t qport;
+	uint32_t rport;
+	bool has_qtime;
+	uint32_t qsec;
+	uint32_t qnsec;
+	bool has_rtime;
+	uint32_t rsec;
+	uint32_t rnsec;
+	isc_region_t qmsg;
+	isc_region_t zone;
+	isc_region_t rmsg;
 };
 
+#if defined(ISC_PLATFORM_HAVESTDATOMIC) && defined(ATOMIC_INT_LOCK_FREE)
+/*
+ * Each thread encodes messages into slots taken in turn from a slab
+ * of its own, so that sending a message does not allocate memory.  A
+ * slot stays busy until the I/O thread has written it out and called
+ * dt_slotfree(), which may happen after the thread that filled it has
+ * exited, so a slab is reference counted: its thread holds one
+ * reference and each busy slot another.  A message which is too large
+ * for a slot, or which finds the next slot still busy, is allocated
+ * with malloc() instead.
+ */
+#define DT_SLAB 1
+#define DT_SLOTSIZE	2048
+#define DT_NSLOTS	256
+
+typedef struct dt_slab dt_slab_t;
+
+typedef struct dt_slot {
+	dt_slab_t *slab;
+	atomic_bool busy;
+	unsigned char data[DT_SLOTSIZE];
+} dt_slot_t;
+
+struct dt_slab {
+	atomic_uint_fast32_t refs;
+	unsigned int next;
+	dt_slot_t slots[DT_NSLOTS];
+};
+#endif
+
+/*
+ * Per-thread state, kept in 'dt_key'.
+ */
+typedef struct dt_thread {
+	unsigned int generation;
+	struct fstrm_iothr_queue *ioq;
+#ifdef DT_SLAB
+	dt_slab_t *slab;
+#endif
+} dt_thread_t;
+
 struct dns_dthandle {
 	dns_dtmode_t mode;
 	struct fstrm_reader *reader;
@@ -110,8 +208,10 @@ struct dns_dtenv {
 	struct fstrm_iothr_options *fopt;
 
 	isc_task_t *reopen_task;
-	isc_mutex_t reopen_lock;	/* locks 'reopen_queued' */
+	isc_mutex_t reopen_lock;	/* locks 'reopen_queued' and
+					   'size_checked' */
 	bool reopen_queued;
+	isc_stdtime_t size_checked;
 
 	isc_region_t identity;
 	isc_region_t version;
@@ -145,9 +245,60 @@ mutex_init(void) {
 	RUNTIME_CHECK(isc_mutex_init(&dt_mutex) == ISC_R_SUCCESS);
 }
 
+#ifdef DT_SLAB
+static dt_slab_t *
+dt_slabcreate(void) {
+	dt_slab_t *slab;
+	unsigned int i;
+
+	/* Need to use malloc() here because the slab may be freed by fstrm */
+	slab = malloc(sizeof(*slab));
+	if (slab == NULL)
+		return (NULL);
+
+	atomic_init(&slab->refs, 1);
+	slab->next = 0;
+	for (i = 0; i < DT_NSLOTS; i++) {
+		slab->slots[i].slab = slab;
+		atomic_init(&slab->slots[i].busy, false);
+	}
+
+	return (slab);
+}
+
+static void
+dt_slabdetach(dt_slab_t *slab) {
+	if (atomic_fetch_sub_explicit(&slab->refs, 1,
+				      memory_order_acq_rel) == 1)
+	{
+		free(slab);
+	}
+}
+
+/*
+ * Called by fstrm when it is done with a slot.
+ */
+static void
+dt_slotfree(void *buf, void *arg) {
+	dt_slot_t *slot = arg;
+	dt_slab_t *slab = slot->slab;
+
+	UNUSED(buf);
+
+	atomic_store_explicit(&slot->busy, false, memory_order_release);
+	dt_slabdetach(slab);
+}
+#endif /* DT_SLAB */
+
 static void
 dtfree(void *arg) {
-	free(arg);
+	dt_thread_t *dtt = arg;
+
+#ifdef DT_SLAB
+	if (dtt->slab != NULL)
+		dt_slabdetach(dtt->slab);
+#endif
+	free(dtt);
 	isc_thread_key_setspecific(dt_key, NULL);
 }
 
@@ -481,13 +632,15 @@ dns_dt_setversion(dns_dtenv_t *env, const char *version) {
 	return (toregion(env, &env->version, version));
 }
 
-static struct fstrm_iothr_queue *
-dt_queue(dns_dtenv_t *env) {
+/*
+ * Return the calling thread's state, creating it if need be.  Each
+ * thread has its own fstrm input queue, which is replaced when the
+ * I/O thread is, and its own slab of message buffers, which is kept.
+ */
+static dt_thread_t *
+dt_thread(dns_dtenv_t *env) {
 	isc_result_t result;
-	struct ioq {
-		unsigned int generation;
-		struct fstrm_iothr_queue *ioq;
-	} *ioq;
+	dt_thread_t *dtt;
 
 	REQUIRE(VALID_DTENV(env));
 
@@ -498,32 +651,35 @@ dt_queue(dns_dtenv_t *env) {
 	if (result != ISC_R_SUCCESS)
 		return (NULL);
 
-	ioq = (struct ioq *)isc_thread_key_getspecific(dt_key);
-	if (ioq != NULL && ioq->generation != generation) {
-		result = isc_thread_key_setspecific(dt_key, NULL);
-		if (result != ISC_R_SUCCESS)
+	dtt = (dt_thread_t *)isc_thread_key_getspecific(dt_key);
+	if (dtt == NULL) {
+		dtt = malloc(sizeof(*dtt));
+		if (dtt == NULL)
 			return (NULL);
-		free(ioq);
-		ioq = NULL;
-	}
-	if (ioq == NULL) {
-		ioq = malloc(sizeof(*ioq));
-		if (ioq == NULL)
-			return (NULL);
-		ioq->generation = generation;
-		ioq->ioq = fstrm_iothr_get_input_queue(env->iothr);
-		if (ioq->ioq == NULL) {
-			free(ioq);
-			return (NULL);
-		}
-		result = isc_thread_key_setspecific(dt_key, ioq);
+		dtt->generation = generation;
+		dtt->ioq = NULL;
+#ifdef DT_SLAB
+		/* Without a slab, buffers are allocated as needed */
+		dtt->slab = dt_slabcreate();
+#endif
+		result = isc_thread_key_setspecific(dt_key, dtt);
 		if (result != ISC_R_SUCCESS) {
-			free(ioq);
+#ifdef DT_SLAB
+			if (dtt->slab != NULL)
+				dt_slabdetach(dtt->slab);
+#endif
+			free(dtt);
 			return (NULL);
 		}
 	}
+	if (dtt->ioq == NULL || dtt->generation != generation) {
+		dtt->generation = generation;
+		dtt->ioq = fstrm_iothr_get_input_queue(env->iothr);
+		if (dtt->ioq == NULL)
+			return (NULL);
+	}
 
-	return (ioq->ioq);
+	return (dtt);
 }
 
 void
@@ -592,55 +748,221 @@ dns_dt_detach(dns_dtenv_t **envp) {
 		destroy(env);
 }
 
-static isc_result_t
-pack_dt(const Dnstap__Dnstap *d, void **buf, size_t *sz) {
-	ProtobufCBufferSimple sbuf;
+static inline size_t
+pb_varintlen(uint64_t val) {
+	size_t len = 1;
 
-	REQUIRE(d != NULL);
-	REQUIRE(sz != NULL);
+	while (val >= 0x80) {
+		val >>= 7;
+		len++;
+	}
 
-	memset(&sbuf, 0, sizeof(sbuf));
-	sbuf.base.append = protobuf_c_buffer_simple_append;
-	sbuf.len = 0;
-	sbuf.alloced = DNSTAP_INITIAL_BUF_SIZE;
+	return (len);
+}
 
-	/* Need to use malloc() here because protobuf uses free() */
-	sbuf.data = malloc(sbuf.alloced);
-	if (sbuf.data == NULL)
-		return (ISC_R_NOMEMORY);
-	sbuf.must_free_data = 1;
+static inline unsigned char *
+pb_putvarint(unsigned char *p, uint64_t val) {
+	while (val >= 0x80) {
+		*p++ = (unsigned char)(val | 0x80);
+		val >>= 7;
+	}
+	*p++ = (unsigned char)val;
 
-	*sz = dnstap__dnstap__pack_to_buffer(d, (ProtobufCBuffer *) &sbuf);
-	if (sbuf.data == NULL)
-		return (ISC_R_FAILURE);
-	*buf = sbuf.data;
+	return (p);
+}
 
-	return (ISC_R_SUCCESS);
+static inline unsigned char *
+pb_putuint(unsigned char *p, uint8_t key, uint64_t val) {
+	*p++ = key;
+	return (pb_putvarint(p, val));
+}
+
+static inline unsigned char *
+pb_putfixed32(unsigned char *p, uint8_t key, uint32_t val) {
+	*p++ = key;
+	*p++ = (unsigned char)val;
+	*p++ = (unsigned char)(val >> 8);
+	*p++ = (unsigned char)(val >> 16);
+	*p++ = (unsigned char)(val >> 24);
+
+	return (p);
+}
+
+static inline unsigned char *
+pb_putbytes(unsigned char *p, uint8_t key, const isc_region_t *r) {
+	*p++ = key;
+	p = pb_putvarint(p, r->length);
+	if (r->length != 0)
+		memmove(p, r->base, r->length);
+
+	return (p + r->length);
+}
+
+#define UINTLEN(v)	(1 + pb_varintlen(v))
+#define FIXED32LEN	5
+#define BYTESLEN(r)	(1 + pb_varintlen((r)->length) + (r)->length)
+
+/*
+ * Return the encoded length of the Message in 'dm'.
+ */
+static size_t
+dt_msglen(const dns_dtmsg_t *dm) {
+	size_t len;
+
+	len = UINTLEN(dm->type);
+	if (dm->family != 0)
+		len += UINTLEN(dm->family);
+	if (dm->protocol != 0)
+		len += UINTLEN(dm->protocol);
+	if (dm->qaddr.base != NULL)
+		len += BYTESLEN(&dm->qaddr) + UINTLEN(dm->qport);
+	if (dm->raddr.base != NULL)
+		len += BYTESLEN(&dm->raddr) + UINTLEN(dm->rport);
+	if (dm->has_qtime)
+		len += UINTLEN(dm->qsec) + FIXED32LEN;
+	if (dm->qmsg.base != NULL)
+		len += BYTESLEN(&dm->qmsg);
+	if (dm->zone.base != NULL)
+		len += BYTESLEN(&dm->zone);
+	if (dm->has_rtime)
+		len += UINTLEN(dm->rsec) + FIXED32LEN;
+	if (dm->rmsg.base != NULL)
+		len += BYTESLEN(&dm->rmsg);
+
+	return (len);
+}
+
+/*
+ * Return the encoded length of a Dnstap frame holding a Message of
+ * 'msglen' bytes.
+ */
+static size_t
+dt_framelen(dns_dtenv_t *env, size_t msglen) {
+	size_t len;
+
+	len = 1 + pb_varintlen(msglen) + msglen + UINTLEN(1);
+	if (env->identity.length != 0)
+		len += BYTESLEN(&env->identity);
+	if (env->version.length != 0)
+		len += BYTESLEN(&env->version);
+
+	return (len);
+}
+
+/*
+ * Encode a Dnstap frame holding the Message in 'dm', which is
+ * 'msglen' bytes long, at 'p'.  Fields are written in field number
+ * order, as protobuf-c does.
+ */
+static unsigned char *
+dt_encode(dns_dtenv_t *env, const dns_dtmsg_t *dm, size_t msglen,
+	  unsigned char *p)
+{
+	if (env->identity.length != 0)
+		p = pb_putbytes(p, DT_IDENTITY, &env->identity);
+	if (env->version.length != 0)
+		p = pb_putbytes(p, DT_VERSION, &env->version);
+
+	p = pb_putuint(p, DT_MESSAGE, msglen);
+	p = pb_putuint(p, DTM_TYPE, dm->type);
+	if (dm->family != 0)
+		p = pb_putuint(p, DTM_FAMILY, dm->family);
+	if (dm->protocol != 0)
+		p = pb_putuint(p, DTM_PROTOCOL, dm->protocol);
+	if (dm->qaddr.base != NULL)
+		p = pb_putbytes(p, DTM_QADDR, &dm->qaddr);
+	if (dm->raddr.base != NULL)
+		p = pb_putbytes(p, DTM_RADDR, &dm->raddr);
+	if (dm->qaddr.base != NULL)
+		p = pb_putuint(p, DTM_QPORT, dm->qport);
+	if (dm->raddr.base != NULL)
+		p = pb_putuint(p, DTM_RPORT, dm->rport);
+	if (dm->has_qtime) {
+		p = pb_putuint(p, DTM_QSEC, dm->qsec);
+		p = pb_putfixed32(p, DTM_QNSEC, dm->qnsec);
+	}
+	if (dm->qmsg.base != NULL)
+		p = pb_putbytes(p, DTM_QMSG, &dm->qmsg);
+	if (dm->zone.base != NULL)
+		p = pb_putbytes(p, DTM_ZONE, &dm->zone);
+	if (dm->has_rtime) {
+		p = pb_putuint(p, DTM_RSEC, dm->rsec);
+		p = pb_putfixed32(p, DTM_RNSEC, dm->rnsec);
+	}
+	if (dm->rmsg.base != NULL)
+		p = pb_putbytes(p, DTM_RMSG, &dm->rmsg);
+
+	p = pb_putuint(p, DT_TYPE, DNSTAP__DNSTAP__TYPE__MESSAGE);
+
+	return (p);
+}
+
+/*
+ * Get a buffer of 'len' bytes to encode a frame into, and the function
+ * and argument with which fstrm is to free it.
+ */
+static unsigned char *
+dt_getbuf(dt_thread_t *dtt, size_t len,
+	  void (**freefuncp)(void *, void *), void **argp)
+{
+#ifdef DT_SLAB
+	dt_slab_t *slab = dtt->slab;
+
+	if (slab != NULL && len <= DT_SLOTSIZE) {
+		dt_slot_t *slot = &slab->slots[slab->next];
+
+		if (!atomic_load_explicit(&slot->busy, memory_order_acquire)) {
+			slab->next = (slab->next + 1) % DT_NSLOTS;
+			atomic_store_explicit(&slot->busy, true,
+					      memory_order_relaxed);
+			atomic_fetch_add_explicit(&slab->refs, 1,
+						  memory_order_relaxed);
+			*freefuncp = dt_slotfree;
+			*argp = slot;
+			return (slot->data);
+		}
+	}
+#else
+	UNUSED(dtt);
+#endif
+
+	/* Need to use malloc() here because fstrm uses free() */
+	*freefuncp = fstrm_free_wrapper;
+	*argp = NULL;
+	return (malloc(len));
 }
 
 static void
-send_dt(dns_dtenv_t *env, void *buf, size_t len) {
-	struct fstrm_iothr_queue *ioq;
+send_dt(dns_dtenv_t *env, const dns_dtmsg_t *dm) {
+	void (*freefunc)(void *, void *);
+	dt_thread_t *dtt;
+	unsigned char *buf, *end;
+	size_t len, msglen;
+	void *arg;
 	fstrm_res res;
 
 	REQUIRE(env != NULL);
 
-	if (buf == NULL)
+	dtt = dt_thread(env);
+	if (dtt == NULL)
 		return;
 
-	ioq = dt_queue(env);
-	if (ioq == NULL) {
-		free(buf);
+	msglen = dt_msglen(dm);
+	len = dt_framelen(env, msglen);
+	buf = dt_getbuf(dtt, len, &freefunc, &arg);
+	if (buf == NULL)
 		return;
-	}
 
-	res = fstrm_iothr_submit(env->iothr, ioq, buf, len,
-				 fstrm_free_wrapper, NULL);
+	end = dt_encode(env, dm, msglen, buf);
+	INSIST((size_t)(end - buf) == len);
+
+	res = fstrm_iothr_submit(env->iothr, dtt->ioq, buf, len,
+				 freefunc, arg);
 	if (res != fstrm_res_success) {
 		if (env->stats != NULL)
 			isc_stats_increment(env->stats,
 					    dns_dnstapcounter_drop);
-		free(buf);
+		(*freefunc)(buf, arg);
 	} else {
 		if (env->stats != NULL)
 			isc_stats_increment(env->stats,
@@ -648,28 +970,6 @@ send_dt(dns_dtenv_t *env, void *buf, size_t len) {
 	}
 }
 
-static void
-init_msg(dns_dtenv_t *env, dns_dtmsg_t *dm, Dnstap__Message__Type mtype) {
-	memset(dm, 0, sizeof(*dm));
-	dm->d.base.descriptor = &dnstap__dnstap__descriptor;
-	dm->m.base.descriptor = &dnstap__message__descriptor;
-	dm->d.type = DNSTAP__DNSTAP__TYPE__MESSAGE;
-	dm->d.message = &dm->m;
-	dm->m.type = mtype;
-
-	if (env->identity.length != 0) {
-		dm->d.identity.data = env->identity.base;
-		dm->d.identity.len = env->identity.length;
-		dm->d.has_identity = true;
-	}
-
-	if (env->version.length != 0) {
-		dm->d.version.data = env->version.base;
-		dm->d.version.len = env->version.length;
-		dm->d.has_version = true;
-	}
-}
-
 static Dnstap__Message__Type
 dnstap_type(dns_dtmsgtype_t msgtype) {
 	switch (msgtype) {
@@ -703,16 +1003,14 @@ dnstap_type(dns_dtmsgtype_t msgtype) {
 }
 
 static void
-cpbuf(isc_buffer_t *buf, ProtobufCBinaryData *p, protobuf_c_boolean *has) {
-	p->data = isc_buffer_base(buf);
-	p->len = isc_buffer_usedlength(buf);
-	*has = 1;
+cpbuf(isc_buffer_t *buf, isc_region_t *r) {
+	r->base = isc_buffer_base(buf);
+	r->length = isc_buffer_usedlength(buf);
 }
 
 static void
 setaddr(dns_dtmsg_t *dm, isc_sockaddr_t *sa, bool tcp,
-	ProtobufCBinaryData *addr, protobuf_c_boolean *has_addr,
-	uint32_t *port, protobuf_c_boolean *has_port)
+	isc_region_t *addr, uint32_t *port)
 {
 	int family = isc_sockaddr_pf(sa);
 
@@ -720,26 +1018,90 @@ setaddr(dns_dtmsg_t *dm, isc_sockaddr_t *sa, bool tcp,
 		return;
 
 	if (family == AF_INET6) {
-		dm->m.socket_family = DNSTAP__SOCKET_FAMILY__INET6;
-		addr->data = sa->type.sin6.sin6_addr.s6_addr;
-		addr->len = 16;
+		dm->family = DNSTAP__SOCKET_FAMILY__INET6;
+		addr->base = sa->type.sin6.sin6_addr.s6_addr;
+		addr->length = 16;
 		*port = ntohs(sa->type.sin6.sin6_port);
 	} else {
-		dm->m.socket_family = DNSTAP__SOCKET_FAMILY__INET;
-		addr->data = (uint8_t *) &sa->type.sin.sin_addr.s_addr;
-		addr->len = 4;
+		dm->family = DNSTAP__SOCKET_FAMILY__INET;
+		addr->base = (unsigned char *) &sa->type.sin.sin_addr.s_addr;
+		addr->length = 4;
 		*port = ntohs(sa->type.sin.sin_port);
 	}
 
 	if (tcp)
-		dm->m.socket_protocol = DNSTAP__SOCKET_PROTOCOL__TCP;
+		dm->protocol = DNSTAP__SOCKET_PROTOCOL__TCP;
 	else
-		dm->m.socket_protocol = DNSTAP__SOCKET_PROTOCOL__UDP;
+		dm->protocol = DNSTAP__SOCKET_PROTOCOL__UDP;
+}
 
-	dm->m.has_socket_protocol = 1;
-	dm->m.has_socket_family = 1;
-	*has_addr = 1;
-	*has_port = 1;
+/*%
+ * Decide whether a message is to be logged when 'view' logs only one
+ * message in 'view->dtsample'.  The decision is made by hashing the
+ * address of the remote end - the client for client and authoritative
+ * messages, the server otherwise - so that it is the same for a query
+ * and its response.  When sampling by prefix the address is truncated
+ * to the configured prefix length, so that everything from a selected
+ * network is logged; otherwise the remote port and the DNS message ID
+ * are hashed as well, so that transactions are selected individually.
+ */
+static bool
+dt_sample(dns_view_t *view, dns_dtmsgtype_t msgtype,
+	  isc_sockaddr_t *qaddr, isc_sockaddr_t *raddr, isc_buffer_t *buf)
+{
+	unsigned char key[16 + 2 + 2];
+	const unsigned char *addr = NULL;
+	isc_sockaddr_t *sa;
+	unsigned int prefix = 0, len = 0, i;
+	in_port_t port = 0;
+
+	switch (msgtype) {
+	case DNS_DTTYPE_CQ:
+	case DNS_DTTYPE_CR:
+	case DNS_DTTYPE_AQ:
+	case DNS_DTTYPE_AR:
+		sa = qaddr;
+		break;
+	default:
+		sa = raddr;
+		break;
+	}
+
+	if (sa != NULL && isc_sockaddr_pf(sa) == AF_INET6) {
+		addr = sa->type.sin6.sin6_addr.s6_addr;
+		len = 16;
+		prefix = view->dtprefix6;
+		port = sa->type.sin6.sin6_port;
+	} else if (sa != NULL && isc_sockaddr_pf(sa) == AF_INET) {
+		addr = (const unsigned char *) &sa->type.sin.sin_addr.s_addr;
+		len = 4;
+		prefix = view->dtprefix4;
+		port = sa->type.sin.sin_port;
+	}
+
+	if (len != 0)
+		memmove(key, addr, len);
+
+	if (prefix != 0) {
+		for (i = 0; i < len; i++) {
+			if (prefix >= 8) {
+				prefix -= 8;
+				continue;
+			}
+			key[i] &= (0xff << (8 - prefix)) & 0xff;
+			prefix = 0;
+		}
+	} else {
+		memmove(key + len, &port, 2);
+		len += 2;
+		if (isc_buffer_usedlength(buf) >= 2) {
+			memmove(key + len, isc_buffer_base(buf), 2);
+			len += 2;
+		}
+	}
+
+	return (isc_hash_function(key, len, true, NULL) %
+		view->dtsample == 0);
 }
 
 /*%
@@ -786,6 +1148,7 @@ static void
 check_file_size_and_maybe_reopen(dns_dtenv_t *env) {
 	isc_task_t *reopen_task = NULL;
 	isc_event_t *event;
+	isc_stdtime_t now;
 	struct stat statbuf;
 
 	/*
@@ -796,13 +1159,28 @@ check_file_size_and_maybe_reopen(dns_dtenv_t *env) {
 		return;
 	}
 
+	/*
+	 * The size is checked at most once a second.  'size_checked' is
+	 * looked at without the lock first so that the common case does
+	 * not serialize senders; a stale value only repeats or delays a
+	 * check by a second.
+	 */
+	isc_stdtime_get(&now);
+	if (env->size_checked == now) {
+		return;
+	}
+
 	/*
 	 * If an output file roll is not currently queued, check the current
 	 * size of the output file to see whether a roll is needed.  Return if
 	 * it is not.
 	 */
 	LOCK(&env->reopen_lock);
-	if (env->reopen_queued || stat(env->path, &statbuf) < 0 ||
+	if (env->reopen_queued || env->size_checked == now) {
+		goto unlock_and_return;
+	}
+	env->size_checked = now;
+	if (stat(env->path, &statbuf) < 0 ||
 	    statbuf.st_size <= env->max_size)
 	{
 		goto unlock_and_return;
@@ -846,6 +1224,12 @@ dns_dt_send(dns_view_t *view, dns_dtmsgtype_t msgtype,
 
 	REQUIRE(VALID_DTENV(view->dtenv));
 
+	if (view->dtsample > 1 &&
+	    !dt_sample(view, msgtype, qaddr, raddr, buf))
+	{
+		return;
+	}
+
 	if (view->dtenv->max_size != 0) {
 		check_file_size_and_maybe_reopen(view->dtenv);
 	}
@@ -853,7 +1237,8 @@ dns_dt_send(dns_view_t *view, dns_dtmsgtype_t msgtype,
 	TIME_NOW(&now);
 	t = &now;
 
-	init_msg(view->dtenv, &dm, dnstap_type(msgtype));
+	memset(&dm, 0, sizeof(dm));
+	dm.type = dnstap_type(msgtype);
 
 	/* Query/response times */
 	switch (msgtype) {
@@ -866,12 +1251,11 @@ dns_dt_send(dns_view_t *view, dns_dtmsgtype_t msgtype,
 		if (rtime != NULL)
 			t = rtime;
 
-		dm.m.response_time_sec = isc_time_seconds(t);
-		dm.m.has_response_time_sec = 1;
-		dm.m.response_time_nsec = isc_time_nanoseconds(t);
-		dm.m.has_response_time_nsec = 1;
+		dm.rsec = isc_time_seconds(t);
+		dm.rnsec = isc_time_nanoseconds(t);
+		dm.has_rtime = true;
 
-		cpbuf(buf, &dm.m.response_message, &dm.m.has_response_message);
+		cpbuf(buf, &dm.rmsg);
 
 		/* Types RR and FR get both query and response times */
 		if (msgtype == DNS_DTTYPE_CR || msgtype == DNS_DTTYPE_AR)
@@ -887,12 +1271,11 @@ dns_dt_send(dns_view_t *view, dns_dtmsgtype_t msgtype,
 		if (qtime != NULL)
 			t = qtime;
 
-		dm.m.query_time_sec = isc_time_seconds(t);
-		dm.m.has_query_time_sec = 1;
-		dm.m.query_time_nsec = isc_time_nanoseconds(t);
-		dm.m.has_query_time_nsec = 1;
+		dm.qsec = isc_time_seconds(t);
+		dm.qnsec = isc_time_nanoseconds(t);
+		dm.has_qtime = true;
 
-		cpbuf(buf, &dm.m.query_message, &dm.m.has_query_message);
+		cpbuf(buf, &dm.qmsg);
 		break;
 	default:
 		isc_log_write(dns_lctx, DNS_LOGCATEGORY_DNSTAP,
@@ -909,9 +1292,7 @@ dns_dt_send(dns_view_t *view, dns_dtmsgtype_t msgtype,
 	case DNS_DTTYPE_FQ:
 	case DNS_DTTYPE_FR:
 		if (zone != NULL && zone->base != NULL && zone->length != 0) {
-			dm.m.query_zone.data = zone->base;
-			dm.m.query_zone.len = zone->length;
-			dm.m.has_query_zone = 1;
+			dm.zone = *zone;
 		}
 		break;
 	default:
@@ -919,18 +1300,13 @@ dns_dt_send(dns_view_t *view, dns_dtmsgtype_t msgtype,
 	}
 
 	if (qaddr != NULL) {
-		setaddr(&dm, qaddr, tcp,
-			&dm.m.query_address, &dm.m.has_query_address,
-			&dm.m.query_port, &dm.m.has_query_port);
+		setaddr(&dm, qaddr, tcp, &dm.qaddr, &dm.qport);
 	}
 	if (raddr != NULL) {
-		setaddr(&dm, raddr, tcp,
-			&dm.m.response_address, &dm.m.has_response_address,
-			&dm.m.response_port, &dm.m.has_response_port);
+		setaddr(&dm, raddr, tcp, &dm.raddr, &dm.rport);
 	}
 
-	if (pack_dt(&dm.d, &dm.buf, &dm.len) == ISC_R_SUCCESS)
-		send_dt(view->dtenv, dm.buf, dm.len);
+	send_dt(view->dtenv, &dm);
 }
 
 void
@@ -1099,6 +1475,55 @@ dns_dt_close(dns_dthandle_t **handlep) {
 	isc_mem_putanddetach(&handle->mctx, handle, sizeof(*handle));
 }
 
+/*
+ * Convert a dnstap message type to a DNS_DTTYPE_* value.
+ */
+static bool
+dtdata_type(uint64_t mtype, dns_dtmsgtype_t *typep) {
+	switch (mtype) {
+	case DNSTAP__MESSAGE__TYPE__AUTH_QUERY:
+		*typep = DNS_DTTYPE_AQ;
+		break;
+	case DNSTAP__MESSAGE__TYPE__AUTH_RESPONSE:
+		*typep = DNS_DTTYPE_AR;
+		break;
+	case DNSTAP__MESSAGE__TYPE__CLIENT_QUERY:
+		*typep = DNS_DTTYPE_CQ;
+		break;
+	case DNSTAP__MESSAGE__TYPE__CLIENT_RESPONSE:
+		*typep = DNS_DTTYPE_CR;
+		break;
+	case DNSTAP__MESSAGE__TYPE__FORWARDER_QUERY:
+		*typep = DNS_DTTYPE_FQ;
+		break;
+	case DNSTAP__MESSAGE__TYPE__FORWARDER_RESPONSE:
+		*typep = DNS_DTTYPE_FR;
+		break;
+	case DNSTAP__MESSAGE__TYPE__RESOLVER_QUERY:
+		*typep = DNS_DTTYPE_RQ;
+		break;
+	case DNSTAP__MESSAGE__TYPE__RESOLVER_RESPONSE:
+		*typep = DNS_DTTYPE_RR;
+		break;
+	case DNSTAP__MESSAGE__TYPE__STUB_QUERY:
+		*typep = DNS_DTTYPE_SQ;
+		break;
+	case DNSTAP__MESSAGE__TYPE__STUB_RESPONSE:
+		*typep = DNS_DTTYPE_SR;
+		break;
+	case DNSTAP__MESSAGE__TYPE__TOOL_QUERY:
+		*typep = DNS_DTTYPE_TQ;
+		break;
+	case DNSTAP__MESSAGE__TYPE__TOOL_RESPONSE:
+		*typep = DNS_DTTYPE_TR;
+		break;
+	default:
+		return (false);
+	}
+
+	return (true);
+}
+
 isc_result_t
 dns_dt_parse(isc_mem_t *mctx, isc_region_t *src, dns_dtdata_t **destp) {
 	isc_result_t result;
@@ -1126,46 +1551,8 @@ dns_dt_parse(isc_mem_t *mctx, isc_region_t *src, dns_dtdata_t **destp) {
 	m = d->frame->message;
 
 	/* Message type */
-	switch (m->type) {
-	case DNSTAP__MESSAGE__TYPE__AUTH_QUERY:
-		d->type = DNS_DTTYPE_AQ;
-		break;
-	case DNSTAP__MESSAGE__TYPE__AUTH_RESPONSE:
-		d->type = DNS_DTTYPE_AR;
-		break;
-	case DNSTAP__MESSAGE__TYPE__CLIENT_QUERY:
-		d->type = DNS_DTTYPE_CQ;
-		break;
-	case DNSTAP__MESSAGE__TYPE__CLIENT_RESPONSE:
-		d->type = DNS_DTTYPE_CR;
-		break;
-	case DNSTAP__MESSAGE__TYPE__FORWARDER_QUERY:
-		d->type = DNS_DTTYPE_FQ;
-		break;
-	case DNSTAP__MESSAGE__TYPE__FORWARDER_RESPONSE:
-		d->type = DNS_DTTYPE_FR;
-		break;
-	case DNSTAP__MESSAGE__TYPE__RESOLVER_QUERY:
-		d->type = DNS_DTTYPE_RQ;
-		break;
-	case DNSTAP__MESSAGE__TYPE__RESOLVER_RESPONSE:
-		d->type = DNS_DTTYPE_RR;
-		break;
-	case DNSTAP__MESSAGE__TYPE__STUB_QUERY:
-		d->type = DNS_DTTYPE_SQ;
-		break;
-	case DNSTAP__MESSAGE__TYPE__STUB_RESPONSE:
-		d->type = DNS_DTTYPE_SR;
-		break;
-	case DNSTAP__MESSAGE__TYPE__TOOL_QUERY:
-		d->type = DNS_DTTYPE_TQ;
-		break;
-	case DNSTAP__MESSAGE__TYPE__TOOL_RESPONSE:
-		d->type = DNS_DTTYPE_TR;
-		break;
-	default:
+	if (!dtdata_type(m->type, &d->type))
 		CHECK(DNS_R_BADDNSTAP);
-	}
 
 	/* Query? */
 	if ((d->type & DNS_DTTYPE_QUERY) != 0)
@@ -1258,6 +1645,217 @@ dns_dt_parse(isc_mem_t *mctx, isc_region_t *src, dns_dtdata_t **destp) {
 	return (result);
 }
 
+/*
+ * Minimal protobuf decoding, for dns_dt_frametotext().
+ */
+typedef struct pb_field {
+	uint64_t key;
+	unsigned int type;
+	uint64_t value;		/* varint and fixed-width fields */
+	isc_region_t data;	/* length-delimited fields */
+} pb_field_t;
+
+static bool
+pb_getvarint(isc_region_t *r, uint64_t *valp) {
+	uint64_t val = 0;
+	unsigned int shift = 0;
+	unsigned char c;
+
+	while (r->length > 0 && shift < 64) {
+		c = r->base[0];
+		isc_region_consume(r, 1);
+		val |= (uint64_t)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0) {
+			*valp = val;
+			return (true);
+		}
+		shift += 7;
+	}
+
+	return (false);
+}
+
+static isc_result_t
+pb_getfield(isc_region_t *r, pb_field_t *f) {
+	uint64_t key, len;
+	unsigned int i, n;
+
+	if (!pb_getvarint(r, &key))
+		return (DNS_R_BADDNSTAP);
+
+	f->key = key;
+	f->type = (unsigned int)(key & 0x07);
+	f->value = 0;
+	f->data.base = NULL;
+	f->data.length = 0;
+
+	switch (f->type) {
+	case PB_VARINT:
+		if (!pb_getvarint(r, &f->value))
+			return (DNS_R_BADDNSTAP);
+		break;
+	case PB_FIXED64:
+	case PB_FIXED32:
+		n = (f->type == PB_FIXED64) ? 8 : 4;
+		if (r->length < n)
+			return (DNS_R_BADDNSTAP);
+		for (i = 0; i < n; i++)
+			f->value |= (uint64_t)r->base[i] << (8 * i);
+		isc_region_consume(r, n);
+		break;
+	case PB_LENGTH:
+		if (!pb_getvarint(r, &len) || len > r->length)
+			return (DNS_R_BADDNSTAP);
+		f->data.base = r->base;
+		f->data.length = (unsigned int)len;
+		isc_region_consume(r, f->data.length);
+		break;
+	default:
+		return (DNS_R_BADDNSTAP);
+	}
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Fill in the query tuple in 'd' from the question section of the
+ * DNS message in 'd->msgdata'.  Anything that cannot be parsed is
+ * left blank.
+ */
+static void
+dtdata_question(dns_dtdata_t *d) {
+	dns_decompress_t dctx;
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	isc_buffer_t b;
+	isc_result_t result;
+
+	if (d->msgdata.length < DNS_MESSAGE_HEADERLEN)
+		return;
+
+	isc_buffer_init(&b, d->msgdata.base, d->msgdata.length);
+	isc_buffer_add(&b, d->msgdata.length);
+	isc_buffer_setactive(&b, d->msgdata.length);
+	isc_buffer_forward(&b, 4);
+	if (isc_buffer_getuint16(&b) == 0)
+		return;
+	isc_buffer_forward(&b, DNS_MESSAGE_HEADERLEN - 6);
+
+	name = dns_fixedname_initname(&fixed);
+	dns_decompress_init(&dctx, -1, DNS_DECOMPRESS_NONE);
+	result = dns_name_fromwire(name, &b, &dctx, 0, NULL);
+	dns_decompress_invalidate(&dctx);
+	if (result != ISC_R_SUCCESS || isc_buffer_remaininglength(&b) < 4)
+		return;
+
+	dns_name_format(name, d->namebuf, sizeof(d->namebuf));
+	dns_rdatatype_format(isc_buffer_getuint16(&b), d->typebuf,
+			     sizeof(d->typebuf));
+	dns_rdataclass_format(isc_buffer_getuint16(&b), d->classbuf,
+			      sizeof(d->classbuf));
+}
+
+isc_result_t
+dns_dt_frametotext(isc_region_t *src, isc_buffer_t **dest) {
+	isc_result_t result;
+	isc_region_t r, message = { NULL, 0 };
+	isc_region_t qmsg = { NULL, 0 }, rmsg = { NULL, 0 };
+	uint64_t ftype = 0, mtype = 0;
+	uint64_t qsec = 0, qnsec = 0, rsec = 0, rnsec = 0;
+	unsigned int qtimes = 0, rtimes = 0;
+	bool has_mtype = false;
+	dns_dtdata_t d;
+	pb_field_t f;
+
+	REQUIRE(src != NULL);
+	REQUIRE(dest != NULL && *dest != NULL);
+
+	memset(&d, 0, sizeof(d));
+
+	r = *src;
+	while (r.length > 0) {
+		CHECK(pb_getfield(&r, &f));
+		if (f.key == DT_MESSAGE)
+			message = f.data;
+		else if (f.key == DT_TYPE)
+			ftype = f.value;
+	}
+	if (ftype != DNSTAP__DNSTAP__TYPE__MESSAGE || message.base == NULL)
+		CHECK(DNS_R_BADDNSTAP);
+
+	r = message;
+	while (r.length > 0) {
+		CHECK(pb_getfield(&r, &f));
+		switch (f.key) {
+		case DTM_TYPE:
+			mtype = f.value;
+			has_mtype = true;
+			break;
+		case DTM_PROTOCOL:
+			d.tcp = (f.value == DNSTAP__SOCKET_PROTOCOL__TCP);
+			break;
+		case DTM_QADDR:
+			d.qaddr = f.data;
+			break;
+		case DTM_RADDR:
+			d.raddr = f.data;
+			break;
+		case DTM_QPORT:
+			d.qport = (uint32_t)f.value;
+			break;
+		case DTM_RPORT:
+			d.rport = (uint32_t)f.value;
+			break;
+		case DTM_QSEC:
+			qsec = f.value;
+			qtimes |= 1;
+			break;
+		case DTM_QNSEC:
+			qnsec = f.value;
+			qtimes |= 2;
+			break;
+		case DTM_QMSG:
+			qmsg = f.data;
+			break;
+		case DTM_RSEC:
+			rsec = f.value;
+			rtimes |= 1;
+			break;
+		case DTM_RNSEC:
+			rnsec = f.value;
+			rtimes |= 2;
+			break;
+		case DTM_RMSG:
+			rmsg = f.data;
+			break;
+		default:
+			break;
+		}
+	}
+	if (!has_mtype || !dtdata_type(mtype, &d.type))
+		CHECK(DNS_R_BADDNSTAP);
+
+	d.query = ((d.type & DNS_DTTYPE_QUERY) != 0);
+	if (d.query) {
+		d.msgdata = qmsg;
+		if (qtimes == 3)
+			isc_time_set(&d.qtime, (unsigned int)qsec,
+				     (unsigned int)qnsec);
+	} else {
+		d.msgdata = rmsg;
+		if (rtimes == 3)
+			isc_time_set(&d.rtime, (unsigned int)rsec,
+				     (unsigned int)rnsec);
+	}
+
+	dtdata_question(&d);
+
+	result = dns_dt_datatotext(&d, dest);
+
+ cleanup:
+	return (result);
+}
+
 isc_result_t
 dns_dt_datatotext(dns_dtdata_t *d, isc_buffer_t **dest) {
 	isc_result_t result;
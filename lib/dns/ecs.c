@@ -33,6 +33,52 @@ dns_ecs_init(dns_ecs_t *ecs) {
 	ecs->scope = 0;
 }
 
+bool
+dns_ecs_equals(const dns_ecs_t *ecs1, const dns_ecs_t *ecs2) {
+	const unsigned char *addr1, *addr2;
+	uint8_t mask;
+	size_t alen;
+
+	REQUIRE(ecs1 != NULL && ecs2 != NULL);
+
+	if (ecs1->source != ecs2->source ||
+	    ecs1->addr.family != ecs2->addr.family)
+	{
+		return (false);
+	}
+
+	alen = (ecs1->source + 7) / 8;
+	if (alen == 0) {
+		return (true);
+	}
+
+	switch (ecs1->addr.family) {
+	case AF_INET:
+		INSIST(alen <= 4);
+		addr1 = (const unsigned char *) &ecs1->addr.type.in;
+		addr2 = (const unsigned char *) &ecs2->addr.type.in;
+		break;
+	case AF_INET6:
+		INSIST(alen <= 16);
+		addr1 = (const unsigned char *) &ecs1->addr.type.in6;
+		addr2 = (const unsigned char *) &ecs2->addr.type.in6;
+		break;
+	default:
+		INSIST(0);
+	}
+
+	/*
+	 * Compare all octets except the last one, then mask off
+	 * the unused bits of the last octet.
+	 */
+	if (alen > 1 && memcmp(addr1, addr2, alen - 1) != 0) {
+		return (false);
+	}
+
+	mask = (~0U << ((8 - (ecs1->source % 8)) % 8)) & 0xff;
+	return ((addr1[alen - 1] & mask) == (addr2[alen - 1] & mask));
+}
+
 void
 dns_ecs_format(dns_ecs_t *ecs, char *buf, size_t size) {
 	size_t len;
@@ -20,8 +20,13 @@
 
 #include <isc/mem.h>
 #include <isc/once.h>
+#include <isc/platform.h>
 #include <isc/string.h>
 
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+#include <stdatomic.h>
+#endif
+
 #include <dns/acl.h>
 #include <dns/geoip.h>
 
@@ -42,39 +47,58 @@
 #include <GeoIPCity.h>
 
 /*
- * This structure preserves state from the previous GeoIP lookup,
- * so that successive lookups for the same data from the same IP
- * address will not require repeated calls into the GeoIP library
- * to look up data in the database. This should improve performance
- * somewhat.
- *
- * For lookups in the City and Region databases, we preserve pointers
- * to the GeoIPRecord and GeoIPregion structures; these will need to be
- * freed by GeoIPRecord_delete() and GeoIPRegion_delete().
+ * Each thread keeps a small cache of the results of recent GeoIP
+ * lookups, so that matching a query address against an ACL with many
+ * GeoIP elements (or against the GeoIP elements of several views)
+ * does not require repeated calls into the GeoIP library.
  *
- * for lookups in ISP, AS, Org and Domain we prserve a pointer to
- * the returned name; these must be freed by free().
+ * A cache entry holds everything learned about one address: the
+ * country code, code3 and name from the Country database, the
+ * GeoIPRecord from the City database, the GeoIPRegion from the Region
+ * database, the names from the ISP, Org, AS and Domain databases and
+ * the Netspeed ID.  Each result is looked up the first time it is
+ * needed; the 'have' bits record which results (including failed
+ * lookups) are present, so any later match of the same address
+ * against any element is answered from the entry.
  *
- * For lookups in Country we preserve a pointer to the text of
- * the country code, name, etc (we use a different pointer for this
- * than for the names returned by Org, ISP, etc, because those need
- * to be freed but country lookups do not).
+ * GeoIPRecord and GeoIPRegion structures must be freed by
+ * GeoIPRecord_delete() and GeoIPRegion_delete(); names returned by
+ * the ISP, Org, AS and Domain databases must be freed by free().
+ * Country texts are static and are not freed.
  *
- * For lookups in Netspeed we preserve the returned ID.
- *
- * XXX: Currently this mechanism is only used for IPv4 lookups; the
- * family and addr6 fields are to be used IPv6 is added.
+ * When the cache is full, the least recently used entry is reused.
+ * Each thread's cache is stamped with a global generation, which
+ * dns_geoip_flushcache() advances when the databases are reloaded;
+ * a thread finding a stale generation empties its cache first.
  */
-typedef struct geoip_state {
-	uint16_t subtype;
+#ifndef GEOIP_CACHESIZE
+#define GEOIP_CACHESIZE		16
+#endif
+
+#define GEOIP_HAVE_TEXT(i)	(1U << (i))		/* 3 country texts */
+#define GEOIP_HAVE_NAME(i)	(1U << (3 + (i)))	/* 4 names */
+#define GEOIP_HAVE_RECORD	(1U << 7)
+#define GEOIP_HAVE_REGION	(1U << 8)
+#define GEOIP_HAVE_ID		(1U << 9)
+
+typedef struct geoip_entry {
 	unsigned int family;
 	uint32_t ipnum;
 	geoipv6_t ipnum6;
+	unsigned int have;
+	unsigned int lastused;
+	const char *text[3];
+	char *name[4];
 	GeoIPRecord *record;
 	GeoIPRegion *region;
-	const char *text;
-	char *name;
 	int id;
+} geoip_entry_t;
+
+typedef struct geoip_state {
+	geoip_entry_t entries[GEOIP_CACHESIZE];
+	geoip_entry_t *last;
+	unsigned int clock;
+	unsigned int generation;
 	isc_mem_t *mctx;
 } geoip_state_t;
 
@@ -83,23 +107,61 @@ static bool state_key_initialized = false;
 static isc_thread_key_t state_key;
 static isc_once_t mutex_once = ISC_ONCE_INIT;
 static isc_mem_t *state_mctx = NULL;
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+static atomic_uint_fast32_t generation;
+#else
+static unsigned int generation;
+#endif
 
 static void
 key_mutex_init(void) {
 	RUNTIME_CHECK(isc_mutex_init(&key_mutex) == ISC_R_SUCCESS);
 }
 
+static void
+clean_entry(geoip_entry_t *entry) {
+	unsigned int i;
+
+	if (entry->record != NULL)
+		GeoIPRecord_delete(entry->record);
+	if (entry->region != NULL)
+		GeoIPRegion_delete(entry->region);
+	for (i = 0; i < 4; i++) {
+		if (entry->name[i] != NULL)
+			free(entry->name[i]);
+	}
+	memset(entry, 0, sizeof(*entry));
+}
+
 static void
 free_state(void *arg) {
 	geoip_state_t *state = arg;
-	if (state != NULL && state->record != NULL)
-		GeoIPRecord_delete(state->record);
-	if (state != NULL)
+	unsigned int i;
+
+	if (state != NULL) {
+		for (i = 0; i < GEOIP_CACHESIZE; i++)
+			clean_entry(&state->entries[i]);
 		isc_mem_putanddetach(&state->mctx,
 				     state, sizeof(geoip_state_t));
+	}
 	isc_thread_key_setspecific(state_key, NULL);
 }
 
+static unsigned int
+current_generation(void) {
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+	return ((unsigned int)atomic_load_explicit(&generation,
+						   memory_order_acquire));
+#else
+	unsigned int g;
+
+	LOCK(&key_mutex);
+	g = generation;
+	UNLOCK(&key_mutex);
+	return (g);
+#endif
+}
+
 static isc_result_t
 state_key_init(void) {
 	isc_result_t result;
@@ -133,113 +195,101 @@ state_key_init(void) {
 	return (result);
 }
 
-static void
-clean_state(geoip_state_t *state) {
-	if (state == NULL)
-		return;
-
-	if (state->record != NULL) {
-		GeoIPRecord_delete(state->record);
-		state->record = NULL;
-	}
-	if (state->region != NULL) {
-		GeoIPRegion_delete(state->region);
-		state->region = NULL;
-	}
-	if (state->name != NULL) {
-		free (state->name);
-		state->name = NULL;
-	}
-	state->ipnum = 0;
-	state->text = NULL;
-	state->id = 0;
+static inline bool
+entry_match(const geoip_entry_t *entry, unsigned int family, uint32_t ipnum,
+	    const geoipv6_t *ipnum6)
+{
+	if (entry->family != family)
+		return (false);
+	if (family == AF_INET)
+		return (entry->ipnum == ipnum);
+	return (memcmp(entry->ipnum6.s6_addr, ipnum6->s6_addr, 16) == 0);
 }
 
-static isc_result_t
-set_state(unsigned int family, uint32_t ipnum, const geoipv6_t *ipnum6,
-	  dns_geoip_subtype_t subtype, GeoIPRecord *record,
-	  GeoIPRegion *region, char *name, const char *text, int id)
-{
-	geoip_state_t *state = NULL;
+/*
+ * Return this thread's cache entry for the given address, creating
+ * one (and the cache itself) if needed.  Returns NULL only if the
+ * cache could not be allocated.
+ */
+static geoip_entry_t *
+get_entry(unsigned int family, uint32_t ipnum, const geoipv6_t *ipnum6) {
+	geoip_state_t *state;
+	geoip_entry_t *entry, *oldest;
 	isc_result_t result;
+	unsigned int i;
+
+	INSIST(family == AF_INET || ipnum6 != NULL);
 
 	result = state_key_init();
 	if (result != ISC_R_SUCCESS)
-		return (result);
+		return (NULL);
 
 	state = (geoip_state_t *) isc_thread_key_getspecific(state_key);
 	if (state == NULL) {
 		state = (geoip_state_t *) isc_mem_get(state_mctx,
 						      sizeof(geoip_state_t));
 		if (state == NULL)
-			return (ISC_R_NOMEMORY);
+			return (NULL);
 		memset(state, 0, sizeof(*state));
 
 		result = isc_thread_key_setspecific(state_key, state);
 		if (result != ISC_R_SUCCESS) {
 			isc_mem_put(state_mctx, state, sizeof(geoip_state_t));
-			return (result);
+			return (NULL);
 		}
 
 		isc_mem_attach(state_mctx, &state->mctx);
-	} else
-		clean_state(state);
-
-	if (family == AF_INET) {
-		state->ipnum = ipnum;
-	} else {
-		INSIST(ipnum6 != NULL);
-		state->ipnum6 = *ipnum6;
+		state->generation = current_generation();
+	} else if (state->generation != current_generation()) {
+		for (i = 0; i < GEOIP_CACHESIZE; i++)
+			clean_entry(&state->entries[i]);
+		state->last = NULL;
+		state->clock = 0;
+		state->generation = current_generation();
 	}
 
-	state->family = family;
-	state->subtype = subtype;
-	state->record = record;
-	state->region = region;
-	state->name = name;
-	state->text = text;
-	state->id = id;
-
-	return (ISC_R_SUCCESS);
-}
-
-static geoip_state_t *
-get_state_for(unsigned int family, uint32_t ipnum,
-	      const geoipv6_t *ipnum6)
-{
-	geoip_state_t *state;
-
-	isc_result_t result;
-
-	result = state_key_init();
-	if (result != ISC_R_SUCCESS)
-		return (NULL);
-
-	state = (geoip_state_t *) isc_thread_key_getspecific(state_key);
-	if (state == NULL)
-		return (NULL);
-
-	if (state->family == family &&
-	    ((state->family == AF_INET && state->ipnum == ipnum) ||
-	     (state->family == AF_INET6 && ipnum6 != NULL &&
-	      memcmp(state->ipnum6.s6_addr, ipnum6->s6_addr, 16) == 0)))
-		return (state);
+	/*
+	 * Successive matches are nearly always for the same address.
+	 */
+	entry = state->last;
+	if (entry != NULL && entry_match(entry, family, ipnum, ipnum6))
+		return (entry);
+
+	oldest = &state->entries[0];
+	for (i = 0; i < GEOIP_CACHESIZE; i++) {
+		entry = &state->entries[i];
+		if (entry_match(entry, family, ipnum, ipnum6))
+			goto found;
+		if (entry->lastused < oldest->lastused)
+			oldest = entry;
+	}
 
-	return (NULL);
+	entry = oldest;
+	clean_entry(entry);
+	entry->family = family;
+	if (family == AF_INET)
+		entry->ipnum = ipnum;
+	else
+		entry->ipnum6 = *ipnum6;
+
+ found:
+	entry->lastused = ++state->clock;
+	state->last = entry;
+	return (entry);
 }
 
 /*
- * Country lookups are performed if the previous lookup was from a
- * different IP address than the current, or was for a search of a
- * different subtype.
+ * Country lookups are performed the first time a given country
+ * subtype is needed for an address.
  */
 static const char *
 country_lookup(GeoIP *db, dns_geoip_subtype_t subtype,
 	       unsigned int family,
 	       uint32_t ipnum, const geoipv6_t *ipnum6)
 {
-	geoip_state_t *prev_state = NULL;
+	geoip_entry_t *entry;
 	const char *text = NULL;
+	unsigned int i;
 
 	REQUIRE(db != NULL);
 
@@ -249,51 +299,47 @@ country_lookup(GeoIP *db, dns_geoip_subtype_t subtype,
 		return (NULL);
 #endif
 
-	prev_state = get_state_for(family, ipnum, ipnum6);
-	if (prev_state != NULL && prev_state->subtype == subtype) {
-		text = prev_state->text;
-	}
+	entry = get_entry(family, ipnum, ipnum6);
+	if (entry == NULL)
+		return (NULL);
+
+	i = subtype - dns_geoip_country_code;
+	INSIST(i < 3);
+	if ((entry->have & GEOIP_HAVE_TEXT(i)) != 0)
+		return (entry->text[i]);
 
-	if (text == NULL) {
-		switch (subtype) {
-		case dns_geoip_country_code:
-			if (family == AF_INET)
-				text = GeoIP_country_code_by_ipnum(db, ipnum);
+	switch (subtype) {
+	case dns_geoip_country_code:
+		if (family == AF_INET)
+			text = GeoIP_country_code_by_ipnum(db, ipnum);
 #ifdef HAVE_GEOIP_V6
-			else
-				text = GeoIP_country_code_by_ipnum_v6(db,
-								      *ipnum6);
+		else
+			text = GeoIP_country_code_by_ipnum_v6(db, *ipnum6);
 #endif
-			break;
-		case dns_geoip_country_code3:
-			if (family == AF_INET)
-				text = GeoIP_country_code3_by_ipnum(db, ipnum);
+		break;
+	case dns_geoip_country_code3:
+		if (family == AF_INET)
+			text = GeoIP_country_code3_by_ipnum(db, ipnum);
 #ifdef HAVE_GEOIP_V6
-			else
-				text = GeoIP_country_code3_by_ipnum_v6(db,
-								       *ipnum6);
+		else
+			text = GeoIP_country_code3_by_ipnum_v6(db, *ipnum6);
 #endif
-			break;
-		case dns_geoip_country_name:
-			if (family == AF_INET)
-				text = GeoIP_country_name_by_ipnum(db, ipnum);
+		break;
+	case dns_geoip_country_name:
+		if (family == AF_INET)
+			text = GeoIP_country_name_by_ipnum(db, ipnum);
 #ifdef HAVE_GEOIP_V6
-			else
-				text = GeoIP_country_name_by_ipnum_v6(db,
-								      *ipnum6);
+		else
+			text = GeoIP_country_name_by_ipnum_v6(db, *ipnum6);
 #endif
-			break;
-		default:
-			INSIST(0);
-		}
-
-		if (text == NULL)
-			return (NULL);
-
-		set_state(family, ipnum, ipnum6, subtype,
-			  NULL, NULL, NULL, text, 0);
+		break;
+	default:
+		INSIST(0);
 	}
 
+	entry->text[i] = text;
+	entry->have |= GEOIP_HAVE_TEXT(i);
+
 	return (text);
 }
 
@@ -352,38 +398,15 @@ city_string(GeoIPRecord *record, dns_geoip_subtype_t subtype, int *maxlen) {
 	}
 }
 
-static bool
-is_city(dns_geoip_subtype_t subtype) {
-	switch (subtype) {
-	case dns_geoip_city_countrycode:
-	case dns_geoip_city_countrycode3:
-	case dns_geoip_city_countryname:
-	case dns_geoip_city_region:
-	case dns_geoip_city_regionname:
-	case dns_geoip_city_name:
-	case dns_geoip_city_postalcode:
-	case dns_geoip_city_continentcode:
-	case dns_geoip_city_timezonecode:
-	case dns_geoip_city_metrocode:
-	case dns_geoip_city_areacode:
-		return (true);
-	default:
-		return (false);
-	}
-}
-
 /*
- * GeoIPRecord lookups are performed if the previous lookup was
- * from a different IP address than the current, or was for a search
- * outside the City database.
+ * GeoIPRecord lookups are performed the first time any City database
+ * subtype is needed for an address.
  */
 static GeoIPRecord *
-city_lookup(GeoIP *db, dns_geoip_subtype_t subtype,
-	    unsigned int family, uint32_t ipnum,
+city_lookup(GeoIP *db, unsigned int family, uint32_t ipnum,
 	    const geoipv6_t *ipnum6)
 {
-	GeoIPRecord *record = NULL;
-	geoip_state_t *prev_state = NULL;
+	geoip_entry_t *entry;
 
 	REQUIRE(db != NULL);
 
@@ -393,26 +416,21 @@ city_lookup(GeoIP *db, dns_geoip_subtype_t subtype,
 		return (NULL);
 #endif
 
-	prev_state = get_state_for(family, ipnum, ipnum6);
-	if (prev_state != NULL && is_city(prev_state->subtype)) {
-		record = prev_state->record;
-	}
+	entry = get_entry(family, ipnum, ipnum6);
+	if (entry == NULL)
+		return (NULL);
 
-	if (record == NULL) {
+	if ((entry->have & GEOIP_HAVE_RECORD) == 0) {
 		if (family == AF_INET)
-			record = GeoIP_record_by_ipnum(db, ipnum);
+			entry->record = GeoIP_record_by_ipnum(db, ipnum);
 #ifdef HAVE_GEOIP_V6
 		else
-			record = GeoIP_record_by_ipnum_v6(db, *ipnum6);
+			entry->record = GeoIP_record_by_ipnum_v6(db, *ipnum6);
 #endif
-		if (record == NULL)
-			return (NULL);
-
-		set_state(family, ipnum, ipnum6, subtype, record,
-			  NULL, NULL, NULL, 0);
+		entry->have |= GEOIP_HAVE_RECORD;
 	}
 
-	return (record);
+	return (entry->record);
 }
 
 static char * region_string(GeoIPRegion *region, dns_geoip_subtype_t subtype, int *maxlen) {
@@ -440,104 +458,73 @@ static char * region_string(GeoIPRegion *region, dns_geoip_subtype_t subtype, in
 	}
 }
 
-static bool
-is_region(dns_geoip_subtype_t subtype) {
-	switch (subtype) {
-	case dns_geoip_region_countrycode:
-	case dns_geoip_region_code:
-		return (true);
-	default:
-		return (false);
-	}
-}
-
 /*
- * GeoIPRegion lookups are performed if the previous lookup was
- * from a different IP address than the current, or was for a search
- * outside the Region database.
+ * GeoIPRegion lookups are performed the first time any Region database
+ * subtype is needed for an address.
  */
 static GeoIPRegion *
-region_lookup(GeoIP *db, dns_geoip_subtype_t subtype, uint32_t ipnum) {
-	GeoIPRegion *region = NULL;
-	geoip_state_t *prev_state = NULL;
+region_lookup(GeoIP *db, uint32_t ipnum) {
+	geoip_entry_t *entry;
 
 	REQUIRE(db != NULL);
 
-	prev_state = get_state_for(AF_INET, ipnum, NULL);
-	if (prev_state != NULL && is_region(prev_state->subtype)) {
-		region = prev_state->region;
-	}
-
-	if (region == NULL) {
-		region = GeoIP_region_by_ipnum(db, ipnum);
-		if (region == NULL)
-			return (NULL);
+	entry = get_entry(AF_INET, ipnum, NULL);
+	if (entry == NULL)
+		return (NULL);
 
-		set_state(AF_INET, ipnum, NULL, subtype, NULL,
-			  region, NULL, NULL, 0);
+	if ((entry->have & GEOIP_HAVE_REGION) == 0) {
+		entry->region = GeoIP_region_by_ipnum(db, ipnum);
+		entry->have |= GEOIP_HAVE_REGION;
 	}
 
-	return (region);
+	return (entry->region);
 }
 
 /*
- * ISP, Organization, AS Number and Domain lookups are performed if
- * the previous lookup was from a different IP address than the current,
- * or was for a search of a different subtype.
+ * ISP, Organization, AS Number and Domain lookups are performed the
+ * first time the given subtype is needed for an address.
  */
 static char *
 name_lookup(GeoIP *db, dns_geoip_subtype_t subtype, uint32_t ipnum) {
-	char *name = NULL;
-	geoip_state_t *prev_state = NULL;
+	geoip_entry_t *entry;
+	unsigned int i;
 
 	REQUIRE(db != NULL);
 
-	prev_state = get_state_for(AF_INET, ipnum, NULL);
-	if (prev_state != NULL && prev_state->subtype == subtype) {
-		name = prev_state->name;
-	}
-
-	if (name == NULL) {
-		name = GeoIP_name_by_ipnum(db, ipnum);
-		if (name == NULL)
-			return (NULL);
+	entry = get_entry(AF_INET, ipnum, NULL);
+	if (entry == NULL)
+		return (NULL);
 
-		set_state(AF_INET, ipnum, NULL, subtype, NULL, NULL,
-			  name, NULL, 0);
+	i = subtype - dns_geoip_isp_name;
+	INSIST(i < 4);
+	if ((entry->have & GEOIP_HAVE_NAME(i)) == 0) {
+		entry->name[i] = GeoIP_name_by_ipnum(db, ipnum);
+		entry->have |= GEOIP_HAVE_NAME(i);
 	}
 
-	return (name);
+	return (entry->name[i]);
 }
 
 /*
- * Netspeed lookups are performed if the previous lookup was from a
- * different IP address than the current, or was for a search of a
- * different subtype.
+ * Netspeed lookups are performed the first time the Netspeed ID is
+ * needed for an address.
  */
 static int
-netspeed_lookup(GeoIP *db, dns_geoip_subtype_t subtype, uint32_t ipnum) {
-	geoip_state_t *prev_state = NULL;
-	bool found = false;
-	int id = -1;
+netspeed_lookup(GeoIP *db, uint32_t ipnum) {
+	geoip_entry_t *entry;
 
 	REQUIRE(db != NULL);
 
-	prev_state = get_state_for(AF_INET, ipnum, NULL);
-	if (prev_state != NULL && prev_state->subtype == subtype) {
-		id = prev_state->id;
-		found = true;
-	}
-
-	if (!found) {
-		id = GeoIP_id_by_ipnum(db, ipnum);
-		if (id == 0)
-			return (0);
+	entry = get_entry(AF_INET, ipnum, NULL);
+	if (entry == NULL)
+		return (0);
 
-		set_state(AF_INET, ipnum, NULL, subtype, NULL,
-			  NULL, NULL, NULL, id);
+	if ((entry->have & GEOIP_HAVE_ID) == 0) {
+		entry->id = GeoIP_id_by_ipnum(db, ipnum);
+		entry->have |= GEOIP_HAVE_ID;
 	}
 
-	return (id);
+	return (entry->id);
 }
 #endif /* HAVE_GEOIP */
 
@@ -679,8 +666,7 @@ dns_geoip_match(const isc_netaddr_t *reqaddr,
 		if (db == NULL)
 			return (false);
 
-		record = city_lookup(db, subtype, family,
-				     ipnum, ipnum6);
+		record = city_lookup(db, family, ipnum, ipnum6);
 		if (record == NULL)
 			break;
 
@@ -695,8 +681,7 @@ dns_geoip_match(const isc_netaddr_t *reqaddr,
 		if (db == NULL)
 			return (false);
 
-		record = city_lookup(db, subtype, family,
-				     ipnum, ipnum6);
+		record = city_lookup(db, family, ipnum, ipnum6);
 		if (record == NULL)
 			break;
 
@@ -709,8 +694,7 @@ dns_geoip_match(const isc_netaddr_t *reqaddr,
 		if (db == NULL)
 			return (false);
 
-		record = city_lookup(db, subtype, family,
-				     ipnum, ipnum6);
+		record = city_lookup(db, family, ipnum, ipnum6);
 		if (record == NULL)
 			break;
 
@@ -731,7 +715,7 @@ dns_geoip_match(const isc_netaddr_t *reqaddr,
 		if (family == AF_INET6)
 			return (false);
 
-		region = region_lookup(geoip->region, subtype, ipnum);
+		region = region_lookup(geoip->region, ipnum);
 		if (region == NULL)
 			break;
 
@@ -790,7 +774,7 @@ dns_geoip_match(const isc_netaddr_t *reqaddr,
 		if (family == AF_INET6)
 			return (false);
 
-		id = netspeed_lookup(geoip->netspeed, subtype, ipnum);
+		id = netspeed_lookup(geoip->netspeed, ipnum);
 		if (id == elt->as_int)
 			return (true);
 		break;
@@ -813,6 +797,23 @@ dns_geoip_match(const isc_netaddr_t *reqaddr,
 #endif
 }
 
+void
+dns_geoip_flushcache(void) {
+#ifdef HAVE_GEOIP
+	if (state_key_init() != ISC_R_SUCCESS)
+		return;
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+	atomic_fetch_add_explicit(&generation, 1, memory_order_release);
+#else
+	LOCK(&key_mutex);
+	generation++;
+	UNLOCK(&key_mutex);
+#endif
+#else
+	return;
+#endif
+}
+
 void
 dns_geoip_shutdown(void) {
 #ifdef HAVE_GEOIP
@@ -51,8 +51,14 @@
 
 static isc_result_t hmacmd5_fromdns(dst_key_t *key, isc_buffer_t *data);
 
+/*
+ * Each key keeps an HMAC context that has already absorbed the inner
+ * and outer pads; createctx copies it instead of rekeying, so signing
+ * or verifying a message does not rehash the key.
+ */
 struct dst_hmacmd5_key {
 	unsigned char key[ISC_MD5_BLOCK_LENGTH];
+	isc_hmacmd5_t schedule;
 };
 
 static isc_result_t
@@ -74,7 +80,7 @@ hmacmd5_createctx(dst_key_t *key, dst_context_t *dctx) {
 	hmacmd5ctx = isc_mem_get(dctx->mctx, sizeof(isc_hmacmd5_t));
 	if (hmacmd5ctx == NULL)
 		return (ISC_R_NOMEMORY);
-	isc_hmacmd5_init(hmacmd5ctx, hkey->key, ISC_MD5_BLOCK_LENGTH);
+	isc_hmacmd5_copy(hmacmd5ctx, &hkey->schedule);
 	dctx->ctxdata.hmacmd5ctx = hmacmd5ctx;
 	return (ISC_R_SUCCESS);
 }
@@ -181,6 +187,7 @@ static void
 hmacmd5_destroy(dst_key_t *key) {
 	dst_hmacmd5_key_t *hkey = key->keydata.hmacmd5;
 
+	isc_hmacmd5_invalidate(&hkey->schedule);
 	isc_safe_memwipe(hkey, sizeof(*hkey));
 	isc_mem_put(key->mctx, hkey, sizeof(*hkey));
 	key->keydata.hmacmd5 = NULL;
@@ -231,6 +238,7 @@ hmacmd5_fromdns(dst_key_t *key, isc_buffer_t *data) {
 	}
 
 	key->key_size = keylen * 8;
+	isc_hmacmd5_init(&hkey->schedule, hkey->key, ISC_MD5_BLOCK_LENGTH);
 	key->keydata.hmacmd5 = hkey;
 
 	isc_buffer_forward(data, r.length);
@@ -370,6 +378,7 @@ static isc_result_t hmacsha1_fromdns(dst_key_t *key, isc_buffer_t *data);
 
 struct dst_hmacsha1_key {
 	unsigned char key[ISC_SHA1_BLOCK_LENGTH];
+	isc_hmacsha1_t schedule;
 };
 
 static isc_result_t
@@ -380,7 +389,7 @@ hmacsha1_createctx(dst_key_t *key, dst_context_t *dctx) {
 	hmacsha1ctx = isc_mem_get(dctx->mctx, sizeof(isc_hmacsha1_t));
 	if (hmacsha1ctx == NULL)
 		return (ISC_R_NOMEMORY);
-	isc_hmacsha1_init(hmacsha1ctx, hkey->key, ISC_SHA1_BLOCK_LENGTH);
+	isc_hmacsha1_copy(hmacsha1ctx, &hkey->schedule);
 	dctx->ctxdata.hmacsha1ctx = hmacsha1ctx;
 	return (ISC_R_SUCCESS);
 }
@@ -487,6 +496,7 @@ static void
 hmacsha1_destroy(dst_key_t *key) {
 	dst_hmacsha1_key_t *hkey = key->keydata.hmacsha1;
 
+	isc_hmacsha1_invalidate(&hkey->schedule);
 	isc_safe_memwipe(hkey, sizeof(*hkey));
 	isc_mem_put(key->mctx, hkey, sizeof(*hkey));
 	key->keydata.hmacsha1 = NULL;
@@ -537,6 +547,7 @@ hmacsha1_fromdns(dst_key_t *key, isc_buffer_t *data) {
 	}
 
 	key->key_size = keylen * 8;
+	isc_hmacsha1_init(&hkey->schedule, hkey->key, ISC_SHA1_BLOCK_LENGTH);
 	key->keydata.hmacsha1 = hkey;
 
 	isc_buffer_forward(data, r.length);
@@ -660,6 +671,7 @@ static isc_result_t hmacsha224_fromdns(dst_key_t *key, isc_buffer_t *data);
 
 struct dst_hmacsha224_key {
 	unsigned char key[ISC_SHA224_BLOCK_LENGTH];
+	isc_hmacsha224_t schedule;
 };
 
 static isc_result_t
@@ -670,7 +682,7 @@ hmacsha224_createctx(dst_key_t *key, dst_context_t *dctx) {
 	hmacsha224ctx = isc_mem_get(dctx->mctx, sizeof(isc_hmacsha224_t));
 	if (hmacsha224ctx == NULL)
 		return (ISC_R_NOMEMORY);
-	isc_hmacsha224_init(hmacsha224ctx, hkey->key, ISC_SHA224_BLOCK_LENGTH);
+	isc_hmacsha224_copy(hmacsha224ctx, &hkey->schedule);
 	dctx->ctxdata.hmacsha224ctx = hmacsha224ctx;
 	return (ISC_R_SUCCESS);
 }
@@ -777,6 +789,7 @@ static void
 hmacsha224_destroy(dst_key_t *key) {
 	dst_hmacsha224_key_t *hkey = key->keydata.hmacsha224;
 
+	isc_hmacsha224_invalidate(&hkey->schedule);
 	isc_safe_memwipe(hkey, sizeof(*hkey));
 	isc_mem_put(key->mctx, hkey, sizeof(*hkey));
 	key->keydata.hmacsha224 = NULL;
@@ -827,6 +840,8 @@ hmacsha224_fromdns(dst_key_t *key, isc_buffer_t *data) {
 	}
 
 	key->key_size = keylen * 8;
+	isc_hmacsha224_init(&hkey->schedule, hkey->key,
+			    ISC_SHA224_BLOCK_LENGTH);
 	key->keydata.hmacsha224 = hkey;
 
 	isc_buffer_forward(data, r.length);
@@ -944,6 +959,7 @@ static isc_result_t hmacsha256_fromdns(dst_key_t *key, isc_buffer_t *data);
 
 struct dst_hmacsha256_key {
 	unsigned char key[ISC_SHA256_BLOCK_LENGTH];
+	isc_hmacsha256_t schedule;
 };
 
 static isc_result_t
@@ -954,7 +970,7 @@ hmacsha256_createctx(dst_key_t *key, dst_context_t *dctx) {
 	hmacsha256ctx = isc_mem_get(dctx->mctx, sizeof(isc_hmacsha256_t));
 	if (hmacsha256ctx == NULL)
 		return (ISC_R_NOMEMORY);
-	isc_hmacsha256_init(hmacsha256ctx, hkey->key, ISC_SHA256_BLOCK_LENGTH);
+	isc_hmacsha256_copy(hmacsha256ctx, &hkey->schedule);
 	dctx->ctxdata.hmacsha256ctx = hmacsha256ctx;
 	return (ISC_R_SUCCESS);
 }
@@ -1061,6 +1077,7 @@ static void
 hmacsha256_destroy(dst_key_t *key) {
 	dst_hmacsha256_key_t *hkey = key->keydata.hmacsha256;
 
+	isc_hmacsha256_invalidate(&hkey->schedule);
 	isc_safe_memwipe(hkey, sizeof(*hkey));
 	isc_mem_put(key->mctx, hkey, sizeof(*hkey));
 	key->keydata.hmacsha256 = NULL;
@@ -1111,6 +1128,8 @@ hmacsha256_fromdns(dst_key_t *key, isc_buffer_t *data) {
 	}
 
 	key->key_size = keylen * 8;
+	isc_hmacsha256_init(&hkey->schedule, hkey->key,
+			    ISC_SHA256_BLOCK_LENGTH);
 	key->keydata.hmacsha256 = hkey;
 
 	isc_buffer_forward(data, r.length);
@@ -1228,6 +1247,7 @@ static isc_result_t hmacsha384_fromdns(dst_key_t *key, isc_buffer_t *data);
 
 struct dst_hmacsha384_key {
 	unsigned char key[ISC_SHA384_BLOCK_LENGTH];
+	isc_hmacsha384_t schedule;
 };
 
 static isc_result_t
@@ -1238,7 +1258,7 @@ hmacsha384_createctx(dst_key_t *key, dst_context_t *dctx) {
 	hmacsha384ctx = isc_mem_get(dctx->mctx, sizeof(isc_hmacsha384_t));
 	if (hmacsha384ctx == NULL)
 		return (ISC_R_NOMEMORY);
-	isc_hmacsha384_init(hmacsha384ctx, hkey->key, ISC_SHA384_BLOCK_LENGTH);
+	isc_hmacsha384_copy(hmacsha384ctx, &hkey->schedule);
 	dctx->ctxdata.hmacsha384ctx = hmacsha384ctx;
 	return (ISC_R_SUCCESS);
 }
@@ -1345,6 +1365,7 @@ static void
 hmacsha384_destroy(dst_key_t *key) {
 	dst_hmacsha384_key_t *hkey = key->keydata.hmacsha384;
 
+	isc_hmacsha384_invalidate(&hkey->schedule);
 	isc_safe_memwipe(hkey, sizeof(*hkey));
 	isc_mem_put(key->mctx, hkey, sizeof(*hkey));
 	key->keydata.hmacsha384 = NULL;
@@ -1395,6 +1416,8 @@ hmacsha384_fromdns(dst_key_t *key, isc_buffer_t *data) {
 	}
 
 	key->key_size = keylen * 8;
+	isc_hmacsha384_init(&hkey->schedule, hkey->key,
+			    ISC_SHA384_BLOCK_LENGTH);
 	key->keydata.hmacsha384 = hkey;
 
 	isc_buffer_forward(data, r.length);
@@ -1512,6 +1535,7 @@ static isc_result_t hmacsha512_fromdns(dst_key_t *key, isc_buffer_t *data);
 
 struct dst_hmacsha512_key {
 	unsigned char key[ISC_SHA512_BLOCK_LENGTH];
+	isc_hmacsha512_t schedule;
 };
 
 static isc_result_t
@@ -1522,7 +1546,7 @@ hmacsha512_createctx(dst_key_t *key, dst_context_t *dctx) {
 	hmacsha512ctx = isc_mem_get(dctx->mctx, sizeof(isc_hmacsha512_t));
 	if (hmacsha512ctx == NULL)
 		return (ISC_R_NOMEMORY);
-	isc_hmacsha512_init(hmacsha512ctx, hkey->key, ISC_SHA512_BLOCK_LENGTH);
+	isc_hmacsha512_copy(hmacsha512ctx, &hkey->schedule);
 	dctx->ctxdata.hmacsha512ctx = hmacsha512ctx;
 	return (ISC_R_SUCCESS);
 }
@@ -1629,6 +1653,7 @@ static void
 hmacsha512_destroy(dst_key_t *key) {
 	dst_hmacsha512_key_t *hkey = key->keydata.hmacsha512;
 
+	isc_hmacsha512_invalidate(&hkey->schedule);
 	isc_safe_memwipe(hkey, sizeof(*hkey));
 	isc_mem_put(key->mctx, hkey, sizeof(*hkey));
 	key->keydata.hmacsha512 = NULL;
@@ -1679,6 +1704,8 @@ hmacsha512_fromdns(dst_key_t *key, isc_buffer_t *data) {
 	}
 
 	key->key_size = keylen * 8;
+	isc_hmacsha512_init(&hkey->schedule, hkey->key,
+			    ISC_SHA512_BLOCK_LENGTH);
 	key->keydata.hmacsha512 = hkey;
 
 	isc_buffer_forward(data, r.length);
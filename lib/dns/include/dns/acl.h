@@ -236,6 +236,9 @@ dns_acl_match(const isc_netaddr_t *reqaddr,
  * current values of localhost and localnets and (if applicable)
  * the GeoIP context.
  *
+ * Results for requests without a signer are cached per thread, see
+ * dns_acl_flushcache().
+ *
  * Returns:
  *\li	#ISC_R_SUCCESS		Always succeeds.
  */
@@ -256,6 +259,25 @@ dns_aclelement_match(const isc_netaddr_t *reqaddr,
  * returned through 'matchelt' is not necessarily 'e' itself.
  */
 
+void
+dns_acl_flushcache(void);
+/*%<
+ * Invalidate the cached results of dns_acl_match() in all threads.
+ *
+ * This is done automatically when an ACL is created or merged into
+ * another, and when an address prefix is added to an IP table or IP
+ * tables are merged.  Code which changes the elements of an ACL or
+ * the contents of an ACL environment after the ACL may have been
+ * matched must call it.
+ */
+
+void
+dns_acl_shutdown(void);
+/*%<
+ * Release the memory context used for the per-thread caches.  The
+ * caches themselves are freed as their threads exit.
+ */
+
 ISC_LANG_ENDDECLS
 
 #endif /* DNS_ACL_H */
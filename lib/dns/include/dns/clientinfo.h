@@ -42,17 +42,20 @@
 #include <isc/sockaddr.h>
 #include <isc/types.h>
 
+#include <dns/types.h>
+
 ISC_LANG_BEGINDECLS
 
 /*****
  ***** Types
  *****/
 
-#define DNS_CLIENTINFO_VERSION 2
+#define DNS_CLIENTINFO_VERSION 3
 typedef struct dns_clientinfo {
 	uint16_t version;
 	void *data;
 	void *dbversion;
+	dns_ecs_t *ecs;
 } dns_clientinfo_t;
 
 typedef isc_result_t (*dns_clientinfo_sourceip_t)(dns_clientinfo_t *client,
@@ -77,6 +80,16 @@ dns_clientinfomethods_init(dns_clientinfomethods_t *methods,
 void
 dns_clientinfo_init(dns_clientinfo_t *ci, void *data, void *versionp);
 
+void
+dns_clientinfo_setecs(dns_clientinfo_t *ci, dns_ecs_t *ecs);
+/*%<
+ * Set the EDNS client subnet to be used when looking up data on
+ * behalf of the client.  A cache database that holds answers scoped
+ * to client subnets returns the most specific answer covering 'ecs',
+ * and raises 'ecs->scope' to the scope prefix length of that answer.
+ * 'ecs' may be NULL to disable scoped lookups.
+ */
+
 ISC_LANG_ENDDECLS
 
 #endif /* DNS_CLIENTINFO_H */
@@ -196,6 +196,12 @@ typedef struct dns_dbmethods {
 	isc_result_t	(*setservestalettl)(dns_db_t *db, dns_ttl_t ttl);
 	isc_result_t	(*getservestalettl)(dns_db_t *db, dns_ttl_t *ttl);
 	isc_result_t	(*setgluecachestats)(dns_db_t *db, isc_stats_t *stats);
+	isc_result_t	(*addscopedrdataset)(dns_db_t *db, dns_dbnode_t *node,
+					     isc_stdtime_t now,
+					     dns_rdataset_t *rdataset,
+					     unsigned int options,
+					     const dns_ecs_t *ecs,
+					     dns_rdataset_t *addedrdataset);
 } dns_dbmethods_t;
 
 typedef isc_result_t
@@ -754,7 +760,9 @@ dns_db_findext(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
  * dns_db_findext() (find extended) also accepts parameters 'methods'
  * and 'clientinfo', which when provided enable the database to retreive
  * information about the client from the caller, and modify its response
- * on the basis of this information.
+ * on the basis of this information.  A cache database uses the client
+ * subnet set with dns_clientinfo_setecs() to prefer answers that were
+ * added with dns_db_addscopedrdataset() for a subnet covering it.
  *
  * Notes:
  *
@@ -1249,6 +1257,52 @@ dns_db_addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
  *	implementation used.
  */
 
+isc_result_t
+dns_db_addscopedrdataset(dns_db_t *db, dns_dbnode_t *node, isc_stdtime_t now,
+			 dns_rdataset_t *rdataset, unsigned int options,
+			 const dns_ecs_t *ecs, dns_rdataset_t *addedrdataset);
+/*%<
+ * Add 'rdataset' to 'node' of the cache database 'db' as an answer that
+ * is only valid for clients within the subnet described by the address
+ * and scope prefix length of 'ecs' (RFC 7871).
+ *
+ * Notes:
+ *
+ * \li	Scoped rdatasets are kept apart from the unscoped data at 'node'
+ *	and from one another: adding one replaces only the rdataset of
+ *	the same type previously added for the same subnet.  The number
+ *	of scoped rdatasets at a node is bounded; when the bound is
+ *	reached the one closest to expiry is dropped.
+ *
+ * \li	Scoped rdatasets are only returned by dns_db_findext() when the
+ *	client subnet passed in 'clientinfo' falls within their scope; they
+ *	are not visible to dns_db_findrdataset() or rdataset iterators.
+ *	Deleting a type with dns_db_deleterdataset() also deletes the
+ *	scoped rdatasets of that type.
+ *
+ * \li	If 'ecs' is NULL or its scope prefix length is zero the rdataset
+ *	is global and this is equivalent to dns_db_addrdataset().
+ *
+ * Requires:
+ *
+ * \li	'db' is a valid cache database.
+ *
+ * \li	'node' is a valid node.
+ *
+ * \li	'rdataset' is a valid, associated, positive rdataset with the same
+ *	class as 'db'.
+ *
+ * \li	'addedrdataset' is NULL, or a valid, unassociated rdataset.
+ *
+ * Returns:
+ *
+ * \li	#ISC_R_SUCCESS
+ * \li	#DNS_R_UNCHANGED			The operation did not change anything.
+ * \li	#ISC_R_NOTIMPLEMENTED		The database or the type of 'rdataset'
+ *					does not support scoped data.
+ * \li	#ISC_R_NOMEMORY
+ */
+
 isc_result_t
 dns_db_subtractrdataset(dns_db_t *db, dns_dbnode_t *node,
 			dns_dbversion_t *version, dns_rdataset_t *rdataset,
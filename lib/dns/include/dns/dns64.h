@@ -125,6 +125,41 @@ dns_dns64_aaaafroma(const dns_dns64_t *dns64, const isc_netaddr_t *reqaddr,
  *	DNS_R_DISALLOWED	if there is no match.
  */
 
+isc_result_t
+dns_dns64_aaaafromrdataset(const dns_dns64_t *dns64,
+			   const isc_netaddr_t *reqaddr,
+			   const dns_name_t *reqsigner,
+			   const dns_aclenv_t *env, unsigned int flags,
+			   dns_rdataset_t *rdataset, unsigned char *aaaa,
+			   size_t aaaalen, unsigned int *countp);
+/*
+ * dns_dns64_aaaafromrdataset() performs DNS64 address synthesis for
+ * every address in the A rdataset 'rdataset', using every record in
+ * the list starting at 'dns64', in one pass.  This is equivalent to
+ * calling dns_dns64_aaaafroma() for each address and each record, but
+ * decides only once which records apply to the client.
+ *
+ * The synthesized addresses are written consecutively to 'aaaa', in
+ * the order of the addresses in 'rdataset' and, for each address, in
+ * the order of the records, and their number is returned in '*countp'.
+ * 'aaaa' must have room for 16 octets per address and record to
+ * guarantee that all addresses can be synthesized.
+ *
+ * Requires:
+ *	'dns64'		to be NULL or valid.
+ *	'reqaddr'	to be valid.
+ *	'reqsigner'	to be NULL or valid.
+ *	'env'		to be valid.
+ *	'rdataset'	to be valid and to be for type A and class IN.
+ *	'aaaa'		to point to a buffer of 'aaaalen' octets.
+ *	'countp'	to be non NULL.
+ *
+ * Returns:
+ *	ISC_R_SUCCESS	'*countp' (possibly zero) addresses were
+ *			synthesized.
+ *	ISC_R_NOSPACE	'aaaa' is too small.
+ */
+
 dns_dns64_t *
 dns_dns64_next(dns_dns64_t *dns64);
 /*
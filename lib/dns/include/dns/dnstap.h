@@ -278,7 +278,11 @@ dns_dt_send(dns_view_t *view, dns_dtmsgtype_t msgtype,
 	    isc_time_t *rtime, isc_buffer_t *buf);
 /*%<
  * Sends a dnstap message to the log, if 'msgtype' is one of the message
- * types represented in 'view->dttypes'.
+ * types represented in 'view->dttypes'.  If 'view->dtsample' is greater
+ * than one, only about one in that many transactions is logged; if
+ * 'view->dtprefix4' and 'view->dtprefix6' are set, the sample is of the
+ * clients' (or servers') networks of those prefix lengths instead.
+ * Either way, a query and its response are logged or not together.
  *
  * Parameters are: 'qaddr' (query address, i.e, the address of the
  * query initiator); 'raddr' (response address, i.e., the address of
@@ -334,6 +338,29 @@ dns_dt_datatotext(dns_dtdata_t *d, isc_buffer_t **dest);
  *\li	Other errors are possible.
  */
 
+isc_result_t
+dns_dt_frametotext(isc_region_t *src, isc_buffer_t **dest);
+/*%<
+ * Converts the raw dnstap frame in 'src' to the same text as
+ * dns_dt_parse() followed by dns_dt_datatotext() would, storing the
+ * result in the buffer 'dest'.  The frame is decoded directly, without
+ * unpacking it with protobuf-c or parsing more of the DNS message than
+ * its question, which makes this much faster for reading large files.
+ * If the question cannot be parsed the query tuple is printed as
+ * "?/?/?" where dns_dt_parse() would fail.
+ *
+ * Requires:
+ *\li	'src' is not NULL
+ *
+ *\li	'dest' is not NULL and '*dest' points to a valid buffer.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS on success
+ *\li	#DNS_R_BADDNSTAP if 'src' is not a valid dnstap message
+ *
+ *\li	Other errors are possible, as for dns_dt_datatotext().
+ */
+
 void
 dns_dtdata_free(dns_dtdata_t **dp);
 /*%<
@@ -13,6 +13,7 @@
 #define DNS_ECS_H 1
 
 #include <inttypes.h>
+#include <stdbool.h>
 
 #include <isc/netaddr.h>
 #include <isc/types.h>
@@ -37,6 +38,18 @@ dns_ecs_init(dns_ecs_t *ecs);
  * \li 'ecs' is not NULL and points to a valid dns_ecs structure.
  */
 
+bool
+dns_ecs_equals(const dns_ecs_t *ecs1, const dns_ecs_t *ecs2);
+/*%<
+ * Determine whether two ECS structures describe the same client subnet:
+ * the same address family, the same source prefix length, and the same
+ * address bits up to that length.  The scope prefix length is not
+ * compared.
+ *
+ * Requires:
+ * \li 'ecs1' and 'ecs2' are not NULL.
+ */
+
 void
 dns_ecs_format(dns_ecs_t *ecs, char *buf, size_t size);
 /*%<
@@ -109,6 +109,13 @@ dns_geoip_match(const isc_netaddr_t *reqaddr,
 		const dns_geoip_databases_t *geoip,
 		const dns_geoip_elem_t *elt);
 
+void
+dns_geoip_flushcache(void);
+/*%<
+ * Discard the GeoIP results cached by dns_geoip_match() in all
+ * threads.  Must be called when the GeoIP databases are reloaded.
+ */
+
 void
 dns_geoip_shutdown(void);
 
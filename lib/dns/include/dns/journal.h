@@ -45,6 +45,7 @@
 #define DNS_JOURNAL_READ	0x00000000	/* false */
 #define DNS_JOURNAL_CREATE	0x00000001	/* true */
 #define DNS_JOURNAL_WRITE	0x00000002
+#define DNS_JOURNAL_DEFERSYNC	0x00000004
 
 #define DNS_JOURNAL_SIZE_MAX	INT32_MAX
 #define DNS_JOURNAL_SIZE_MIN	4096
@@ -107,6 +108,16 @@ dns_journal_open(isc_mem_t *mctx, const char *filename, unsigned int mode,
  * the journal if it does not exist.
  * DNS_JOURNAL_WRITE open the journal for reading and writing.
  * DNS_JOURNAL_READ open the journal for reading only.
+ *
+ * DNS_JOURNAL_DEFERSYNC may be combined with DNS_JOURNAL_CREATE or
+ * DNS_JOURNAL_WRITE.  Transactions committed through such a journal
+ * are made visible to other readers of the file but are not forced
+ * to stable storage; that is left to a later dns_journal_sync().
+ * If the system crashes before then, the unsynced transactions are
+ * checked the next time the journal is opened by another process
+ * and any that were not completely written are discarded.  Opening
+ * the journal again from the process that deferred the sync costs
+ * nothing extra.
  */
 
 void
@@ -172,6 +183,19 @@ dns_journal_write_transaction(dns_journal_t *j, dns_diff_t *diff);
  *       in arbitrary order.
  */
 
+isc_result_t
+dns_journal_sync(dns_journal_t *j);
+/*%<
+ * Force any transactions committed with DNS_JOURNAL_DEFERSYNC,
+ * through this or any other dns_journal_t open on the same file,
+ * to stable storage.  This costs one round of fsync() regardless of
+ * the number of transactions outstanding, and nothing if there are
+ * none.
+ *
+ * Requires:
+ *\li      'j' is open for writing and no transaction is in progress.
+ */
+
 /**************************************************************************/
 /*
  * Reading transactions from journals.
@@ -170,6 +170,9 @@ typedef int dns_messagetextflag_t;
 						   source buffer */
 #define DNS_MESSAGEPARSE_IGNORETRUNCATION 0x0008 /*%< truncation errors are
 						  * not fatal. */
+#define DNS_MESSAGEPARSE_ARENA		0x0010	/*%< allocate parse-time
+						   objects from the
+						   message arena */
 
 /*
  * Control behavior of rendering
@@ -184,6 +187,7 @@ typedef int dns_messagetextflag_t;
 #define DNS_MESSAGERENDER_FILTER_AAAA	0x0020	/*%< filter AAAA records */
 
 typedef struct dns_msgblock dns_msgblock_t;
+typedef struct dns_msgarena dns_msgarena_t;
 
 struct dns_sortlist_arg {
 	dns_aclenv_t *env;
@@ -224,6 +228,7 @@ struct dns_message {
 	unsigned int			cc_bad : 1;
 	unsigned int			tkey : 1;
 	unsigned int			rdclass_set : 1;
+	unsigned int			use_arena : 1;
 
 	unsigned int			opt_reserved;
 	unsigned int			sig_reserved;
@@ -245,6 +250,8 @@ struct dns_message {
 	ISC_LIST(dns_msgblock_t)	rdatas;
 	ISC_LIST(dns_msgblock_t)	rdatalists;
 	ISC_LIST(dns_msgblock_t)	offsets;
+	ISC_LIST(dns_msgarena_t)	arena;
+	unsigned int			arena_hint;
 
 	ISC_LIST(dns_rdata_t)		freerdata;
 	ISC_LIST(dns_rdatalist_t)	freerdatalist;
@@ -450,6 +457,16 @@ dns_message_parse(dns_message_t *msg, isc_buffer_t *source,
  * If #DNS_MESSAGEPARSE_IGNORETRUNCATION is set then return as many complete
  * RR's as possible, DNS_R_RECOVERABLE will be returned.
  *
+ * If #DNS_MESSAGEPARSE_ARENA is set, the names, rdatasets, rdatas and
+ * decompressed wire data of the message are carved out of a single
+ * arena owned by 'msg' instead of the message's memory pools and
+ * scratch buffers.  The arena is sized from 'source' and is retained
+ * when the message is reset, so a message which is reused to parse
+ * similar packets makes no allocator calls while parsing.  Objects
+ * taken from the arena remain valid until the message is reset or
+ * destroyed, and may be handed back with the dns_message_puttemp*()
+ * functions like any other.
+ *
  * OPT and TSIG records are always handled specially, regardless of the
  * 'preserve_order' setting.
  *
@@ -585,6 +602,33 @@ dns_message_rendersection(dns_message_t *msg, dns_section_t section,
  *				   are records remaining for this section.
  */
 
+isc_result_t
+dns_message_renderraw(dns_message_t *msg, dns_section_t section,
+		      const isc_region_t *r, unsigned int count);
+/*%<
+ * Append 'count' records of previously rendered wire data in 'r' to
+ * 'section'.  The data is copied verbatim and is not added to the
+ * compression context; any compression pointers it contains must
+ * refer to data that is identical, and at the same offsets, in the
+ * message being rendered.  This allows a caller that renders the same
+ * section many times (e.g. outgoing zone transfers) to replay an earlier
+ * rendering.
+ *
+ * Requires:
+ *\li	'msg' be valid.
+ *
+ *\li	'section' be a valid section.
+ *
+ *\li	dns_message_renderbegin() was called.
+ *
+ *\li	'r' be a valid region.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS		-- the data was appended.
+ *\li	#ISC_R_NOSPACE		-- not enough room in the buffer, taking
+ *				   reserved space into account.
+ */
+
 void
 dns_message_renderheader(dns_message_t *msg, isc_buffer_t *target);
 /*%<
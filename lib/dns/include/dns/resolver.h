@@ -285,6 +285,7 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
 			 const dns_name_t *domain, dns_rdataset_t *nameservers,
 			 dns_forwarders_t *forwarders,
 			 const isc_sockaddr_t *client, dns_messageid_t id,
+			 const dns_ecs_t *ecs,
 			 unsigned int options, unsigned int depth,
 			 isc_counter_t *qc, isc_task_t *task,
 			 isc_taskaction_t action, void *arg,
@@ -317,6 +318,12 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
  *	must remain stable until after 'action' has been called or
  *	dns_resolver_cancelfetch() is called.
  *
+ *\li	If 'ecs' is not NULL and has a non-zero source prefix length, the
+ *	queries sent carry it as an EDNS CLIENT-SUBNET option (RFC 7871),
+ *	only fetches for the same subnet are shared, and answers that the
+ *	authoritative server scopes to a subnet are cached with
+ *	dns_db_addscopedrdataset().  Signed answers are cached unscoped.
+ *
  * Requires:
  *
  *\li	'res' is a valid resolver that has been frozen.
@@ -334,6 +341,8 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
  *
  *\li	'client' is a valid sockaddr or NULL.
  *
+ *\li	'ecs' is NULL, or has an AF_INET or AF_INET6 address.
+ *
  *\li	'options' contains valid options.
  *
  *\li	'rdataset' is a valid, disassociated rdataset.
@@ -294,6 +294,8 @@ typedef struct {
 		dns_dbversion_t		*version;
 		dns_dbnode_t		*node;
 		dns_rdataset_t		*rdataset;
+		bool			compiled; /* policy from the
+						   * summary database */
 	} m;
 	/*
 	 * State for chasing IP addresses and NS names including recursion.
@@ -408,6 +410,24 @@ isc_result_t
 dns_rpz_add(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
 	    const dns_name_t *name);
 
+isc_result_t
+dns_rpz_compile(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
+		const dns_name_t *name, dns_rpz_policy_t policy,
+		dns_ttl_t ttl);
+/*%<
+ * Record in the summary database the 'policy' and 'ttl' of the exact
+ * QNAME or NSDNAME trigger 'name' added to policy zone 'rpz_num' with
+ * dns_rpz_add().  PASSTHRU, DROP, TCP-ONLY, NXDOMAIN, and NODATA
+ * policies are kept for the lowest numbered zone, so that
+ * dns_rpz_find_policy() can return them.  Other policies forget any
+ * policy previously recorded for the zone.  Wildcard and IP address
+ * triggers are ignored.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOTFOUND if the trigger is not in the summary database
+ */
+
 void
 dns_rpz_delete(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
 	       const dns_name_t *name);
@@ -421,6 +441,22 @@ dns_rpz_zbits_t
 dns_rpz_find_name(dns_rpz_zones_t *rpzs, dns_rpz_type_t rpz_type,
 		  dns_rpz_zbits_t zbits, dns_name_t *trig_name);
 
+dns_rpz_zbits_t
+dns_rpz_find_policy(dns_rpz_zones_t *rpzs, dns_rpz_type_t rpz_type,
+		    dns_rpz_zbits_t zbits, dns_name_t *trig_name,
+		    dns_rpz_num_t *rpz_nump, dns_rpz_policy_t *policyp,
+		    dns_ttl_t *ttlp);
+/*%<
+ * Like dns_rpz_find_name(), but when the lowest numbered zone with
+ * a hit has a policy recorded with dns_rpz_compile() for the exact
+ * trigger 'trig_name', also return that zone in '*rpz_nump' and the
+ * policy and its TTL in '*policyp' and '*ttlp'.  Otherwise, '*rpz_nump'
+ * is set to DNS_RPZ_INVALID_NUM.
+ *
+ * Requires:
+ *\li	'rpz_nump' is NULL, or 'policyp' and 'ttlp' are not NULL.
+ */
+
 ISC_LANG_ENDDECLS
 
 #endif /* DNS_RPZ_H */
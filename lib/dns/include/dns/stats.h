@@ -98,8 +98,10 @@ enum {
 	dns_zonestatscounter_ixfrreqv6 = 10,
 	dns_zonestatscounter_xfrsuccess = 11,
 	dns_zonestatscounter_xfrfail = 12,
+	dns_zonestatscounter_journaldeferred = 13,
+	dns_zonestatscounter_journalsync = 14,
 
-	dns_zonestatscounter_max = 13,
+	dns_zonestatscounter_max = 15,
 
 	/*
 	 * Adb statistics values.
@@ -120,8 +122,10 @@ enum {
 	dns_cachestatscounter_querymisses = 4,
 	dns_cachestatscounter_deletelru = 5,
 	dns_cachestatscounter_deletettl = 6,
+	dns_cachestatscounter_scopedhits = 7,
+	dns_cachestatscounter_scopedmisses = 8,
 
-	dns_cachestatscounter_max = 7,
+	dns_cachestatscounter_max = 9,
 
 	/*%
 	 * Query statistics counters (obsolete).
@@ -442,6 +446,18 @@ enum {
 	dns_sizecounter_out_max = 257
 };
 
+/*%
+ * Per-view latency histograms, in microseconds.  Used as isc_histo_t IDs.
+ */
+enum {
+	dns_latency_query = 0,		/*%< client request to response */
+	dns_latency_recursion = 1,	/*%< query recursion */
+	dns_latency_fetch = 2,		/*%< resolver fetch */
+	dns_latency_rtt = 3,		/*%< upstream server RTT */
+
+	dns_latency_max = 4
+};
+
 #define DNS_STATS_NCOUNTERS 8
 
 #if 0
@@ -67,6 +67,7 @@ struct dns_tsig_keyring {
 	unsigned int generated;
 	unsigned int maxgenerated;
 	ISC_LIST(dns_tsigkey_t) lru;
+	isc_stdtime_t lastclean;	/*%< last expiry scan */
 	unsigned int references;
 };
 
@@ -145,6 +145,7 @@ typedef struct dns_update_state			dns_update_state_t;
 typedef struct dns_validator			dns_validator_t;
 typedef struct dns_view				dns_view_t;
 typedef ISC_LIST(dns_view_t)			dns_viewlist_t;
+typedef struct dns_viewindex			dns_viewindex_t;
 typedef struct dns_zone				dns_zone_t;
 typedef ISC_LIST(dns_zone_t)			dns_zonelist_t;
 typedef struct dns_zonemgr			dns_zonemgr_t;
@@ -433,6 +434,9 @@ typedef bool
 (*dns_isselffunc_t)(dns_view_t *, dns_tsigkey_t *, const isc_sockaddr_t *,
 		    const isc_sockaddr_t *, dns_rdataclass_t, void *);
 
+typedef void
+(*dns_dbreleasedfunc_t)(dns_zone_t *, dns_db_t *, void *);
+
 typedef isc_result_t
 (*dns_deserializefunc_t)(void *, FILE *, off_t);
 
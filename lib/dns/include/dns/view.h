@@ -108,6 +108,7 @@ struct dns_view {
 	isc_stats_t *			adbstats;
 	isc_stats_t *			resstats;
 	dns_stats_t *			resquerystats;
+	isc_histo_t *			latency;
 	bool			cacheshared;
 
 	/* Configurable data. */
@@ -173,6 +174,9 @@ struct dns_view {
 	dns_ttl_t			staleanswerttl;
 	dns_stale_answer_t		staleanswersok;		/* rndc setting */
 	bool			staleanswersenable;	/* named.conf setting */
+	bool			sendclientsubnet;
+	dns_acl_t *			ecsclients;
+	dns_acl_t *			ecsservers;
 	uint16_t			nocookieudp;
 	uint16_t			padding;
 	dns_acl_t *			pad_acl;
@@ -236,6 +240,9 @@ struct dns_view {
 	dns_dtenv_t			*dtenv;		/* Dnstap environment */
 	dns_dtmsgtype_t			dttypes;	/* Dnstap message types
 							   to log */
+	unsigned int			dtsample;	/* Log 1 in N */
+	unsigned int			dtprefix4;	/* Sample by prefix */
+	unsigned int			dtprefix6;
 };
 
 #define DNS_VIEW_MAGIC			ISC_MAGIC('V','i','e','w')
@@ -1098,6 +1105,34 @@ dns_view_getresquerystats(dns_view_t *view, dns_stats_t **statsp);
  *\li	'statsp' != NULL && '*statsp' != NULL
  */
 
+void
+dns_view_setlatency(dns_view_t *view, isc_histo_t *histo);
+/*%<
+ * Set a set of latency histograms 'histo' for 'view'.  Once the set is
+ * installed, the view's resolver will record fetch durations and
+ * server round trip times, and the server will record query handling
+ * and recursion times for the view.
+ *
+ * Requires:
+ * \li	'view' is valid and is not frozen.
+ *
+ *\li	histo is a valid histogram set with dns_latency_max histograms
+ *	(see dns/stats.h).
+ */
+
+void
+dns_view_getlatency(dns_view_t *view, isc_histo_t **histop);
+/*%<
+ * Get the latency histograms for 'view'.  If a histogram set is set
+ * '*histop' will be attached to the set; otherwise, '*histop' will be
+ * untouched.
+ *
+ * Requires:
+ * \li	'view' is valid.
+ *
+ *\li	'histop' != NULL && '*histop' == NULL
+ */
+
 bool
 dns_view_iscacheshared(dns_view_t *view);
 /*%<
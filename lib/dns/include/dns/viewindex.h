@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#ifndef DNS_VIEWINDEX_H
+#define DNS_VIEWINDEX_H 1
+
+/*****
+ ***** Module Info
+ *****/
+
+/*! \file dns/viewindex.h
+ * \brief
+ * A view index maps the source address of a query to the ordered list
+ * of views which could possibly match it, so that view selection does
+ * not have to evaluate the match-clients ACL of every configured view.
+ *
+ * The index is compiled from a view list.  The address prefixes of
+ * all match-clients ACLs are combined into a single radix tree in
+ * which each address falls into exactly one cell (the longest
+ * matching prefix), and each cell records which views accept
+ * addresses in it.  A view whose match-clients ACL also has other
+ * elements (keys, localhost/localnets, GeoIP, nested ACLs with such
+ * elements) is listed in a cell as a candidate to be evaluated in
+ * full, unless its address prefixes already decide the match there.
+ * Key name elements never match queries without a TSIG, so each cell
+ * keeps separate candidate lists for signed and unsigned queries.
+ * Candidates remain in view list order, so the first matching view
+ * is the same one a linear scan would find.
+ *
+ * The index holds weak references to its views; it must be rebuilt
+ * whenever the view list or the views' match-* settings change.
+ */
+
+#include <isc/lang.h>
+#include <isc/netaddr.h>
+
+#include <dns/types.h>
+
+ISC_LANG_BEGINDECLS
+
+isc_result_t
+dns_viewindex_create(isc_mem_t *mctx, dns_viewlist_t *viewlist,
+		     dns_viewindex_t **indexp);
+/*%<
+ * Compile the match-clients, match-destinations and
+ * match-recursive-only settings of all views in 'viewlist' into a
+ * new view index.
+ *
+ * Requires:
+ *\li	'mctx' is a valid memory context.
+ *\li	'viewlist' is a valid view list.
+ *\li	'indexp' is not NULL and '*indexp' is NULL.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOMEMORY
+ */
+
+void
+dns_viewindex_destroy(dns_viewindex_t **indexp);
+/*%<
+ * Destroy a view index, releasing its references to the views.
+ *
+ * Requires:
+ *\li	'*indexp' is a valid view index.
+ */
+
+isc_result_t
+dns_viewindex_find(dns_viewindex_t *index, isc_netaddr_t *srcaddr,
+		   isc_netaddr_t *destaddr, dns_message_t *message,
+		   dns_aclenv_t *env, isc_result_t *sigresult,
+		   dns_view_t **viewp);
+/*%<
+ * Find the first view in 'index' which matches a query from 'srcaddr'
+ * to 'destaddr' with the class and flags of 'message'.  The result
+ * is the same as checking each view in view list order.
+ *
+ * The signature of 'message' is rechecked against the keys of every
+ * view whose ACLs depend on the TSIG identity, and against the keys of
+ * the view returned; '*sigresult' is set to the result of the latter.
+ *
+ * Requires:
+ *\li	'index' is a valid view index.
+ *\li	'message' is a valid message.
+ *\li	'sigresult' is not NULL.
+ *\li	'viewp' is not NULL and '*viewp' is NULL.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS		'*viewp' is attached to the matching view.
+ *\li	#ISC_R_NOTFOUND		No view matched.
+ */
+
+unsigned int
+dns_viewindex_count(dns_viewindex_t *index);
+/*%<
+ * Return the number of views in 'index'.
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* DNS_VIEWINDEX_H */
@@ -1200,6 +1200,31 @@ dns_zone_getjournalsize(dns_zone_t *zone);
  *\li	'zone' to be a valid zone.
  */
 
+void
+dns_zone_setjournalsyncdelay(dns_zone_t *zone, uint32_t delay);
+uint32_t
+dns_zone_getjournalsyncdelay(dns_zone_t *zone);
+/*%<
+ *	Set/get the number of milliseconds by which forcing a journal
+ *	transaction to stable storage may be deferred.  Zero, the
+ *	default, syncs every transaction as it is committed.
+ *
+ * Requires:
+ *\li	'zone' to be a valid zone.
+ */
+
+void
+dns_zone_journaldeferred(dns_zone_t *zone);
+/*%<
+ *	Tell the zone that a transaction has been committed to its
+ *	journal with DNS_JOURNAL_DEFERSYNC.  All transactions
+ *	deferred in this way are synced together, no later than the
+ *	configured journal sync delay after the first of them.
+ *
+ * Requires:
+ *\li	'zone' to be a valid zone.
+ */
+
 isc_result_t
 dns_zone_notifyreceive(dns_zone_t *zone, isc_sockaddr_t *from,
 		       isc_sockaddr_t *to, dns_message_t *msg);
@@ -2097,6 +2122,20 @@ dns_zone_setisself(dns_zone_t *zone, dns_isselffunc_t isself, void *arg);
  * delivered to 'myview'.
  */
 
+void
+dns_zone_setdbreleased(dns_zone_t *zone, dns_dbreleasedfunc_t released,
+		       void *arg);
+/*%<
+ * Set a function to be called whenever 'zone' stops using a database,
+ * because the database was replaced or the zone was unloaded or freed.
+ *
+ * void
+ * released(dns_zone_t *zone, dns_db_t *db, void *arg);
+ *
+ * It may be called with the zone or its database lock held and must not
+ * call back into the zone.  'db' is still attached when it is called.
+ */
+
 void
 dns_zone_setnodes(dns_zone_t *zone, uint32_t nodes);
 /*%<
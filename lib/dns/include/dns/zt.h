@@ -192,6 +192,31 @@ dns_zt_apply(dns_zt_t *zt, bool stop, isc_result_t *sub,
  *	any error code from 'action'.
  */
 
+isc_result_t
+dns_zt_applyfrom(dns_zt_t *zt, const dns_name_t *from,
+		 isc_result_t (*action)(dns_zone_t *, void *), void *uap);
+/*%<
+ * Apply 'action' to the zones in the table in DNSSEC order, starting
+ * with the zone named 'from' if there is one, or else with the first
+ * zone whose name sorts after 'from'.  If 'from' is NULL, start with the
+ * first zone.  The walk stops at the first zone for which 'action'
+ * does not return ISC_R_SUCCESS.
+ *
+ * This allows a long walk to be done in pieces: the caller remembers
+ * the last zone it handled and resumes from there, without holding
+ * any lock in between.  The table is read locked while 'action' runs,
+ * so 'action' must not modify the table.
+ *
+ * Requires:
+ * \li	'zt' to be valid.
+ * \li	'from' to be NULL or an absolute name.
+ * \li	'action' to be non NULL.
+ *
+ * Returns:
+ * \li	ISC_R_SUCCESS if 'action' was applied to all remaining zones.
+ * \li	any other result returned by 'action'.
+ */
+
 bool
 dns_zt_loadspending(dns_zt_t *zt);
 /*%<
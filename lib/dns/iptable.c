@@ -95,6 +95,8 @@ dns_iptable_addprefix(dns_iptable_t *tab, const isc_netaddr_t *addr,
 		}
 	}
 
+	dns_acl_flushcache();
+
 	isc_refcount_destroy(&pfx.refcount);
 	return (ISC_R_SUCCESS);
 }
@@ -136,6 +138,7 @@ dns_iptable_merge(dns_iptable_t *tab, dns_iptable_t *source, bool pos)
 	} RADIX_WALK_END;
 
 	tab->radix->num_added_node += max_node;
+	dns_acl_flushcache();
 	return (ISC_R_SUCCESS);
 }
 
@@ -19,7 +19,9 @@
 
 #include <isc/file.h>
 #include <isc/mem.h>
+#include <isc/once.h>
 #include <isc/print.h>
+#include <isc/random.h>
 #include <isc/stdio.h>
 #include <isc/string.h>
 #include <isc/util.h>
@@ -36,6 +38,14 @@
 #include <dns/result.h>
 #include <dns/soa.h>
 
+#ifndef WIN32
+#include <sys/mman.h>
+#else
+#define PROT_READ	0x01
+#define MAP_PRIVATE	0x0002
+#define MAP_FAILED	((void *)-1)
+#endif
+
 /*! \file
  * \brief Journaling.
  *
@@ -72,6 +82,26 @@
  *     appended to the journal but never committed by updating
  *     the "end" position in the header.  The latter will
  *     be overwritten when new transactions are added.
+ *
+ * Journals opened for reading only (outgoing IXFR, named-journalprint,
+ * the source side of dns_journal_compact()) are mapped into memory
+ * when possible.  Walking the transaction headers in journal_find()
+ * and reading RRs in read_one_rr() then costs no system calls, and
+ * the RR data is parsed directly from the mapping without being
+ * copied.  Only the part of the file up to the committed "end"
+ * position is mapped, so transactions appended while the journal
+ * is open for reading are never visible through the mapping.
+ *
+ * The index in the header has a fixed number of entries and only
+ * narrows down where journal_find() starts walking.  The writer
+ * therefore also keeps a dense index next to the journal, in a file
+ * named after it with ".idx" appended.  It is an array of
+ * journal_rawpos_t giving the serial and offset of every transaction
+ * from "begin" onwards, in file order, so journal_find() can binary
+ * search it.  It is only a hint: it is not synced, and a missing,
+ * short or stale dense index (an older journal, a crash, a journal
+ * compacted by an older version) makes journal_find() fall back to
+ * the header index.  The writer rebuilds it at its next commit.
  */
 
 /**************************************************************************/
@@ -101,8 +131,10 @@
 	} while (0)
 
 #define JOURNAL_SERIALSET	0x01U
+#define JOURNAL_SYNCPENDING	0x02U
 
 static isc_result_t index_to_disk(dns_journal_t *);
+static void dindex_remove(const char *);
 
 static inline uint32_t
 decode_uint32(unsigned char *p) {
@@ -210,6 +242,17 @@ typedef union {
 		/*% Source serial number. */
 		unsigned char           sourceserial[4];
 		unsigned char           flags;
+		/*%
+		 * Position up to which the journal is known to be on
+		 * stable storage.  Only meaningful when the
+		 * JOURNAL_SYNCPENDING flag is set.
+		 */
+		journal_rawpos_t	synced;
+		/*%
+		 * Identifies the process that deferred the sync.  Only
+		 * meaningful when the JOURNAL_SYNCPENDING flag is set.
+		 */
+		unsigned char		writer[4];
 	} h;
 	/* Pad the header to a fixed size. */
 	unsigned char pad[JOURNAL_HEADER_SIZE];
@@ -251,6 +294,9 @@ typedef struct {
 	uint32_t	index_size;
 	uint32_t	sourceserial;
 	bool	serialset;
+	bool	syncpending;
+	journal_pos_t 	synced;
+	uint32_t	writer;
 } journal_header_t;
 
 /*%
@@ -283,7 +329,9 @@ typedef struct {
  */
 
 static journal_header_t
-initial_journal_header = { ";BIND LOG V9\n", { 0, 0 }, { 0, 0 }, 0, 0, 0 };
+initial_journal_header = {
+	";BIND LOG V9\n", { 0, 0 }, { 0, 0 }, 0, 0, 0, 0, { 0, 0 }, 0
+};
 
 #define JOURNAL_EMPTY(h) ((h)->begin.offset == (h)->end.offset)
 
@@ -300,11 +348,16 @@ struct dns_journal {
 	isc_mem_t		*mctx;		/*%< Memory context */
 	journal_state_t		state;
 	char 			*filename;	/*%< Journal file name */
+	bool			defersync;	/*%< Opened with DEFERSYNC */
 	FILE *			fp;		/*%< File handle */
+	unsigned char		*map;		/*%< Read-only file mapping */
+	size_t			maplen;		/*%< Length of 'map' */
 	isc_offset_t		offset;		/*%< Current file offset */
 	journal_header_t 	header;		/*%< In-core journal header */
 	unsigned char		*rawindex;	/*%< In-core buffer for journal index in on-disk format */
 	journal_pos_t		*index;		/*%< In-core journal index */
+	FILE *			dfp;		/*%< Dense index file handle */
+	uint32_t		dlen;		/*%< Dense index entries */
 
 	/*% Current transaction state (when writing). */
 	struct {
@@ -334,6 +387,8 @@ struct dns_journal {
 #define DNS_JOURNAL_MAGIC	ISC_MAGIC('J', 'O', 'U', 'R')
 #define DNS_JOURNAL_VALID(t)	ISC_MAGIC_VALID(t, DNS_JOURNAL_MAGIC)
 
+static isc_result_t journal_next(dns_journal_t *j, journal_pos_t *pos);
+
 static void
 journal_pos_decode(journal_rawpos_t *raw, journal_pos_t *cooked) {
 	cooked->serial = decode_uint32(raw->serial);
@@ -355,6 +410,14 @@ journal_header_decode(journal_rawheader_t *raw, journal_header_t *cooked) {
 	cooked->index_size = decode_uint32(raw->h.index_size);
 	cooked->sourceserial = decode_uint32(raw->h.sourceserial);
 	cooked->serialset = (raw->h.flags & JOURNAL_SERIALSET);
+	cooked->syncpending = (raw->h.flags & JOURNAL_SYNCPENDING);
+	if (cooked->syncpending) {
+		journal_pos_decode(&raw->h.synced, &cooked->synced);
+		cooked->writer = decode_uint32(raw->h.writer);
+	} else {
+		POS_INVALIDATE(cooked->synced);
+		cooked->writer = 0;
+	}
 }
 
 static void
@@ -370,6 +433,11 @@ journal_header_encode(journal_header_t *cooked, journal_rawheader_t *raw) {
 	encode_uint32(cooked->sourceserial, raw->h.sourceserial);
 	if (cooked->serialset)
 		flags |= JOURNAL_SERIALSET;
+	if (cooked->syncpending) {
+		flags |= JOURNAL_SYNCPENDING;
+		journal_pos_encode(&raw->h.synced, &cooked->synced);
+		encode_uint32(cooked->writer, raw->h.writer);
+	}
 	raw->h.flags = flags;
 }
 
@@ -380,6 +448,17 @@ static isc_result_t
 journal_seek(dns_journal_t *j, uint32_t offset) {
 	isc_result_t result;
 
+	if (j->map != NULL) {
+		if (offset > j->maplen) {
+			isc_log_write(JOURNAL_COMMON_LOGARGS, ISC_LOG_ERROR,
+				      "%s: seek: offset %u beyond end of "
+				      "mapping", j->filename, offset);
+			return (ISC_R_UNEXPECTED);
+		}
+		j->offset = offset;
+		return (ISC_R_SUCCESS);
+	}
+
 	result = isc_stdio_seek(j->fp, (off_t)offset, SEEK_SET);
 	if (result != ISC_R_SUCCESS) {
 		isc_log_write(JOURNAL_COMMON_LOGARGS, ISC_LOG_ERROR,
@@ -395,6 +474,14 @@ static isc_result_t
 journal_read(dns_journal_t *j, void *mem, size_t nbytes) {
 	isc_result_t result;
 
+	if (j->map != NULL) {
+		if (nbytes > j->maplen - (size_t)j->offset)
+			return (ISC_R_NOMORE);
+		memmove(mem, j->map + j->offset, nbytes);
+		j->offset += (isc_offset_t)nbytes;
+		return (ISC_R_SUCCESS);
+	}
+
 	result = isc_stdio_read(mem, 1, nbytes, j->fp, NULL);
 	if (result != ISC_R_SUCCESS) {
 		if (result == ISC_R_EOF)
@@ -423,6 +510,19 @@ journal_write(dns_journal_t *j, void *mem, size_t nbytes) {
 	return (ISC_R_SUCCESS);
 }
 
+static isc_result_t
+journal_flush(dns_journal_t *j) {
+	isc_result_t result;
+	result = isc_stdio_flush(j->fp);
+	if (result != ISC_R_SUCCESS) {
+		isc_log_write(JOURNAL_COMMON_LOGARGS, ISC_LOG_ERROR,
+			      "%s: flush: %s",
+			      j->filename, isc_result_totext(result));
+		return (ISC_R_UNEXPECTED);
+	}
+	return (ISC_R_SUCCESS);
+}
+
 static isc_result_t
 journal_fsync(dns_journal_t *j) {
 	isc_result_t result;
@@ -507,6 +607,8 @@ journal_file_create(isc_mem_t *mctx, const char *filename) {
 		return (ISC_R_UNEXPECTED);
 	}
 
+	dindex_remove(filename);
+
 	header = initial_journal_header;
 	header.index_size = index_size;
 	journal_header_encode(&header, &rawheader);
@@ -547,6 +649,145 @@ journal_file_create(isc_mem_t *mctx, const char *filename) {
 	return (ISC_R_SUCCESS);
 }
 
+/*
+ * A random value identifying this process in the headers of journals
+ * with a pending sync, so that journal_open() can tell whether the
+ * process that deferred the sync is still running.
+ */
+static isc_once_t instance_once = ISC_ONCE_INIT;
+static uint32_t instance_id;
+
+static void
+instance_initialize(void) {
+	do {
+		instance_id = isc_random32();
+	} while (instance_id == 0);
+}
+
+static uint32_t
+journal_instance(void) {
+	RUNTIME_CHECK(isc_once_do(&instance_once, instance_initialize) ==
+		      ISC_R_SUCCESS);
+	return (instance_id);
+}
+
+/*
+ * The journal was last written with DNS_JOURNAL_DEFERSYNC by a
+ * process that is no longer running, and dns_journal_sync() was not
+ * called before it went away, so the transactions
+ * between 'header.synced' and 'header.end' may not have reached
+ * stable storage before a crash.  Check each of them and, at the
+ * first one that cannot be read back intact, discard it and
+ * everything after it.  The checked-out journal header is written
+ * back only if the journal is open for writing.
+ */
+static isc_result_t
+journal_recover(dns_journal_t *j, bool writable) {
+	isc_result_t result;
+	journal_rawheader_t rawheader;
+	journal_pos_t pos, next;
+	unsigned int i;
+
+	pos = j->header.synced;
+	while (pos.serial != j->header.end.serial) {
+		next = pos;
+		result = journal_next(j, &next);
+		if (result == ISC_R_SUCCESS) {
+			j->it.bpos = pos;
+			j->it.epos = next;
+			for (result = dns_journal_first_rr(j);
+			     result == ISC_R_SUCCESS;
+			     result = dns_journal_next_rr(j))
+				;
+			if (result == ISC_R_NOMORE &&
+			    j->it.current_serial == next.serial)
+				result = ISC_R_SUCCESS;
+		}
+		if (result != ISC_R_SUCCESS)
+			break;
+		pos = next;
+	}
+
+	if (pos.serial != j->header.end.serial ||
+	    pos.offset != j->header.end.offset)
+	{
+		isc_log_write(JOURNAL_COMMON_LOGARGS, ISC_LOG_WARNING,
+			      "%s: discarding incompletely written "
+			      "transactions after serial %u",
+			      j->filename, pos.serial);
+		j->header.end = pos;
+		for (i = 0; j->index != NULL &&
+			    i < j->header.index_size; i++)
+		{
+			if (j->index[i].offset >= pos.offset)
+				POS_INVALIDATE(j->index[i]);
+		}
+	}
+
+	if (!writable)
+		return (ISC_R_SUCCESS);
+
+	j->header.syncpending = false;
+	journal_header_encode(&j->header, &rawheader);
+	CHECK(journal_seek(j, 0));
+	CHECK(journal_write(j, &rawheader, sizeof(rawheader)));
+	CHECK(index_to_disk(j));
+	CHECK(journal_fsync(j));
+
+	result = ISC_R_SUCCESS;
+ failure:
+	return (result);
+}
+
+/*
+ * Map the committed part of the journal file into memory.  The
+ * header has already been read, and the data it points to has been
+ * flushed to disk before the header was written, so the file is at
+ * least 'header.end.offset' bytes long.  Anything after that is
+ * uncommitted and deliberately left out of the mapping.
+ */
+#ifdef HAVE_MMAP
+static void
+journal_map(dns_journal_t *j) {
+	off_t filesize = 0;
+	size_t len;
+	void *base;
+	int flags = MAP_PRIVATE;
+
+	if (JOURNAL_EMPTY(&j->header))
+		return;
+
+	len = (size_t)j->header.end.offset;
+	if (isc_file_getsizefd(fileno(j->fp), &filesize) != ISC_R_SUCCESS ||
+	    (off_t)len > filesize)
+	{
+		return;
+	}
+
+#ifdef MAP_FILE
+	flags |= MAP_FILE;
+#endif
+	base = isc_file_mmap(NULL, len, PROT_READ, flags, fileno(j->fp), 0);
+	if (base == NULL || base == MAP_FAILED) {
+		isc_log_write(JOURNAL_DEBUG_LOGARGS(3),
+			      "%s: mmap failed, using stdio", j->filename);
+		return;
+	}
+
+	/*
+	 * From here on 'it.source' points into the mapping; release
+	 * anything journal_recover() may have allocated for it.
+	 */
+	if (j->it.source.base != NULL) {
+		isc_mem_put(j->mctx, j->it.source.base, j->it.source.length);
+		isc_buffer_init(&j->it.source, NULL, 0);
+	}
+
+	j->map = base;
+	j->maplen = len;
+}
+#endif /* HAVE_MMAP */
+
 static isc_result_t
 journal_open(isc_mem_t *mctx, const char *filename, bool writable,
 	     bool create, dns_journal_t **journalp)
@@ -565,9 +806,22 @@ journal_open(isc_mem_t *mctx, const char *filename, bool writable,
 	isc_mem_attach(mctx, &j->mctx);
 	j->state = JOURNAL_STATE_INVALID;
 	j->fp = NULL;
+	j->defersync = false;
+	j->map = NULL;
+	j->maplen = 0;
 	j->filename = isc_mem_strdup(mctx, filename);
 	j->index = NULL;
 	j->rawindex = NULL;
+	j->dfp = NULL;
+	j->dlen = 0;
+
+	/*
+	 * Set up empty initial buffers for unchecked and checked
+	 * wire format RR data.  They will be reallocated
+	 * later.
+	 */
+	isc_buffer_init(&j->it.source, NULL, 0);
+	isc_buffer_init(&j->it.target, NULL, 0);
 
 	if (j->filename == NULL)
 		FAIL(ISC_R_NOMEMORY);
@@ -644,6 +898,7 @@ journal_open(isc_mem_t *mctx, const char *filename, bool writable,
 		}
 		INSIST(p == j->rawindex + rawbytes);
 	}
+
 	j->offset = -1; /* Invalid, must seek explicitly. */
 
 	/*
@@ -652,14 +907,26 @@ journal_open(isc_mem_t *mctx, const char *filename, bool writable,
 	dns_name_init(&j->it.name, NULL);
 	dns_rdata_init(&j->it.rdata);
 
+	dns_decompress_init(&j->it.dctx, -1, DNS_DECOMPRESS_NONE);
+
 	/*
-	 * Set up empty initial buffers for unchecked and checked
-	 * wire format RR data.  They will be reallocated
-	 * later.
+	 * A pending sync left by this process only means the data is
+	 * still in the page cache; only one left by a process that
+	 * has since gone away can indicate a crash.
 	 */
-	isc_buffer_init(&j->it.source, NULL, 0);
-	isc_buffer_init(&j->it.target, NULL, 0);
-	dns_decompress_init(&j->it.dctx, -1, DNS_DECOMPRESS_NONE);
+	if (j->header.syncpending && j->header.writer != journal_instance())
+		CHECK(journal_recover(j, writable));
+
+#ifdef HAVE_MMAP
+	/*
+	 * Read-only journals are served from a memory mapping.
+	 * If that fails we quietly fall back to stdio.  Without
+	 * mmap() we always use stdio rather than reading the whole
+	 * journal into memory.
+	 */
+	if (!writable)
+		journal_map(j);
+#endif
 
 	j->state =
 		writable ? JOURNAL_STATE_WRITE : JOURNAL_STATE_READ;
@@ -675,8 +942,14 @@ journal_open(isc_mem_t *mctx, const char *filename, bool writable,
 	if (j->index != NULL)
 		isc_mem_put(j->mctx, j->index, j->header.index_size *
 			    sizeof(journal_pos_t));
+	if (j->it.target.base != NULL)
+		isc_mem_put(j->mctx, j->it.target.base, j->it.target.length);
+	if (j->it.source.base != NULL)
+		isc_mem_put(j->mctx, j->it.source.base, j->it.source.length);
 	if (j->filename != NULL)
 		isc_mem_free(j->mctx, j->filename);
+	if (j->map != NULL)
+		(void)isc_file_munmap(j->map, j->maplen);
 	if (j->fp != NULL)
 		(void)isc_stdio_close(j->fp);
 	isc_mem_putanddetach(&j->mctx, j, sizeof(*j));
@@ -709,6 +982,8 @@ dns_journal_open(isc_mem_t *mctx, const char *filename, unsigned int mode,
 		result = journal_open(mctx, backup, writable, writable,
 				      journalp);
 	}
+	if (result == ISC_R_SUCCESS && writable)
+		(*journalp)->defersync = (mode & DNS_JOURNAL_DEFERSYNC);
 	return (result);
 }
 
@@ -913,6 +1188,209 @@ index_invalidate(dns_journal_t *j, uint32_t serial) {
 	}
 }
 
+/*
+ * Dense index maintenance.  All failures are quietly ignored; the
+ * dense index is only used when it is consistent with the journal.
+ */
+static bool
+dindex_name(const char *filename, char *buf, size_t size) {
+	int n;
+
+	n = snprintf(buf, size, "%s.idx", filename);
+	return (n > 0 && (size_t)n < size);
+}
+
+static void
+dindex_remove(const char *filename) {
+	char name[PATH_MAX];
+
+	if (dindex_name(filename, name, sizeof(name)))
+		(void)isc_file_remove(name);
+}
+
+/*
+ * Open the dense index of 'j', creating it if 'writable'.
+ */
+static bool
+dindex_open(dns_journal_t *j, bool writable) {
+	char name[PATH_MAX];
+	isc_result_t result;
+	off_t size = 0;
+
+	if (j->dfp != NULL)
+		return (true);
+
+	if (!dindex_name(j->filename, name, sizeof(name)))
+		return (false);
+	result = isc_stdio_open(name, writable ? "rb+" : "rb", &j->dfp);
+	if (result == ISC_R_FILENOTFOUND && writable)
+		result = isc_stdio_open(name, "wb+", &j->dfp);
+	if (result != ISC_R_SUCCESS)
+		return (false);
+
+	if (isc_file_getsizefd(fileno(j->dfp), &size) != ISC_R_SUCCESS) {
+		(void)isc_stdio_close(j->dfp);
+		j->dfp = NULL;
+		return (false);
+	}
+	j->dlen = (uint32_t)(size / sizeof(journal_rawpos_t));
+	return (true);
+}
+
+static bool
+dindex_get(dns_journal_t *j, uint32_t i, journal_pos_t *pos) {
+	journal_rawpos_t raw;
+
+	if (isc_stdio_seek(j->dfp, (off_t)i * sizeof(raw),
+			   SEEK_SET) != ISC_R_SUCCESS ||
+	    isc_stdio_read(&raw, sizeof(raw), 1, j->dfp,
+			   NULL) != ISC_R_SUCCESS)
+	{
+		return (false);
+	}
+	journal_pos_decode(&raw, pos);
+	return (true);
+}
+
+static bool
+dindex_put(dns_journal_t *j, journal_pos_t *pos) {
+	journal_rawpos_t raw;
+
+	journal_pos_encode(&raw, pos);
+	if (isc_stdio_seek(j->dfp, (off_t)j->dlen * sizeof(raw),
+			   SEEK_SET) != ISC_R_SUCCESS ||
+	    isc_stdio_write(&raw, sizeof(raw), 1, j->dfp,
+			    NULL) != ISC_R_SUCCESS)
+	{
+		return (false);
+	}
+	j->dlen++;
+	return (true);
+}
+
+/*
+ * Check, without logging, that a transaction with initial serial
+ * 'pos->serial' starts at 'pos->offset' within the committed part
+ * of the journal, and store the position of the one after it in
+ * '*next'.
+ */
+static bool
+dindex_check(dns_journal_t *j, journal_pos_t *pos, journal_pos_t *next) {
+	journal_xhdr_t xhdr;
+
+	if (pos->offset < j->header.begin.offset ||
+	    pos->offset >= j->header.end.offset)
+		return (false);
+	if (journal_seek(j, pos->offset) != ISC_R_SUCCESS ||
+	    journal_read_xhdr(j, &xhdr) != ISC_R_SUCCESS ||
+	    xhdr.serial0 != pos->serial)
+		return (false);
+
+	next->serial = xhdr.serial1;
+	next->offset = pos->offset + sizeof(journal_rawxhdr_t) + xhdr.size;
+	return (true);
+}
+
+/*
+ * Rewrite the dense index of 'j' from scratch.
+ */
+static void
+dindex_rebuild(dns_journal_t *j) {
+	char name[PATH_MAX];
+	journal_pos_t pos;
+
+	if (j->dfp != NULL) {
+		(void)isc_stdio_close(j->dfp);
+		j->dfp = NULL;
+	}
+	j->dlen = 0;
+
+	if (!dindex_name(j->filename, name, sizeof(name)) ||
+	    isc_stdio_open(name, "wb+", &j->dfp) != ISC_R_SUCCESS)
+		return;
+
+	pos = j->header.begin;
+	while (pos.serial != j->header.end.serial) {
+		if (!dindex_put(j, &pos) ||
+		    journal_next(j, &pos) != ISC_R_SUCCESS)
+			break;
+	}
+	(void)isc_stdio_flush(j->dfp);
+}
+
+/*
+ * Record the transaction just committed to 'j' in its dense index.
+ * If the dense index does not cover every transaction before it,
+ * rebuild it.
+ */
+static void
+dindex_update(dns_journal_t *j) {
+	journal_pos_t first, last, next;
+	bool ok = false;
+
+	if (!dindex_open(j, true))
+		return;
+
+	if (j->dlen == 0) {
+		ok = (j->x.pos[0].offset == j->header.begin.offset);
+	} else if (dindex_get(j, 0, &first) &&
+		   first.serial == j->header.begin.serial &&
+		   first.offset == j->header.begin.offset &&
+		   dindex_get(j, j->dlen - 1, &last) &&
+		   dindex_check(j, &last, &next))
+	{
+		ok = (next.serial == j->x.pos[0].serial &&
+		      next.offset == j->x.pos[0].offset);
+	}
+
+	if (!ok) {
+		dindex_rebuild(j);
+		return;
+	}
+
+	if (dindex_put(j, &j->x.pos[0]))
+		(void)isc_stdio_flush(j->dfp);
+}
+
+/*
+ * If the dense index of 'j' has an entry "better" than '*best_guess'
+ * in the sense of index_find(), replace '*best_guess' with it.
+ */
+static void
+dindex_find(dns_journal_t *j, uint32_t serial, journal_pos_t *best_guess) {
+	journal_pos_t pos, next;
+	uint32_t lo, hi, mid;
+
+	if (!dindex_open(j, false) || j->dlen == 0)
+		return;
+	if (!dindex_get(j, 0, &pos) ||
+	    pos.serial != j->header.begin.serial ||
+	    pos.offset != j->header.begin.offset)
+		return;
+
+	/*
+	 * Entry 'lo' is at or before 'serial', entry 'hi' (if any)
+	 * is after it or beyond the committed end of the journal.
+	 */
+	lo = 0;
+	hi = j->dlen;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (!dindex_get(j, mid, &pos))
+			return;
+		if (pos.offset < j->header.end.offset &&
+		    DNS_SERIAL_GE(serial, pos.serial))
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	if (!dindex_get(j, lo, &pos) || !dindex_check(j, &pos, &next))
+		return;
+	if (DNS_SERIAL_GT(pos.serial, best_guess->serial))
+		*best_guess = pos;
+}
+
 /*
  * Try to find a transaction with initial serial number 'serial'
  * in the journal 'j'.
@@ -949,6 +1427,7 @@ journal_find(dns_journal_t *j, uint32_t serial, journal_pos_t *pos) {
 
 	current_pos = j->header.begin;
 	index_find(j, serial, &current_pos);
+	dindex_find(j, serial, &current_pos);
 
 	while (current_pos.serial != serial) {
 		if (DNS_SERIAL_GT(current_pos.serial, serial))
@@ -1109,6 +1588,7 @@ dns_journal_commit(dns_journal_t *j) {
 	 */
 	if (j->state == JOURNAL_STATE_INLINE) {
 		CHECK(journal_fsync(j));
+		j->header.syncpending = false;
 		journal_header_encode(&j->header, &rawheader);
 		CHECK(journal_seek(j, 0));
 		CHECK(journal_write(j, &rawheader, sizeof(rawheader)));
@@ -1177,9 +1657,22 @@ dns_journal_commit(dns_journal_t *j) {
 #endif
 
 	/*
-	 * Commit the transaction data to stable storage.
+	 * Commit the transaction data to stable storage, unless that
+	 * has been deferred to dns_journal_sync().  In the latter case
+	 * remember where the durable part of the journal ends, so that
+	 * a crash can be recovered from by discarding the rest.
 	 */
-	CHECK(journal_fsync(j));
+	if (j->defersync) {
+		CHECK(journal_flush(j));
+		if (!j->header.syncpending) {
+			j->header.synced = j->x.pos[0];
+			j->header.syncpending = true;
+			j->header.writer = journal_instance();
+		}
+	} else {
+		CHECK(journal_fsync(j));
+		j->header.syncpending = false;
+	}
 
 	if (j->state == JOURNAL_STATE_TRANSACTION) {
 		isc_offset_t offset;
@@ -1217,7 +1710,12 @@ dns_journal_commit(dns_journal_t *j) {
 	/*
 	 * Commit the header to stable storage.
 	 */
-	CHECK(journal_fsync(j));
+	if (j->defersync)
+		CHECK(journal_flush(j));
+	else
+		CHECK(journal_fsync(j));
+
+	dindex_update(j);
 
 	/*
 	 * We no longer have a transaction open.
@@ -1242,6 +1740,33 @@ dns_journal_write_transaction(dns_journal_t *j, dns_diff_t *diff) {
 	return (result);
 }
 
+isc_result_t
+dns_journal_sync(dns_journal_t *j) {
+	isc_result_t result;
+	journal_rawheader_t rawheader;
+
+	REQUIRE(DNS_JOURNAL_VALID(j));
+	REQUIRE(j->state == JOURNAL_STATE_WRITE);
+
+	if (!j->header.syncpending)
+		return (ISC_R_SUCCESS);
+
+	/*
+	 * Same two-step protocol as dns_journal_commit(): the data
+	 * must be durable before the header that declares it so.
+	 */
+	CHECK(journal_fsync(j));
+	j->header.syncpending = false;
+	journal_header_encode(&j->header, &rawheader);
+	CHECK(journal_seek(j, 0));
+	CHECK(journal_write(j, &rawheader, sizeof(rawheader)));
+	CHECK(journal_fsync(j));
+
+	result = ISC_R_SUCCESS;
+ failure:
+	return (result);
+}
+
 void
 dns_journal_destroy(dns_journal_t **journalp) {
 	dns_journal_t *j = *journalp;
@@ -1258,10 +1783,14 @@ dns_journal_destroy(dns_journal_t **journalp) {
 			    sizeof(journal_pos_t));
 	if (j->it.target.base != NULL)
 		isc_mem_put(j->mctx, j->it.target.base, j->it.target.length);
-	if (j->it.source.base != NULL)
+	if (j->it.source.base != NULL && j->map == NULL)
 		isc_mem_put(j->mctx, j->it.source.base, j->it.source.length);
 	if (j->filename != NULL)
 		isc_mem_free(j->mctx, j->filename);
+	if (j->map != NULL)
+		(void)isc_file_munmap(j->map, j->maplen);
+	if (j->dfp != NULL)
+		(void)isc_stdio_close(j->dfp);
 	if (j->fp != NULL)
 		(void)isc_stdio_close(j->fp);
 	j->magic = 0;
@@ -1726,8 +2255,19 @@ read_one_rr(dns_journal_t *j) {
 		FAIL(ISC_R_UNEXPECTED);
 	}
 
-	CHECK(size_buffer(j->mctx, &j->it.source, rrhdr.size));
-	CHECK(journal_read(j, j->it.source.base, rrhdr.size));
+	if (j->map != NULL) {
+		/*
+		 * Parse the RR in place; 'source' never owns memory
+		 * when the journal is mapped.
+		 */
+		if (rrhdr.size > j->maplen - (size_t)j->offset)
+			FAIL(ISC_R_NOMORE);
+		isc_buffer_init(&j->it.source, j->map + j->offset, rrhdr.size);
+		j->offset += rrhdr.size;
+	} else {
+		CHECK(size_buffer(j->mctx, &j->it.source, rrhdr.size));
+		CHECK(journal_read(j, j->it.source.base, rrhdr.size));
+	}
 	isc_buffer_add(&j->it.source, rrhdr.size);
 
 	/*
@@ -2122,6 +2662,8 @@ dns_journal_compact(isc_mem_t *mctx, char *filename, uint32_t serial,
 	unsigned int indexend;
 	char newname[PATH_MAX];
 	char backup[PATH_MAX];
+	char newidx[PATH_MAX];
+	char idx[PATH_MAX];
 	bool is_backup = false;
 
 	REQUIRE(filename != NULL);
@@ -2279,6 +2821,7 @@ dns_journal_compact(isc_mem_t *mctx, char *filename, uint32_t serial,
 		 */
 		CHECK(index_to_disk(j2));
 		CHECK(journal_fsync(j2));
+		dindex_rebuild(j2);
 
 		indexend = j2->header.end.offset;
 		POST(indexend);
@@ -2320,10 +2863,23 @@ dns_journal_compact(isc_mem_t *mctx, char *filename, uint32_t serial,
 		}
 	}
 
+	/*
+	 * Move the dense index along with the journal.  If that
+	 * fails, the dense index of the old journal no longer
+	 * matches and is removed; the next commit rebuilds it.
+	 */
+	if (!dindex_name(newname, newidx, sizeof(newidx)) ||
+	    !dindex_name(filename, idx, sizeof(idx)) ||
+	    isc_file_rename(newidx, idx) != ISC_R_SUCCESS)
+	{
+		dindex_remove(filename);
+	}
+
 	result = ISC_R_SUCCESS;
 
  failure:
 	(void)isc_file_remove(newname);
+	dindex_remove(newname);
 	if (buf != NULL)
 		isc_mem_put(mctx, buf, size);
 	if (j1 != NULL)
@@ -86,8 +86,8 @@ start_fetch(dns_lookup_t *lookup) {
 	result = dns_resolver_createfetch(lookup->view->resolver,
 					  dns_fixedname_name(&lookup->name),
 					  lookup->type,
-					  NULL, NULL, NULL, NULL, 0, 0, 0,
-					  NULL,
+					  NULL, NULL, NULL, NULL, 0, NULL,
+					  0, 0, NULL,
 					  lookup->task, fetch_done, lookup,
 					  &lookup->rdataset,
 					  &lookup->sigrdataset,
@@ -14,12 +14,14 @@
 #include <config.h>
 
 #include <inttypes.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 
 #include <isc/buffer.h>
 #include <isc/event.h>
 #include <isc/file.h>
+#include <isc/formatcheck.h>
 #include <isc/magic.h>
 #include <isc/mem.h>
 #include <isc/print.h>
@@ -243,7 +245,7 @@ struct dns_dumpctx {
 					    const dns_name_t *name,
 					    dns_rdatasetiter_t *rdsiter,
 					    dns_totext_ctx_t *ctx,
-					    isc_buffer_t *buffer, FILE *f);
+					    isc_buffer_t *buffer);
 };
 
 #define NXDOMAIN(x) (((x)->attributes & DNS_RDATASETATTR_NXDOMAIN) != 0)
@@ -853,18 +855,105 @@ dns_master_questiontotext(const dns_name_t *owner_name,
 }
 
 /*
- * Print an rdataset.  'buffer' is a scratch buffer, which must have been
- * dynamically allocated by the caller.  It must be large enough to
- * hold the result from dns_ttl_totext().  If more than that is needed,
- * the buffer will be grown automatically.
+ * Dump output is accumulated in a buffer allocated by the caller and
+ * written to the master file in large blocks by dump_flush(), rather
+ * than with a stdio call for every RRset and directive.
+ */
+
+/*
+ * Make sure there are at least 'length' bytes available in 'buffer',
+ * growing it (and keeping its contents) if necessary.
+ */
+static isc_result_t
+dump_reserve(isc_mem_t *mctx, isc_buffer_t *buffer, unsigned int length) {
+	unsigned int used = isc_buffer_usedlength(buffer);
+	unsigned int newlength;
+	void *newmem;
+
+	if (isc_buffer_availablelength(buffer) >= length)
+		return (ISC_R_SUCCESS);
+
+	newlength = buffer->length * 2;
+	while (newlength - used < length)
+		newlength *= 2;
+	newmem = isc_mem_get(mctx, newlength);
+	if (newmem == NULL)
+		return (ISC_R_NOMEMORY);
+	if (used != 0)
+		memmove(newmem, buffer->base, used);
+	isc_mem_put(mctx, buffer->base, buffer->length);
+	isc_buffer_init(buffer, newmem, newlength);
+	isc_buffer_add(buffer, used);
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Append printf-style text to 'buffer', growing it if necessary.
+ */
+static isc_result_t
+dump_printf(isc_mem_t *mctx, isc_buffer_t *buffer, const char *format, ...)
+     ISC_FORMAT_PRINTF(3, 4);
+
+static isc_result_t
+dump_printf(isc_mem_t *mctx, isc_buffer_t *buffer, const char *format, ...) {
+	isc_result_t result;
+	va_list ap;
+	int n;
+
+	for (;;) {
+		va_start(ap, format);
+		n = vsnprintf(isc_buffer_used(buffer),
+			      isc_buffer_availablelength(buffer), format, ap);
+		va_end(ap);
+		if (n < 0)
+			return (ISC_R_FAILURE);
+		if ((unsigned int)n < isc_buffer_availablelength(buffer))
+			break;
+		result = dump_reserve(mctx, buffer, n + 1);
+		if (result != ISC_R_SUCCESS)
+			return (result);
+	}
+	isc_buffer_add(buffer, n);
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Write the contents of 'buffer' to 'f' and empty it.
+ */
+static isc_result_t
+dump_flush(isc_buffer_t *buffer, FILE *f) {
+	isc_region_t r;
+	isc_result_t result;
+
+	isc_buffer_usedregion(buffer, &r);
+	isc_buffer_clear(buffer);
+	if (r.length == 0)
+		return (ISC_R_SUCCESS);
+
+	result = isc_stdio_write(r.base, 1, (size_t)r.length, f, NULL);
+	if (result != ISC_R_SUCCESS) {
+		UNEXPECTED_ERROR(__FILE__, __LINE__,
+				 "master file write failed: %s",
+				 isc_result_totext(result));
+	}
+
+	return (result);
+}
+
+/*
+ * Print an rdataset, appending it to 'buffer', which must have been
+ * dynamically allocated by the caller.  The buffer will be grown
+ * automatically if needed.
  */
 
 static isc_result_t
 dump_rdataset(isc_mem_t *mctx, const dns_name_t *name,
 	      dns_rdataset_t *rdataset, dns_totext_ctx_t *ctx,
-	      isc_buffer_t *buffer, FILE *f)
+	      isc_buffer_t *buffer)
 {
-	isc_region_t r;
+	unsigned int used;
 	isc_result_t result;
 
 	REQUIRE(buffer->length > 0);
@@ -879,60 +968,47 @@ dump_rdataset(isc_mem_t *mctx, const dns_name_t *name,
 		{
 			if ((ctx->style.flags & DNS_STYLEFLAG_COMMENT) != 0)
 			{
-				isc_buffer_clear(buffer);
+				/*
+				 * Leave room for the longest possible
+				 * dns_ttl_totext() output.
+				 */
+				RETERR(dump_printf(mctx, buffer,
+						   "$TTL %u\t; ",
+						   rdataset->ttl));
+				RETERR(dump_reserve(mctx, buffer, 100));
 				result = dns_ttl_totext(rdataset->ttl,
 							true, true,
 							buffer);
 				INSIST(result == ISC_R_SUCCESS);
-				isc_buffer_usedregion(buffer, &r);
-				fprintf(f, "$TTL %u\t; %.*s\n", rdataset->ttl,
-					(int) r.length, (char *) r.base);
+				RETERR(dump_printf(mctx, buffer, "\n"));
 			} else {
-				fprintf(f, "$TTL %u\n", rdataset->ttl);
+				RETERR(dump_printf(mctx, buffer, "$TTL %u\n",
+						   rdataset->ttl));
 			}
 			ctx->current_ttl = rdataset->ttl;
 			ctx->current_ttl_valid = true;
 		}
 	}
 
-	isc_buffer_clear(buffer);
-
 	/*
 	 * Generate the text representation of the rdataset into
-	 * the buffer.  If the buffer is too small, grow it.
+	 * the buffer.  If the buffer is too small, discard the
+	 * partial output, grow it, and try again.
 	 */
+	used = isc_buffer_usedlength(buffer);
 	for (;;) {
-		int newlength;
-		void *newmem;
 		result = rdataset_totext(rdataset, name, ctx,
 					 false, buffer);
 		if (result != ISC_R_NOSPACE)
 			break;
 
-		newlength = buffer->length * 2;
-		newmem = isc_mem_get(mctx, newlength);
-		if (newmem == NULL)
-			return (ISC_R_NOMEMORY);
-		isc_mem_put(mctx, buffer->base, buffer->length);
-		isc_buffer_init(buffer, newmem, newlength);
-	}
-	if (result != ISC_R_SUCCESS)
-		return (result);
-
-	/*
-	 * Write the buffer contents to the master file.
-	 */
-	isc_buffer_usedregion(buffer, &r);
-	result = isc_stdio_write(r.base, 1, (size_t)r.length, f, NULL);
-
-	if (result != ISC_R_SUCCESS) {
-		UNEXPECTED_ERROR(__FILE__, __LINE__,
-				 "master file write failed: %s",
-				 isc_result_totext(result));
-		return (result);
+		isc_buffer_subtract(buffer,
+				    isc_buffer_usedlength(buffer) - used);
+		RETERR(dump_reserve(mctx, buffer,
+				    isc_buffer_length(buffer)));
 	}
 
-	return (ISC_R_SUCCESS);
+	return (result);
 }
 
 /*
@@ -990,10 +1066,9 @@ dump_order_compare(const void *a, const void *b) {
 static isc_result_t
 dump_rdatasets_text(isc_mem_t *mctx, const dns_name_t *name,
 		    dns_rdatasetiter_t *rdsiter, dns_totext_ctx_t *ctx,
-		    isc_buffer_t *buffer, FILE *f)
+		    isc_buffer_t *buffer)
 {
 	isc_result_t itresult, dumpresult;
-	isc_region_t r;
 	dns_rdataset_t rdatasets[MAXSORT];
 	dns_rdataset_t *sorted[MAXSORT];
 	int i, n;
@@ -1002,11 +1077,11 @@ dump_rdatasets_text(isc_mem_t *mctx, const dns_name_t *name,
 	dumpresult = ISC_R_SUCCESS;
 
 	if (itresult == ISC_R_SUCCESS && ctx->neworigin != NULL) {
-		isc_buffer_clear(buffer);
+		RETERR(dump_printf(mctx, buffer, "$ORIGIN "));
+		RETERR(dump_reserve(mctx, buffer, DNS_NAME_MAXTEXT + 1));
 		itresult = dns_name_totext(ctx->neworigin, false, buffer);
 		RUNTIME_CHECK(itresult == ISC_R_SUCCESS);
-		isc_buffer_usedregion(buffer, &r);
-		fprintf(f, "$ORIGIN %.*s\n", (int) r.length, (char *) r.base);
+		RETERR(dump_printf(mctx, buffer, "\n"));
 		ctx->neworigin = NULL;
 	}
 
@@ -1025,30 +1100,42 @@ dump_rdatasets_text(isc_mem_t *mctx, const dns_name_t *name,
 
 	for (i = 0; i < n; i++) {
 		dns_rdataset_t *rds = sorted[i];
+		isc_result_t result = ISC_R_SUCCESS;
+
 		if (ctx->style.flags & DNS_STYLEFLAG_TRUST) {
 			if ((ctx->style.flags & DNS_STYLEFLAG_INDENT) != 0 ||
 			    (ctx->style.flags & DNS_STYLEFLAG_YAML) != 0)
 			{
 				unsigned int j;
-				for (j = 0; j < dns_master_indent; j++)
-					fprintf(f, "%s", dns_master_indentstr);
+				for (j = 0;
+				     result == ISC_R_SUCCESS &&
+				     j < dns_master_indent;
+				     j++)
+				{
+					result = dump_printf(mctx, buffer,
+						"%s", dns_master_indentstr);
+				}
 			}
-			fprintf(f, "; %s\n", dns_trust_totext(rds->trust));
+			if (result == ISC_R_SUCCESS)
+				result = dump_printf(mctx, buffer, "; %s\n",
+					dns_trust_totext(rds->trust));
 		}
 		if (((rds->attributes & DNS_RDATASETATTR_NEGATIVE) != 0) &&
 		    (ctx->style.flags & DNS_STYLEFLAG_NCACHE) == 0) {
 			/* Omit negative cache entries */
 		} else {
-			isc_result_t result;
-			if (rds->ttl < ctx->serve_stale_ttl)
-				fprintf(f, "; stale\n");
-			result = dump_rdataset(mctx, name, rds, ctx, buffer, f);
-			if (result != ISC_R_SUCCESS)
-				dumpresult = result;
+			if (result == ISC_R_SUCCESS &&
+			    rds->ttl < ctx->serve_stale_ttl)
+				result = dump_printf(mctx, buffer,
+						     "; stale\n");
+			if (result == ISC_R_SUCCESS)
+				result = dump_rdataset(mctx, name, rds, ctx,
+						       buffer);
 			if ((ctx->style.flags & DNS_STYLEFLAG_OMIT_OWNER) != 0)
 				name = NULL;
 		}
-		if (ctx->style.flags & DNS_STYLEFLAG_RESIGN &&
+		if (result == ISC_R_SUCCESS &&
+		    ctx->style.flags & DNS_STYLEFLAG_RESIGN &&
 		    rds->attributes & DNS_RDATASETATTR_RESIGN) {
 			isc_buffer_t b;
 			char buf[sizeof("YYYYMMDDHHMMSS")];
@@ -1059,11 +1146,21 @@ dump_rdatasets_text(isc_mem_t *mctx, const dns_name_t *name,
 			    (ctx->style.flags & DNS_STYLEFLAG_YAML) != 0)
 			{
 				unsigned int j;
-				for (j = 0; j < dns_master_indent; j++)
-					fprintf(f, "%s", dns_master_indentstr);
+				for (j = 0;
+				     result == ISC_R_SUCCESS &&
+				     j < dns_master_indent;
+				     j++)
+				{
+					result = dump_printf(mctx, buffer,
+						"%s", dns_master_indentstr);
+				}
 			}
-			fprintf(f, "; resign=%s\n", buf);
+			if (result == ISC_R_SUCCESS)
+				result = dump_printf(mctx, buffer,
+						     "; resign=%s\n", buf);
 		}
+		if (result != ISC_R_SUCCESS)
+			dumpresult = result;
 		dns_rdataset_disassociate(rds);
 	}
 
@@ -1084,47 +1181,42 @@ dump_rdatasets_text(isc_mem_t *mctx, const dns_name_t *name,
 }
 
 /*
- * Dump given RRsets in the "raw" format.
+ * Dump given RRsets in the "raw" format, appending them to 'buffer'.
  */
 static isc_result_t
 dump_rdataset_raw(isc_mem_t *mctx, const dns_name_t *name,
-		  dns_rdataset_t *rdataset, isc_buffer_t *buffer, FILE *f)
+		  dns_rdataset_t *rdataset, isc_buffer_t *buffer)
 {
 	isc_result_t result;
 	uint32_t totallen;
 	uint16_t dlen;
-	isc_region_t r, r_hdr;
+	isc_region_t r;
+	isc_buffer_t lenbuf;
+	unsigned int start;
 
 	REQUIRE(buffer->length > 0);
 	REQUIRE(DNS_RDATASET_VALID(rdataset));
 
 	rdataset->attributes |= DNS_RDATASETATTR_LOADORDER;
- restart:
-	totallen = 0;
 	result = dns_rdataset_first(rdataset);
 	REQUIRE(result == ISC_R_SUCCESS);
 
-	isc_buffer_clear(buffer);
-
 	/*
 	 * Common header and owner name (length followed by name)
-	 * These fields should be in a moderate length, so we assume we
-	 * can store all of them in the initial buffer.
 	 */
-	isc_buffer_availableregion(buffer, &r_hdr);
-	INSIST(r_hdr.length >= sizeof(dns_masterrawrdataset_t));
-	isc_buffer_putuint32(buffer, totallen);	/* XXX: leave space */
+	dns_name_toregion(name, &r);
+	RETERR(dump_reserve(mctx, buffer, sizeof(dns_masterrawrdataset_t) +
+			    sizeof(dlen) + r.length));
+	start = isc_buffer_usedlength(buffer);
+	isc_buffer_putuint32(buffer, 0);	/* total length, filled in below */
 	isc_buffer_putuint16(buffer, rdataset->rdclass); /* 16-bit class */
 	isc_buffer_putuint16(buffer, rdataset->type); /* 16-bit type */
 	isc_buffer_putuint16(buffer, rdataset->covers);	/* same as type */
 	isc_buffer_putuint32(buffer, rdataset->ttl); /* 32-bit TTL */
 	isc_buffer_putuint32(buffer, dns_rdataset_count(rdataset));
-	totallen = isc_buffer_usedlength(buffer);
+	totallen = isc_buffer_usedlength(buffer) - start;
 	INSIST(totallen <= sizeof(dns_masterrawrdataset_t));
 
-	dns_name_toregion(name, &r);
-	INSIST(isc_buffer_availablelength(buffer) >=
-	       (sizeof(dlen) + r.length));
 	dlen = (uint16_t)r.length;
 	isc_buffer_putuint16(buffer, dlen);
 	isc_buffer_copyregion(buffer, &r);
@@ -1139,24 +1231,9 @@ dump_rdataset_raw(isc_mem_t *mctx, const dns_name_t *name,
 		dlen = (uint16_t)r.length;
 
 		/*
-		 * Copy the rdata into the buffer.  If the buffer is too small,
-		 * grow it.  This should be rare, so we'll simply restart the
-		 * entire procedure (or should we copy the old data and
-		 * continue?).
+		 * Copy the rdata into the buffer, growing it if necessary.
 		 */
-		if (isc_buffer_availablelength(buffer) <
-						 sizeof(dlen) + r.length) {
-			int newlength;
-			void *newmem;
-
-			newlength = buffer->length * 2;
-			newmem = isc_mem_get(mctx, newlength);
-			if (newmem == NULL)
-				return (ISC_R_NOMEMORY);
-			isc_mem_put(mctx, buffer->base, buffer->length);
-			isc_buffer_init(buffer, newmem, newlength);
-			goto restart;
-		}
+		RETERR(dump_reserve(mctx, buffer, sizeof(dlen) + r.length));
 		isc_buffer_putuint16(buffer, dlen);
 		isc_buffer_copyregion(buffer, &r);
 		totallen += sizeof(dlen) + r.length;
@@ -1169,34 +1246,18 @@ dump_rdataset_raw(isc_mem_t *mctx, const dns_name_t *name,
 
 	/*
 	 * Fill in the total length field.
-	 * XXX: this is a bit tricky.  Since we have already "used" the space
-	 * for the total length in the buffer, we first remember the entire
-	 * buffer length in the region, "rewind", and then write the value.
 	 */
-	isc_buffer_usedregion(buffer, &r);
-	isc_buffer_clear(buffer);
-	isc_buffer_putuint32(buffer, totallen);
-	INSIST(isc_buffer_usedlength(buffer) < totallen);
+	isc_buffer_init(&lenbuf, (unsigned char *)buffer->base + start,
+			sizeof(totallen));
+	isc_buffer_putuint32(&lenbuf, totallen);
 
-	/*
-	 * Write the buffer contents to the raw master file.
-	 */
-	result = isc_stdio_write(r.base, 1, (size_t)r.length, f, NULL);
-
-	if (result != ISC_R_SUCCESS) {
-		UNEXPECTED_ERROR(__FILE__, __LINE__,
-				 "raw master file write failed: %s",
-				 isc_result_totext(result));
-		return (result);
-	}
-
-	return (result);
+	return (ISC_R_SUCCESS);
 }
 
 static isc_result_t
 dump_rdatasets_raw(isc_mem_t *mctx, const dns_name_t *name,
 		   dns_rdatasetiter_t *rdsiter, dns_totext_ctx_t *ctx,
-		   isc_buffer_t *buffer, FILE *f)
+		   isc_buffer_t *buffer)
 {
 	isc_result_t result;
 	dns_rdataset_t rdataset;
@@ -1213,7 +1274,7 @@ dump_rdatasets_raw(isc_mem_t *mctx, const dns_name_t *name,
 			/* Omit negative cache entries */
 		} else {
 			result = dump_rdataset_raw(mctx, name, &rdataset,
-						   buffer, f);
+						   buffer);
 		}
 		dns_rdataset_disassociate(&rdataset);
 		if (result != ISC_R_SUCCESS)
@@ -1229,14 +1290,13 @@ dump_rdatasets_raw(isc_mem_t *mctx, const dns_name_t *name,
 static isc_result_t
 dump_rdatasets_map(isc_mem_t *mctx, const dns_name_t *name,
 		   dns_rdatasetiter_t *rdsiter, dns_totext_ctx_t *ctx,
-		   isc_buffer_t *buffer, FILE *f)
+		   isc_buffer_t *buffer)
 {
 	UNUSED(mctx);
 	UNUSED(name);
 	UNUSED(rdsiter);
 	UNUSED(ctx);
 	UNUSED(buffer);
-	UNUSED(f);
 
 	return (ISC_R_NOTIMPLEMENTED);
 }
@@ -1246,13 +1306,18 @@ dump_rdatasets_map(isc_mem_t *mctx, const dns_name_t *name,
  * for several purposes: converting origin names, rdatasets,
  * $DATE timestamps, and comment strings for $TTL directives.
  *
- * When converting rdatasets, it is dynamically resized, but
- * when converting origins, timestamps, etc it is not.  Therefore,
- * the initial size must large enough to hold the longest possible
- * text representation of any domain name (for $ORIGIN).
+ * It is dynamically resized as needed.
  */
 static const int initial_buffer_length = 1200;
 
+/*
+ * Size of the output buffer used when dumping a whole database, and
+ * the amount of output that is accumulated in it before it is written
+ * to the master file.
+ */
+static const int dump_buffer_length = 128 * 1024;
+static const unsigned int dump_flush_length = 64 * 1024;
+
 static isc_result_t
 dumptostreaminc(dns_dumpctx_t *dctx);
 
@@ -1644,11 +1709,11 @@ dumptostreaminc(dns_dumpctx_t *dctx) {
 	unsigned int nodes;
 	isc_time_t start;
 
-	bufmem = isc_mem_get(dctx->mctx, initial_buffer_length);
+	bufmem = isc_mem_get(dctx->mctx, dump_buffer_length);
 	if (bufmem == NULL)
 		return (ISC_R_NOMEMORY);
 
-	isc_buffer_init(&buffer, bufmem, initial_buffer_length);
+	isc_buffer_init(&buffer, bufmem, dump_buffer_length);
 
 	name = dns_fixedname_initname(&fixname);
 
@@ -1701,13 +1766,15 @@ dumptostreaminc(dns_dumpctx_t *dctx) {
 			goto cleanup;
 		}
 		result = (dctx->dumpsets)(dctx->mctx, name, rdsiter,
-					  &dctx->tctx, &buffer, dctx->f);
+					  &dctx->tctx, &buffer);
 		dns_rdatasetiter_destroy(&rdsiter);
 		if (result != ISC_R_SUCCESS) {
 			dns_db_detachnode(dctx->db, &node);
 			goto cleanup;
 		}
 		dns_db_detachnode(dctx->db, &node);
+		if (isc_buffer_usedlength(&buffer) >= dump_flush_length)
+			CHECK(dump_flush(&buffer, dctx->f));
 		result = dns_dbiterator_next(dctx->dbiter);
 	}
 
@@ -1756,6 +1823,11 @@ dumptostreaminc(dns_dumpctx_t *dctx) {
 		result = ISC_R_SUCCESS;
  cleanup:
 	RUNTIME_CHECK(dns_dbiterator_pause(dctx->dbiter) == ISC_R_SUCCESS);
+	if (result == ISC_R_SUCCESS || result == DNS_R_CONTINUE) {
+		isc_result_t tresult = dump_flush(&buffer, dctx->f);
+		if (tresult != ISC_R_SUCCESS)
+			result = tresult;
+	}
 	isc_mem_put(dctx->mctx, buffer.base, buffer.length);
 	return (result);
 }
@@ -1974,10 +2046,13 @@ dns_master_dumpnodetostream(isc_mem_t *mctx, dns_db_t *db,
 	result = dns_db_allrdatasets(db, node, version, now, &rdsiter);
 	if (result != ISC_R_SUCCESS)
 		goto failure;
-	result = dump_rdatasets_text(mctx, name, rdsiter, &ctx, &buffer, f);
+	result = dump_rdatasets_text(mctx, name, rdsiter, &ctx, &buffer);
+	dns_rdatasetiter_destroy(&rdsiter);
+	if (result != ISC_R_SUCCESS)
+		goto failure;
+	result = dump_flush(&buffer, f);
 	if (result != ISC_R_SUCCESS)
 		goto failure;
-	dns_rdatasetiter_destroy(&rdsiter);
 
 	result = ISC_R_SUCCESS;
 
@@ -108,6 +108,21 @@ hexdump(const char *msg, const char *msg2, void *base, size_t len) {
 #define RDATALIST_COUNT		  8
 #define RDATASET_COUNT	         64
 
+/*%
+ * Parse-time arena sizing.  ARENA_SIZE is the smallest chunk allocated;
+ * ARENA_MAXHINT caps the size remembered across resets (and the size
+ * guessed from a packet), so that one unusual message does not pin a
+ * large chunk to a long-lived message.
+ */
+#define ARENA_SIZE		2048
+#define ARENA_MAXHINT		16384
+#define ARENA_ALIGN(x)		(((x) + 7U) & ~7U)
+#define ARENA_PERRR		(ARENA_ALIGN(sizeof(dns_name_t)) + \
+				 ARENA_ALIGN(sizeof(dns_offsets_t)) + \
+				 ARENA_ALIGN(sizeof(dns_rdataset_t)) + \
+				 ARENA_ALIGN(sizeof(dns_rdatalist_t)) + \
+				 ARENA_ALIGN(sizeof(dns_rdata_t)))
+
 /*%
  * Text representation of the different items, for message_totext
  * functions.
@@ -156,6 +171,20 @@ struct dns_msgblock {
 	ISC_LINK(dns_msgblock_t)	link;
 }; /* dynamically sized */
 
+/*
+ * A chunk of the parse-time arena.  Objects are carved out of the tail
+ * chunk from the front; the whole arena is released at once when the
+ * message is reset.
+ */
+struct dns_msgarena {
+	unsigned int			size;
+	unsigned int			used;
+	ISC_LINK(dns_msgarena_t)	link;
+}; /* dynamically sized */
+
+#define ARENA_BASE(a) \
+	((unsigned char *)(a) + ARENA_ALIGN(sizeof(dns_msgarena_t)))
+
 static inline dns_msgblock_t *
 msgblock_allocate(isc_mem_t *, unsigned int, unsigned int);
 
@@ -240,6 +269,185 @@ msgblock_free(isc_mem_t *mctx, dns_msgblock_t *block, unsigned int sizeof_type)
 	isc_mem_put(mctx, block, length);
 }
 
+/*
+ * Make sure the tail chunk of the arena has at least 'size' octets
+ * free, allocating a new chunk if it does not, and return a pointer to
+ * the free space.  '*availp' is set to the amount of free space.  Nothing
+ * is consumed until arena_commit() is called.
+ */
+static unsigned char *
+arena_reserve(dns_message_t *msg, unsigned int size, unsigned int *availp) {
+	dns_msgarena_t *arena;
+	unsigned int chunk;
+
+	size = ARENA_ALIGN(size);
+
+	arena = ISC_LIST_TAIL(msg->arena);
+	if (arena == NULL || arena->size - arena->used < size) {
+		chunk = ARENA_SIZE;
+		if (arena != NULL && chunk < arena->size * 2)
+			chunk = arena->size * 2;
+		if (chunk < size)
+			chunk = size;
+
+		arena = isc_mem_get(msg->mctx,
+				    ARENA_ALIGN(sizeof(*arena)) + chunk);
+		if (arena == NULL)
+			return (NULL);
+		arena->size = chunk;
+		arena->used = 0;
+		ISC_LINK_INIT(arena, link);
+		ISC_LIST_APPEND(msg->arena, arena, link);
+	}
+
+	*availp = arena->size - arena->used;
+	return (ARENA_BASE(arena) + arena->used);
+}
+
+/*
+ * Consume 'size' octets of the space returned by arena_reserve().
+ */
+static inline void
+arena_commit(dns_message_t *msg, unsigned int size) {
+	dns_msgarena_t *arena;
+
+	arena = ISC_LIST_TAIL(msg->arena);
+	INSIST(arena != NULL);
+	arena->used += ARENA_ALIGN(size);
+	INSIST(arena->used <= arena->size);
+}
+
+static inline void *
+arena_get(dns_message_t *msg, unsigned int size) {
+	unsigned char *ptr;
+	unsigned int avail;
+
+	ptr = arena_reserve(msg, size, &avail);
+	if (ptr != NULL)
+		arena_commit(msg, size);
+	return (ptr);
+}
+
+/*
+ * Return true if 'ptr' was carved out of the arena of 'msg'.
+ */
+static inline bool
+arena_owns(dns_message_t *msg, void *ptr) {
+	dns_msgarena_t *arena;
+	unsigned char *p = ptr;
+
+	for (arena = ISC_LIST_HEAD(msg->arena);
+	     arena != NULL;
+	     arena = ISC_LIST_NEXT(arena, link))
+	{
+		if (p >= ARENA_BASE(arena) &&
+		    p < ARENA_BASE(arena) + arena->size)
+		{
+			return (true);
+		}
+	}
+	return (false);
+}
+
+/*
+ * Size the arena for a message of 'length' octets containing 'count'
+ * records before parsing it, so that the common case is served by a
+ * single chunk.
+ */
+static void
+arena_prepare(dns_message_t *msg, unsigned int length, unsigned int count) {
+	dns_msgarena_t *arena;
+	unsigned int size, avail;
+
+	/*
+	 * Every question needs at least 5 octets and every record at
+	 * least 11, so don't trust the header counts beyond that.
+	 */
+	if (count > length / 5)
+		count = length / 5;
+	size = count * ARENA_PERRR + 2 * length;
+	if (size > ARENA_MAXHINT)
+		size = ARENA_MAXHINT;
+	if (size < msg->arena_hint)
+		size = msg->arena_hint;
+
+	arena = ISC_LIST_HEAD(msg->arena);
+	if (arena != NULL) {
+		if (arena->used != 0 || arena->size >= size ||
+		    ISC_LIST_NEXT(arena, link) != NULL)
+		{
+			return;
+		}
+		ISC_LIST_UNLINK(msg->arena, arena, link);
+		isc_mem_put(msg->mctx, arena,
+			    ARENA_ALIGN(sizeof(*arena)) + arena->size);
+	}
+
+	/*
+	 * If this fails the arena will be grown on demand instead.
+	 */
+	(void)arena_reserve(msg, size, &avail);
+}
+
+/*
+ * Release the arena.  Unless 'everything' is set, a single chunk is
+ * kept for the next message; if the last message outgrew it, all chunks
+ * are freed and the total used is remembered so that arena_prepare()
+ * allocates one chunk big enough next time.
+ */
+static void
+arena_reset(dns_message_t *msg, bool everything) {
+	dns_msgarena_t *arena, *next;
+	unsigned int used = 0;
+
+	arena = ISC_LIST_HEAD(msg->arena);
+	if (arena == NULL)
+		return;
+
+	if (!everything && ISC_LIST_NEXT(arena, link) == NULL) {
+		arena->used = 0;
+		return;
+	}
+
+	while (arena != NULL) {
+		next = ISC_LIST_NEXT(arena, link);
+		used += arena->used;
+		ISC_LIST_UNLINK(msg->arena, arena, link);
+		isc_mem_put(msg->mctx, arena,
+			    ARENA_ALIGN(sizeof(*arena)) + arena->size);
+		arena = next;
+	}
+
+	if (!everything)
+		msg->arena_hint = ISC_MIN(used, ARENA_MAXHINT);
+}
+
+static inline dns_name_t *
+newname(dns_message_t *msg) {
+	if (msg->use_arena)
+		return (arena_get(msg, sizeof(dns_name_t)));
+	return (isc_mempool_get(msg->namepool));
+}
+
+static inline void
+releasename(dns_message_t *msg, dns_name_t *name) {
+	if (!arena_owns(msg, name))
+		isc_mempool_put(msg->namepool, name);
+}
+
+static inline dns_rdataset_t *
+newrdataset(dns_message_t *msg) {
+	if (msg->use_arena)
+		return (arena_get(msg, sizeof(dns_rdataset_t)));
+	return (isc_mempool_get(msg->rdspool));
+}
+
+static inline void
+releaserdataset(dns_message_t *msg, dns_rdataset_t *rdataset) {
+	if (!arena_owns(msg, rdataset))
+		isc_mempool_put(msg->rdspool, rdataset);
+}
+
 /*
  * Allocate a new dynamic buffer, and attach it to this message as the
  * "current" buffer.  (which is always the last on the list, for our
@@ -285,6 +493,14 @@ newrdata(dns_message_t *msg) {
 		return (rdata);
 	}
 
+	if (msg->use_arena) {
+		rdata = arena_get(msg, sizeof(dns_rdata_t));
+		if (rdata == NULL)
+			return (NULL);
+		dns_rdata_init(rdata);
+		return (rdata);
+	}
+
 	msgblock = ISC_LIST_TAIL(msg->rdatas);
 	rdata = msgblock_get(msgblock, dns_rdata_t);
 	if (rdata == NULL) {
@@ -318,6 +534,11 @@ newrdatalist(dns_message_t *msg) {
 		goto out;
 	}
 
+	if (msg->use_arena) {
+		rdatalist = arena_get(msg, sizeof(dns_rdatalist_t));
+		goto out;
+	}
+
 	msgblock = ISC_LIST_TAIL(msg->rdatalists);
 	rdatalist = msgblock_get(msgblock, dns_rdatalist_t);
 	if (rdatalist == NULL) {
@@ -343,6 +564,9 @@ newoffsets(dns_message_t *msg) {
 	dns_msgblock_t *msgblock;
 	dns_offsets_t *offsets;
 
+	if (msg->use_arena)
+		return (arena_get(msg, sizeof(dns_offsets_t)));
+
 	msgblock = ISC_LIST_TAIL(msg->offsets);
 	offsets = msgblock_get(msgblock, dns_offsets_t);
 	if (offsets == NULL) {
@@ -431,6 +655,7 @@ msginit(dns_message_t *m) {
 	m->cc_bad = 0;
 	m->tkey = 0;
 	m->rdclass_set = 0;
+	m->use_arena = 0;
 	m->querytsig = NULL;
 }
 
@@ -456,12 +681,12 @@ msgresetnames(dns_message_t *msg, unsigned int first_section) {
 
 				INSIST(dns_rdataset_isassociated(rds));
 				dns_rdataset_disassociate(rds);
-				isc_mempool_put(msg->rdspool, rds);
+				releaserdataset(msg, rds);
 				rds = next_rds;
 			}
 			if (dns_name_dynamic(name))
 				dns_name_free(name, msg->mctx);
-			isc_mempool_put(msg->namepool, name);
+			releasename(msg, name);
 			name = next_name;
 		}
 	}
@@ -477,7 +702,7 @@ msgresetopt(dns_message_t *msg)
 		}
 		INSIST(dns_rdataset_isassociated(msg->opt));
 		dns_rdataset_disassociate(msg->opt);
-		isc_mempool_put(msg->rdspool, msg->opt);
+		releaserdataset(msg, msg->opt);
 		msg->opt = NULL;
 		msg->cc_ok = 0;
 		msg->cc_bad = 0;
@@ -498,30 +723,30 @@ msgresetsigs(dns_message_t *msg, bool replying) {
 			msg->querytsig = msg->tsig;
 		} else {
 			dns_rdataset_disassociate(msg->tsig);
-			isc_mempool_put(msg->rdspool, msg->tsig);
+			releaserdataset(msg, msg->tsig);
 			if (msg->querytsig != NULL) {
 				dns_rdataset_disassociate(msg->querytsig);
-				isc_mempool_put(msg->rdspool, msg->querytsig);
+				releaserdataset(msg, msg->querytsig);
 			}
 		}
 		if (dns_name_dynamic(msg->tsigname))
 			dns_name_free(msg->tsigname, msg->mctx);
-		isc_mempool_put(msg->namepool, msg->tsigname);
+		releasename(msg, msg->tsigname);
 		msg->tsig = NULL;
 		msg->tsigname = NULL;
 	} else if (msg->querytsig != NULL && !replying) {
 		dns_rdataset_disassociate(msg->querytsig);
-		isc_mempool_put(msg->rdspool, msg->querytsig);
+		releaserdataset(msg, msg->querytsig);
 		msg->querytsig = NULL;
 	}
 	if (msg->sig0 != NULL) {
 		INSIST(dns_rdataset_isassociated(msg->sig0));
 		dns_rdataset_disassociate(msg->sig0);
-		isc_mempool_put(msg->rdspool, msg->sig0);
+		releaserdataset(msg, msg->sig0);
 		if (msg->sig0name != NULL) {
 			if (dns_name_dynamic(msg->sig0name))
 				dns_name_free(msg->sig0name, msg->mctx);
-			isc_mempool_put(msg->namepool, msg->sig0name);
+			releasename(msg, msg->sig0name);
 		}
 		msg->sig0 = NULL;
 		msg->sig0name = NULL;
@@ -616,6 +841,8 @@ msgreset(dns_message_t *msg, bool everything) {
 		msgblock = next_msgblock;
 	}
 
+	arena_reset(msg, everything);
+
 	if (msg->tsigkey != NULL) {
 		dns_tsigkey_detach(&msg->tsigkey);
 		msg->tsigkey = NULL;
@@ -740,6 +967,8 @@ dns_message_create(isc_mem_t *mctx, unsigned int intent, dns_message_t **msgp)
 	ISC_LIST_INIT(m->rdatas);
 	ISC_LIST_INIT(m->rdatalists);
 	ISC_LIST_INIT(m->offsets);
+	ISC_LIST_INIT(m->arena);
+	m->arena_hint = 0;
 	ISC_LIST_INIT(m->freerdata);
 	ISC_LIST_INIT(m->freerdatalist);
 
@@ -895,6 +1124,22 @@ getname(dns_name_t *name, isc_buffer_t *source, dns_message_t *msg,
 	isc_result_t result;
 	unsigned int tries;
 
+	if (msg->use_arena) {
+		isc_buffer_t buffer;
+		unsigned char *base;
+		unsigned int avail;
+
+		base = arena_reserve(msg, DNS_NAME_MAXWIRE, &avail);
+		if (base == NULL)
+			return (ISC_R_NOMEMORY);
+		isc_buffer_init(&buffer, base, DNS_NAME_MAXWIRE);
+		result = dns_name_fromwire(name, source, dctx, false,
+					   &buffer);
+		if (result == ISC_R_SUCCESS)
+			arena_commit(msg, isc_buffer_usedlength(&buffer));
+		return (result);
+	}
+
 	scratch = currentbuffer(msg);
 
 	/*
@@ -924,6 +1169,43 @@ getname(dns_name_t *name, isc_buffer_t *source, dns_message_t *msg,
 	return (ISC_R_UNEXPECTED);
 }
 
+/*
+ * getrdata() for arena mode.  The first try uses whatever is left in the
+ * current arena chunk, as long as that is at least 'rdatalen'; later
+ * tries reserve twice as much each time, as getrdata() does.
+ */
+static isc_result_t
+getrdata_arena(isc_buffer_t *source, dns_message_t *msg,
+	       dns_decompress_t *dctx, dns_rdataclass_t rdclass,
+	       dns_rdatatype_t rdtype, unsigned int rdatalen,
+	       dns_rdata_t *rdata)
+{
+	isc_buffer_t buffer;
+	isc_result_t result;
+	unsigned char *base;
+	unsigned int trysize, avail;
+
+	trysize = rdatalen;
+	for (;;) {
+		base = arena_reserve(msg, trysize, &avail);
+		if (base == NULL)
+			return (ISC_R_NOMEMORY);
+		isc_buffer_init(&buffer, base, avail);
+		result = dns_rdata_fromwire(rdata, rdclass, rdtype,
+					    source, dctx, 0, &buffer);
+		if (result == ISC_R_SUCCESS)
+			arena_commit(msg, isc_buffer_usedlength(&buffer));
+		if (result != ISC_R_NOSPACE)
+			return (result);
+
+		if (avail >= 65535)
+			return (ISC_R_NOSPACE);
+		trysize = ISC_MAX(2 * avail, 2 * rdatalen);
+		if (trysize < SCRATCHPAD_SIZE)
+			trysize = SCRATCHPAD_SIZE;
+	}
+}
+
 static isc_result_t
 getrdata(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 	 dns_rdataclass_t rdclass, dns_rdatatype_t rdtype,
@@ -934,10 +1216,14 @@ getrdata(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 	unsigned int tries;
 	unsigned int trysize;
 
-	scratch = currentbuffer(msg);
-
 	isc_buffer_setactive(source, rdatalen);
 
+	if (msg->use_arena)
+		return (getrdata_arena(source, msg, dctx, rdclass, rdtype,
+				       rdatalen, rdata));
+
+	scratch = currentbuffer(msg);
+
 	/*
 	 * First try:  use current buffer.
 	 * Second try:  allocate a new buffer of size
@@ -1016,7 +1302,7 @@ getquestions(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 	rdatalist = NULL;
 
 	for (count = 0; count < msg->counts[DNS_SECTION_QUESTION]; count++) {
-		name = isc_mempool_get(msg->namepool);
+		name = newname(msg);
 		if (name == NULL)
 			return (ISC_R_NOMEMORY);
 		free_name = true;
@@ -1061,7 +1347,7 @@ getquestions(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 			ISC_LIST_APPEND(*section, name, link);
 			free_name = false;
 		} else {
-			isc_mempool_put(msg->namepool, name);
+			releasename(msg, name);
 			name = name2;
 			name2 = NULL;
 			free_name = false;
@@ -1109,7 +1395,7 @@ getquestions(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 			result = ISC_R_NOMEMORY;
 			goto cleanup;
 		}
-		rdataset =  isc_mempool_get(msg->rdspool);
+		rdataset = newrdataset(msg);
 		if (rdataset == NULL) {
 			result = ISC_R_NOMEMORY;
 			goto cleanup;
@@ -1140,14 +1426,14 @@ getquestions(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
  cleanup:
 	if (rdataset != NULL) {
 		INSIST(!dns_rdataset_isassociated(rdataset));
-		isc_mempool_put(msg->rdspool, rdataset);
+		releaserdataset(msg, rdataset);
 	}
 #if 0
 	if (rdatalist != NULL)
 		isc_mempool_put(msg->rdlpool, rdatalist);
 #endif
 	if (free_name)
-		isc_mempool_put(msg->namepool, name);
+		releasename(msg, name);
 
 	return (result);
 }
@@ -1254,7 +1540,7 @@ getsection(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 		skip_type_search = false;
 		free_rdataset = false;
 
-		name = isc_mempool_get(msg->namepool);
+		name = newname(msg);
 		if (name == NULL)
 			return (ISC_R_NOMEMORY);
 		free_name = true;
@@ -1484,7 +1770,7 @@ getsection(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 			 * If it is a new name, append to the section.
 			 */
 			if (result == ISC_R_SUCCESS) {
-				isc_mempool_put(msg->namepool, name);
+				releasename(msg, name);
 				name = name2;
 			} else {
 				ISC_LIST_APPEND(*section, name, link);
@@ -1536,7 +1822,7 @@ getsection(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 		}
 
 		if (result == ISC_R_NOTFOUND) {
-			rdataset = isc_mempool_get(msg->rdspool);
+			rdataset = newrdataset(msg);
 			if (rdataset == NULL) {
 				result = ISC_R_NOMEMORY;
 				goto cleanup;
@@ -1605,7 +1891,7 @@ getsection(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 				((msg->opt->ttl & DNS_MESSAGE_EDNSRCODE_MASK)
 				 >> 20);
 			msg->rcode |= ercode;
-			isc_mempool_put(msg->namepool, name);
+			releasename(msg, name);
 			free_name = false;
 		} else if (issigzero && msg->sig0 == NULL) {
 			msg->sig0 = rdataset;
@@ -1625,9 +1911,9 @@ getsection(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 
 		if (seen_problem) {
 			if (free_name)
-				isc_mempool_put(msg->namepool, name);
+				releasename(msg, name);
 			if (free_rdataset)
-				isc_mempool_put(msg->rdspool, rdataset);
+				releaserdataset(msg, rdataset);
 			free_name = free_rdataset = false;
 		}
 		INSIST(free_name == false);
@@ -1653,10 +1939,208 @@ getsection(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
 
  cleanup:
 	if (free_name)
-		isc_mempool_put(msg->namepool, name);
+		releasename(msg, name);
 	if (free_rdataset)
-		isc_mempool_put(msg->rdspool, rdataset);
+		releaserdataset(msg, rdataset);
+
+	return (result);
+}
+
+/*
+ * Query fast path.
+ *
+ * Nearly all requests a server sees are queries with a single,
+ * uncompressed question and nothing else but an OPT record.  For those
+ * the generic section parser is mostly overhead: there are no names or
+ * rdatasets to merge, no meta-types to police and no compression
+ * pointers to follow.  isfastquery() checks the shape of the message
+ * straight from the wire without consuming or allocating anything;
+ * getfastquery() then builds the question and OPT pseudo-section
+ * directly.  Anything else, including any message with a TSIG or SIG(0),
+ * goes through getquestions() and getsection().
+ */
+static bool
+isfastquery(dns_message_t *msg, isc_buffer_t *source, unsigned int options,
+	    unsigned int *namelenp)
+{
+	isc_region_t r;
+	unsigned int i, len, rdlen;
+
+	if ((options & DNS_MESSAGEPARSE_PRESERVEORDER) != 0 ||
+	    (msg->flags & DNS_MESSAGEFLAG_QR) != 0 ||
+	    msg->opcode != dns_opcode_query ||
+	    msg->counts[DNS_SECTION_QUESTION] != 1 ||
+	    msg->counts[DNS_SECTION_ANSWER] != 0 ||
+	    msg->counts[DNS_SECTION_AUTHORITY] != 0 ||
+	    msg->counts[DNS_SECTION_ADDITIONAL] > 1)
+	{
+		return (false);
+	}
+
+	isc_buffer_remainingregion(source, &r);
+
+	/*
+	 * The question name, which must consist of ordinary labels only.
+	 */
+	i = 0;
+	do {
+		if (i >= r.length)
+			return (false);
+		len = r.base[i];
+		if (len > 63)
+			return (false);
+		i += len + 1;
+		if (i > DNS_NAME_MAXWIRE)
+			return (false);
+	} while (len != 0);
+	*namelenp = i;
+
+	/*
+	 * Type and class, and then either the end of the message or an
+	 * OPT record owned by the root name which ends the message.
+	 */
+	i += 4;
+	if (msg->counts[DNS_SECTION_ADDITIONAL] == 0)
+		return (i == r.length);
+
+	if (r.length < i + 11 || r.base[i] != 0 ||
+	    r.base[i + 1] != 0 || r.base[i + 2] != dns_rdatatype_opt)
+	{
+		return (false);
+	}
+	rdlen = (r.base[i + 9] << 8) | r.base[i + 10];
+	return (i + 11 + rdlen == r.length);
+}
+
+static isc_result_t
+getfastquery(isc_buffer_t *source, dns_message_t *msg, dns_decompress_t *dctx,
+	     unsigned int namelen)
+{
+	isc_region_t r;
+	isc_result_t result;
+	dns_name_t *name = NULL;
+	dns_offsets_t *offsets;
+	dns_rdataset_t *rdataset = NULL;
+	dns_rdatalist_t *rdatalist;
+	dns_rdata_t *rdata;
+	dns_rdatatype_t rdtype;
+	dns_rdataclass_t rdclass;
+	dns_ttl_t ttl;
+	unsigned int rdatalen;
+	unsigned char *ndata;
+
+	/*
+	 * The question name has been checked by isfastquery(), so it can
+	 * simply be copied.
+	 */
+	name = newname(msg);
+	if (name == NULL)
+		return (ISC_R_NOMEMORY);
+	offsets = newoffsets(msg);
+	if (offsets == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup;
+	}
+	dns_name_init(name, *offsets);
+
+	if (msg->use_arena) {
+		ndata = arena_get(msg, namelen);
+		if (ndata == NULL) {
+			result = ISC_R_NOMEMORY;
+			goto cleanup;
+		}
+	} else {
+		isc_buffer_t *scratch = currentbuffer(msg);
 
+		if (isc_buffer_availablelength(scratch) < namelen) {
+			result = newbuffer(msg, SCRATCHPAD_SIZE);
+			if (result != ISC_R_SUCCESS)
+				goto cleanup;
+			scratch = currentbuffer(msg);
+		}
+		ndata = isc_buffer_used(scratch);
+		isc_buffer_add(scratch, namelen);
+	}
+	memmove(ndata, isc_buffer_current(source), namelen);
+	isc_buffer_forward(source, namelen);
+	r.base = ndata;
+	r.length = namelen;
+	dns_name_fromregion(name, &r);
+
+	rdtype = isc_buffer_getuint16(source);
+	rdclass = isc_buffer_getuint16(source);
+	msg->rdclass = rdclass;
+	msg->rdclass_set = 1;
+	if (rdtype == dns_rdatatype_tkey)
+		msg->tkey = 1;
+
+	rdatalist = newrdatalist(msg);
+	if (rdatalist == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup;
+	}
+	rdataset = newrdataset(msg);
+	if (rdataset == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup;
+	}
+	rdatalist->type = rdtype;
+	rdatalist->rdclass = rdclass;
+	dns_rdataset_init(rdataset);
+	RUNTIME_CHECK(dns_rdatalist_tordataset(rdatalist, rdataset)
+		      == ISC_R_SUCCESS);
+	rdataset->attributes |= DNS_RDATASETATTR_QUESTION;
+
+	ISC_LIST_APPEND(name->list, rdataset, link);
+	ISC_LIST_APPEND(msg->sections[DNS_SECTION_QUESTION], name, link);
+	name = NULL;
+	rdataset = NULL;
+	msg->question_ok = 1;
+
+	if (msg->counts[DNS_SECTION_ADDITIONAL] == 0)
+		return (ISC_R_SUCCESS);
+
+	/*
+	 * The OPT record.  Its rdata still goes through
+	 * dns_rdata_fromwire() so that the options are checked.
+	 */
+	isc_buffer_forward(source, 1);
+	rdtype = isc_buffer_getuint16(source);
+	rdclass = isc_buffer_getuint16(source);
+	ttl = isc_buffer_getuint32(source);
+	rdatalen = isc_buffer_getuint16(source);
+
+	rdata = newrdata(msg);
+	if (rdata == NULL)
+		return (ISC_R_NOMEMORY);
+	result = getrdata(source, msg, dctx, rdclass, rdtype, rdatalen, rdata);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+	rdata->rdclass = rdclass;
+
+	rdatalist = newrdatalist(msg);
+	if (rdatalist == NULL)
+		return (ISC_R_NOMEMORY);
+	rdataset = newrdataset(msg);
+	if (rdataset == NULL)
+		return (ISC_R_NOMEMORY);
+	rdatalist->type = rdtype;
+	rdatalist->rdclass = rdclass;
+	rdatalist->ttl = ttl;
+	ISC_LIST_APPEND(rdatalist->rdata, rdata, link);
+	dns_rdataset_init(rdataset);
+	RUNTIME_CHECK(dns_rdatalist_tordataset(rdatalist, rdataset)
+		      == ISC_R_SUCCESS);
+	dns_rdataset_setownercase(rdataset, dns_rootname);
+
+	msg->opt = rdataset;
+	msg->rcode |= (dns_rcode_t)((ttl & DNS_MESSAGE_EDNSRCODE_MASK) >> 20);
+
+	return (ISC_R_SUCCESS);
+
+ cleanup:
+	if (name != NULL)
+		releasename(msg, name);
 	return (result);
 }
 
@@ -1671,6 +2155,7 @@ dns_message_parse(dns_message_t *msg, isc_buffer_t *source,
 	isc_buffer_t origsource;
 	bool seen_problem;
 	bool ignore_tc;
+	unsigned int namelen;
 
 	REQUIRE(DNS_MESSAGE_VALID(msg));
 	REQUIRE(source != NULL);
@@ -1702,6 +2187,16 @@ dns_message_parse(dns_message_t *msg, isc_buffer_t *source,
 	msg->header_ok = 1;
 	msg->state = DNS_SECTION_QUESTION;
 
+	if ((options & DNS_MESSAGEPARSE_ARENA) != 0) {
+		isc_buffer_remainingregion(source, &r);
+		arena_prepare(msg, r.length,
+			      msg->counts[DNS_SECTION_QUESTION] +
+			      msg->counts[DNS_SECTION_ANSWER] +
+			      msg->counts[DNS_SECTION_AUTHORITY] +
+			      msg->counts[DNS_SECTION_ADDITIONAL]);
+		msg->use_arena = 1;
+	}
+
 	/*
 	 * -1 means no EDNS.
 	 */
@@ -1709,6 +2204,16 @@ dns_message_parse(dns_message_t *msg, isc_buffer_t *source,
 
 	dns_decompress_setmethods(&dctx, DNS_COMPRESS_GLOBAL14);
 
+	if (isfastquery(msg, source, options, &namelen)) {
+		ret = getfastquery(source, msg, &dctx, namelen);
+		if (ret != ISC_R_SUCCESS)
+			return (ret);
+		/*
+		 * isfastquery() has ruled out trailing garbage.
+		 */
+		goto truncated;
+	}
+
 	ret = getquestions(source, msg, &dctx, options);
 	if (ret == ISC_R_UNEXPECTEDEND && ignore_tc)
 		goto truncated;
@@ -2204,6 +2709,25 @@ dns_message_rendersection(dns_message_t *msg, dns_section_t sectionid,
 	return (ISC_R_SUCCESS);
 }
 
+isc_result_t
+dns_message_renderraw(dns_message_t *msg, dns_section_t sectionid,
+		      const isc_region_t *r, unsigned int count)
+{
+	REQUIRE(DNS_MESSAGE_VALID(msg));
+	REQUIRE(msg->buffer != NULL);
+	REQUIRE(VALID_NAMED_SECTION(sectionid));
+	REQUIRE(r != NULL);
+
+	if (isc_buffer_availablelength(msg->buffer) <
+	    r->length + msg->reserved)
+		return (ISC_R_NOSPACE);
+
+	isc_buffer_putmem(msg->buffer, r->base, r->length);
+	msg->counts[sectionid] += count;
+
+	return (ISC_R_SUCCESS);
+}
+
 void
 dns_message_renderheader(dns_message_t *msg, isc_buffer_t *target) {
 	uint16_t tmp;
@@ -2647,7 +3171,7 @@ dns_message_puttempname(dns_message_t *msg, dns_name_t **itemp) {
 	*itemp = NULL;
 	if (dns_name_dynamic(item))
 		dns_name_free(item, msg->mctx);
-	isc_mempool_put(msg->namepool, item);
+	releasename(msg, item);
 }
 
 void
@@ -2665,7 +3189,7 @@ dns_message_puttemprdataset(dns_message_t *msg, dns_rdataset_t **item) {
 	REQUIRE(item != NULL && *item != NULL);
 
 	REQUIRE(!dns_rdataset_isassociated(*item));
-	isc_mempool_put(msg->rdspool, *item);
+	releaserdataset(msg, *item);
 	*item = NULL;
 }
 
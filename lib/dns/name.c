@@ -109,6 +109,105 @@ static unsigned char maptolower[] = {
 #define CONVERTTOASCII(c)
 #define CONVERTFROMASCII(c)
 
+/*
+ * Case folding and comparison eight octets at a time.
+ *
+ * tolower64() lowercases 'A'-'Z' in each octet of a 64-bit word and
+ * leaves every other octet, including those with the high bit set,
+ * untouched, exactly as maptolower[] does.  Label length octets are
+ * never above 63 and so are never changed by it, which lets whole
+ * wire-format names be folded or compared without walking labels.
+ *
+ * The words are loaded with memmove() so that no alignment is
+ * assumed; compilers turn these into single unaligned loads and
+ * stores where the CPU allows them.
+ */
+#define ALL_OCTETS	UINT64_C(0x0101010101010101)
+
+static inline uint64_t
+load64(const unsigned char *p) {
+	uint64_t v;
+
+	memmove(&v, p, sizeof(v));
+	return (v);
+}
+
+static inline void
+store64(unsigned char *p, uint64_t v) {
+	memmove(p, &v, sizeof(v));
+}
+
+static inline uint64_t
+tolower64(uint64_t octets) {
+	/*
+	 * With the high bit of each octet cleared, adding a constant
+	 * cannot carry into the next octet.  The high bit of the sum
+	 * then tells whether the octet is above 'Z', and (separately)
+	 * whether it is at least 'A'; an octet is an upper case letter
+	 * when exactly one of these holds and its own high bit was
+	 * clear.  Shifting that bit right by two gives 0x20.
+	 */
+	uint64_t heptets = octets & (0x7f * ALL_OCTETS);
+	uint64_t is_gt_Z = heptets + (0x7f - 'Z') * ALL_OCTETS;
+	uint64_t is_ge_A = heptets + (0x80 - 'A') * ALL_OCTETS;
+	uint64_t is_upper = ~octets & (is_ge_A ^ is_gt_Z) &
+			    (0x80 * ALL_OCTETS);
+
+	return (octets | (is_upper >> 2));
+}
+
+/*
+ * Copy 'length' octets from 'src' to 'dst', lowercasing them.
+ * 'src' and 'dst' may be the same.
+ */
+static inline void
+fold_octets(unsigned char *dst, const unsigned char *src,
+	    unsigned int length)
+{
+	while (length >= 8) {
+		store64(dst, tolower64(load64(src)));
+		dst += 8;
+		src += 8;
+		length -= 8;
+	}
+	while (length > 0) {
+		*dst++ = maptolower[*src++];
+		length--;
+	}
+}
+
+/*
+ * Case-insensitively compare 'length' octets for equality.
+ */
+static inline bool
+caseequal_octets(const unsigned char *a, const unsigned char *b,
+		 unsigned int length)
+{
+	if (length < 8) {
+		while (length-- > 0) {
+			if (maptolower[*a++] != maptolower[*b++])
+				return (false);
+		}
+		return (true);
+	}
+
+	while (length > 8) {
+		if (tolower64(load64(a)) != tolower64(load64(b)))
+			return (false);
+		a += 8;
+		b += 8;
+		length -= 8;
+	}
+
+	/*
+	 * The last one to eight octets: compare the final eight,
+	 * overlapping octets that have already been compared.
+	 */
+	a -= 8 - length;
+	b -= 8 - length;
+	return (tolower64(load64(a)) == tolower64(load64(b)));
+}
+
 #define INIT_OFFSETS(name, var, default_offsets) \
 	if ((name)->offsets != NULL)		 \
 		var = (name)->offsets;		 \
@@ -559,35 +658,19 @@ dns_name_fullcompare(const dns_name_t *name1, const dns_name_t *name2,
 		else
 			count = count2;
 
-		/* Loop unrolled for performance */
-		while (ISC_LIKELY(count > 3)) {
-			chdiff = (int)maptolower[label1[0]] -
-				 (int)maptolower[label2[0]];
-			if (chdiff != 0) {
-				*orderp = chdiff;
-				goto done;
-			}
-			chdiff = (int)maptolower[label1[1]] -
-				 (int)maptolower[label2[1]];
-			if (chdiff != 0) {
-				*orderp = chdiff;
-				goto done;
-			}
-			chdiff = (int)maptolower[label1[2]] -
-				 (int)maptolower[label2[2]];
-			if (chdiff != 0) {
-				*orderp = chdiff;
-				goto done;
-			}
-			chdiff = (int)maptolower[label1[3]] -
-				 (int)maptolower[label2[3]];
-			if (chdiff != 0) {
-				*orderp = chdiff;
-				goto done;
+		/*
+		 * Skip over equal words; a difference inside a word is
+		 * located by the octet loop below.
+		 */
+		while (count >= 8) {
+			if (tolower64(load64(label1)) !=
+			    tolower64(load64(label2)))
+			{
+				break;
 			}
-			count -= 4;
-			label1 += 4;
-			label2 += 4;
+			count -= 8;
+			label1 += 8;
+			label2 += 8;
 		}
 		while (ISC_LIKELY(count-- > 0)) {
 			chdiff = (int)maptolower[*label1++] -
@@ -644,9 +727,6 @@ dns_name_compare(const dns_name_t *name1, const dns_name_t *name2) {
 
 bool
 dns_name_equal(const dns_name_t *name1, const dns_name_t *name2) {
-	unsigned int l, count;
-	unsigned char c;
-	unsigned char *label1, *label2;
 
 	/*
 	 * Are 'name1' and 'name2' equal?
@@ -671,46 +751,14 @@ dns_name_equal(const dns_name_t *name1, const dns_name_t *name2) {
 	if (name1->length != name2->length)
 		return (false);
 
-	l = name1->labels;
-
-	if (l != name2->labels)
+	if (name1->labels != name2->labels)
 		return (false);
 
-	label1 = name1->ndata;
-	label2 = name2->ndata;
-	while (ISC_LIKELY(l-- > 0)) {
-		count = *label1++;
-		if (count != *label2++)
-			return (false);
-
-		INSIST(count <= 63); /* no bitstring support */
-
-		/* Loop unrolled for performance */
-		while (ISC_LIKELY(count > 3)) {
-			c = maptolower[label1[0]];
-			if (c != maptolower[label2[0]])
-				return (false);
-			c = maptolower[label1[1]];
-			if (c != maptolower[label2[1]])
-				return (false);
-			c = maptolower[label1[2]];
-			if (c != maptolower[label2[2]])
-				return (false);
-			c = maptolower[label1[3]];
-			if (c != maptolower[label2[3]])
-				return (false);
-			count -= 4;
-			label1 += 4;
-			label2 += 4;
-		}
-		while (ISC_LIKELY(count-- > 0)) {
-			c = maptolower[*label1++];
-			if (c != maptolower[*label2++])
-				return (false);
-		}
-	}
-
-	return (true);
+	/*
+	 * Label length octets are not affected by case folding, so
+	 * if the names are equal octet by octet, their labels line up.
+	 */
+	return (caseequal_octets(name1->ndata, name2->ndata, name1->length));
 }
 
 bool
@@ -1626,7 +1674,7 @@ dns_name_downcase(const dns_name_t *source, dns_name_t *name,
 		  isc_buffer_t *target)
 {
 	unsigned char *sndata, *ndata;
-	unsigned int nlen, count, labels;
+	unsigned int nlen;
 	isc_buffer_t buffer;
 
 	/*
@@ -1654,31 +1702,17 @@ dns_name_downcase(const dns_name_t *source, dns_name_t *name,
 
 	sndata = source->ndata;
 	nlen = source->length;
-	labels = source->labels;
 
 	if (nlen > (target->length - target->used)) {
 		MAKE_EMPTY(name);
 		return (ISC_R_NOSPACE);
 	}
 
-	while (labels > 0 && nlen > 0) {
-		labels--;
-		count = *sndata++;
-		*ndata++ = count;
-		nlen--;
-		if (count < 64) {
-			INSIST(nlen >= count);
-			while (count > 0) {
-				*ndata++ = maptolower[(*sndata++)];
-				nlen--;
-				count--;
-			}
-		} else {
-			FATAL_ERROR(__FILE__, __LINE__,
-				    "Unexpected label type %02x", count);
-			/* Does not return. */
-		}
-	}
+	/*
+	 * Label length octets are left alone by case folding, so the
+	 * whole name can be folded without walking its labels.
+	 */
+	fold_octets(ndata, sndata, nlen);
 
 	if (source != name) {
 		name->labels = source->labels;
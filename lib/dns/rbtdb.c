@@ -43,6 +43,7 @@
 #include <dns/callbacks.h>
 #include <dns/db.h>
 #include <dns/dbiterator.h>
+#include <dns/ecs.h>
 #include <dns/events.h>
 #include <dns/fixedname.h>
 #include <dns/lib.h>
@@ -134,6 +135,16 @@ typedef uint32_t                    rbtdb_rdatatype_t;
 #define RBTDB_RDATATYPE_NCACHEANY \
 		RBTDB_RDATATYPE_VALUE(0, dns_rdatatype_any)
 
+/*%
+ * Rdatasets scoped to a client subnet are stored with an extension
+ * that can never occur in an unscoped type, so that only code looking
+ * for scoped data ever matches them.  Only positive rdatasets of
+ * types other than RRSIG are scoped.
+ */
+#define RBTDB_RDATATYPE_SCOPEDEXT	0xFFFF
+#define RBTDB_RDATATYPE_SCOPED(type) \
+		RBTDB_RDATATYPE_VALUE(type, RBTDB_RDATATYPE_SCOPEDEXT)
+
 /*
  * We use rwlock for DB lock only when ISC_RWLOCK_USEATOMIC is non 0.
  * Using rwlock is effective with regard to lookup performance only when
@@ -231,6 +242,23 @@ struct noqname {
 	dns_rdatatype_t	type;
 };
 
+/*%
+ * The client subnet a scoped rdataset applies to (RFC 7871).  'addr'
+ * holds 'bits' significant bits; the rest are zero.
+ */
+typedef struct rbtdb_scope {
+	uint8_t			family;
+	uint8_t			bits;
+	unsigned char		addr[16];
+} rbtdb_scope_t;
+
+/*%
+ * The most scoped rdatasets kept at a single node.
+ */
+#ifndef DNS_RBTDB_MAXSCOPED
+#define DNS_RBTDB_MAXSCOPED	16
+#endif
+
 typedef struct rdatasetheader {
 	/*%
 	 * Locked by the owning node's lock.
@@ -242,6 +270,11 @@ typedef struct rdatasetheader {
 	dns_trust_t                     trust;
 	struct noqname                  *noqname;
 	struct noqname                  *closest;
+	rbtdb_scope_t                   *scope;
+	/*%<
+	 * If not NULL, this rdataset only answers clients within the
+	 * given subnet.  Cache only.
+	 */
 	unsigned int 			is_mmapped : 1;
 	unsigned int 			next_is_relative : 1;
 	unsigned int 			node_is_relative : 1;
@@ -349,6 +382,8 @@ typedef ISC_LIST(dns_rbtnode_t)         rbtnodelist_t;
 	(((header)->attributes & RDATASET_ATTR_CASEFULLYLOWER) != 0)
 #define ANCIENT(header) \
 	(((header)->attributes & RDATASET_ATTR_ANCIENT) != 0)
+#define SCOPED(header) \
+	((header)->scope != NULL)
 
 #define ACTIVE(header, now) \
 	(((header)->rdh_ttl > (now)) || \
@@ -851,6 +886,18 @@ update_cachestats(dns_rbtdb_t *rbtdb, isc_result_t result) {
 	}
 }
 
+static void
+update_scopedstats(dns_rbtdb_t *rbtdb, bool hit) {
+	INSIST(IS_CACHE(rbtdb));
+
+	if (rbtdb->cachestats == NULL)
+		return;
+
+	isc_stats_increment(rbtdb->cachestats,
+			    hit ? dns_cachestatscounter_scopedhits
+				: dns_cachestatscounter_scopedmisses);
+}
+
 static void
 update_rrsetstats(dns_rbtdb_t *rbtdb, rdatasetheader_t *header,
 		  bool increment)
@@ -1433,6 +1480,52 @@ free_noqname(isc_mem_t *mctx, struct noqname **noqname) {
 	*noqname = NULL;
 }
 
+/*
+ * Return the address octets of 'ecs'.
+ */
+static inline const unsigned char *
+ecs_address(const dns_ecs_t *ecs) {
+	if (ecs->addr.family == AF_INET6)
+		return ((const unsigned char *)&ecs->addr.type.in6);
+	return ((const unsigned char *)&ecs->addr.type.in);
+}
+
+/*
+ * Return true if the first 'bits' bits of 'a' and 'b' are equal.
+ */
+static inline bool
+prefix_equal(const unsigned char *a, const unsigned char *b,
+	     unsigned int bits)
+{
+	unsigned int bytes = bits / 8;
+	unsigned char mask;
+
+	if (bytes != 0 && memcmp(a, b, bytes) != 0)
+		return (false);
+	if ((bits % 8) == 0)
+		return (true);
+	mask = (0xff << (8 - bits % 8)) & 0xff;
+	return (((a[bytes] ^ b[bytes]) & mask) == 0);
+}
+
+/*
+ * Does the scope of a cached rdataset cover the client subnet 'ecs'?
+ * An answer scoped more narrowly than the client's source prefix
+ * cannot be used.
+ */
+static inline bool
+scope_match(const rbtdb_scope_t *scope, const dns_ecs_t *ecs) {
+	if (scope->family != ecs->addr.family || scope->bits > ecs->source)
+		return (false);
+	return (prefix_equal(scope->addr, ecs_address(ecs), scope->bits));
+}
+
+static inline bool
+scope_equal(const rbtdb_scope_t *a, const rbtdb_scope_t *b) {
+	return (a->family == b->family && a->bits == b->bits &&
+		memcmp(a->addr, b->addr, sizeof(a->addr)) == 0);
+}
+
 static inline void
 init_rdataset(dns_rbtdb_t *rbtdb, rdatasetheader_t *h) {
 	ISC_LINK_INIT(h, link);
@@ -1440,6 +1533,7 @@ init_rdataset(dns_rbtdb_t *rbtdb, rdatasetheader_t *h) {
 	h->is_mmapped = 0;
 	h->next_is_relative = 0;
 	h->node_is_relative = 0;
+	h->scope = NULL;
 
 #if TRACE_HEADER
 	if (IS_CACHE(rbtdb) && rbtdb->common.rdclass == dns_rdataclass_in)
@@ -1518,6 +1612,10 @@ free_rdataset(dns_rbtdb_t *rbtdb, isc_mem_t *mctx, rdatasetheader_t *rdataset) {
 		free_noqname(mctx, &rdataset->noqname);
 	if (rdataset->closest != NULL)
 		free_noqname(mctx, &rdataset->closest);
+	if (rdataset->scope != NULL) {
+		isc_mem_put(mctx, rdataset->scope, sizeof(*rdataset->scope));
+		rdataset->scope = NULL;
+	}
 
 	if (NONEXISTENT(rdataset))
 		size = sizeof(*rdataset);
@@ -3109,7 +3207,10 @@ bind_rdataset(dns_rbtdb_t *rbtdb, dns_rbtnode_t *node,
 	rdataset->methods = &rdataset_methods;
 	rdataset->rdclass = rbtdb->common.rdclass;
 	rdataset->type = RBTDB_RDATATYPE_BASE(header->type);
-	rdataset->covers = RBTDB_RDATATYPE_EXT(header->type);
+	if (SCOPED(header))
+		rdataset->covers = 0;
+	else
+		rdataset->covers = RBTDB_RDATATYPE_EXT(header->type);
 	rdataset->ttl = header->rdh_ttl - now;
 	rdataset->trust = header->trust;
 	if (NEGATIVE(header))
@@ -4834,10 +4935,11 @@ find_coveringnsec(rbtdb_search_t *search, dns_dbnode_t **nodep,
 }
 
 static isc_result_t
-cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
-	   dns_rdatatype_t type, unsigned int options, isc_stdtime_t now,
-	   dns_dbnode_t **nodep, dns_name_t *foundname,
-	   dns_rdataset_t *rdataset, dns_rdataset_t *sigrdataset)
+cache_findext(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
+	      dns_rdatatype_t type, unsigned int options, isc_stdtime_t now,
+	      dns_dbnode_t **nodep, dns_name_t *foundname,
+	      dns_clientinfomethods_t *methods, dns_clientinfo_t *clientinfo,
+	      dns_rdataset_t *rdataset, dns_rdataset_t *sigrdataset)
 {
 	dns_rbtnode_t *node = NULL;
 	isc_result_t result;
@@ -4851,9 +4953,15 @@ cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 	rdatasetheader_t *foundsig, *nssig, *cnamesig;
 	rdatasetheader_t *update, *updatesig;
 	rdatasetheader_t *nsecheader, *nsecsig;
+	rdatasetheader_t *scoped;
 	rbtdb_rdatatype_t sigtype, negtype;
+	dns_rdatatype_t scopedtype;
+	dns_rdatatype_t foundtype = 0;
+	dns_ecs_t *ecs = NULL;
+	bool scopedhit = false;
 
 	UNUSED(version);
+	UNUSED(methods);
 
 	search.rbtdb = (dns_rbtdb_t *)db;
 
@@ -4876,6 +4984,17 @@ cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 	update = NULL;
 	updatesig = NULL;
 
+	/*
+	 * Answers scoped to a client subnet are only looked for when the
+	 * client has a subnet to match them against.
+	 */
+	if (clientinfo != NULL && clientinfo->version >= 3 &&
+	    clientinfo->ecs != NULL && clientinfo->ecs->source != 0 &&
+	    type != dns_rdatatype_any)
+	{
+		ecs = clientinfo->ecs;
+	}
+
 	RWLOCK(&search.rbtdb->tree_lock, isc_rwlocktype_read);
 
 	/*
@@ -4936,6 +5055,7 @@ cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 	nssig = NULL;
 	nsecsig = NULL;
 	cnamesig = NULL;
+	scoped = NULL;
 	empty_node = true;
 	header_prev = NULL;
 	for (header = node->data; header != NULL; header = header_next) {
@@ -4951,6 +5071,26 @@ cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 			 */
 			empty_node = false;
 
+			if (SCOPED(header)) {
+				/*
+				 * Remember the most specific scoped answer
+				 * covering the client's subnet.
+				 */
+				scopedtype = RBTDB_RDATATYPE_BASE(header->type);
+				if (ecs != NULL &&
+				    (scopedtype == type ||
+				     (cname_ok &&
+				      scopedtype == dns_rdatatype_cname)) &&
+				    scope_match(header->scope, ecs) &&
+				    (scoped == NULL ||
+				     header->scope->bits > scoped->scope->bits))
+				{
+					scoped = header;
+				}
+				header_prev = header;
+				continue;
+			}
+
 			/*
 			 * If we found a type we were looking for, remember
 			 * it.
@@ -5025,6 +5165,21 @@ cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 		goto find_ns;
 	}
 
+	/*
+	 * An answer scoped to the client's subnet is more specific than
+	 * unscoped data of the same or lower trust.  Scoped answers are
+	 * never signed.
+	 */
+	if (scoped != NULL &&
+	    (found == NULL || scoped->trust >= found->trust))
+	{
+		found = scoped;
+		foundsig = NULL;
+		foundtype = RBTDB_RDATATYPE_BASE(found->type);
+	} else if (found != NULL) {
+		foundtype = found->type;
+	}
+
 	/*
 	 * If we didn't find what we were looking for...
 	 */
@@ -5102,6 +5257,12 @@ cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 		*nodep = node;
 	}
 
+	if (found == scoped) {
+		scopedhit = true;
+		if (found->scope->bits > ecs->scope)
+			ecs->scope = found->scope->bits;
+	}
+
 	if (NEGATIVE(found)) {
 		/*
 		 * We found a negative cache entry.
@@ -5110,9 +5271,9 @@ cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 			result = DNS_R_NCACHENXDOMAIN;
 		else
 			result = DNS_R_NCACHENXRRSET;
-	} else if (type != found->type &&
+	} else if (type != foundtype &&
 		   type != dns_rdatatype_any &&
-		   found->type == dns_rdatatype_cname) {
+		   foundtype == dns_rdatatype_cname) {
 		/*
 		 * We weren't doing an ANY query and we found a CNAME instead
 		 * of the type we were looking for, so we need to indicate
@@ -5177,9 +5338,21 @@ cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
 	dns_rbtnodechain_reset(&search.chain);
 
 	update_cachestats(search.rbtdb, result);
+	if (ecs != NULL)
+		update_scopedstats(search.rbtdb, scopedhit);
 	return (result);
 }
 
+static isc_result_t
+cache_find(dns_db_t *db, const dns_name_t *name, dns_dbversion_t *version,
+	   dns_rdatatype_t type, unsigned int options, isc_stdtime_t now,
+	   dns_dbnode_t **nodep, dns_name_t *foundname,
+	   dns_rdataset_t *rdataset, dns_rdataset_t *sigrdataset)
+{
+	return (cache_findext(db, name, version, type, options, now, nodep,
+			      foundname, NULL, NULL, rdataset, sigrdataset));
+}
+
 static isc_result_t
 cache_findzonecut(dns_db_t *db, const dns_name_t *name, unsigned int options,
 		  isc_stdtime_t now, dns_dbnode_t **nodep,
@@ -5932,6 +6105,53 @@ update_recordsandbytes(bool add, rbtdb_version_t *rbtversion,
 	}
 }
 
+/*
+ * Find the scoped rdataset at 'node' that 'newheader' replaces, and the
+ * top header preceding it.  If there is none and the node already holds
+ * the maximum number of live scoped rdatasets, make room by expiring
+ * the one closest to expiry.
+ */
+static rdatasetheader_t *
+find_scoped(dns_rbtdb_t *rbtdb, dns_rbtnode_t *node,
+	    rdatasetheader_t *newheader, isc_stdtime_t now,
+	    rdatasetheader_t **prevp)
+{
+	rdatasetheader_t *header, *prev = NULL, *victim = NULL;
+	unsigned int count = 0;
+
+	for (header = node->data;
+	     header != NULL;
+	     prev = header, header = header->next)
+	{
+		if (!SCOPED(header))
+			continue;
+		if (header->type == newheader->type &&
+		    scope_equal(header->scope, newheader->scope))
+		{
+			*prevp = prev;
+			return (header);
+		}
+		if (EXISTS(header) && !ANCIENT(header) &&
+		    ACTIVE(header, now))
+		{
+			count++;
+			if (victim == NULL ||
+			    header->rdh_ttl < victim->rdh_ttl)
+			{
+				victim = header;
+			}
+		}
+	}
+
+	if (count >= DNS_RBTDB_MAXSCOPED) {
+		set_ttl(rbtdb, victim, 0);
+		mark_header_ancient(rbtdb, victim);
+	}
+
+	*prevp = NULL;
+	return (NULL);
+}
+
 static isc_result_t
 add32(dns_rbtdb_t *rbtdb, dns_rbtnode_t *rbtnode, rbtdb_version_t *rbtversion,
       rdatasetheader_t *newheader, unsigned int options, bool loading,
@@ -5985,6 +6205,35 @@ add32(dns_rbtdb_t *rbtdb, dns_rbtnode_t *rbtnode, rbtdb_version_t *rbtversion,
 	topheader_prev = NULL;
 	sigheader = NULL;
 	negtype = 0;
+	if (SCOPED(newheader)) {
+		/*
+		 * A scoped answer only replaces the answer of the same
+		 * type for the same subnet; unscoped data is left alone.
+		 */
+		topheader = find_scoped(rbtdb, rbtnode, newheader, now,
+					&topheader_prev);
+		goto find_header;
+	}
+	if (rbtversion == NULL && newheader_nx &&
+	    RBTDB_RDATATYPE_EXT(newheader->type) == 0)
+	{
+		/*
+		 * Deleting a type from the cache also deletes the
+		 * answers of that type scoped to client subnets.
+		 */
+		for (topheader = rbtnode->data;
+		     topheader != NULL;
+		     topheader = topheader->next)
+		{
+			if (SCOPED(topheader) &&
+			    RBTDB_RDATATYPE_BASE(topheader->type) ==
+			    RBTDB_RDATATYPE_BASE(newheader->type))
+			{
+				set_ttl(rbtdb, topheader, 0);
+				mark_header_ancient(rbtdb, topheader);
+			}
+		}
+	}
 	if (rbtversion == NULL && !newheader_nx) {
 		rdtype = RBTDB_RDATATYPE_BASE(newheader->type);
 		covers = RBTDB_RDATATYPE_EXT(newheader->type);
@@ -6588,10 +6837,44 @@ addclosest(dns_rbtdb_t *rbtdb, rdatasetheader_t *newheader,
 
 static dns_dbmethods_t zone_methods;
 
+/*
+ * Attach the client subnet of 'ecs' to 'newheader', making it a scoped
+ * rdataset.  A scope longer than the source prefix the answer was asked
+ * for is narrowed to the source prefix, as nothing more is known about
+ * the clients it applies to.
+ */
 static isc_result_t
-addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
-	    isc_stdtime_t now, dns_rdataset_t *rdataset, unsigned int options,
-	    dns_rdataset_t *addedrdataset)
+addscope(dns_rbtdb_t *rbtdb, rdatasetheader_t *newheader,
+	 const dns_ecs_t *ecs)
+{
+	rbtdb_scope_t *scope;
+	unsigned int bits;
+
+	bits = ISC_MIN(ecs->scope, ecs->source);
+	INSIST(bits > 0);
+
+	scope = isc_mem_get(rbtdb->common.mctx, sizeof(*scope));
+	if (scope == NULL)
+		return (ISC_R_NOMEMORY);
+	memset(scope, 0, sizeof(*scope));
+	scope->family = (uint8_t)ecs->addr.family;
+	scope->bits = (uint8_t)bits;
+	memmove(scope->addr, ecs_address(ecs), (bits + 7) / 8);
+	if ((bits % 8) != 0)
+		scope->addr[bits / 8] &= (0xff << (8 - bits % 8)) & 0xff;
+
+	newheader->scope = scope;
+	newheader->type =
+		RBTDB_RDATATYPE_SCOPED(RBTDB_RDATATYPE_BASE(newheader->type));
+
+	return (ISC_R_SUCCESS);
+}
+
+static isc_result_t
+addrdataset_common(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
+		   isc_stdtime_t now, dns_rdataset_t *rdataset,
+		   unsigned int options, const dns_ecs_t *ecs,
+		   dns_rdataset_t *addedrdataset)
 {
 	dns_rbtdb_t *rbtdb = (dns_rbtdb_t *)db;
 	dns_rbtnode_t *rbtnode = (dns_rbtnode_t *)node;
@@ -6691,6 +6974,14 @@ addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 				return (result);
 			}
 		}
+		if (ecs != NULL) {
+			result = addscope(rbtdb, newheader, ecs);
+			if (result != ISC_R_SUCCESS) {
+				free_rdataset(rbtdb, rbtdb->common.mctx,
+					      newheader);
+				return (result);
+			}
+		}
 	}
 
 	/*
@@ -6794,6 +7085,50 @@ addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 	return (result);
 }
 
+static isc_result_t
+addrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
+	    isc_stdtime_t now, dns_rdataset_t *rdataset, unsigned int options,
+	    dns_rdataset_t *addedrdataset)
+{
+	return (addrdataset_common(db, node, version, now, rdataset, options,
+				   NULL, addedrdataset));
+}
+
+static isc_result_t
+addscopedrdataset(dns_db_t *db, dns_dbnode_t *node, isc_stdtime_t now,
+		  dns_rdataset_t *rdataset, unsigned int options,
+		  const dns_ecs_t *ecs, dns_rdataset_t *addedrdataset)
+{
+	dns_rbtdb_t *rbtdb = (dns_rbtdb_t *)db;
+	dns_rbtnode_t *rbtnode = (dns_rbtnode_t *)node;
+
+	REQUIRE(VALID_RBTDB(rbtdb));
+	REQUIRE(IS_CACHE(rbtdb));
+	REQUIRE(ecs != NULL && ecs->scope != 0);
+
+	/*
+	 * Only positive answers are scoped.  Signatures cannot be, and
+	 * DNAMEs affect the lookup of every name below them.
+	 */
+	if ((rdataset->attributes & DNS_RDATASETATTR_NEGATIVE) != 0 ||
+	    rdataset->type == dns_rdatatype_rrsig ||
+	    delegating_type(rbtdb, rbtnode, rdataset->type))
+	{
+		return (ISC_R_NOTIMPLEMENTED);
+	}
+
+	if ((ecs->addr.family != AF_INET || ecs->source > 32) &&
+	    (ecs->addr.family != AF_INET6 || ecs->source > 128))
+	{
+		return (ISC_R_NOTIMPLEMENTED);
+	}
+	if (ecs->source == 0)
+		return (ISC_R_NOTIMPLEMENTED);
+
+	return (addrdataset_common(db, node, NULL, now, rdataset, options,
+				   ecs, addedrdataset));
+}
+
 static isc_result_t
 subtractrdataset(dns_db_t *db, dns_dbnode_t *node, dns_dbversion_t *version,
 		 dns_rdataset_t *rdataset, unsigned int options,
@@ -8179,7 +8514,8 @@ static dns_dbmethods_t zone_methods = {
 	getsize,
 	NULL,			/* setservestalettl */
 	NULL,			/* getservestalettl */
-	setgluecachestats
+	setgluecachestats,
+	NULL			/* addscopedrdataset */
 };
 
 static dns_dbmethods_t cache_methods = {
@@ -8223,14 +8559,15 @@ static dns_dbmethods_t cache_methods = {
 	NULL,			/* rpz_attach */
 	NULL,			/* rpz_ready */
 	NULL,			/* findnodeext */
-	NULL,			/* findext */
+	cache_findext,
 	setcachestats,
 	hashsize,
 	nodefullname,
 	NULL,			/* getsize */
 	setservestalettl,
 	getservestalettl,
-	NULL
+	NULL,			/* setgluecachestats */
+	addscopedrdataset
 };
 
 isc_result_t
@@ -8892,6 +9229,11 @@ rdatasetiter_first(dns_rdatasetiter_t *iterator) {
 
 	for (header = rbtnode->data; header != NULL; header = top_next) {
 		top_next = header->next;
+		/*
+		 * Answers scoped to client subnets are not iterated.
+		 */
+		if (SCOPED(header))
+			continue;
 		do {
 			if (header->serial <= serial && !IGNORE(header)) {
 				/*
@@ -8966,7 +9308,9 @@ rdatasetiter_next(dns_rdatasetiter_t *iterator) {
 		/*
 		 * If not walking back up the down list.
 		 */
-		if (header->type != type && header->type != negtype) {
+		if (header->type != type && header->type != negtype &&
+		    !SCOPED(header))
+		{
 			do {
 				if (header->serial <= serial &&
 				    !IGNORE(header)) {
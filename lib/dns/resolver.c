@@ -18,6 +18,7 @@
 #include <stdbool.h>
 
 #include <isc/counter.h>
+#include <isc/histo.h>
 #include <isc/log.h>
 #include <isc/platform.h>
 #include <isc/print.h>
@@ -43,6 +44,7 @@
 #include <dns/dispatch.h>
 #include <dns/dnstap.h>
 #include <dns/ds.h>
+#include <dns/ecs.h>
 #include <dns/edns.h>
 #include <dns/events.h>
 #include <dns/forward.h>
@@ -269,6 +271,11 @@ struct fetchctx {
 	char *				info;
 	isc_mem_t *			mctx;
 	isc_stdtime_t			now;
+	/*%
+	 * Client subnet sent upstream; 'ecs.scope' is the scope of the
+	 * last response, which is set under task serialization.
+	 */
+	dns_ecs_t			ecs;
 
 	/*% Locked by appropriate bucket lock. */
 	fetchstate			state;
@@ -834,6 +841,15 @@ dec_stats(dns_resolver_t *res, isc_statscounter_t counter) {
 		isc_stats_decrement(res->view->resstats, counter);
 }
 
+/*%
+ * Record a resolver latency sample, in microseconds.
+ */
+static inline void
+add_latency(dns_resolver_t *res, int id, uint64_t usec) {
+	if (res->view->latency != NULL)
+		isc_histo_add(res->view->latency, id, usec);
+}
+
 static isc_result_t
 valcreate(fetchctx_t *fctx, dns_adbaddrinfo_t *addrinfo, dns_name_t *name,
 	  dns_rdatatype_t type, dns_rdataset_t *rdataset,
@@ -1168,6 +1184,7 @@ fctx_cancelquery(resquery_t **queryp, dns_dispatchevent_t **deventp,
 			rtt = (unsigned int)isc_time_microdiff(finish,
 							       &query->start);
 			factor = DNS_ADB_RTTADJDEFAULT;
+			add_latency(fctx->res, dns_latency_rtt, rtt);
 
 			rttms = rtt / 1000;
 			if (rttms < DNS_RESOLVER_QRYRTTCLASS0) {
@@ -1692,6 +1709,7 @@ fctx_done(fetchctx_t *fctx, isc_result_t result, int line) {
 	fctx->state = fetchstate_done;
 	fctx->attributes &= ~FCTX_ATTR_ADDRWAIT;
 	fctx_sendevents(fctx, result, line);
+	add_latency(res, dns_latency_fetch, fctx->duration);
 
 	UNLOCK(&res->buckets[fctx->bucketnum].lock);
 }
@@ -2347,6 +2365,51 @@ wouldvalidate(fetchctx_t *fctx) {
 	return (secure_domain);
 }
 
+/*
+ * Render the CLIENT-SUBNET option data for 'ecs' into 'buf', which
+ * must hold at least 20 octets, and return its length.
+ */
+static uint16_t
+ecs_option(const dns_ecs_t *ecs, unsigned char *buf) {
+	const unsigned char *addr;
+	unsigned int addrlen;
+
+	if (ecs->addr.family == AF_INET) {
+		addr = (const unsigned char *)&ecs->addr.type.in;
+		buf[1] = 1;
+	} else {
+		addr = (const unsigned char *)&ecs->addr.type.in6;
+		buf[1] = 2;
+	}
+	buf[0] = 0;
+	buf[2] = ecs->source;
+	buf[3] = 0;
+
+	addrlen = (ecs->source + 7) / 8;
+	memmove(buf + 4, addr, addrlen);
+	if ((ecs->source % 8) != 0)
+		buf[4 + addrlen - 1] &= (0xff << (8 - ecs->source % 8)) & 0xff;
+
+	return ((uint16_t)(4 + addrlen));
+}
+
+/*
+ * Should the client subnet of 'fctx' be sent to the server that
+ * 'query' is addressed to?
+ */
+static bool
+ecs_sendto(fetchctx_t *fctx, resquery_t *query) {
+	isc_netaddr_t netaddr;
+	dns_view_t *view = fctx->res->view;
+
+	if (fctx->ecs.source == 0 || view->ecsservers == NULL)
+		return (false);
+
+	isc_netaddr_fromsockaddr(&netaddr, &query->addrinfo->sockaddr);
+	return (dns_acl_allowed(&netaddr, NULL, view->ecsservers,
+				&view->aclenv));
+}
+
 static isc_result_t
 resquery_send(resquery_t *query) {
 	fetchctx_t *fctx;
@@ -2370,6 +2433,7 @@ resquery_send(resquery_t *query) {
 	bool tcp = (query->options & DNS_FETCHOPT_TCP);
 	dns_ednsopt_t ednsopts[DNS_EDNSOPTIONS];
 	unsigned ednsopt = 0;
+	unsigned char ecsbuf[20];
 	uint16_t hint = 0, udpsize = 0;	/* No EDNS */
 #ifdef HAVE_DNSTAP
 	isc_sockaddr_t localaddr, *la = NULL;
@@ -2650,6 +2714,17 @@ resquery_send(resquery_t *query) {
 				ednsopt++;
 			}
 
+			/* Add CLIENT-SUBNET for client subnet fetches */
+			if (ecs_sendto(fctx, query)) {
+				INSIST(ednsopt < DNS_EDNSOPTIONS);
+				ednsopts[ednsopt].code =
+					DNS_OPT_CLIENT_SUBNET;
+				ednsopts[ednsopt].length =
+					ecs_option(&fctx->ecs, ecsbuf);
+				ednsopts[ednsopt].value = ecsbuf;
+				ednsopt++;
+			}
+
 			/* Add TCP keepalive option if appropriate */
 			if ((peer != NULL) && tcp)
 				(void) dns_peer_gettcpkeepalive(peer,
@@ -4489,7 +4564,8 @@ log_ns_ttl(fetchctx_t *fctx, const char *where) {
 static isc_result_t
 fctx_create(dns_resolver_t *res, const dns_name_t *name, dns_rdatatype_t type,
 	    const dns_name_t *domain, dns_rdataset_t *nameservers,
-	    unsigned int options, unsigned int bucketnum, unsigned int depth,
+	    const dns_ecs_t *ecs, unsigned int options,
+	    unsigned int bucketnum, unsigned int depth,
 	    isc_counter_t *qc, fetchctx_t **fctxp)
 {
 	fetchctx_t *fctx;
@@ -4551,6 +4627,11 @@ fctx_create(dns_resolver_t *res, const dns_name_t *name, dns_rdatatype_t type,
 	fctx->fulltype = type;
 	fctx->type = type;
 	fctx->options = options;
+	dns_ecs_init(&fctx->ecs);
+	if (ecs != NULL && ecs->source != 0) {
+		fctx->ecs.addr = ecs->addr;
+		fctx->ecs.source = ecs->source;
+	}
 	/*
 	 * Note!  We do not attach to the task.  We are relying on the
 	 * resolver to ensure that this task doesn't go away while we are
@@ -5079,6 +5160,30 @@ maybe_destroy(fetchctx_t *fctx, bool locked) {
 	return (bucket_empty);
 }
 
+/*
+ * Cache the unsigned answer 'rdataset' for 'fctx'.  If the server
+ * returned a non-zero client subnet scope the answer is cached for
+ * that subnet only; answers that cannot be cached with a scope (for
+ * example negative answers) are cached for all clients.
+ */
+static isc_result_t
+cache_answer(fetchctx_t *fctx, dns_dbnode_t *node, isc_stdtime_t now,
+	     dns_rdataset_t *rdataset, unsigned int options,
+	     dns_rdataset_t *addedrdataset)
+{
+	isc_result_t result;
+
+	if (fctx->ecs.scope != 0) {
+		result = dns_db_addscopedrdataset(fctx->cache, node, now,
+						  rdataset, options,
+						  &fctx->ecs, addedrdataset);
+		if (result != ISC_R_NOTIMPLEMENTED)
+			return (result);
+	}
+	return (dns_db_addrdataset(fctx->cache, node, NULL, now, rdataset,
+				   options, addedrdataset));
+}
+
 /*
  * The validator has finished.
  */
@@ -5361,8 +5466,13 @@ validated(isc_task_t *task, isc_event_t *event) {
 	options = 0;
 	if ((fctx->options & DNS_FETCHOPT_PREFETCH) != 0)
 		options = DNS_DBADD_PREFETCH;
-	result = dns_db_addrdataset(fctx->cache, node, NULL, now,
-				    vevent->rdataset, options, ardataset);
+	if (vevent->sigrdataset == NULL)
+		result = cache_answer(fctx, node, now, vevent->rdataset,
+				      options, ardataset);
+	else
+		result = dns_db_addrdataset(fctx->cache, node, NULL, now,
+					    vevent->rdataset, options,
+					    ardataset);
 	if (result != ISC_R_SUCCESS &&
 	    result != DNS_R_UNCHANGED)
 		goto noanswer_response;
@@ -6076,11 +6186,17 @@ cache_name(fetchctx_t *fctx, dns_name_t *name, dns_adbaddrinfo_t *addrinfo,
 			/*
 			 * Now we can add the rdataset.
 			 */
-			result = dns_db_addrdataset(fctx->cache,
-						    node, NULL, now,
-						    rdataset,
-						    options,
-						    addedrdataset);
+			if (ANSWER(rdataset) && sigrdataset == NULL) {
+				result = cache_answer(fctx, node, now,
+						      rdataset, options,
+						      addedrdataset);
+			} else {
+				result = dns_db_addrdataset(fctx->cache,
+							    node, NULL, now,
+							    rdataset,
+							    options,
+							    addedrdataset);
+			}
 
 			if (result == DNS_R_UNCHANGED) {
 				if (ANSWER(rdataset) &&
@@ -6909,7 +7025,8 @@ resume_dslookup(isc_task_t *task, isc_event_t *event) {
 		result = dns_resolver_createfetch(fctx->res, &fctx->nsname,
 						  dns_rdatatype_ns, domain,
 						  nsrdataset, NULL, NULL, 0,
-						  fctx->options, 0, NULL, task,
+						  NULL, fctx->options, 0,
+						  NULL, task,
 						  resume_dslookup, fctx,
 						  &fctx->nsrrset, NULL,
 						  &fctx->nsfetch);
@@ -7168,6 +7285,7 @@ resquery_response(isc_task_t *task, isc_event_t *event) {
 	 * Process receive opt record.
 	 */
 	rctx.opt = dns_message_getopt(fctx->rmessage);
+	fctx->ecs.scope = 0;
 	if (rctx.opt != NULL) {
 		rctx_opt(&rctx);
 	}
@@ -7563,7 +7681,8 @@ rctx_parse(respctx_t *rctx) {
 	fetchctx_t *fctx = rctx->fctx;
 	resquery_t *query = rctx->query;
 
-	result = dns_message_parse(fctx->rmessage, &rctx->devent->buffer, 0);
+	result = dns_message_parse(fctx->rmessage, &rctx->devent->buffer,
+				   DNS_MESSAGEPARSE_ARENA);
 	if (result == ISC_R_SUCCESS) {
 		return (ISC_R_SUCCESS);
 	}
@@ -7641,6 +7760,45 @@ rctx_parse(respctx_t *rctx) {
 	return (ISC_R_COMPLETE);
 }
 
+/*
+ * Return the scope prefix length with which an answer to the client
+ * subnet query 'fctx' may be cached, given the CLIENT-SUBNET option
+ * data 'value' of length 'len' returned by the server.  If the option
+ * does not echo the family, source prefix length and address we sent,
+ * the answer is treated as applying to the source prefix only.
+ */
+static uint8_t
+ecs_scope(fetchctx_t *fctx, const unsigned char *value, uint16_t len) {
+	const unsigned char *addr;
+	unsigned int family, source, scope, addrlen, i;
+
+	if (fctx->ecs.addr.family == AF_INET) {
+		addr = (const unsigned char *)&fctx->ecs.addr.type.in;
+		family = 1;
+	} else {
+		addr = (const unsigned char *)&fctx->ecs.addr.type.in6;
+		family = 2;
+	}
+	source = fctx->ecs.source;
+	addrlen = (source + 7) / 8;
+
+	if (len != 4 + addrlen || value[0] != 0 || value[1] != family ||
+	    value[2] != source)
+	{
+		return (source);
+	}
+	for (i = 0; i < addrlen; i++) {
+		unsigned char mask = 0xff;
+		if (i == addrlen - 1 && (source % 8) != 0)
+			mask = (0xff << (8 - source % 8)) & 0xff;
+		if ((value[4 + i] & mask) != (addr[i] & mask))
+			return (source);
+	}
+
+	scope = value[3];
+	return (scope > source ? source : scope);
+}
+
 /*
  * rctx_opt():
  * Process the OPT record in the response.
@@ -7659,6 +7817,7 @@ rctx_opt(respctx_t *rctx) {
 	unsigned char cookie[8];
 	bool seen_cookie = false;
 	bool seen_nsid = false;
+	bool seen_ecs = false;
 
 	result = dns_rdataset_first(rctx->opt);
 	if (result == ISC_R_SUCCESS) {
@@ -7711,6 +7870,16 @@ rctx_opt(respctx_t *rctx) {
 					  dns_resstatscounter_cookiein);
 				seen_cookie = true;
 				break;
+			case DNS_OPT_CLIENT_SUBNET:
+				if (!seen_ecs && ecs_sendto(fctx, query)) {
+					optvalue = isc_buffer_current(&optbuf);
+					fctx->ecs.scope =
+						ecs_scope(fctx, optvalue,
+							  optlen);
+				}
+				isc_buffer_forward(&optbuf, optlen);
+				seen_ecs = true;
+				break;
 			default:
 				isc_buffer_forward(&optbuf, optlen);
 				break;
@@ -9237,7 +9406,7 @@ rctx_chaseds(respctx_t *rctx, dns_adbaddrinfo_t *addrinfo, isc_result_t result)
 
 	result = dns_resolver_createfetch(fctx->res, &fctx->nsname,
 					  dns_rdatatype_ns,
-					  NULL, NULL, NULL, NULL, 0,
+					  NULL, NULL, NULL, NULL, 0, NULL,
 					  fctx->options, 0, NULL, rctx->task,
 					  resume_dslookup, fctx,
 					  &fctx->nsrrset, NULL,
@@ -10108,8 +10277,8 @@ dns_resolver_prime(dns_resolver_t *res) {
 		LOCK(&res->primelock);
 		result = dns_resolver_createfetch(res, dns_rootname,
 						  dns_rdatatype_ns,
-						  NULL, NULL, NULL, NULL, 0, 0,
-						  0, NULL,
+						  NULL, NULL, NULL, NULL, 0,
+						  NULL, 0, 0, NULL,
 						  res->buckets[0].task,
 						  prime_done,
 						  res, rdataset, NULL,
@@ -10263,7 +10432,7 @@ dns_resolver_detach(dns_resolver_t **resp) {
 
 static inline bool
 fctx_match(fetchctx_t *fctx, const dns_name_t *name, dns_rdatatype_t type,
-	   unsigned int options)
+	   const dns_ecs_t *ecs, unsigned int options)
 {
 	/*
 	 * Don't match fetch contexts that are shutting down.
@@ -10274,6 +10443,15 @@ fctx_match(fetchctx_t *fctx, const dns_name_t *name, dns_rdatatype_t type,
 
 	if (fctx->fulltype != type || fctx->options != options)
 		return (false);
+	/*
+	 * Answers for different client subnets may differ.
+	 */
+	if (ecs != NULL && ecs->source != 0) {
+		if (!dns_ecs_equals(&fctx->ecs, ecs))
+			return (false);
+	} else if (fctx->ecs.source != 0) {
+		return (false);
+	}
 	return (dns_name_equal(&fctx->fullname, name));
 }
 
@@ -10365,6 +10543,7 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
 			 const dns_name_t *domain, dns_rdataset_t *nameservers,
 			 dns_forwarders_t *forwarders,
 			 const isc_sockaddr_t *client, dns_messageid_t id,
+			 const dns_ecs_t *ecs,
 			 unsigned int options, unsigned int depth,
 			 isc_counter_t *qc, isc_task_t *task,
 			 isc_taskaction_t action, void *arg,
@@ -10394,6 +10573,9 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
 	} else
 		REQUIRE(nameservers == NULL);
 	REQUIRE(forwarders == NULL);
+	REQUIRE(ecs == NULL || ecs->source == 0 ||
+		(ecs->addr.family == AF_INET && ecs->source <= 32) ||
+		(ecs->addr.family == AF_INET6 && ecs->source <= 128));
 	REQUIRE(!dns_rdataset_isassociated(rdataset));
 	REQUIRE(sigrdataset == NULL ||
 		!dns_rdataset_isassociated(sigrdataset));
@@ -10427,7 +10609,7 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
 		for (fctx = ISC_LIST_HEAD(res->buckets[bucketnum].fctxs);
 		     fctx != NULL;
 		     fctx = ISC_LIST_NEXT(fctx, link)) {
-			if (fctx_match(fctx, name, type, options))
+			if (fctx_match(fctx, name, type, ecs, options))
 				break;
 		}
 	}
@@ -10460,7 +10642,8 @@ dns_resolver_createfetch(dns_resolver_t *res, const dns_name_t *name,
 
 	if (fctx == NULL) {
 		result = fctx_create(res, name, type, domain, nameservers,
-				     options, bucketnum, depth, qc, &fctx);
+				     ecs, options, bucketnum, depth, qc,
+				     &fctx);
 		if (result != ISC_R_SUCCESS)
 			goto unlock;
 		new_fctx = true;
@@ -25,6 +25,7 @@
 #include <isc/stdlib.h>
 #include <isc/string.h>
 #include <isc/task.h>
+#include <isc/thread.h>
 #include <isc/util.h>
 
 #include <dns/db.h>
@@ -94,12 +95,32 @@
  */
 #define DNS_RPZ_QUANTUM 1024
 
+/*
+ * Maximum number of summary database changes made per acquisition of
+ * the search lock.  The lock is released between batches so that
+ * searches are not held up for a whole quantum.
+ */
+#define DNS_RPZ_LOCKBATCH 32
+
 static void
 dns_rpz_update_from_db(dns_rpz_zone_t *rpz);
 
 static void
 dns_rpz_update_taskaction(isc_task_t *task, isc_event_t *event);
 
+static isc_result_t
+add_trigger(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
+	    const dns_name_t *src_name);
+
+static void
+del_trigger(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
+	    const dns_name_t *src_name);
+
+static isc_result_t
+compile_trigger(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
+		const dns_name_t *src_name, dns_rpz_policy_t policy,
+		dns_ttl_t ttl);
+
 /*
  * Use a private definition of IPv6 addresses because s6_addr32 is not
  * always defined and our IPv6 addresses are in non-standard byte order
@@ -160,15 +181,31 @@ struct dns_rpz_nm_zbits {
 	dns_rpz_zbits_t		ns;
 };
 
+/*
+ * The compiled policy of an exact (not wildcard) QNAME or NSDNAME trigger.
+ * It is kept for the lowest numbered policy zone whose policy record for
+ * the trigger needs nothing more from the policy zone than its SOA,
+ * so that a hit in that zone need not search the zone again.
+ */
+typedef struct dns_rpz_nm_policy dns_rpz_nm_policy_t;
+struct dns_rpz_nm_policy {
+	dns_rpz_num_t		num;	/* DNS_RPZ_INVALID_NUM if none */
+	uint8_t			policy;	/* dns_rpz_policy_t */
+	dns_ttl_t		ttl;
+};
+
 /*
  * The data in a RBT node has two pairs of bits for policy zones.
  * One pair is for the corresponding name of the node such as example.com
  * and the other pair is for a wildcard child such as *.example.com.
+ * The node also carries the compiled policies of its exact triggers.
  */
 typedef struct dns_rpz_nm_data dns_rpz_nm_data_t;
 struct dns_rpz_nm_data {
 	dns_rpz_nm_zbits_t	set;
 	dns_rpz_nm_zbits_t	wild;
+	dns_rpz_nm_policy_t	qname;
+	dns_rpz_nm_policy_t	ns;
 };
 
 #if 0
@@ -1019,6 +1056,9 @@ name2data(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
 		n -= dns_name_countlabels(&rpz->nsdname);
 	dns_name_getlabelsequence(src_name, prefix_len, n, &tmp_name);
 	(void)dns_name_concatenate(&tmp_name, dns_rootname, trig_name, NULL);
+
+	new_data->qname.num = DNS_RPZ_INVALID_NUM;
+	new_data->ns.num = DNS_RPZ_INVALID_NUM;
 }
 
 #ifndef HAVE_BUILTIN_CLZ
@@ -1757,19 +1797,46 @@ setup_update(dns_rpz_zone_t *rpz) {
 	return (result);
 }
 
+/*
+ * Remove names of nodes that are gone from the summary database,
+ * DNS_RPZ_LOCKBATCH of them per acquisition of the summary lock.
+ */
+static void
+delete_names(dns_rpz_zone_t *rpz, dns_fixedname_t *names,
+	     unsigned int count)
+{
+	unsigned int i, end;
+
+	for (i = 0; i < count; i = end) {
+		if (i != 0)
+			isc_thread_yield();
+		end = ISC_MIN(i + DNS_RPZ_LOCKBATCH, count);
+		RWLOCK(&rpz->rpzs->search_lock, isc_rwlocktype_write);
+		for (; i < end; i++)
+			del_trigger(rpz->rpzs, rpz->num,
+				    dns_fixedname_name(&names[i]));
+		RWUNLOCK(&rpz->rpzs->search_lock, isc_rwlocktype_write);
+	}
+}
+
 static void
 finish_update(dns_rpz_zone_t *rpz) {
 	isc_result_t result;
 	isc_ht_t *tmpht = NULL;
 	isc_ht_iter_t *iter = NULL;
 	dns_fixedname_t fname;
+	dns_fixedname_t *names;
+	unsigned int count = 0;
 	char dname[DNS_NAME_FORMATSIZE];
 	dns_name_t *name;
 
 	/*
 	 * Iterate over old ht with existing nodes deleted to delete
-	 * deleted nodes from RPZ
+	 * deleted nodes from RPZ, DNS_RPZ_QUANTUM of them at a time.
 	 */
+	names = isc_mem_get(rpz->rpzs->mctx,
+			    DNS_RPZ_QUANTUM * sizeof(*names));
+
 	result = isc_ht_iter_create(rpz->nodes, &iter);
 	if (result != ISC_R_SUCCESS) {
 		char domain[DNS_NAME_FORMATSIZE];
@@ -1796,8 +1863,19 @@ finish_update(dns_rpz_zone_t *rpz) {
 		region.base = key;
 		region.length = (unsigned int)keysize;
 		dns_name_fromregion(name, &region);
-		dns_rpz_delete(rpz->rpzs, rpz->num, name);
+		if (names == NULL) {
+			dns_rpz_delete(rpz->rpzs, rpz->num, name);
+			continue;
+		}
+		dns_name_copy(name, dns_fixedname_initname(&names[count]),
+			      NULL);
+		if (++count == DNS_RPZ_QUANTUM) {
+			delete_names(rpz, names, count);
+			count = 0;
+		}
 	}
+	if (names != NULL)
+		delete_names(rpz, names, count);
 
 	tmpht = rpz->nodes;
 	rpz->nodes = rpz->newnodes;
@@ -1827,6 +1905,98 @@ finish_update(dns_rpz_zone_t *rpz) {
 cleanup:
 	if (iter != NULL)
 		isc_ht_iter_destroy(&iter);
+	if (names != NULL)
+		isc_mem_put(rpz->rpzs->mctx, names,
+			    DNS_RPZ_QUANTUM * sizeof(*names));
+}
+
+/*
+ * A change to the summary database found while loading a policy zone.
+ * The changes found in a quantum are applied after the walk of the
+ * policy zone is paused, DNS_RPZ_LOCKBATCH of them per acquisition of
+ * the summary database lock instead of one per node.
+ */
+typedef struct rpz_change rpz_change_t;
+struct rpz_change {
+	dns_fixedname_t		name;
+	bool			add;	/* not in the previous version */
+	dns_rpz_policy_t	policy;
+	dns_ttl_t		ttl;
+};
+
+/*
+ * Get the policy of a node of the policy zone being loaded for
+ * compile_trigger().  The policy of nodes that were already present is
+ * refreshed as well, because their records might have changed.
+ */
+static void
+node_policy(dns_rpz_zone_t *rpz, dns_dbnode_t *node, rpz_change_t *change) {
+	dns_rdataset_t rdataset;
+	isc_result_t result;
+
+	change->policy = DNS_RPZ_POLICY_RECORD;
+	change->ttl = 0;
+	dns_rdataset_init(&rdataset);
+	result = dns_db_findrdataset(rpz->updb, node, rpz->updbversion,
+				     dns_rdatatype_cname, 0, 0,
+				     &rdataset, NULL);
+	if (result == ISC_R_SUCCESS) {
+		change->policy = dns_rpz_decode_cname(rpz, &rdataset, NULL);
+		change->ttl = rdataset.ttl;
+		dns_rdataset_disassociate(&rdataset);
+	}
+}
+
+static void
+apply_changes(dns_rpz_zone_t *rpz, rpz_change_t *changes,
+	      unsigned int count, const char *domain)
+{
+	dns_rpz_zones_t *rpzs = rpz->rpzs;
+	isc_result_t results[DNS_RPZ_QUANTUM];
+	char namebuf[DNS_NAME_FORMATSIZE];
+	dns_name_t *name;
+	unsigned int i, end;
+
+	REQUIRE(count <= DNS_RPZ_QUANTUM);
+
+	for (i = 0; i < count; i = end) {
+		if (i != 0)
+			isc_thread_yield();
+		end = ISC_MIN(i + DNS_RPZ_LOCKBATCH, count);
+		RWLOCK(&rpzs->search_lock, isc_rwlocktype_write);
+		for (; i < end; i++) {
+			name = dns_fixedname_name(&changes[i].name);
+			results[i] = ISC_R_SUCCESS;
+			if (changes[i].add)
+				results[i] = add_trigger(rpzs, rpz->num, name);
+			if (results[i] == ISC_R_SUCCESS)
+				(void)compile_trigger(rpzs, rpz->num, name,
+						      changes[i].policy,
+						      changes[i].ttl);
+		}
+		RWUNLOCK(&rpzs->search_lock, isc_rwlocktype_write);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!changes[i].add)
+			continue;
+		name = dns_fixedname_name(&changes[i].name);
+		if (results[i] != ISC_R_SUCCESS) {
+			dns_name_format(name, namebuf, sizeof(namebuf));
+			isc_log_write(dns_lctx, DNS_LOGCATEGORY_GENERAL,
+				      DNS_LOGMODULE_MASTER, ISC_LOG_ERROR,
+				      "rpz: %s: adding node %s "
+				      "to RPZ error %s",
+				      domain, namebuf,
+				      isc_result_totext(results[i]));
+		} else if (isc_log_wouldlog(dns_lctx, ISC_LOG_DEBUG(3))) {
+			dns_name_format(name, namebuf, sizeof(namebuf));
+			isc_log_write(dns_lctx, DNS_LOGCATEGORY_GENERAL,
+				      DNS_LOGMODULE_MASTER, ISC_LOG_DEBUG(3),
+				      "rpz: %s: adding node %s",
+				      domain, namebuf);
+		}
+	}
 }
 
 static void
@@ -1837,6 +2007,8 @@ update_quantum(isc_task_t *task, isc_event_t *event) {
 	char domain[DNS_NAME_FORMATSIZE];
 	dns_fixedname_t fixname;
 	dns_name_t *name;
+	rpz_change_t *changes;
+	unsigned int nchanges = 0;
 	int count = 0;
 
 	UNUSED(task);
@@ -1854,9 +2026,20 @@ update_quantum(isc_task_t *task, isc_event_t *event) {
 
 	dns_name_format(&rpz->origin, domain, DNS_NAME_FORMATSIZE);
 
+	changes = isc_mem_get(rpz->rpzs->mctx,
+			      DNS_RPZ_QUANTUM * sizeof(*changes));
+	if (changes == NULL) {
+		isc_log_write(dns_lctx, DNS_LOGCATEGORY_GENERAL,
+			      DNS_LOGMODULE_MASTER, ISC_LOG_ERROR,
+			      "rpz: %s: failed to allocate changes - %s",
+			      domain, isc_result_totext(ISC_R_NOMEMORY));
+		result = ISC_R_NOMEMORY;
+	}
+
 	while (result == ISC_R_SUCCESS && count++ < DNS_RPZ_QUANTUM) {
 		char namebuf[DNS_NAME_FORMATSIZE];
 		dns_rdatasetiter_t *rdsiter = NULL;
+		rpz_change_t *change;
 
 		result = dns_dbiterator_current(rpz->updbit, &node, name);
 		if (result != ISC_R_SUCCESS) {
@@ -1908,43 +2091,36 @@ update_quantum(isc_task_t *task, isc_event_t *event) {
 			continue;
 		}
 
+		change = &changes[nchanges++];
+		dns_name_copy(name, dns_fixedname_initname(&change->name),
+			      NULL);
 		result = isc_ht_find(rpz->nodes, name->ndata,
 				     name->length, NULL);
 		if (result == ISC_R_SUCCESS) {
 			isc_ht_delete(rpz->nodes, name->ndata, name->length);
+			change->add = false;
 		} else { /* not found */
-			result = dns_rpz_add(rpz->rpzs, rpz->num, name);
-			if (result != ISC_R_SUCCESS) {
-				dns_name_format(name, namebuf, sizeof(namebuf));
-				isc_log_write(dns_lctx,
-					      DNS_LOGCATEGORY_GENERAL,
-					      DNS_LOGMODULE_MASTER,
-					      ISC_LOG_ERROR,
-					      "rpz: %s: adding node %s "
-					      "to RPZ error %s",
-					      domain, namebuf,
-					      isc_result_totext(result));
-			} else {
-				dns_name_format(name, namebuf, sizeof(namebuf));
-				isc_log_write(dns_lctx,
-					      DNS_LOGCATEGORY_GENERAL,
-					      DNS_LOGMODULE_MASTER,
-					      ISC_LOG_DEBUG(3),
-					      "rpz: %s: adding node %s",
-					      domain, namebuf);
-			}
+			change->add = true;
 		}
+		node_policy(rpz, node, change);
 
 		dns_db_detachnode(rpz->updb, &node);
 		result = dns_dbiterator_next(rpz->updbit);
 	}
 
+	/*
+	 * Pause the iterator so that the DB is not locked while
+	 * we wait for the summary database.
+	 */
+	if (changes != NULL) {
+		dns_dbiterator_pause(rpz->updbit);
+		apply_changes(rpz, changes, nchanges, domain);
+		isc_mem_put(rpz->rpzs->mctx, changes,
+			    DNS_RPZ_QUANTUM * sizeof(*changes));
+	}
+
 	if (result == ISC_R_SUCCESS) {
 		isc_event_t *nevent;
-		/*
-		 * Pause the iterator so that the DB is not locked
-		 */
-		dns_dbiterator_pause(rpz->updbit);
 		/*
 		 * We finished a quantum; trigger the next one and return
 		 */
@@ -2188,19 +2364,33 @@ dns_rpz_ready(dns_rpz_zones_t *rpzs,
 isc_result_t
 dns_rpz_add(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
 	    const dns_name_t *src_name)
+{
+	isc_result_t result;
+
+	REQUIRE(rpzs != NULL && rpz_num < rpzs->p.num_zones);
+	REQUIRE(rpzs->zones[rpz_num] != NULL);
+
+	RWLOCK(&rpzs->search_lock, isc_rwlocktype_write);
+	result = add_trigger(rpzs, rpz_num, src_name);
+	RWUNLOCK(&rpzs->search_lock, isc_rwlocktype_write);
+
+	return (result);
+}
+
+/*
+ * Caller must hold rpzs->search_lock for writing.
+ */
+static isc_result_t
+add_trigger(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
+	    const dns_name_t *src_name)
 {
 	dns_rpz_zone_t *rpz;
 	dns_rpz_type_t rpz_type;
 	isc_result_t result = ISC_R_FAILURE;
 
-	REQUIRE(rpzs != NULL && rpz_num < rpzs->p.num_zones);
 	rpz = rpzs->zones[rpz_num];
-	REQUIRE(rpz != NULL);
-	RWLOCK(&rpzs->search_lock, isc_rwlocktype_write);
-
 	rpz_type = type_from_name(rpzs, rpz, src_name);
 
-
 	switch (rpz_type) {
 	case DNS_RPZ_TYPE_QNAME:
 	case DNS_RPZ_TYPE_NSDNAME:
@@ -2214,11 +2404,111 @@ dns_rpz_add(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
 	case DNS_RPZ_TYPE_BAD:
 		break;
 	}
+
+	return (result);
+}
+
+/*
+ * Can a policy be applied without looking at the policy zone again?
+ */
+static bool
+policy_compiles(dns_rpz_policy_t policy) {
+	switch (policy) {
+	case DNS_RPZ_POLICY_PASSTHRU:
+	case DNS_RPZ_POLICY_DROP:
+	case DNS_RPZ_POLICY_TCP_ONLY:
+	case DNS_RPZ_POLICY_NXDOMAIN:
+	case DNS_RPZ_POLICY_NODATA:
+		return (true);
+	default:
+		return (false);
+	}
+}
+
+/*
+ * Record the policy of an exact QNAME or NSDNAME trigger in the summary
+ * database.
+ */
+isc_result_t
+dns_rpz_compile(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
+		const dns_name_t *src_name, dns_rpz_policy_t policy,
+		dns_ttl_t ttl)
+{
+	isc_result_t result;
+
+	REQUIRE(rpzs != NULL && rpz_num < rpzs->p.num_zones);
+	REQUIRE(rpzs->zones[rpz_num] != NULL);
+
+	RWLOCK(&rpzs->search_lock, isc_rwlocktype_write);
+	result = compile_trigger(rpzs, rpz_num, src_name, policy, ttl);
 	RWUNLOCK(&rpzs->search_lock, isc_rwlocktype_write);
 
 	return (result);
 }
 
+/*
+ * Caller must hold rpzs->search_lock for writing.
+ */
+static isc_result_t
+compile_trigger(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
+		const dns_name_t *src_name, dns_rpz_policy_t policy,
+		dns_ttl_t ttl)
+{
+	dns_rpz_zone_t *rpz;
+	dns_rpz_type_t rpz_type;
+	dns_rpz_nm_data_t *nm_data, tmp_data;
+	dns_rpz_nm_policy_t *nm_policy;
+	dns_rpz_zbits_t zbits;
+	dns_fixedname_t trig_namef;
+	dns_name_t *trig_name;
+	dns_rbtnode_t *nmnode;
+	isc_result_t result;
+
+	rpz = rpzs->zones[rpz_num];
+	rpz_type = type_from_name(rpzs, rpz, src_name);
+	if ((rpz_type != DNS_RPZ_TYPE_QNAME &&
+	     rpz_type != DNS_RPZ_TYPE_NSDNAME) ||
+	    dns_name_iswildcard(src_name))
+		return (ISC_R_SUCCESS);
+
+	trig_name = dns_fixedname_initname(&trig_namef);
+	name2data(rpzs, rpz_num, rpz_type, src_name, trig_name, &tmp_data);
+
+	nmnode = NULL;
+	result = dns_rbt_findnode(rpzs->rbt, trig_name, NULL, &nmnode, NULL, 0,
+				  NULL, NULL);
+	if (result == DNS_R_PARTIALMATCH)
+		return (ISC_R_NOTFOUND);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+
+	nm_data = nmnode->data;
+	if (nm_data == NULL)
+		return (ISC_R_NOTFOUND);
+	if (rpz_type == DNS_RPZ_TYPE_QNAME) {
+		zbits = nm_data->set.qname;
+		nm_policy = &nm_data->qname;
+	} else {
+		zbits = nm_data->set.ns;
+		nm_policy = &nm_data->ns;
+	}
+	if ((zbits & DNS_RPZ_ZBIT(rpz_num)) == 0)
+		return (ISC_R_NOTFOUND);
+
+	if (!policy_compiles(policy)) {
+		if (nm_policy->num == rpz_num)
+			nm_policy->num = DNS_RPZ_INVALID_NUM;
+	} else if (nm_policy->num == DNS_RPZ_INVALID_NUM ||
+		   nm_policy->num >= rpz_num)
+	{
+		nm_policy->num = rpz_num;
+		nm_policy->policy = (uint8_t)policy;
+		nm_policy->ttl = ttl;
+	}
+
+	return (ISC_R_SUCCESS);
+}
+
 /*
  * Remove an IP address from the radix tree.
  */
@@ -2371,6 +2661,16 @@ del_name(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
 	nm_data->wild.qname &= ~del_data.wild.qname;
 	nm_data->wild.ns &= ~del_data.wild.ns;
 
+	/*
+	 * Forget compiled policies of triggers that are gone.
+	 */
+	if (nm_data->qname.num != DNS_RPZ_INVALID_NUM &&
+	    (nm_data->set.qname & DNS_RPZ_ZBIT(nm_data->qname.num)) == 0)
+		nm_data->qname.num = DNS_RPZ_INVALID_NUM;
+	if (nm_data->ns.num != DNS_RPZ_INVALID_NUM &&
+	    (nm_data->set.ns & DNS_RPZ_ZBIT(nm_data->ns.num)) == 0)
+		nm_data->ns.num = DNS_RPZ_INVALID_NUM;
+
 	if (nm_data->set.qname == 0 && nm_data->set.ns == 0 &&
 	    nm_data->wild.qname == 0 && nm_data->wild.ns == 0) {
 		result = dns_rbt_deletenode(rpzs->rbt, nmnode, false);
@@ -2398,15 +2698,25 @@ void
 dns_rpz_delete(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
 	       const dns_name_t *src_name)
 {
-	dns_rpz_zone_t *rpz;
-	dns_rpz_type_t rpz_type;
-
 	REQUIRE(rpzs != NULL && rpz_num < rpzs->p.num_zones);
-	rpz = rpzs->zones[rpz_num];
-	REQUIRE(rpz != NULL);
+	REQUIRE(rpzs->zones[rpz_num] != NULL);
 
 	RWLOCK(&rpzs->search_lock, isc_rwlocktype_write);
+	del_trigger(rpzs, rpz_num, src_name);
+	RWUNLOCK(&rpzs->search_lock, isc_rwlocktype_write);
+}
+
+/*
+ * Caller must hold rpzs->search_lock for writing.
+ */
+static void
+del_trigger(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
+	    const dns_name_t *src_name)
+{
+	dns_rpz_zone_t *rpz;
+	dns_rpz_type_t rpz_type;
 
+	rpz = rpzs->zones[rpz_num];
 	rpz_type = type_from_name(rpzs, rpz, src_name);
 
 	switch (rpz_type) {
@@ -2422,8 +2732,6 @@ dns_rpz_delete(dns_rpz_zones_t *rpzs, dns_rpz_num_t rpz_num,
 	case DNS_RPZ_TYPE_BAD:
 		break;
 	}
-
-	RWUNLOCK(&rpzs->search_lock, isc_rwlocktype_write);
 }
 
 /*
@@ -2558,17 +2866,39 @@ dns_rpz_find_ip(dns_rpz_zones_t *rpzs, dns_rpz_type_t rpz_type,
 dns_rpz_zbits_t
 dns_rpz_find_name(dns_rpz_zones_t *rpzs, dns_rpz_type_t rpz_type,
 		  dns_rpz_zbits_t zbits, dns_name_t *trig_name)
+{
+	return (dns_rpz_find_policy(rpzs, rpz_type, zbits, trig_name,
+				    NULL, NULL, NULL));
+}
+
+/*
+ * Search the summary radix tree for policy zones with triggers matching
+ * a name, and get the compiled policy of the trigger in the first of
+ * those zones if there is one.
+ */
+dns_rpz_zbits_t
+dns_rpz_find_policy(dns_rpz_zones_t *rpzs, dns_rpz_type_t rpz_type,
+		    dns_rpz_zbits_t zbits, dns_name_t *trig_name,
+		    dns_rpz_num_t *rpz_nump, dns_rpz_policy_t *policyp,
+		    dns_ttl_t *ttlp)
 {
 	char namebuf[DNS_NAME_FORMATSIZE];
 	dns_rbtnode_t *nmnode;
 	const dns_rpz_nm_data_t *nm_data;
+	const dns_rpz_nm_policy_t *nm_policy;
 	dns_rpz_zbits_t found_zbits;
 	isc_result_t result;
 
+	REQUIRE(rpz_nump == NULL || (policyp != NULL && ttlp != NULL));
+
+	if (rpz_nump != NULL)
+		*rpz_nump = DNS_RPZ_INVALID_NUM;
+
 	if (zbits == 0)
 		return (0);
 
 	found_zbits = 0;
+	nm_policy = NULL;
 
 	RWLOCK(&rpzs->search_lock, isc_rwlocktype_read);
 
@@ -2579,10 +2909,13 @@ dns_rpz_find_name(dns_rpz_zones_t *rpzs, dns_rpz_type_t rpz_type,
 	case ISC_R_SUCCESS:
 		nm_data = nmnode->data;
 		if (nm_data != NULL) {
-			if (rpz_type == DNS_RPZ_TYPE_QNAME)
+			if (rpz_type == DNS_RPZ_TYPE_QNAME) {
 				found_zbits = nm_data->set.qname;
-			else
+				nm_policy = &nm_data->qname;
+			} else {
 				found_zbits = nm_data->set.ns;
+				nm_policy = &nm_data->ns;
+			}
 		}
 		nmnode = nmnode->parent;
 		/* fall thru */
@@ -2614,8 +2947,24 @@ dns_rpz_find_name(dns_rpz_zones_t *rpzs, dns_rpz_type_t rpz_type,
 		break;
 	}
 
+	/*
+	 * The exact trigger decides the policy of the first zone with
+	 * a hit, because the policy zone search would find that trigger
+	 * instead of any wildcard.
+	 */
+	found_zbits &= zbits;
+	if (rpz_nump != NULL && nm_policy != NULL &&
+	    nm_policy->num != DNS_RPZ_INVALID_NUM &&
+	    (found_zbits & DNS_RPZ_ZMASK(nm_policy->num)) ==
+	    DNS_RPZ_ZBIT(nm_policy->num))
+	{
+		*rpz_nump = nm_policy->num;
+		*policyp = (dns_rpz_policy_t)nm_policy->policy;
+		*ttlp = nm_policy->ttl;
+	}
+
 	RWUNLOCK(&rpzs->search_lock, isc_rwlocktype_read);
-	return (zbits & found_zbits);
+	return (found_zbits);
 }
 
 /*
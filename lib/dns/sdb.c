@@ -1296,7 +1296,8 @@ static dns_dbmethods_t sdb_methods = {
 	NULL,			/* getsize */
 	NULL,			/* setservestalettl */
 	NULL,			/* getservestalettl */
-	NULL			/* setgluecachestats */
+	NULL,			/* setgluecachestats */
+	NULL			/* addscopedrdataset */
 };
 
 static isc_result_t
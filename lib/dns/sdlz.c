@@ -1335,7 +1335,8 @@ static dns_dbmethods_t sdlzdb_methods = {
 	NULL,			/* getsize */
 	NULL,			/* setservestalettl */
 	NULL,			/* getservestalettl */
-	NULL			/* setgluecachestats */
+	NULL,			/* setgluecachestats */
+	NULL			/* addscopedrdataset */
 };
 
 /*
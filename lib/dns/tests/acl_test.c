@@ -19,9 +19,13 @@
 #include <unistd.h>
 
 #include <isc/print.h>
+#include <isc/random.h>
 #include <isc/string.h>
+#include <isc/time.h>
+#include <isc/util.h>
 
 #include <dns/acl.h>
+#include <dns/name.h>
 #include "dnstest.h"
 
 /*
@@ -116,10 +120,238 @@ ATF_TC_BODY(dns_acl_isinsecure, tc) {
 	dns_test_end();
 }
 
+/*
+ * Return an ACL of 'count' IPv4 /24 prefixes in 10/8, 'pos' deciding
+ * whether they are positive or negative, followed by the elements
+ * "localnets" and "key example.".
+ */
+static dns_acl_t *
+makeacl(unsigned int count, bool (*pos)(unsigned int)) {
+	dns_acl_t *acl = NULL;
+	dns_aclelement_t *de;
+	isc_netaddr_t na;
+	struct in_addr in;
+	isc_result_t result;
+	unsigned int i;
+
+	result = dns_acl_create(mctx, 2, &acl);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < count; i++) {
+		in.s_addr = htonl(0x0a000000 | (i << 8));
+		isc_netaddr_fromin(&na, &in);
+		result = dns_iptable_addprefix(acl->iptable, &na, 24, pos(i));
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+
+	de = &acl->elements[acl->length++];
+	de->type = dns_aclelementtype_localnets;
+	de->negative = false;
+	de->node_num = ++acl->node_count;
+
+	de = &acl->elements[acl->length++];
+	de->type = dns_aclelementtype_keyname;
+	de->negative = false;
+	dns_name_init(&de->keyname, NULL);
+	result = dns_name_dup(dns_rootname, mctx, &de->keyname);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	de->node_num = ++acl->node_count;
+
+	return (acl);
+}
+
+static bool
+evenpos(unsigned int i) {
+	return ((i % 2) == 0);
+}
+
+static int
+match(const char *addr, const dns_name_t *signer, dns_acl_t *acl,
+      dns_aclenv_t *env, const dns_aclelement_t **matchelt)
+{
+	isc_netaddr_t na;
+	struct in_addr in;
+	struct in6_addr in6;
+	isc_result_t result;
+	int m;
+
+	if (inet_pton(AF_INET6, addr, &in6) == 1) {
+		isc_netaddr_fromin6(&na, &in6);
+	} else {
+		ATF_REQUIRE_EQ(inet_pton(AF_INET, addr, &in), 1);
+		isc_netaddr_fromin(&na, &in);
+	}
+
+	result = dns_acl_match(&na, signer, acl, env, &m, matchelt);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	return (m);
+}
+
+ATF_TC(dns_acl_match);
+ATF_TC_HEAD(dns_acl_match, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "check that dns_acl_match() results are cached "
+			  "only as long as they are valid");
+}
+ATF_TC_BODY(dns_acl_match, tc) {
+	const dns_aclelement_t *elt = NULL;
+	dns_acl_t *acl;
+	dns_aclenv_t env;
+	isc_netaddr_t na;
+	struct in_addr in;
+	isc_result_t result;
+	int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_aclenv_init(mctx, &env);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	acl = makeacl(100, evenpos);
+
+	/* Repeated matches, the second one from the cache. */
+	for (i = 0; i < 2; i++) {
+		ATF_CHECK_EQ(match("10.0.0.1", NULL, acl, &env, NULL), 1);
+		ATF_CHECK(match("10.0.1.1", NULL, acl, &env, NULL) < 0);
+		ATF_CHECK_EQ(match("10.0.100.1", NULL, acl, &env, NULL), 0);
+		ATF_CHECK_EQ(match("::ffff:10.0.0.1", NULL, acl, &env, NULL),
+			     0);
+	}
+
+	/* The result depends on the signer, which isn't cached. */
+	ATF_CHECK_EQ(match("10.0.100.1", dns_rootname, acl, &env, NULL),
+		     102);
+	ATF_CHECK_EQ(match("10.0.100.1", NULL, acl, &env, NULL), 0);
+
+	/* Changing the ACL invalidates the cached results. */
+	in.s_addr = htonl(0x0a006400);
+	isc_netaddr_fromin(&na, &in);
+	result = dns_iptable_addprefix(acl->iptable, &na, 24, true);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(match("10.0.100.1", NULL, acl, &env, NULL), 103);
+
+	/* And so does changing the environment. */
+	env.match_mapped = true;
+	ATF_CHECK_EQ(match("::ffff:10.0.0.1", NULL, acl, &env, NULL), 1);
+	env.match_mapped = false;
+	ATF_CHECK_EQ(match("::ffff:10.0.0.1", NULL, acl, &env, NULL), 0);
+
+	in.s_addr = htonl(0xc0000200);
+	isc_netaddr_fromin(&na, &in);
+	ATF_CHECK_EQ(match("192.0.2.1", NULL, acl, &env, NULL), 0);
+	result = dns_iptable_addprefix(env.localnets->iptable, &na, 24, true);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/* The matching element is cached along with the result. */
+	for (i = 0; i < 2; i++) {
+		elt = NULL;
+		ATF_CHECK_EQ(match("192.0.2.1", NULL, acl, &env, &elt), 101);
+		ATF_CHECK_EQ(elt, &acl->elements[0]);
+	}
+	elt = NULL;
+	(void)match("10.0.0.1", NULL, acl, &env, &elt);
+	ATF_CHECK_EQ(elt, NULL);
+
+	dns_acl_detach(&acl);
+	dns_aclenv_destroy(&env);
+
+	dns_test_end();
+}
+
+#ifdef DNS_BENCHMARK_TESTS
+static bool
+allpos(unsigned int i) {
+	UNUSED(i);
+	return (true);
+}
+
+/*
+ * Return the average time in nanoseconds to match one of 'count'
+ * addresses against 'acl'.
+ */
+static double
+timematch(dns_acl_t *acl, dns_aclenv_t *env, isc_netaddr_t *clients,
+	  unsigned int count, bool flush, unsigned int rounds)
+{
+	isc_time_t ts1, ts2;
+	isc_result_t result;
+	unsigned int i;
+	int m;
+
+	result = isc_time_now(&ts1);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (i = 0; i < rounds; i++) {
+		if (flush)
+			dns_acl_flushcache();
+		result = dns_acl_match(&clients[i % count], NULL, acl, env,
+				       &m, NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+	result = isc_time_now(&ts2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	return (isc_time_microdiff(&ts2, &ts1) * 1000.0 / rounds);
+}
+
+ATF_TC(benchmark);
+ATF_TC_HEAD(benchmark, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "Benchmark dns_acl_match() with a large ACL");
+}
+ATF_TC_BODY(benchmark, tc) {
+	static const unsigned int clients[] = { 100, 500, 1000, 100000 };
+	const unsigned int rounds = 1000000;
+	isc_netaddr_t *addrs;
+	struct in_addr in;
+	dns_acl_t *acl;
+	dns_aclenv_t env;
+	isc_result_t result;
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_aclenv_init(mctx, &env);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	acl = makeacl(50000, allpos);
+
+	addrs = isc_mem_get(mctx, 100000 * sizeof(*addrs));
+	ATF_REQUIRE(addrs != NULL);
+	for (i = 0; i < 100000; i++) {
+		in.s_addr = htonl(0x0a000000 | isc_random_uniform(0x1000000));
+		isc_netaddr_fromin(&addrs[i], &in);
+	}
+
+	for (i = 0; i < sizeof(clients) / sizeof(clients[0]); i++) {
+		printf("%6u clients: uncached %6.1f ns/match, "
+		       "cached %6.1f ns/match\n", clients[i],
+		       timematch(acl, &env, addrs, clients[i], true, rounds),
+		       timematch(acl, &env, addrs, clients[i], false, rounds));
+	}
+
+	isc_mem_put(mctx, addrs, 100000 * sizeof(*addrs));
+	dns_acl_detach(&acl);
+	dns_aclenv_destroy(&env);
+
+	dns_test_end();
+}
+#endif /* DNS_BENCHMARK_TESTS */
+
 /*
  * Main
  */
 ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, dns_acl_isinsecure);
+	ATF_TP_ADD_TC(tp, dns_acl_match);
+#ifdef DNS_BENCHMARK_TESTS
+	ATF_TP_ADD_TC(tp, benchmark);
+#endif
 	return (atf_no_error());
 }
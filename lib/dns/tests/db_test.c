@@ -18,8 +18,12 @@
 #include <unistd.h>
 #include <stdlib.h>
 
+#include <arpa/inet.h>
+
+#include <dns/clientinfo.h>
 #include <dns/db.h>
 #include <dns/dbiterator.h>
+#include <dns/ecs.h>
 #include <dns/journal.h>
 #include <dns/name.h>
 #include <dns/rdatalist.h>
@@ -34,6 +38,113 @@
 #define	BIGBUFLEN	(64 * 1024)
 #define TEST_ORIGIN	"test"
 
+static void
+make_ecs(dns_ecs_t *ecs, const char *addr, uint8_t source, uint8_t scope) {
+	struct in_addr in;
+
+	ATF_REQUIRE_EQ(inet_pton(AF_INET, addr, &in), 1);
+	dns_ecs_init(ecs);
+	isc_netaddr_fromin(&ecs->addr, &in);
+	ecs->source = source;
+	ecs->scope = scope;
+}
+
+static isc_result_t
+add_rdata(dns_db_t *db, dns_name_t *name, dns_rdatatype_t type,
+	  unsigned char *data, unsigned int length, dns_trust_t trust,
+	  const dns_ecs_t *ecs)
+{
+	dns_dbnode_t *node = NULL;
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	dns_rdatalist_t rdatalist;
+	dns_rdataset_t rdataset;
+	isc_result_t result;
+
+	rdata.data = data;
+	rdata.length = length;
+	rdata.rdclass = dns_rdataclass_in;
+	rdata.type = type;
+
+	dns_rdatalist_init(&rdatalist);
+	rdatalist.ttl = 300;
+	rdatalist.type = type;
+	rdatalist.rdclass = dns_rdataclass_in;
+	ISC_LIST_APPEND(rdatalist.rdata, &rdata, link);
+
+	dns_rdataset_init(&rdataset);
+	result = dns_rdatalist_tordataset(&rdatalist, &rdataset);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	rdataset.trust = trust;
+
+	result = dns_db_findnode(db, name, true, &node);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_db_addscopedrdataset(db, node, 0, &rdataset, 0, ecs,
+					  NULL);
+	dns_db_detachnode(db, &node);
+	dns_rdataset_disassociate(&rdataset);
+
+	return (result);
+}
+
+static isc_result_t
+add_a(dns_db_t *db, dns_name_t *name, unsigned char last,
+      const dns_ecs_t *ecs)
+{
+	unsigned char data[4] = { 10, 0, 0, 0 };
+
+	data[3] = last;
+	return (add_rdata(db, name, dns_rdatatype_a, data, sizeof(data),
+			  dns_trust_none, ecs));
+}
+
+/*
+ * Look up the A record of 'name' on behalf of 'ecs', leaving the
+ * answer in 'rdataset'.
+ */
+static isc_result_t
+find_rdataset(dns_db_t *db, dns_name_t *name, dns_ecs_t *ecs,
+	      dns_rdataset_t *rdataset)
+{
+	dns_clientinfomethods_t cm;
+	dns_clientinfo_t ci;
+	dns_fixedname_t fixed;
+
+	dns_clientinfomethods_init(&cm, NULL);
+	dns_clientinfo_init(&ci, NULL, NULL);
+	dns_clientinfo_setecs(&ci, ecs);
+
+	return (dns_db_findext(db, name, NULL, dns_rdatatype_a, 0, 0, NULL,
+			       dns_fixedname_initname(&fixed), &cm, &ci,
+			       rdataset, NULL));
+}
+
+/*
+ * Look up the A record of 'name' on behalf of 'ecs' and return the
+ * last octet of the address found, or 0 if there is none.
+ */
+static unsigned char
+find_a(dns_db_t *db, dns_name_t *name, dns_ecs_t *ecs) {
+	dns_rdata_t rdata = DNS_RDATA_INIT;
+	dns_rdataset_t rdataset;
+	isc_result_t result;
+	unsigned char last;
+
+	dns_rdataset_init(&rdataset);
+	result = find_rdataset(db, name, ecs, &rdataset);
+	if (result != ISC_R_SUCCESS) {
+		if (dns_rdataset_isassociated(&rdataset))
+			dns_rdataset_disassociate(&rdataset);
+		return (0);
+	}
+
+	ATF_REQUIRE_EQ(dns_rdataset_first(&rdataset), ISC_R_SUCCESS);
+	dns_rdataset_current(&rdataset, &rdata);
+	last = rdata.data[3];
+	dns_rdataset_disassociate(&rdataset);
+
+	return (last);
+}
+
 /*
  * Individual unit tests
  */
@@ -262,6 +373,123 @@ ATF_TC_BODY(dns_dbfind_staleok, tc) {
 	isc_mem_detach(&mymctx);
 }
 
+ATF_TC(scoped);
+ATF_TC_HEAD(scoped, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "check answers cached for client subnets");
+}
+ATF_TC_BODY(scoped, tc) {
+	dns_db_t *db = NULL;
+	dns_ecs_t ecs;
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	isc_mem_t *mymctx = NULL;
+	isc_result_t result;
+	char buf[sizeof("192.0.255.0")];
+	/* "target.example" in wire format */
+	unsigned char target[] = "\006target\007example";
+	unsigned char a1[4] = { 10, 0, 0, 1 };
+	unsigned char a2[4] = { 10, 0, 0, 2 };
+	unsigned char a3[4] = { 10, 0, 0, 3 };
+	dns_rdataset_t rdataset;
+	unsigned int i;
+
+	result = isc_mem_create(0, 0, &mymctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_db_create(mymctx, "rbt", dns_rootname, dns_dbtype_cache,
+			       dns_rdataclass_in, 0, NULL, &db);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, "example", 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/* Global answer, and answers for 192.0.2.0/24 and 192.0.0.0/16 */
+	ATF_REQUIRE_EQ(add_a(db, name, 1, NULL), ISC_R_SUCCESS);
+	make_ecs(&ecs, "192.0.2.1", 24, 24);
+	ATF_REQUIRE_EQ(add_a(db, name, 2, &ecs), ISC_R_SUCCESS);
+	make_ecs(&ecs, "192.0.3.1", 24, 16);
+	ATF_REQUIRE_EQ(add_a(db, name, 3, &ecs), ISC_R_SUCCESS);
+
+	/* No client subnet: the global answer */
+	ATF_CHECK_EQ(find_a(db, name, NULL), 1);
+
+	/* Longest matching prefix wins, and the scope is reported */
+	make_ecs(&ecs, "192.0.2.77", 24, 0);
+	ATF_CHECK_EQ(find_a(db, name, &ecs), 2);
+	ATF_CHECK_EQ(ecs.scope, 24);
+
+	make_ecs(&ecs, "192.0.9.1", 24, 0);
+	ATF_CHECK_EQ(find_a(db, name, &ecs), 3);
+	ATF_CHECK_EQ(ecs.scope, 16);
+
+	/* A scope longer than the client's source never matches */
+	make_ecs(&ecs, "192.0.2.77", 20, 0);
+	ATF_CHECK_EQ(find_a(db, name, &ecs), 3);
+
+	make_ecs(&ecs, "198.51.100.1", 24, 0);
+	ATF_CHECK_EQ(find_a(db, name, &ecs), 1);
+	ATF_CHECK_EQ(ecs.scope, 0);
+
+	/* Replacing an answer for the same subnet */
+	make_ecs(&ecs, "192.0.2.1", 24, 24);
+	ATF_REQUIRE_EQ(add_a(db, name, 4, &ecs), ISC_R_SUCCESS);
+	make_ecs(&ecs, "192.0.2.77", 24, 0);
+	ATF_CHECK_EQ(find_a(db, name, &ecs), 4);
+
+	/* The number of subnets cached per name is bounded */
+	for (i = 0; i < 64; i++) {
+		snprintf(buf, sizeof(buf), "10.%u.0.0", i);
+		make_ecs(&ecs, buf, 24, 24);
+		ATF_REQUIRE_EQ(add_a(db, name, 100 + i, &ecs),
+			       ISC_R_SUCCESS);
+		ATF_CHECK_EQ(find_a(db, name, &ecs), 100 + i);
+	}
+	ATF_CHECK_EQ(find_a(db, name, NULL), 1);
+
+	/* A CNAME scoped to a subnet is followed for that subnet only */
+	result = dns_name_fromstring(name, "alias.example", 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	make_ecs(&ecs, "192.0.2.1", 24, 24);
+	ATF_REQUIRE_EQ(add_rdata(db, name, dns_rdatatype_cname, target,
+				 sizeof(target), dns_trust_none, &ecs),
+		       ISC_R_SUCCESS);
+	make_ecs(&ecs, "192.0.2.77", 24, 0);
+	dns_rdataset_init(&rdataset);
+	result = find_rdataset(db, name, &ecs, &rdataset);
+	ATF_CHECK_EQ(result, DNS_R_CNAME);
+	ATF_CHECK_EQ(ecs.scope, 24);
+	if (dns_rdataset_isassociated(&rdataset)) {
+		ATF_CHECK_EQ(rdataset.type, dns_rdatatype_cname);
+		dns_rdataset_disassociate(&rdataset);
+	}
+	make_ecs(&ecs, "198.51.100.1", 24, 0);
+	ATF_CHECK_EQ(find_a(db, name, &ecs), 0);
+
+	/* A scoped answer is not preferred over a more trusted one */
+	result = dns_name_fromstring(name, "trust.example", 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_REQUIRE_EQ(add_rdata(db, name, dns_rdatatype_a, a1, sizeof(a1),
+				 dns_trust_authanswer, NULL),
+		       ISC_R_SUCCESS);
+	make_ecs(&ecs, "192.0.2.1", 24, 24);
+	ATF_REQUIRE_EQ(add_rdata(db, name, dns_rdatatype_a, a2, sizeof(a2),
+				 dns_trust_answer, &ecs),
+		       ISC_R_SUCCESS);
+	make_ecs(&ecs, "192.0.3.1", 24, 24);
+	ATF_REQUIRE_EQ(add_rdata(db, name, dns_rdatatype_a, a3, sizeof(a3),
+				 dns_trust_authanswer, &ecs),
+		       ISC_R_SUCCESS);
+	make_ecs(&ecs, "192.0.2.77", 24, 0);
+	ATF_CHECK_EQ(find_a(db, name, &ecs), 1);
+	make_ecs(&ecs, "192.0.3.77", 24, 0);
+	ATF_CHECK_EQ(find_a(db, name, &ecs), 3);
+
+	dns_db_detach(&db);
+	isc_mem_detach(&mymctx);
+}
+
 ATF_TC(class);
 ATF_TC_HEAD(class, tc) {
 	atf_tc_set_md_var(tc, "descr", "database class");
@@ -401,6 +629,7 @@ ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, getoriginnode);
 	ATF_TP_ADD_TC(tp, getsetservestalettl);
 	ATF_TP_ADD_TC(tp, dns_dbfind_staleok);
+	ATF_TP_ADD_TC(tp, scoped);
 	ATF_TP_ADD_TC(tp, class);
 	ATF_TP_ADD_TC(tp, dbtype);
 	ATF_TP_ADD_TC(tp, version);
@@ -356,6 +356,201 @@ ATF_TC_BODY(totext, tc) {
 	dns_test_end();
 }
 
+ATF_TC(frametotext);
+ATF_TC_HEAD(frametotext, tc) {
+	atf_tc_set_md_var(tc, "descr", "dnstap frame directly to text");
+}
+ATF_TC_BODY(frametotext, tc) {
+	isc_result_t result;
+	dns_dthandle_t *handle = NULL;
+	isc_buffer_t *b = NULL;
+	uint8_t *data;
+	size_t dsize;
+	FILE *fp = NULL;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, true);
+	ATF_REQUIRE(result == ISC_R_SUCCESS);
+
+	result = dns_dt_open(TAPSAVED, dns_dtmode_file, mctx, &handle);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_stdio_open(TAPTEXT, "r", &fp);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/* make sure text conversion gets the right local time */
+	setenv("TZ", "PST8", 1);
+
+	isc_buffer_allocate(mctx, &b, 2048);
+	ATF_REQUIRE(b != NULL);
+
+	while (dns_dt_getframe(handle, &data, &dsize) == ISC_R_SUCCESS) {
+		isc_region_t r;
+		char s[BUFSIZ], *p;
+
+		r.base = data;
+		r.length = dsize;
+
+		/* read the corresponding line of text */
+		p = fgets(s, sizeof(s), fp);
+		ATF_CHECK_EQ(p, s);
+		if (p == NULL)
+			break;
+
+		p = strchr(p, '\n');
+		if (p != NULL)
+			*p = '\0';
+
+		/* convert and compare */
+		isc_buffer_clear(b);
+		result = dns_dt_frametotext(&r, &b);
+		ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+
+		ATF_CHECK_STREQ((char *) isc_buffer_base(b), s);
+
+		/* a truncated frame is rejected */
+		r.length--;
+		isc_buffer_clear(b);
+		result = dns_dt_frametotext(&r, &b);
+		ATF_CHECK_EQ(result, DNS_R_BADDNSTAP);
+	}
+
+	isc_buffer_free(&b);
+	if (fp != NULL)
+		isc_stdio_close(fp);
+	if (handle != NULL)
+		dns_dt_close(&handle);
+	cleanup();
+
+	dns_test_end();
+}
+
+/*
+ * Send a client query and response from each of 10.0.0.1 to
+ * 10.0.255.1 with 'sample' and 'prefix4' set, and return the number
+ * of pairs logged.
+ */
+static unsigned int
+sendsampled(unsigned int sample, unsigned int prefix4) {
+	isc_result_t result;
+	dns_dtenv_t *dtenv = NULL;
+	dns_dthandle_t *handle = NULL;
+	dns_view_t *view = NULL;
+	struct fstrm_iothr_options *fopt;
+	unsigned char qrmbuffer[4096];
+	isc_sockaddr_t qaddr, raddr;
+	isc_buffer_t qrmsg;
+	struct in_addr in;
+	unsigned int i, queries = 0, responses = 0;
+	uint8_t *data;
+	size_t dsize, qrsize;
+
+	cleanup();
+
+	result = dns_test_makeview("test", &view);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	fopt = fstrm_iothr_options_init();
+	ATF_REQUIRE(fopt != NULL);
+	fstrm_iothr_options_set_num_input_queues(fopt, 1);
+
+	result = dns_dt_create(mctx, dns_dtmode_file, TAPFILE, &fopt, NULL,
+			       &dtenv);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	dns_dt_attach(dtenv, &view->dtenv);
+	view->dttypes = DNS_DTTYPE_CQ|DNS_DTTYPE_CR;
+	view->dtsample = sample;
+	view->dtprefix4 = prefix4;
+	view->dtprefix6 = (prefix4 != 0) ? 64 : 0;
+
+	result = dns_test_getdata("testdata/dnstap/query.recursive", qrmbuffer,
+				  sizeof(qrmbuffer), &qrsize);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	isc_buffer_init(&qrmsg, qrmbuffer, qrsize);
+	isc_buffer_add(&qrmsg, qrsize);
+
+	in.s_addr = inet_addr("10.53.0.2");
+	isc_sockaddr_fromin(&raddr, &in, 53);
+
+	for (i = 0; i < 256; i++) {
+		in.s_addr = htonl(0x0a000001 | (i << 8));
+		isc_sockaddr_fromin(&qaddr, &in, 2112);
+
+		/* same ID in both, as for a real query and response */
+		dns_dt_send(view, DNS_DTTYPE_CQ, &qaddr, &raddr, false,
+			    NULL, NULL, NULL, &qrmsg);
+		dns_dt_send(view, DNS_DTTYPE_CR, &qaddr, &raddr, false,
+			    NULL, NULL, NULL, &qrmsg);
+	}
+
+	dns_dt_detach(&view->dtenv);
+	dns_dt_detach(&dtenv);
+	dns_dt_shutdown();
+	dns_view_detach(&view);
+
+	result = dns_dt_open(TAPFILE, dns_dtmode_file, mctx, &handle);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	while (dns_dt_getframe(handle, &data, &dsize) == ISC_R_SUCCESS) {
+		dns_dtdata_t *dtdata = NULL;
+		isc_region_t r;
+
+		r.base = data;
+		r.length = dsize;
+
+		result = dns_dt_parse(mctx, &r, &dtdata);
+		ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+		if (result != ISC_R_SUCCESS)
+			continue;
+
+		if (dtdata->type == DNS_DTTYPE_CQ)
+			queries++;
+		else if (dtdata->type == DNS_DTTYPE_CR)
+			responses++;
+
+		dns_dtdata_free(&dtdata);
+	}
+
+	dns_dt_close(&handle);
+	if (fopt != NULL)
+		fstrm_iothr_options_destroy(&fopt);
+	cleanup();
+
+	/* a query and its response are logged together */
+	ATF_CHECK_EQ(queries, responses);
+
+	return (queries);
+}
+
+ATF_TC(sample);
+ATF_TC_HEAD(sample, tc) {
+	atf_tc_set_md_var(tc, "descr", "sample dnstap messages");
+}
+ATF_TC_BODY(sample, tc) {
+	isc_result_t result;
+	unsigned int n;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, true);
+	ATF_REQUIRE(result == ISC_R_SUCCESS);
+
+	n = sendsampled(1, 0);
+	ATF_CHECK_EQ(n, 256);
+
+	/* about 1 in 4 transactions; allow plenty of slack */
+	n = sendsampled(4, 0);
+	ATF_CHECK(n > 16 && n < 128);
+
+	/* all the clients are in 10.0.0.0/16: all or nothing */
+	n = sendsampled(4, 16);
+	ATF_CHECK(n == 0 || n == 256);
+
+	dns_test_end();
+}
+
 #else
 ATF_TC(untested);
 ATF_TC_HEAD(untested, tc) {
@@ -375,6 +570,8 @@ ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, create);
 	ATF_TP_ADD_TC(tp, send);
 	ATF_TP_ADD_TC(tp, totext);
+	ATF_TP_ADD_TC(tp, frametotext);
+	ATF_TP_ADD_TC(tp, sample);
 #else
 	ATF_TP_ADD_TC(tp, untested);
 #endif
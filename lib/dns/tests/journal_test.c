@@ -0,0 +1,613 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <isc/file.h>
+#include <isc/print.h>
+#include <isc/stdio.h>
+#include <isc/util.h>
+
+#include <dns/db.h>
+#include <dns/journal.h>
+
+#include "dnstest.h"
+
+/*
+ * The tests below look at the journal header and the dense index
+ * directly, so build the journal code into the test itself.  It has
+ * its own CHECK() with a different label.
+ */
+#undef CHECK
+#include "../journal.c"
+
+#define TEST_ORIGIN	"test"
+#define TEST_JOURNAL	"journal_test.jnl"
+#define NTRANS		300
+
+/*
+ * Helper functions
+ */
+static void
+cleanup(void) {
+	(void)isc_file_remove(TEST_JOURNAL);
+	dindex_remove(TEST_JOURNAL);
+}
+
+/*
+ * Append the transaction taking zone TEST_ORIGIN from 'serial' to
+ * 'serial' + 1 to the journal 'j'.  Its SOA records match the one in
+ * testdata/diff/zone1.data, so the result can be rolled into it.
+ */
+static void
+write_transaction(dns_journal_t *j, uint32_t serial) {
+	char soa0[64], soa1[64], owner[64], address[64];
+	dns_diff_t diff;
+	isc_result_t result;
+	zonechange_t changes[] = {
+		{ DNS_DIFFOP_DEL, TEST_ORIGIN, 0, "SOA", soa0 },
+		{ DNS_DIFFOP_ADD, TEST_ORIGIN, 0, "SOA", soa1 },
+		{ DNS_DIFFOP_ADD, owner, 0, "A", address },
+		{ 0, NULL, 0, NULL, NULL }
+	};
+
+	snprintf(soa0, sizeof(soa0), ". . %u 0 0 0 0", serial);
+	snprintf(soa1, sizeof(soa1), ". . %u 0 0 0 0", serial + 1);
+	snprintf(owner, sizeof(owner), "a%u." TEST_ORIGIN, serial);
+	snprintf(address, sizeof(address), "10.0.%u.%u",
+		 (serial >> 8) & 0xff, serial & 0xff);
+
+	result = dns_test_difffromchanges(&diff, changes);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_journal_write_transaction(j, &diff);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_diff_clear(&diff);
+}
+
+/*
+ * Append transactions 'from' .. 'to' - 1 to TEST_JOURNAL.
+ */
+static void
+write_journal(uint32_t from, uint32_t to) {
+	dns_journal_t *j = NULL;
+	isc_result_t result;
+	uint32_t serial;
+
+	result = dns_journal_open(mctx, TEST_JOURNAL, DNS_JOURNAL_CREATE, &j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (serial = from; serial < to; serial++)
+		write_transaction(j, serial);
+	dns_journal_destroy(&j);
+}
+
+/*
+ * Walk TEST_JOURNAL one transaction at a time, and check that the
+ * dense index has exactly one entry for each transaction, in order,
+ * and that journal_find() agrees with the walk for every serial.
+ */
+static void
+check_index(void) {
+	dns_journal_t *j = NULL;
+	journal_pos_t pos, found, guess, entry;
+	isc_result_t result;
+	uint32_t n = 0;
+
+	result = dns_journal_open(mctx, TEST_JOURNAL, DNS_JOURNAL_READ, &j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_REQUIRE(dindex_open(j, false));
+
+	pos = j->header.begin;
+	while (pos.serial != j->header.end.serial) {
+		ATF_REQUIRE(n < j->dlen);
+		ATF_REQUIRE(dindex_get(j, n, &entry));
+		ATF_CHECK_EQ(entry.serial, pos.serial);
+		ATF_CHECK_EQ(entry.offset, pos.offset);
+
+		/* The dense index alone must lead straight to 'pos'. */
+		guess = j->header.begin;
+		dindex_find(j, pos.serial, &guess);
+		ATF_CHECK_EQ(guess.serial, pos.serial);
+		ATF_CHECK_EQ(guess.offset, pos.offset);
+
+		result = journal_find(j, pos.serial, &found);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		ATF_CHECK_EQ(found.serial, pos.serial);
+		ATF_CHECK_EQ(found.offset, pos.offset);
+
+		result = journal_next(j, &pos);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		n++;
+	}
+	ATF_CHECK_EQ(j->dlen, n);
+
+	dns_journal_destroy(&j);
+}
+
+/*
+ * Overwrite entry 'i' of the dense index of TEST_JOURNAL with 'pos',
+ * or cut the index down to 'i' entries if 'pos' is NULL.
+ */
+static void
+damage_index(uint32_t i, journal_pos_t *pos) {
+	char name[PATH_MAX];
+	journal_rawpos_t raw;
+	FILE *fp = NULL;
+	isc_result_t result;
+
+	ATF_REQUIRE(dindex_name(TEST_JOURNAL, name, sizeof(name)));
+	if (pos == NULL) {
+		ATF_REQUIRE_EQ(truncate(name, (off_t)i * sizeof(raw)), 0);
+		return;
+	}
+
+	journal_pos_encode(&raw, pos);
+	result = isc_stdio_open(name, "rb+", &fp);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_stdio_seek(fp, (off_t)i * sizeof(raw), SEEK_SET);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_stdio_write(&raw, sizeof(raw), 1, fp, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_stdio_close(fp);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+}
+
+/*
+ * Look up every serial in TEST_JOURNAL with journal_find() and check
+ * the answer against the transaction headers.
+ */
+static void
+check_find(void) {
+	dns_journal_t *j = NULL;
+	journal_pos_t pos;
+	journal_xhdr_t xhdr;
+	isc_result_t result;
+	uint32_t serial;
+
+	result = dns_journal_open(mctx, TEST_JOURNAL, DNS_JOURNAL_READ, &j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	for (serial = j->header.begin.serial;
+	     serial != j->header.end.serial;
+	     serial++)
+	{
+		result = journal_find(j, serial, &pos);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		ATF_CHECK_EQ(pos.serial, serial);
+		result = journal_seek(j, pos.offset);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		result = journal_read_xhdr(j, &xhdr);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		ATF_CHECK_EQ(xhdr.serial0, serial);
+	}
+
+	dns_journal_destroy(&j);
+}
+
+/*
+ * Append transactions 'from' .. 'to' - 1 to TEST_JOURNAL with their
+ * sync deferred, and leave without calling dns_journal_sync().
+ */
+static void
+write_deferred(uint32_t from, uint32_t to) {
+	dns_journal_t *j = NULL;
+	isc_result_t result;
+	uint32_t serial;
+
+	result = dns_journal_open(mctx, TEST_JOURNAL,
+				  DNS_JOURNAL_CREATE | DNS_JOURNAL_DEFERSYNC,
+				  &j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (serial = from; serial < to; serial++)
+		write_transaction(j, serial);
+	ATF_CHECK(j->header.syncpending);
+	ATF_CHECK_EQ(j->header.synced.serial, from);
+	dns_journal_destroy(&j);
+}
+
+/*
+ * Cut TEST_JOURNAL off in the middle of transaction 'serial', as a
+ * crash before its data reached the disk would.
+ */
+static void
+tear_journal(uint32_t serial) {
+	dns_journal_t *j = NULL;
+	journal_pos_t pos;
+	isc_result_t result;
+
+	result = dns_journal_open(mctx, TEST_JOURNAL, DNS_JOURNAL_READ, &j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = journal_find(j, serial, &pos);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_journal_destroy(&j);
+
+	ATF_REQUIRE_EQ(truncate(TEST_JOURNAL, (off_t)pos.offset +
+			       sizeof(journal_rawxhdr_t) + 8), 0);
+}
+
+/*
+ * Open TEST_JOURNAL with 'mode', and check its last serial and
+ * whether a sync is still pending.
+ */
+static void
+check_journal(unsigned int mode, uint32_t last, bool syncpending) {
+	dns_journal_t *j = NULL;
+	isc_result_t result;
+
+	result = dns_journal_open(mctx, TEST_JOURNAL, mode, &j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(dns_journal_last_serial(j), last);
+	ATF_CHECK_EQ(j->header.syncpending, syncpending);
+	dns_journal_destroy(&j);
+}
+
+/*
+ * Make journal_open() treat journals written so far as left behind
+ * by another process, as it would after a restart.  Returns the
+ * previous instance, for restore_instance().
+ */
+static uint32_t
+new_instance(void) {
+	uint32_t old = journal_instance();
+
+	instance_id = old + 1;
+	if (instance_id == 0)
+		instance_id = 1;
+	return (old);
+}
+
+static void
+restore_instance(uint32_t old) {
+	instance_id = old;
+}
+
+/*
+ * Individual unit tests
+ */
+
+ATF_TC(dindex_lookup);
+ATF_TC_HEAD(dindex_lookup, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "dense index lookups match a linear scan");
+}
+ATF_TC_BODY(dindex_lookup, tc) {
+	dns_journal_t *j = NULL;
+	journal_pos_t pos;
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	cleanup();
+
+	/*
+	 * Commit in several sessions, so that the index is picked
+	 * up again by later writers.
+	 */
+	write_journal(0, NTRANS / 3);
+	write_journal(NTRANS / 3, NTRANS);
+	check_index();
+
+	/*
+	 * Serials outside the journal are still out of range, and the
+	 * last serial is found past the last transaction.
+	 */
+	result = dns_journal_open(mctx, TEST_JOURNAL, DNS_JOURNAL_READ, &j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = journal_find(j, NTRANS + 1, &pos);
+	ATF_CHECK_EQ(result, ISC_R_RANGE);
+	result = journal_find(j, NTRANS, &pos);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(pos.offset, j->header.end.offset);
+	dns_journal_destroy(&j);
+
+	cleanup();
+	dns_test_end();
+}
+
+ATF_TC(dindex_rebuild);
+ATF_TC_HEAD(dindex_rebuild, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "a stale or corrupt dense index is detected "
+			  "and rebuilt");
+}
+ATF_TC_BODY(dindex_rebuild, tc) {
+	journal_pos_t bogus;
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	cleanup();
+
+	write_journal(0, NTRANS);
+
+	/*
+	 * A corrupt entry in the middle misleads the binary search
+	 * for some serials; journal_find() must still get them right.
+	 */
+	bogus.serial = NTRANS / 2;
+	bogus.offset = sizeof(journal_rawheader_t);
+	damage_index(NTRANS / 2, &bogus);
+	check_find();
+
+	/*
+	 * A corrupt first entry makes the whole index unusable.
+	 * It is ignored on lookup and rebuilt by the next commit.
+	 */
+	bogus.serial = 1;
+	damage_index(0, &bogus);
+	check_find();
+	write_journal(NTRANS, NTRANS + 1);
+	check_index();
+
+	/*
+	 * An index missing its last entries, as left behind by a
+	 * crash, is rebuilt too rather than appended to.
+	 */
+	damage_index(NTRANS - 10, NULL);
+	check_find();
+	write_journal(NTRANS + 1, NTRANS + 2);
+	check_index();
+
+	/*
+	 * So is a missing one.
+	 */
+	dindex_remove(TEST_JOURNAL);
+	check_find();
+	write_journal(NTRANS + 2, NTRANS + 3);
+	check_index();
+
+	cleanup();
+	dns_test_end();
+}
+
+ATF_TC(dindex_compact);
+ATF_TC_HEAD(dindex_compact, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "compaction and rollforward keep the dense "
+			  "index consistent");
+}
+ATF_TC_BODY(dindex_compact, tc) {
+	char filename[] = TEST_JOURNAL;
+	dns_db_t *db = NULL;
+	dns_journal_t *j = NULL;
+	uint32_t serial;
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	cleanup();
+
+	result = dns_test_loaddb(&db, dns_dbtype_zone, TEST_ORIGIN,
+				 "testdata/diff/zone1.data");
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	write_journal(0, NTRANS);
+	result = dns_journal_rollforward(mctx, db, 0, TEST_JOURNAL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_db_getsoaserial(db, NULL, &serial);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(serial, NTRANS);
+
+	/*
+	 * Compacting drops the start of the journal; the index must
+	 * start again at the new first transaction.
+	 */
+	result = dns_journal_compact(mctx, filename, NTRANS - 10, 0);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_journal_open(mctx, TEST_JOURNAL, DNS_JOURNAL_READ, &j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK(j->header.begin.serial > 0);
+	ATF_CHECK(j->header.begin.serial <= NTRANS - 10);
+	dns_journal_destroy(&j);
+	check_index();
+
+	/*
+	 * Writing more and rolling forward from the middle of the
+	 * compacted journal finds the right starting point.
+	 */
+	write_journal(NTRANS, NTRANS + 20);
+	check_index();
+	result = dns_journal_rollforward(mctx, db, 0, TEST_JOURNAL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_db_getsoaserial(db, NULL, &serial);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(serial, NTRANS + 20);
+
+	dns_db_detach(&db);
+	cleanup();
+	dns_test_end();
+}
+
+ATF_TC(defersync);
+ATF_TC_HEAD(defersync, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "deferred commits are made durable by "
+			  "dns_journal_sync()");
+}
+ATF_TC_BODY(defersync, tc) {
+	dns_journal_t *j = NULL;
+	isc_result_t result;
+	uint32_t serial, old;
+	unsigned int n = 0;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	cleanup();
+
+	write_journal(0, 5);
+
+	result = dns_journal_open(mctx, TEST_JOURNAL,
+				  DNS_JOURNAL_WRITE | DNS_JOURNAL_DEFERSYNC,
+				  &j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK(!j->header.syncpending);
+	for (serial = 5; serial < 10; serial++)
+		write_transaction(j, serial);
+
+	/*
+	 * The first deferred commit marks where the durable part of
+	 * the journal ends; later ones leave the mark alone.
+	 */
+	ATF_CHECK(j->header.syncpending);
+	ATF_CHECK_EQ(j->header.synced.serial, 5);
+	ATF_CHECK_EQ(j->header.writer, journal_instance());
+
+	/*
+	 * Readers in the same process see every deferred commit.
+	 */
+	check_journal(DNS_JOURNAL_READ, 10, true);
+
+	result = dns_journal_sync(j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK(!j->header.syncpending);
+	dns_journal_destroy(&j);
+
+	/*
+	 * Once synced, nothing is discarded after a restart, and
+	 * every transaction can be read back.
+	 */
+	old = new_instance();
+	check_journal(DNS_JOURNAL_WRITE, 10, false);
+
+	result = dns_journal_open(mctx, TEST_JOURNAL, DNS_JOURNAL_READ, &j);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_journal_iter_init(j, 0, 10);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (result = dns_journal_first_rr(j);
+	     result == ISC_R_SUCCESS;
+	     result = dns_journal_next_rr(j))
+	{
+		n++;
+	}
+	ATF_CHECK_EQ(result, ISC_R_NOMORE);
+	ATF_CHECK_EQ(n, 10 * 3);
+	dns_journal_destroy(&j);
+
+	restore_instance(old);
+	cleanup();
+	dns_test_end();
+}
+
+ATF_TC(defersync_recover);
+ATF_TC_HEAD(defersync_recover, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "an unsynced tail left by another process is "
+			  "checked and discarded from where it is torn");
+}
+ATF_TC_BODY(defersync_recover, tc) {
+	isc_result_t result;
+	uint32_t old;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	cleanup();
+
+	write_journal(0, 5);
+	write_deferred(5, 10);
+	tear_journal(8);
+
+	old = new_instance();
+
+	/*
+	 * A reader sees the journal end before the torn transaction,
+	 * but leaves the file for the next writer to repair.
+	 */
+	check_journal(DNS_JOURNAL_READ, 8, true);
+	check_journal(DNS_JOURNAL_READ, 8, true);
+
+	/*
+	 * A writer repairs it for good.
+	 */
+	check_journal(DNS_JOURNAL_WRITE, 8, false);
+	check_journal(DNS_JOURNAL_READ, 8, false);
+
+	/*
+	 * The journal can be written to again, and its dense index
+	 * no longer points at the discarded transactions.
+	 */
+	write_journal(8, 12);
+	check_journal(DNS_JOURNAL_READ, 12, false);
+	check_index();
+
+	restore_instance(old);
+	cleanup();
+	dns_test_end();
+}
+
+ATF_TC(defersync_samewriter);
+ATF_TC_HEAD(defersync_samewriter, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "an unsynced tail left by this process is not "
+			  "recovered");
+}
+ATF_TC_BODY(defersync_samewriter, tc) {
+	isc_result_t result;
+	uint32_t old;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	cleanup();
+
+	write_journal(0, 5);
+	write_deferred(5, 10);
+
+	/*
+	 * Tear the tail so that recovery, were it to run, would
+	 * visibly cut the journal short.  The writer is still
+	 * running, so the data is only waiting in the page cache
+	 * and the journal must be taken as it stands.
+	 */
+	tear_journal(8);
+	check_journal(DNS_JOURNAL_READ, 10, true);
+	check_journal(DNS_JOURNAL_WRITE, 10, true);
+
+	/*
+	 * The same journal seen from another process is recovered.
+	 */
+	old = new_instance();
+	check_journal(DNS_JOURNAL_READ, 8, true);
+
+	restore_instance(old);
+	cleanup();
+	dns_test_end();
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, dindex_lookup);
+	ATF_TP_ADD_TC(tp, dindex_rebuild);
+	ATF_TP_ADD_TC(tp, dindex_compact);
+	ATF_TP_ADD_TC(tp, defersync);
+	ATF_TP_ADD_TC(tp, defersync_recover);
+	ATF_TP_ADD_TC(tp, defersync_samewriter);
+	return (atf_no_error());
+}
@@ -0,0 +1,584 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <isc/buffer.h>
+#include <isc/mem.h>
+#include <isc/print.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/compress.h>
+#include <dns/fixedname.h>
+#include <dns/masterdump.h>
+#include <dns/message.h>
+#include <dns/name.h>
+#include <dns/rdataclass.h>
+#include <dns/rdatatype.h>
+
+#include "dnstest.h"
+
+/*
+ * Helper functions
+ */
+
+static void
+putname(const char *text, isc_buffer_t *target, dns_compress_t *cctx) {
+	dns_fixedname_t fixed;
+	dns_name_t *name = dns_fixedname_initname(&fixed);
+	isc_result_t result;
+
+	result = dns_name_fromstring(name, text, 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_name_towire(name, cctx, target);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+}
+
+/*
+ * Build a response to "example/A" with 'count' answers cycling through
+ * A, NS (with a compressed name in the rdata) and TXT records of
+ * 'txtlen' octets, all owned by compressed names, and an OPT record.
+ */
+static void
+makeresponse(unsigned int count, unsigned int txtlen, isc_buffer_t *target) {
+	dns_compress_t cctx;
+	isc_result_t result;
+	char text[DNS_NAME_FORMATSIZE];
+	unsigned int i, j;
+
+	result = dns_compress_init(&cctx, -1, mctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_compress_setmethods(&cctx, DNS_COMPRESS_GLOBAL14);
+
+	isc_buffer_putuint16(target, 0x1234);
+	isc_buffer_putuint16(target, DNS_MESSAGEFLAG_QR | DNS_MESSAGEFLAG_AA);
+	isc_buffer_putuint16(target, 1);
+	isc_buffer_putuint16(target, count);
+	isc_buffer_putuint16(target, 0);
+	isc_buffer_putuint16(target, 1);
+
+	putname("example.", target, &cctx);
+	isc_buffer_putuint16(target, dns_rdatatype_a);
+	isc_buffer_putuint16(target, dns_rdataclass_in);
+
+	for (i = 0; i < count; i++) {
+		unsigned int rdlen, rdlenpos;
+		unsigned char *rdlenp;
+
+		snprintf(text, sizeof(text), "host%u.sub%u.example.",
+			 i / 3, i % 7);
+		putname(text, target, &cctx);
+		switch (i % 3) {
+		case 0:
+			isc_buffer_putuint16(target, dns_rdatatype_a);
+			isc_buffer_putuint16(target, dns_rdataclass_in);
+			isc_buffer_putuint32(target, 300 + i);
+			isc_buffer_putuint16(target, 4);
+			isc_buffer_putuint32(target, 0x0a000000 + i);
+			break;
+		case 1:
+			isc_buffer_putuint16(target, dns_rdatatype_ns);
+			isc_buffer_putuint16(target, dns_rdataclass_in);
+			isc_buffer_putuint32(target, 300);
+			rdlenpos = isc_buffer_usedlength(target);
+			isc_buffer_putuint16(target, 0);
+			snprintf(text, sizeof(text), "ns%u.sub%u.example.",
+				 i, i % 7);
+			putname(text, target, &cctx);
+			rdlen = isc_buffer_usedlength(target) - rdlenpos - 2;
+			rdlenp = (unsigned char *)isc_buffer_base(target) +
+				 rdlenpos;
+			rdlenp[0] = rdlen >> 8;
+			rdlenp[1] = rdlen & 0xff;
+			break;
+		case 2:
+			isc_buffer_putuint16(target, dns_rdatatype_txt);
+			isc_buffer_putuint16(target, dns_rdataclass_in);
+			isc_buffer_putuint32(target, 300);
+			isc_buffer_putuint16(target, txtlen + 1);
+			isc_buffer_putuint8(target, txtlen);
+			for (j = 0; j < txtlen; j++) {
+				isc_buffer_putuint8(target, 'a' + (i + j) % 26);
+			}
+			break;
+		}
+	}
+
+	/* OPT */
+	isc_buffer_putuint8(target, 0);
+	isc_buffer_putuint16(target, dns_rdatatype_opt);
+	isc_buffer_putuint16(target, 4096);
+	isc_buffer_putuint32(target, 0);
+	isc_buffer_putuint16(target, 0);
+
+	dns_compress_invalidate(&cctx);
+}
+
+static void
+parsetotext(dns_message_t *msg, isc_buffer_t *wire, unsigned int options,
+	    isc_buffer_t *text)
+{
+	isc_buffer_t source;
+	isc_result_t result;
+
+	isc_buffer_init(&source, isc_buffer_base(wire),
+			isc_buffer_usedlength(wire));
+	isc_buffer_add(&source, isc_buffer_usedlength(wire));
+
+	dns_message_reset(msg, DNS_MESSAGE_INTENTPARSE);
+	result = dns_message_parse(msg, &source, options);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	isc_buffer_clear(text);
+	result = dns_message_totext(msg, &dns_master_style_debug, 0, text);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+}
+
+#define NOOPT	UINT_MAX
+
+/*
+ * Build a query for 'qname' (in wire format, 'qnamelen' octets) with
+ * an OPT record carrying 'optlen' octets of options unless 'optlen' is
+ * NOOPT, followed by 'trailing' octets of garbage.
+ */
+static void
+makequery(const unsigned char *qname, unsigned int qnamelen,
+	  dns_rdatatype_t type, dns_rdataclass_t rdclass,
+	  const unsigned char *opt, unsigned int optlen, uint32_t optttl,
+	  unsigned int trailing, isc_buffer_t *target)
+{
+	isc_buffer_clear(target);
+	isc_buffer_putuint16(target, 0x4321);
+	isc_buffer_putuint16(target, DNS_MESSAGEFLAG_RD);
+	isc_buffer_putuint16(target, 1);
+	isc_buffer_putuint16(target, 0);
+	isc_buffer_putuint16(target, 0);
+	isc_buffer_putuint16(target, (optlen != NOOPT) ? 1 : 0);
+	isc_buffer_putmem(target, qname, qnamelen);
+	isc_buffer_putuint16(target, type);
+	isc_buffer_putuint16(target, rdclass);
+	if (optlen != NOOPT) {
+		isc_buffer_putuint8(target, 0);
+		isc_buffer_putuint16(target, dns_rdatatype_opt);
+		isc_buffer_putuint16(target, 1232);
+		isc_buffer_putuint32(target, optttl);
+		isc_buffer_putuint16(target, optlen);
+		isc_buffer_putmem(target, opt, optlen);
+	}
+	while (trailing-- > 0)
+		isc_buffer_putuint8(target, 0);
+}
+
+/*
+ * Parse 'wire' with the query fast path (if it applies) and with the
+ * generic parser, and check that the results are the same.
+ */
+static void
+checkfastquery(dns_message_t *fast, dns_message_t *full, isc_buffer_t *wire,
+	       isc_buffer_t *text1, isc_buffer_t *text2)
+{
+	isc_buffer_t source;
+	isc_result_t result1, result2;
+
+	dns_message_reset(fast, DNS_MESSAGE_INTENTPARSE);
+	isc_buffer_init(&source, isc_buffer_base(wire),
+			isc_buffer_usedlength(wire));
+	isc_buffer_add(&source, isc_buffer_usedlength(wire));
+	result1 = dns_message_parse(fast, &source, DNS_MESSAGEPARSE_ARENA);
+
+	/*
+	 * DNS_MESSAGEPARSE_PRESERVEORDER makes no difference to a message
+	 * with at most one record per section, but disables the fast path.
+	 */
+	dns_message_reset(full, DNS_MESSAGE_INTENTPARSE);
+	isc_buffer_init(&source, isc_buffer_base(wire),
+			isc_buffer_usedlength(wire));
+	isc_buffer_add(&source, isc_buffer_usedlength(wire));
+	result2 = dns_message_parse(full, &source,
+				    DNS_MESSAGEPARSE_PRESERVEORDER);
+
+	ATF_CHECK_EQ(result1, result2);
+	if (result1 != ISC_R_SUCCESS || result2 != ISC_R_SUCCESS)
+		return;
+
+	ATF_CHECK_EQ(fast->rdclass, full->rdclass);
+	ATF_CHECK_EQ(fast->rcode, full->rcode);
+	ATF_CHECK_EQ(fast->tkey, full->tkey);
+	ATF_CHECK_EQ(fast->question_ok, full->question_ok);
+	ATF_CHECK_EQ(fast->opt == NULL, full->opt == NULL);
+	ATF_CHECK_EQ(fast->saved.length, full->saved.length);
+
+	isc_buffer_clear(text1);
+	result1 = dns_message_totext(fast, &dns_master_style_debug, 0, text1);
+	ATF_CHECK_EQ(result1, ISC_R_SUCCESS);
+	isc_buffer_clear(text2);
+	result2 = dns_message_totext(full, &dns_master_style_debug, 0, text2);
+	ATF_CHECK_EQ(result2, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(isc_buffer_usedlength(text1),
+		     isc_buffer_usedlength(text2));
+	ATF_CHECK(memcmp(isc_buffer_base(text1), isc_buffer_base(text2),
+			 isc_buffer_usedlength(text1)) == 0);
+}
+
+/*
+ * Individual unit tests
+ */
+
+ATF_TC(arena);
+ATF_TC_HEAD(arena, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "dns_message_parse() with DNS_MESSAGEPARSE_ARENA "
+			  "gives the same message as without it");
+}
+ATF_TC_BODY(arena, tc) {
+	static const unsigned int counts[] = { 0, 1, 10, 100, 600 };
+	dns_message_t *msg = NULL, *ref = NULL;
+	isc_buffer_t *wire = NULL, *text1 = NULL, *text2 = NULL;
+	isc_result_t result;
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_buffer_allocate(mctx, &wire, 65535);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_buffer_allocate(mctx, &text1, 1024 * 1024);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_buffer_allocate(mctx, &text2, 1024 * 1024);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE, &msg);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE, &ref);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/*
+	 * Reuse one message for all sizes, small to large and back, so
+	 * that arena growth and shrinking on reset are exercised.
+	 */
+	for (i = 0; i < 2 * sizeof(counts) / sizeof(counts[0]); i++) {
+		unsigned int n = sizeof(counts) / sizeof(counts[0]);
+		unsigned int count = (i < n) ? counts[i] : counts[2 * n - i - 1];
+
+		isc_buffer_clear(wire);
+		makeresponse(count, (count > 100) ? 60 : 250, wire);
+
+		parsetotext(ref, wire, 0, text1);
+		parsetotext(msg, wire, DNS_MESSAGEPARSE_ARENA, text2);
+
+		ATF_CHECK_EQ(isc_buffer_usedlength(text1),
+			     isc_buffer_usedlength(text2));
+		ATF_CHECK(memcmp(isc_buffer_base(text1),
+				 isc_buffer_base(text2),
+				 isc_buffer_usedlength(text1)) == 0);
+		ATF_CHECK(!ISC_LIST_EMPTY(msg->arena));
+		ATF_CHECK(ISC_LIST_EMPTY(ref->arena));
+		ATF_CHECK(msg->opt != NULL);
+	}
+
+	dns_message_destroy(&msg);
+	dns_message_destroy(&ref);
+	isc_buffer_free(&wire);
+	isc_buffer_free(&text1);
+	isc_buffer_free(&text2);
+
+	dns_test_end();
+}
+
+ATF_TC(arenareuse);
+ATF_TC_HEAD(arenareuse, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "a reused message parses similar packets "
+			  "without growing its arena");
+}
+ATF_TC_BODY(arenareuse, tc) {
+	dns_message_t *msg = NULL;
+	dns_msgarena_t *arena;
+	dns_name_t *name = NULL;
+	dns_rdataset_t *rdataset = NULL;
+	isc_buffer_t *wire = NULL, *text = NULL;
+	isc_result_t result;
+	size_t inuse;
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_buffer_allocate(mctx, &wire, 65535);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_buffer_allocate(mctx, &text, 1024 * 1024);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE, &msg);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	makeresponse(30, 100, wire);
+
+	/*
+	 * After the first parse the arena is a single chunk which is
+	 * used again for every later message.
+	 */
+	parsetotext(msg, wire, DNS_MESSAGEPARSE_ARENA, text);
+	dns_message_reset(msg, DNS_MESSAGE_INTENTPARSE);
+	parsetotext(msg, wire, DNS_MESSAGEPARSE_ARENA, text);
+	arena = ISC_LIST_HEAD(msg->arena);
+	ATF_REQUIRE(arena != NULL);
+	inuse = isc_mem_inuse(mctx);
+
+	for (i = 0; i < 100; i++) {
+		parsetotext(msg, wire, DNS_MESSAGEPARSE_ARENA, text);
+		ATF_CHECK(ISC_LIST_HEAD(msg->arena) == arena);
+		ATF_CHECK_EQ(isc_mem_inuse(mctx), inuse);
+	}
+
+	/*
+	 * Turn the message into a reply to itself.  Names from the arena
+	 * can then be handed back like temporary names, and temporary
+	 * names still come from the memory pool.
+	 */
+	msg->flags &= ~DNS_MESSAGEFLAG_QR;
+	result = dns_message_reply(msg, true);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	name = ISC_LIST_HEAD(msg->sections[DNS_SECTION_QUESTION]);
+	ATF_REQUIRE(name != NULL);
+	dns_message_removename(msg, name, DNS_SECTION_QUESTION);
+	rdataset = ISC_LIST_HEAD(name->list);
+	ATF_REQUIRE(rdataset != NULL);
+	ISC_LIST_UNLINK(name->list, rdataset, link);
+	dns_rdataset_disassociate(rdataset);
+	dns_message_puttemprdataset(msg, &rdataset);
+	dns_message_puttempname(msg, &name);
+	result = dns_message_gettempname(msg, &name);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_message_puttempname(msg, &name);
+
+	dns_message_destroy(&msg);
+	isc_buffer_free(&wire);
+	isc_buffer_free(&text);
+
+	dns_test_end();
+}
+
+ATF_TC(fastquery);
+ATF_TC_HEAD(fastquery, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "the query fast path parses queries the same "
+			  "way as the generic parser");
+}
+ATF_TC_BODY(fastquery, tc) {
+	static const unsigned char www[] = "\003www\007EXAMPLE\003org";
+	static const unsigned char root[] = "";
+	static const unsigned char compressed[] = "\003www\300\014";
+	static const unsigned char badlabel[] = "\100www";
+	static const unsigned char cookie[] = {
+		0x00, 0x0a, 0x00, 0x08, 1, 2, 3, 4, 5, 6, 7, 8
+	};
+	static const unsigned char ecs[] = {
+		0x00, 0x08, 0x00, 0x07, 0x00, 0x01, 24, 0, 192, 0, 2,
+		0x00, 0x0c, 0x00, 0x02, 0, 0
+	};
+	static const unsigned char badecs[] = {
+		0x00, 0x08, 0x00, 0x07, 0x00, 0x07, 24, 0, 192, 0, 2
+	};
+	static const unsigned char truncopt[] = { 0x00, 0x0a, 0x00, 0x08 };
+	dns_message_t *fast = NULL, *full = NULL;
+	isc_buffer_t *wire = NULL, *text1 = NULL, *text2 = NULL;
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_buffer_allocate(mctx, &wire, 65535);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_buffer_allocate(mctx, &text1, 65535);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_buffer_allocate(mctx, &text2, 65535);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE, &fast);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE, &full);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/* Plain queries, with and without EDNS. */
+	makequery(www, sizeof(www), dns_rdatatype_a, dns_rdataclass_in,
+		  NULL, NOOPT, 0, 0, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+	makequery(root, sizeof(root), dns_rdatatype_ns, dns_rdataclass_in,
+		  NULL, 0, 0, 0, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+	makequery(www, sizeof(www), dns_rdatatype_txt, dns_rdataclass_ch,
+		  cookie, sizeof(cookie), 0x8000, 0, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+	makequery(www, sizeof(www), dns_rdatatype_aaaa, dns_rdataclass_in,
+		  ecs, sizeof(ecs), 0, 0, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+	makequery(www, sizeof(www), dns_rdatatype_tkey, dns_rdataclass_any,
+		  NULL, 0, 0, 0, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+	ATF_CHECK_EQ(fast->tkey, 1);
+
+	/* Extended RCODE bits in the OPT TTL. */
+	makequery(www, sizeof(www), dns_rdatatype_a, dns_rdataclass_in,
+		  NULL, 0, 0x01000000, 0, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+
+	/* Bad OPT options. */
+	makequery(www, sizeof(www), dns_rdatatype_a, dns_rdataclass_in,
+		  badecs, sizeof(badecs), 0, 0, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+	makequery(www, sizeof(www), dns_rdatatype_a, dns_rdataclass_in,
+		  truncopt, sizeof(truncopt), 0, 0, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+
+	/* Messages which are not for the fast path. */
+	makequery(compressed, sizeof(compressed) - 1, dns_rdatatype_a,
+		  dns_rdataclass_in, NULL, NOOPT, 0, 0, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+	makequery(badlabel, sizeof(badlabel), dns_rdatatype_a,
+		  dns_rdataclass_in, NULL, NOOPT, 0, 0, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+	makequery(www, sizeof(www), dns_rdatatype_a, dns_rdataclass_in,
+		  cookie, sizeof(cookie), 0, 3, wire);
+	checkfastquery(fast, full, wire, text1, text2);
+	makequery(www, sizeof(www), dns_rdatatype_a, dns_rdataclass_in,
+		  NULL, NOOPT, 0, 0, wire);
+	isc_buffer_subtract(wire, 1);
+	checkfastquery(fast, full, wire, text1, text2);
+
+	dns_message_destroy(&fast);
+	dns_message_destroy(&full);
+	isc_buffer_free(&wire);
+	isc_buffer_free(&text1);
+	isc_buffer_free(&text2);
+
+	dns_test_end();
+}
+
+#ifdef DNS_BENCHMARK_TESTS
+
+/*
+ * Return the average time in nanoseconds to parse and reset 'wire'.
+ */
+static double
+timeparse(dns_message_t *msg, isc_buffer_t *wire, unsigned int options,
+	  unsigned int rounds)
+{
+	isc_time_t ts1, ts2;
+	isc_result_t result;
+	unsigned int i;
+
+	result = isc_time_now(&ts1);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (i = 0; i < rounds; i++) {
+		isc_buffer_t source;
+
+		isc_buffer_init(&source, isc_buffer_base(wire),
+				isc_buffer_usedlength(wire));
+		isc_buffer_add(&source, isc_buffer_usedlength(wire));
+		result = dns_message_parse(msg, &source, options);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		dns_message_reset(msg, DNS_MESSAGE_INTENTPARSE);
+	}
+	result = isc_time_now(&ts2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	return (isc_time_microdiff(&ts2, &ts1) * 1000.0 / rounds);
+}
+
+ATF_TC(benchmark);
+ATF_TC_HEAD(benchmark, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "Benchmark dns_message_parse() with and "
+			  "without DNS_MESSAGEPARSE_ARENA, and the "
+			  "query fast path");
+}
+ATF_TC_BODY(benchmark, tc) {
+	static const unsigned int counts[] = { 0, 5, 20, 100 };
+	static const unsigned char qname[] = "\003www\007example\003org";
+	static const unsigned char cookie[] = {
+		0x00, 0x0a, 0x00, 0x08, 1, 2, 3, 4, 5, 6, 7, 8
+	};
+	const unsigned int rounds = 100000;
+	dns_message_t *msg = NULL;
+	isc_buffer_t *wire = NULL;
+	isc_result_t result;
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_buffer_allocate(mctx, &wire, 65535);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE, &msg);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		isc_buffer_clear(wire);
+		makeresponse(counts[i], 40, wire);
+
+		printf("%4u answers (%5u octets): pools %8.1f ns/parse, "
+		       "arena %8.1f ns/parse\n", counts[i],
+		       isc_buffer_usedlength(wire),
+		       timeparse(msg, wire, 0, rounds),
+		       timeparse(msg, wire, DNS_MESSAGEPARSE_ARENA, rounds));
+	}
+
+	/*
+	 * DNS_MESSAGEPARSE_PRESERVEORDER disables the query fast path
+	 * without otherwise changing how a query is parsed.
+	 */
+	makequery(qname, sizeof(qname), dns_rdatatype_a, dns_rdataclass_in,
+		  cookie, sizeof(cookie), 0, 0, wire);
+	printf("query with cookie (%u octets): full %8.1f ns/parse, "
+	       "fast path %8.1f ns/parse\n", isc_buffer_usedlength(wire),
+	       timeparse(msg, wire, DNS_MESSAGEPARSE_ARENA |
+			 DNS_MESSAGEPARSE_PRESERVEORDER, rounds),
+	       timeparse(msg, wire, DNS_MESSAGEPARSE_ARENA, rounds));
+
+	dns_message_destroy(&msg);
+	isc_buffer_free(&wire);
+
+	dns_test_end();
+}
+#endif /* DNS_BENCHMARK_TESTS */
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, arena);
+	ATF_TP_ADD_TC(tp, arenareuse);
+	ATF_TP_ADD_TC(tp, fastquery);
+#ifdef DNS_BENCHMARK_TESTS
+	ATF_TP_ADD_TC(tp, benchmark);
+#endif
+
+	return (atf_no_error());
+}
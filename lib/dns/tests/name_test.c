@@ -13,6 +13,7 @@
 
 #include <config.h>
 
+#include <ctype.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -26,7 +27,9 @@
 #include <isc/mem.h>
 #include <isc/os.h>
 #include <isc/print.h>
+#include <isc/random.h>
 #include <isc/thread.h>
+#include <isc/time.h>
 #include <isc/util.h>
 
 #include <dns/compress.h>
@@ -648,6 +651,171 @@ ATF_TC_BODY(getlabelsequence, tc) {
 	}
 }
 
+/*
+ * Build a random absolute name in 'wire' whose labels are drawn from
+ * all 256 octet values, so that case folding is exercised on letters,
+ * non-letters and octets with the high bit set.
+ */
+static void
+random_name(unsigned char *wire, dns_name_t *name) {
+	isc_region_t r;
+	unsigned int labels, length = 0, i, j;
+
+	labels = 1 + isc_random_uniform(8);
+	for (i = 0; i < labels; i++) {
+		unsigned int count = 1 + isc_random_uniform(63);
+
+		if (length + count + 2 > DNS_NAME_MAXWIRE)
+			break;
+		wire[length++] = count;
+		for (j = 0; j < count; j++)
+			wire[length++] = isc_random_uniform(256);
+	}
+	wire[length++] = 0;
+
+	r.base = wire;
+	r.length = length;
+	dns_name_reset(name);
+	dns_name_fromregion(name, &r);
+}
+
+/*
+ * Change the case of some letters in 'name' in place.
+ */
+static void
+mutate_case(dns_name_t *name) {
+	unsigned int i;
+
+	for (i = 0; i < name->length; i++) {
+		unsigned char c = name->ndata[i];
+
+		if (((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) &&
+		    isc_random_uniform(2) == 0)
+		{
+			name->ndata[i] = c ^ 0x20;
+		}
+	}
+}
+
+static int
+sign(int value) {
+	return ((value < 0) ? -1 : (value > 0) ? 1 : 0);
+}
+
+static unsigned char
+ref_tolower(unsigned char c) {
+	return ((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+}
+
+/*
+ * DNSSEC ordering of two absolute names, one octet at a time.
+ */
+static int
+ref_compare(const dns_name_t *n1, const dns_name_t *n2) {
+	unsigned char offsets1[128], offsets2[128];
+	unsigned int l1, l2, i;
+	unsigned int off;
+
+	for (l1 = 0, off = 0; off < n1->length; off += n1->ndata[off] + 1)
+		offsets1[l1++] = off;
+	for (l2 = 0, off = 0; off < n2->length; off += n2->ndata[off] + 1)
+		offsets2[l2++] = off;
+
+	while (l1 > 0 && l2 > 0) {
+		const unsigned char *label1 = &n1->ndata[offsets1[--l1]];
+		const unsigned char *label2 = &n2->ndata[offsets2[--l2]];
+		unsigned int count = ISC_MIN(label1[0], label2[0]);
+
+		for (i = 1; i <= count; i++) {
+			int d = ref_tolower(label1[i]) - ref_tolower(label2[i]);
+			if (d != 0)
+				return (d);
+		}
+		if (label1[0] != label2[0])
+			return (label1[0] - label2[0]);
+	}
+
+	return ((int)l1 - (int)l2);
+}
+
+ATF_TC(casefold);
+ATF_TC_HEAD(casefold, tc) {
+	atf_tc_set_md_var(tc, "descr", "case-insensitive name comparison, "
+			  "hashing and downcasing agree with tolower()");
+}
+ATF_TC_BODY(casefold, tc) {
+	unsigned char data1[DNS_NAME_MAXWIRE], data2[DNS_NAME_MAXWIRE];
+	unsigned char data3[DNS_NAME_MAXWIRE];
+	isc_buffer_t b3;
+	dns_name_t n1, n2, n3;
+	unsigned int i, j;
+
+	UNUSED(tc);
+
+	isc_buffer_init(&b3, data3, sizeof(data3));
+	dns_name_init(&n1, NULL);
+	dns_name_init(&n2, NULL);
+	dns_name_init(&n3, NULL);
+
+	for (i = 0; i < 20000; i++) {
+		isc_region_t r;
+		int order;
+		unsigned int nlabels;
+
+		random_name(data1, &n1);
+
+		/* A copy of 'n1' with different case. */
+		dns_name_toregion(&n1, &r);
+		memmove(data2, data1, r.length);
+		r.base = data2;
+		dns_name_reset(&n2);
+		dns_name_fromregion(&n2, &r);
+		mutate_case(&n2);
+
+		ATF_REQUIRE(dns_name_equal(&n1, &n2));
+		ATF_REQUIRE_EQ(dns_name_fullcompare(&n1, &n2, &order,
+						    &nlabels),
+			       dns_namereln_equal);
+		ATF_REQUIRE_EQ(order, 0);
+		ATF_REQUIRE_EQ(nlabels, n1.labels);
+		ATF_REQUIRE_EQ(dns_name_hash(&n1, false),
+			       dns_name_hash(&n2, false));
+		ATF_REQUIRE_EQ(dns_name_fullhash(&n1, false),
+			       dns_name_fullhash(&n2, false));
+		ATF_REQUIRE_EQ(dns_name_caseequal(&n1, &n2),
+			       memcmp(n1.ndata, n2.ndata, n1.length) == 0);
+
+		/* Downcasing matches tolower() on every label octet. */
+		isc_buffer_clear(&b3);
+		dns_name_reset(&n3);
+		ATF_REQUIRE_EQ(dns_name_downcase(&n2, &n3, &b3),
+			       ISC_R_SUCCESS);
+		ATF_REQUIRE_EQ(n3.length, n2.length);
+		ATF_REQUIRE_EQ(n3.labels, n2.labels);
+		for (j = 0; j < n2.length; j++) {
+			ATF_REQUIRE_EQ(n3.ndata[j], ref_tolower(n2.ndata[j]));
+		}
+
+		/* Change one label octet and compare again. */
+		if (n2.length > 1) {
+			unsigned int pos = 1 + isc_random_uniform(n2.length -
+								  1);
+
+			for (j = 0; j < n2.length; j += n2.ndata[j] + 1) {
+				if (j == pos)
+					break;
+			}
+			if (j == pos)
+				continue;
+
+			n2.ndata[pos] ^= 1 << isc_random_uniform(8);
+			order = dns_name_compare(&n1, &n2);
+			ATF_REQUIRE_EQ(sign(order), sign(ref_compare(&n1, &n2)));
+			ATF_REQUIRE_EQ(dns_name_equal(&n1, &n2), order == 0);
+		}
+	}
+}
+
 #ifdef DNS_BENCHMARK_TESTS
 
 /*
@@ -742,6 +910,160 @@ ATF_TC_BODY(benchmark, tc) {
 	dns_test_end();
 }
 
+/*
+ * Names shaped like real query names: zero to three labels such as
+ * "www" or "_dmarc" below a registered domain and a TLD, with about a
+ * quarter of them in mixed case as seen with DNS 0x20 randomization.
+ */
+#define BENCH_NAMES	1024
+#define BENCH_ROUNDS	2048
+
+static void
+bench_names(dns_fixedname_t *names, dns_fixedname_t *mixed) {
+	static const char *prefixes[] = {
+		"www", "mail", "ns1", "ns2", "_dmarc", "api", "cdn", "smtp"
+	};
+	static const char *tlds[] = {
+		"com", "net", "org", "de", "uk", "io", "in-addr.arpa"
+	};
+	char text[DNS_NAME_FORMATSIZE];
+	unsigned int i, j, n;
+	isc_result_t result;
+
+	for (i = 0; i < BENCH_NAMES; i++) {
+		char *p = text;
+		unsigned int labels = isc_random_uniform(4);
+
+		for (j = 0; j < labels; j++) {
+			if (isc_random_uniform(2) == 0) {
+				p += sprintf(p, "%s.", prefixes[
+					isc_random_uniform(8)]);
+			} else {
+				n = 3 + isc_random_uniform(8);
+				while (n-- > 0)
+					*p++ = 'a' + isc_random_uniform(26);
+				*p++ = '.';
+			}
+		}
+		n = 4 + isc_random_uniform(11);
+		while (n-- > 0)
+			*p++ = 'a' + isc_random_uniform(26);
+		sprintf(p, ".%s.", tlds[isc_random_uniform(7)]);
+
+		dns_fixedname_init(&names[i]);
+		result = dns_name_fromstring(dns_fixedname_name(&names[i]),
+					     text, 0, NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		if (isc_random_uniform(4) == 0) {
+			for (p = text; *p != '\0'; p++) {
+				if (isc_random_uniform(2) == 0)
+					*p = toupper((unsigned char)*p);
+			}
+		}
+		dns_fixedname_init(&mixed[i]);
+		result = dns_name_fromstring(dns_fixedname_name(&mixed[i]),
+					     text, 0, NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+}
+
+static void
+bench_report(const char *what, isc_time_t *start) {
+	isc_time_t now;
+	uint64_t t;
+
+	ATF_REQUIRE_EQ(isc_time_now(&now), ISC_R_SUCCESS);
+	t = isc_time_microdiff(&now, start);
+	printf("%-24s %6.1f ns/call\n", what,
+	       (t * 1000.0) / ((double)BENCH_NAMES * BENCH_ROUNDS));
+	*start = now;
+}
+
+ATF_TC(primitives);
+ATF_TC_HEAD(primitives, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "Benchmark name comparison, hashing and "
+			  "downcasing");
+}
+ATF_TC_BODY(primitives, tc) {
+	dns_fixedname_t *names, *mixed, fixed;
+	dns_name_t *target;
+	isc_time_t start;
+	isc_result_t result;
+	unsigned int i, k, nlabels;
+	unsigned int sink = 0;
+	int order;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	names = isc_mem_get(mctx, BENCH_NAMES * sizeof(*names));
+	ATF_REQUIRE(names != NULL);
+	mixed = isc_mem_get(mctx, BENCH_NAMES * sizeof(*mixed));
+	ATF_REQUIRE(mixed != NULL);
+	bench_names(names, mixed);
+	target = dns_fixedname_initname(&fixed);
+
+	ATF_REQUIRE_EQ(isc_time_now(&start), ISC_R_SUCCESS);
+
+	for (k = 0; k < BENCH_ROUNDS; k++) {
+		for (i = 0; i < BENCH_NAMES; i++) {
+			sink += dns_name_equal(dns_fixedname_name(&names[i]),
+					       dns_fixedname_name(&mixed[i]));
+		}
+	}
+	bench_report("dns_name_equal", &start);
+
+	for (k = 0; k < BENCH_ROUNDS; k++) {
+		for (i = 0; i < BENCH_NAMES; i++) {
+			unsigned int j = (i + k + 1) % BENCH_NAMES;
+
+			sink += dns_name_fullcompare(
+					dns_fixedname_name(&names[i]),
+					dns_fixedname_name(&mixed[j]),
+					&order, &nlabels);
+		}
+	}
+	bench_report("dns_name_fullcompare", &start);
+
+	for (k = 0; k < BENCH_ROUNDS; k++) {
+		for (i = 0; i < BENCH_NAMES; i++) {
+			sink += dns_name_hash(dns_fixedname_name(&mixed[i]),
+					      false);
+		}
+	}
+	bench_report("dns_name_hash", &start);
+
+	for (k = 0; k < BENCH_ROUNDS; k++) {
+		for (i = 0; i < BENCH_NAMES; i++) {
+			sink += dns_name_fullhash(
+					dns_fixedname_name(&mixed[i]), false);
+		}
+	}
+	bench_report("dns_name_fullhash", &start);
+
+	for (k = 0; k < BENCH_ROUNDS; k++) {
+		for (i = 0; i < BENCH_NAMES; i++) {
+			result = dns_name_downcase(
+					dns_fixedname_name(&mixed[i]),
+					target, NULL);
+			sink += result;
+		}
+	}
+	bench_report("dns_name_downcase", &start);
+
+	/* Keep the compiler from discarding the calls. */
+	ATF_CHECK(sink != 0);
+
+	isc_mem_put(mctx, names, BENCH_NAMES * sizeof(*names));
+	isc_mem_put(mctx, mixed, BENCH_NAMES * sizeof(*mixed));
+
+	dns_test_end();
+}
+
 #endif /* DNS_BENCHMARK_TESTS */
 
 /*
@@ -760,8 +1082,10 @@ ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, countlabels);
 	ATF_TP_ADD_TC(tp, getlabel);
 	ATF_TP_ADD_TC(tp, getlabelsequence);
+	ATF_TP_ADD_TC(tp, casefold);
 #ifdef DNS_BENCHMARK_TESTS
 	ATF_TP_ADD_TC(tp, benchmark);
+	ATF_TP_ADD_TC(tp, primitives);
 #endif /* DNS_BENCHMARK_TESTS */
 
 	return (atf_no_error());
@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <isc/print.h>
+#include <isc/random.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/fixedname.h>
+#include <dns/name.h>
+#include <dns/rpz.h>
+
+#include "dnstest.h"
+
+/*
+ * Helper functions
+ */
+static void
+setname(dns_name_t *name, const char *label, const char *origin) {
+	char buf[DNS_NAME_FORMATSIZE];
+	isc_result_t result;
+
+	snprintf(buf, sizeof(buf), "%s%s%s", label,
+		 (*label != '\0' && *origin != '\0') ? "." : "", origin);
+	result = dns_name_fromstring(name, buf, DNS_NAME_DOWNCASE, mctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+}
+
+/*
+ * Create 'count' policy zones named "policyN." with the default
+ * names for their special subdomains, as named would configure them.
+ */
+static void
+makezones(unsigned int count, dns_rpz_zones_t **rpzsp) {
+	dns_rpz_zones_t *rpzs = NULL;
+	unsigned int i;
+	isc_result_t result;
+
+	result = dns_rpz_new_zones(&rpzs, NULL, 0, mctx, taskmgr, timermgr);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < count; i++) {
+		dns_rpz_zone_t *rpz = NULL;
+		char origin[64];
+
+		result = dns_rpz_new_zone(rpzs, &rpz);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		snprintf(origin, sizeof(origin), "policy%u", i);
+		setname(&rpz->origin, "", origin);
+		setname(&rpz->client_ip, DNS_RPZ_CLIENT_IP_ZONE, origin);
+		setname(&rpz->ip, DNS_RPZ_IP_ZONE, origin);
+		setname(&rpz->nsdname, DNS_RPZ_NSDNAME_ZONE, origin);
+		setname(&rpz->nsip, DNS_RPZ_NSIP_ZONE, origin);
+		setname(&rpz->passthru, DNS_RPZ_PASSTHRU_NAME, "");
+		setname(&rpz->drop, DNS_RPZ_DROP_NAME, "");
+		setname(&rpz->tcp_only, DNS_RPZ_TCP_ONLY_NAME, "");
+		rpz->max_policy_ttl = DNS_RPZ_MAX_TTL_DEFAULT;
+		rpz->policy = DNS_RPZ_POLICY_GIVEN;
+	}
+
+	*rpzsp = rpzs;
+}
+
+/*
+ * Add the trigger 'trigger' to policy zone 'num' with 'policy'.
+ */
+static void
+addtrigger(dns_rpz_zones_t *rpzs, dns_rpz_num_t num, const char *trigger,
+	   dns_rpz_policy_t policy, dns_ttl_t ttl)
+{
+	dns_fixedname_t fixed;
+	char buf[DNS_NAME_FORMATSIZE];
+	isc_result_t result;
+
+	snprintf(buf, sizeof(buf), "%s.policy%u", trigger, num);
+	dns_test_namefromstring(buf, &fixed);
+
+	result = dns_rpz_add(rpzs, num, dns_fixedname_name(&fixed));
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_rpz_compile(rpzs, num, dns_fixedname_name(&fixed),
+				 policy, ttl);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+}
+
+static void
+deltrigger(dns_rpz_zones_t *rpzs, dns_rpz_num_t num, const char *trigger) {
+	dns_fixedname_t fixed;
+	char buf[DNS_NAME_FORMATSIZE];
+
+	snprintf(buf, sizeof(buf), "%s.policy%u", trigger, num);
+	dns_test_namefromstring(buf, &fixed);
+
+	dns_rpz_delete(rpzs, num, dns_fixedname_name(&fixed));
+}
+
+/*
+ * Look up the QNAME trigger 'qname', returning the zones with hits and
+ * the compiled policy of the first.
+ */
+static dns_rpz_zbits_t
+findqname(dns_rpz_zones_t *rpzs, const char *qname, dns_rpz_num_t *nump,
+	  dns_rpz_policy_t *policyp, dns_ttl_t *ttlp)
+{
+	dns_fixedname_t fixed;
+
+	dns_test_namefromstring(qname, &fixed);
+
+	return (dns_rpz_find_policy(rpzs, DNS_RPZ_TYPE_QNAME,
+				    DNS_RPZ_ALL_ZBITS,
+				    dns_fixedname_name(&fixed),
+				    nump, policyp, ttlp));
+}
+
+/*
+ * Individual unit tests
+ */
+ATF_TC(compile);
+ATF_TC_HEAD(compile, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "dns_rpz_find_policy() returns compiled policies "
+			  "only when they decide the result");
+}
+ATF_TC_BODY(compile, tc) {
+	dns_rpz_zones_t *rpzs = NULL;
+	dns_rpz_zbits_t zbits;
+	dns_rpz_num_t num;
+	dns_rpz_policy_t policy;
+	dns_ttl_t ttl;
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, true);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	makezones(3, &rpzs);
+
+	addtrigger(rpzs, 1, "evil.example", DNS_RPZ_POLICY_NXDOMAIN, 60);
+	addtrigger(rpzs, 2, "evil.example", DNS_RPZ_POLICY_DROP, 30);
+	addtrigger(rpzs, 1, "record.example", DNS_RPZ_POLICY_RECORD, 60);
+	addtrigger(rpzs, 0, "*.wild.example", DNS_RPZ_POLICY_NODATA, 60);
+	addtrigger(rpzs, 2, "a.wild.example", DNS_RPZ_POLICY_TCP_ONLY, 60);
+
+	/* The first zone with a hit has a compiled policy. */
+	zbits = findqname(rpzs, "evil.example", &num, &policy, &ttl);
+	ATF_CHECK_EQ(zbits, DNS_RPZ_ZBIT(1) | DNS_RPZ_ZBIT(2));
+	ATF_CHECK_EQ(num, 1);
+	ATF_CHECK_EQ(policy, DNS_RPZ_POLICY_NXDOMAIN);
+	ATF_CHECK_EQ(ttl, 60);
+
+	/* Records must still come from the policy zone. */
+	zbits = findqname(rpzs, "record.example", &num, &policy, &ttl);
+	ATF_CHECK_EQ(zbits, DNS_RPZ_ZBIT(1));
+	ATF_CHECK_EQ(num, DNS_RPZ_INVALID_NUM);
+
+	/* A wildcard in an earlier zone decides. */
+	zbits = findqname(rpzs, "a.wild.example", &num, &policy, &ttl);
+	ATF_CHECK_EQ(zbits, DNS_RPZ_ZBIT(0) | DNS_RPZ_ZBIT(2));
+	ATF_CHECK_EQ(num, DNS_RPZ_INVALID_NUM);
+
+	zbits = findqname(rpzs, "b.wild.example", &num, &policy, &ttl);
+	ATF_CHECK_EQ(zbits, DNS_RPZ_ZBIT(0));
+	ATF_CHECK_EQ(num, DNS_RPZ_INVALID_NUM);
+
+	zbits = findqname(rpzs, "good.example", &num, &policy, &ttl);
+	ATF_CHECK_EQ(zbits, 0);
+	ATF_CHECK_EQ(num, DNS_RPZ_INVALID_NUM);
+
+	/* Excluding a zone leaves the next zone to decide. */
+	{
+		dns_fixedname_t fixed;
+
+		dns_test_namefromstring("evil.example", &fixed);
+		zbits = dns_rpz_find_policy(rpzs, DNS_RPZ_TYPE_QNAME,
+					    DNS_RPZ_ZBIT(2),
+					    dns_fixedname_name(&fixed),
+					    &num, &policy, &ttl);
+		ATF_CHECK_EQ(zbits, DNS_RPZ_ZBIT(2));
+		ATF_CHECK_EQ(num, DNS_RPZ_INVALID_NUM);
+	}
+
+	/* A changed record forgets the compiled policy. */
+	addtrigger(rpzs, 1, "evil.example", DNS_RPZ_POLICY_RECORD, 60);
+	zbits = findqname(rpzs, "evil.example", &num, &policy, &ttl);
+	ATF_CHECK_EQ(num, DNS_RPZ_INVALID_NUM);
+	addtrigger(rpzs, 1, "evil.example", DNS_RPZ_POLICY_NODATA, 10);
+	zbits = findqname(rpzs, "evil.example", &num, &policy, &ttl);
+	ATF_CHECK_EQ(num, 1);
+	ATF_CHECK_EQ(policy, DNS_RPZ_POLICY_NODATA);
+	ATF_CHECK_EQ(ttl, 10);
+
+	/* So does a deleted trigger. */
+	deltrigger(rpzs, 1, "evil.example");
+	zbits = findqname(rpzs, "evil.example", &num, &policy, &ttl);
+	ATF_CHECK_EQ(zbits, DNS_RPZ_ZBIT(2));
+	ATF_CHECK_EQ(num, DNS_RPZ_INVALID_NUM);
+
+	dns_rpz_detach_rpzs(&rpzs);
+
+	dns_test_end();
+}
+
+#ifdef DNS_BENCHMARK_TESTS
+
+/*
+ * Load a large feed of QNAME triggers spread over many policy zones and
+ * time lookups of names that hit and miss.
+ */
+ATF_TC(benchmark);
+ATF_TC_HEAD(benchmark, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "Benchmark the summary database with a large "
+			  "trigger feed");
+}
+ATF_TC_BODY(benchmark, tc) {
+	static const dns_rpz_policy_t policies[] = {
+		DNS_RPZ_POLICY_NXDOMAIN, DNS_RPZ_POLICY_NODATA,
+		DNS_RPZ_POLICY_DROP, DNS_RPZ_POLICY_RECORD
+	};
+	const unsigned int nzones = 30;
+	const unsigned int ntriggers = 1000000;
+	const unsigned int nnames = 100000;
+	const unsigned int rounds = 10;
+	dns_rpz_zones_t *rpzs = NULL;
+	dns_fixedname_t *names;
+	isc_time_t ts1, ts2, ts3, ts4;
+	unsigned int i, j, hits, compiled;
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	debug_mem_record = false;
+	result = dns_test_begin(NULL, true);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	makezones(nzones, &rpzs);
+
+	result = isc_time_now(&ts1);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (i = 0; i < ntriggers; i++) {
+		char trigger[64];
+
+		snprintf(trigger, sizeof(trigger), "host%u.domain%u.example",
+			 i, i % 1000);
+		addtrigger(rpzs, i % nzones, trigger,
+			   policies[i % (sizeof(policies) /
+					 sizeof(policies[0]))], 300);
+	}
+	result = isc_time_now(&ts2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/*
+	 * A third of the names hit a trigger.
+	 */
+	names = isc_mem_get(mctx, nnames * sizeof(*names));
+	ATF_REQUIRE(names != NULL);
+	for (i = 0; i < nnames; i++) {
+		char qname[64];
+		unsigned int n = isc_random_uniform(ntriggers * 3);
+
+		snprintf(qname, sizeof(qname), "host%u.domain%u.example",
+			 n, n % 1000);
+		dns_test_namefromstring(qname, &names[i]);
+	}
+
+	hits = compiled = 0;
+	result = isc_time_now(&ts3);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (j = 0; j < rounds; j++) {
+		for (i = 0; i < nnames; i++) {
+			dns_rpz_num_t num;
+			dns_rpz_policy_t policy;
+			dns_ttl_t ttl;
+
+			if (dns_rpz_find_policy(rpzs, DNS_RPZ_TYPE_QNAME,
+						DNS_RPZ_ALL_ZBITS,
+						dns_fixedname_name(&names[i]),
+						&num, &policy, &ttl) != 0)
+			{
+				hits++;
+			}
+			if (num != DNS_RPZ_INVALID_NUM) {
+				compiled++;
+			}
+		}
+	}
+	result = isc_time_now(&ts4);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	printf("%u triggers in %u zones: load %8.1f ns/trigger, "
+	       "find %8.1f ns/lookup (%u%% hits, %u%% compiled)\n",
+	       ntriggers, nzones,
+	       isc_time_microdiff(&ts2, &ts1) * 1000.0 / ntriggers,
+	       isc_time_microdiff(&ts4, &ts3) * 1000.0 / (nnames * rounds),
+	       hits * 100 / (nnames * rounds),
+	       compiled * 100 / (nnames * rounds));
+
+	isc_mem_put(mctx, names, nnames * sizeof(*names));
+	dns_rpz_detach_rpzs(&rpzs);
+
+	dns_test_end();
+}
+
+#endif /* DNS_BENCHMARK_TESTS */
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, compile);
+#ifdef DNS_BENCHMARK_TESTS
+	ATF_TP_ADD_TC(tp, benchmark);
+#endif /* DNS_BENCHMARK_TESTS */
+
+	return (atf_no_error());
+}
@@ -16,10 +16,16 @@
 #include <atf-c.h>
 
 #include <stdbool.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <isc/hmacsha.h>
 #include <isc/mem.h>
 #include <isc/print.h>
+#include <isc/stdtime.h>
+#include <isc/thread.h>
+#include <isc/time.h>
+#include <isc/util.h>
 
 #include <dns/rdatalist.h>
 #include <dns/rdataset.h>
@@ -596,6 +602,328 @@ ATF_TC_BODY(algallocated, tc) {
 	ATF_REQUIRE_EQ(dns__tsig_algallocated(dns_rootname), true);
 }
 
+ATF_TC(schedule);
+ATF_TC_HEAD(schedule, tc) {
+	atf_tc_set_md_var(tc, "descr", "contexts copied from a key's HMAC "
+				       "schedule match a freshly keyed HMAC");
+}
+ATF_TC_BODY(schedule, tc) {
+	static const char *data[2] = { "first message", "second message" };
+	/* The second secret is longer than a block and gets hashed. */
+	static const unsigned int lengths[] = { 16, 100 };
+	unsigned char secret[100];
+	unsigned char expect[ISC_SHA256_DIGESTLENGTH];
+	unsigned char digest[ISC_SHA256_DIGESTLENGTH];
+	dst_context_t *ctx[2];
+	dns_fixedname_t fkeyname;
+	dns_name_t *keyname;
+	dns_tsigkey_t *key;
+	isc_hmacsha256_t hmac;
+	isc_buffer_t sigbuf;
+	isc_region_t r;
+	isc_result_t result;
+	unsigned int i, j;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	keyname = dns_fixedname_initname(&fkeyname);
+	result = dns_name_fromstring(keyname, "test", 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < sizeof(secret); i++)
+		secret[i] = (unsigned char)(i * 7 + 1);
+
+	for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+		key = NULL;
+		result = dns_tsigkey_create(keyname, dns_tsig_hmacsha256_name,
+					    secret, lengths[i], false,
+					    NULL, 0, 0, mctx, NULL, &key);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		/*
+		 * Both contexts are copied from the key before either
+		 * is used.
+		 */
+		for (j = 0; j < 2; j++) {
+			ctx[j] = NULL;
+			result = dst_context_create(key->key, mctx,
+						    DNS_LOGCATEGORY_DNSSEC,
+						    true, 0, &ctx[j]);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		}
+
+		for (j = 0; j < 2; j++) {
+			DE_CONST(data[j], r.base);
+			r.length = strlen(data[j]);
+			result = dst_context_adddata(ctx[j], &r);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+			isc_buffer_init(&sigbuf, digest, sizeof(digest));
+			result = dst_context_sign(ctx[j], &sigbuf);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+			ATF_CHECK_EQ(isc_buffer_usedlength(&sigbuf),
+				     sizeof(digest));
+			dst_context_destroy(&ctx[j]);
+
+			isc_hmacsha256_init(&hmac, secret, lengths[i]);
+			isc_hmacsha256_update(&hmac, r.base, r.length);
+			isc_hmacsha256_sign(&hmac, expect, sizeof(expect));
+			ATF_CHECK(memcmp(digest, expect, sizeof(expect)) == 0);
+		}
+
+		dns_tsigkey_detach(&key);
+	}
+
+	dns_test_end();
+}
+
+/*
+ * Look up 'name' in 'ring' and check that the result is 'expect'.
+ */
+static void
+findkey(dns_tsig_keyring_t *ring, const char *name,
+	const dns_name_t *algorithm, isc_result_t expect)
+{
+	dns_fixedname_t fkeyname;
+	dns_name_t *keyname;
+	dns_tsigkey_t *key = NULL;
+	isc_result_t result;
+
+	keyname = dns_fixedname_initname(&fkeyname);
+	result = dns_name_fromstring(keyname, name, 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_tsigkey_find(&key, keyname, algorithm, ring);
+	ATF_CHECK_EQ_MSG(result, expect, "%s: %s", name,
+			 isc_result_totext(result));
+	if (key != NULL) {
+		ATF_CHECK(dns_name_equal(&key->name, keyname));
+		dns_tsigkey_detach(&key);
+	}
+}
+
+/*
+ * Add a key called 'name' to 'ring'.
+ */
+static void
+addkey(dns_tsig_keyring_t *ring, const char *name, bool generated,
+       isc_stdtime_t inception, isc_stdtime_t expire)
+{
+	unsigned char secret[16] = { 0 };
+	dns_fixedname_t fkeyname;
+	dns_name_t *keyname;
+	isc_result_t result;
+
+	keyname = dns_fixedname_initname(&fkeyname);
+	result = dns_name_fromstring(keyname, name, 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_tsigkey_create(keyname, dns_tsig_hmacsha256_name,
+				    secret, sizeof(secret), generated,
+				    generated ? dns_rootname : NULL,
+				    inception, expire, mctx, ring, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+}
+
+ATF_TC(keyring);
+ATF_TC_HEAD(keyring, tc) {
+	atf_tc_set_md_var(tc, "descr", "dns_tsigkey_find() with configured "
+				       "and generated keys");
+}
+ATF_TC_BODY(keyring, tc) {
+	dns_tsig_keyring_t *ring = NULL;
+	isc_result_t result;
+	isc_stdtime_t now;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	isc_stdtime_get(&now);
+
+	result = dns_tsigkeyring_create(mctx, &ring);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	addkey(ring, "key0.example", false, 0, 0);
+	addkey(ring, "key1.example", false, 0, 0);
+	addkey(ring, "gen.example", true, now - 10, now + 3600);
+	addkey(ring, "old.example", true, now - 3600, now - 10);
+
+	findkey(ring, "key0.example", dns_tsig_hmacsha256_name,
+		ISC_R_SUCCESS);
+	findkey(ring, "KEY1.example", NULL, ISC_R_SUCCESS);
+	findkey(ring, "key0.example", dns_tsig_hmacsha1_name,
+		ISC_R_NOTFOUND);
+	findkey(ring, "key2.example", NULL, ISC_R_NOTFOUND);
+	findkey(ring, "example", NULL, ISC_R_NOTFOUND);
+	findkey(ring, "gen.example", NULL, ISC_R_SUCCESS);
+
+	/* The expired key is removed by the first lookup. */
+	findkey(ring, "old.example", NULL, ISC_R_NOTFOUND);
+	ATF_CHECK_EQ(ring->generated, 1);
+	findkey(ring, "old.example", NULL, ISC_R_NOTFOUND);
+
+	dns_tsigkeyring_detach(&ring);
+
+	dns_test_end();
+}
+
+#ifdef DNS_BENCHMARK_TESTS
+#define NKEYS		1000
+#define NTHREADS	4
+
+static dns_tsig_keyring_t *benchring = NULL;
+static dns_name_t *benchname = NULL;
+static unsigned int benchrounds;
+
+/*
+ * Sign an empty request with 'key' into 'buf'.
+ */
+static void
+signrequest(dns_tsigkey_t *key, isc_buffer_t *buf) {
+	dns_message_t *msg = NULL;
+	dns_compress_t cctx;
+	isc_result_t result;
+
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTRENDER, &msg);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	msg->id = 50;
+	result = dns_message_settsigkey(msg, key);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_compress_init(&cctx, -1, mctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	isc_buffer_clear(buf);
+	result = dns_message_renderbegin(msg, &cctx, buf);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_message_renderend(msg);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_compress_invalidate(&cctx);
+	dns_message_destroy(&msg);
+}
+
+/*
+ * Parse the request in 'buf' and verify it against the keys in
+ * 'benchring', as a server does.
+ */
+static void
+verifyrequest(isc_buffer_t *buf) {
+	dns_message_t *msg = NULL;
+	isc_result_t result;
+
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE, &msg);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	isc_buffer_first(buf);
+	result = dns_message_parse(msg, buf, 0);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_tsig_verify(buf, msg, benchring, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_message_destroy(&msg);
+}
+
+static isc_threadresult_t
+finder(isc_threadarg_t arg) {
+	dns_tsigkey_t *key;
+	unsigned int i;
+
+	UNUSED(arg);
+
+	for (i = 0; i < benchrounds; i++) {
+		key = NULL;
+		RUNTIME_CHECK(dns_tsigkey_find(&key, benchname, NULL,
+					       benchring) == ISC_R_SUCCESS);
+		dns_tsigkey_detach(&key);
+	}
+
+	return ((isc_threadresult_t)0);
+}
+
+ATF_TC(benchmark);
+ATF_TC_HEAD(benchmark, tc) {
+	atf_tc_set_md_var(tc, "descr", "Benchmark TSIG signing, verification "
+				       "and key lookup");
+}
+ATF_TC_BODY(benchmark, tc) {
+	const unsigned int rounds = 100000;
+	unsigned char secret[32] = { 0 };
+	isc_thread_t threads[NTHREADS];
+	dns_fixedname_t fkeyname;
+	dns_tsigkey_t *key = NULL;
+	isc_buffer_t *buf = NULL;
+	isc_time_t ts1, ts2;
+	isc_result_t result;
+	char namebuf[64];
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_tsigkeyring_create(mctx, &benchring);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	benchname = dns_fixedname_initname(&fkeyname);
+	for (i = 0; i < NKEYS; i++) {
+		snprintf(namebuf, sizeof(namebuf), "key%u.example", i);
+		result = dns_name_fromstring(benchname, namebuf, 0, NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		result = dns_tsigkey_create(benchname,
+					    dns_tsig_hmacsha256_name,
+					    secret, sizeof(secret), false,
+					    NULL, 0, 0, mctx, benchring,
+					    (i == NKEYS / 2) ? &key : NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+	ATF_REQUIRE(key != NULL);
+	dns_name_copy(&key->name, benchname, NULL);
+
+	result = isc_buffer_allocate(mctx, &buf, 512);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_time_now(&ts1);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (i = 0; i < rounds; i++)
+		signrequest(key, buf);
+	result = isc_time_now(&ts2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	printf("hmac-sha256 sign:   %8.1f ns/message\n",
+	       isc_time_microdiff(&ts2, &ts1) * 1000.0 / rounds);
+
+	result = isc_time_now(&ts1);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (i = 0; i < rounds; i++)
+		verifyrequest(buf);
+	result = isc_time_now(&ts2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	printf("hmac-sha256 verify: %8.1f ns/message (%u keys)\n",
+	       isc_time_microdiff(&ts2, &ts1) * 1000.0 / rounds, NKEYS);
+
+	benchrounds = rounds * 10;
+	result = isc_time_now(&ts1);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (i = 0; i < NTHREADS; i++) {
+		result = isc_thread_create(finder, NULL, &threads[i]);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+	for (i = 0; i < NTHREADS; i++)
+		isc_thread_join(threads[i], NULL);
+	result = isc_time_now(&ts2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	printf("keyring lookup:     %8.1f ns/lookup (%u threads)\n",
+	       isc_time_microdiff(&ts2, &ts1) * 1000.0 /
+	       (benchrounds * NTHREADS), NTHREADS);
+
+	isc_buffer_free(&buf);
+	dns_tsigkey_detach(&key);
+	dns_tsigkeyring_detach(&benchring);
+
+	dns_test_end();
+}
+#endif /* DNS_BENCHMARK_TESTS */
+
 /*
  * Main
  */
@@ -605,6 +933,11 @@ ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, algfromname);
 	ATF_TP_ADD_TC(tp, algnamefromname);
 	ATF_TP_ADD_TC(tp, algallocated);
+	ATF_TP_ADD_TC(tp, schedule);
+	ATF_TP_ADD_TC(tp, keyring);
+#ifdef DNS_BENCHMARK_TESTS
+	ATF_TP_ADD_TC(tp, benchmark);
+#endif
 
 	return (atf_no_error());
 }
@@ -0,0 +1,488 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <isc/netaddr.h>
+#include <isc/print.h>
+#include <isc/random.h>
+#include <isc/time.h>
+#include <isc/util.h>
+
+#include <dns/acl.h>
+#include <dns/fixedname.h>
+#include <dns/iptable.h>
+#include <dns/message.h>
+#include <dns/name.h>
+#include <dns/tsig.h>
+#include <dns/view.h>
+#include <dns/viewindex.h>
+
+#include "dnstest.h"
+
+/*
+ * Helper functions
+ */
+
+static void
+addprefix(dns_acl_t *acl, const char *text, unsigned int bitlen, bool pos) {
+	isc_netaddr_t na;
+	struct in_addr in4;
+	struct in6_addr in6;
+	isc_result_t result;
+
+	if (inet_pton(AF_INET6, text, &in6) == 1) {
+		isc_netaddr_fromin6(&na, &in6);
+	} else {
+		ATF_REQUIRE(inet_pton(AF_INET, text, &in4) == 1);
+		isc_netaddr_fromin(&na, &in4);
+	}
+
+	result = dns_iptable_addprefix(acl->iptable, &na, bitlen, pos);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+}
+
+static void
+addkey(dns_acl_t *acl, const char *text) {
+	dns_aclelement_t *de = &acl->elements[acl->length];
+	dns_fixedname_t fixed;
+	dns_name_t *name = dns_fixedname_initname(&fixed);
+	isc_result_t result;
+
+	result = dns_name_fromstring(name, text, 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	de->type = dns_aclelementtype_keyname;
+	de->negative = false;
+	dns_name_init(&de->keyname, NULL);
+	result = dns_name_dup(name, acl->mctx, &de->keyname);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	de->nestedacl = NULL;
+	acl->node_count++;
+	de->node_num = acl->node_count;
+	acl->length++;
+}
+
+static void
+addlocalnets(dns_acl_t *acl) {
+	dns_aclelement_t *de = &acl->elements[acl->length];
+
+	de->type = dns_aclelementtype_localnets;
+	de->negative = false;
+	dns_name_init(&de->keyname, NULL);
+	de->nestedacl = NULL;
+	acl->node_count++;
+	de->node_num = acl->node_count;
+	acl->length++;
+}
+
+/*
+ * Create 'count' views with a mix of address-only, negated,
+ * dual-stack and key-based match-clients ACLs, followed by a
+ * catch-all view.  If 'localnets' is true some views also match
+ * "localnets".
+ */
+static void
+makeviews(unsigned int count, bool localnets, dns_viewlist_t *viewlist) {
+	unsigned int i;
+	isc_result_t result;
+	char name[64], text[64];
+
+	ISC_LIST_INIT(*viewlist);
+
+	for (i = 0; i <= count; i++) {
+		dns_view_t *view = NULL;
+		dns_acl_t *acl = NULL;
+
+		snprintf(name, sizeof(name), "view%u", i);
+		result = dns_test_makeview(name, &view);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		if (i == count) {
+			result = dns_acl_any(mctx, &view->matchclients);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+			ISC_LIST_APPEND(*viewlist, view, link);
+			continue;
+		}
+
+		result = dns_acl_create(mctx, 2, &acl);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		if (i % 7 == 5) {
+			snprintf(text, sizeof(text), "key%u.", i);
+			addkey(acl, text);
+		}
+		if (i % 2 == 1) {
+			snprintf(text, sizeof(text), "10.%u.%u.128",
+				 i / 256, i % 256);
+			addprefix(acl, text, 25, false);
+		}
+		snprintf(text, sizeof(text), "10.%u.%u.0", i / 256, i % 256);
+		addprefix(acl, text, 24, true);
+		if (i % 3 == 0) {
+			snprintf(text, sizeof(text), "2001:db8:%x::", i);
+			addprefix(acl, text, 48, true);
+		}
+		if (i % 13 == 0) {
+			addprefix(acl, "10.0.0.0", 8, true);
+		}
+		if (localnets && i % 7 == 3) {
+			addlocalnets(acl);
+		}
+		view->matchclients = acl;
+
+		if (i % 9 == 4) {
+			result = dns_acl_create(mctx, 0,
+						&view->matchdestinations);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+			addprefix(view->matchdestinations, "127.0.0.1",
+				  32, true);
+		}
+
+		view->matchrecursiveonly = (i % 5 == 2);
+
+		ISC_LIST_APPEND(*viewlist, view, link);
+	}
+}
+
+static void
+freeviews(dns_viewlist_t *viewlist) {
+	dns_view_t *view;
+
+	while ((view = ISC_LIST_HEAD(*viewlist)) != NULL) {
+		ISC_LIST_UNLINK(*viewlist, view, link);
+		dns_view_detach(&view);
+	}
+}
+
+/*
+ * The view selection loop that the index replaces.
+ */
+static isc_result_t
+linear_find(dns_viewlist_t *viewlist, isc_netaddr_t *srcaddr,
+	    isc_netaddr_t *destaddr, dns_message_t *message,
+	    dns_aclenv_t *env, isc_result_t *sigresult, dns_view_t **viewp)
+{
+	dns_view_t *view;
+
+	for (view = ISC_LIST_HEAD(*viewlist);
+	     view != NULL;
+	     view = ISC_LIST_NEXT(view, link))
+	{
+		if (message->rdclass == view->rdclass ||
+		    message->rdclass == dns_rdataclass_any)
+		{
+			dns_name_t *tsig = NULL;
+
+			*sigresult = dns_message_rechecksig(message, view);
+			if (*sigresult == ISC_R_SUCCESS) {
+				tsig = dns_tsigkey_identity(message->tsigkey);
+			}
+
+			if (dns_acl_allowed(srcaddr, tsig,
+					    view->matchclients, env) &&
+			    dns_acl_allowed(destaddr, tsig,
+					    view->matchdestinations, env) &&
+			    !(view->matchrecursiveonly &&
+			      (message->flags & DNS_MESSAGEFLAG_RD) == 0))
+			{
+				dns_view_attach(view, viewp);
+				return (ISC_R_SUCCESS);
+			}
+		}
+	}
+
+	return (ISC_R_NOTFOUND);
+}
+
+/*
+ * Generate a query source address in or around the prefixes used
+ * by makeviews().
+ */
+static void
+randomaddr(unsigned int count, isc_netaddr_t *na) {
+	uint32_t r = isc_random32();
+	unsigned int v = r % (count + count / 4 + 1);
+	unsigned char a[16];
+
+	memset(a, 0, sizeof(a));
+	switch ((r >> 24) % 4) {
+	case 0:
+	case 1:
+		a[0] = 10;
+		a[1] = v / 256;
+		a[2] = v % 256;
+		a[3] = (r >> 8) & 0xff;
+		isc_netaddr_fromin(na, (struct in_addr *)a);
+		break;
+	case 2:
+		a[0] = 0x20; a[1] = 0x01; a[2] = 0x0d; a[3] = 0xb8;
+		a[4] = v / 256;
+		a[5] = v % 256;
+		a[15] = r & 0xff;
+		isc_netaddr_fromin6(na, (struct in6_addr *)a);
+		break;
+	case 3:
+		a[10] = 0xff; a[11] = 0xff;
+		a[12] = ((r >> 16) & 1) ? 10 : 192;
+		a[13] = v / 256;
+		a[14] = v % 256;
+		a[15] = r & 0xff;
+		isc_netaddr_fromin6(na, (struct in6_addr *)a);
+		break;
+	}
+}
+
+/*
+ * Individual unit tests
+ */
+
+ATF_TC(find);
+ATF_TC_HEAD(find, tc) {
+	atf_tc_set_md_var(tc, "descr", "dns_viewindex_find() selects the "
+			  "same view as a linear scan of the view list");
+}
+ATF_TC_BODY(find, tc) {
+	isc_result_t result, result1, result2, sig1, sig2;
+	dns_viewlist_t viewlist;
+	dns_viewindex_t *index = NULL;
+	dns_message_t *message = NULL;
+	dns_aclenv_t env;
+	isc_netaddr_t src, dst;
+	struct in_addr in4;
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_aclenv_init(mctx, &env);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	addprefix(env.localnets, "10.0.0.0", 12, true);
+
+	makeviews(300, true, &viewlist);
+
+	result = dns_viewindex_create(mctx, &viewlist, &index);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(dns_viewindex_count(index), 301);
+
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE, &message);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	message->rdclass = dns_rdataclass_in;
+
+	for (i = 0; i < 100000; i++) {
+		dns_view_t *view1 = NULL, *view2 = NULL;
+
+		randomaddr(300, &src);
+		in4.s_addr = htonl((i % 3 == 0) ? 0x7f000002 : 0x7f000001);
+		isc_netaddr_fromin(&dst, &in4);
+		message->flags = (i % 2 == 0) ? DNS_MESSAGEFLAG_RD : 0;
+		env.match_mapped = ((i % 4) < 2);
+
+		result1 = linear_find(&viewlist, &src, &dst, message, &env,
+				      &sig1, &view1);
+		result2 = dns_viewindex_find(index, &src, &dst, message, &env,
+					     &sig2, &view2);
+		ATF_REQUIRE_EQ(result1, result2);
+		ATF_REQUIRE_EQ(view1, view2);
+		if (result1 == ISC_R_SUCCESS) {
+			ATF_REQUIRE_EQ(sig1, sig2);
+			dns_view_detach(&view1);
+			dns_view_detach(&view2);
+		}
+	}
+
+	/* A class no view serves. */
+	message->rdclass = dns_rdataclass_chaos;
+	randomaddr(300, &src);
+	{
+		dns_view_t *view = NULL;
+
+		result = dns_viewindex_find(index, &src, &dst, message, &env,
+					    &sig2, &view);
+		ATF_CHECK_EQ(result, ISC_R_NOTFOUND);
+		ATF_CHECK_EQ(view, NULL);
+	}
+
+	dns_message_destroy(&message);
+	dns_viewindex_destroy(&index);
+	ATF_CHECK_EQ(index, NULL);
+	freeviews(&viewlist);
+	dns_aclenv_destroy(&env);
+
+	dns_test_end();
+}
+
+ATF_TC(empty);
+ATF_TC_HEAD(empty, tc) {
+	atf_tc_set_md_var(tc, "descr", "an index over no views matches "
+			  "nothing");
+}
+ATF_TC_BODY(empty, tc) {
+	isc_result_t result, sigresult;
+	dns_viewlist_t viewlist;
+	dns_viewindex_t *index = NULL;
+	dns_message_t *message = NULL;
+	dns_view_t *view = NULL;
+	isc_netaddr_t src;
+	struct in_addr in4;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	ISC_LIST_INIT(viewlist);
+	result = dns_viewindex_create(mctx, &viewlist, &index);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(dns_viewindex_count(index), 0);
+
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE, &message);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	message->rdclass = dns_rdataclass_in;
+
+	in4.s_addr = htonl(0x0a000001);
+	isc_netaddr_fromin(&src, &in4);
+	result = dns_viewindex_find(index, &src, &src, message, NULL,
+				    &sigresult, &view);
+	ATF_CHECK_EQ(result, ISC_R_NOTFOUND);
+
+	dns_message_destroy(&message);
+	dns_viewindex_destroy(&index);
+
+	dns_test_end();
+}
+
+#ifdef DNS_BENCHMARK_TESTS
+
+/*
+ * Compare view selection through the index against the linear scan
+ * for increasing numbers of views.
+ */
+
+ATF_TC(benchmark);
+ATF_TC_HEAD(benchmark, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "Benchmark dns_viewindex_find() against a "
+			  "linear scan as the view count grows");
+}
+ATF_TC_BODY(benchmark, tc) {
+	static const unsigned int counts[] = { 1, 10, 100, 400, 1000 };
+	const unsigned int lookups = 200000;
+	isc_result_t result, sigresult;
+	dns_message_t *message = NULL;
+	dns_aclenv_t env;
+	isc_netaddr_t *addrs, dst;
+	struct in_addr in4;
+	unsigned int i, j;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_aclenv_init(mctx, &env);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTPARSE, &message);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	message->rdclass = dns_rdataclass_in;
+	message->flags = DNS_MESSAGEFLAG_RD;
+
+	in4.s_addr = htonl(0x7f000001);
+	isc_netaddr_fromin(&dst, &in4);
+
+	addrs = isc_mem_get(mctx, lookups * sizeof(*addrs));
+	ATF_REQUIRE(addrs != NULL);
+
+	for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+		dns_viewlist_t viewlist;
+		dns_viewindex_t *index = NULL;
+		isc_time_t ts1, ts2, ts3;
+		uint64_t tlinear, tindex;
+
+		makeviews(counts[i], false, &viewlist);
+		result = dns_viewindex_create(mctx, &viewlist, &index);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		for (j = 0; j < lookups; j++) {
+			randomaddr(counts[i], &addrs[j]);
+		}
+
+		result = isc_time_now(&ts1);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		for (j = 0; j < lookups; j++) {
+			dns_view_t *view = NULL;
+
+			if (linear_find(&viewlist, &addrs[j], &dst, message,
+					&env, &sigresult,
+					&view) == ISC_R_SUCCESS)
+			{
+				dns_view_detach(&view);
+			}
+		}
+		result = isc_time_now(&ts2);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		for (j = 0; j < lookups; j++) {
+			dns_view_t *view = NULL;
+
+			if (dns_viewindex_find(index, &addrs[j], &dst,
+					       message, &env, &sigresult,
+					       &view) == ISC_R_SUCCESS)
+			{
+				dns_view_detach(&view);
+			}
+		}
+		result = isc_time_now(&ts3);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		tlinear = isc_time_microdiff(&ts2, &ts1);
+		tindex = isc_time_microdiff(&ts3, &ts2);
+		printf("%5u views: linear %8.1f ns/lookup, "
+		       "index %8.1f ns/lookup\n", counts[i],
+		       tlinear * 1000.0 / lookups,
+		       tindex * 1000.0 / lookups);
+
+		dns_viewindex_destroy(&index);
+		freeviews(&viewlist);
+	}
+
+	isc_mem_put(mctx, addrs, lookups * sizeof(*addrs));
+	dns_message_destroy(&message);
+	dns_aclenv_destroy(&env);
+
+	dns_test_end();
+}
+
+#endif /* DNS_BENCHMARK_TESTS */
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, find);
+	ATF_TP_ADD_TC(tp, empty);
+#ifdef DNS_BENCHMARK_TESTS
+	ATF_TP_ADD_TC(tp, benchmark);
+#endif /* DNS_BENCHMARK_TESTS */
+
+	return (atf_no_error());
+}
@@ -20,11 +20,17 @@
 
 #include <isc/app.h>
 #include <isc/buffer.h>
+#include <isc/random.h>
+#include <isc/string.h>
 #include <isc/task.h>
+#include <isc/time.h>
 #include <isc/timer.h>
 
 #include <dns/db.h>
+#include <dns/fixedname.h>
 #include <dns/name.h>
+#include <dns/rbt.h>
+#include <dns/result.h>
 #include <dns/view.h>
 #include <dns/zone.h>
 #include <dns/zt.h>
@@ -92,6 +98,118 @@ start_zone_asyncload(isc_task_t *task, isc_event_t *event) {
 	isc_event_free(&event);
 }
 
+/*
+ * Create a zone for 'origin' and mount it in 'zt'.
+ */
+static void
+mountzone(dns_zt_t *zt, const char *origin) {
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	dns_zone_t *zone = NULL;
+	isc_result_t result;
+
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, origin, 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_zone_create(&zone, mctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_zone_setorigin(zone, name);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_zt_mount(zt, zone);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_zone_detach(&zone);
+}
+
+/*
+ * Record the origins of the zones visited by dns_zt_applyfrom(),
+ * stopping after 'limit' zones if it is non-zero.
+ */
+struct visited {
+	char names[256];
+	unsigned int count;
+	unsigned int limit;
+};
+
+static isc_result_t
+visit_zone(dns_zone_t *zone, void *uap) {
+	struct visited *visited = uap;
+	char buf[DNS_NAME_FORMATSIZE];
+
+	if (visited->limit != 0 && visited->count == visited->limit)
+		return (ISC_R_NOMORE);
+
+	dns_name_format(dns_zone_getorigin(zone), buf, sizeof(buf));
+	if (visited->count++ != 0)
+		strlcat(visited->names, " ", sizeof(visited->names));
+	strlcat(visited->names, buf, sizeof(visited->names));
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Walk 'zt' from 'from' (NULL for the start) and check the zones
+ * visited and the result.
+ */
+static void
+checkapplyfrom(dns_zt_t *zt, const char *from, unsigned int limit,
+	       isc_result_t expect, const char *expectnames)
+{
+	dns_fixedname_t fixed;
+	dns_name_t *name = NULL;
+	struct visited visited;
+	isc_result_t result;
+
+	if (from != NULL) {
+		name = dns_fixedname_initname(&fixed);
+		result = dns_name_fromstring(name, from, 0, NULL);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+
+	memset(&visited, 0, sizeof(visited));
+	visited.limit = limit;
+	result = dns_zt_applyfrom(zt, name, visit_zone, &visited);
+	ATF_CHECK_EQ_MSG(result, expect, "%s: %s",
+			 from != NULL ? from : "(start)",
+			 isc_result_totext(result));
+	ATF_CHECK_STREQ_MSG(visited.names, expectnames, "from %s",
+			    from != NULL ? from : "(start)");
+}
+
+/*
+ * Look up 'qname' in 'zt' and check the result and the zone found.
+ */
+static void
+checkfind(dns_zt_t *zt, const char *qname, unsigned int options,
+	  isc_result_t expect, const char *expectzone)
+{
+	dns_fixedname_t fixed, ffixed, efixed;
+	dns_name_t *name, *foundname, *expectname;
+	dns_zone_t *zone = NULL;
+	isc_result_t result;
+
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, qname, 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	foundname = dns_fixedname_initname(&ffixed);
+
+	result = dns_zt_find(zt, name, options, foundname, &zone);
+	ATF_CHECK_EQ_MSG(result, expect, "%s: %s", qname,
+			 isc_result_totext(result));
+	if (expectzone == NULL) {
+		ATF_CHECK(zone == NULL);
+		return;
+	}
+
+	ATF_REQUIRE(zone != NULL);
+	expectname = dns_fixedname_initname(&efixed);
+	result = dns_name_fromstring(expectname, expectzone, 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_MSG(dns_name_equal(dns_zone_getorigin(zone), expectname),
+		      "%s: wrong zone", qname);
+	ATF_CHECK(dns_name_equal(foundname, expectname));
+	dns_zone_detach(&zone);
+}
+
 /*
  * Individual unit tests
  */
@@ -137,6 +255,64 @@ ATF_TC_BODY(apply, tc) {
 	dns_test_end();
 }
 
+ATF_TC(applyfrom);
+ATF_TC_HEAD(applyfrom, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "walk a zone table from a given name");
+}
+ATF_TC_BODY(applyfrom, tc) {
+	dns_zt_t *zt = NULL;
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_zt_create(mctx, dns_rdataclass_in, &zt);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	checkapplyfrom(zt, NULL, 0, ISC_R_SUCCESS, "");
+	checkapplyfrom(zt, "example", 0, ISC_R_SUCCESS, "");
+
+	mountzone(zt, "e.example");
+	mountzone(zt, "example");
+	mountzone(zt, "c.example");
+	mountzone(zt, "a.example");
+
+	/* From the start, in DNSSEC order */
+	checkapplyfrom(zt, NULL, 0, ISC_R_SUCCESS,
+		       "example a.example c.example e.example");
+
+	/* Resuming from an existing zone includes that zone */
+	checkapplyfrom(zt, "c.example", 0, ISC_R_SUCCESS,
+		       "c.example e.example");
+	checkapplyfrom(zt, "example", 0, ISC_R_SUCCESS,
+		       "example a.example c.example e.example");
+	checkapplyfrom(zt, "e.example", 0, ISC_R_SUCCESS, "e.example");
+
+	/* Resuming from a missing name starts with the next zone */
+	checkapplyfrom(zt, "d.example", 0, ISC_R_SUCCESS, "e.example");
+	checkapplyfrom(zt, "www.a.example", 0, ISC_R_SUCCESS,
+		       "c.example e.example");
+	checkapplyfrom(zt, "f.example", 0, ISC_R_SUCCESS, "");
+	checkapplyfrom(zt, "net", 0, ISC_R_SUCCESS, "");
+
+	/* Names sorting before the first zone walk the whole table */
+	checkapplyfrom(zt, ".", 0, ISC_R_SUCCESS,
+		       "example a.example c.example e.example");
+	checkapplyfrom(zt, "com", 0, ISC_R_SUCCESS,
+		       "example a.example c.example e.example");
+
+	/* The walk stops when the action fails */
+	checkapplyfrom(zt, NULL, 2, ISC_R_NOMORE, "example a.example");
+	checkapplyfrom(zt, "b.example", 1, ISC_R_NOMORE, "c.example");
+
+	dns_zt_detach(&zt);
+
+	dns_test_end();
+}
+
 ATF_TC(asyncload_zone);
 ATF_TC_HEAD(asyncload_zone, tc) {
 	atf_tc_set_md_var(tc, "descr", "asynchronous zone load");
@@ -283,12 +459,226 @@ ATF_TC_BODY(asyncload_zt, tc) {
 	dns_test_end();
 }
 
+ATF_TC(find);
+ATF_TC_HEAD(find, tc) {
+	atf_tc_set_md_var(tc, "descr", "find the deepest zone for a name");
+}
+ATF_TC_BODY(find, tc) {
+	dns_fixedname_t fixed;
+	dns_name_t *name;
+	dns_zone_t *zone = NULL;
+	dns_zt_t *zt = NULL;
+	isc_result_t result;
+	char buf[64];
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_zt_create(mctx, dns_rdataclass_in, &zt);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	checkfind(zt, "www.example", 0, ISC_R_NOTFOUND, NULL);
+
+	mountzone(zt, "example");
+	mountzone(zt, "sub.example");
+	mountzone(zt, "a.b.c.sub.example");
+	mountzone(zt, "EXAMPLE.net");
+
+	checkfind(zt, "example", 0, ISC_R_SUCCESS, "example");
+	checkfind(zt, "www.example", 0, DNS_R_PARTIALMATCH, "example");
+	checkfind(zt, "sub.example", 0, ISC_R_SUCCESS, "sub.example");
+	checkfind(zt, "sub.example", DNS_ZTFIND_NOEXACT,
+		  DNS_R_PARTIALMATCH, "example");
+	checkfind(zt, "example", DNS_ZTFIND_NOEXACT, ISC_R_NOTFOUND, NULL);
+	checkfind(zt, "x.b.c.sub.example", 0, DNS_R_PARTIALMATCH,
+		  "sub.example");
+	checkfind(zt, "x.A.B.C.SUB.example", 0, DNS_R_PARTIALMATCH,
+		  "a.b.c.sub.example");
+	checkfind(zt, "www.example.net", 0, DNS_R_PARTIALMATCH,
+		  "example.net");
+	checkfind(zt, "example.com", 0, ISC_R_NOTFOUND, NULL);
+	checkfind(zt, "net", 0, ISC_R_NOTFOUND, NULL);
+
+	/* Enough zones to grow the index several times */
+	for (i = 0; i < 1000; i++) {
+		snprintf(buf, sizeof(buf), "z%u.sub.example", i);
+		mountzone(zt, buf);
+	}
+	mountzone(zt, ".");
+
+	checkfind(zt, "www.z999.sub.example", 0, DNS_R_PARTIALMATCH,
+		  "z999.sub.example");
+	checkfind(zt, "z1000.sub.example", 0, DNS_R_PARTIALMATCH,
+		  "sub.example");
+	checkfind(zt, "example.com", 0, DNS_R_PARTIALMATCH, ".");
+
+	/* Unmounting */
+	name = dns_fixedname_initname(&fixed);
+	result = dns_name_fromstring(name, "sub.example", 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_zt_find(zt, name, 0, NULL, &zone);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_zt_unmount(zt, zone);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_zone_detach(&zone);
+
+	checkfind(zt, "www.sub.example", 0, DNS_R_PARTIALMATCH, "example");
+	checkfind(zt, "www.z5.sub.example", 0, DNS_R_PARTIALMATCH,
+		  "z5.sub.example");
+
+	/* Unmounting by another zone object with the same origin */
+	result = dns_name_fromstring(name, "z5.sub.example", 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_zone_create(&zone, mctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_zone_setorigin(zone, name);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_zt_unmount(zt, zone);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	dns_zone_detach(&zone);
+
+	checkfind(zt, "www.z5.sub.example", 0, DNS_R_PARTIALMATCH, "example");
+	checkfind(zt, "www.z6.sub.example", 0, DNS_R_PARTIALMATCH,
+		  "z6.sub.example");
+
+	dns_zt_detach(&zt);
+
+	dns_test_end();
+}
+
+#ifdef DNS_BENCHMARK_TESTS
+/*
+ * Return the average time in nanoseconds of 'rounds' lookups of the
+ * names in 'qnames', either in 'zt' or, if 'rbt' is non-NULL, in an
+ * RBT holding the same zone origins.
+ */
+static double
+timefind(dns_zt_t *zt, dns_rbt_t *rbt, dns_name_t *qnames,
+	 unsigned int count, unsigned int rounds)
+{
+	dns_fixedname_t fixed;
+	dns_name_t *foundname;
+	dns_zone_t *zone;
+	isc_time_t ts1, ts2;
+	isc_result_t result;
+	unsigned int i;
+	void *data;
+
+	foundname = dns_fixedname_initname(&fixed);
+
+	result = isc_time_now(&ts1);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	for (i = 0; i < rounds; i++) {
+		if (rbt != NULL) {
+			data = NULL;
+			result = dns_rbt_findname(rbt, &qnames[i % count], 0,
+						  foundname, &data);
+		} else {
+			zone = NULL;
+			result = dns_zt_find(zt, &qnames[i % count], 0,
+					     foundname, &zone);
+			if (zone != NULL)
+				dns_zone_detach(&zone);
+		}
+		ATF_REQUIRE(result == DNS_R_PARTIALMATCH);
+	}
+	result = isc_time_now(&ts2);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	return (isc_time_microdiff(&ts2, &ts1) * 1000.0 / rounds);
+}
+
+ATF_TC(benchmark);
+ATF_TC_HEAD(benchmark, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "Benchmark dns_zt_find() with many zones");
+}
+ATF_TC_BODY(benchmark, tc) {
+	static const unsigned int sizes[] = { 100, 10000, 200000 };
+	const unsigned int nqnames = 10000, rounds = 1000000;
+	dns_fixedname_t *fqnames;
+	dns_name_t *qnames, *origin;
+	dns_fixedname_t fixed;
+	dns_rbt_t *rbt;
+	dns_zt_t *zt;
+	isc_result_t result;
+	char buf[128];
+	unsigned int i, j, n;
+
+	UNUSED(tc);
+
+	debug_mem_record = false;
+	result = dns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	fqnames = isc_mem_get(mctx, nqnames * sizeof(*fqnames));
+	ATF_REQUIRE(fqnames != NULL);
+	qnames = isc_mem_get(mctx, nqnames * sizeof(*qnames));
+	ATF_REQUIRE(qnames != NULL);
+
+	origin = dns_fixedname_initname(&fixed);
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		zt = NULL;
+		result = dns_zt_create(mctx, dns_rdataclass_in, &zt);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		rbt = NULL;
+		result = dns_rbt_create(mctx, NULL, NULL, &rbt);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		for (j = 0; j < sizes[i]; j++) {
+			snprintf(buf, sizeof(buf), "customer-%u.example%u.com",
+				 j, j % 10);
+			mountzone(zt, buf);
+			result = dns_name_fromstring(origin, buf, 0, NULL);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+			result = dns_rbt_addname(rbt, origin, &rbt);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		}
+		mountzone(zt, ".");
+		result = dns_rbt_addname(rbt, dns_rootname, &rbt);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		for (j = 0; j < nqnames; j++) {
+			n = isc_random_uniform(sizes[i] * 2);
+			snprintf(buf, sizeof(buf),
+				 "www.host%u.customer-%u.example%u.com",
+				 j, n, n % 10);
+			qnames[j] = *dns_fixedname_initname(&fqnames[j]);
+			result = dns_name_fromstring(&qnames[j], buf, 0,
+						     NULL);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		}
+
+		printf("%6u zones: rbt %6.1f ns/find, zt %6.1f ns/find\n",
+		       sizes[i], timefind(zt, rbt, qnames, nqnames, rounds),
+		       timefind(zt, NULL, qnames, nqnames, rounds));
+
+		dns_rbt_destroy(&rbt);
+		dns_zt_detach(&zt);
+	}
+
+	isc_mem_put(mctx, qnames, nqnames * sizeof(*qnames));
+	isc_mem_put(mctx, fqnames, nqnames * sizeof(*fqnames));
+
+	dns_test_end();
+}
+#endif /* DNS_BENCHMARK_TESTS */
+
 /*
  * Main
  */
 ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, apply);
+	ATF_TP_ADD_TC(tp, applyfrom);
 	ATF_TP_ADD_TC(tp, asyncload_zone);
 	ATF_TP_ADD_TC(tp, asyncload_zt);
+	ATF_TP_ADD_TC(tp, find);
+#ifdef DNS_BENCHMARK_TESTS
+	ATF_TP_ADD_TC(tp, benchmark);
+#endif
 	return (atf_no_error());
 }
@@ -1748,12 +1748,26 @@ dns_tsigkey_find(dns_tsigkey_t **tsigkey, const dns_name_t *name,
 	REQUIRE(name != NULL);
 	REQUIRE(ring != NULL);
 
-	RWLOCK(&ring->lock, isc_rwlocktype_write);
-	cleanup_ring(ring);
-	RWUNLOCK(&ring->lock, isc_rwlocktype_write);
-
 	isc_stdtime_get(&now);
 	RWLOCK(&ring->lock, isc_rwlocktype_read);
+
+	/*
+	 * Only generated keys expire, so a ring of configured keys is
+	 * searched under the read lock alone.  Otherwise scan for
+	 * expired keys at most once a second, rather than taking the
+	 * write lock and walking the whole ring on every lookup.
+	 */
+	if (ring->generated != 0 && ring->lastclean != now) {
+		RWUNLOCK(&ring->lock, isc_rwlocktype_read);
+		RWLOCK(&ring->lock, isc_rwlocktype_write);
+		if (ring->lastclean != now) {
+			ring->lastclean = now;
+			cleanup_ring(ring);
+		}
+		RWUNLOCK(&ring->lock, isc_rwlocktype_write);
+		RWLOCK(&ring->lock, isc_rwlocktype_read);
+	}
+
 	key = NULL;
 	result = dns_rbt_findname(ring->keys, name, 0, NULL, (void *)&key);
 	if (result == DNS_R_PARTIALMATCH || result == ISC_R_NOTFOUND) {
@@ -1840,6 +1854,7 @@ dns_tsigkeyring_create(isc_mem_t *mctx, dns_tsig_keyring_t **ringp) {
 	ring->generated = 0;
 	ring->maxgenerated = DNS_TSIG_MAXGENERATEDKEYS;
 	ISC_LIST_INIT(ring->lru);
+	ring->lastclean = 0;
 	isc_mem_attach(mctx, &ring->mctx);
 	ring->references = 1;
 
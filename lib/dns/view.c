@@ -23,6 +23,7 @@
 
 #include <isc/file.h>
 #include <isc/hash.h>
+#include <isc/histo.h>
 #include <isc/lex.h>
 #include <isc/print.h>
 #include <isc/sha2.h>
@@ -176,6 +177,7 @@ dns_view_create(isc_mem_t *mctx, dns_rdataclass_t rdclass,
 	view->adbstats = NULL;
 	view->resstats = NULL;
 	view->resquerystats = NULL;
+	view->latency = NULL;
 	view->cacheshared = false;
 	ISC_LIST_INIT(view->dns64);
 	view->dns64cnt = 0;
@@ -227,6 +229,9 @@ dns_view_create(isc_mem_t *mctx, dns_rdataclass_t rdclass,
 	view->staleanswerttl = 1;
 	view->staleanswersok = dns_stale_answer_conf;
 	view->staleanswersenable = false;
+	view->sendclientsubnet = false;
+	view->ecsclients = NULL;
+	view->ecsservers = NULL;
 	view->nocookieudp = 0;
 	view->padding = 0;
 	view->pad_acl = NULL;
@@ -261,6 +266,9 @@ dns_view_create(isc_mem_t *mctx, dns_rdataclass_t rdclass,
 	view->v6bias = 0;
 	view->dtenv = NULL;
 	view->dttypes = 0;
+	view->dtsample = 0;
+	view->dtprefix4 = 0;
+	view->dtprefix6 = 0;
 
 	result = isc_mutex_init(&view->new_zone_lock);
 	if (result != ISC_R_SUCCESS)
@@ -455,6 +463,10 @@ destroy(dns_view_t *view) {
 		dns_acl_detach(&view->aaaa_acl);
 	if (view->pad_acl != NULL)
 		dns_acl_detach(&view->pad_acl);
+	if (view->ecsclients != NULL)
+		dns_acl_detach(&view->ecsclients);
+	if (view->ecsservers != NULL)
+		dns_acl_detach(&view->ecsservers);
 	if (view->answeracl_exclude != NULL)
 		dns_rbt_destroy(&view->answeracl_exclude);
 	if (view->denyanswernames != NULL)
@@ -502,6 +514,8 @@ destroy(dns_view_t *view) {
 		isc_stats_detach(&view->resstats);
 	if (view->resquerystats != NULL)
 		dns_stats_detach(&view->resquerystats);
+	if (view->latency != NULL)
+		isc_histo_detach(&view->latency);
 	if (view->secroots_priv != NULL)
 		dns_keytable_detach(&view->secroots_priv);
 	if (view->ntatable_priv != NULL)
@@ -1841,6 +1855,25 @@ dns_view_getresquerystats(dns_view_t *view, dns_stats_t **statsp) {
 		dns_stats_attach(view->resquerystats, statsp);
 }
 
+void
+dns_view_setlatency(dns_view_t *view, isc_histo_t *histo) {
+	REQUIRE(DNS_VIEW_VALID(view));
+	REQUIRE(!view->frozen);
+	REQUIRE(view->latency == NULL);
+	REQUIRE(isc_histo_nhistos(histo) == dns_latency_max);
+
+	isc_histo_attach(histo, &view->latency);
+}
+
+void
+dns_view_getlatency(dns_view_t *view, isc_histo_t **histop) {
+	REQUIRE(DNS_VIEW_VALID(view));
+	REQUIRE(histop != NULL && *histop == NULL);
+
+	if (view->latency != NULL)
+		isc_histo_attach(view->latency, histop);
+}
+
 isc_result_t
 dns_view_initntatable(dns_view_t *view,
 		      isc_taskmgr_t *taskmgr, isc_timermgr_t *timermgr)
@@ -0,0 +1,602 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/netaddr.h>
+#include <isc/radix.h>
+#include <isc/util.h>
+
+#include <dns/acl.h>
+#include <dns/message.h>
+#include <dns/tsig.h>
+#include <dns/view.h>
+#include <dns/viewindex.h>
+
+#define VIEWINDEX_MAGIC		ISC_MAGIC('V','w','I','x')
+#define VALID_VIEWINDEX(x)	ISC_MAGIC_VALID(x, VIEWINDEX_MAGIC)
+
+typedef enum {
+	clients_static,		/*%< address prefixes only */
+	clients_keys,		/*%< prefixes and key names */
+	clients_dynamic		/*%< anything else */
+} clientstype_t;
+
+typedef struct viewentry {
+	dns_view_t *		view;
+	clientstype_t		clients;
+	bool			anydest;	/*%< match-destinations
+						     accepts everything */
+	bool			destsig;	/*%< match-destinations
+						     has non-address
+						     elements */
+} viewentry_t;
+
+/*%
+ * A candidate view for a cell.  If 'evaluate' is false the address
+ * prefixes of match-clients already accept every address in the
+ * cell; otherwise match-clients has to be checked in full.
+ */
+typedef struct viewcand {
+	unsigned int		view;		/*%< index into 'views' */
+	bool			evaluate;
+} viewcand_t;
+
+typedef struct candlist {
+	unsigned int		count;
+	viewcand_t *		cands;
+} candlist_t;
+
+/*%
+ * Candidate views for one cell of the index, in view list order:
+ * [0] for queries without a TSIG, for which key name elements can
+ * never match, and [1] for queries with one.
+ */
+typedef struct viewcell {
+	candlist_t		lists[2];
+} viewcell_t;
+
+struct dns_viewindex {
+	unsigned int		magic;
+	isc_mem_t *		mctx;
+	unsigned int		count;
+	viewentry_t *		views;
+	isc_radix_tree_t *	radix;
+	viewcell_t		nomatch[RADIX_FAMILIES];
+};
+
+/*%
+ * A prefix collected from a match-clients ACL.
+ */
+typedef struct viewprefix {
+	int			family;
+	unsigned int		bitlen;
+	unsigned char		addr[16];
+} viewprefix_t;
+
+static bool
+isstatic(dns_acl_t *acl) {
+	return (acl == NULL || acl->length == 0);
+}
+
+static clientstype_t
+clientstype(dns_acl_t *acl) {
+	unsigned int i;
+
+	if (isstatic(acl))
+		return (clients_static);
+
+	for (i = 0; i < acl->length; i++) {
+		if (acl->elements[i].type != dns_aclelementtype_keyname)
+			return (clients_dynamic);
+	}
+
+	return (clients_keys);
+}
+
+static void
+setprefix(isc_prefix_t *pfx, int fam, const unsigned char *addr,
+	  unsigned int bitlen)
+{
+	memset(pfx, 0, sizeof(*pfx));
+	pfx->family = (fam == RADIX_V6) ? AF_INET6 : AF_INET;
+	pfx->bitlen = bitlen;
+	memmove(&pfx->add, addr, (bitlen + 7) / 8);
+	isc_refcount_init(&pfx->refcount, 0);
+}
+
+/*
+ * Sort collected prefixes longest first.
+ */
+static int
+prefix_compare(const void *a, const void *b) {
+	const viewprefix_t *pa = a, *pb = b;
+
+	if (pa->bitlen != pb->bitlen)
+		return ((pa->bitlen > pb->bitlen) ? -1 : 1);
+	return (0);
+}
+
+/*
+ * Collect the non-zero-length prefixes of 'acl' into '*prefixesp',
+ * growing the array as necessary.
+ */
+static isc_result_t
+collect_prefixes(isc_mem_t *mctx, dns_acl_t *acl, viewprefix_t **prefixesp,
+		 unsigned int *countp, unsigned int *allocp)
+{
+	isc_radix_node_t *node;
+	int fam;
+
+	if (acl == NULL || acl->iptable->radix->head == NULL)
+		return (ISC_R_SUCCESS);
+
+	RADIX_WALK(acl->iptable->radix->head, node) {
+		for (fam = 0; fam < RADIX_FAMILIES; fam++) {
+			viewprefix_t *p;
+
+			if (node->node_num[fam] == -1 || node->bit == 0)
+				continue;
+
+			if (*countp == *allocp) {
+				unsigned int newalloc = *allocp * 2 + 64;
+				viewprefix_t *tmp;
+
+				tmp = isc_mem_get(mctx,
+						  newalloc * sizeof(*tmp));
+				if (tmp == NULL)
+					return (ISC_R_NOMEMORY);
+				if (*prefixesp != NULL) {
+					memmove(tmp, *prefixesp,
+						*countp * sizeof(*tmp));
+					isc_mem_put(mctx, *prefixesp,
+						    *allocp * sizeof(*tmp));
+				}
+				*prefixesp = tmp;
+				*allocp = newalloc;
+			}
+
+			p = &(*prefixesp)[(*countp)++];
+			memset(p, 0, sizeof(*p));
+			p->family = fam;
+			p->bitlen = node->bit;
+			memmove(p->addr, isc_prefix_touchar(node->prefix),
+				(node->bit + 7) / 8);
+		}
+	} RADIX_WALK_END;
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Work out how match-clients ACL 'acl' treats addresses in the cell
+ * 'pfx'.  Every prefix in 'acl' which contains an address in the
+ * cell also contains 'pfx', so searching for 'pfx' itself gives the
+ * same first match in the IP table as searching for the address.
+ *
+ * Sets '*allowed' to whether the IP table accepts the cell and
+ * '*decided' to whether that answer stands regardless of the ACL's
+ * other elements, i.e. the IP table match precedes all of them.
+ */
+static void
+cell_match(dns_acl_t *acl, isc_prefix_t *pfx, bool *allowed, bool *decided) {
+	isc_radix_node_t *node = NULL;
+	isc_result_t result;
+	int fam, match_num = -1;
+
+	*allowed = false;
+	*decided = true;
+
+	if (acl == NULL) {
+		*allowed = true;
+		return;
+	}
+
+	result = isc_radix_search(acl->iptable->radix, &node, pfx);
+	if (result == ISC_R_SUCCESS && node != NULL) {
+		fam = ISC_RADIX_FAMILY(pfx);
+		match_num = node->node_num[fam];
+		*allowed = *(bool *) node->data[fam];
+	}
+
+	/* Elements are sorted by node_num. */
+	if (acl->length != 0 &&
+	    (match_num == -1 || acl->elements[0].node_num < match_num))
+	{
+		*decided = false;
+	}
+}
+
+static isc_result_t
+build_list(dns_viewindex_t *index, isc_prefix_t *pfx, bool signedq,
+	   candlist_t *list)
+{
+	viewcand_t *cands;
+	unsigned int i, n = 0;
+
+	list->count = 0;
+	list->cands = NULL;
+
+	if (index->count == 0)
+		return (ISC_R_SUCCESS);
+
+	cands = isc_mem_get(index->mctx, index->count * sizeof(*cands));
+	if (cands == NULL)
+		return (ISC_R_NOMEMORY);
+
+	for (i = 0; i < index->count; i++) {
+		viewentry_t *entry = &index->views[i];
+		bool allowed, decided;
+
+		cell_match(entry->view->matchclients, pfx,
+			   &allowed, &decided);
+
+		/*
+		 * Without a TSIG the signer is NULL, and key name
+		 * elements cannot match.
+		 */
+		if (!signedq && entry->clients == clients_keys)
+			decided = true;
+
+		if (!decided || allowed) {
+			cands[n].view = i;
+			cands[n].evaluate = !decided;
+			n++;
+		}
+	}
+
+	if (n != 0) {
+		list->cands = isc_mem_get(index->mctx, n * sizeof(*cands));
+		if (list->cands == NULL) {
+			isc_mem_put(index->mctx, cands,
+				    index->count * sizeof(*cands));
+			return (ISC_R_NOMEMORY);
+		}
+		memmove(list->cands, cands, n * sizeof(*cands));
+		list->count = n;
+	}
+
+	isc_mem_put(index->mctx, cands, index->count * sizeof(*cands));
+	return (ISC_R_SUCCESS);
+}
+
+static void
+free_cell(isc_mem_t *mctx, viewcell_t *cell) {
+	unsigned int i;
+
+	for (i = 0; i < 2; i++) {
+		candlist_t *list = &cell->lists[i];
+
+		if (list->cands != NULL) {
+			isc_mem_put(mctx, list->cands,
+				    list->count * sizeof(viewcand_t));
+			list->cands = NULL;
+		}
+		list->count = 0;
+	}
+}
+
+static isc_result_t
+build_cell(dns_viewindex_t *index, isc_prefix_t *pfx, viewcell_t *cell) {
+	isc_result_t result;
+
+	cell->lists[1].count = 0;
+	cell->lists[1].cands = NULL;
+
+	result = build_list(index, pfx, false, &cell->lists[0]);
+	if (result == ISC_R_SUCCESS)
+		result = build_list(index, pfx, true, &cell->lists[1]);
+	if (result != ISC_R_SUCCESS)
+		free_cell(index->mctx, cell);
+
+	return (result);
+}
+
+isc_result_t
+dns_viewindex_create(isc_mem_t *mctx, dns_viewlist_t *viewlist,
+		     dns_viewindex_t **indexp)
+{
+	dns_viewindex_t *index;
+	dns_view_t *view;
+	viewprefix_t *prefixes = NULL;
+	unsigned int nprefixes = 0, alloc = 0;
+	isc_radix_node_t *node;
+	isc_prefix_t pfx;
+	unsigned int i;
+	isc_result_t result;
+	int fam;
+
+	REQUIRE(mctx != NULL);
+	REQUIRE(viewlist != NULL);
+	REQUIRE(indexp != NULL && *indexp == NULL);
+
+	index = isc_mem_get(mctx, sizeof(*index));
+	if (index == NULL)
+		return (ISC_R_NOMEMORY);
+
+	index->mctx = NULL;
+	isc_mem_attach(mctx, &index->mctx);
+	index->count = 0;
+	index->views = NULL;
+	index->radix = NULL;
+	memset(index->nomatch, 0, sizeof(index->nomatch));
+	index->magic = VIEWINDEX_MAGIC;
+
+	for (view = ISC_LIST_HEAD(*viewlist);
+	     view != NULL;
+	     view = ISC_LIST_NEXT(view, link))
+	{
+		index->count++;
+	}
+
+	if (index->count != 0) {
+		index->views = isc_mem_get(mctx,
+					   index->count * sizeof(viewentry_t));
+		if (index->views == NULL) {
+			index->count = 0;
+			result = ISC_R_NOMEMORY;
+			goto cleanup;
+		}
+		memset(index->views, 0, index->count * sizeof(viewentry_t));
+	}
+
+	i = 0;
+	for (view = ISC_LIST_HEAD(*viewlist);
+	     view != NULL;
+	     view = ISC_LIST_NEXT(view, link))
+	{
+		viewentry_t *entry = &index->views[i++];
+
+		entry->view = NULL;
+		dns_view_weakattach(view, &entry->view);
+		entry->clients = clientstype(view->matchclients);
+		entry->anydest = (view->matchdestinations == NULL ||
+				  dns_acl_isany(view->matchdestinations));
+		entry->destsig = !isstatic(view->matchdestinations);
+
+		result = collect_prefixes(mctx, view->matchclients,
+					  &prefixes, &nprefixes, &alloc);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup;
+	}
+
+	/*
+	 * Insert the prefixes longest first.  isc_radix_search() returns
+	 * the matching node that was inserted earliest, which then is
+	 * the longest match: the cell an address belongs to.
+	 */
+	result = isc_radix_create(mctx, &index->radix, RADIX_MAXBITS);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup;
+
+	if (nprefixes != 0)
+		qsort(prefixes, nprefixes, sizeof(*prefixes), prefix_compare);
+
+	for (i = 0; i < nprefixes; i++) {
+		node = NULL;
+		setprefix(&pfx, prefixes[i].family, prefixes[i].addr,
+			  prefixes[i].bitlen);
+		result = isc_radix_insert(index->radix, &node, NULL, &pfx);
+		isc_refcount_destroy(&pfx.refcount);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup;
+	}
+
+	if (index->radix->head != NULL) {
+		RADIX_WALK(index->radix->head, node) {
+			for (fam = 0; fam < RADIX_FAMILIES; fam++) {
+				viewcell_t *cell;
+
+				if (node->node_num[fam] == -1)
+					continue;
+
+				cell = isc_mem_get(mctx, sizeof(*cell));
+				if (cell == NULL) {
+					result = ISC_R_NOMEMORY;
+					goto cleanup;
+				}
+				setprefix(&pfx, fam,
+					  isc_prefix_touchar(node->prefix),
+					  node->bit);
+				result = build_cell(index, &pfx, cell);
+				isc_refcount_destroy(&pfx.refcount);
+				if (result != ISC_R_SUCCESS) {
+					isc_mem_put(mctx, cell, sizeof(*cell));
+					goto cleanup;
+				}
+				node->data[fam] = cell;
+			}
+		} RADIX_WALK_END;
+	}
+
+	/*
+	 * Addresses outside every collected prefix can only be matched
+	 * by a zero-length prefix ("any") or by non-address elements.
+	 */
+	for (fam = 0; fam < RADIX_FAMILIES; fam++) {
+		unsigned char zero[16];
+
+		memset(zero, 0, sizeof(zero));
+		setprefix(&pfx, fam, zero, 0);
+		result = build_cell(index, &pfx, &index->nomatch[fam]);
+		isc_refcount_destroy(&pfx.refcount);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup;
+	}
+
+	if (prefixes != NULL)
+		isc_mem_put(mctx, prefixes, alloc * sizeof(*prefixes));
+
+	*indexp = index;
+	return (ISC_R_SUCCESS);
+
+ cleanup:
+	if (prefixes != NULL)
+		isc_mem_put(mctx, prefixes, alloc * sizeof(*prefixes));
+	dns_viewindex_destroy(&index);
+	return (result);
+}
+
+void
+dns_viewindex_destroy(dns_viewindex_t **indexp) {
+	dns_viewindex_t *index;
+	isc_radix_node_t *node;
+	unsigned int i;
+	int fam;
+
+	REQUIRE(indexp != NULL && VALID_VIEWINDEX(*indexp));
+
+	index = *indexp;
+	*indexp = NULL;
+
+	if (index->radix != NULL) {
+		if (index->radix->head != NULL) {
+			RADIX_WALK(index->radix->head, node) {
+				for (fam = 0; fam < RADIX_FAMILIES; fam++) {
+					viewcell_t *cell = node->data[fam];
+
+					if (cell == NULL)
+						continue;
+					free_cell(index->mctx, cell);
+					isc_mem_put(index->mctx, cell,
+						    sizeof(*cell));
+					node->data[fam] = NULL;
+				}
+			} RADIX_WALK_END;
+		}
+		isc_radix_destroy(index->radix, NULL);
+	}
+
+	for (fam = 0; fam < RADIX_FAMILIES; fam++)
+		free_cell(index->mctx, &index->nomatch[fam]);
+
+	for (i = 0; i < index->count; i++) {
+		if (index->views[i].view != NULL)
+			dns_view_weakdetach(&index->views[i].view);
+	}
+	if (index->views != NULL)
+		isc_mem_put(index->mctx, index->views,
+			    index->count * sizeof(viewentry_t));
+
+	index->magic = 0;
+	isc_mem_putanddetach(&index->mctx, index, sizeof(*index));
+}
+
+isc_result_t
+dns_viewindex_find(dns_viewindex_t *index, isc_netaddr_t *srcaddr,
+		   isc_netaddr_t *destaddr, dns_message_t *message,
+		   dns_aclenv_t *env, isc_result_t *sigresult,
+		   dns_view_t **viewp)
+{
+	const isc_netaddr_t *addr = srcaddr;
+	isc_netaddr_t v4addr;
+	isc_radix_node_t *node = NULL;
+	isc_prefix_t pfx;
+	viewcell_t *cell;
+	candlist_t *list;
+	unsigned int i;
+	isc_result_t result;
+
+	REQUIRE(VALID_VIEWINDEX(index));
+	REQUIRE(message != NULL);
+	REQUIRE(sigresult != NULL);
+	REQUIRE(viewp != NULL && *viewp == NULL);
+
+	/*
+	 * Select the cell the same way dns_acl_match() would look the
+	 * address up in each static ACL.
+	 */
+	if (env != NULL && env->match_mapped &&
+	    addr->family == AF_INET6 &&
+	    IN6_IS_ADDR_V4MAPPED(&addr->type.in6))
+	{
+		isc_netaddr_fromv4mapped(&v4addr, addr);
+		addr = &v4addr;
+	}
+
+	NETADDR_TO_PREFIX_T(addr, pfx,
+			    (addr->family == AF_INET6) ? 128 : 32);
+	result = isc_radix_search(index->radix, &node, &pfx);
+	if (result == ISC_R_SUCCESS && node != NULL) {
+		cell = node->data[ISC_RADIX_FAMILY(&pfx)];
+	} else {
+		cell = &index->nomatch[ISC_RADIX_FAMILY(&pfx)];
+	}
+	isc_refcount_destroy(&pfx.refcount);
+
+	list = &cell->lists[(message->tsig != NULL) ? 1 : 0];
+
+	for (i = 0; i < list->count; i++) {
+		viewcand_t *cand = &list->cands[i];
+		viewentry_t *entry = &index->views[cand->view];
+		dns_view_t *view = entry->view;
+		dns_name_t *tsig = NULL;
+		bool checked = false;
+
+		if (message->rdclass != view->rdclass &&
+		    message->rdclass != dns_rdataclass_any)
+		{
+			continue;
+		}
+
+		if (view->matchrecursiveonly &&
+		    (message->flags & DNS_MESSAGEFLAG_RD) == 0)
+		{
+			continue;
+		}
+
+		if (cand->evaluate || entry->destsig) {
+			*sigresult = dns_message_rechecksig(message, view);
+			if (*sigresult == ISC_R_SUCCESS) {
+				tsig = dns_tsigkey_identity(message->tsigkey);
+			}
+			checked = true;
+		}
+
+		if (cand->evaluate &&
+		    !dns_acl_allowed(srcaddr, tsig, view->matchclients, env))
+		{
+			continue;
+		}
+
+		if (!entry->anydest &&
+		    !dns_acl_allowed(destaddr, tsig,
+				     view->matchdestinations, env))
+		{
+			continue;
+		}
+
+		if (!checked) {
+			*sigresult = dns_message_rechecksig(message, view);
+		}
+
+		dns_view_attach(view, viewp);
+		return (ISC_R_SUCCESS);
+	}
+
+	return (ISC_R_NOTFOUND);
+}
+
+unsigned int
+dns_viewindex_count(dns_viewindex_t *index) {
+	REQUIRE(VALID_VIEWINDEX(index));
+
+	return (index->count);
+}
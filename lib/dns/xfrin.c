@@ -30,6 +30,7 @@
 #include <dns/db.h>
 #include <dns/diff.h>
 #include <dns/events.h>
+#include <dns/fixedname.h>
 #include <dns/journal.h>
 #include <dns/log.h>
 #include <dns/message.h>
@@ -166,6 +167,27 @@ struct dns_xfrin_ctx {
 	 */
 	dns_rdatacallbacks_t	axfr;
 
+	/*%
+	 * The AXFR RRset being accumulated by axfr_putdata().  The
+	 * rdata and data arrays grow as needed and are reused for every
+	 * RRset, so a transfer costs no memory allocation per record
+	 * once they have reached the size of the largest RRset seen.
+	 */
+	struct {
+		dns_fixedname_t	fname;
+		dns_name_t	*name;
+		dns_rdatatype_t	type;
+		dns_rdatatype_t	covers;
+		dns_ttl_t	ttl;
+		dns_rdata_t	*rdata;		/*%< Array of 'size' */
+		unsigned int	count;
+		unsigned int	size;
+		unsigned char	*data;		/*%< Rdata bytes */
+		unsigned int	used;
+		unsigned int	length;
+		uint64_t	nrecords;	/*%< Loaded so far */
+	} axfrset;
+
 	struct {
 		uint32_t 	request_serial;
 		uint32_t 	current_serial;
@@ -261,6 +283,9 @@ axfr_init(dns_xfrin_ctx_t *xfr) {
 		dns_db_detach(&xfr->db);
 
 	CHECK(axfr_makedb(xfr, &xfr->db));
+	xfr->axfrset.count = 0;
+	xfr->axfrset.used = 0;
+	xfr->axfrset.nrecords = 0;
 	dns_rdatacallbacks_init(&xfr->axfr);
 	CHECK(dns_db_beginload(xfr->db, &xfr->axfr));
 	result = ISC_R_SUCCESS;
@@ -286,46 +311,155 @@ axfr_makedb(dns_xfrin_ctx_t *xfr, dns_db_t **dbp) {
 	return (result);
 }
 
+/*
+ * Hand the accumulated RRset to the database being loaded.
+ */
 static isc_result_t
-axfr_putdata(dns_xfrin_ctx_t *xfr, dns_diffop_t op,
-	     dns_name_t *name, dns_ttl_t ttl, dns_rdata_t *rdata)
-{
+axfr_apply(dns_xfrin_ctx_t *xfr) {
 	isc_result_t result;
+	dns_rdatalist_t rdatalist;
+	dns_rdataset_t rdataset;
+	unsigned int i;
+
+	if (xfr->axfrset.count == 0)
+		return (ISC_R_SUCCESS);
+
+	dns_rdatalist_init(&rdatalist);
+	rdatalist.rdclass = xfr->rdclass;
+	rdatalist.type = xfr->axfrset.type;
+	rdatalist.covers = xfr->axfrset.covers;
+	rdatalist.ttl = xfr->axfrset.ttl;
+	for (i = 0; i < xfr->axfrset.count; i++) {
+		ISC_LIST_APPEND(rdatalist.rdata, &xfr->axfrset.rdata[i], link);
+	}
 
-	dns_difftuple_t *tuple = NULL;
+	dns_rdataset_init(&rdataset);
+	CHECK(dns_rdatalist_tordataset(&rdatalist, &rdataset));
+	rdataset.trust = dns_trust_ultimate;
 
-	if (rdata->rdclass != xfr->rdclass)
-		return(DNS_R_BADCLASS);
+	/*
+	 * As in dns_diff_load(), an add that had no effect is not
+	 * an error.
+	 */
+	result = (*xfr->axfr.add)(xfr->axfr.add_private, xfr->axfrset.name,
+				  &rdataset);
+	if (result != ISC_R_SUCCESS && result != DNS_R_UNCHANGED &&
+	    result != DNS_R_NXRRSET)
+		goto failure;
+
+	xfr->axfrset.nrecords += xfr->axfrset.count;
+	xfr->axfrset.count = 0;
+	xfr->axfrset.used = 0;
+
+	if (xfr->maxrecords != 0U &&
+	    xfr->axfrset.nrecords > xfr->maxrecords)
+		FAIL(DNS_R_TOOMANYRECORDS);
 
-	CHECK(dns_zone_checknames(xfr->zone, name, rdata));
-	CHECK(dns_difftuple_create(xfr->diff.mctx, op,
-				   name, ttl, rdata, &tuple));
-	dns_diff_append(&xfr->diff, &tuple);
-	if (++xfr->difflen > 100)
-		CHECK(axfr_apply(xfr));
 	result = ISC_R_SUCCESS;
  failure:
 	return (result);
 }
 
 /*
- * Store a set of AXFR RRs in the database.
+ * Make room for at least one more rdata of 'length' bytes in the
+ * RRset being accumulated.
  */
 static isc_result_t
-axfr_apply(dns_xfrin_ctx_t *xfr) {
-	isc_result_t result;
-	uint64_t records;
+axfr_reserve(dns_xfrin_ctx_t *xfr, unsigned int length) {
+	unsigned int i, size;
+
+	if (xfr->axfrset.count == xfr->axfrset.size) {
+		dns_rdata_t *rdata;
+
+		size = xfr->axfrset.size * 2;
+		if (size == 0)
+			size = 16;
+		rdata = isc_mem_get(xfr->mctx, size * sizeof(*rdata));
+		if (rdata == NULL)
+			return (ISC_R_NOMEMORY);
+		if (xfr->axfrset.rdata != NULL) {
+			memmove(rdata, xfr->axfrset.rdata,
+				xfr->axfrset.count * sizeof(*rdata));
+			isc_mem_put(xfr->mctx, xfr->axfrset.rdata,
+				    xfr->axfrset.size * sizeof(*rdata));
+		}
+		xfr->axfrset.rdata = rdata;
+		xfr->axfrset.size = size;
+	}
 
-	CHECK(dns_diff_load(&xfr->diff, xfr->axfr.add, xfr->axfr.add_private));
-	xfr->difflen = 0;
-	dns_diff_clear(&xfr->diff);
-	if (xfr->maxrecords != 0U) {
-		result = dns_db_getsize(xfr->db, xfr->ver, &records, NULL);
-		if (result == ISC_R_SUCCESS && records > xfr->maxrecords) {
-			result = DNS_R_TOOMANYRECORDS;
-			goto failure;
+	if (xfr->axfrset.length - xfr->axfrset.used < length) {
+		unsigned char *data;
+
+		size = ISC_MAX(xfr->axfrset.length * 2,
+			       xfr->axfrset.used + length);
+		size = ISC_MAX(size, 4096);
+		data = isc_mem_get(xfr->mctx, size);
+		if (data == NULL)
+			return (ISC_R_NOMEMORY);
+		if (xfr->axfrset.data != NULL) {
+			memmove(data, xfr->axfrset.data, xfr->axfrset.used);
+			for (i = 0; i < xfr->axfrset.count; i++) {
+				dns_rdata_t *rdata = &xfr->axfrset.rdata[i];
+				rdata->data = data +
+					(rdata->data - xfr->axfrset.data);
+			}
+			isc_mem_put(xfr->mctx, xfr->axfrset.data,
+				    xfr->axfrset.length);
 		}
+		xfr->axfrset.data = data;
+		xfr->axfrset.length = size;
 	}
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Add an AXFR RR to the RRset being accumulated, handing that RRset
+ * to the database first if this RR does not belong to it.  Unlike
+ * IXFR, no diff tuples are created: the rdata is copied once into
+ * storage that is reused for the whole transfer.
+ */
+static isc_result_t
+axfr_putdata(dns_xfrin_ctx_t *xfr, dns_diffop_t op,
+	     dns_name_t *name, dns_ttl_t ttl, dns_rdata_t *rdata)
+{
+	isc_result_t result;
+	dns_rdatatype_t covers;
+	dns_rdata_t *target;
+
+	REQUIRE(op == DNS_DIFFOP_ADD);
+
+	if (rdata->rdclass != xfr->rdclass)
+		return(DNS_R_BADCLASS);
+
+	CHECK(dns_zone_checknames(xfr->zone, name, rdata));
+
+	covers = (rdata->type == dns_rdatatype_rrsig) ?
+		dns_rdata_covers(rdata) : 0;
+
+	if (xfr->axfrset.count != 0 &&
+	    (xfr->axfrset.type != rdata->type ||
+	     xfr->axfrset.covers != covers ||
+	     !dns_name_equal(xfr->axfrset.name, name)))
+	{
+		CHECK(axfr_apply(xfr));
+	}
+
+	if (xfr->axfrset.count == 0) {
+		dns_name_copy(name, xfr->axfrset.name, NULL);
+		xfr->axfrset.type = rdata->type;
+		xfr->axfrset.covers = covers;
+		xfr->axfrset.ttl = ttl;
+	}
+
+	CHECK(axfr_reserve(xfr, rdata->length));
+	target = &xfr->axfrset.rdata[xfr->axfrset.count++];
+	dns_rdata_init(target);
+	dns_rdata_clone(rdata, target);
+	target->data = xfr->axfrset.data + xfr->axfrset.used;
+	memmove(target->data, rdata->data, rdata->length);
+	xfr->axfrset.used += rdata->length;
+
 	result = ISC_R_SUCCESS;
  failure:
 	return (result);
@@ -728,6 +862,10 @@ xfrin_reset(dns_xfrin_ctx_t *xfr) {
 	dns_diff_clear(&xfr->diff);
 	xfr->difflen = 0;
 
+	xfr->axfrset.count = 0;
+	xfr->axfrset.used = 0;
+	xfr->axfrset.nrecords = 0;
+
 	if (xfr->ixfr.journal != NULL)
 		dns_journal_destroy(&xfr->ixfr.journal);
 
@@ -828,6 +966,15 @@ xfrin_create(isc_mem_t *mctx,
 	dns_diff_init(xfr->mctx, &xfr->diff);
 	xfr->difflen = 0;
 
+	xfr->axfrset.name = dns_fixedname_initname(&xfr->axfrset.fname);
+	xfr->axfrset.rdata = NULL;
+	xfr->axfrset.count = 0;
+	xfr->axfrset.size = 0;
+	xfr->axfrset.data = NULL;
+	xfr->axfrset.used = 0;
+	xfr->axfrset.length = 0;
+	xfr->axfrset.nrecords = 0;
+
 	if (reqtype == dns_rdatatype_soa)
 		xfr->state = XFRST_SOAQUERY;
 	else
@@ -1492,6 +1639,13 @@ maybe_free(dns_xfrin_ctx_t *xfr) {
 
 	dns_diff_clear(&xfr->diff);
 
+	if (xfr->axfrset.rdata != NULL)
+		isc_mem_put(xfr->mctx, xfr->axfrset.rdata,
+			    xfr->axfrset.size * sizeof(dns_rdata_t));
+	if (xfr->axfrset.data != NULL)
+		isc_mem_put(xfr->mctx, xfr->axfrset.data,
+			    xfr->axfrset.length);
+
 	if (xfr->ixfr.journal != NULL)
 		dns_journal_destroy(&xfr->ixfr.journal);
 
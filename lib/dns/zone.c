@@ -225,6 +225,8 @@ struct dns_zone {
 	const dns_master_style_t *masterstyle;
 	char			*journal;
 	int32_t		journalsize;
+	uint32_t		journalsyncdelay;
+	unsigned int		journalpending;
 	dns_rdataclass_t	rdclass;
 	dns_zonetype_t		type;
 	unsigned int		flags;
@@ -241,6 +243,7 @@ struct dns_zone {
 	isc_time_t		signingtime;
 	isc_time_t		nsec3chaintime;
 	isc_time_t		refreshkeytime;
+	isc_time_t		journalsynctime;
 	uint32_t		refreshkeyinterval;
 	uint32_t		refreshkeycount;
 	uint32_t		refresh;
@@ -342,6 +345,8 @@ struct dns_zone {
 	uint32_t		notifydelay;
 	dns_isselffunc_t	isself;
 	void			*isselfarg;
+	dns_dbreleasedfunc_t	dbreleased;
+	void			*dbreleasedarg;
 
 	char *			strnamerd;
 	char *			strname;
@@ -741,6 +746,7 @@ LIBDNS_EXTERNAL_DATA unsigned int dns_zone_mkey_month = MONTH;
 #define SEND_BUFFER_SIZE 2048
 
 static void zone_settimer(dns_zone_t *, isc_time_t *);
+static void zone_journal_sync(dns_zone_t *zone);
 static void cancel_refresh(dns_zone_t *);
 static void zone_debuglog(dns_zone_t *zone, const char *, int debuglevel,
 			  const char *msg, ...) ISC_FORMAT_PRINTF(4, 5);
@@ -945,6 +951,8 @@ dns_zone_create(dns_zone_t **zonep, isc_mem_t *mctx) {
 	zone->masterstyle = NULL;
 	zone->keydirectory = NULL;
 	zone->journalsize = -1;
+	zone->journalsyncdelay = 0;
+	zone->journalpending = 0;
 	zone->journal = NULL;
 	zone->rdclass = dns_rdataclass_none;
 	zone->type = dns_zone_none;
@@ -956,6 +964,7 @@ dns_zone_create(dns_zone_t **zonep, isc_mem_t *mctx) {
 	isc_time_settoepoch(&zone->expiretime);
 	isc_time_settoepoch(&zone->refreshtime);
 	isc_time_settoepoch(&zone->dumptime);
+	isc_time_settoepoch(&zone->journalsynctime);
 	isc_time_settoepoch(&zone->loadtime);
 	zone->notifytime = now;
 	isc_time_settoepoch(&zone->resigntime);
@@ -1041,6 +1050,8 @@ dns_zone_create(dns_zone_t **zonep, isc_mem_t *mctx) {
 	zone->notifydelay = 5;
 	zone->isself = NULL;
 	zone->isselfarg = NULL;
+	zone->dbreleased = NULL;
+	zone->dbreleasedarg = NULL;
 	ISC_LIST_INIT(zone->signing);
 	ISC_LIST_INIT(zone->nsec3chain);
 	ISC_LIST_INIT(zone->setnsec3param_queue);
@@ -9899,6 +9910,7 @@ zone_refreshkeys(dns_zone_t *zone) {
 		result = dns_resolver_createfetch(zone->view->resolver,
 						  kname, dns_rdatatype_dnskey,
 						  NULL, NULL, NULL, NULL, 0,
+						  NULL,
 						  DNS_FETCHOPT_NOVALIDATE |
 						  DNS_FETCHOPT_UNSHARED |
 						  DNS_FETCHOPT_NOCACHED,
@@ -9997,6 +10009,13 @@ zone_maintenance(dns_zone_t *zone) {
 
 	TIME_NOW(&now);
 
+	/*
+	 * Flush deferred journal transactions.
+	 */
+	if (zone->journalpending != 0 &&
+	    isc_time_compare(&now, &zone->journalsynctime) >= 0)
+		zone_journal_sync(zone);
+
 	/*
 	 * Expire check.
 	 */
@@ -12822,6 +12841,11 @@ zone_shutdown(isc_task_t *task, isc_event_t *event) {
 	DNS_ZONE_SETFLAG(zone, DNS_ZONEFLG_EXITING);
 	UNLOCK_ZONE(zone);
 
+	/*
+	 * Don't leave deferred journal transactions unsynced.
+	 */
+	zone_journal_sync(zone);
+
 	/*
 	 * If we were waiting for xfrin quota, step out of
 	 * the queue.
@@ -12988,6 +13012,11 @@ zone_settimer(dns_zone_t *zone, isc_time_t *now) {
 			    isc_time_compare(&zone->nsec3chaintime, &next) < 0)
 				next = zone->nsec3chaintime;
 		}
+		if (zone->journalpending != 0) {
+			if (isc_time_isepoch(&next) ||
+			    isc_time_compare(&zone->journalsynctime, &next) < 0)
+				next = zone->journalsynctime;
+		}
 		break;
 
 	case dns_zone_slave:
@@ -13670,6 +13699,88 @@ dns_zone_getjournalsize(dns_zone_t *zone) {
 	return (zone->journalsize);
 }
 
+void
+dns_zone_setjournalsyncdelay(dns_zone_t *zone, uint32_t delay) {
+	REQUIRE(DNS_ZONE_VALID(zone));
+
+	zone->journalsyncdelay = delay;
+}
+
+uint32_t
+dns_zone_getjournalsyncdelay(dns_zone_t *zone) {
+	REQUIRE(DNS_ZONE_VALID(zone));
+
+	return (zone->journalsyncdelay);
+}
+
+void
+dns_zone_journaldeferred(dns_zone_t *zone) {
+	isc_time_t now;
+	isc_interval_t i;
+
+	REQUIRE(DNS_ZONE_VALID(zone));
+
+	inc_stats(zone, dns_zonestatscounter_journaldeferred);
+
+	LOCK_ZONE(zone);
+	if (zone->journalpending++ == 0) {
+		TIME_NOW(&now);
+		isc_interval_set(&i, zone->journalsyncdelay / 1000,
+				 (zone->journalsyncdelay % 1000) * 1000000);
+		if (isc_time_add(&now, &i, &zone->journalsynctime) !=
+		    ISC_R_SUCCESS)
+		{
+			zone->journalsynctime = now;
+		}
+		if (zone->task != NULL)
+			zone_settimer(zone, &now);
+	}
+	UNLOCK_ZONE(zone);
+}
+
+/*
+ * Make the journal transactions committed since the last call
+ * durable with a single round of fsync().  Called from the zone
+ * task, which is also where dynamic updates write the journal, so
+ * no transaction can be in progress.
+ */
+static void
+zone_journal_sync(dns_zone_t *zone) {
+	const char me[] = "zone_journal_sync";
+	dns_journal_t *journal = NULL;
+	isc_result_t result;
+	unsigned int pending;
+
+	ENTER;
+
+	LOCK_ZONE(zone);
+	pending = zone->journalpending;
+	zone->journalpending = 0;
+	isc_time_settoepoch(&zone->journalsynctime);
+	UNLOCK_ZONE(zone);
+
+	if (pending == 0 || zone->journal == NULL)
+		return;
+
+	result = dns_journal_open(zone->mctx, zone->journal,
+				  DNS_JOURNAL_WRITE, &journal);
+	if (result == ISC_R_SUCCESS) {
+		result = dns_journal_sync(journal);
+		dns_journal_destroy(&journal);
+	}
+	if (result != ISC_R_SUCCESS) {
+		dns_zone_log(zone, ISC_LOG_ERROR,
+			     "journal sync failed: %s",
+			     dns_result_totext(result));
+		return;
+	}
+
+	inc_stats(zone, dns_zonestatscounter_journalsync);
+	dns_zone_log(zone, ISC_LOG_DEBUG(3),
+		     "synced %u journal transaction%s", pending,
+		     pending == 1 ? "" : "s");
+}
+
 static void
 zone_namerd_tostr(dns_zone_t *zone, char *buf, size_t length) {
 	isc_result_t result = ISC_R_FAILURE;
@@ -15164,6 +15275,8 @@ static inline void
 zone_detachdb(dns_zone_t *zone) {
 	REQUIRE(zone->db != NULL);
 
+	if (zone->dbreleased != NULL)
+		(zone->dbreleased)(zone, zone->db, zone->dbreleasedarg);
 	dns_db_detach(&zone->db);
 }
 
@@ -17343,6 +17456,18 @@ dns_zone_setisself(dns_zone_t *zone, dns_isselffunc_t isself, void *arg) {
 	UNLOCK_ZONE(zone);
 }
 
+void
+dns_zone_setdbreleased(dns_zone_t *zone, dns_dbreleasedfunc_t released,
+		       void *arg)
+{
+	REQUIRE(DNS_ZONE_VALID(zone));
+
+	LOCK_ZONE(zone);
+	zone->dbreleased = released;
+	zone->dbreleasedarg = arg;
+	UNLOCK_ZONE(zone);
+}
+
 void
 dns_zone_setnotifydelay(dns_zone_t *zone, uint32_t delay) {
 	REQUIRE(DNS_ZONE_VALID(zone));
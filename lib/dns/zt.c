@@ -18,6 +18,7 @@
 #include <stdbool.h>
 
 #include <isc/file.h>
+#include <isc/hash.h>
 #include <isc/magic.h>
 #include <isc/mem.h>
 #include <isc/string.h>
@@ -33,6 +34,25 @@
 #include <dns/zone.h>
 #include <dns/zt.h>
 
+/*
+ * Zone apex index.  Every mounted zone is also entered in a hash table
+ * keyed on its origin, hashed from the root label up so that the hash
+ * of each suffix of a query name can be computed in a single pass
+ * over the name.  dns_zt_find() probes the suffixes from the longest
+ * down, which is the deepest zone cut, instead of descending the
+ * RBT.  The RBT remains the authoritative store and is still used for
+ * ordered traversal.
+ */
+typedef struct zt_apex zt_apex_t;
+struct zt_apex {
+	zt_apex_t		*next;
+	uint32_t		hashval;
+	unsigned int		labels;
+	dns_zone_t		*zone;
+};
+
+#define ZT_APEX_INITIALSIZE	64
+
 struct dns_zt {
 	/* Unlocked. */
 	unsigned int		magic;
@@ -46,6 +66,9 @@ struct dns_zt {
 	uint32_t		references;
 	unsigned int		loads_pending;
 	dns_rbt_t		*table;
+	zt_apex_t		**apex;
+	unsigned int		apexsize;
+	unsigned int		apexcount;
 };
 
 #define ZTMAGIC			ISC_MAGIC('Z', 'T', 'b', 'l')
@@ -69,6 +92,19 @@ freezezones(dns_zone_t *zone, void *uap);
 static isc_result_t
 doneloading(dns_zt_t *zt, dns_zone_t *zone, isc_task_t *task);
 
+static unsigned int
+suffixhashes(const dns_name_t *name, uint32_t *hashes);
+
+static isc_result_t
+apex_add(dns_zt_t *zt, dns_zone_t *zone);
+
+static void
+apex_delete(dns_zt_t *zt, dns_zone_t *zone);
+
+static dns_zone_t *
+apex_find(dns_zt_t *zt, const dns_name_t *name, bool noexact,
+	  bool *exactp);
+
 isc_result_t
 dns_zt_create(isc_mem_t *mctx, dns_rdataclass_t rdclass, dns_zt_t **ztp) {
 	dns_zt_t *zt;
@@ -85,9 +121,18 @@ dns_zt_create(isc_mem_t *mctx, dns_rdataclass_t rdclass, dns_zt_t **ztp) {
 	if (result != ISC_R_SUCCESS)
 		goto cleanup_zt;
 
+	zt->apexsize = ZT_APEX_INITIALSIZE;
+	zt->apexcount = 0;
+	zt->apex = isc_mem_get(mctx, zt->apexsize * sizeof(zt_apex_t *));
+	if (zt->apex == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_rbt;
+	}
+	memset(zt->apex, 0, zt->apexsize * sizeof(zt_apex_t *));
+
 	result = isc_rwlock_init(&zt->rwlock, 0, 0);
 	if (result != ISC_R_SUCCESS)
-		goto cleanup_rbt;
+		goto cleanup_apex;
 
 	zt->mctx = NULL;
 	isc_mem_attach(mctx, &zt->mctx);
@@ -102,6 +147,9 @@ dns_zt_create(isc_mem_t *mctx, dns_rdataclass_t rdclass, dns_zt_t **ztp) {
 
 	return (ISC_R_SUCCESS);
 
+   cleanup_apex:
+	isc_mem_put(mctx, zt->apex, zt->apexsize * sizeof(zt_apex_t *));
+
    cleanup_rbt:
 	dns_rbt_destroy(&zt->table);
 
@@ -123,9 +171,18 @@ dns_zt_mount(dns_zt_t *zt, dns_zone_t *zone) {
 
 	RWLOCK(&zt->rwlock, isc_rwlocktype_write);
 
-	result = dns_rbt_addname(zt->table, name, zone);
-	if (result == ISC_R_SUCCESS)
-		dns_zone_attach(zone, &dummy);
+	/*
+	 * The table holds a reference from the moment the name is
+	 * added, as deleting the node detaches it again.
+	 */
+	dns_zone_attach(zone, &dummy);
+	result = dns_rbt_addname(zt->table, name, dummy);
+	if (result == ISC_R_SUCCESS) {
+		result = apex_add(zt, zone);
+		if (result != ISC_R_SUCCESS)
+			(void)dns_rbt_deletename(zt->table, name, false);
+	} else
+		dns_zone_detach(&dummy);
 
 	RWUNLOCK(&zt->rwlock, isc_rwlocktype_write);
 
@@ -143,6 +200,7 @@ dns_zt_unmount(dns_zt_t *zt, dns_zone_t *zone) {
 
 	RWLOCK(&zt->rwlock, isc_rwlocktype_write);
 
+	apex_delete(zt, zone);
 	result = dns_rbt_deletename(zt->table, name, false);
 
 	RWUNLOCK(&zt->rwlock, isc_rwlocktype_write);
@@ -157,6 +215,7 @@ dns_zt_find(dns_zt_t *zt, const dns_name_t *name, unsigned int options,
 	isc_result_t result;
 	dns_zone_t *dummy = NULL;
 	unsigned int rbtoptions = 0;
+	bool exact = false;
 
 	REQUIRE(VALID_ZT(zt));
 
@@ -165,8 +224,27 @@ dns_zt_find(dns_zt_t *zt, const dns_name_t *name, unsigned int options,
 
 	RWLOCK(&zt->rwlock, isc_rwlocktype_read);
 
-	result = dns_rbt_findname(zt->table, name, rbtoptions, foundname,
-				  (void **) (void*)&dummy);
+	if (dns_name_isabsolute(name)) {
+		dummy = apex_find(zt, name,
+				  (options & DNS_ZTFIND_NOEXACT) != 0,
+				  &exact);
+		if (dummy == NULL) {
+			result = ISC_R_NOTFOUND;
+		} else {
+			result = exact ? ISC_R_SUCCESS : DNS_R_PARTIALMATCH;
+			if (foundname != NULL) {
+				isc_result_t tresult;
+				tresult = dns_name_copy(
+						dns_zone_getorigin(dummy),
+						foundname, NULL);
+				if (tresult != ISC_R_SUCCESS)
+					result = tresult;
+			}
+		}
+	} else {
+		result = dns_rbt_findname(zt->table, name, rbtoptions,
+					  foundname, (void **) (void*)&dummy);
+	}
 	if (result == ISC_R_SUCCESS || result == DNS_R_PARTIALMATCH) {
 		/*
 		 * If DNS_ZTFIND_MIRROR is set and the zone which was
@@ -214,9 +292,19 @@ flush(dns_zone_t *zone, void *uap) {
 
 static void
 zt_destroy(dns_zt_t *zt) {
+	zt_apex_t *apex, *next;
+	unsigned int i;
+
 	if (zt->flush)
 		(void)dns_zt_apply(zt, false, NULL, flush, NULL);
 	dns_rbt_destroy(&zt->table);
+	for (i = 0; i < zt->apexsize; i++) {
+		for (apex = zt->apex[i]; apex != NULL; apex = next) {
+			next = apex->next;
+			isc_mem_put(zt->mctx, apex, sizeof(*apex));
+		}
+	}
+	isc_mem_put(zt->mctx, zt->apex, zt->apexsize * sizeof(zt_apex_t *));
 	isc_rwlock_destroy(&zt->rwlock);
 	zt->magic = 0;
 	isc_mem_putanddetach(&zt->mctx, zt, sizeof(*zt));
@@ -538,6 +626,70 @@ dns_zt_apply(dns_zt_t *zt, bool stop, isc_result_t *sub,
 	return (result);
 }
 
+isc_result_t
+dns_zt_applyfrom(dns_zt_t *zt, const dns_name_t *from,
+		 isc_result_t (*action)(dns_zone_t *, void *), void *uap)
+{
+	dns_rbtnode_t *node = NULL;
+	dns_rbtnodechain_t chain;
+	isc_result_t result;
+	dns_zone_t *zone;
+
+	REQUIRE(VALID_ZT(zt));
+	REQUIRE(from == NULL || dns_name_isabsolute(from));
+	REQUIRE(action != NULL);
+
+	dns_rbtnodechain_init(&chain, zt->mctx);
+
+	RWLOCK(&zt->rwlock, isc_rwlocktype_read);
+
+	if (from == NULL) {
+		result = dns_rbtnodechain_first(&chain, zt->table, NULL, NULL);
+	} else {
+		/*
+		 * On an exact match the chain points to 'from' itself;
+		 * otherwise it points to the DNSSEC predecessor of 'from',
+		 * or nowhere if there is none.
+		 */
+		result = dns_rbt_findnode(zt->table, from, NULL, &node, &chain,
+					  DNS_RBTFIND_EMPTYDATA, NULL, NULL);
+		if (result == DNS_R_PARTIALMATCH ||
+		    result == ISC_R_NOTFOUND)
+		{
+			result = dns_rbtnodechain_current(&chain, NULL, NULL,
+							  NULL);
+			if (result == ISC_R_NOTFOUND)
+				result = dns_rbtnodechain_first(&chain,
+								zt->table,
+								NULL, NULL);
+			else
+				result = dns_rbtnodechain_next(&chain,
+							       NULL, NULL);
+		}
+	}
+
+	while (result == DNS_R_NEWORIGIN || result == ISC_R_SUCCESS) {
+		result = dns_rbtnodechain_current(&chain, NULL, NULL, &node);
+		if (result == ISC_R_SUCCESS) {
+			zone = node->data;
+			if (zone != NULL) {
+				result = (action)(zone, uap);
+				if (result != ISC_R_SUCCESS)
+					goto cleanup;
+			}
+		}
+		result = dns_rbtnodechain_next(&chain, NULL, NULL);
+	}
+	if (result == ISC_R_NOMORE || result == ISC_R_NOTFOUND)
+		result = ISC_R_SUCCESS;
+
+ cleanup:
+	RWUNLOCK(&zt->rwlock, isc_rwlocktype_read);
+	dns_rbtnodechain_invalidate(&chain);
+
+	return (result);
+}
+
 /*
  * Decrement the loads_pending counter; when counter reaches
  * zero, call the loaddone callback that was initially set by
@@ -589,3 +741,155 @@ auto_detach(void *data, void *arg) {
 	UNUSED(arg);
 	dns_zone_detach(&zone);
 }
+
+/*
+ * Compute the hash of every suffix of 'name': hashes[i] is the hash of
+ * the name formed by label i and all labels to its right.  Returns the
+ * number of labels.
+ */
+static unsigned int
+suffixhashes(const dns_name_t *name, uint32_t *hashes) {
+	unsigned char offsets[128];
+	const unsigned char *ndata = name->ndata;
+	unsigned int i, labels, offset;
+
+	labels = name->labels;
+	INSIST(labels > 0 && labels <= 128);
+
+	for (i = 0, offset = 0; i < labels; i++) {
+		offsets[i] = offset;
+		offset += ndata[offset] + 1;
+	}
+
+	i = labels - 1;
+	hashes[i] = isc_hash_function_reverse(ndata + offsets[i],
+					      ndata[offsets[i]] + 1,
+					      false, NULL);
+	while (i-- > 0) {
+		hashes[i] = isc_hash_function_reverse(ndata + offsets[i],
+						      ndata[offsets[i]] + 1,
+						      false, &hashes[i + 1]);
+	}
+
+	return (labels);
+}
+
+static void
+apex_rehash(dns_zt_t *zt) {
+	zt_apex_t **newtable, *apex, *next;
+	unsigned int newsize, i, bucket;
+
+	newsize = zt->apexsize * 2;
+	newtable = isc_mem_get(zt->mctx, newsize * sizeof(zt_apex_t *));
+	if (newtable == NULL)
+		return;		/* Keep using the old table. */
+	memset(newtable, 0, newsize * sizeof(zt_apex_t *));
+
+	for (i = 0; i < zt->apexsize; i++) {
+		for (apex = zt->apex[i]; apex != NULL; apex = next) {
+			next = apex->next;
+			bucket = apex->hashval & (newsize - 1);
+			apex->next = newtable[bucket];
+			newtable[bucket] = apex;
+		}
+	}
+
+	isc_mem_put(zt->mctx, zt->apex, zt->apexsize * sizeof(zt_apex_t *));
+	zt->apex = newtable;
+	zt->apexsize = newsize;
+}
+
+/*
+ * Enter 'zone' in the apex index.  Caller holds the write lock.
+ */
+static isc_result_t
+apex_add(dns_zt_t *zt, dns_zone_t *zone) {
+	uint32_t hashes[128];
+	dns_name_t *origin = dns_zone_getorigin(zone);
+	zt_apex_t *apex;
+	unsigned int bucket;
+
+	apex = isc_mem_get(zt->mctx, sizeof(*apex));
+	if (apex == NULL)
+		return (ISC_R_NOMEMORY);
+
+	apex->labels = suffixhashes(origin, hashes);
+	apex->hashval = hashes[0];
+	apex->zone = zone;
+
+	if (zt->apexcount >= zt->apexsize)
+		apex_rehash(zt);
+
+	bucket = apex->hashval & (zt->apexsize - 1);
+	apex->next = zt->apex[bucket];
+	zt->apex[bucket] = apex;
+	zt->apexcount++;
+
+	return (ISC_R_SUCCESS);
+}
+
+/*
+ * Remove the zone whose origin is that of 'zone' from the apex index,
+ * matching the node dns_rbt_deletename() removes from the table.
+ * Caller holds the write lock.
+ */
+static void
+apex_delete(dns_zt_t *zt, dns_zone_t *zone) {
+	uint32_t hashes[128];
+	dns_name_t *origin = dns_zone_getorigin(zone);
+	zt_apex_t *apex, **prevp;
+	unsigned int labels;
+
+	labels = suffixhashes(origin, hashes);
+
+	prevp = &zt->apex[hashes[0] & (zt->apexsize - 1)];
+	for (apex = *prevp; apex != NULL; apex = apex->next) {
+		if (apex->hashval == hashes[0] && apex->labels == labels &&
+		    dns_name_equal(dns_zone_getorigin(apex->zone), origin))
+		{
+			*prevp = apex->next;
+			isc_mem_put(zt->mctx, apex, sizeof(*apex));
+			zt->apexcount--;
+			return;
+		}
+		prevp = &apex->next;
+	}
+}
+
+/*
+ * Find the zone whose origin is the longest suffix of 'name' (a proper
+ * suffix if 'noexact' is set).  Caller holds the read lock.
+ */
+static dns_zone_t *
+apex_find(dns_zt_t *zt, const dns_name_t *name, bool noexact,
+	  bool *exactp)
+{
+	uint32_t hashes[128];
+	dns_name_t suffix;
+	zt_apex_t *apex;
+	unsigned int i, labels;
+
+	labels = suffixhashes(name, hashes);
+	dns_name_init(&suffix, NULL);
+
+	for (i = noexact ? 1 : 0; i < labels; i++) {
+		apex = zt->apex[hashes[i] & (zt->apexsize - 1)];
+		for (; apex != NULL; apex = apex->next) {
+			if (apex->hashval != hashes[i] ||
+			    apex->labels != labels - i)
+			{
+				continue;
+			}
+			dns_name_getlabelsequence(name, i, labels - i,
+						  &suffix);
+			if (dns_name_equal(dns_zone_getorigin(apex->zone),
+					   &suffix))
+			{
+				*exactp = (i == 0);
+				return (apex->zone);
+			}
+		}
+	}
+
+	return (NULL);
+}
@@ -0,0 +1,311 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <isc/atomic.h>
+#include <isc/histo.h>
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/platform.h>
+#include <isc/refcount.h>
+#include <isc/util.h>
+
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+#include <stdatomic.h>
+#endif
+
+#define ISC_HISTO_MAGIC			ISC_MAGIC('H', 'i', 's', 't')
+#define ISC_HISTO_VALID(x)		ISC_MAGIC_VALID(x, ISC_HISTO_MAGIC)
+
+/*%
+ * Counters are updated with 64-bit atomic additions where they are
+ * available.  Otherwise, as with isc_stats, they are updated without
+ * locking and may occasionally lose a sample.
+ */
+#if defined(ISC_PLATFORM_HAVESTDATOMIC) && defined(ATOMIC_LONG_LOCK_FREE)
+#define ISC_HISTO_HAVESTDATOMICQ 1
+typedef atomic_uint_fast64_t isc_histocounter_t;
+#else
+typedef uint64_t isc_histocounter_t;
+#endif
+
+/*%
+ * Each histogram is a sum of sample values followed by its buckets.
+ */
+#define HISTOSIZE	(ISC_HISTO_NBUCKETS + 1)
+#define SUM(h, id)	(&(h)->counters[(id) * HISTOSIZE])
+#define BUCKETS(h, id)	(&(h)->counters[(id) * HISTOSIZE + 1])
+
+struct isc_histo {
+	unsigned int		magic;
+	isc_mem_t		*mctx;
+	int			nhistos;
+	isc_refcount_t		references;
+	isc_histocounter_t	*counters;
+};
+
+isc_result_t
+isc_histo_create(isc_mem_t *mctx, int nhistos, isc_histo_t **histop) {
+	isc_histo_t *histo;
+	isc_result_t result;
+	size_t size;
+	int i;
+
+	REQUIRE(nhistos > 0);
+	REQUIRE(histop != NULL && *histop == NULL);
+
+	histo = isc_mem_get(mctx, sizeof(*histo));
+	if (histo == NULL)
+		return (ISC_R_NOMEMORY);
+
+	size = sizeof(isc_histocounter_t) * HISTOSIZE * nhistos;
+	histo->counters = isc_mem_get(mctx, size);
+	if (histo->counters == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto clean_histo;
+	}
+	for (i = 0; i < HISTOSIZE * nhistos; i++) {
+#if defined(ISC_HISTO_HAVESTDATOMICQ)
+		atomic_init(&histo->counters[i], 0);
+#else
+		histo->counters[i] = 0;
+#endif
+	}
+
+	result = isc_refcount_init(&histo->references, 1);
+	if (result != ISC_R_SUCCESS)
+		goto clean_counters;
+
+	histo->mctx = NULL;
+	isc_mem_attach(mctx, &histo->mctx);
+	histo->nhistos = nhistos;
+	histo->magic = ISC_HISTO_MAGIC;
+
+	*histop = histo;
+
+	return (ISC_R_SUCCESS);
+
+clean_counters:
+	isc_mem_put(mctx, histo->counters, size);
+
+clean_histo:
+	isc_mem_put(mctx, histo, sizeof(*histo));
+
+	return (result);
+}
+
+void
+isc_histo_attach(isc_histo_t *histo, isc_histo_t **histop) {
+	REQUIRE(ISC_HISTO_VALID(histo));
+	REQUIRE(histop != NULL && *histop == NULL);
+
+	isc_refcount_increment(&histo->references, NULL);
+	*histop = histo;
+}
+
+void
+isc_histo_detach(isc_histo_t **histop) {
+	isc_histo_t *histo;
+	unsigned int refs;
+
+	REQUIRE(histop != NULL && ISC_HISTO_VALID(*histop));
+
+	histo = *histop;
+	*histop = NULL;
+
+	isc_refcount_decrement(&histo->references, &refs);
+	if (refs > 0)
+		return;
+
+	isc_refcount_destroy(&histo->references);
+	histo->magic = 0;
+	isc_mem_put(histo->mctx, histo->counters,
+		    sizeof(isc_histocounter_t) * HISTOSIZE * histo->nhistos);
+	isc_mem_putanddetach(&histo->mctx, histo, sizeof(*histo));
+}
+
+int
+isc_histo_nhistos(isc_histo_t *histo) {
+	REQUIRE(ISC_HISTO_VALID(histo));
+
+	return (histo->nhistos);
+}
+
+static inline unsigned int
+msbit(uint64_t value) {
+#ifdef HAVE_BUILTIN_CLZ
+	return (63 - __builtin_clzll(value));
+#else
+	unsigned int bit = 0;
+
+	while ((value >>= 1) != 0)
+		bit++;
+	return (bit);
+#endif
+}
+
+unsigned int
+isc_histo_bucket(uint64_t value) {
+	unsigned int shift;
+
+	if (value < ISC_HISTO_SUBBUCKETS)
+		return ((unsigned int)value);
+	if (value >> ISC_HISTO_MAXBITS != 0)
+		return (ISC_HISTO_NBUCKETS - 1);
+
+	/*
+	 * The top ISC_HISTO_SUBBITS + 1 bits of 'value' select the
+	 * bucket within the power of two.
+	 */
+	shift = msbit(value) - ISC_HISTO_SUBBITS;
+	return (((shift + 1) << ISC_HISTO_SUBBITS) +
+		(unsigned int)((value >> shift) & (ISC_HISTO_SUBBUCKETS - 1)));
+}
+
+void
+isc_histo_bucketrange(unsigned int bucket, uint64_t *minp, uint64_t *maxp) {
+	unsigned int shift;
+	uint64_t mantissa;
+
+	REQUIRE(bucket < ISC_HISTO_NBUCKETS);
+	REQUIRE(minp != NULL && maxp != NULL);
+
+	if (bucket < ISC_HISTO_SUBBUCKETS) {
+		*minp = *maxp = bucket;
+		return;
+	}
+
+	shift = (bucket >> ISC_HISTO_SUBBITS) - 1;
+	mantissa = ISC_HISTO_SUBBUCKETS + (bucket & (ISC_HISTO_SUBBUCKETS - 1));
+	*minp = mantissa << shift;
+	if (bucket == ISC_HISTO_NBUCKETS - 1)
+		*maxp = UINT64_MAX;
+	else
+		*maxp = ((mantissa + 1) << shift) - 1;
+}
+
+static inline void
+addcounter(isc_histocounter_t *counter, uint64_t value) {
+#if defined(ISC_HISTO_HAVESTDATOMICQ)
+	atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+#elif defined(ISC_PLATFORM_HAVEXADDQ)
+	isc_atomic_xaddq((int64_t *)counter, (int64_t)value);
+#else
+	*counter += value;
+#endif
+}
+
+static inline uint64_t
+getcounter(isc_histocounter_t *counter) {
+#if defined(ISC_HISTO_HAVESTDATOMICQ)
+	return (atomic_load_explicit(counter, memory_order_relaxed));
+#elif defined(ISC_PLATFORM_HAVEXADDQ)
+	return ((uint64_t)isc_atomic_xaddq((int64_t *)counter, 0));
+#else
+	return (*counter);
+#endif
+}
+
+void
+isc_histo_add(isc_histo_t *histo, int id, uint64_t value) {
+	REQUIRE(ISC_HISTO_VALID(histo));
+	REQUIRE(id >= 0 && id < histo->nhistos);
+
+	addcounter(&BUCKETS(histo, id)[isc_histo_bucket(value)], 1);
+	addcounter(SUM(histo, id), value);
+}
+
+void
+isc_histo_totals(isc_histo_t *histo, int id, uint64_t *countp,
+		 uint64_t *sump)
+{
+	isc_histocounter_t *buckets;
+	uint64_t count = 0;
+	unsigned int i;
+
+	REQUIRE(ISC_HISTO_VALID(histo));
+	REQUIRE(id >= 0 && id < histo->nhistos);
+	REQUIRE(countp != NULL && sump != NULL);
+
+	buckets = BUCKETS(histo, id);
+	for (i = 0; i < ISC_HISTO_NBUCKETS; i++)
+		count += getcounter(&buckets[i]);
+
+	*countp = count;
+	*sump = getcounter(SUM(histo, id));
+}
+
+void
+isc_histo_quantiles(isc_histo_t *histo, int id, unsigned int n,
+		    const double *quantiles, uint64_t *values)
+{
+	uint64_t copy[ISC_HISTO_NBUCKETS];
+	isc_histocounter_t *buckets;
+	uint64_t count = 0, seen = 0, rank, min;
+	unsigned int i, bucket = 0;
+
+	REQUIRE(ISC_HISTO_VALID(histo));
+	REQUIRE(id >= 0 && id < histo->nhistos);
+	REQUIRE(n == 0 || (quantiles != NULL && values != NULL));
+
+	buckets = BUCKETS(histo, id);
+	for (i = 0; i < ISC_HISTO_NBUCKETS; i++) {
+		copy[i] = getcounter(&buckets[i]);
+		count += copy[i];
+	}
+
+	for (i = 0; i < n; i++) {
+		if (count == 0) {
+			values[i] = 0;
+			continue;
+		}
+
+		/*
+		 * The quantile is the value of the sample of this rank,
+		 * counting from 1.
+		 */
+		rank = (uint64_t)(quantiles[i] * (double)count);
+		if (rank == 0)
+			rank = 1;
+		if (rank > count)
+			rank = count;
+		while (seen + copy[bucket] < rank)
+			seen += copy[bucket++];
+		isc_histo_bucketrange(bucket, &min, &values[i]);
+	}
+}
+
+void
+isc_histo_dump(isc_histo_t *histo, int id, isc_histo_dumper_t dump_fn,
+	       void *arg)
+{
+	isc_histocounter_t *buckets;
+	uint64_t count, min, max;
+	unsigned int i;
+
+	REQUIRE(ISC_HISTO_VALID(histo));
+	REQUIRE(id >= 0 && id < histo->nhistos);
+
+	buckets = BUCKETS(histo, id);
+	for (i = 0; i < ISC_HISTO_NBUCKETS; i++) {
+		count = getcounter(&buckets[i]);
+		if (count == 0)
+			continue;
+		isc_histo_bucketrange(i, &min, &max);
+		dump_fn(min, max, count, arg);
+	}
+}
@@ -47,6 +47,15 @@ isc_hmacmd5_invalidate(isc_hmacmd5_t *ctx) {
 	ctx->ctx = NULL;
 }
 
+void
+isc_hmacmd5_copy(isc_hmacmd5_t *ctx, const isc_hmacmd5_t *source) {
+	REQUIRE(source->ctx != NULL);
+
+	ctx->ctx = HMAC_CTX_new();
+	RUNTIME_CHECK(ctx->ctx != NULL);
+	RUNTIME_CHECK(HMAC_CTX_copy(ctx->ctx, source->ctx) == 1);
+}
+
 void
 isc_hmacmd5_update(isc_hmacmd5_t *ctx, const unsigned char *buf,
 		   unsigned int len)
@@ -52,6 +52,15 @@ isc_hmacsha1_invalidate(isc_hmacsha1_t *ctx) {
 	ctx->ctx = NULL;
 }
 
+void
+isc_hmacsha1_copy(isc_hmacsha1_t *ctx, const isc_hmacsha1_t *source) {
+	REQUIRE(source->ctx != NULL);
+
+	ctx->ctx = HMAC_CTX_new();
+	RUNTIME_CHECK(ctx->ctx != NULL);
+	RUNTIME_CHECK(HMAC_CTX_copy(ctx->ctx, source->ctx) == 1);
+}
+
 void
 isc_hmacsha1_update(isc_hmacsha1_t *ctx, const unsigned char *buf,
 		   unsigned int len)
@@ -90,6 +99,15 @@ isc_hmacsha224_invalidate(isc_hmacsha224_t *ctx) {
 	ctx->ctx = NULL;
 }
 
+void
+isc_hmacsha224_copy(isc_hmacsha224_t *ctx, const isc_hmacsha224_t *source) {
+	REQUIRE(source->ctx != NULL);
+
+	ctx->ctx = HMAC_CTX_new();
+	RUNTIME_CHECK(ctx->ctx != NULL);
+	RUNTIME_CHECK(HMAC_CTX_copy(ctx->ctx, source->ctx) == 1);
+}
+
 void
 isc_hmacsha224_update(isc_hmacsha224_t *ctx, const unsigned char *buf,
 		   unsigned int len)
@@ -128,6 +146,15 @@ isc_hmacsha256_invalidate(isc_hmacsha256_t *ctx) {
 	ctx->ctx = NULL;
 }
 
+void
+isc_hmacsha256_copy(isc_hmacsha256_t *ctx, const isc_hmacsha256_t *source) {
+	REQUIRE(source->ctx != NULL);
+
+	ctx->ctx = HMAC_CTX_new();
+	RUNTIME_CHECK(ctx->ctx != NULL);
+	RUNTIME_CHECK(HMAC_CTX_copy(ctx->ctx, source->ctx) == 1);
+}
+
 void
 isc_hmacsha256_update(isc_hmacsha256_t *ctx, const unsigned char *buf,
 		   unsigned int len)
@@ -166,6 +193,15 @@ isc_hmacsha384_invalidate(isc_hmacsha384_t *ctx) {
 	ctx->ctx = NULL;
 }
 
+void
+isc_hmacsha384_copy(isc_hmacsha384_t *ctx, const isc_hmacsha384_t *source) {
+	REQUIRE(source->ctx != NULL);
+
+	ctx->ctx = HMAC_CTX_new();
+	RUNTIME_CHECK(ctx->ctx != NULL);
+	RUNTIME_CHECK(HMAC_CTX_copy(ctx->ctx, source->ctx) == 1);
+}
+
 void
 isc_hmacsha384_update(isc_hmacsha384_t *ctx, const unsigned char *buf,
 		   unsigned int len)
@@ -204,6 +240,15 @@ isc_hmacsha512_invalidate(isc_hmacsha512_t *ctx) {
 	ctx->ctx = NULL;
 }
 
+void
+isc_hmacsha512_copy(isc_hmacsha512_t *ctx, const isc_hmacsha512_t *source) {
+	REQUIRE(source->ctx != NULL);
+
+	ctx->ctx = HMAC_CTX_new();
+	RUNTIME_CHECK(ctx->ctx != NULL);
+	RUNTIME_CHECK(HMAC_CTX_copy(ctx->ctx, source->ctx) == 1);
+}
+
 void
 isc_hmacsha512_update(isc_hmacsha512_t *ctx, const unsigned char *buf,
 		   unsigned int len)
@@ -59,11 +59,15 @@
 #define HTTP_RECVLEN			1024
 #define HTTP_SENDGROW			1024
 #define HTTP_SEND_MAXLEN		10240
+#define HTTP_STREAMLEN			(64 * 1024)
+#define HTTP_CHUNKHDRLEN		10	/* "%08x\r\n" */
+#define HTTP_CHUNKTRAILERLEN		7	/* "\r\n0\r\n\r\n" */
 
 #define HTTPD_CLOSE		0x0001 /* Got a Connection: close header */
 #define HTTPD_FOUNDHOST		0x0002 /* Got a Host: header */
 #define HTTPD_KEEPALIVE		0x0004 /* Got a Connection: Keep-Alive */
 #define HTTPD_ACCEPT_DEFLATE   0x0008
+#define HTTPD_CHUNKED		0x0010 /* Streamed response is chunked */
 
 /*% http client */
 struct isc_httpd {
@@ -124,6 +128,17 @@ struct isc_httpd {
 	isc_buffer_t		bodybuffer;
 	isc_httpdfree_t	       *freecb;
 	void		       *freecb_arg;
+
+	/*%
+	 * Streamed response state.  While a streamed response is being
+	 * sent, 'streamnext' and 'streamstate' are the renderer and its
+	 * state; they are cleared when the renderer has finished.  The
+	 * streambuffer holds one chunk; it is allocated for the first
+	 * streamed response and kept until the client is destroyed.
+	 */
+	isc_httpdnext_t	       *streamnext;
+	void		       *streamstate;
+	isc_buffer_t		streambuffer;
 };
 
 /*% lightweight socket manager for httpd output */
@@ -210,6 +225,8 @@ static isc_result_t process_request(isc_httpd_t *, int);
 static void httpdmgr_destroy(isc_httpdmgr_t *);
 static isc_result_t grow_headerspace(isc_httpd_t *);
 static void reset_client(isc_httpd_t *httpd);
+static isc_result_t stream_fill(isc_httpd_t *httpd);
+static isc_result_t stream_start(isc_httpd_t *httpd, isc_httpdurl_t *url);
 
 static isc_httpdaction_t render_404;
 static isc_httpdaction_t render_500;
@@ -224,6 +241,12 @@ destroy_client(isc_httpd_t **httpdp) {
 
 	*httpdp = NULL;
 
+	/*
+	 * Let an unfinished stream renderer release its state.
+	 */
+	if (httpd->streamnext != NULL)
+		(void)(httpd->streamnext)(httpd->streamstate, NULL);
+
 	LOCK(&httpdmgr->lock);
 
 	isc_socket_detach(&httpd->sock);
@@ -239,6 +262,11 @@ destroy_client(isc_httpd_t **httpdp) {
 		isc_mem_put(httpdmgr->mctx, r.base, r.length);
 	}
 
+	isc_buffer_region(&httpd->streambuffer, &r);
+	if (r.length > 0) {
+		isc_mem_put(httpdmgr->mctx, r.base, r.length);
+	}
+
 	isc_mem_put(httpdmgr->mctx, httpd, sizeof(isc_httpd_t));
 
 	UNLOCK(&httpdmgr->lock);
@@ -671,6 +699,9 @@ isc_httpd_accept(isc_task_t *task, isc_event_t *ev) {
 
 	isc_buffer_initnull(&httpd->compbuffer);
 	isc_buffer_initnull(&httpd->bodybuffer);
+	isc_buffer_initnull(&httpd->streambuffer);
+	httpd->streamnext = NULL;
+	httpd->streamstate = NULL;
 	reset_client(httpd);
 
 	r.base = (unsigned char *)httpd->recvbuf;
@@ -838,6 +869,109 @@ isc_httpd_compress(isc_httpd_t *httpd) {
 }
 #endif
 
+/*%<
+ * Call the stream renderer to fill the next chunk of a streamed
+ * response into httpd->streambuffer, framing it if the response is
+ * chunked.  When the renderer has finished, httpd->streamnext is
+ * cleared and the end of the response is appended.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS	  -- streambuffer holds the data to send next,
+ *			     which may be nothing at the end of an
+ *			     unchunked response
+ *\li	any error returned by the renderer
+ */
+static isc_result_t
+stream_fill(isc_httpd_t *httpd) {
+	isc_buffer_t b;
+	isc_result_t result;
+	unsigned char *base;
+	unsigned int offset = 0, length;
+	char hdr[HTTP_CHUNKHDRLEN + 1];
+	bool chunked = ((httpd->flags & HTTPD_CHUNKED) != 0);
+
+	INSIST(httpd->streamnext != NULL);
+
+	base = isc_buffer_base(&httpd->streambuffer);
+	if (chunked)
+		offset = HTTP_CHUNKHDRLEN;
+
+	do {
+		isc_buffer_init(&b, base + offset, HTTP_STREAMLEN);
+		result = (httpd->streamnext)(httpd->streamstate, &b);
+		length = isc_buffer_usedlength(&b);
+	} while (result == ISC_R_SUCCESS && length == 0);
+
+	if (result != ISC_R_SUCCESS) {
+		httpd->streamnext = NULL;
+		httpd->streamstate = NULL;
+		if (result != ISC_R_NOMORE)
+			return (result);
+	}
+
+	isc_buffer_clear(&httpd->streambuffer);
+	if (!chunked) {
+		isc_buffer_add(&httpd->streambuffer, length);
+		return (ISC_R_SUCCESS);
+	}
+
+	if (length > 0) {
+		snprintf(hdr, sizeof(hdr), "%08x\r\n", length);
+		memmove(base, hdr, HTTP_CHUNKHDRLEN);
+		isc_buffer_add(&httpd->streambuffer,
+			       HTTP_CHUNKHDRLEN + length);
+		isc_buffer_putmem(&httpd->streambuffer,
+				  (const unsigned char *)"\r\n", 2);
+	}
+	if (httpd->streamnext == NULL) {
+		/* last-chunk and an empty trailer */
+		isc_buffer_putmem(&httpd->streambuffer,
+				  (const unsigned char *)"0\r\n\r\n", 5);
+	}
+
+	return (ISC_R_SUCCESS);
+}
+
+/*%<
+ * Start a streamed response for 'url' and render its first chunk.
+ */
+static isc_result_t
+stream_start(isc_httpd_t *httpd, isc_httpdurl_t *url) {
+	isc_result_t result;
+	unsigned char *data;
+	unsigned int size = HTTP_CHUNKHDRLEN + HTTP_STREAMLEN +
+			    HTTP_CHUNKTRAILERLEN;
+
+	if (isc_buffer_base(&httpd->streambuffer) == NULL) {
+		data = isc_mem_get(httpd->mgr->mctx, size);
+		if (data == NULL)
+			return (ISC_R_NOMEMORY);
+		isc_buffer_init(&httpd->streambuffer, data, size);
+	}
+
+	httpd->streamstate = NULL;
+	result = url->start(httpd->url, url, httpd->querystring,
+			    httpd->headers, url->action_arg,
+			    &httpd->retcode, &httpd->retmsg,
+			    &httpd->mimetype, &httpd->streamstate);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+	httpd->streamnext = url->next;
+
+	/*
+	 * HTTP/1.0 has no chunked encoding; the end of the response is
+	 * marked by closing the connection.
+	 */
+	if (strcmp(httpd->protocol, "HTTP/1.1") == 0) {
+		httpd->flags |= HTTPD_CHUNKED;
+	} else {
+		httpd->flags &= ~HTTPD_KEEPALIVE;
+		httpd->flags |= HTTPD_CLOSE;
+	}
+
+	return (stream_fill(httpd));
+}
+
 static void
 isc_httpd_recvdone(isc_task_t *task, isc_event_t *ev) {
 	isc_region_t r;
@@ -847,6 +981,7 @@ isc_httpd_recvdone(isc_task_t *task, isc_event_t *ev) {
 	isc_httpdurl_t *url;
 	isc_time_t now;
 	bool is_compressed = false;
+	bool is_streamed = false;
 	char datebuf[ISC_FORMATHTTPTIMESTAMP_SIZE];
 
 	ENTER("recv");
@@ -891,7 +1026,11 @@ isc_httpd_recvdone(isc_task_t *task, isc_event_t *ev) {
 			break;
 		url = ISC_LIST_NEXT(url, link);
 	}
-	if (url == NULL)
+	if (url != NULL && url->start != NULL) {
+		result = stream_start(httpd, url);
+		if (result == ISC_R_SUCCESS)
+			is_streamed = true;
+	} else if (url == NULL)
 		result = httpd->mgr->render_404(httpd->url, NULL,
 						httpd->querystring,
 						NULL, NULL,
@@ -923,7 +1062,7 @@ isc_httpd_recvdone(isc_task_t *task, isc_event_t *ev) {
 	}
 
 #ifdef HAVE_ZLIB
-	if (httpd->flags & HTTPD_ACCEPT_DEFLATE) {
+	if (!is_streamed && (httpd->flags & HTTPD_ACCEPT_DEFLATE) != 0) {
 			result = isc_httpd_compress(httpd);
 			if (result == ISC_R_SUCCESS) {
 				is_compressed = true;
@@ -952,7 +1091,11 @@ isc_httpd_recvdone(isc_task_t *task, isc_event_t *ev) {
 
 	isc_httpd_addheader(httpd, "Server: libisc", NULL);
 
-	if (is_compressed == true) {
+	if (is_streamed) {
+		if ((httpd->flags & HTTPD_CHUNKED) != 0)
+			isc_httpd_addheader(httpd, "Transfer-Encoding",
+					    "chunked");
+	} else if (is_compressed == true) {
 		isc_httpd_addheader(httpd, "Content-Encoding", "deflate");
 		isc_httpd_addheaderuint(httpd, "Content-Length",
 					isc_buffer_usedlength(&httpd->compbuffer));
@@ -969,7 +1112,12 @@ isc_httpd_recvdone(isc_task_t *task, isc_event_t *ev) {
 	 * rendered into it.  If no data is present, we won't do anything
 	 * with the buffer.
 	 */
-	if (is_compressed == true) {
+	if (is_streamed) {
+		if (isc_buffer_usedlength(&httpd->streambuffer) > 0) {
+			ISC_LIST_APPEND(httpd->bufflist, &httpd->streambuffer,
+					link);
+		}
+	} else if (is_compressed == true) {
 		ISC_LIST_APPEND(httpd->bufflist, &httpd->compbuffer, link);
 	} else {
 		if (isc_buffer_length(&httpd->bodybuffer) > 0) {
@@ -1131,8 +1279,10 @@ isc_httpd_senddone(isc_task_t *task, isc_event_t *ev) {
 	 * is sort of an evil hack, since we know our buffer will be there,
 	 * and we know it's address, so we can just remove it directly.
 	 */
-	NOTICE("senddone unlinked header");
-	ISC_LIST_UNLINK(sev->bufferlist, &httpd->headerbuffer, link);
+	if (ISC_LINK_LINKED(&httpd->headerbuffer, link)) {
+		ISC_LIST_UNLINK(sev->bufferlist, &httpd->headerbuffer, link);
+		NOTICE("senddone unlinked header");
+	}
 
 	/*
 	 * We will always want to clean up our receive buffer, even if we
@@ -1155,6 +1305,9 @@ isc_httpd_senddone(isc_task_t *task, isc_event_t *ev) {
 	} else if (ISC_LINK_LINKED(&httpd->compbuffer, link)) {
 		ISC_LIST_UNLINK(sev->bufferlist, &httpd->compbuffer, link);
 		NOTICE("senddone compressed data unlinked and freed");
+	} else if (ISC_LINK_LINKED(&httpd->streambuffer, link)) {
+		ISC_LIST_UNLINK(sev->bufferlist, &httpd->streambuffer, link);
+		NOTICE("senddone stream chunk unlinked");
 	}
 
 	if (sev->result != ISC_R_SUCCESS) {
@@ -1162,6 +1315,24 @@ isc_httpd_senddone(isc_task_t *task, isc_event_t *ev) {
 		goto out;
 	}
 
+	/*
+	 * Send the next chunk of a streamed response, if there is one.
+	 */
+	if (httpd->streamnext != NULL) {
+		if (stream_fill(httpd) != ISC_R_SUCCESS) {
+			destroy_client(&httpd);
+			goto out;
+		}
+		if (isc_buffer_usedlength(&httpd->streambuffer) > 0) {
+			ISC_LIST_APPEND(httpd->bufflist, &httpd->streambuffer,
+					link);
+			/* check return code? */
+			(void)isc_socket_sendv(httpd->sock, &httpd->bufflist,
+					       task, isc_httpd_senddone, httpd);
+			goto out;
+		}
+	}
+
 	if ((httpd->flags & HTTPD_CLOSE) != 0) {
 		destroy_client(&httpd);
 		goto out;
@@ -1193,6 +1364,8 @@ reset_client(isc_httpd_t *httpd) {
 	INSIST(ISC_HTTPD_ISRECV(httpd));
 	INSIST(!ISC_LINK_LINKED(&httpd->headerbuffer, link));
 	INSIST(!ISC_LINK_LINKED(&httpd->bodybuffer, link));
+	INSIST(!ISC_LINK_LINKED(&httpd->streambuffer, link));
+	INSIST(httpd->streamnext == NULL);
 
 	httpd->recvbuf[0] = 0;
 	httpd->recvlen = 0;
@@ -1215,18 +1388,13 @@ isc_httpdmgr_addurl(isc_httpdmgr_t *httpdmgr, const char *url,
 	return (isc_httpdmgr_addurl2(httpdmgr, url, false, func, arg));
 }
 
-isc_result_t
-isc_httpdmgr_addurl2(isc_httpdmgr_t *httpdmgr, const char *url,
-		     bool isstatic,
-		     isc_httpdaction_t *func, void *arg)
+static isc_result_t
+addurl(isc_httpdmgr_t *httpdmgr, const char *url, bool isstatic,
+       isc_httpdaction_t *func, isc_httpdstart_t *start,
+       isc_httpdnext_t *next, void *arg)
 {
 	isc_httpdurl_t *item;
 
-	if (url == NULL) {
-		httpdmgr->render_404 = func;
-		return (ISC_R_SUCCESS);
-	}
-
 	item = isc_mem_get(httpdmgr->mctx, sizeof(isc_httpdurl_t));
 	if (item == NULL)
 		return (ISC_R_NOMEMORY);
@@ -1238,6 +1406,8 @@ isc_httpdmgr_addurl2(isc_httpdmgr_t *httpdmgr, const char *url,
 	}
 
 	item->action = func;
+	item->start = start;
+	item->next = next;
 	item->action_arg = arg;
 	item->isstatic = isstatic;
 	isc_time_now(&item->loadtime);
@@ -1248,6 +1418,30 @@ isc_httpdmgr_addurl2(isc_httpdmgr_t *httpdmgr, const char *url,
 	return (ISC_R_SUCCESS);
 }
 
+isc_result_t
+isc_httpdmgr_addurl2(isc_httpdmgr_t *httpdmgr, const char *url,
+		     bool isstatic,
+		     isc_httpdaction_t *func, void *arg)
+{
+	if (url == NULL) {
+		httpdmgr->render_404 = func;
+		return (ISC_R_SUCCESS);
+	}
+
+	return (addurl(httpdmgr, url, isstatic, func, NULL, NULL, arg));
+}
+
+isc_result_t
+isc_httpdmgr_addstream(isc_httpdmgr_t *httpdmgr, const char *url,
+		       isc_httpdstart_t *start, isc_httpdnext_t *next,
+		       void *arg)
+{
+	REQUIRE(url != NULL);
+	REQUIRE(start != NULL && next != NULL);
+
+	return (addurl(httpdmgr, url, false, NULL, start, next, arg));
+}
+
 void
 isc_httpd_setfinishhook(void (*fn)(void))
 {
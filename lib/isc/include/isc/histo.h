@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#ifndef ISC_HISTO_H
+#define ISC_HISTO_H 1
+
+/*! \file isc/histo.h
+ * \brief
+ * A set of histograms of unsigned integer samples, typically latencies
+ * in microseconds.
+ *
+ * Buckets are log-linear: each power of two is divided into
+ * #ISC_HISTO_SUBBUCKETS equal buckets, so the width of a bucket is at
+ * most 1/#ISC_HISTO_SUBBUCKETS of its lower bound, and values below
+ * #ISC_HISTO_SUBBUCKETS have a bucket each.  Values of 2^#ISC_HISTO_MAXBITS
+ * or more are counted in the last bucket.
+ *
+ * Adding a sample costs two atomic additions and takes no locks, as
+ * for isc_stats_increment().  Readers copy the buckets without locking,
+ * so a snapshot taken while samples are being added may be slightly
+ * inconsistent.
+ */
+
+#include <inttypes.h>
+
+#include <isc/lang.h>
+#include <isc/types.h>
+
+#define ISC_HISTO_SUBBITS	3
+#define ISC_HISTO_SUBBUCKETS	(1 << ISC_HISTO_SUBBITS)
+#define ISC_HISTO_MAXBITS	40
+#define ISC_HISTO_NBUCKETS \
+	((ISC_HISTO_MAXBITS - ISC_HISTO_SUBBITS + 1) << ISC_HISTO_SUBBITS)
+
+ISC_LANG_BEGINDECLS
+
+/*%<
+ * Dump callback type.  'min' and 'max' are the smallest and largest
+ * values counted in the bucket; 'count' is the number of samples in it.
+ */
+typedef void (*isc_histo_dumper_t)(uint64_t min, uint64_t max,
+				   uint64_t count, void *arg);
+
+isc_result_t
+isc_histo_create(isc_mem_t *mctx, int nhistos, isc_histo_t **histop);
+/*%<
+ * Create a set of 'nhistos' histograms, indexed by an ID between 0 and
+ * nhistos - 1.
+ *
+ * Requires:
+ *\li	'mctx' must be a valid memory context.
+ *\li	'nhistos' > 0.
+ *\li	'histop' != NULL && '*histop' == NULL.
+ *
+ * Returns:
+ *\li	ISC_R_SUCCESS	-- all ok
+ *\li	ISC_R_NOMEMORY
+ */
+
+void
+isc_histo_attach(isc_histo_t *histo, isc_histo_t **histop);
+/*%<
+ * Attach to a histogram set.
+ *
+ * Requires:
+ *\li	'histo' is a valid isc_histo_t.
+ *\li	'histop' != NULL && '*histop' == NULL
+ */
+
+void
+isc_histo_detach(isc_histo_t **histop);
+/*%<
+ * Detach from a histogram set.
+ *
+ * Requires:
+ *\li	'histop' != NULL and '*histop' is a valid isc_histo_t.
+ */
+
+int
+isc_histo_nhistos(isc_histo_t *histo);
+/*%<
+ * Returns the number of histograms in 'histo'.
+ *
+ * Requires:
+ *\li	'histo' is a valid isc_histo_t.
+ */
+
+void
+isc_histo_add(isc_histo_t *histo, int id, uint64_t value);
+/*%<
+ * Add a sample of 'value' to the id-th histogram of 'histo'.
+ *
+ * Requires:
+ *\li	'histo' is a valid isc_histo_t.
+ *\li	'id' is less than the number of histograms given on creation.
+ */
+
+void
+isc_histo_totals(isc_histo_t *histo, int id, uint64_t *countp,
+		 uint64_t *sump);
+/*%<
+ * Get the number of samples in the id-th histogram of 'histo' and the
+ * sum of their values.
+ *
+ * Requires:
+ *\li	'histo' is a valid isc_histo_t.
+ *\li	'countp' and 'sump' are not NULL.
+ */
+
+void
+isc_histo_quantiles(isc_histo_t *histo, int id, unsigned int n,
+		    const double *quantiles, uint64_t *values);
+/*%<
+ * Estimate 'n' quantiles of the id-th histogram of 'histo'.  For each
+ * fraction 'quantiles[i]', in increasing order between 0 and 1,
+ * 'values[i]' is set to the upper bound of the bucket containing that
+ * quantile, or to zero if the histogram is empty.  All the quantiles
+ * are computed from the same snapshot of the histogram.
+ *
+ * Requires:
+ *\li	'histo' is a valid isc_histo_t.
+ *\li	'quantiles' and 'values' point to arrays of 'n' elements.
+ */
+
+void
+isc_histo_dump(isc_histo_t *histo, int id, isc_histo_dumper_t dump_fn,
+	       void *arg);
+/*%<
+ * Call 'dump_fn' for each bucket of the id-th histogram of 'histo' that
+ * has a non-zero count, in increasing order of value.
+ *
+ * Requires:
+ *\li	'histo' is a valid isc_histo_t.
+ */
+
+unsigned int
+isc_histo_bucket(uint64_t value);
+/*%<
+ * Return the index of the bucket in which 'value' is counted.
+ */
+
+void
+isc_histo_bucketrange(unsigned int bucket, uint64_t *minp, uint64_t *maxp);
+/*%<
+ * Get the smallest and largest values counted in bucket 'bucket'.
+ *
+ * Requires:
+ *\li	'bucket' < #ISC_HISTO_NBUCKETS
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* ISC_HISTO_H */
@@ -45,6 +45,15 @@ isc_hmacmd5_init(isc_hmacmd5_t *ctx, const unsigned char *key,
 void
 isc_hmacmd5_invalidate(isc_hmacmd5_t *ctx);
 
+void
+isc_hmacmd5_copy(isc_hmacmd5_t *ctx, const isc_hmacmd5_t *source);
+/*%<
+ * Initialize 'ctx' as a copy of the initialized context 'source',
+ * including its keyed inner and outer digest states, so that a key
+ * schedule computed once can be reused for many messages.  'source'
+ * is not modified and may be copied concurrently.
+ */
+
 void
 isc_hmacmd5_update(isc_hmacmd5_t *ctx, const unsigned char *buf,
 		   unsigned int len);
@@ -56,6 +56,13 @@ isc_hmacsha1_init(isc_hmacsha1_t *ctx, const unsigned char *key,
 void
 isc_hmacsha1_invalidate(isc_hmacsha1_t *ctx);
 
+void
+isc_hmacsha1_copy(isc_hmacsha1_t *ctx, const isc_hmacsha1_t *source);
+/*%<
+ * Initialize 'ctx' as a copy of the initialized context 'source'.
+ * See isc_hmacmd5_copy().
+ */
+
 void
 isc_hmacsha1_update(isc_hmacsha1_t *ctx, const unsigned char *buf,
 		    unsigned int len);
@@ -77,6 +84,9 @@ isc_hmacsha224_init(isc_hmacsha224_t *ctx, const unsigned char *key,
 void
 isc_hmacsha224_invalidate(isc_hmacsha224_t *ctx);
 
+void
+isc_hmacsha224_copy(isc_hmacsha224_t *ctx, const isc_hmacsha224_t *source);
+
 void
 isc_hmacsha224_update(isc_hmacsha224_t *ctx, const unsigned char *buf,
 		      unsigned int len);
@@ -95,6 +105,9 @@ isc_hmacsha256_init(isc_hmacsha256_t *ctx, const unsigned char *key,
 void
 isc_hmacsha256_invalidate(isc_hmacsha256_t *ctx);
 
+void
+isc_hmacsha256_copy(isc_hmacsha256_t *ctx, const isc_hmacsha256_t *source);
+
 void
 isc_hmacsha256_update(isc_hmacsha256_t *ctx, const unsigned char *buf,
 		      unsigned int len);
@@ -113,6 +126,9 @@ isc_hmacsha384_init(isc_hmacsha384_t *ctx, const unsigned char *key,
 void
 isc_hmacsha384_invalidate(isc_hmacsha384_t *ctx);
 
+void
+isc_hmacsha384_copy(isc_hmacsha384_t *ctx, const isc_hmacsha384_t *source);
+
 void
 isc_hmacsha384_update(isc_hmacsha384_t *ctx, const unsigned char *buf,
 		      unsigned int len);
@@ -131,6 +147,9 @@ isc_hmacsha512_init(isc_hmacsha512_t *ctx, const unsigned char *key,
 void
 isc_hmacsha512_invalidate(isc_hmacsha512_t *ctx);
 
+void
+isc_hmacsha512_copy(isc_hmacsha512_t *ctx, const isc_hmacsha512_t *source);
+
 void
 isc_hmacsha512_update(isc_hmacsha512_t *ctx, const unsigned char *buf,
 		      unsigned int len);
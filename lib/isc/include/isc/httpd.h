@@ -34,6 +34,8 @@
 struct isc_httpdurl {
 	char			       *url;
 	isc_httpdaction_t	       *action;
+	isc_httpdstart_t	       *start;		/*%< streamed response */
+	isc_httpdnext_t		       *next;
 	void			       *action_arg;
 	bool			isstatic;
 	isc_time_t			loadtime;
@@ -67,6 +69,29 @@ isc_httpdmgr_addurl2(isc_httpdmgr_t *httpdmgr, const char *url,
 		     bool isstatic,
 		     isc_httpdaction_t *func, void *arg);
 
+isc_result_t
+isc_httpdmgr_addstream(isc_httpdmgr_t *httpdmgr, const char *url,
+		       isc_httpdstart_t *start, isc_httpdnext_t *next,
+		       void *arg);
+/*%<
+ * Add a URL whose response is rendered a piece at a time.
+ *
+ * When 'url' is requested, 'start' is called to set the response code,
+ * message and MIME type, and to set '*statep' to the renderer's state.
+ * Then 'next' is called with that state and an empty buffer to fill.
+ * Each buffer is sent to the client before 'next' is called again, as
+ * one chunk of a chunked response for HTTP/1.1 clients or as part of a
+ * response ending at connection close for HTTP/1.0 clients, so the
+ * whole response is never held in memory.
+ *
+ * 'next' returns ISC_R_SUCCESS if there is more to render, or
+ * ISC_R_NOMORE if the response is complete.  Any other result aborts the
+ * response and closes the connection.  Once 'next' has returned anything
+ * but ISC_R_SUCCESS it is not called again, and the renderer must have
+ * released its state.  If the connection is lost before the response is
+ * complete, 'next' is called with a NULL buffer to release the state.
+ */
+
 isc_result_t
 isc_httpd_response(isc_httpd_t *httpd);
 
@@ -16,6 +16,7 @@
 /*! \file isc/log.h */
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <syslog.h> /* XXXDCL NT */
@@ -733,6 +734,53 @@ isc_log_wouldlog(isc_log_t *lctx, int level);
  * isc_log_write() calls and possible message preformatting.
  */
 
+isc_result_t
+isc_log_setasync(isc_log_t *lctx, bool async, size_t size, bool block);
+/*%<
+ * Enable or disable asynchronous logging.
+ *
+ * Notes:
+ *\li	In asynchronous mode, messages are formatted by the logging thread
+ *	into a ring buffer of its own, and a dedicated writer thread
+ *	writes them to the channels in batches.  Logging threads do not
+ *	take the context lock nor wait for file I/O; file channels are
+ *	flushed once per batch.
+ *
+ *\li	Each ring buffer holds 'size' bytes of messages (0 selects
+ *	the default).  When a thread's buffer is full the message is
+ *	dropped and counted (see isc_log_getdropped()), or, if 'block' is
+ *	true, the thread waits for the writer to make room.
+ *
+ *\li	Messages at level #ISC_LOG_CRITICAL, and messages from threads
+ *	that could not be given a ring buffer, are written synchronously
+ *	after all queued messages.
+ *
+ *\li	Calling this function again while asynchronous logging is
+ *	enabled updates the 'block' policy; the buffer size of threads
+ *	already logging is not changed.  Disabling asynchronous logging
+ *	writes out all queued messages and stops the writer thread.
+ *
+ * Requires:
+ *\li	lctx is a valid logging context.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_NOMEMORY
+ *\li	#ISC_R_NOTIMPLEMENTED	asynchronous logging is not supported
+ *				on this platform.
+ *\li	Other errors are possible if the writer thread cannot be created.
+ */
+
+uint64_t
+isc_log_getdropped(isc_log_t *lctx);
+/*%<
+ * Return the number of messages dropped because a ring buffer was
+ * full while asynchronous logging was enabled.
+ *
+ * Requires:
+ *\li	lctx is a valid logging context.
+ */
+
 void
 isc_log_setduplicateinterval(isc_logconfig_t *lcfg, unsigned int interval);
 /*%<
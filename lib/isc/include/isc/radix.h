@@ -107,6 +107,10 @@ typedef struct isc_radix_tree {
 	uint32_t maxbits;		/* for IP, 32 bit addresses */
 	int num_active_node;		/* for debugging purposes */
 	int num_added_node;		/* total number of nodes */
+#if defined(ISC_PLATFORM_HAVESTDATOMIC) && defined(ATOMIC_POINTER_LOCK_FREE)
+	atomic_uintptr_t index;		/* search index */
+	isc_mutex_t index_lock;		/* serializes building 'index' */
+#endif
 } isc_radix_tree_t;
 
 isc_result_t
@@ -116,6 +120,12 @@ isc_radix_search(isc_radix_tree_t *radix, isc_radix_node_t **target,
  * Search 'radix' for the best match to 'prefix'.
  * Return the node found in '*target'.
  *
+ * Searches for host addresses in trees of more than a few nodes use
+ * a flat index of the address ranges with distinct matches.  It is
+ * built by isc_radix_buildindex(), or if that has not been called
+ * since the tree was last changed, by the first such search.
+ * The tree must not be changed while it is being searched.
+ *
  * Requires:
  * \li	'radix' to be valid.
  * \li	'target' is not NULL and "*target" is NULL.
@@ -126,6 +136,18 @@ isc_radix_search(isc_radix_tree_t *radix, isc_radix_node_t **target,
  * \li	ISC_R_SUCCESS
  */
 
+void
+isc_radix_buildindex(isc_radix_tree_t *radix);
+/*%<
+ * Build the search index of 'radix' now, so that searches do not
+ * have to.  Intended to be called once the tree is complete, e.g.
+ * when an ACL has been loaded from the configuration.  Does nothing
+ * for small trees or where the index is not supported.
+ *
+ * Requires:
+ * \li	'radix' to be valid.
+ */
+
 isc_result_t
 isc_radix_insert(isc_radix_tree_t *radix, isc_radix_node_t **target,
 		 isc_radix_node_t *source, isc_prefix_t *prefix);
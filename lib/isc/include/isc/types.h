@@ -43,6 +43,7 @@ typedef ISC_LIST(isc_event_t)		isc_eventlist_t;	/*%< Event List */
 typedef unsigned int			isc_eventtype_t;	/*%< Event Type */
 typedef uint32_t			isc_fsaccess_t;		/*%< FS Access */
 typedef struct isc_hash			isc_hash_t;		/*%< Hash */
+typedef struct isc_histo		isc_histo_t;		/*%< Histograms */
 typedef struct isc_httpd		isc_httpd_t;		/*%< HTTP client */
 typedef void (isc_httpdfree_t)(isc_buffer_t *, void *);		/*%< HTTP free function */
 typedef struct isc_httpdmgr		isc_httpdmgr_t;		/*%< HTTP manager */
@@ -98,6 +99,16 @@ typedef isc_result_t (isc_httpdaction_t)(const char *url,
 					 isc_buffer_t *body,
 					 isc_httpdfree_t **freecb,
 					 void **freecb_args);
+typedef isc_result_t (isc_httpdstart_t)(const char *url,
+					isc_httpdurl_t *urlinfo,
+					const char *querystring,
+					const char *headers,
+					void *arg,
+					unsigned int *retcode,
+					const char **retmsg,
+					const char **mimetype,
+					void **statep);
+typedef isc_result_t (isc_httpdnext_t)(void *state, isc_buffer_t *body);
 typedef bool (isc_httpdclientok_t)(const isc_sockaddr_t *, void *);
 
 /*% Resource */
@@ -16,25 +16,33 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <time.h>
 
 #include <sys/types.h>	/* dev_t FreeBSD 2.1 */
 
+#include <isc/condition.h>
 #include <isc/dir.h>
 #include <isc/file.h>
 #include <isc/log.h>
 #include <isc/magic.h>
 #include <isc/mem.h>
 #include <isc/msgs.h>
+#include <isc/platform.h>
 #include <isc/print.h>
 #include <isc/stat.h>
 #include <isc/stdio.h>
 #include <isc/string.h>
+#include <isc/thread.h>
 #include <isc/time.h>
 #include <isc/util.h>
 
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+#include <stdatomic.h>
+#endif
+
 #define LCTX_MAGIC		ISC_MAGIC('L', 'c', 't', 'x')
 #define VALID_CONTEXT(lctx)	ISC_MAGIC_VALID(lctx, LCTX_MAGIC)
 
@@ -98,6 +106,70 @@ struct isc_logmessage {
 	ISC_LINK(isc_logmessage_t)	link;
 };
 
+/*!
+ * Asynchronous logging.  Each logging thread claims one of a fixed
+ * set of ring buffers, keyed by its thread ID, and is the only producer
+ * for it; the writer thread (or, for messages that must be written
+ * synchronously, the logging thread itself, holding the context lock)
+ * is the only consumer.  The rings are therefore lock-free: the
+ * producer publishes records by advancing 'head', the consumer frees
+ * space by advancing 'tail'.  Records are preformatted messages, padded
+ * to a multiple of 8 bytes; a record 'size' of zero marks unused space
+ * at the end of the ring, where the next record did not fit.
+ *
+ * Rings and their buffers are only released when the log context is
+ * destroyed.  A thread which exits leaves its ring claimed, which is
+ * harmless for the long-lived threads of a server; threads for which
+ * no ring is left log synchronously.
+ */
+#if defined(ISC_PLATFORM_HAVESTDATOMIC) && defined(ATOMIC_LONG_LOCK_FREE)
+#define LOG_ASYNC 1
+#endif
+
+#ifdef LOG_ASYNC
+#define LOG_ASYNC_RINGS		128
+#define LOG_RING_MINSIZE	(4 * LOG_BUFFER_SIZE)
+#define LOG_RING_DEFSIZE	(256 * 1024)
+
+typedef struct logrecord {
+	uint32_t			size;	/*%< 0: skip to start */
+	int				level;
+	bool				write_once;
+	isc_logcategory_t *		category;
+	isc_logmodule_t *		module;
+	isc_time_t			time;
+	char				text[FLEXIBLE_ARRAY_MEMBER];
+} logrecord_t;
+
+#define LOG_RECORD_SIZE(len) \
+	((offsetof(logrecord_t, text) + (len) + 7) & ~((size_t)7))
+
+typedef struct logring {
+	atomic_ulong			owner;	/*%< thread ID, 0 if free */
+	unsigned char *			buf;
+	size_t				size;	/*%< power of 2 */
+	atomic_size_t			head;
+	atomic_size_t			tail;
+} logring_t;
+
+typedef struct isc_logasync {
+	atomic_bool			enabled;
+	atomic_bool			block;
+	atomic_bool			sleeping;
+	atomic_uint_fast64_t		dropped;
+	size_t				size;	/*%< of rings claimed next */
+	isc_thread_t			thread;
+	isc_mutex_t			lock;
+	/* Locked by lock. */
+	isc_condition_t			ready;	/*%< wakes the writer */
+	isc_condition_t			space;	/*%< wakes blocked loggers */
+	bool				shutdown;
+	logring_t			rings[LOG_ASYNC_RINGS];
+} isc_logasync_t;
+#else
+typedef struct isc_logasync isc_logasync_t;
+#endif /* LOG_ASYNC */
+
 /*!
  * The isc_logconfig structure is used to store the configurable information
  * about where messages are actually supposed to be sent -- the information
@@ -143,6 +215,7 @@ struct isc_log {
 	isc_logmodule_t *		modules;
 	unsigned int			module_count;
 	int				debug_level;
+	isc_logasync_t *		async;
 	isc_mutex_t			lock;
 	/* Locked by isc_log lock. */
 	isc_logconfig_t * 		logconfig;
@@ -234,6 +307,36 @@ isc_log_doit(isc_log_t *lctx, isc_logcategory_t *category,
 	     const char *format, va_list args)
      ISC_FORMAT_PRINTF(9, 0);
 
+static void
+log_channels(isc_log_t *lctx, isc_logcategory_t *category,
+	     isc_logmodule_t *module, int level, bool write_once,
+	     const isc_time_t *when, bool batched,
+	     const char *format, va_list args)
+     ISC_FORMAT_PRINTF(8, 0);
+
+#ifdef LOG_ASYNC
+static void
+log_text(isc_log_t *lctx, isc_logcategory_t *category,
+	 isc_logmodule_t *module, int level, bool write_once,
+	 const isc_time_t *when, bool batched, const char *format, ...)
+     ISC_FORMAT_PRINTF(8, 9);
+
+static void
+log_async(isc_log_t *lctx, isc_logcategory_t *category,
+	  isc_logmodule_t *module, int level, bool write_once,
+	  const char *format, va_list args)
+     ISC_FORMAT_PRINTF(6, 0);
+
+static isc_threadresult_t
+log_writer(isc_threadarg_t arg);
+
+static unsigned int
+log_drain(isc_log_t *lctx);
+
+static void
+log_stopasync(isc_log_t *lctx);
+#endif
+
 /*@{*/
 /*!
  * Convenience macros.
@@ -274,6 +377,7 @@ isc_log_create(isc_mem_t *mctx, isc_log_t **lctxp, isc_logconfig_t **lcfgp) {
 		lctx->modules = NULL;
 		lctx->module_count = 0;
 		lctx->debug_level = 0;
+		lctx->async = NULL;
 
 		ISC_LIST_INIT(lctx->messages);
 
@@ -464,6 +568,25 @@ isc_log_destroy(isc_log_t **lctxp) {
 	lctx = *lctxp;
 	mctx = lctx->mctx;
 
+#ifdef LOG_ASYNC
+	if (lctx->async != NULL) {
+		isc_logasync_t *async = lctx->async;
+		unsigned int i;
+
+		log_stopasync(lctx);
+		for (i = 0; i < LOG_ASYNC_RINGS; i++) {
+			if (async->rings[i].buf != NULL)
+				isc_mem_put(mctx, async->rings[i].buf,
+					    async->rings[i].size);
+		}
+		(void)isc_condition_destroy(&async->ready);
+		(void)isc_condition_destroy(&async->space);
+		DESTROYLOCK(&async->lock);
+		isc_mem_put(mctx, async, sizeof(*async));
+		lctx->async = NULL;
+	}
+#endif
+
 	if (lctx->logconfig != NULL) {
 		lcfg = lctx->logconfig;
 		lctx->logconfig = NULL;
@@ -980,6 +1103,98 @@ isc_log_getdebuglevel(isc_log_t *lctx) {
 	return (lctx->debug_level);
 }
 
+isc_result_t
+isc_log_setasync(isc_log_t *lctx, bool async, size_t size, bool block) {
+#ifdef LOG_ASYNC
+	isc_logasync_t *la;
+	isc_result_t result;
+	unsigned int i;
+
+	REQUIRE(VALID_CONTEXT(lctx));
+
+	if (!async) {
+		log_stopasync(lctx);
+		return (ISC_R_SUCCESS);
+	}
+
+	la = lctx->async;
+	if (la == NULL) {
+		la = isc_mem_get(lctx->mctx, sizeof(*la));
+		if (la == NULL)
+			return (ISC_R_NOMEMORY);
+		result = isc_mutex_init(&la->lock);
+		if (result != ISC_R_SUCCESS) {
+			isc_mem_put(lctx->mctx, la, sizeof(*la));
+			return (result);
+		}
+		result = isc_condition_init(&la->ready);
+		if (result != ISC_R_SUCCESS) {
+			DESTROYLOCK(&la->lock);
+			isc_mem_put(lctx->mctx, la, sizeof(*la));
+			return (result);
+		}
+		result = isc_condition_init(&la->space);
+		if (result != ISC_R_SUCCESS) {
+			(void)isc_condition_destroy(&la->ready);
+			DESTROYLOCK(&la->lock);
+			isc_mem_put(lctx->mctx, la, sizeof(*la));
+			return (result);
+		}
+		atomic_init(&la->enabled, false);
+		atomic_init(&la->block, false);
+		atomic_init(&la->sleeping, false);
+		atomic_init(&la->dropped, 0);
+		la->shutdown = false;
+		for (i = 0; i < LOG_ASYNC_RINGS; i++) {
+			atomic_init(&la->rings[i].owner, 0);
+			la->rings[i].buf = NULL;
+			la->rings[i].size = 0;
+			atomic_init(&la->rings[i].head, 0);
+			atomic_init(&la->rings[i].tail, 0);
+		}
+		lctx->async = la;
+	}
+
+	atomic_store_explicit(&la->block, block, memory_order_relaxed);
+	if (atomic_load_explicit(&la->enabled, memory_order_acquire))
+		return (ISC_R_SUCCESS);
+
+	if (size == 0)
+		size = LOG_RING_DEFSIZE;
+	la->size = LOG_RING_MINSIZE;
+	while (la->size < size && la->size < (SIZE_MAX >> 2))
+		la->size <<= 1;
+
+	la->shutdown = false;
+	result = isc_thread_create(log_writer, lctx, &la->thread);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+	isc_thread_setname(la->thread, "isc-logwriter");
+
+	atomic_store_explicit(&la->enabled, true, memory_order_seq_cst);
+
+	return (ISC_R_SUCCESS);
+#else
+	REQUIRE(VALID_CONTEXT(lctx));
+	UNUSED(size);
+	UNUSED(block);
+
+	return (async ? ISC_R_NOTIMPLEMENTED : ISC_R_SUCCESS);
+#endif /* LOG_ASYNC */
+}
+
+uint64_t
+isc_log_getdropped(isc_log_t *lctx) {
+	REQUIRE(VALID_CONTEXT(lctx));
+
+#ifdef LOG_ASYNC
+	if (lctx->async != NULL)
+		return (atomic_load_explicit(&lctx->async->dropped,
+					     memory_order_relaxed));
+#endif
+	return (0);
+}
+
 void
 isc_log_setduplicateinterval(isc_logconfig_t *lcfg, unsigned int interval) {
 	REQUIRE(VALID_CONFIG(lcfg));
@@ -1584,21 +1799,7 @@ isc_log_doit(isc_log_t *lctx, isc_logcategory_t *category,
 	     isc_msgcat_t *msgcat, int msgset, int msg,
 	     const char *format, va_list args)
 {
-	int syslog_level;
-	const char *time_string;
-	char local_time[64];
-	char iso8601z_string[64];
-	char iso8601l_string[64];
-	char level_string[24];
 	const char *iformat;
-	struct stat statbuf;
-	bool matched = false;
-	bool printtime, iso8601, utc, printtag, printcolon;
-	bool printcategory, printmodule, printlevel, buffered;
-	isc_logconfig_t *lcfg;
-	isc_logchannel_t *channel;
-	isc_logchannellist_t *category_channels;
-	isc_result_t result;
 
 	REQUIRE(lctx == NULL || VALID_CONTEXT(lctx));
 	REQUIRE(category != NULL);
@@ -1625,13 +1826,58 @@ isc_log_doit(isc_log_t *lctx, isc_logcategory_t *category,
 	else
 		iformat = format;
 
+#ifdef LOG_ASYNC
+	if (lctx->async != NULL &&
+	    atomic_load_explicit(&lctx->async->enabled,
+				 memory_order_acquire))
+	{
+		log_async(lctx, category, module, level, write_once,
+			  iformat, args);
+		return;
+	}
+#endif
+
+	LOCK(&lctx->lock);
+	log_channels(lctx, category, module, level, write_once,
+		     NULL, false, iformat, args);
+	UNLOCK(&lctx->lock);
+}
+
+/*
+ * Write a message to the channels configured for 'category' and
+ * 'module'.  The message is only formatted if some channel wants it.
+ * 'when' is the time the message was logged, or NULL for now.  If
+ * 'batched' is true, file channels are neither flushed nor checked
+ * against their maximum size; log_flush() does that for the batch.
+ *
+ * Requires lctx->lock to be held.
+ */
+static void
+log_channels(isc_log_t *lctx, isc_logcategory_t *category,
+	     isc_logmodule_t *module, int level, bool write_once,
+	     const isc_time_t *when, bool batched,
+	     const char *format, va_list args)
+{
+	int syslog_level;
+	const char *time_string;
+	char local_time[64];
+	char iso8601z_string[64];
+	char iso8601l_string[64];
+	char level_string[24];
+	struct stat statbuf;
+	bool matched = false;
+	bool printtime, iso8601, utc, printtag, printcolon;
+	bool printcategory, printmodule, printlevel, buffered;
+	isc_logconfig_t *lcfg;
+	isc_logchannel_t *channel;
+	isc_logchannellist_t *category_channels;
+	isc_result_t result;
+
 	local_time[0] = '\0';
 	iso8601l_string[0] = '\0';
 	iso8601z_string[0] = '\0';
 	level_string[0] = '\0';
 
-	LOCK(&lctx->lock);
-
 	lctx->buffer[0] = '\0';
 
 	lcfg = lctx->logconfig;
@@ -1694,7 +1940,10 @@ isc_log_doit(isc_log_t *lctx, isc_logcategory_t *category,
 		{
 			isc_time_t isctime;
 
-			TIME_NOW(&isctime);
+			if (when != NULL)
+				isctime = *when;
+			else
+				TIME_NOW(&isctime);
 
 			isc_time_formattimestamp(&isctime,
 						 local_time,
@@ -1730,7 +1979,7 @@ isc_log_doit(isc_log_t *lctx, isc_logcategory_t *category,
 		 */
 		if (lctx->buffer[0] == '\0') {
 			(void)vsnprintf(lctx->buffer, sizeof(lctx->buffer),
-					iformat, args);
+					format, args);
 
 			/*
 			 * Check for duplicates.
@@ -1799,10 +2048,8 @@ isc_log_doit(isc_log_t *lctx, isc_logcategory_t *category,
 					    == 0) {
 						/*
 						 * ... and it is a duplicate.
-						 * Unlock the mutex and
-						 * get the hell out of Dodge.
+						 * Get the hell out of Dodge.
 						 */
-						UNLOCK(&lctx->lock);
 						return;
 					}
 
@@ -1921,6 +2168,9 @@ isc_log_doit(isc_log_t *lctx, isc_logcategory_t *category,
 				printlevel    ? level_string	: "",
 				lctx->buffer);
 
+			if (batched)
+				break;
+
 			if (!buffered)
 				fflush(FILE_STREAM(channel));
 
@@ -1973,6 +2223,375 @@ isc_log_doit(isc_log_t *lctx, isc_logcategory_t *category,
 		}
 
 	} while (1);
+}
 
+#ifdef LOG_ASYNC
+static void
+log_text(isc_log_t *lctx, isc_logcategory_t *category,
+	 isc_logmodule_t *module, int level, bool write_once,
+	 const isc_time_t *when, bool batched, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	log_channels(lctx, category, module, level, write_once,
+		     when, batched, format, args);
+	va_end(args);
+}
+
+/*
+ * Flush the file channels written to by a batch of messages, and note
+ * those which have grown past their maximum size.
+ *
+ * Requires lctx->lock to be held.
+ */
+static void
+log_flush(isc_log_t *lctx) {
+	isc_logchannel_t *channel;
+	struct stat statbuf;
+
+	for (channel = ISC_LIST_HEAD(lctx->logconfig->channels);
+	     channel != NULL;
+	     channel = ISC_LIST_NEXT(channel, link))
+	{
+		if ((channel->type != ISC_LOG_TOFILE &&
+		     channel->type != ISC_LOG_TOFILEDESC) ||
+		    FILE_STREAM(channel) == NULL)
+		{
+			continue;
+		}
+
+		if ((channel->flags & ISC_LOG_BUFFERED) == 0)
+			fflush(FILE_STREAM(channel));
+
+		if (channel->type == ISC_LOG_TOFILE &&
+		    FILE_MAXSIZE(channel) > 0 &&
+		    fstat(fileno(FILE_STREAM(channel)), &statbuf) >= 0 &&
+		    statbuf.st_size > FILE_MAXSIZE(channel))
+		{
+			FILE_MAXREACHED(channel) = true;
+		}
+	}
+}
+
+/*
+ * Write out all queued messages, ring by ring, and return how many
+ * there were.
+ *
+ * Requires lctx->lock to be held; this makes the caller the only
+ * consumer of the rings.
+ */
+static unsigned int
+log_drain(isc_log_t *lctx) {
+	isc_logasync_t *la = lctx->async;
+	unsigned int i, count = 0;
+
+	for (i = 0; i < LOG_ASYNC_RINGS; i++) {
+		logring_t *ring = &la->rings[i];
+		logrecord_t *rec;
+		size_t head, tail, off;
+
+		head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		if (head == tail)
+			continue;
+
+		while (tail != head) {
+			off = tail & (ring->size - 1);
+			rec = (logrecord_t *)(ring->buf + off);
+			if (rec->size == 0) {
+				tail += ring->size - off;
+				continue;
+			}
+			log_text(lctx, rec->category, rec->module, rec->level,
+				 rec->write_once, &rec->time, true,
+				 "%s", rec->text);
+			tail += rec->size;
+			count++;
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+	}
+
+	if (count != 0)
+		log_flush(lctx);
+
+	return (count);
+}
+
+static bool
+log_pending(isc_logasync_t *la) {
+	unsigned int i;
+
+	for (i = 0; i < LOG_ASYNC_RINGS; i++) {
+		if (atomic_load_explicit(&la->rings[i].head,
+					 memory_order_seq_cst) !=
+		    atomic_load_explicit(&la->rings[i].tail,
+					 memory_order_relaxed))
+		{
+			return (true);
+		}
+	}
+
+	return (false);
+}
+
+static isc_threadresult_t
+log_writer(isc_threadarg_t arg) {
+	isc_log_t *lctx = arg;
+	isc_logasync_t *la = lctx->async;
+	isc_interval_t interval;
+	isc_time_t timeout;
+	unsigned int count;
+
+	isc_interval_set(&interval, 1, 0);
+
+	LOCK(&la->lock);
+	while (!la->shutdown) {
+		UNLOCK(&la->lock);
+
+		LOCK(&lctx->lock);
+		count = log_drain(lctx);
+		UNLOCK(&lctx->lock);
+
+		LOCK(&la->lock);
+		if (count != 0) {
+			BROADCAST(&la->space);
+			continue;
+		}
+
+		/*
+		 * Loggers wake us up if they see 'sleeping' set after
+		 * queueing a message; the timeout is only a safety net.
+		 */
+		atomic_store_explicit(&la->sleeping, true,
+				      memory_order_seq_cst);
+		if (!la->shutdown && !log_pending(la) &&
+		    isc_time_nowplusinterval(&timeout, &interval) ==
+		    ISC_R_SUCCESS)
+		{
+			(void)WAITUNTIL(&la->ready, &la->lock, &timeout);
+		}
+		atomic_store_explicit(&la->sleeping, false,
+				      memory_order_relaxed);
+	}
+	UNLOCK(&la->lock);
+
+	return ((isc_threadresult_t)0);
+}
+
+static void
+log_stopasync(isc_log_t *lctx) {
+	isc_logasync_t *la = lctx->async;
+
+	if (la == NULL ||
+	    !atomic_load_explicit(&la->enabled, memory_order_acquire))
+	{
+		return;
+	}
+
+	atomic_store_explicit(&la->enabled, false, memory_order_seq_cst);
+
+	LOCK(&la->lock);
+	la->shutdown = true;
+	SIGNAL(&la->ready);
+	BROADCAST(&la->space);
+	UNLOCK(&la->lock);
+
+	(void)isc_thread_join(la->thread, NULL);
+
+	LOCK(&lctx->lock);
+	(void)log_drain(lctx);
+	UNLOCK(&lctx->lock);
+}
+
+/*
+ * Return the calling thread's ring, claiming a free one if it has
+ * none, or NULL if all are taken.
+ */
+static logring_t *
+log_getring(isc_log_t *lctx, isc_logasync_t *la) {
+	unsigned long self = isc_thread_self();
+	unsigned long owner;
+	unsigned int i, n, start;
+	logring_t *ring;
+
+	INSIST(self != 0);
+
+	start = (unsigned int)(((self >> 4) * 0x9e3779b1U) >> 8);
+	for (n = 0; n < LOG_ASYNC_RINGS; n++) {
+		i = (start + n) % LOG_ASYNC_RINGS;
+		ring = &la->rings[i];
+		owner = atomic_load_explicit(&ring->owner,
+					     memory_order_relaxed);
+		if (owner == self)
+			return (ring);
+		if (owner != 0)
+			continue;
+		if (!atomic_compare_exchange_strong(&ring->owner,
+						    &owner, self))
+		{
+			continue;
+		}
+
+		/*
+		 * The ring is ours.  Its buffer is only touched by the
+		 * consumer once 'head' has moved, so it can be set up
+		 * without further synchronization.
+		 */
+		if (ring->buf == NULL) {
+			ring->buf = isc_mem_get(lctx->mctx, la->size);
+			if (ring->buf == NULL) {
+				atomic_store(&ring->owner, 0);
+				return (NULL);
+			}
+			ring->size = la->size;
+		}
+		return (ring);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Wait for the writer to free some space.  Returns false if
+ * asynchronous logging has been disabled in the meantime.
+ */
+static bool
+log_waitforspace(isc_logasync_t *la) {
+	isc_interval_t interval;
+	isc_time_t timeout;
+	bool enabled;
+
+	LOCK(&la->lock);
+	enabled = atomic_load_explicit(&la->enabled, memory_order_acquire);
+	if (enabled) {
+		SIGNAL(&la->ready);
+		isc_interval_set(&interval, 0, 10000000);
+		if (isc_time_nowplusinterval(&timeout, &interval) ==
+		    ISC_R_SUCCESS)
+		{
+			(void)WAITUNTIL(&la->space, &la->lock, &timeout);
+		}
+	}
+	UNLOCK(&la->lock);
+
+	return (enabled);
+}
+
+/*
+ * Queue a formatted message on 'ring'.  Returns false if the message
+ * must be written synchronously instead.
+ */
+static bool
+log_put(isc_logasync_t *la, logring_t *ring, isc_logcategory_t *category,
+	isc_logmodule_t *module, int level, bool write_once,
+	const isc_time_t *when, const char *text, size_t len)
+{
+	logrecord_t *rec;
+	size_t need, pad, head, tail, off;
+
+	need = LOG_RECORD_SIZE(len + 1);
+	if (need > ring->size / 2)
+		return (false);
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	off = head & (ring->size - 1);
+	pad = (ring->size - off < need) ? ring->size - off : 0;
+
+	for (;;) {
+		tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+		if (ring->size - (head - tail) >= pad + need)
+			break;
+		if (!atomic_load_explicit(&la->block, memory_order_relaxed)) {
+			atomic_fetch_add_explicit(&la->dropped, 1,
+						  memory_order_relaxed);
+			return (true);
+		}
+		if (!log_waitforspace(la))
+			return (false);
+	}
+
+	if (pad != 0) {
+		rec = (logrecord_t *)(ring->buf + off);
+		rec->size = 0;
+		head += pad;
+		off = 0;
+	}
+
+	rec = (logrecord_t *)(ring->buf + off);
+	rec->size = (uint32_t)need;
+	rec->level = level;
+	rec->write_once = write_once;
+	rec->category = category;
+	rec->module = module;
+	rec->time = *when;
+	memmove(rec->text, text, len);
+	rec->text[len] = '\0';
+
+	atomic_store_explicit(&ring->head, head + need, memory_order_seq_cst);
+
+	if (atomic_load_explicit(&la->sleeping, memory_order_seq_cst)) {
+		LOCK(&la->lock);
+		SIGNAL(&la->ready);
+		UNLOCK(&la->lock);
+	}
+
+	return (true);
+}
+
+static void
+log_async(isc_log_t *lctx, isc_logcategory_t *category,
+	  isc_logmodule_t *module, int level, bool write_once,
+	  const char *format, va_list args)
+{
+	isc_logasync_t *la = lctx->async;
+	logring_t *ring;
+	char text[LOG_BUFFER_SIZE];
+	isc_time_t now;
+	int len;
+
+	TIME_NOW(&now);
+	len = vsnprintf(text, sizeof(text), format, args);
+	if (len < 0)
+		len = 0;
+	else if ((size_t)len >= sizeof(text))
+		len = sizeof(text) - 1;
+
+	/*
+	 * Critical messages are often followed by an abort, so they
+	 * are never queued.
+	 */
+	if (level > ISC_LOG_CRITICAL) {
+		ring = log_getring(lctx, la);
+		if (ring != NULL &&
+		    log_put(la, ring, category, module, level, write_once,
+			    &now, text, (size_t)len))
+		{
+			/*
+			 * If asynchronous logging was disabled while
+			 * we were queueing, the writer may be gone;
+			 * make sure the message gets out.
+			 */
+			if (atomic_load_explicit(&la->enabled,
+						 memory_order_seq_cst))
+			{
+				return;
+			}
+			LOCK(&lctx->lock);
+			(void)log_drain(lctx);
+			UNLOCK(&lctx->lock);
+			return;
+		}
+	}
+
+	/*
+	 * Write the message synchronously, after everything queued
+	 * before it.
+	 */
+	LOCK(&lctx->lock);
+	(void)log_drain(lctx);
+	log_text(lctx, category, module, level, write_once, &now, false,
+		 "%s", text);
 	UNLOCK(&lctx->lock);
 }
+#endif /* LOG_ASYNC */
@@ -20,10 +20,68 @@
 #include <inttypes.h>
 
 #include <isc/mem.h>
+#include <isc/mutex.h>
 #include <isc/types.h>
 #include <isc/util.h>
 #include <isc/radix.h>
 
+/*
+ * Searches for host addresses, which is what ACL matching does, are
+ * answered from an index rather than by walking the tree.
+ *
+ * For each address family, the first-match rule (lowest node_num
+ * among all matching prefixes) divides the address space into ranges
+ * of addresses with the same result.  Since prefixes are either
+ * nested or disjoint there are at most 2n+1 such ranges for n
+ * prefixes.  The index stores the start addresses of the ranges in a
+ * sorted array, with the matching node of each range in a parallel
+ * array.  A lookup uses the top bits of the address to select a
+ * bucket of a first-level table, which holds the index of the range
+ * containing the first address of the bucket, and binary searches
+ * the few ranges between it and the next bucket's.  On 64-bit
+ * platforms a range takes 12 bytes for IPv4 and 24 for IPv6, so the
+ * index of n disjoint IPv4 prefixes can take about 24n bytes, e.g.
+ * 24 MB for a million, plus the first-level table.
+ *
+ * The index is built by isc_radix_buildindex() when the owner of the
+ * tree has finished loading it, or otherwise by the first search
+ * after the tree has been changed, and discarded by the next change.
+ * Small trees are searched directly.
+ */
+#if defined(ISC_PLATFORM_HAVESTDATOMIC) && defined(ATOMIC_POINTER_LOCK_FREE)
+#define RADIX_INDEX 1
+#endif
+
+#ifdef RADIX_INDEX
+#define INDEX_MINNODES	32
+#define INDEX_MAXBITS	16
+
+typedef struct {
+	uint64_t hi, lo;
+} rkey_t;
+
+typedef struct radix_ranges {
+	unsigned int		count;		/* number of ranges */
+	unsigned int		bits;		/* first-level table size */
+	uint32_t		*table;		/* 2^bits + 1 entries */
+	uint32_t		*start4;	/* IPv4 range starts */
+	rkey_t			*start6;	/* IPv6 range starts */
+	isc_radix_node_t	**node;		/* matching node, or NULL */
+} radix_ranges_t;
+
+typedef struct radix_index {
+	radix_ranges_t		family[RADIX_FAMILIES];
+} radix_index_t;
+
+/*
+ * Marks a tree for which building an index failed.
+ */
+static radix_index_t noindex;
+
+static void
+invalidate_index(isc_radix_tree_t *radix);
+#endif /* RADIX_INDEX */
+
 static isc_result_t
 _new_prefix(isc_mem_t *mctx, isc_prefix_t **target, int family,
 	    void *dest, int bitlen);
@@ -137,6 +195,9 @@ _comp_with_mask(void *addr, void *dest, u_int mask) {
 isc_result_t
 isc_radix_create(isc_mem_t *mctx, isc_radix_tree_t **target, int maxbits) {
 	isc_radix_tree_t *radix;
+#ifdef RADIX_INDEX
+	isc_result_t result;
+#endif
 
 	REQUIRE(target != NULL && *target == NULL);
 
@@ -150,6 +211,14 @@ isc_radix_create(isc_mem_t *mctx, isc_radix_tree_t **target, int maxbits) {
 	radix->head = NULL;
 	radix->num_active_node = 0;
 	radix->num_added_node = 0;
+#ifdef RADIX_INDEX
+	atomic_init(&radix->index, 0);
+	result = isc_mutex_init(&radix->index_lock);
+	if (result != ISC_R_SUCCESS) {
+		isc_mem_putanddetach(&radix->mctx, radix, sizeof(*radix));
+		return (result);
+	}
+#endif
 	RUNTIME_CHECK(maxbits <= RADIX_MAXBITS); /* XXX */
 	radix->magic = RADIX_TREE_MAGIC;
 	*target = radix;
@@ -166,6 +235,10 @@ _clear_radix(isc_radix_tree_t *radix, isc_radix_destroyfunc_t func) {
 
 	REQUIRE(radix != NULL);
 
+#ifdef RADIX_INDEX
+	invalidate_index(radix);
+#endif
+
 	if (radix->head != NULL) {
 		isc_radix_node_t *Xstack[RADIX_MAXBITS+1];
 		isc_radix_node_t **Xsp = Xstack;
@@ -209,6 +282,9 @@ void
 isc_radix_destroy(isc_radix_tree_t *radix, isc_radix_destroyfunc_t func) {
 	REQUIRE(radix != NULL);
 	_clear_radix(radix, func);
+#ifdef RADIX_INDEX
+	DESTROYLOCK(&radix->index_lock);
+#endif
 	isc_mem_putanddetach(&radix->mctx, radix, sizeof(*radix));
 }
 
@@ -228,6 +304,365 @@ isc_radix_process(isc_radix_tree_t *radix, isc_radix_processfunc_t func) {
 }
 
 
+#ifdef RADIX_INDEX
+
+static inline bool
+key_lt(rkey_t a, rkey_t b) {
+	return (a.hi < b.hi || (a.hi == b.hi && a.lo < b.lo));
+}
+
+/*
+ * Return the first address of 'prefix' as a 128 bit key.  Only the
+ * first 'bitlen' bits of the address are meaningful.
+ */
+static rkey_t
+prefix_key(isc_prefix_t *prefix) {
+	const u_char *addr = isc_prefix_touchar(prefix);
+	u_int bits = prefix->bitlen, i;
+	u_char buf[16];
+	rkey_t key = { 0, 0 };
+
+	memset(buf, 0, sizeof(buf));
+	memmove(buf, addr, (bits + 7) / 8);
+	if ((bits % 8) != 0)
+		buf[bits / 8] &= (u_char)(0xff << (8 - (bits % 8)));
+
+	for (i = 0; i < 8; i++) {
+		key.hi = (key.hi << 8) | buf[i];
+		key.lo = (key.lo << 8) | buf[i + 8];
+	}
+	return (key);
+}
+
+/*
+ * Return a mask of bits 'from' to 'to' - 1 of a 64 bit word, counting
+ * from the most significant bit.
+ */
+static inline uint64_t
+mask64(u_int from, u_int to) {
+	uint64_t m = (from >= 64) ? 0 : (~(uint64_t)0 >> from);
+
+	if (to < 64)
+		m &= ~(~(uint64_t)0 >> to);
+	return (m);
+}
+
+/*
+ * Return the last address of the 'bitlen' bit prefix starting at
+ * 'key', in an address family of 'width' bits.  Keys are left
+ * aligned, so an IPv4 address occupies the top 32 bits of 'hi'.
+ */
+static rkey_t
+key_last(rkey_t key, u_int bitlen, u_int width) {
+	if (bitlen < 64)
+		key.hi |= mask64(bitlen, ISC_MIN(width, 64));
+	if (width > 64)
+		key.lo |= mask64(ISC_MAX(bitlen, 64) - 64, width - 64);
+	return (key);
+}
+
+/*
+ * Advance 'key' to the next address in an address family of 'width'
+ * bits, returning false if 'key' was the last one.
+ */
+static bool
+key_next(rkey_t *key, u_int width) {
+	if (width == 32) {
+		if (key->hi == 0xffffffff00000000ULL)
+			return (false);
+		key->hi += 0x100000000ULL;
+		return (true);
+	}
+	if (++key->lo == 0 && ++key->hi == 0)
+		return (false);
+	return (true);
+}
+
+typedef struct {
+	radix_ranges_t		*ranges;	/* NULL when counting */
+	unsigned int		count;
+	isc_radix_node_t	*last;
+} builder_t;
+
+static void
+emit(builder_t *b, rkey_t start, isc_radix_node_t *node) {
+	if (b->count > 0 && b->last == node)
+		return;
+	if (b->ranges != NULL) {
+		if (b->ranges->start4 != NULL)
+			b->ranges->start4[b->count] = (uint32_t)(start.hi >> 32);
+		else
+			b->ranges->start6[b->count] = start;
+		b->ranges->node[b->count] = node;
+	}
+	b->last = node;
+	b->count++;
+}
+
+/*
+ * Walk 'radix' in address order and emit the ranges of addresses of
+ * family 'fam' with the same first match.
+ */
+static void
+sweep(isc_radix_tree_t *radix, int fam, builder_t *b) {
+	struct {
+		rkey_t end;
+		isc_radix_node_t *best;
+	} stack[RADIX_MAXBITS + 1];
+	isc_radix_node_t *node;
+	u_int width = (fam == RADIX_V6) ? 128 : 32;
+	rkey_t cursor = { 0, 0 };
+	bool more = true;
+	int sp = 0;
+
+	RADIX_WALK(radix->head, node) {
+		if (node->node_num[fam] != -1 && node->bit <= width) {
+			rkey_t start = prefix_key(node->prefix);
+			isc_radix_node_t *best = node;
+
+			/* Close the ranges which end before this prefix. */
+			while (sp > 0 && key_lt(stack[sp - 1].end, start)) {
+				sp--;
+				emit(b, cursor, stack[sp].best);
+				cursor = stack[sp].end;
+				(void)key_next(&cursor, width);
+			}
+			if (key_lt(cursor, start)) {
+				emit(b, cursor, (sp > 0) ? stack[sp - 1].best
+							 : NULL);
+				cursor = start;
+			}
+
+			/*
+			 * A less specific prefix added earlier wins;
+			 * on a tie, the more specific one does.
+			 */
+			if (sp > 0 &&
+			    stack[sp - 1].best->node_num[fam] <
+			    node->node_num[fam])
+			{
+				best = stack[sp - 1].best;
+			}
+			INSIST(sp <= RADIX_MAXBITS);
+			stack[sp].end = key_last(start, node->bit, width);
+			stack[sp].best = best;
+			sp++;
+		}
+	} RADIX_WALK_END;
+
+	/* Close the remaining ranges, up to the end of the address space. */
+	while (sp > 0 && more) {
+		sp--;
+		emit(b, cursor, stack[sp].best);
+		cursor = stack[sp].end;
+		more = key_next(&cursor, width);
+	}
+	if (more)
+		emit(b, cursor, NULL);
+}
+
+static void
+free_ranges(isc_mem_t *mctx, radix_ranges_t *ranges) {
+	if (ranges->table != NULL)
+		isc_mem_put(mctx, ranges->table,
+			    ((1U << ranges->bits) + 1) * sizeof(uint32_t));
+	if (ranges->start4 != NULL)
+		isc_mem_put(mctx, ranges->start4,
+			    ranges->count * sizeof(uint32_t));
+	if (ranges->start6 != NULL)
+		isc_mem_put(mctx, ranges->start6,
+			    ranges->count * sizeof(rkey_t));
+	if (ranges->node != NULL)
+		isc_mem_put(mctx, ranges->node,
+			    ranges->count * sizeof(isc_radix_node_t *));
+}
+
+/*
+ * Return true if range 'i' starts at or before the first address of
+ * first-level bucket 'bucket'.
+ */
+static inline bool
+starts_before(const radix_ranges_t *ranges, uint32_t i, uint32_t bucket) {
+	if (ranges->start6 != NULL) {
+		rkey_t first = { (uint64_t)bucket << (64 - ranges->bits), 0 };
+		return (!key_lt(first, ranges->start6[i]));
+	}
+	return (ranges->start4[i] <= (bucket << (32 - ranges->bits)));
+}
+
+static isc_result_t
+build_ranges(isc_radix_tree_t *radix, int fam, radix_ranges_t *ranges) {
+	builder_t b = { NULL, 0, NULL };
+	uint32_t i, bucket, nbuckets;
+
+	sweep(radix, fam, &b);
+
+	ranges->count = b.count;
+	for (ranges->bits = 1;
+	     ranges->bits < INDEX_MAXBITS && (1U << ranges->bits) < b.count;
+	     ranges->bits++)
+		;
+	nbuckets = 1U << ranges->bits;
+
+	ranges->table = isc_mem_get(radix->mctx,
+				    (nbuckets + 1) * sizeof(uint32_t));
+	if (fam == RADIX_V6)
+		ranges->start6 = isc_mem_get(radix->mctx,
+					     b.count * sizeof(rkey_t));
+	else
+		ranges->start4 = isc_mem_get(radix->mctx,
+					     b.count * sizeof(uint32_t));
+	ranges->node = isc_mem_get(radix->mctx,
+				   b.count * sizeof(isc_radix_node_t *));
+	if (ranges->table == NULL ||
+	    (ranges->start4 == NULL && ranges->start6 == NULL) ||
+	    ranges->node == NULL)
+	{
+		return (ISC_R_NOMEMORY);
+	}
+
+	b.ranges = ranges;
+	b.count = 0;
+	sweep(radix, fam, &b);
+	INSIST(b.count == ranges->count);
+
+	/*
+	 * table[bucket] is the range containing the first address
+	 * of the bucket.
+	 */
+	for (bucket = 0, i = 0; bucket < nbuckets; bucket++) {
+		while (i + 1 < ranges->count &&
+		       starts_before(ranges, i + 1, bucket))
+		{
+			i++;
+		}
+		ranges->table[bucket] = i;
+	}
+	ranges->table[nbuckets] = ranges->count - 1;
+
+	return (ISC_R_SUCCESS);
+}
+
+static void
+free_index(isc_radix_tree_t *radix, radix_index_t *index) {
+	int i;
+
+	if (index == NULL || index == &noindex)
+		return;
+	for (i = 0; i < RADIX_FAMILIES; i++)
+		free_ranges(radix->mctx, &index->family[i]);
+	isc_mem_put(radix->mctx, index, sizeof(*index));
+}
+
+/*
+ * Discard the index of 'radix' after it has been changed.
+ */
+static void
+invalidate_index(isc_radix_tree_t *radix) {
+	radix_index_t *index;
+
+	index = (radix_index_t *)atomic_exchange_explicit(&radix->index, 0,
+							  memory_order_acq_rel);
+	free_index(radix, index);
+}
+
+/*
+ * Return the index of 'radix', building it if necessary, or NULL if
+ * the tree is to be searched directly.
+ */
+static radix_index_t *
+get_index(isc_radix_tree_t *radix) {
+	radix_index_t *index;
+	isc_result_t result;
+	int i;
+
+	index = (radix_index_t *)atomic_load_explicit(&radix->index,
+						      memory_order_acquire);
+	if (ISC_LIKELY(index != NULL))
+		return ((index == &noindex) ? NULL : index);
+
+	if (radix->num_active_node < INDEX_MINNODES)
+		return (NULL);
+
+	LOCK(&radix->index_lock);
+	index = (radix_index_t *)atomic_load_explicit(&radix->index,
+						      memory_order_acquire);
+	if (index == NULL) {
+		index = isc_mem_get(radix->mctx, sizeof(*index));
+		if (index != NULL) {
+			memset(index, 0, sizeof(*index));
+			for (i = 0; i < RADIX_FAMILIES; i++) {
+				result = build_ranges(radix, i,
+						      &index->family[i]);
+				if (result != ISC_R_SUCCESS) {
+					free_index(radix, index);
+					index = &noindex;
+					break;
+				}
+			}
+		} else {
+			index = &noindex;
+		}
+		atomic_store_explicit(&radix->index, (uintptr_t)index,
+				      memory_order_release);
+	}
+	UNLOCK(&radix->index_lock);
+
+	return ((index == &noindex) ? NULL : index);
+}
+#endif /* RADIX_INDEX */
+
+void
+isc_radix_buildindex(isc_radix_tree_t *radix) {
+	REQUIRE(radix != NULL);
+
+#ifdef RADIX_INDEX
+	(void)get_index(radix);
+#endif
+}
+
+#ifdef RADIX_INDEX
+
+/*
+ * Return the first match for the host address 'prefix' from 'index'.
+ */
+static isc_radix_node_t *
+index_search(radix_index_t *index, isc_prefix_t *prefix) {
+	radix_ranges_t *ranges;
+	uint32_t lo, hi, mid;
+
+	if (prefix->family == AF_INET6) {
+		rkey_t key = prefix_key(prefix);
+
+		ranges = &index->family[RADIX_V6];
+		lo = ranges->table[key.hi >> (64 - ranges->bits)];
+		hi = ranges->table[(key.hi >> (64 - ranges->bits)) + 1];
+		while (lo < hi) {
+			mid = lo + (hi - lo + 1) / 2;
+			if (key_lt(key, ranges->start6[mid]))
+				hi = mid - 1;
+			else
+				lo = mid;
+		}
+	} else {
+		uint32_t key = ntohl(prefix->add.sin.s_addr);
+
+		ranges = &index->family[RADIX_V4];
+		lo = ranges->table[key >> (32 - ranges->bits)];
+		hi = ranges->table[(key >> (32 - ranges->bits)) + 1];
+		while (lo < hi) {
+			mid = lo + (hi - lo + 1) / 2;
+			if (key < ranges->start4[mid])
+				hi = mid - 1;
+			else
+				lo = mid;
+		}
+	}
+
+	return (ranges->node[lo]);
+}
+#endif /* RADIX_INDEX */
+
 isc_result_t
 isc_radix_search(isc_radix_tree_t *radix, isc_radix_node_t **target,
 		 isc_prefix_t *prefix)
@@ -237,6 +672,9 @@ isc_radix_search(isc_radix_tree_t *radix, isc_radix_node_t **target,
 	u_char *addr;
 	uint32_t bitlen;
 	int tfam = -1, cnt = 0;
+#ifdef RADIX_INDEX
+	radix_index_t *index;
+#endif
 
 	REQUIRE(radix != NULL);
 	REQUIRE(prefix != NULL);
@@ -249,6 +687,19 @@ isc_radix_search(isc_radix_tree_t *radix, isc_radix_node_t **target,
 		return (ISC_R_NOTFOUND);
 	}
 
+#ifdef RADIX_INDEX
+	if ((prefix->family == AF_INET && prefix->bitlen == 32) ||
+	    (prefix->family == AF_INET6 && prefix->bitlen == 128))
+	{
+		index = get_index(radix);
+		if (index != NULL) {
+			*target = index_search(index, prefix);
+			return ((*target == NULL) ? ISC_R_NOTFOUND
+						  : ISC_R_SUCCESS);
+		}
+	}
+#endif
+
 	node = radix->head;
 	addr = isc_prefix_touchar(prefix);
 	bitlen = prefix->bitlen;
@@ -317,6 +768,10 @@ isc_radix_insert(isc_radix_tree_t *radix, isc_radix_node_t **target,
 
 	INSIST(prefix != NULL);
 
+#ifdef RADIX_INDEX
+	invalidate_index(radix);
+#endif
+
 	bitlen = prefix->bitlen;
 	fam = prefix->family;
 
@@ -623,6 +1078,10 @@ isc_radix_remove(isc_radix_tree_t *radix, isc_radix_node_t *node) {
 	REQUIRE(radix != NULL);
 	REQUIRE(node != NULL);
 
+#ifdef RADIX_INDEX
+	invalidate_index(radix);
+#endif
+
 	if (node->r && node->l) {
 		/*
 		 * This might be a placeholder node -- have to check and
@@ -1780,6 +1780,105 @@ ATF_TC_BODY(isc_hmacmd5, tc) {
 	}
 }
 
+/* HMAC context copies */
+ATF_TC(isc_hmac_copy);
+ATF_TC_HEAD(isc_hmac_copy, tc) {
+	atf_tc_set_md_var(tc, "descr", "HMAC contexts copied from keyed ones");
+}
+ATF_TC_BODY(isc_hmac_copy, tc) {
+	isc_hmacmd5_t md5, md5key;
+	isc_hmacsha1_t sha1, sha1key;
+	isc_hmacsha224_t sha224, sha224key;
+	isc_hmacsha256_t sha256, sha256key;
+	isc_hmacsha384_t sha384, sha384key;
+	isc_hmacsha512_t sha512, sha512key;
+	const uint8_t *input = (const uint8_t *) "what do ya want for nothing?";
+	unsigned int len = 28;
+	int i;
+
+	UNUSED(tc);
+
+	/*
+	 * Test 2 of RFC2104 and RFC4634 ("Jefe").  Each keyed context is
+	 * copied twice: a copy gives the same result as the original
+	 * would, does not disturb it, and outlives it.
+	 */
+	memmove(buffer, "Jefe", 4);
+
+	isc_hmacmd5_init(&md5key, buffer, 4);
+	for (i = 0; i < 2; i++) {
+		isc_hmacmd5_copy(&md5, &md5key);
+		if (i == 1)
+			isc_hmacmd5_invalidate(&md5key);
+		isc_hmacmd5_update(&md5, input, len);
+		isc_hmacmd5_sign(&md5, digest);
+		tohexstr(digest, ISC_MD5_DIGESTLENGTH, str, sizeof(str));
+		ATF_CHECK_STREQ(str, "0x750C783E6AB0B503EAA86E310A5DB738");
+	}
+
+	isc_hmacsha1_init(&sha1key, buffer, 4);
+	for (i = 0; i < 2; i++) {
+		isc_hmacsha1_copy(&sha1, &sha1key);
+		if (i == 1)
+			isc_hmacsha1_invalidate(&sha1key);
+		isc_hmacsha1_update(&sha1, input, len);
+		isc_hmacsha1_sign(&sha1, digest, ISC_SHA1_DIGESTLENGTH);
+		tohexstr(digest, ISC_SHA1_DIGESTLENGTH, str, sizeof(str));
+		ATF_CHECK_STREQ(str, "0xEFFCDF6AE5EB2FA2D27416D5F184DF9C259A7C79");
+	}
+
+	isc_hmacsha224_init(&sha224key, buffer, 4);
+	for (i = 0; i < 2; i++) {
+		isc_hmacsha224_copy(&sha224, &sha224key);
+		if (i == 1)
+			isc_hmacsha224_invalidate(&sha224key);
+		isc_hmacsha224_update(&sha224, input, len);
+		isc_hmacsha224_sign(&sha224, digest, ISC_SHA224_DIGESTLENGTH);
+		tohexstr(digest, ISC_SHA224_DIGESTLENGTH, str, sizeof(str));
+		ATF_CHECK_STREQ(str, "0xA30E01098BC6DBBF45690F3A7E9E6D0F8BBEA2A39E"
+				     "6148008FD05E44");
+	}
+
+	isc_hmacsha256_init(&sha256key, buffer, 4);
+	for (i = 0; i < 2; i++) {
+		isc_hmacsha256_copy(&sha256, &sha256key);
+		if (i == 1)
+			isc_hmacsha256_invalidate(&sha256key);
+		isc_hmacsha256_update(&sha256, input, len);
+		isc_hmacsha256_sign(&sha256, digest, ISC_SHA256_DIGESTLENGTH);
+		tohexstr(digest, ISC_SHA256_DIGESTLENGTH, str, sizeof(str));
+		ATF_CHECK_STREQ(str, "0x5BDCC146BF60754E6A042426089575C75A003F089D"
+				     "2739839DEC58B964EC3843");
+	}
+
+	isc_hmacsha384_init(&sha384key, buffer, 4);
+	for (i = 0; i < 2; i++) {
+		isc_hmacsha384_copy(&sha384, &sha384key);
+		if (i == 1)
+			isc_hmacsha384_invalidate(&sha384key);
+		isc_hmacsha384_update(&sha384, input, len);
+		isc_hmacsha384_sign(&sha384, digest, ISC_SHA384_DIGESTLENGTH);
+		tohexstr(digest, ISC_SHA384_DIGESTLENGTH, str, sizeof(str));
+		ATF_CHECK_STREQ(str, "0xAF45D2E376484031617F78D2B58A6B1B9C7EF464F5"
+				     "A01B47E42EC3736322445E8E2240CA5E69E2C78B"
+				     "3239ECFAB21649");
+	}
+
+	isc_hmacsha512_init(&sha512key, buffer, 4);
+	for (i = 0; i < 2; i++) {
+		isc_hmacsha512_copy(&sha512, &sha512key);
+		if (i == 1)
+			isc_hmacsha512_invalidate(&sha512key);
+		isc_hmacsha512_update(&sha512, input, len);
+		isc_hmacsha512_sign(&sha512, digest, ISC_SHA512_DIGESTLENGTH);
+		tohexstr(digest, ISC_SHA512_DIGESTLENGTH, str, sizeof(str));
+		ATF_CHECK_STREQ(str, "0x164B7A7BFCF819E2E395FBE73B56E0A387BD64222E"
+				     "831FD610270CD7EA2505549758BF75C05A994A6D"
+				     "034F65F8F0E6FDCAEAB1A34D4A6B4B636E070A38"
+				     "BCE737");
+	}
+}
+
 /* CRC64 Test */
 ATF_TC(isc_crc64);
 ATF_TC_HEAD(isc_crc64, tc) {
@@ -2014,6 +2113,7 @@ ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, isc_hmacsha256);
 	ATF_TP_ADD_TC(tp, isc_hmacsha384);
 	ATF_TP_ADD_TC(tp, isc_hmacsha512);
+	ATF_TP_ADD_TC(tp, isc_hmac_copy);
 	ATF_TP_ADD_TC(tp, isc_md5);
 	ATF_TP_ADD_TC(tp, isc_sha1);
 	ATF_TP_ADD_TC(tp, isc_sha224);
@@ -0,0 +1,185 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/* ! \file */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <isc/histo.h>
+#include <isc/mem.h>
+#include <isc/thread.h>
+#include <isc/util.h>
+
+#define NTHREADS	4
+#define NSAMPLES	100000
+
+ATF_TC(buckets);
+ATF_TC_HEAD(buckets, tc) {
+	atf_tc_set_md_var(tc, "descr", "bucket ranges are contiguous and "
+				       "contain their values");
+}
+ATF_TC_BODY(buckets, tc) {
+	uint64_t min, max, next = 0, value;
+	unsigned int i, shift;
+
+	UNUSED(tc);
+
+	for (i = 0; i < ISC_HISTO_NBUCKETS; i++) {
+		isc_histo_bucketrange(i, &min, &max);
+		ATF_CHECK_EQ(min, next);
+		ATF_CHECK(max >= min);
+		ATF_CHECK_EQ(isc_histo_bucket(min), i);
+		ATF_CHECK_EQ(isc_histo_bucket(max), i);
+		/* A bucket is at most 1/ISC_HISTO_SUBBUCKETS of its value */
+		if (i < ISC_HISTO_NBUCKETS - 1)
+			ATF_CHECK(max - min <= min / ISC_HISTO_SUBBUCKETS);
+		next = max + 1;
+	}
+	ATF_CHECK_EQ(max, UINT64_MAX);
+
+	for (shift = 0; shift < 64; shift++) {
+		value = (uint64_t)1 << shift;
+		isc_histo_bucketrange(isc_histo_bucket(value), &min, &max);
+		ATF_CHECK(min <= value && value <= max);
+	}
+}
+
+ATF_TC(quantiles);
+ATF_TC_HEAD(quantiles, tc) {
+	atf_tc_set_md_var(tc, "descr", "totals and quantiles of a set of "
+				       "histograms");
+}
+ATF_TC_BODY(quantiles, tc) {
+	static const double q[] = { 0.0, 0.5, 0.9, 0.99, 1.0 };
+	uint64_t values[5], count, sum, expect = 0;
+	isc_mem_t *mctx = NULL;
+	isc_histo_t *histo = NULL;
+	isc_result_t result;
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = isc_mem_create(0, 0, &mctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_histo_create(mctx, 2, &histo);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_EQ(isc_histo_nhistos(histo), 2);
+
+	isc_histo_quantiles(histo, 0, 5, q, values);
+	for (i = 0; i < 5; i++)
+		ATF_CHECK_EQ(values[i], 0);
+
+	for (i = 1; i <= 1000; i++) {
+		isc_histo_add(histo, 1, i);
+		expect += i;
+	}
+
+	isc_histo_totals(histo, 0, &count, &sum);
+	ATF_CHECK_EQ(count, 0);
+	ATF_CHECK_EQ(sum, 0);
+	isc_histo_totals(histo, 1, &count, &sum);
+	ATF_CHECK_EQ(count, 1000);
+	ATF_CHECK_EQ(sum, expect);
+
+	/*
+	 * Each quantile is reported as the upper bound of its bucket,
+	 * which is within 1/ISC_HISTO_SUBBUCKETS of the true value.
+	 */
+	isc_histo_quantiles(histo, 1, 5, q, values);
+	ATF_CHECK_EQ(values[0], 1);
+	ATF_CHECK(values[1] >= 500 && values[1] <= 500 + 500 / 8);
+	ATF_CHECK(values[2] >= 900 && values[2] <= 900 + 900 / 8);
+	ATF_CHECK(values[3] >= 990 && values[3] <= 990 + 990 / 8);
+	ATF_CHECK(values[4] >= 1000 && values[4] <= 1000 + 1000 / 8);
+
+	isc_histo_detach(&histo);
+	ATF_CHECK(histo == NULL);
+	isc_mem_destroy(&mctx);
+}
+
+static isc_histo_t *shared = NULL;
+
+static isc_threadresult_t
+adder(isc_threadarg_t arg) {
+	unsigned int i;
+
+	UNUSED(arg);
+
+	for (i = 0; i < NSAMPLES; i++)
+		isc_histo_add(shared, 0, i % 1000);
+
+	return ((isc_threadresult_t)0);
+}
+
+static uint64_t dumped;
+
+static void
+dumper(uint64_t min, uint64_t max, uint64_t count, void *arg) {
+	UNUSED(arg);
+
+	ATF_CHECK(min <= max && min < 1000);
+	dumped += count;
+}
+
+ATF_TC(threads);
+ATF_TC_HEAD(threads, tc) {
+	atf_tc_set_md_var(tc, "descr", "concurrent samples are all counted");
+}
+ATF_TC_BODY(threads, tc) {
+	isc_thread_t threads[NTHREADS];
+	isc_mem_t *mctx = NULL;
+	isc_result_t result;
+	uint64_t count, sum;
+	unsigned int i;
+
+	UNUSED(tc);
+
+	result = isc_mem_create(0, 0, &mctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = isc_histo_create(mctx, 1, &shared);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	for (i = 0; i < NTHREADS; i++) {
+		result = isc_thread_create(adder, NULL, &threads[i]);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+	for (i = 0; i < NTHREADS; i++)
+		isc_thread_join(threads[i], NULL);
+
+	isc_histo_totals(shared, 0, &count, &sum);
+	ATF_CHECK_EQ(count, NTHREADS * NSAMPLES);
+	ATF_CHECK_EQ(sum, (uint64_t)NTHREADS * (NSAMPLES / 1000) *
+			  (999 * 1000 / 2));
+
+	dumped = 0;
+	isc_histo_dump(shared, 0, dumper, NULL);
+	ATF_CHECK_EQ(dumped, count);
+
+	isc_histo_detach(&shared);
+	isc_mem_destroy(&mctx);
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, buckets);
+	ATF_TP_ADD_TC(tp, quantiles);
+	ATF_TP_ADD_TC(tp, threads);
+	return (atf_no_error());
+}
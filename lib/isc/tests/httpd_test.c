@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Test the framing of streamed responses done by stream_fill().
+ */
+#include "../httpd.c"
+
+/*
+ * A renderer which returns the pieces of 'parts' in turn, followed by
+ * 'last' (ISC_R_NOMORE or an error) once two NULLs are reached.  A
+ * single NULL part is a call which renders nothing; a part of "*"
+ * fills the whole buffer.
+ */
+typedef struct {
+	const char **parts;
+	unsigned int n;
+	isc_result_t last;
+} script_t;
+
+static isc_result_t
+script_next(void *arg, isc_buffer_t *b) {
+	script_t *script = arg;
+	const char *part = script->parts[script->n];
+	unsigned int len;
+
+	if (part == NULL && script->parts[script->n + 1] == NULL)
+		return (script->last);
+	script->n++;
+	if (part == NULL)
+		return (ISC_R_SUCCESS);
+	if (strcmp(part, "*") == 0) {
+		len = isc_buffer_availablelength(b);
+		memset(isc_buffer_used(b), 'x', len);
+		isc_buffer_add(b, len);
+		return (ISC_R_SUCCESS);
+	}
+	isc_buffer_putstr(b, part);
+	return (ISC_R_SUCCESS);
+}
+
+static void
+setup(isc_httpd_t *httpd, script_t *script, bool chunked) {
+	unsigned int size = HTTP_CHUNKHDRLEN + HTTP_STREAMLEN +
+			    HTTP_CHUNKTRAILERLEN;
+	unsigned char *data;
+
+	memset(httpd, 0, sizeof(*httpd));
+	data = malloc(size);
+	ATF_REQUIRE(data != NULL);
+	isc_buffer_init(&httpd->streambuffer, data, size);
+	httpd->streamnext = script_next;
+	httpd->streamstate = script;
+	httpd->flags = chunked ? HTTPD_CHUNKED : 0;
+}
+
+/*
+ * Call stream_fill() until the renderer has finished, collecting what
+ * would be sent into 'out'.
+ */
+static isc_result_t
+drain(isc_httpd_t *httpd, char *out, size_t outlen) {
+	isc_result_t result = ISC_R_SUCCESS;
+	isc_region_t r;
+	size_t used = 0;
+
+	out[0] = '\0';
+	while (httpd->streamnext != NULL) {
+		result = stream_fill(httpd);
+		if (result != ISC_R_SUCCESS)
+			break;
+		isc_buffer_usedregion(&httpd->streambuffer, &r);
+		ATF_REQUIRE(used + r.length < outlen);
+		memmove(out + used, r.base, r.length);
+		used += r.length;
+		out[used] = '\0';
+	}
+	free(isc_buffer_base(&httpd->streambuffer));
+	return (result);
+}
+
+ATF_TC(chunked);
+ATF_TC_HEAD(chunked, tc) {
+	atf_tc_set_md_var(tc, "descr", "chunked framing of a stream");
+}
+ATF_TC_BODY(chunked, tc) {
+	const char *parts[] = { "abc", NULL, "defghijklmnopqrstu", NULL, NULL };
+	script_t script = { parts, 0, ISC_R_NOMORE };
+	isc_httpd_t httpd;
+	char out[256];
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	setup(&httpd, &script, true);
+	result = drain(&httpd, out, sizeof(out));
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_STREQ(out, "00000003\r\nabc\r\n"
+			     "00000012\r\ndefghijklmnopqrstu\r\n"
+			     "0\r\n\r\n");
+	ATF_CHECK(httpd.streamstate == NULL);
+}
+
+ATF_TC(chunked_empty);
+ATF_TC_HEAD(chunked_empty, tc) {
+	atf_tc_set_md_var(tc, "descr", "chunked framing of an empty stream");
+}
+ATF_TC_BODY(chunked_empty, tc) {
+	const char *parts[] = { NULL, NULL };
+	script_t script = { parts, 0, ISC_R_NOMORE };
+	isc_httpd_t httpd;
+	char out[256];
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	setup(&httpd, &script, true);
+	result = drain(&httpd, out, sizeof(out));
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_STREQ(out, "0\r\n\r\n");
+}
+
+ATF_TC(chunked_full);
+ATF_TC_HEAD(chunked_full, tc) {
+	atf_tc_set_md_var(tc, "descr", "chunked framing of full buffers");
+}
+ATF_TC_BODY(chunked_full, tc) {
+	const char *parts[] = { "*", "z", NULL, NULL };
+	script_t script = { parts, 0, ISC_R_NOMORE };
+	isc_httpd_t httpd;
+	isc_region_t r;
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	setup(&httpd, &script, true);
+
+	/* A full chunk, and nothing more yet. */
+	result = stream_fill(&httpd);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	isc_buffer_usedregion(&httpd.streambuffer, &r);
+	ATF_REQUIRE_EQ(r.length, HTTP_CHUNKHDRLEN + HTTP_STREAMLEN + 2);
+	ATF_CHECK(memcmp(r.base, "00010000\r\n", HTTP_CHUNKHDRLEN) == 0);
+	ATF_CHECK_EQ(r.base[HTTP_CHUNKHDRLEN], 'x');
+	ATF_CHECK_EQ(r.base[HTTP_CHUNKHDRLEN + HTTP_STREAMLEN - 1], 'x');
+	ATF_CHECK(memcmp(r.base + r.length - 2, "\r\n", 2) == 0);
+	ATF_CHECK(httpd.streamnext != NULL);
+
+	/* A short chunk. */
+	result = stream_fill(&httpd);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	isc_buffer_usedregion(&httpd.streambuffer, &r);
+	ATF_REQUIRE_EQ(r.length, sizeof("00000001\r\nz\r\n") - 1);
+	ATF_CHECK(memcmp(r.base, "00000001\r\nz\r\n", r.length) == 0);
+	ATF_CHECK(httpd.streamnext != NULL);
+
+	/* The end of the response. */
+	result = stream_fill(&httpd);
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	isc_buffer_usedregion(&httpd.streambuffer, &r);
+	ATF_REQUIRE_EQ(r.length, sizeof("0\r\n\r\n") - 1);
+	ATF_CHECK(memcmp(r.base, "0\r\n\r\n", r.length) == 0);
+	ATF_CHECK(httpd.streamnext == NULL);
+
+	free(isc_buffer_base(&httpd.streambuffer));
+}
+
+ATF_TC(unchunked);
+ATF_TC_HEAD(unchunked, tc) {
+	atf_tc_set_md_var(tc, "descr", "unframed stream for HTTP/1.0");
+}
+ATF_TC_BODY(unchunked, tc) {
+	const char *parts[] = { "abc", NULL, "def", NULL, NULL };
+	script_t script = { parts, 0, ISC_R_NOMORE };
+	isc_httpd_t httpd;
+	char out[256];
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	setup(&httpd, &script, false);
+	result = drain(&httpd, out, sizeof(out));
+	ATF_CHECK_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK_STREQ(out, "abcdef");
+}
+
+ATF_TC(error);
+ATF_TC_HEAD(error, tc) {
+	atf_tc_set_md_var(tc, "descr", "renderer errors end the stream");
+}
+ATF_TC_BODY(error, tc) {
+	const char *parts[] = { "abc", NULL, NULL };
+	script_t script = { parts, 0, ISC_R_NOMEMORY };
+	isc_httpd_t httpd;
+	char out[256];
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	setup(&httpd, &script, true);
+	result = drain(&httpd, out, sizeof(out));
+	ATF_CHECK_EQ(result, ISC_R_NOMEMORY);
+	ATF_CHECK_STREQ(out, "00000003\r\nabc\r\n");
+	ATF_CHECK(httpd.streamnext == NULL);
+	ATF_CHECK(httpd.streamstate == NULL);
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, chunked);
+	ATF_TP_ADD_TC(tp, chunked_empty);
+	ATF_TP_ADD_TC(tp, chunked_full);
+	ATF_TP_ADD_TC(tp, unchunked);
+	ATF_TP_ADD_TC(tp, error);
+	return (atf_no_error());
+}
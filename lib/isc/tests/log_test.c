@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <isc/file.h>
+#include <isc/log.h>
+#include <isc/mem.h>
+#include <isc/result.h>
+#include <isc/string.h>
+#include <isc/thread.h>
+#include <isc/util.h>
+
+#define LOGFILE		"log_test.out"
+#define NTHREADS	4
+#define NMESSAGES	20000
+
+static isc_mem_t *lmctx = NULL;
+static isc_log_t *tlctx = NULL;
+
+static void
+setup(void) {
+	isc_logconfig_t *logconfig = NULL;
+	isc_logdestination_t destination;
+	isc_result_t result;
+
+	(void)isc_file_remove(LOGFILE);
+
+	result = isc_mem_create(0, 0, &lmctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_log_create(lmctx, &tlctx, &logconfig);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	destination.file.stream = NULL;
+	destination.file.name = LOGFILE;
+	destination.file.versions = ISC_LOG_ROLLNEVER;
+	destination.file.suffix = isc_log_rollsuffix_increment;
+	destination.file.maximum_size = 0;
+	result = isc_log_createchannel(logconfig, "test", ISC_LOG_TOFILE,
+				       ISC_LOG_INFO, &destination, 0);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = isc_log_usechannel(logconfig, "test", NULL, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+}
+
+static void
+teardown(void) {
+	isc_log_destroy(&tlctx);
+	isc_mem_destroy(&lmctx);
+	(void)isc_file_remove(LOGFILE);
+}
+
+static isc_threadresult_t
+logger(isc_threadarg_t arg) {
+	unsigned int id = *(unsigned int *)arg;
+	unsigned int i;
+
+	for (i = 0; i < NMESSAGES; i++) {
+		isc_log_write(tlctx, ISC_LOGCATEGORY_GENERAL,
+			      ISC_LOGMODULE_OTHER, ISC_LOG_INFO,
+			      "thread %u message %u", id, i);
+	}
+
+	return ((isc_threadresult_t)0);
+}
+
+static void
+runloggers(void) {
+	isc_thread_t threads[NTHREADS];
+	unsigned int ids[NTHREADS];
+	isc_result_t result;
+	unsigned int i;
+
+	for (i = 0; i < NTHREADS; i++) {
+		ids[i] = i;
+		result = isc_thread_create(logger, &ids[i], &threads[i]);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+	for (i = 0; i < NTHREADS; i++)
+		isc_thread_join(threads[i], NULL);
+}
+
+/*
+ * Read back the log file; check that each thread's messages are in
+ * order and return their number.  If 'last' is not NULL, the text of
+ * the last line is copied there.
+ */
+static unsigned int
+readlog(char *last, size_t lastlen) {
+	unsigned int next[NTHREADS];
+	unsigned int count = 0, id, n;
+	char line[256];
+	FILE *fp;
+
+	memset(next, 0, sizeof(next));
+	fp = fopen(LOGFILE, "r");
+	ATF_REQUIRE(fp != NULL);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (last != NULL)
+			strlcpy(last, line, lastlen);
+		if (sscanf(line, "thread %u message %u", &id, &n) != 2)
+			continue;
+		ATF_REQUIRE(id < NTHREADS);
+		ATF_CHECK(n >= next[id]);
+		next[id] = n + 1;
+		count++;
+	}
+	fclose(fp);
+
+	return (count);
+}
+
+ATF_TC(async);
+ATF_TC_HEAD(async, tc) {
+	atf_tc_set_md_var(tc, "descr", "asynchronous logging loses nothing "
+				       "when blocking");
+}
+ATF_TC_BODY(async, tc) {
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	setup();
+
+	result = isc_log_setasync(tlctx, true, 0, true);
+	if (result == ISC_R_NOTIMPLEMENTED) {
+		teardown();
+		atf_tc_skip("asynchronous logging not supported");
+	}
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	runloggers();
+
+	result = isc_log_setasync(tlctx, false, 0, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	ATF_CHECK_EQ(readlog(NULL, 0), NTHREADS * NMESSAGES);
+	ATF_CHECK_EQ(isc_log_getdropped(tlctx), 0);
+
+	teardown();
+}
+
+ATF_TC(drop);
+ATF_TC_HEAD(drop, tc) {
+	atf_tc_set_md_var(tc, "descr", "messages dropped by asynchronous "
+				       "logging are counted");
+}
+ATF_TC_BODY(drop, tc) {
+	isc_result_t result;
+	uint64_t dropped;
+
+	UNUSED(tc);
+
+	setup();
+
+	/* The smallest ring size. */
+	result = isc_log_setasync(tlctx, true, 1, false);
+	if (result == ISC_R_NOTIMPLEMENTED) {
+		teardown();
+		atf_tc_skip("asynchronous logging not supported");
+	}
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	runloggers();
+
+	result = isc_log_setasync(tlctx, false, 0, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	dropped = isc_log_getdropped(tlctx);
+	ATF_CHECK_EQ(readlog(NULL, 0) + dropped, NTHREADS * NMESSAGES);
+
+	teardown();
+}
+
+ATF_TC(critical);
+ATF_TC_HEAD(critical, tc) {
+	atf_tc_set_md_var(tc, "descr", "critical messages are written "
+				       "synchronously after queued ones");
+}
+ATF_TC_BODY(critical, tc) {
+	isc_result_t result;
+	char last[256];
+	unsigned int id = 0;
+
+	UNUSED(tc);
+
+	setup();
+
+	result = isc_log_setasync(tlctx, true, 0, true);
+	if (result == ISC_R_NOTIMPLEMENTED) {
+		teardown();
+		atf_tc_skip("asynchronous logging not supported");
+	}
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	(void)logger(&id);
+	isc_log_write(tlctx, ISC_LOGCATEGORY_GENERAL, ISC_LOGMODULE_OTHER,
+		      ISC_LOG_CRITICAL, "critical");
+
+	/*
+	 * The critical message must be in the file already, after all
+	 * the others.
+	 */
+	ATF_CHECK_EQ(readlog(last, sizeof(last)), NMESSAGES);
+	ATF_CHECK_STREQ(last, "critical\n");
+
+	result = isc_log_setasync(tlctx, false, 0, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	teardown();
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, async);
+	ATF_TP_ADD_TC(tp, drop);
+	ATF_TP_ADD_TC(tp, critical);
+	return (atf_no_error());
+}
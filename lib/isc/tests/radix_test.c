@@ -13,12 +13,16 @@
 
 #include <isc/mem.h>
 #include <isc/netaddr.h>
+#include <isc/print.h>
 #include <isc/radix.h>
+#include <isc/random.h>
 #include <isc/result.h>
+#include <isc/time.h>
 #include <isc/util.h>
 
 #include <atf-c.h>
 
+#include <stdio.h>
 #include <stdlib.h>
 
 #include "isctest.h"
@@ -79,11 +83,300 @@ ATF_TC_BODY(isc_radix_search, tc) {
 	isc_test_end();
 }
 
+/*
+ * Set 'buf' to a random address near one of a small pool, so that
+ * the prefixes in the tree nest and collide.
+ */
+static void
+random_address(unsigned char *buf) {
+	static const unsigned char pool[][16] = {
+		{ 10, 0, 0, 0 },
+		{ 10, 1, 128, 0 },
+		{ 192, 0, 2, 0 },
+		{ 0x20, 0x01, 0x0d, 0xb8 },
+		{ 0x20, 0x01, 0x0d, 0xb8, 0x80 },
+		{ 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+		  0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff },
+	};
+	unsigned int i;
+
+	memmove(buf, pool[isc_random_uniform(sizeof(pool) / sizeof(pool[0]))],
+		16);
+	for (i = 0; i < 3; i++)
+		buf[isc_random_uniform(16)] ^= 1 << isc_random_uniform(8);
+}
+
+/*
+ * Insert a random prefix of 'family' into 'radix'.
+ */
+static void
+insert_random(isc_radix_tree_t *radix, int family) {
+	isc_radix_node_t *node = NULL;
+	isc_prefix_t prefix;
+	isc_netaddr_t netaddr;
+	unsigned char buf[16];
+	unsigned int bits;
+	isc_result_t result;
+
+	random_address(buf);
+
+	if (family == AF_UNSPEC) {
+		NETADDR_TO_PREFIX_T((isc_netaddr_t *)NULL, prefix, 0);
+	} else if (family == AF_INET) {
+		bits = isc_random_uniform(33);
+		isc_netaddr_fromin(&netaddr, (struct in_addr *)buf);
+		NETADDR_TO_PREFIX_T(&netaddr, prefix, bits);
+	} else {
+		bits = isc_random_uniform(129);
+		isc_netaddr_fromin6(&netaddr, (struct in6_addr *)buf);
+		NETADDR_TO_PREFIX_T(&netaddr, prefix, bits);
+	}
+
+	result = isc_radix_insert(radix, &node, NULL, &prefix);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	isc_refcount_destroy(&prefix.refcount);
+}
+
+/*
+ * Return the first match for 'prefix' in 'radix' by checking every
+ * node of the tree.
+ */
+static isc_radix_node_t *
+search_all(isc_radix_tree_t *radix, isc_prefix_t *prefix) {
+	isc_radix_node_t *node, *best = NULL;
+	int fam = ISC_RADIX_FAMILY(prefix);
+	const unsigned char *a = isc_prefix_touchar(prefix);
+	unsigned int i;
+
+	RADIX_WALK(radix->head, node) {
+		const unsigned char *p = isc_prefix_touchar(node->prefix);
+		bool match = (node->node_num[fam] != -1 &&
+			      node->bit <= prefix->bitlen);
+
+		for (i = 0; match && i < node->bit; i++) {
+			if (((a[i / 8] ^ p[i / 8]) & (0x80 >> (i % 8))) != 0)
+				match = false;
+		}
+		if (match &&
+		    (best == NULL ||
+		     node->node_num[fam] < best->node_num[fam] ||
+		     (node->node_num[fam] == best->node_num[fam] &&
+		      node->bit > best->bit)))
+		{
+			best = node;
+		}
+	} RADIX_WALK_END;
+
+	return (best);
+}
+
+static void
+check_random(isc_radix_tree_t *radix, unsigned int count) {
+	isc_radix_node_t *node, *expect;
+	isc_prefix_t prefix;
+	isc_netaddr_t netaddr;
+	unsigned char buf[16];
+	isc_result_t result;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		/* Mostly addresses near the prefixes in the tree. */
+		if (isc_random_uniform(4) != 0)
+			random_address(buf);
+		else
+			isc_random_buf(buf, sizeof(buf));
+		if (i % 2 == 0) {
+			isc_netaddr_fromin6(&netaddr, (struct in6_addr *)buf);
+			NETADDR_TO_PREFIX_T(&netaddr, prefix, 128);
+		} else {
+			isc_netaddr_fromin(&netaddr, (struct in_addr *)buf);
+			NETADDR_TO_PREFIX_T(&netaddr, prefix, 32);
+		}
+
+		node = NULL;
+		result = isc_radix_search(radix, &node, &prefix);
+		expect = search_all(radix, &prefix);
+		ATF_REQUIRE_EQ(node, expect);
+		ATF_REQUIRE_EQ(result, (expect == NULL) ? ISC_R_NOTFOUND
+							: ISC_R_SUCCESS);
+		isc_refcount_destroy(&prefix.refcount);
+	}
+}
+
+ATF_TC(isc_radix_index);
+ATF_TC_HEAD(isc_radix_index, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "check that searching large trees follows the "
+			  "first-match rule");
+}
+ATF_TC_BODY(isc_radix_index, tc) {
+	static const int families[] = { AF_INET, AF_INET6 };
+	isc_radix_tree_t *radix = NULL, *other = NULL;
+	isc_radix_node_t *node, *new_node;
+	isc_result_t result;
+	unsigned int i, round;
+
+	UNUSED(tc);
+
+	result = isc_test_begin(NULL, true, 0);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	for (round = 0; round < 20; round++) {
+		unsigned int count = 1 + isc_random_uniform(400);
+
+		result = isc_radix_create(mctx, &radix, RADIX_MAXBITS);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+		for (i = 0; i < count; i++) {
+			insert_random(radix, families[i % 2]);
+			if (round % 4 == 0 && i == count / 2)
+				insert_random(radix, AF_UNSPEC);
+		}
+		/* Build the index up front in half of the rounds. */
+		if (round % 2 == 0)
+			isc_radix_buildindex(radix);
+		check_random(radix, 2000);
+
+		/* Merge another tree in, as dns_iptable_merge() does. */
+		result = isc_radix_create(mctx, &other, RADIX_MAXBITS);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		for (i = 0; i < count; i++)
+			insert_random(other, families[i % 2]);
+		RADIX_WALK(other->head, node) {
+			new_node = NULL;
+			result = isc_radix_insert(radix, &new_node, node, NULL);
+			ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		} RADIX_WALK_END;
+		radix->num_added_node += other->num_added_node;
+		isc_radix_destroy(other, NULL);
+		other = NULL;
+		if (round % 2 == 0)
+			isc_radix_buildindex(radix);
+		check_random(radix, 2000);
+
+		/* Remove a few leaves. */
+		for (i = 0; i < 5 && radix->head != NULL; i++) {
+			node = radix->head;
+			while (node->l != NULL || node->r != NULL) {
+				node = (node->r == NULL ||
+					(node->l != NULL && isc_random8() < 128))
+					? node->l : node->r;
+			}
+			isc_radix_remove(radix, node);
+		}
+		if (radix->head != NULL)
+			check_random(radix, 2000);
+
+		isc_radix_destroy(radix, NULL);
+		radix = NULL;
+	}
+
+	isc_test_end();
+}
+
+#ifdef ISC_BENCHMARK_TESTS
+/*
+ * Load a table of disjoint, non-adjacent /24s, which is the worst case
+ * for the size of the index: each prefix starts a range and the gap
+ * after it another.
+ */
+ATF_TC(benchmark);
+ATF_TC_HEAD(benchmark, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "Benchmark a radix tree of 1M disjoint IPv4 prefixes");
+}
+ATF_TC_BODY(benchmark, tc) {
+	const unsigned int count = 1000000, rounds = 2000000;
+	isc_mem_t *bmctx = NULL;
+	isc_radix_tree_t *radix = NULL;
+	isc_radix_node_t *node;
+	isc_prefix_t prefix;
+	isc_netaddr_t netaddr;
+	struct in_addr in;
+	uint32_t *addrs;
+	isc_time_t ts1, ts2, ts3;
+	isc_result_t result;
+	size_t inuse;
+	unsigned int i, found = 0;
+
+	UNUSED(tc);
+
+	/*
+	 * Use a private memory context: allocation tracking would
+	 * dominate the results.
+	 */
+	isc_mem_debugging = 0;
+	result = isc_mem_create(0, 0, &bmctx);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	inuse = isc_mem_inuse(bmctx);
+	result = isc_radix_create(bmctx, &radix, RADIX_MAXBITS);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	isc_time_now(&ts1);
+	for (i = 0; i < count; i++) {
+		/*
+		 * Take one /24 out of the first 15 of each block of 16,
+		 * visiting the blocks in a scrambled order.
+		 */
+		uint32_t block = (i * 2654435761U) & 0xfffff;
+		uint32_t a = (block << 4) + isc_random_uniform(15);
+
+		in.s_addr = htonl(a << 8);
+		isc_netaddr_fromin(&netaddr, &in);
+		NETADDR_TO_PREFIX_T(&netaddr, prefix, 24);
+		node = NULL;
+		result = isc_radix_insert(radix, &node, NULL, &prefix);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+		isc_refcount_destroy(&prefix.refcount);
+	}
+	isc_time_now(&ts2);
+	printf("insert: %.2f s, tree %zu MB\n",
+	       isc_time_microdiff(&ts2, &ts1) / 1e6,
+	       (isc_mem_inuse(bmctx) - inuse) >> 20);
+
+	addrs = isc_mem_get(bmctx, 65536 * sizeof(*addrs));
+	ATF_REQUIRE(addrs != NULL);
+	for (i = 0; i < 65536; i++)
+		addrs[i] = isc_random32();
+
+	inuse = isc_mem_inuse(bmctx);
+	isc_time_now(&ts1);
+	for (i = 0; i < rounds; i++) {
+		in.s_addr = addrs[i % 65536];
+		isc_netaddr_fromin(&netaddr, &in);
+		NETADDR_TO_PREFIX_T(&netaddr, prefix, 32);
+		node = NULL;
+		if (isc_radix_search(radix, &node, &prefix) == ISC_R_SUCCESS)
+			found++;
+		if (i == 0)
+			isc_time_now(&ts2);
+	}
+	isc_time_now(&ts3);
+	printf("first search: %.2f s, index %zu KB "
+	       "(%u ranges of 12 bytes: %zu KB)\n",
+	       isc_time_microdiff(&ts2, &ts1) / 1e6,
+	       (isc_mem_inuse(bmctx) - inuse) >> 10, 2 * count + 1,
+	       ((2 * count + 1) * (size_t)12) >> 10);
+	printf("search: %.1f ns (%u%% found)\n",
+	       isc_time_microdiff(&ts3, &ts2) * 1000.0 / (rounds - 1),
+	       found / (rounds / 100));
+
+	isc_mem_put(bmctx, addrs, 65536 * sizeof(*addrs));
+	isc_radix_destroy(radix, NULL);
+	isc_mem_destroy(&bmctx);
+}
+#endif /* ISC_BENCHMARK_TESTS */
+
 /*
  * Main
  */
 ATF_TP_ADD_TCS(tp) {
 	ATF_TP_ADD_TC(tp, isc_radix_search);
+	ATF_TP_ADD_TC(tp, isc_radix_index);
+#ifdef ISC_BENCHMARK_TESTS
+	ATF_TP_ADD_TC(tp, benchmark);
+#endif
 
 	return (atf_no_error());
 }
@@ -16,6 +16,7 @@
 
 #include <isc/mem.h>
 #include <isc/print.h>
+#include <isc/radix.h>
 #include <isc/string.h>		/* Required for HP/UX (and others?) */
 #include <isc/util.h>
 
@@ -635,7 +636,7 @@ cfg_acl_fromconfig2(const cfg_obj_t *caml, const cfg_obj_t *cctx,
 	const cfg_listelt_t *elt;
 	dns_iptable_t *iptab;
 	int new_nest_level = 0;
-	bool setpos;
+	bool setpos, toplevel;
 
 	if (nest_level != 0)
 		new_nest_level = nest_level - 1;
@@ -643,6 +644,8 @@ cfg_acl_fromconfig2(const cfg_obj_t *caml, const cfg_obj_t *cctx,
 	REQUIRE(target != NULL);
 	REQUIRE(*target == NULL || DNS_ACL_VALID(*target));
 
+	toplevel = (*target == NULL);
+
 	if (*target != NULL) {
 		/*
 		 * If target already points to an ACL, then we're being
@@ -897,6 +900,13 @@ nested_acl:
 		INSIST(dacl->length <= dacl->alloc);
 	}
 
+	/*
+	 * Build the search index of a complete ACL now rather than
+	 * on the first query that is checked against it.
+	 */
+	if (toplevel)
+		isc_radix_buildindex(dacl->iptable->radix);
+
 	dns_acl_attach(dacl, target);
 	result = ISC_R_SUCCESS;
 
@@ -1028,12 +1028,20 @@ static cfg_type_t cfg_type_fstrm_model = {
 	&cfg_rep_string, &fstrm_model_enums
 };
 
+static const char *asyncoverflow_enums[] = { "block", "drop", NULL };
+static cfg_type_t cfg_type_asyncoverflow = {
+	"asyncoverflow", cfg_parse_enum, cfg_print_ustring, cfg_doc_enum,
+	&cfg_rep_string, &asyncoverflow_enums
+};
+
 /*%
  * Clauses that can be found within the 'options' statement.
  */
 static cfg_clausedef_t
 options_clauses[] = {
 	{ "answer-cookie", &cfg_type_boolean, 0 },
+	{ "async-logging", &cfg_type_boolean, 0 },
+	{ "async-logging-overflow", &cfg_type_asyncoverflow, 0 },
 	{ "automatic-interface-scan", &cfg_type_boolean, 0 },
 	{ "avoid-v4-udp-ports", &cfg_type_bracketed_portlist, 0 },
 	{ "avoid-v6-udp-ports", &cfg_type_bracketed_portlist, 0 },
@@ -1114,6 +1122,7 @@ options_clauses[] = {
 	{ "pid-file", &cfg_type_qstringornone, 0 },
 	{ "port", &cfg_type_uint32, 0 },
 	{ "querylog", &cfg_type_boolean, 0 },
+	{ "querylog-binary", &cfg_type_logfile, 0 },
 	{ "random-device", &cfg_type_qstringornone, 0 },
 	{ "recursing-file", &cfg_type_qstring, 0 },
 	{ "recursive-clients", &cfg_type_uint32, 0 },
@@ -1140,6 +1149,7 @@ options_clauses[] = {
 	{ "tkey-domain", &cfg_type_qstring, 0 },
 	{ "tkey-gssapi-credential", &cfg_type_qstring, 0 },
 	{ "tkey-gssapi-keytab", &cfg_type_qstring, 0 },
+	{ "transfer-cache-size", &cfg_type_sizenodefault, 0 },
 	{ "transfer-message-size", &cfg_type_uint32, 0 },
 	{ "transfers-in", &cfg_type_uint32, 0 },
 	{ "transfers-out", &cfg_type_uint32, 0 },
@@ -1309,6 +1319,20 @@ static cfg_type_t cfg_type_dnstap = {
 	cfg_doc_bracketed_list, &cfg_rep_list, &cfg_type_dnstap_entry
 };
 
+/*%
+ * dnstap-sample-prefix <ipv4-length> <ipv6-length>;
+ */
+static cfg_tuplefielddef_t dtsampleprefix_fields[] = {
+	{ "ipv4", &cfg_type_uint32, 0 },
+	{ "ipv6", &cfg_type_uint32, 0 },
+	{ NULL, NULL, 0 }
+};
+
+static cfg_type_t cfg_type_dtsampleprefix = {
+	"dnstap-sample-prefix", cfg_parse_tuple, cfg_print_tuple,
+	cfg_doc_tuple, &cfg_rep_tuple, dtsampleprefix_fields
+};
+
 /*%
  * dnstap-output
  */
@@ -1849,6 +1873,7 @@ view_clauses[] = {
 	  CFG_CLAUSEFLAG_OBSOLETE },
 	{ "acache-enable", &cfg_type_boolean,
 	  CFG_CLAUSEFLAG_OBSOLETE },
+	{ "accept-client-subnet", &cfg_type_bracketed_aml, 0 },
 	{ "additional-from-auth", &cfg_type_boolean,
 	  CFG_CLAUSEFLAG_OBSOLETE },
 	{ "additional-from-cache", &cfg_type_boolean,
@@ -1866,6 +1891,7 @@ view_clauses[] = {
 	{ "catalog-zones", &cfg_type_catz, 0 },
 	{ "check-names", &cfg_type_checknames, CFG_CLAUSEFLAG_MULTI },
 	{ "cleaning-interval", &cfg_type_uint32, 0 },
+	{ "client-subnet-servers", &cfg_type_bracketed_aml, 0 },
 	{ "clients-per-query", &cfg_type_uint32, 0 },
 	{ "deny-answer-addresses", &cfg_type_denyaddresses, 0 },
 	{ "deny-answer-aliases", &cfg_type_denyaliases, 0 },
@@ -1893,8 +1919,13 @@ view_clauses[] = {
 	{ "dnssec-validation", &cfg_type_boolorauto, 0 },
 #ifdef HAVE_DNSTAP
 	{ "dnstap", &cfg_type_dnstap, 0 },
+	{ "dnstap-sample", &cfg_type_uint32, 0 },
+	{ "dnstap-sample-prefix", &cfg_type_dtsampleprefix, 0 },
 #else
 	{ "dnstap", &cfg_type_dnstap, CFG_CLAUSEFLAG_NOTCONFIGURED },
+	{ "dnstap-sample", &cfg_type_uint32, CFG_CLAUSEFLAG_NOTCONFIGURED },
+	{ "dnstap-sample-prefix", &cfg_type_dtsampleprefix,
+	  CFG_CLAUSEFLAG_NOTCONFIGURED },
 #endif /* HAVE_DNSTAP */
 	{ "dual-stack-servers", &cfg_type_nameportiplist, 0 },
 	{ "edns-udp-size", &cfg_type_uint32, 0 },
@@ -1964,6 +1995,7 @@ view_clauses[] = {
 	{ "root-delegation-only",  &cfg_type_optional_exclude, 0 },
 	{ "root-key-sentinel", &cfg_type_boolean, 0 },
 	{ "rrset-order", &cfg_type_rrsetorder, 0 },
+	{ "send-client-subnet", &cfg_type_boolean, 0 },
 	{ "send-cookie", &cfg_type_boolean, 0 },
 	{ "servfail-ttl", &cfg_type_ttlval, 0 },
 	{ "sortlist", &cfg_type_bracketed_aml, 0 },
@@ -2099,6 +2131,9 @@ zone_clauses[] = {
 	{ "inline-signing", &cfg_type_boolean,
 		CFG_ZONE_MASTER | CFG_ZONE_SLAVE
 	},
+	{ "journal-sync-delay", &cfg_type_uint32,
+		CFG_ZONE_MASTER
+	},
 	{ "key-directory", &cfg_type_qstring,
 		CFG_ZONE_MASTER | CFG_ZONE_SLAVE
 	},
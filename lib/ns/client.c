@@ -17,6 +17,7 @@
 #include <isc/aes.h>
 #include <isc/formatcheck.h>
 #include <isc/fuzz.h>
+#include <isc/histo.h>
 #include <isc/hmacsha.h>
 #include <isc/mutex.h>
 #include <isc/once.h>
@@ -51,6 +52,7 @@
 #include <dns/rdataset.h>
 #include <dns/resolver.h>
 #include <dns/stats.h>
+#include <dns/tcpmsg.h>
 #include <dns/tsig.h>
 #include <dns/view.h>
 #include <dns/zone.h>
@@ -102,6 +104,13 @@
 #define SEND_BUFFER_SIZE		4096
 #define RECV_BUFFER_SIZE		4096
 
+#define TCP_PIPELINE_DEPTH		32
+/*%<
+ * Maximum number of requests from a single pipelining TCP connection
+ * that are processed at the same time.  The connection stops reading
+ * until one of them is done.
+ */
+
 #define NMCTXS				100
 /*%<
  * Number of 'mctx pools' for clients. (Should this be configurable?)
@@ -120,6 +129,59 @@
 #define WANTPAD(x) (((x)->attributes & NS_CLIENTATTR_WANTPAD) != 0)
 #define USEKEEPALIVE(x) (((x)->attributes & NS_CLIENTATTR_USEKEEPALIVE) != 0)
 
+/*%
+ * An accepted TCP connection.
+ *
+ * The connection reads requests by itself, with its own task and idle
+ * timer, and hands each one to a client taken from the manager's pool
+ * of inactive clients, which returns to the pool once the response has
+ * been sent.  An idle connection therefore holds no client.  If the
+ * connection is pipelined, it goes on reading while its requests are
+ * being processed, and responses are sent in the order they complete.
+ *
+ * The connection holds the tcp-clients quota, and lives until the read
+ * in progress, if any, and all the clients working on its requests have
+ * detached from it.  A request read while earlier ones are still being
+ * worked on needs another tcp-clients quota for its client; if none is
+ * left, the request waits until the earlier ones have completed.
+ */
+struct ns_tcpconn {
+	unsigned int			magic;
+	isc_mem_t *			mctx;
+	ns_clientmgr_t *		manager;
+	ns_interface_t *		interface;
+	isc_task_t *			task;
+	isc_timer_t *			timer;
+	isc_socket_t *			socket;
+	isc_quota_t *			tcpquota;
+	isc_sockaddr_t			peeraddr;
+	bool				pipelined; /*%< TCP queries not in
+						    *   sequence */
+
+	/* Lock covers the fields below */
+	isc_mutex_t			lock;
+	int				references;
+	unsigned int			nclients;  /*%< Clients working on
+						    *   requests */
+	unsigned int			nrequests;
+	bool				reading;
+	bool				serial;	   /*%< Wait for all the
+						    *   requests to complete
+						    *   before reading again */
+	bool				closing;
+	bool				keepalive;
+	isc_buffer_t			pending;   /*%< Request waiting for
+						    *   a quota */
+	dns_tcpmsg_t			tcpmsg;
+
+	ISC_LINK(ns_tcpconn_t)		link;
+};
+
+typedef ISC_LIST(ns_tcpconn_t) tcpconn_list_t;
+
+#define TCPCONN_MAGIC			ISC_MAGIC('N', 'S', 'T', 'c')
+#define VALID_TCPCONN(c)		ISC_MAGIC_VALID(c, TCPCONN_MAGIC)
+
 /*% nameserver client manager structure */
 struct ns_clientmgr {
 	/* Unlocked. */
@@ -138,9 +200,10 @@ struct ns_clientmgr {
 	isc_mutex_t			lock;
 	bool			exiting;
 
-	/* Lock covers the clients list */
+	/* Lock covers the clients and connections lists */
 	isc_mutex_t			listlock;
 	client_list_t			clients;      /*%< All active clients */
+	tcpconn_list_t			tcpconns;     /*%< All TCP connections */
 
 	/* Lock covers the recursing list */
 	isc_mutex_t			reclock;
@@ -196,9 +259,9 @@ struct ns_clientmgr {
 
 #define NS_CLIENTSTATE_READING  3
 /*%<
- * The client object is a TCP client object that has received
- * a connection.  It has a tcpsocket, tcpmsg, TCP quota, and an
- * outstanding TCP read request.  This state is not used for
+ * The client object is a TCP client object that has been handed
+ * a request read from a connection.  It has a tcpsocket, and it
+ * is attached to the connection.  This state is not used for
  * UDP client objects.
  */
 
@@ -231,8 +294,6 @@ struct ns_clientmgr {
 
 LIBNS_EXTERNAL_DATA unsigned int ns_client_requests;
 
-static void read_settimeout(ns_client_t *client, bool newconn);
-static void client_read(ns_client_t *client, bool newconn);
 static void client_accept(ns_client_t *client);
 static void client_udprecv(ns_client_t *client);
 static void clientmgr_destroy(ns_clientmgr_t *manager);
@@ -242,8 +303,15 @@ static void client_start(isc_task_t *task, isc_event_t *event);
 static void ns_client_dumpmessage(ns_client_t *client, const char *reason);
 static isc_result_t get_client(ns_clientmgr_t *manager, ns_interface_t *ifp,
 			       dns_dispatch_t *disp, bool tcp);
-static isc_result_t get_worker(ns_clientmgr_t *manager, ns_interface_t *ifp,
-			       isc_socket_t *sock);
+static isc_result_t get_worker(ns_clientmgr_t *manager, ns_tcpconn_t *conn,
+			       isc_buffer_t *buffer, isc_quota_t **quotap);
+static void tcpconn_read(isc_task_t *task, isc_event_t *event);
+static void tcpconn_handoff(ns_tcpconn_t *conn, isc_buffer_t *buffer,
+			    isc_quota_t **quotap, bool readnext);
+static void tcpconn_done(ns_tcpconn_t **connp, bool close);
+static void tcpconn_close(ns_tcpconn_t *conn);
+static void tcpconn_log(ns_tcpconn_t *conn, int level, const char *fmt, ...)
+	ISC_FORMAT_PRINTF(3, 4);
 static void compute_cookie(ns_client_t *client, uint32_t when,
 			   uint32_t nonce, const unsigned char *secret,
 			   isc_buffer_t *buf);
@@ -292,32 +360,6 @@ ns_client_settimeout(ns_client_t *client, unsigned int seconds) {
 	}
 }
 
-static void
-read_settimeout(ns_client_t *client, bool newconn) {
-	isc_result_t result;
-	isc_interval_t interval;
-	unsigned int ds;
-
-	if (newconn)
-		ds = client->sctx->initialtimo;
-	else if (USEKEEPALIVE(client))
-		ds = client->sctx->keepalivetimo;
-	else
-		ds = client->sctx->idletimo;
-
-	isc_interval_set(&interval, ds / 10, 100000000 * (ds % 10));
-	result = isc_timer_reset(client->timer, isc_timertype_once, NULL,
-				 &interval, false);
-	client->timerset = true;
-	if (result != ISC_R_SUCCESS) {
-		ns_client_log(client, NS_LOGCATEGORY_CLIENT,
-			      NS_LOGMODULE_CLIENT, ISC_LOG_ERROR,
-			      "setting timeout: %s",
-			      isc_result_totext(result));
-		/* Continue anyway. */
-	}
-}
-
 /*%
  * Check for a deactivation or shutdown request and take appropriate
  * action.  Returns true if either is in progress; in this case
@@ -401,49 +443,56 @@ exit_check(ns_client_t *client) {
 						client, rlink);
 			UNLOCK(&manager->reclock);
 		}
+
+		/*
+		 * An EDNS TCP keepalive option applies to the rest of
+		 * the connection.
+		 */
+		if (client->tcpconn != NULL && USEKEEPALIVE(client)) {
+			LOCK(&client->tcpconn->lock);
+			client->tcpconn->keepalive = true;
+			UNLOCK(&client->tcpconn->lock);
+		}
+
 		ns_client_endrequest(client);
 
 		client->state = NS_CLIENTSTATE_READING;
 		INSIST(client->recursionquota == NULL);
 
-		if (NS_CLIENTSTATE_READING == client->newstate) {
-			if (!client->pipelined) {
-				client_read(client, false);
-				client->newstate = NS_CLIENTSTATE_MAX;
-				return (true); /* We're done. */
-			} else if (client->mortal) {
-				client->newstate = NS_CLIENTSTATE_INACTIVE;
-			} else
-				return (false);
-		}
+		/*
+		 * The connection reads any further requests itself,
+		 * so we are done with it.
+		 */
+		if (NS_CLIENTSTATE_READING == client->newstate)
+			client->newstate = NS_CLIENTSTATE_INACTIVE;
 	}
 
 	if (client->state == NS_CLIENTSTATE_READING) {
 		/*
-		 * We are trying to abort the current TCP connection,
-		 * if any.
+		 * We are trying to let go of the current TCP connection,
+		 * if any.  Unless the request was completed normally,
+		 * the connection is closed.
 		 */
 		INSIST(client->recursionquota == NULL);
 		INSIST(client->newstate <= NS_CLIENTSTATE_READY);
-		if (client->nreads > 0)
-			dns_tcpmsg_cancelread(&client->tcpmsg);
-		if (client->nreads != 0) {
-			/* Still waiting for read cancel completion. */
-			return (true);
-		}
 
-		if (client->tcpmsg_valid) {
-			dns_tcpmsg_invalidate(&client->tcpmsg);
-			client->tcpmsg_valid = false;
+		if (client->tcpconn != NULL) {
+			if (client->tcpreq.base != NULL) {
+				isc_mem_put(client->tcpconn->mctx,
+					    client->tcpreq.base,
+					    client->tcpreq.length);
+				isc_buffer_initnull(&client->tcpreq);
+			}
+			if (client->tcpquota != NULL)
+				isc_quota_detach(&client->tcpquota);
+			tcpconn_done(&client->tcpconn, client->newstate !=
+						       NS_CLIENTSTATE_INACTIVE);
 		}
 		if (client->tcpsocket != NULL) {
 			CTRACE("closetcp");
 			isc_socket_detach(&client->tcpsocket);
 		}
 
-		if (client->tcpquota != NULL)
-			isc_quota_detach(&client->tcpquota);
-
 		if (client->timerset) {
 			(void)isc_timer_reset(client->timer,
 					      isc_timertype_inactive,
@@ -451,8 +500,6 @@ exit_check(ns_client_t *client) {
 			client->timerset = false;
 		}
 
-		client->pipelined = false;
-
 		client->peeraddr_valid = false;
 
 		client->state = NS_CLIENTSTATE_READY;
@@ -594,7 +641,8 @@ exit_check(ns_client_t *client) {
 			ISC_LIST_UNLINK(manager->clients, client, link);
 			LOCK(&manager->lock);
 			if (manager->exiting &&
-			    ISC_LIST_EMPTY(manager->clients))
+			    ISC_LIST_EMPTY(manager->clients) &&
+			    ISC_LIST_EMPTY(manager->tcpconns))
 				destroy_manager = true;
 			UNLOCK(&manager->lock);
 			UNLOCK(&manager->listlock);
@@ -684,8 +732,12 @@ client_start(isc_task_t *task, isc_event_t *event) {
 		return;
 
 	if (TCP_CLIENT(client)) {
-		if (client->pipelined) {
-			client_read(client, false);
+		if (client->tcpconn != NULL) {
+			/*
+			 * We have been handed a request read from
+			 * the connection.
+			 */
+			ns__client_request(task, event);
 		} else {
 			client_accept(client);
 		}
@@ -731,7 +783,6 @@ client_shutdown(isc_task_t *task, isc_event_t *event) {
 static void
 ns_client_endrequest(ns_client_t *client) {
 	INSIST(client->naccepts == 0);
-	INSIST(client->nreads == 0);
 	INSIST(client->nsends == 0);
 	INSIST(client->nrecvs == 0);
 	INSIST(client->nupdates == 0);
@@ -994,6 +1045,14 @@ client_sendpkg(ns_client_t *client, isc_buffer_t *buffer) {
 				    client->sendevent, sockflags);
 	if (result == ISC_R_SUCCESS || result == ISC_R_INPROGRESS) {
 		client->nsends++;
+		if (client->view != NULL && client->view->latency != NULL) {
+			isc_time_t now;
+
+			TIME_NOW(&now);
+			isc_histo_add(client->view->latency, dns_latency_query,
+				      isc_time_microdiff(&now,
+							 &client->requesttime));
+		}
 		if (result == ISC_R_SUCCESS)
 			client_senddone(client->task,
 					(isc_event_t *)client->sendevent);
@@ -2238,7 +2297,8 @@ process_opt(ns_client_t *client, dns_rdataset_t *opt) {
 
 /*
  * Handle an incoming request event from the socket (UDP case)
- * or tcpmsg (TCP case).
+ * or the control event of a client handed a request by a TCP
+ * connection (TCP case).
  */
 void
 ns__client_request(isc_task_t *task, isc_event_t *event) {
@@ -2303,15 +2363,13 @@ ns__client_request(isc_task_t *task, isc_event_t *event) {
 		client->nrecvs--;
 	} else {
 		INSIST(TCP_CLIENT(client));
-		REQUIRE(event->ev_type == DNS_EVENT_TCPMSG);
-		REQUIRE(event->ev_sender == &client->tcpmsg);
-		buffer = &client->tcpmsg.buffer;
-		result = client->tcpmsg.result;
-		INSIST(client->nreads == 1);
+		REQUIRE(event->ev_type == NS_EVENT_CLIENTCONTROL);
+		REQUIRE(client->tcpconn != NULL);
+		buffer = &client->tcpreq;
+		result = ISC_R_SUCCESS;
 		/*
 		 * client->peeraddr was set when the connection was accepted.
 		 */
-		client->nreads--;
 	}
 
 	reqsize = isc_buffer_usedlength(buffer);
@@ -2466,7 +2524,8 @@ ns__client_request(isc_task_t *task, isc_event_t *event) {
 	/*
 	 * It's a request.  Parse it.
 	 */
-	result = dns_message_parse(client->message, buffer, 0);
+	result = dns_message_parse(client->message, buffer,
+				   DNS_MESSAGEPARSE_ARENA);
 	if (result != ISC_R_SUCCESS) {
 		/*
 		 * Parsing the request failed.  Send a response
@@ -2484,24 +2543,6 @@ ns__client_request(isc_task_t *task, isc_event_t *event) {
 		return;
 	}
 
-	/*
-	 * Pipeline TCP query processing.
-	 */
-	if (client->message->opcode != dns_opcode_query)
-		client->pipelined = false;
-	if (TCP_CLIENT(client) && client->pipelined) {
-		result = isc_quota_reserve(&client->sctx->tcpquota);
-		if (result == ISC_R_SUCCESS)
-			result = ns_client_replace(client);
-		if (result != ISC_R_SUCCESS) {
-			ns_client_log(client, NS_LOGCATEGORY_CLIENT,
-				      NS_LOGMODULE_CLIENT, ISC_LOG_WARNING,
-				      "no more TCP clients(read): %s",
-				      isc_result_totext(result));
-			client->pipelined = false;
-		}
-	}
-
 	dns_opcodestats_increment(client->sctx->opcodestats,
 				  client->message->opcode);
 	switch (client->message->opcode) {
@@ -2993,7 +3034,6 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 	client->state = NS_CLIENTSTATE_INACTIVE;
 	client->newstate = NS_CLIENTSTATE_MAX;
 	client->naccepts = 0;
-	client->nreads = 0;
 	client->nsends = 0;
 	client->nrecvs = 0;
 	client->nupdates = 0;
@@ -3005,7 +3045,8 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 	client->udpsocket = NULL;
 	client->tcplistener = NULL;
 	client->tcpsocket = NULL;
-	client->tcpmsg_valid = false;
+	client->tcpconn = NULL;
+	isc_buffer_initnull(&client->tcpreq);
 	client->tcpbuf = NULL;
 	client->opt = NULL;
 	client->udpsize = 512;
@@ -3019,9 +3060,8 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 	dns_name_init(&client->signername, NULL);
 	client->mortal = false;
 	client->sendcb = NULL;
-	client->pipelined = false;
-	client->tcpquota = NULL;
 	client->recursionquota = NULL;
+	client->tcpquota = NULL;
 	client->interface = NULL;
 	client->peeraddr_valid = false;
 	dns_ecs_init(&client->ecs);
@@ -3095,30 +3135,455 @@ client_create(ns_clientmgr_t *manager, ns_client_t **clientp) {
 }
 
 static void
-client_read(ns_client_t *client, bool newconn) {
+tcpconn_log(ns_tcpconn_t *conn, int level, const char *fmt, ...) {
+	char msgbuf[2048];
+	char peerbuf[ISC_SOCKADDR_FORMATSIZE];
+	va_list ap;
+
+	if (! isc_log_wouldlog(ns_lctx, level))
+		return;
+
+	va_start(ap, fmt);
+	vsnprintf(msgbuf, sizeof(msgbuf), fmt, ap);
+	va_end(ap);
+
+	isc_sockaddr_format(&conn->peeraddr, peerbuf, sizeof(peerbuf));
+	isc_log_write(ns_lctx, NS_LOGCATEGORY_CLIENT, NS_LOGMODULE_CLIENT,
+		      level, "client @%p %s: %s", conn, peerbuf, msgbuf);
+}
+
+static void
+tcpconn_destroy(ns_tcpconn_t *conn) {
+	ns_clientmgr_t *manager = conn->manager;
+	bool destroy_manager = false;
+
+	INSIST(conn->references == 0);
+	INSIST(conn->nclients == 0);
+	INSIST(!conn->reading);
+	INSIST(conn->pending.base == NULL);
+
+	tcpconn_log(conn, ISC_LOG_DEBUG(3), "closing TCP connection");
+
+	LOCK(&manager->listlock);
+	ISC_LIST_UNLINK(manager->tcpconns, conn, link);
+	LOCK(&manager->lock);
+	if (manager->exiting &&
+	    ISC_LIST_EMPTY(manager->clients) &&
+	    ISC_LIST_EMPTY(manager->tcpconns))
+		destroy_manager = true;
+	UNLOCK(&manager->lock);
+	UNLOCK(&manager->listlock);
+
+	/*
+	 * The timer is inactive, and detaching it purges any timer
+	 * event still queued for the connection's task.
+	 */
+	isc_timer_detach(&conn->timer);
+	dns_tcpmsg_invalidate(&conn->tcpmsg);
+	isc_socket_detach(&conn->socket);
+	isc_quota_detach(&conn->tcpquota);
+	ns_interface_detach(&conn->interface);
+	isc_task_detach(&conn->task);
+	DESTROYLOCK(&conn->lock);
+
+	conn->magic = 0;
+	isc_mem_putanddetach(&conn->mctx, conn, sizeof(*conn));
+
+	if (destroy_manager)
+		clientmgr_destroy(manager);
+}
+
+static void
+tcpconn_detach(ns_tcpconn_t **connp) {
+	ns_tcpconn_t *conn;
+	bool destroy;
+
+	REQUIRE(connp != NULL && VALID_TCPCONN(*connp));
+
+	conn = *connp;
+	*connp = NULL;
+
+	LOCK(&conn->lock);
+	INSIST(conn->references > 0);
+	conn->references--;
+	destroy = (conn->references == 0);
+	UNLOCK(&conn->lock);
+
+	if (destroy)
+		tcpconn_destroy(conn);
+}
+
+/*%
+ * Stop reading requests from 'conn'.  The socket is closed once all
+ * the clients working on earlier requests are done with it.
+ *
+ * Requires conn->lock.
+ */
+static void
+tcpconn_stop(ns_tcpconn_t *conn) {
+	conn->closing = true;
+	if (conn->reading)
+		dns_tcpmsg_cancelread(&conn->tcpmsg);
+}
+
+/*%
+ * Set the timer to limit the amount of time we will wait for the next
+ * request on 'conn'.
+ *
+ * Requires conn->lock.
+ */
+static void
+tcpconn_settimeout(ns_tcpconn_t *conn) {
+	ns_server_t *sctx = conn->manager->sctx;
+	isc_interval_t interval;
 	isc_result_t result;
+	unsigned int ds;
 
-	CTRACE("read");
+	if (conn->nrequests == 0)
+		ds = sctx->initialtimo;
+	else if (conn->keepalive)
+		ds = sctx->keepalivetimo;
+	else
+		ds = sctx->idletimo;
 
-	result = dns_tcpmsg_readmessage(&client->tcpmsg, client->task,
-					ns__client_request, client);
-	if (result != ISC_R_SUCCESS)
-		goto fail;
+	isc_interval_set(&interval, ds / 10, 100000000 * (ds % 10));
+	result = isc_timer_reset(conn->timer, isc_timertype_once, NULL,
+				 &interval, true);
+	if (result != ISC_R_SUCCESS) {
+		tcpconn_log(conn, ISC_LOG_ERROR, "setting timeout: %s",
+			    isc_result_totext(result));
+		/* Continue anyway. */
+	}
+}
+
+/*%
+ * Start reading the next request from 'conn'.
+ *
+ * Requires conn->lock.
+ */
+static void
+tcpconn_startread(ns_tcpconn_t *conn) {
+	isc_result_t result;
+
+	if (conn->reading || conn->closing)
+		return;
+
+	result = dns_tcpmsg_readmessage(&conn->tcpmsg, conn->task,
+					tcpconn_read, conn);
+	if (result != ISC_R_SUCCESS) {
+		tcpconn_log(conn, ISC_LOG_DEBUG(3), "request failed: %s",
+			    isc_result_totext(result));
+		conn->closing = true;
+		return;
+	}
+	conn->reading = true;
+	conn->serial = false;
+	conn->references++;
+
+	tcpconn_settimeout(conn);
+}
+
+/*%
+ * A request has been read from the connection, or the read failed.
+ */
+static void
+tcpconn_read(isc_task_t *task, isc_event_t *event) {
+	ns_tcpconn_t *conn = event->ev_arg;
+	isc_buffer_t buffer;
+	isc_region_t r;
+	isc_result_t result;
+	isc_quota_t *quota = NULL;
+	bool readnext = false;
+
+	REQUIRE(event->ev_type == DNS_EVENT_TCPMSG);
+	REQUIRE(VALID_TCPCONN(conn));
+	REQUIRE(task == conn->task);
+
+	UNUSED(task);
+
+	LOCK(&conn->lock);
+	INSIST(conn->reading);
+	conn->reading = false;
+	(void)isc_timer_reset(conn->timer, isc_timertype_inactive,
+			      NULL, NULL, true);
+
+	result = conn->tcpmsg.result;
+	if (result == ISC_R_SUCCESS && conn->closing)
+		result = ISC_R_CANCELED;
+	if (result != ISC_R_SUCCESS) {
+		conn->closing = true;
+		UNLOCK(&conn->lock);
+		if (result != ISC_R_CANCELED)
+			tcpconn_log(conn, ISC_LOG_DEBUG(3),
+				    "request failed: %s",
+				    isc_result_totext(result));
+		tcpconn_detach(&conn);
+		return;
+	}
+
+	dns_tcpmsg_keepbuffer(&conn->tcpmsg, &buffer);
+	conn->nrequests++;
 
 	/*
-	 * Set a timeout to limit the amount of time we will wait
-	 * for a request on this TCP connection.
+	 * Reserve a reference for the client that will handle the
+	 * request.  If earlier requests are still being worked on, the
+	 * client also needs a tcp-clients quota; if none is left, the
+	 * request waits in conn->pending until they have completed.
 	 */
-	read_settimeout(client, newconn);
+	conn->references++;
+	if (conn->nclients > 0) {
+		result = isc_quota_attach(&conn->manager->sctx->tcpquota,
+					  &quota);
+		if (result != ISC_R_SUCCESS) {
+			conn->pending = buffer;
+			conn->serial = true;
+			UNLOCK(&conn->lock);
+			tcpconn_log(conn, ISC_LOG_DEBUG(3),
+				    "request deferred: %s",
+				    isc_result_totext(result));
+			tcpconn_detach(&conn);
+			return;
+		}
+	}
 
-	client->state = client->newstate = NS_CLIENTSTATE_READING;
-	INSIST(client->nreads == 0);
-	INSIST(client->recursionquota == NULL);
-	client->nreads++;
+	/*
+	 * Reserve a place for the client.  Unless responses must be
+	 * sent in order, or this is not a query, read the next request
+	 * right away.
+	 */
+	conn->nclients++;
+	isc_buffer_usedregion(&buffer, &r);
+	if (conn->pipelined && r.length >= DNS_MESSAGE_HEADERLEN &&
+	    ((r.base[2] >> 3) & 0x0f) == dns_opcode_query)
+	{
+		readnext = (conn->nclients < TCP_PIPELINE_DEPTH);
+	} else
+		conn->serial = true;
+	UNLOCK(&conn->lock);
 
-	return;
- fail:
-	ns_client_next(client, result);
+	tcpconn_handoff(conn, &buffer, &quota, readnext);
+
+	/*
+	 * Release the reference held by this read.
+	 */
+	tcpconn_detach(&conn);
+}
+
+/*%
+ * Hand the request in 'buffer' to a client, along with the tcp-clients
+ * quota in '*quotap', if any.  The caller has reserved a reference and
+ * a place for the client in 'conn'.  If 'readnext' is true, start
+ * reading the next request.
+ */
+static void
+tcpconn_handoff(ns_tcpconn_t *conn, isc_buffer_t *buffer,
+		isc_quota_t **quotap, bool readnext)
+{
+	isc_result_t result;
+
+	result = get_worker(conn->manager, conn, buffer, quotap);
+	if (result != ISC_R_SUCCESS) {
+		tcpconn_log(conn, ISC_LOG_WARNING,
+			    "no more TCP clients(read): %s",
+			    isc_result_totext(result));
+		isc_mem_put(conn->mctx, buffer->base, buffer->length);
+		if (*quotap != NULL)
+			isc_quota_detach(quotap);
+		LOCK(&conn->lock);
+		conn->nclients--;
+		conn->references--;
+		tcpconn_stop(conn);
+		UNLOCK(&conn->lock);
+	} else if (readnext) {
+		LOCK(&conn->lock);
+		tcpconn_startread(conn);
+		UNLOCK(&conn->lock);
+	}
+}
+
+/*%
+ * The connection has been idle for too long.
+ */
+static void
+tcpconn_timeout(isc_task_t *task, isc_event_t *event) {
+	ns_tcpconn_t *conn = event->ev_arg;
+
+	REQUIRE(VALID_TCPCONN(conn));
+	REQUIRE(task == conn->task);
+
+	UNUSED(task);
+
+	isc_event_free(&event);
+
+	LOCK(&conn->lock);
+	if (conn->reading) {
+		tcpconn_log(conn, ISC_LOG_DEBUG(3), "request failed: %s",
+			    isc_result_totext(ISC_R_TIMEDOUT));
+		tcpconn_stop(conn);
+	}
+	UNLOCK(&conn->lock);
+}
+
+/*%
+ * A client is done with a request read from '*connp'.  Unless 'close'
+ * is true, the connection reads the next request if it was waiting for
+ * this one to complete; if it is already reading, the idle timeout
+ * starts over from now.
+ */
+static void
+tcpconn_done(ns_tcpconn_t **connp, bool close) {
+	ns_tcpconn_t *conn;
+	isc_buffer_t buffer;
+	isc_quota_t *quota = NULL;
+
+	REQUIRE(connp != NULL && VALID_TCPCONN(*connp));
+
+	conn = *connp;
+	isc_buffer_initnull(&buffer);
+
+	LOCK(&conn->lock);
+	INSIST(conn->nclients > 0);
+	conn->nclients--;
+	if (close)
+		tcpconn_stop(conn);
+	else if (conn->reading && !conn->closing)
+		tcpconn_settimeout(conn);
+	else if (conn->pending.base != NULL && !conn->closing) {
+		/*
+		 * The waiting request can go ahead once the earlier
+		 * ones have completed, under the connection's quota.
+		 */
+		if (conn->nclients == 0) {
+			buffer = conn->pending;
+			isc_buffer_initnull(&conn->pending);
+			conn->nclients++;
+		}
+	} else if (conn->serial ? conn->nclients == 0
+				: conn->nclients < TCP_PIPELINE_DEPTH)
+		tcpconn_startread(conn);
+	if (conn->pending.base != NULL && conn->closing) {
+		isc_mem_put(conn->mctx, conn->pending.base,
+			    conn->pending.length);
+		isc_buffer_initnull(&conn->pending);
+		conn->references--;
+	}
+	UNLOCK(&conn->lock);
+
+	if (buffer.base != NULL)
+		tcpconn_handoff(conn, &buffer, &quota, false);
+
+	tcpconn_detach(connp);
+}
+
+/*%
+ * Stop reading from a connection because the manager is shutting down.
+ */
+static void
+tcpconn_close(ns_tcpconn_t *conn) {
+	REQUIRE(VALID_TCPCONN(conn));
+
+	LOCK(&conn->lock);
+	tcpconn_stop(conn);
+	UNLOCK(&conn->lock);
+}
+
+/*%
+ * Set up a connection for the TCP socket 'sock', accepted by 'client',
+ * and start reading requests from it.
+ */
+static isc_result_t
+tcpconn_create(ns_client_t *client, isc_socket_t *sock, bool pipelined) {
+	ns_clientmgr_t *manager = client->manager;
+	ns_tcpconn_t *conn;
+	isc_quota_t *tcpquota = NULL;
+	isc_mem_t *mctx = NULL;
+	isc_result_t result;
+	bool destroy;
+
+	result = isc_quota_attach(&client->sctx->tcpquota, &tcpquota);
+	if (result != ISC_R_SUCCESS)
+		return (result);
+
+	LOCK(&manager->lock);
+	result = get_clientmctx(manager, &mctx);
+	UNLOCK(&manager->lock);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_quota;
+
+	conn = isc_mem_get(mctx, sizeof(*conn));
+	if (conn == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_mctx;
+	}
+
+	result = isc_mutex_init(&conn->lock);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_conn;
+
+	conn->task = NULL;
+	result = isc_task_create(manager->taskmgr, 0, &conn->task);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_lock;
+	isc_task_setname(conn->task, "tcpconn", conn);
+
+	conn->timer = NULL;
+	result = isc_timer_create(manager->timermgr, isc_timertype_inactive,
+				  NULL, NULL, conn->task, tcpconn_timeout,
+				  conn, &conn->timer);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_task;
+
+	conn->mctx = mctx;
+	conn->manager = manager;
+	conn->interface = NULL;
+	ns_interface_attach(client->interface, &conn->interface);
+	conn->socket = NULL;
+	isc_socket_attach(sock, &conn->socket);
+	conn->tcpquota = tcpquota;
+	conn->peeraddr = client->peeraddr;
+	conn->pipelined = pipelined;
+	conn->references = 0;
+	conn->nclients = 0;
+	conn->nrequests = 0;
+	conn->reading = false;
+	conn->serial = false;
+	conn->closing = false;
+	conn->keepalive = false;
+	isc_buffer_initnull(&conn->pending);
+	dns_tcpmsg_init(conn->mctx, conn->socket, &conn->tcpmsg);
+	ISC_LINK_INIT(conn, link);
+	conn->magic = TCPCONN_MAGIC;
+
+	LOCK(&manager->listlock);
+	ISC_LIST_APPEND(manager->tcpconns, conn, link);
+	UNLOCK(&manager->listlock);
+
+	LOCK(&conn->lock);
+	tcpconn_startread(conn);
+	destroy = (conn->references == 0);
+	UNLOCK(&conn->lock);
+
+	if (destroy)
+		tcpconn_destroy(conn);
+
+	return (ISC_R_SUCCESS);
+
+ cleanup_task:
+	isc_task_detach(&conn->task);
+
+ cleanup_lock:
+	DESTROYLOCK(&conn->lock);
+
+ cleanup_conn:
+	isc_mem_put(mctx, conn, sizeof(*conn));
+
+ cleanup_mctx:
+	isc_mem_detach(&mctx);
+
+ cleanup_quota:
+	isc_quota_detach(&tcpquota);
+
+	return (result);
 }
 
 static void
@@ -3126,6 +3591,7 @@ client_newconn(isc_task_t *task, isc_event_t *event) {
 	ns_client_t *client = event->ev_arg;
 	isc_socket_newconnev_t *nevent = (isc_socket_newconnev_t *)event;
 	dns_aclenv_t *env = ns_interfacemgr_getaclenv(client->interface->mgr);
+	isc_socket_t *sock = NULL;
 	isc_result_t result;
 
 	REQUIRE(event->ev_type == ISC_SOCKEVENT_NEWCONN);
@@ -3149,13 +3615,10 @@ client_newconn(isc_task_t *task, isc_event_t *event) {
 	 * check to make sure it gets destroyed if we decide to exit.
 	 */
 	if (nevent->result == ISC_R_SUCCESS) {
-		client->tcpsocket = nevent->newsocket;
-		isc_socket_setname(client->tcpsocket, "client-tcp", NULL);
-		client->state = NS_CLIENTSTATE_READING;
-		INSIST(client->recursionquota == NULL);
+		sock = nevent->newsocket;
+		isc_socket_setname(sock, "client-tcp", NULL);
 
-		(void)isc_socket_getpeername(client->tcpsocket,
-					     &client->peeraddr);
+		(void)isc_socket_getpeername(sock, &client->peeraddr);
 		client->peeraddr_valid = true;
 		ns_client_log(client, NS_LOGCATEGORY_CLIENT,
 			   NS_LOGMODULE_CLIENT, ISC_LOG_DEBUG(3),
@@ -3183,6 +3646,7 @@ client_newconn(isc_task_t *task, isc_event_t *event) {
 	if (nevent->result == ISC_R_SUCCESS) {
 		int match;
 		isc_netaddr_t netaddr;
+		bool pipelined;
 
 		isc_netaddr_fromsockaddr(&netaddr, &client->peeraddr);
 
@@ -3194,43 +3658,32 @@ client_newconn(isc_task_t *task, isc_event_t *event) {
 			ns_client_log(client, DNS_LOGCATEGORY_SECURITY,
 				      NS_LOGMODULE_CLIENT, ISC_LOG_DEBUG(10),
 				      "blackholed connection attempt");
-			client->newstate = NS_CLIENTSTATE_READY;
-			(void)exit_check(client);
-			goto freeevent;
+		} else {
+			pipelined = (client->sctx->keepresporder == NULL ||
+				     !dns_acl_allowed(&netaddr, NULL,
+						client->sctx->keepresporder,
+						env));
+			result = tcpconn_create(client, sock, pipelined);
+			if (result != ISC_R_SUCCESS) {
+				ns_client_log(client, NS_LOGCATEGORY_CLIENT,
+					      NS_LOGMODULE_CLIENT,
+					      ISC_LOG_WARNING,
+					      "no more TCP clients(accept): %s",
+					      isc_result_totext(result));
+			}
 		}
 
-		INSIST(client->tcpmsg_valid == false);
-		dns_tcpmsg_init(client->mctx, client->tcpsocket,
-				&client->tcpmsg);
-		client->tcpmsg_valid = true;
-
 		/*
-		 * Let a new client take our place immediately, before
-		 * we wait for a request packet.  If we don't,
-		 * telnetting to port 53 (once per CPU) will
-		 * deny service to legitimate TCP clients.
+		 * The connection, if any, reads requests by itself;
+		 * we go on accepting new ones.
 		 */
-		client->pipelined = false;
-		result = isc_quota_attach(&client->sctx->tcpquota,
-					  &client->tcpquota);
-		if (result == ISC_R_SUCCESS)
-			result = ns_client_replace(client);
-		if (result != ISC_R_SUCCESS) {
-			ns_client_log(client, NS_LOGCATEGORY_CLIENT,
-				      NS_LOGMODULE_CLIENT, ISC_LOG_WARNING,
-				      "no more TCP clients(accept): %s",
-				      isc_result_totext(result));
-		} else if (client->sctx->keepresporder == NULL ||
-			   !dns_acl_allowed(&netaddr, NULL,
-					    client->sctx->keepresporder, env))
-		{
-			client->pipelined = true;
-		}
-
-		client_read(client, true);
+		client->peeraddr_valid = false;
+		client_accept(client);
 	}
 
  freeevent:
+	if (sock != NULL)
+		isc_socket_detach(&sock);
 	isc_event_free(&event);
 }
 
@@ -3322,23 +3775,23 @@ ns_client_shuttingdown(ns_client_t *client) {
 isc_result_t
 ns_client_replace(ns_client_t *client) {
 	isc_result_t result;
-	bool tcp;
 
 	CTRACE("replace");
 
 	REQUIRE(client != NULL);
 	REQUIRE(client->manager != NULL);
 
-	tcp = TCP_CLIENT(client);
-	if (tcp && client->pipelined) {
-		result = get_worker(client->manager, client->interface,
-				    client->tcpsocket);
-	} else {
+	/*
+	 * A TCP client handles a single request handed to it by the
+	 * connection, which goes on reading by itself, so only a UDP
+	 * client needs a replacement.
+	 */
+	if (!TCP_CLIENT(client)) {
 		result = get_client(client->manager, client->interface,
-				    client->dispatch, tcp);
+				    client->dispatch, false);
+		if (result != ISC_R_SUCCESS)
+			return (result);
 	}
-	if (result != ISC_R_SUCCESS)
-		return (result);
 
 	/*
 	 * The responsibility for listening for new requests is hereby
@@ -3361,6 +3814,7 @@ clientmgr_destroy(ns_clientmgr_t *manager) {
 #endif
 
 	REQUIRE(ISC_LIST_EMPTY(manager->clients));
+	REQUIRE(ISC_LIST_EMPTY(manager->tcpconns));
 
 	MTRACE("clientmgr_destroy");
 
@@ -3427,6 +3881,7 @@ ns_clientmgr_create(isc_mem_t *mctx, ns_server_t *sctx, isc_taskmgr_t *taskmgr,
 	ns_server_attach(sctx, &manager->sctx);
 
 	ISC_LIST_INIT(manager->clients);
+	ISC_LIST_INIT(manager->tcpconns);
 	ISC_LIST_INIT(manager->recursing);
 	ISC_QUEUE_INIT(manager->inactive, ilink);
 #if NMCTXS > 0
@@ -3462,6 +3917,7 @@ ns_clientmgr_destroy(ns_clientmgr_t **managerp) {
 	isc_result_t result;
 	ns_clientmgr_t *manager;
 	ns_client_t *client;
+	ns_tcpconn_t *conn;
 	bool need_destroy = false, unlock = false;
 
 	REQUIRE(managerp != NULL);
@@ -3486,7 +3942,15 @@ ns_clientmgr_destroy(ns_clientmgr_t **managerp) {
 	     client = ISC_LIST_NEXT(client, link))
 		isc_task_shutdown(client->task);
 
-	if (ISC_LIST_EMPTY(manager->clients))
+	LOCK(&manager->listlock);
+	for (conn = ISC_LIST_HEAD(manager->tcpconns);
+	     conn != NULL;
+	     conn = ISC_LIST_NEXT(conn, link))
+		tcpconn_close(conn);
+	UNLOCK(&manager->listlock);
+
+	if (ISC_LIST_EMPTY(manager->clients) &&
+	    ISC_LIST_EMPTY(manager->tcpconns))
 		need_destroy = true;
 
 	if (unlock)
@@ -3564,8 +4028,15 @@ get_client(ns_clientmgr_t *manager, ns_interface_t *ifp,
 	return (ISC_R_SUCCESS);
 }
 
+/*%
+ * Get a client to handle the request in 'buffer', read from 'conn'.
+ * On success, the client takes over the buffer, the tcp-clients quota
+ * in '*quotap', if any, and a reference to 'conn' held by the caller.
+ */
 static isc_result_t
-get_worker(ns_clientmgr_t *manager, ns_interface_t *ifp, isc_socket_t *sock) {
+get_worker(ns_clientmgr_t *manager, ns_tcpconn_t *conn, isc_buffer_t *buffer,
+	   isc_quota_t **quotap)
+{
 	isc_result_t result = ISC_R_SUCCESS;
 	isc_event_t *ev;
 	ns_client_t *client;
@@ -3601,28 +4072,28 @@ get_worker(ns_clientmgr_t *manager, ns_interface_t *ifp, isc_socket_t *sock) {
 	}
 
 	client->manager = manager;
-	ns_interface_attach(ifp, &client->interface);
-	client->newstate = client->state = NS_CLIENTSTATE_WORKING;
+	ns_interface_attach(conn->interface, &client->interface);
+	client->state = NS_CLIENTSTATE_READING;
 	INSIST(client->recursionquota == NULL);
 	client->sctx = manager->sctx;
-	client->tcpquota = &client->sctx->tcpquota;
 
-	client->dscp = ifp->dscp;
+	client->dscp = conn->interface->dscp;
 
 	client->attributes |= NS_CLIENTATTR_TCP;
-	client->pipelined = true;
 	client->mortal = true;
 	client->sendcb = NULL;
 
-	isc_socket_attach(ifp->tcpsocket, &client->tcplistener);
-	isc_socket_attach(sock, &client->tcpsocket);
-	isc_socket_setname(client->tcpsocket, "worker-tcp", NULL);
-	(void)isc_socket_getpeername(client->tcpsocket, &client->peeraddr);
+	isc_socket_attach(conn->interface->tcpsocket, &client->tcplistener);
+	isc_socket_attach(conn->socket, &client->tcpsocket);
+	client->peeraddr = conn->peeraddr;
 	client->peeraddr_valid = true;
 
-	INSIST(client->tcpmsg_valid == false);
-	dns_tcpmsg_init(client->mctx, client->tcpsocket, &client->tcpmsg);
-	client->tcpmsg_valid = true;
+	INSIST(client->tcpconn == NULL);
+	client->tcpconn = conn;
+	client->tcpreq = *buffer;
+	INSIST(client->tcpquota == NULL);
+	client->tcpquota = *quotap;
+	*quotap = NULL;
 
 	INSIST(client->nctls == 0);
 	client->nctls++;
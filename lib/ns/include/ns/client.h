@@ -70,7 +70,6 @@
 #include <dns/name.h>
 #include <dns/rdataclass.h>
 #include <dns/rdatatype.h>
-#include <dns/tcpmsg.h>
 #include <dns/types.h>
 
 #include <ns/query.h>
@@ -89,7 +88,6 @@ struct ns_client {
 	int			state;
 	int			newstate;
 	int			naccepts;
-	int			nreads;
 	int			nsends;
 	int			nrecvs;
 	int			nupdates;
@@ -110,8 +108,8 @@ struct ns_client {
 	isc_socket_t *		tcplistener;
 	isc_socket_t *		tcpsocket;
 	unsigned char *		tcpbuf;
-	dns_tcpmsg_t		tcpmsg;
-	bool		tcpmsg_valid;
+	ns_tcpconn_t *		tcpconn;
+	isc_buffer_t		tcpreq;       /*%< TCP request, from tcpconn */
 	isc_timer_t *		timer;
 	isc_timer_t *		delaytimer;
 	bool 		timerset;
@@ -133,9 +131,8 @@ struct ns_client {
 	dns_name_t		signername;   /*%< [T]SIG key name */
 	dns_name_t *		signer;	      /*%< NULL if not valid sig */
 	bool		mortal;	      /*%< Die after handling request */
-	bool		pipelined;   /*%< TCP queries not in sequence */
-	isc_quota_t		*tcpquota;
 	isc_quota_t		*recursionquota;
+	isc_quota_t		*tcpquota;    /*%< For a pipelined request */
 	ns_interface_t		*interface;
 
 	isc_sockaddr_t		peeraddr;
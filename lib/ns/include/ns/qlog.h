@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+#ifndef NS_QLOG_H
+#define NS_QLOG_H 1
+
+/*! \file
+ * \brief
+ * Binary query log.
+ *
+ * Instead of formatting a line of text for every query, the binary query
+ * log appends a record containing the raw query data to a memory-mapped
+ * segment file.  Space for a record is reserved with a single atomic
+ * addition, so concurrent writers do not serialize on a lock; when a
+ * segment is full it is truncated to its used length and rolled like a
+ * log file, and a new segment is started.  named-qlogprint renders
+ * segment files as text.
+ *
+ * A segment file starts with an #NS_QLOG_FILEHDRSIZE byte header:
+ *
+ *\li	8 bytes:	#NS_QLOG_MAGIC
+ *\li	4 bytes:	format version (#NS_QLOG_VERSION)
+ *\li	4 bytes:	header size
+ *
+ * followed by zero padding.  Records follow the header.  Each record is
+ * an #ns_qlogrec_t, then the query name in uncompressed wire format
+ * ('qnamelen' bytes), then the view name ('viewlen' bytes, not NUL
+ * terminated), then zero padding to a multiple of #NS_QLOG_ALIGN bytes.
+ * All integers are in network byte order.  The 'length' field is
+ * written last; a zero length marks the end of the records in a segment.
+ */
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <isc/lang.h>
+#include <isc/log.h>
+#include <isc/types.h>
+
+#include <dns/types.h>
+
+#include <ns/types.h>
+
+#define NS_QLOG_MAGIC		"BINDQLOG"
+#define NS_QLOG_VERSION		1
+#define NS_QLOG_FILEHDRSIZE	64
+#define NS_QLOG_ALIGN		8
+
+/*% Limits on the segment size */
+#define NS_QLOG_MINSIZE		(64U * 1024)
+#define NS_QLOG_MAXSIZE		(1024U * 1024 * 1024)
+
+/*%
+ * Record flags.
+ */
+#define NS_QLOG_RECURSE		0x0001	/*%< RD set ("+") */
+#define NS_QLOG_SIGNED		0x0002	/*%< TSIG/SIG(0) signed ("S") */
+#define NS_QLOG_EDNS		0x0004	/*%< EDNS present ("E") */
+#define NS_QLOG_TCP		0x0008	/*%< received over TCP ("T") */
+#define NS_QLOG_DNSSECOK	0x0010	/*%< DO set ("D") */
+#define NS_QLOG_CHECKINGDISABLED 0x0020	/*%< CD set ("C") */
+#define NS_QLOG_WANTCOOKIE	0x0040	/*%< cookie present ("K") */
+#define NS_QLOG_HAVECOOKIE	0x0080	/*%< valid server cookie ("V") */
+#define NS_QLOG_ECS		0x0100	/*%< EDNS client subnet present */
+
+typedef struct ns_qlogrec {
+	uint32_t	length;		/*%< total record length */
+	uint32_t	seconds;	/*%< time received */
+	uint32_t	nanoseconds;
+	uint16_t	flags;		/*%< NS_QLOG_* */
+	uint16_t	port;		/*%< client port */
+	unsigned char	client[16];	/*%< client address */
+	unsigned char	local[16];	/*%< local address */
+	uint16_t	qtype;
+	uint16_t	qclass;
+	uint8_t		family;		/*%< 4 or 6 */
+	uint8_t		ednsversion;
+	uint8_t		qnamelen;
+	uint8_t		viewlen;
+	uint16_t	id;		/*%< message ID */
+	uint16_t	reserved1;
+	uint32_t	reserved2;
+} ns_qlogrec_t;
+
+ISC_LANG_BEGINDECLS
+
+isc_result_t
+ns_qlog_create(isc_mem_t *mctx, const char *path, size_t segsize,
+	       int versions, isc_log_rollsuffix_t suffix, ns_qlog_t **qlogp);
+/*%<
+ * Create a binary query log writing to segment file 'path'.  Segments
+ * are 'segsize' bytes long; a full segment is rolled as a log file with
+ * 'versions' and 'suffix' would be (see isc_logfile_roll()).  An
+ * existing file at 'path' is rolled rather than overwritten.
+ *
+ * Requires:
+ *\li	'path' is not NULL.
+ *\li	qlogp != NULL && *qlogp == NULL
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_RANGE		'segsize' is too small or too large
+ *\li	Other errors are possible if the first segment cannot be
+ *	created.
+ */
+
+void
+ns_qlog_destroy(ns_qlog_t **qlogp);
+/*%<
+ * Close the current segment, truncating it to the length used, and
+ * destroy the query log.  There must be no concurrent writers.
+ *
+ * Requires:
+ *\li	'*qlogp' is a valid query log.
+ */
+
+bool
+ns_qlog_matches(ns_qlog_t *qlog, const char *path, size_t segsize,
+		int versions, isc_log_rollsuffix_t suffix);
+/*%<
+ * Return true if 'qlog' was created with the given parameters.
+ */
+
+isc_result_t
+ns_qlog_write(ns_qlog_t *qlog, const ns_qlogrec_t *rec,
+	      const dns_name_t *qname, const char *view);
+/*%<
+ * Append a record for a query for 'qname' in 'view' to the query log.
+ * 'rec' holds the fixed-width part of the record in network byte order;
+ * its 'length', 'qnamelen' and 'viewlen' fields are ignored.  View
+ * names longer than 255 characters are truncated.
+ *
+ * Records are dropped if no segment can be opened.
+ *
+ * Returns:
+ *\li	#ISC_R_SUCCESS
+ *\li	#ISC_R_FAILURE		the record was dropped
+ */
+
+uint64_t
+ns_qlog_getdropped(ns_qlog_t *qlog);
+/*%<
+ * Return the number of records dropped because no segment could be
+ * opened.
+ */
+
+ISC_LANG_ENDDECLS
+
+#endif /* NS_QLOG_H */
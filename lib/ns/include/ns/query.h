@@ -19,7 +19,9 @@
 #include <isc/types.h>
 #include <isc/buffer.h>
 #include <isc/netaddr.h>
+#include <isc/time.h>
 
+#include <dns/ecs.h>
 #include <dns/rdataset.h>
 #include <dns/resolver.h>
 #include <dns/rpz.h>
@@ -66,6 +68,7 @@ struct ns_query {
 	isc_mutex_t			fetchlock;
 	dns_fetch_t *			fetch;
 	dns_fetch_t *			prefetch;
+	isc_time_t			fetchstart;
 	dns_rpz_st_t *			rpz_st;
 	isc_bufferlist_t		namebufs;
 	ISC_LIST(ns_dbversion_t)	activeversions;
@@ -77,6 +80,8 @@ struct ns_query {
 	unsigned int			dns64_options;
 	unsigned int			dns64_ttl;
 
+	dns_ecs_t			ecs;	/*%< client subnet for lookups */
+
 	struct {
 		dns_db_t *      	db;
 		dns_zone_t *      	zone;
@@ -115,6 +120,7 @@ struct ns_query {
 #define NS_QUERYATTR_DNS64EXCLUDE	0x8000
 #define NS_QUERYATTR_RRL_CHECKED	0x10000
 #define NS_QUERYATTR_REDIRECT		0x20000
+#define NS_QUERYATTR_CLIENTECS		0x40000
 
 /* query context structure */
 
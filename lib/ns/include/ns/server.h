@@ -102,6 +102,12 @@ struct ns_server {
 	bool			interface_auto;
 	dns_tkeyctx_t *		tkeyctx;
 
+	/*% Rendered outgoing AXFR messages */
+	ns_xfrcache_t *		xfrcache;
+
+	/*% Binary query log, used instead of the text one when set */
+	ns_qlog_t *		qlog;
+
 	/*% Server id for NSID */
 	char *			server_id;
 	ns_hostnamecb_t		gethostname;
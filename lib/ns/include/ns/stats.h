@@ -102,7 +102,10 @@ enum {
 	ns_statscounter_prefetch = 63,
 	ns_statscounter_keytagopt = 64,
 
-	ns_statscounter_max = 65
+	ns_statscounter_logdropped = 65,
+	ns_statscounter_qlogdropped = 66,
+
+	ns_statscounter_max = 67
 };
 
 void
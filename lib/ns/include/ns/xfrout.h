@@ -21,6 +21,17 @@
  * Outgoing zone transfers (AXFR + IXFR).
  */
 
+#include <isc/types.h>
+
+#include <dns/types.h>
+
+#include <ns/types.h>
+
+/*%
+ * Default size limit of the outgoing AXFR cache.
+ */
+#define NS_XFRCACHE_DEFAULTSIZE		(32 * 1024 * 1024)
+
 /***
  *** Functions
  ***/
@@ -28,4 +39,59 @@
 void
 ns_xfr_start(ns_client_t *client, dns_rdatatype_t xfrtype);
 
+isc_result_t
+ns_xfrcache_create(isc_mem_t *mctx, ns_xfrcache_t **cachep);
+/*%<
+ * Create a cache of rendered outgoing AXFR messages.  The first AXFR
+ * of each zone version records the answer sections of the messages
+ * it sends; concurrent and later AXFRs of that version replay them
+ * instead of rendering and compressing the zone again.
+ *
+ * Requires:
+ *\li	'cachep' is not NULL and '*cachep' is NULL.
+ */
+
+void
+ns_xfrcache_setmaxsize(ns_xfrcache_t *cache, size_t maxsize);
+/*%<
+ * Set the maximum amount of memory used by 'cache', evicting least
+ * recently used zone versions if necessary.  Zero disables the cache.
+ *
+ * Requires:
+ *\li	'cache' is valid.
+ */
+
+void
+ns_xfrcache_flush(ns_xfrcache_t *cache);
+/*%<
+ * Remove everything from 'cache'.  Transfers currently replaying a
+ * zone version from it are not affected.
+ *
+ * Requires:
+ *\li	'cache' is valid.
+ */
+
+void
+ns_xfrcache_flushdb(ns_xfrcache_t *cache, dns_db_t *db);
+/*%<
+ * Remove every zone version of 'db' from 'cache', so that the cache
+ * stops holding a reference to a database the zone no longer serves.
+ *
+ * Requires:
+ *\li	'cache' is valid.
+ *\li	'db' is a valid database.
+ */
+
+void
+ns_xfrcache_destroy(ns_xfrcache_t **cachep);
+/*%<
+ * Flush and destroy '*cachep'.
+ *
+ * Requires:
+ *\li	'*cachep' is valid.
+ *
+ * Ensures:
+ *\li	'*cachep' is NULL.
+ */
+
 #endif /* NS_XFROUT_H */
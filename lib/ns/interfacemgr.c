@@ -742,6 +742,7 @@ clearacl(isc_mem_t *mctx, dns_acl_t **aclp) {
 	dns_acl_detach(aclp);
 	dns_acl_attach(newacl, aclp);
 	dns_acl_detach(&newacl);
+	dns_acl_flushcache();
 	return (ISC_R_SUCCESS);
 }
 
@@ -0,0 +1,426 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <isc/file.h>
+#include <isc/magic.h>
+#include <isc/mem.h>
+#include <isc/mutex.h>
+#include <isc/net.h>
+#include <isc/platform.h>
+#include <isc/rwlock.h>
+#include <isc/stdio.h>
+#include <isc/stdtime.h>
+#include <isc/string.h>
+#include <isc/util.h>
+
+#if defined(ISC_PLATFORM_HAVESTDATOMIC)
+#include <stdatomic.h>
+#endif
+
+#include <dns/name.h>
+
+#include <ns/log.h>
+#include <ns/qlog.h>
+
+#ifndef WIN32
+#include <sys/mman.h>
+#else
+#define PROT_READ	0x01
+#define PROT_WRITE	0x02
+#define MAP_SHARED	0x0001
+#define MAP_FAILED	((void *)-1)
+#endif
+
+/*
+ * Writers hold the read side of 'rwlock' while they append to the
+ * current segment; the write side is only taken to switch segments.
+ * Space within a segment is reserved by advancing 'used', atomically
+ * where possible.  Reservations are contiguous, so when a segment
+ * fills up exactly one writer's reservation straddles its end; that
+ * writer records where the records stop in 'end'.
+ */
+#if defined(ISC_PLATFORM_HAVESTDATOMIC) && defined(ATOMIC_INT_LOCK_FREE)
+#define QLOG_ATOMIC 1
+#endif
+
+#define QLOG_MAGIC		ISC_MAGIC('Q', 'L', 'o', 'g')
+#define VALID_QLOG(q)		ISC_MAGIC_VALID(q, QLOG_MAGIC)
+
+/*% Seconds to wait before trying again to open a segment. */
+#define QLOG_RETRY		5
+
+struct ns_qlog {
+	unsigned int		magic;
+	isc_mem_t		*mctx;
+	char			*path;
+	size_t			segsize;
+	int			versions;
+	isc_log_rollsuffix_t	suffix;
+
+	isc_rwlock_t		rwlock;
+	FILE			*fp;		/*%< current segment */
+	unsigned char		*map;
+	unsigned int		generation;
+	uint32_t		end;
+	isc_stdtime_t		retry;
+
+	isc_mutex_t		lock;		/*%< protects 'dropped' */
+	uint64_t		dropped;
+#ifdef QLOG_ATOMIC
+	atomic_uint_fast32_t	used;
+#else
+	uint32_t		used;
+#endif
+};
+
+static inline uint32_t
+reserve(ns_qlog_t *qlog, uint32_t len) {
+#ifdef QLOG_ATOMIC
+	return ((uint32_t)atomic_fetch_add_explicit(&qlog->used, len,
+						    memory_order_relaxed));
+#else
+	uint32_t offset;
+
+	LOCK(&qlog->lock);
+	offset = qlog->used;
+	qlog->used += len;
+	UNLOCK(&qlog->lock);
+	return (offset);
+#endif
+}
+
+static inline uint32_t
+getused(ns_qlog_t *qlog) {
+#ifdef QLOG_ATOMIC
+	return ((uint32_t)atomic_load(&qlog->used));
+#else
+	return (qlog->used);
+#endif
+}
+
+static inline void
+setused(ns_qlog_t *qlog, uint32_t used) {
+#ifdef QLOG_ATOMIC
+	atomic_store(&qlog->used, used);
+#else
+	qlog->used = used;
+#endif
+}
+
+static void
+roll(ns_qlog_t *qlog) {
+	isc_logfile_t file;
+
+	file.stream = NULL;
+	file.name = qlog->path;
+	file.versions = qlog->versions;
+	file.suffix = qlog->suffix;
+	file.maximum_size = 0;
+	file.maximum_reached = false;
+	(void)isc_logfile_roll(&file);
+}
+
+/*
+ * Unmap the current segment and truncate it to the records written.
+ * Called with the write lock held, or with no other references.
+ */
+static void
+closesegment(ns_qlog_t *qlog) {
+	uint32_t used;
+
+	if (qlog->map == NULL)
+		return;
+
+	used = getused(qlog);
+	if (used > qlog->segsize)
+		used = qlog->end;
+
+#ifndef HAVE_MMAP
+	/*
+	 * isc_file_mmap() has simulated the mapping with a private
+	 * buffer; write it out.
+	 */
+	if (isc_stdio_seek(qlog->fp, 0, SEEK_SET) == ISC_R_SUCCESS)
+		(void)isc_stdio_write(qlog->map, 1, used, qlog->fp, NULL);
+	(void)isc_stdio_flush(qlog->fp);
+#endif
+	(void)isc_file_munmap(qlog->map, qlog->segsize);
+	qlog->map = NULL;
+	(void)isc_stdio_close(qlog->fp);
+	qlog->fp = NULL;
+	(void)isc_file_truncate(qlog->path, used);
+}
+
+/*
+ * Create a new segment file of full size and map it.  Called with the
+ * write lock held, or with no other references.
+ */
+static isc_result_t
+opensegment(ns_qlog_t *qlog) {
+	isc_result_t result;
+	unsigned char *base;
+	FILE *fp = NULL;
+	int flags = MAP_SHARED;
+	uint32_t val;
+
+	INSIST(qlog->map == NULL);
+
+	result = isc_stdio_open(qlog->path, "w+", &fp);
+	if (result != ISC_R_SUCCESS)
+		goto failure;
+	result = isc_file_truncate(qlog->path, (isc_offset_t)qlog->segsize);
+	if (result != ISC_R_SUCCESS)
+		goto failure;
+
+#ifdef MAP_FILE
+	flags |= MAP_FILE;
+#endif
+	base = isc_file_mmap(NULL, qlog->segsize, PROT_READ | PROT_WRITE,
+			     flags, fileno(fp), 0);
+	if (base == NULL || base == MAP_FAILED) {
+		result = ISC_R_FAILURE;
+		goto failure;
+	}
+
+	memset(base, 0, NS_QLOG_FILEHDRSIZE);
+	memmove(base, NS_QLOG_MAGIC, 8);
+	val = htonl(NS_QLOG_VERSION);
+	memmove(base + 8, &val, sizeof(val));
+	val = htonl(NS_QLOG_FILEHDRSIZE);
+	memmove(base + 12, &val, sizeof(val));
+
+	qlog->fp = fp;
+	qlog->map = base;
+	qlog->end = 0;
+	qlog->generation++;
+	setused(qlog, NS_QLOG_FILEHDRSIZE);
+	return (ISC_R_SUCCESS);
+
+ failure:
+	if (fp != NULL) {
+		(void)isc_stdio_close(fp);
+		(void)isc_file_remove(qlog->path);
+	}
+	isc_stdtime_get(&qlog->retry);
+	qlog->retry += QLOG_RETRY;
+	isc_log_write(ns_lctx, NS_LOGCATEGORY_QUERIES, NS_LOGMODULE_QUERY,
+		      ISC_LOG_ERROR, "unable to create query log segment "
+		      "'%s': %s", qlog->path, isc_result_totext(result));
+	return (result);
+}
+
+isc_result_t
+ns_qlog_create(isc_mem_t *mctx, const char *path, size_t segsize,
+	       int versions, isc_log_rollsuffix_t suffix, ns_qlog_t **qlogp)
+{
+	isc_result_t result;
+	ns_qlog_t *qlog;
+
+	REQUIRE(path != NULL);
+	REQUIRE(qlogp != NULL && *qlogp == NULL);
+
+	if (segsize < NS_QLOG_MINSIZE || segsize > NS_QLOG_MAXSIZE)
+		return (ISC_R_RANGE);
+
+	qlog = isc_mem_get(mctx, sizeof(*qlog));
+	if (qlog == NULL)
+		return (ISC_R_NOMEMORY);
+
+	qlog->path = isc_mem_strdup(mctx, path);
+	if (qlog->path == NULL) {
+		result = ISC_R_NOMEMORY;
+		goto cleanup_qlog;
+	}
+	result = isc_rwlock_init(&qlog->rwlock, 0, 0);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_path;
+	result = isc_mutex_init(&qlog->lock);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup_rwlock;
+
+	qlog->mctx = NULL;
+	isc_mem_attach(mctx, &qlog->mctx);
+	qlog->segsize = segsize & ~(NS_QLOG_ALIGN - 1);
+	qlog->versions = versions;
+	qlog->suffix = suffix;
+	qlog->fp = NULL;
+	qlog->map = NULL;
+	qlog->generation = 0;
+	qlog->end = 0;
+	qlog->retry = 0;
+	qlog->dropped = 0;
+	setused(qlog, 0);
+	qlog->magic = QLOG_MAGIC;
+
+	if (isc_file_exists(path))
+		roll(qlog);
+	result = opensegment(qlog);
+	if (result != ISC_R_SUCCESS) {
+		ns_qlog_destroy(&qlog);
+		return (result);
+	}
+
+	*qlogp = qlog;
+	return (ISC_R_SUCCESS);
+
+ cleanup_rwlock:
+	isc_rwlock_destroy(&qlog->rwlock);
+ cleanup_path:
+	isc_mem_free(mctx, qlog->path);
+ cleanup_qlog:
+	isc_mem_put(mctx, qlog, sizeof(*qlog));
+	return (result);
+}
+
+void
+ns_qlog_destroy(ns_qlog_t **qlogp) {
+	ns_qlog_t *qlog;
+
+	REQUIRE(qlogp != NULL && VALID_QLOG(*qlogp));
+
+	qlog = *qlogp;
+	*qlogp = NULL;
+
+	closesegment(qlog);
+	qlog->magic = 0;
+	DESTROYLOCK(&qlog->lock);
+	isc_rwlock_destroy(&qlog->rwlock);
+	isc_mem_free(qlog->mctx, qlog->path);
+	isc_mem_putanddetach(&qlog->mctx, qlog, sizeof(*qlog));
+}
+
+bool
+ns_qlog_matches(ns_qlog_t *qlog, const char *path, size_t segsize,
+		int versions, isc_log_rollsuffix_t suffix)
+{
+	REQUIRE(VALID_QLOG(qlog));
+	REQUIRE(path != NULL);
+
+	return (strcmp(qlog->path, path) == 0 &&
+		qlog->segsize == (segsize & ~(NS_QLOG_ALIGN - 1)) &&
+		qlog->versions == versions && qlog->suffix == suffix);
+}
+
+static void
+dropped(ns_qlog_t *qlog) {
+	LOCK(&qlog->lock);
+	qlog->dropped++;
+	UNLOCK(&qlog->lock);
+}
+
+isc_result_t
+ns_qlog_write(ns_qlog_t *qlog, const ns_qlogrec_t *rec,
+	      const dns_name_t *qname, const char *view)
+{
+	isc_region_t r;
+	ns_qlogrec_t hdr;
+	unsigned char *p;
+	size_t viewlen;
+	uint32_t len, nlen, offset;
+	unsigned int generation;
+	isc_stdtime_t now;
+
+	REQUIRE(VALID_QLOG(qlog));
+	REQUIRE(rec != NULL);
+	REQUIRE(dns_name_isabsolute(qname));
+
+	dns_name_toregion(qname, &r);
+	viewlen = strlen(view);
+	if (viewlen > 255)
+		viewlen = 255;
+	len = sizeof(hdr) + r.length + viewlen;
+	len = (len + NS_QLOG_ALIGN - 1) & ~(NS_QLOG_ALIGN - 1);
+
+	hdr = *rec;
+	hdr.length = 0;
+	hdr.qnamelen = r.length;
+	hdr.viewlen = (uint8_t)viewlen;
+
+	for (;;) {
+		RWLOCK(&qlog->rwlock, isc_rwlocktype_read);
+		if (qlog->map == NULL) {
+			isc_stdtime_get(&now);
+			if (now < qlog->retry) {
+				RWUNLOCK(&qlog->rwlock, isc_rwlocktype_read);
+				dropped(qlog);
+				return (ISC_R_FAILURE);
+			}
+		} else {
+			offset = reserve(qlog, len);
+			if (offset + len <= qlog->segsize) {
+				p = qlog->map + offset;
+				memmove(p, &hdr, sizeof(hdr));
+				memmove(p + sizeof(hdr), r.base, r.length);
+				memmove(p + sizeof(hdr) + r.length, view,
+					viewlen);
+				memset(p + sizeof(hdr) + r.length + viewlen, 0,
+				       len - sizeof(hdr) - r.length - viewlen);
+				/*
+				 * The record is complete once its length
+				 * is visible.
+				 */
+#ifdef QLOG_ATOMIC
+				atomic_thread_fence(memory_order_release);
+#endif
+				nlen = htonl(len);
+				memmove(p, &nlen, sizeof(nlen));
+				RWUNLOCK(&qlog->rwlock, isc_rwlocktype_read);
+				return (ISC_R_SUCCESS);
+			}
+			if (offset <= qlog->segsize)
+				qlog->end = offset;
+		}
+		generation = qlog->generation;
+		RWUNLOCK(&qlog->rwlock, isc_rwlocktype_read);
+
+		/*
+		 * The segment is full, or there is none: start a new one
+		 * unless another writer already has.
+		 */
+		RWLOCK(&qlog->rwlock, isc_rwlocktype_write);
+		if (qlog->generation == generation) {
+			isc_stdtime_get(&now);
+			if (qlog->map != NULL) {
+				closesegment(qlog);
+				roll(qlog);
+				(void)opensegment(qlog);
+			} else if (now >= qlog->retry) {
+				(void)opensegment(qlog);
+			}
+			if (qlog->map == NULL) {
+				RWUNLOCK(&qlog->rwlock,
+					 isc_rwlocktype_write);
+				dropped(qlog);
+				return (ISC_R_FAILURE);
+			}
+		}
+		RWUNLOCK(&qlog->rwlock, isc_rwlocktype_write);
+	}
+}
+
+uint64_t
+ns_qlog_getdropped(ns_qlog_t *qlog) {
+	uint64_t count;
+
+	REQUIRE(VALID_QLOG(qlog));
+
+	LOCK(&qlog->lock);
+	count = qlog->dropped;
+	UNLOCK(&qlog->lock);
+	return (count);
+}
@@ -18,6 +18,7 @@
 #include <string.h>
 
 #include <isc/hex.h>
+#include <isc/histo.h>
 #include <isc/mem.h>
 #include <isc/print.h>
 #include <isc/random.h>
@@ -63,6 +64,7 @@
 #include <ns/client.h>
 #include <ns/interfacemgr.h>
 #include <ns/log.h>
+#include <ns/qlog.h>
 #include <ns/server.h>
 #include <ns/sortlist.h>
 #include <ns/stats.h>
@@ -515,6 +517,15 @@ query_send(ns_client_t *client) {
 		counter = ns_statscounter_failure;
 
 	inc_stats(client, counter);
+
+	/*
+	 * If the subnet the client sent was used, tell it the scope
+	 * of the answer.
+	 */
+	if ((client->query.attributes & NS_QUERYATTR_CLIENTECS) != 0) {
+		client->ecs.scope = client->query.ecs.scope;
+	}
+
 	ns_client_send(client);
 }
 
@@ -687,6 +698,7 @@ query_reset(ns_client_t *client, bool everything) {
 				    NS_QUERYATTR_SECURE);
 	client->query.restarts = 0;
 	client->query.timerset = false;
+	dns_ecs_init(&client->query.ecs);
 	if (client->query.rpz_st != NULL) {
 		rpz_st_clear(client);
 		if (everything) {
@@ -944,6 +956,7 @@ ns_query_init(ns_client_t *client) {
 	client->query.dns64_sigaaaa = NULL;
 	client->query.dns64_aaaaok = NULL;
 	client->query.dns64_aaaaoklen = 0;
+	dns_ecs_init(&client->query.ecs);
 	client->query.redirect.db = NULL;
 	client->query.redirect.node = NULL;
 	client->query.redirect.zone = NULL;
@@ -2454,6 +2467,86 @@ prefetch_done(isc_task_t *task, isc_event_t *event) {
 	ns_client_detach(&client);
 }
 
+/*%
+ * Return the client subnet to use for cache lookups and outgoing
+ * queries on behalf of 'client', or NULL if the view does not send
+ * client subnet information to any server.  A subnet supplied by a
+ * client matching the view's accept-client-subnet ACL is used,
+ * shortened to at most /24 for IPv4 and /56 for IPv6; a source prefix
+ * length of zero means the client asked for its address not to be
+ * used.  Otherwise the subnet is derived from the client's address.
+ * The result is kept in client->query.ecs, leaving client->ecs to be
+ * echoed back as sent.
+ */
+static dns_ecs_t *
+query_ecs(ns_client_t *client) {
+	dns_ecs_t *ecs = &client->query.ecs;
+	isc_netaddr_t netaddr;
+	unsigned char *addr;
+	unsigned int bits, i, len;
+
+	if (client->view == NULL || !client->view->sendclientsubnet ||
+	    client->view->ecsservers == NULL)
+	{
+		return (NULL);
+	}
+
+	if (ecs->source != 0) {
+		return (ecs);
+	}
+
+	if (HAVEECS(client) &&
+	    ns_client_checkaclsilent(client, NULL, client->view->ecsclients,
+				     false) == ISC_R_SUCCESS)
+	{
+		if (client->ecs.source == 0) {
+			return (NULL);
+		}
+		netaddr = client->ecs.addr;
+		bits = client->ecs.source;
+		client->query.attributes |= NS_QUERYATTR_CLIENTECS;
+	} else {
+		isc_netaddr_fromsockaddr(&netaddr, &client->peeraddr);
+		if (isc_netaddr_isloopback(&netaddr)) {
+			return (NULL);
+		}
+		bits = 128;
+	}
+
+	switch (netaddr.family) {
+	case AF_INET:
+		bits = ISC_MIN(bits, 24);
+		addr = (unsigned char *)&netaddr.type.in;
+		len = 4;
+		break;
+	case AF_INET6:
+		bits = ISC_MIN(bits, 56);
+		addr = (unsigned char *)&netaddr.type.in6;
+		len = 16;
+		break;
+	default:
+		client->query.attributes &= ~NS_QUERYATTR_CLIENTECS;
+		return (NULL);
+	}
+
+	/*
+	 * Clear the address bits beyond the prefix we pass on.
+	 */
+	for (i = bits / 8; i < len; i++) {
+		if (i == bits / 8 && (bits % 8) != 0) {
+			addr[i] &= (0xff << (8 - bits % 8)) & 0xff;
+		} else {
+			addr[i] = 0;
+		}
+	}
+
+	ecs->addr = netaddr;
+	ecs->source = bits;
+	ecs->scope = 0;
+
+	return (ecs);
+}
+
 static void
 query_prefetch(ns_client_t *client, dns_name_t *qname,
 	       dns_rdataset_t *rdataset)
@@ -2493,6 +2586,7 @@ query_prefetch(ns_client_t *client, dns_name_t *qname,
 	result = dns_resolver_createfetch(client->view->resolver,
 					  qname, rdataset->type, NULL, NULL,
 					  NULL, peeraddr, client->message->id,
+					  query_ecs(client),
 					  options, 0, NULL, client->task,
 					  prefetch_done, client,
 					  tmprdataset, NULL,
@@ -2699,8 +2793,8 @@ query_rpzfetch(ns_client_t *client, dns_name_t *qname, dns_rdatatype_t type) {
 	options = client->query.fetchoptions;
 	result = dns_resolver_createfetch(client->view->resolver, qname, type,
 					  NULL, NULL, NULL, peeraddr,
-					  client->message->id, options, 0,
-					  NULL, client->task, prefetch_done,
+					  client->message->id, NULL, options,
+					  0, NULL, client->task, prefetch_done,
 					  client, tmprdataset, NULL,
 					  &client->query.prefetch);
 	if (result != ISC_R_SUCCESS) {
@@ -3041,6 +3135,40 @@ rpz_find_p(ns_client_t *client, dns_name_t *self_name, dns_rdatatype_t qtype,
 	}
 }
 
+/*
+ * Get the policy zone of a trigger whose policy the summary database
+ * already knows.  Such policies need nothing from the policy zone but its
+ * SOA record, so the apex node stands in for the policy record.
+ */
+static isc_result_t
+rpz_compiled_p(ns_client_t *client, dns_name_t *p_name,
+	       dns_rpz_type_t rpz_type, dns_zone_t **zonep, dns_db_t **dbp,
+	       dns_dbversion_t **versionp, dns_dbnode_t **nodep,
+	       dns_rdataset_t **rdatasetp)
+{
+	isc_result_t result;
+
+	REQUIRE(nodep != NULL);
+
+	CTRACE(ISC_LOG_DEBUG(3), "rpz_compiled_p");
+
+	rpz_clean(zonep, dbp, nodep, rdatasetp);
+	*versionp = NULL;
+	result = rpz_getdb(client, p_name, rpz_type, zonep, dbp, versionp);
+	if (result != ISC_R_SUCCESS)
+		return (DNS_R_NXDOMAIN);
+
+	result = dns_db_getoriginnode(*dbp, nodep);
+	if (result != ISC_R_SUCCESS) {
+		rpz_log_fail(client, DNS_RPZ_ERROR_LEVEL, p_name, rpz_type,
+			     " getoriginnode()", result);
+		CTRACE(ISC_LOG_ERROR,
+		       "rpz_compiled_p: getoriginnode failed");
+		return (DNS_R_SERVFAIL);
+	}
+	return (ISC_R_SUCCESS);
+}
+
 static void
 rpz_save_p(dns_rpz_st_t *st, dns_rpz_zone_t *rpz, dns_rpz_type_t rpz_type,
 	   dns_rpz_policy_t policy, dns_name_t *p_name, dns_rpz_prefix_t prefix,
@@ -3054,6 +3182,7 @@ rpz_save_p(dns_rpz_st_t *st, dns_rpz_zone_t *rpz, dns_rpz_type_t rpz_type,
 	st->m.rpz = rpz;
 	st->m.type = rpz_type;
 	st->m.policy = policy;
+	st->m.compiled = false;
 	dns_name_copy(p_name, st->p_name, NULL);
 	st->m.prefix = prefix;
 	st->m.result = result;
@@ -3673,6 +3802,9 @@ rpz_rewrite_name(ns_client_t *client, dns_name_t *trig_name,
 	dns_dbversion_t *p_version;
 	dns_dbnode_t *p_node;
 	dns_rpz_policy_t policy;
+	dns_rpz_num_t c_num;
+	dns_rpz_policy_t c_policy;
+	dns_ttl_t c_ttl;
 	isc_result_t result;
 
 #ifndef USE_DNSRPS
@@ -3701,8 +3833,11 @@ rpz_rewrite_name(ns_client_t *client, dns_name_t *trig_name,
 	 * with policies for this trigger name. We do this even if there
 	 * is only one eligible policy zone so that wildcard triggers
 	 * are matched correctly, and not into their parent.
+	 * The summary database also knows the policy of some triggers,
+	 * which saves searching the first policy zone with a hit.
 	 */
-	zbits = dns_rpz_find_name(rpzs, rpz_type, zbits, trig_name);
+	zbits = dns_rpz_find_policy(rpzs, rpz_type, zbits, trig_name,
+				    &c_num, &c_policy, &c_ttl);
 	if (zbits == 0)
 		return (ISC_R_SUCCESS);
 
@@ -3744,10 +3879,17 @@ rpz_rewrite_name(ns_client_t *client, dns_name_t *trig_name,
 					trig_name);
 		if (result != ISC_R_SUCCESS)
 			continue;
-		result = rpz_find_p(client, trig_name, qtype, p_name,
-				    rpz, rpz_type,
-				    &p_zone, &p_db, &p_version, &p_node,
-				    rdatasetp, &policy);
+		if (rpz_num == c_num) {
+			result = rpz_compiled_p(client, p_name, rpz_type,
+						&p_zone, &p_db, &p_version,
+						&p_node, rdatasetp);
+			policy = c_policy;
+		} else {
+			result = rpz_find_p(client, trig_name, qtype, p_name,
+					    rpz, rpz_type,
+					    &p_zone, &p_db, &p_version,
+					    &p_node, rdatasetp, &policy);
+		}
 		switch (result) {
 		case DNS_R_NXDOMAIN:
 			/*
@@ -3820,6 +3962,11 @@ rpz_rewrite_name(ns_client_t *client, dns_name_t *trig_name,
 					   policy, p_name, 0, result,
 					   &p_zone, &p_db, &p_node,
 					   rdatasetp, p_version);
+				if (rpz_num == c_num) {
+					st->m.ttl = ISC_MIN(c_ttl,
+							rpz->max_policy_ttl);
+					st->m.compiled = true;
+				}
 				/*
 				 * After a hit, higher numbered policy zones
 				 * are irrelevant
@@ -4657,6 +4804,7 @@ dns64_aaaaok(ns_client_t *client, dns_rdataset_t *rdataset,
 	dns_dns64_t *dns64 = ISC_LIST_HEAD(client->view->dns64);
 	unsigned int flags = 0;
 	unsigned int i, count;
+	bool ok[16];
 	bool *aaaaok;
 
 	INSIST(client->query.dns64_aaaaok == NULL);
@@ -4674,8 +4822,17 @@ dns64_aaaaok(ns_client_t *client, dns_rdataset_t *rdataset,
 	    dns_rdataset_isassociated(sigrdataset))
 		flags |= DNS_DNS64_DNSSEC;
 
+	/*
+	 * Most AAAA RRsets are small; only allocate the result array
+	 * when it doesn't fit on the stack, or when some addresses
+	 * are excluded and it has to be kept for query_filter64().
+	 */
 	count = dns_rdataset_count(rdataset);
-	aaaaok = isc_mem_get(client->mctx, sizeof(bool) * count);
+	if (count <= sizeof(ok) / sizeof(ok[0])) {
+		aaaaok = ok;
+	} else {
+		aaaaok = isc_mem_get(client->mctx, sizeof(bool) * count);
+	}
 
 	isc_netaddr_fromsockaddr(&netaddr, &client->peeraddr);
 	if (dns_dns64_aaaaok(dns64, &netaddr, client->signer,
@@ -4683,17 +4840,26 @@ dns64_aaaaok(ns_client_t *client, dns_rdataset_t *rdataset,
 	{
 		for (i = 0; i < count; i++) {
 			if (aaaaok != NULL && !aaaaok[i]) {
+				if (aaaaok == ok) {
+					aaaaok = isc_mem_get(client->mctx,
+							     sizeof(bool) *
+							     count);
+					if (aaaaok == NULL)
+						break;
+					memmove(aaaaok, ok,
+						sizeof(bool) * count);
+				}
 				SAVE(client->query.dns64_aaaaok, aaaaok);
 				client->query.dns64_aaaaoklen = count;
 				break;
 			}
 		}
-		if (aaaaok != NULL)
+		if (aaaaok != NULL && aaaaok != ok)
 			isc_mem_put(client->mctx, aaaaok,
 				    sizeof(bool) * count);
 		return (true);
 	}
-	if (aaaaok != NULL)
+	if (aaaaok != NULL && aaaaok != ok)
 		isc_mem_put(client->mctx, aaaaok,
 			    sizeof(bool) * count);
 	return (false);
@@ -5442,6 +5608,9 @@ query_lookup(query_ctx_t *qctx) {
 
 	dns_clientinfomethods_init(&cm, ns_client_sourceip);
 	dns_clientinfo_init(&ci, qctx->client, NULL);
+	if (!qctx->is_zone) {
+		dns_clientinfo_setecs(&ci, query_ecs(qctx->client));
+	}
 
 	/*
 	 * We'll need some resources...
@@ -5583,6 +5752,15 @@ fetch_callback(isc_task_t *task, isc_event_t *event) {
 		 * Update client->now.
 		 */
 		isc_stdtime_get(&client->now);
+		if (client->view->latency != NULL) {
+			isc_time_t now;
+
+			TIME_NOW(&now);
+			isc_histo_add(client->view->latency,
+				      dns_latency_recursion,
+				      isc_time_microdiff(&now,
+						&client->query.fetchstart));
+		}
 	} else {
 		/*
 		 * This is a fetch completion event for a canceled fetch.
@@ -5700,6 +5878,7 @@ query_recurse(ns_client_t *client, dns_rdatatype_t qtype, dns_name_t *qname,
 	isc_result_t result;
 	dns_rdataset_t *rdataset, *sigrdataset;
 	isc_sockaddr_t *peeraddr = NULL;
+	dns_ecs_t *ecs;
 
 	CTRACE(ISC_LOG_DEBUG(3), "query_recurse");
 
@@ -5820,11 +5999,15 @@ query_recurse(ns_client_t *client, dns_rdatatype_t qtype, dns_name_t *qname,
 		peeraddr = &client->peeraddr;
 	}
 
+	ecs = query_ecs(client);
+	if (client->view->latency != NULL) {
+		TIME_NOW(&client->query.fetchstart);
+	}
 	result = dns_resolver_createfetch(client->view->resolver,
 					  qname, qtype, qdomain, nameservers,
 					  NULL, peeraddr, client->message->id,
-					  client->query.fetchoptions, 0, NULL,
-					  client->task, fetch_callback,
+					  ecs, client->query.fetchoptions, 0,
+					  NULL, client->task, fetch_callback,
 					  client, rdataset, sigrdataset,
 					  &client->query.fetch);
 	if (result != ISC_R_SUCCESS) {
@@ -5832,6 +6015,12 @@ query_recurse(ns_client_t *client, dns_rdatatype_t qtype, dns_name_t *qname,
 		if (sigrdataset != NULL) {
 			query_putrdataset(client, &sigrdataset);
 		}
+	} else if (ecs != NULL) {
+		/*
+		 * We don't learn the scope of the answer, so tell the
+		 * client it applies to the subnet we sent.
+		 */
+		ecs->scope = ecs->source;
 	}
 
 	/*
@@ -6348,10 +6537,13 @@ query_checkrpz(query_ctx_t *qctx, isc_result_t result) {
 		RESTORE(qctx->zone, qctx->rpz_st->m.zone);
 
 		/*
-		 * Add SOA record to additional section
+		 * Add SOA record to additional section.  A compiled
+		 * policy has no policy record, but the SOA must look
+		 * the same as if the record had been found.
 		 */
 		rresult = query_addsoa(qctx,
-			       dns_rdataset_isassociated(qctx->rdataset),
+			       dns_rdataset_isassociated(qctx->rdataset) ||
+			       qctx->rpz_st->m.compiled,
 			       DNS_SECTION_ADDITIONAL);
 		if (rresult != ISC_R_SUCCESS) {
 			QUERY_ERROR(qctx, result);
@@ -7333,7 +7525,6 @@ query_dns64(query_ctx_t *qctx) {
 	dns_aclenv_t *env = ns_interfacemgr_getaclenv(client->interface->mgr);
 	dns_name_t *name, *mname;
 	dns_rdata_t *dns64_rdata;
-	dns_rdata_t rdata = DNS_RDATA_INIT;
 	dns_rdatalist_t *dns64_rdatalist;
 	dns_rdataset_t *dns64_rdataset;
 	dns_rdataset_t *mrdataset;
@@ -7342,8 +7533,8 @@ query_dns64(query_ctx_t *qctx) {
 	isc_result_t result;
 	dns_view_t *view = client->view;
 	isc_netaddr_t netaddr;
-	dns_dns64_t *dns64;
 	unsigned int flags = 0;
+	unsigned int i, count;
 	const dns_section_t section = DNS_SECTION_ANSWER;
 
 	/*%
@@ -7437,40 +7628,29 @@ query_dns64(query_ctx_t *qctx) {
 	    dns_rdataset_isassociated(qctx->sigrdataset))
 		flags |= DNS_DNS64_DNSSEC;
 
-	for (result = dns_rdataset_first(qctx->rdataset);
-	     result == ISC_R_SUCCESS;
-	     result = dns_rdataset_next(qctx->rdataset)) {
-		for (dns64 = ISC_LIST_HEAD(client->view->dns64);
-		     dns64 != NULL; dns64 = dns_dns64_next(dns64)) {
+	result = dns_dns64_aaaafromrdataset(ISC_LIST_HEAD(view->dns64),
+					    &netaddr, client->signer, env,
+					    flags, qctx->rdataset,
+					    isc_buffer_base(buffer),
+					    isc_buffer_length(buffer), &count);
+	if (result != ISC_R_SUCCESS)
+		goto cleanup;
 
-			dns_rdataset_current(qctx->rdataset, &rdata);
-			isc_buffer_availableregion(buffer, &r);
-			INSIST(r.length >= 16);
-			result = dns_dns64_aaaafroma(dns64, &netaddr,
-						     client->signer, env, flags,
-						     rdata.data, r.base);
-			if (result != ISC_R_SUCCESS) {
-				dns_rdata_reset(&rdata);
-				continue;
-			}
-			isc_buffer_add(buffer, 16);
-			isc_buffer_remainingregion(buffer, &r);
-			isc_buffer_forward(buffer, 16);
-			result = dns_message_gettemprdata(client->message,
-							  &dns64_rdata);
-			if (result != ISC_R_SUCCESS)
-				goto cleanup;
-			dns_rdata_init(dns64_rdata);
-			dns_rdata_fromregion(dns64_rdata, dns_rdataclass_in,
-					     dns_rdatatype_aaaa, &r);
-			ISC_LIST_APPEND(dns64_rdatalist->rdata, dns64_rdata,
-					link);
-			dns64_rdata = NULL;
-			dns_rdata_reset(&rdata);
-		}
+	isc_buffer_add(buffer, count * 16);
+	for (i = 0; i < count; i++) {
+		result = dns_message_gettemprdata(client->message,
+						  &dns64_rdata);
+		if (result != ISC_R_SUCCESS)
+			goto cleanup;
+		isc_buffer_remainingregion(buffer, &r);
+		r.length = 16;
+		isc_buffer_forward(buffer, 16);
+		dns_rdata_init(dns64_rdata);
+		dns_rdata_fromregion(dns64_rdata, dns_rdataclass_in,
+				     dns_rdatatype_aaaa, &r);
+		ISC_LIST_APPEND(dns64_rdatalist->rdata, dns64_rdata, link);
+		dns64_rdata = NULL;
 	}
-	if (result != ISC_R_NOMORE)
-		goto cleanup;
 
 	if (ISC_LIST_EMPTY(dns64_rdatalist->rdata))
 		goto cleanup;
@@ -10796,6 +10976,73 @@ log_tat(ns_client_t *client) {
 	}
 }
 
+/*
+ * Append a record for the query to the binary query log.  This carries
+ * the same information as the text log message, but nothing is
+ * formatted.
+ */
+static void
+log_query_binary(ns_client_t *client, unsigned int flags,
+		 unsigned int extflags)
+{
+	ns_qlogrec_t rec;
+	dns_rdataset_t *rdataset;
+	isc_netaddr_t netaddr;
+	isc_result_t result;
+	uint16_t qflags = 0;
+
+	rdataset = ISC_LIST_HEAD(client->query.qname->list);
+	INSIST(rdataset != NULL);
+
+	memset(&rec, 0, sizeof(rec));
+	rec.seconds = htonl(isc_time_seconds(&client->requesttime));
+	rec.nanoseconds = htonl(isc_time_nanoseconds(&client->requesttime));
+	rec.port = htons(isc_sockaddr_getport(&client->peeraddr));
+	isc_netaddr_fromsockaddr(&netaddr, &client->peeraddr);
+	if (netaddr.family == AF_INET6) {
+		rec.family = 6;
+		memmove(rec.client, &netaddr.type.in6, 16);
+	} else {
+		rec.family = 4;
+		memmove(rec.client, &netaddr.type.in, 4);
+	}
+	if (client->destaddr.family == AF_INET6)
+		memmove(rec.local, &client->destaddr.type.in6, 16);
+	else if (client->destaddr.family == AF_INET)
+		memmove(rec.local, &client->destaddr.type.in, 4);
+	rec.qtype = htons(rdataset->type);
+	rec.qclass = htons(rdataset->rdclass);
+	rec.id = htons(client->message->id);
+
+	if (WANTRECURSION(client))
+		qflags |= NS_QLOG_RECURSE;
+	if (client->signer != NULL)
+		qflags |= NS_QLOG_SIGNED;
+	if (client->ednsversion >= 0) {
+		qflags |= NS_QLOG_EDNS;
+		rec.ednsversion = (uint8_t)client->ednsversion;
+	}
+	if (TCP(client))
+		qflags |= NS_QLOG_TCP;
+	if ((extflags & DNS_MESSAGEEXTFLAG_DO) != 0)
+		qflags |= NS_QLOG_DNSSECOK;
+	if ((flags & DNS_MESSAGEFLAG_CD) != 0)
+		qflags |= NS_QLOG_CHECKINGDISABLED;
+	if (HAVECOOKIE(client))
+		qflags |= NS_QLOG_HAVECOOKIE;
+	else if (WANTCOOKIE(client))
+		qflags |= NS_QLOG_WANTCOOKIE;
+	if (HAVEECS(client))
+		qflags |= NS_QLOG_ECS;
+	rec.flags = htons(qflags);
+
+	result = ns_qlog_write(client->sctx->qlog, &rec, client->query.qname,
+			       client->view != NULL ? client->view->name : "");
+	if (result != ISC_R_SUCCESS)
+		ns_stats_increment(client->sctx->nsstats,
+				   ns_statscounter_qlogdropped);
+}
+
 static inline void
 log_query(ns_client_t *client, unsigned int flags, unsigned int extflags) {
 	char namebuf[DNS_NAME_FORMATSIZE];
@@ -10807,6 +11054,11 @@ log_query(ns_client_t *client, unsigned int flags, unsigned int extflags) {
 	dns_rdataset_t *rdataset;
 	int level = ISC_LOG_INFO;
 
+	if (client->sctx->qlog != NULL) {
+		log_query_binary(client, flags, extflags);
+		return;
+	}
+
 	if (! isc_log_wouldlog(ns_lctx, level))
 		return;
 
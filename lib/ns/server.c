@@ -22,8 +22,10 @@
 #include <dns/tkey.h>
 #include <dns/stats.h>
 
+#include <ns/qlog.h>
 #include <ns/server.h>
 #include <ns/stats.h>
+#include <ns/xfrout.h>
 
 #define SCTX_MAGIC		ISC_MAGIC('S','c','t','x')
 #define SCTX_VALID(s)		ISC_MAGIC_VALID(s, SCTX_MAGIC)
@@ -60,6 +62,8 @@ ns_server_create(isc_mem_t *mctx, ns_matchview_t matchingview,
 
 	CHECKFATAL(dns_tkeyctx_create(mctx, &sctx->tkeyctx));
 
+	CHECKFATAL(ns_xfrcache_create(mctx, &sctx->xfrcache));
+
 	CHECKFATAL(ns_stats_create(mctx, ns_statscounter_max, &sctx->nsstats));
 
 	CHECKFATAL(dns_rdatatypestats_create(mctx, &sctx->rcvquerystats));
@@ -163,6 +167,10 @@ ns_server_detach(ns_server_t **sctxp) {
 			dns_acl_detach(&sctx->keepresporder);
 		if (sctx->tkeyctx != NULL)
 			dns_tkeyctx_destroy(&sctx->tkeyctx);
+		if (sctx->xfrcache != NULL)
+			ns_xfrcache_destroy(&sctx->xfrcache);
+		if (sctx->qlog != NULL)
+			ns_qlog_destroy(&sctx->qlog);
 
 		if (sctx->nsstats != NULL)
 			ns_stats_detach(&sctx->nsstats);
@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <isc/file.h>
+#include <isc/net.h>
+#include <isc/print.h>
+#include <isc/thread.h>
+#include <isc/util.h>
+
+#include <dns/name.h>
+
+#include <ns/qlog.h>
+
+#include "nstest.h"
+
+#define QLOGFILE	"qlog_test.out"
+#define NTHREADS	4
+#define NRECORDS	5000
+
+static ns_qlog_t *qlog = NULL;
+
+static void
+removefiles(void) {
+	char name[64];
+	int i;
+
+	(void)isc_file_remove(QLOGFILE);
+	for (i = 0; i < 1000; i++) {
+		snprintf(name, sizeof(name), "%s.%d", QLOGFILE, i);
+		if (isc_file_remove(name) != ISC_R_SUCCESS)
+			break;
+	}
+}
+
+static isc_threadresult_t
+writer(isc_threadarg_t arg) {
+	unsigned int id = *(unsigned int *)arg;
+	ns_qlogrec_t rec;
+	unsigned int i;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.family = 4;
+	rec.port = htons(id);
+	rec.qtype = htons(1);
+	rec.qclass = htons(1);
+	for (i = 0; i < NRECORDS; i++) {
+		rec.id = htons(i);
+		(void)ns_qlog_write(qlog, &rec, dns_rootname, "_default");
+	}
+
+	return ((isc_threadresult_t)0);
+}
+
+/*
+ * Read back a segment file, checking that each thread's records are
+ * in order.  Returns the number of records, or -1 if the file is bad.
+ */
+static int
+readfile(const char *filename, unsigned int *next) {
+	unsigned char header[NS_QLOG_FILEHDRSIZE];
+	unsigned char data[256];
+	ns_qlogrec_t rec;
+	unsigned int port, id;
+	uint32_t length;
+	int count = 0;
+	FILE *fp;
+
+	fp = fopen(filename, "rb");
+	if (fp == NULL)
+		return (-1);
+	if (fread(header, sizeof(header), 1, fp) != 1 ||
+	    memcmp(header, NS_QLOG_MAGIC, 8) != 0)
+	{
+		fclose(fp);
+		return (-1);
+	}
+	while (fread(&rec, sizeof(rec), 1, fp) == 1) {
+		length = ntohl(rec.length);
+		if (length == 0)
+			break;
+		if (length != 80 || rec.qnamelen != 1 || rec.viewlen != 8 ||
+		    fread(data, length - sizeof(rec), 1, fp) != 1 ||
+		    data[0] != 0 || memcmp(data + 1, "_default", 8) != 0)
+		{
+			fclose(fp);
+			return (-1);
+		}
+		port = ntohs(rec.port);
+		id = ntohs(rec.id);
+		if (port >= NTHREADS || id < next[port]) {
+			fclose(fp);
+			return (-1);
+		}
+		next[port] = id + 1;
+		count++;
+	}
+	fclose(fp);
+	return (count);
+}
+
+ATF_TC(write);
+ATF_TC_HEAD(write, tc) {
+	atf_tc_set_md_var(tc, "descr", "concurrent writers fill and roll "
+				       "segments without losing records");
+}
+ATF_TC_BODY(write, tc) {
+	isc_thread_t threads[NTHREADS];
+	unsigned int ids[NTHREADS];
+	unsigned int next[NTHREADS];
+	isc_result_t result;
+	char name[64];
+	int i, n, total, segments;
+
+	UNUSED(tc);
+
+	result = ns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	removefiles();
+
+	result = ns_qlog_create(mctx, QLOGFILE, NS_QLOG_MINSIZE,
+				ISC_LOG_ROLLINFINITE,
+				isc_log_rollsuffix_increment, &qlog);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_CHECK(ns_qlog_matches(qlog, QLOGFILE, NS_QLOG_MINSIZE,
+				  ISC_LOG_ROLLINFINITE,
+				  isc_log_rollsuffix_increment));
+	ATF_CHECK(!ns_qlog_matches(qlog, QLOGFILE, 2 * NS_QLOG_MINSIZE,
+				   ISC_LOG_ROLLINFINITE,
+				   isc_log_rollsuffix_increment));
+
+	for (i = 0; i < NTHREADS; i++) {
+		ids[i] = i;
+		result = isc_thread_create(writer, &ids[i], &threads[i]);
+		ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	}
+	for (i = 0; i < NTHREADS; i++)
+		isc_thread_join(threads[i], NULL);
+
+	ATF_CHECK_EQ(ns_qlog_getdropped(qlog), 0);
+	ns_qlog_destroy(&qlog);
+
+	/*
+	 * The oldest segment has the highest number.
+	 */
+	memset(next, 0, sizeof(next));
+	total = 0;
+	for (segments = 0; segments < 1000; segments++) {
+		snprintf(name, sizeof(name), "%s.%d", QLOGFILE, segments);
+		if (!isc_file_exists(name))
+			break;
+	}
+	ATF_CHECK(segments > 1);
+	for (i = segments - 1; i >= 0; i--) {
+		snprintf(name, sizeof(name), "%s.%d", QLOGFILE, i);
+		n = readfile(name, next);
+		ATF_CHECK(n > 0);
+		total += n;
+	}
+	n = readfile(QLOGFILE, next);
+	ATF_CHECK(n >= 0);
+	total += n;
+	ATF_CHECK_EQ(total, NTHREADS * NRECORDS);
+
+	removefiles();
+	ns_test_end();
+}
+
+ATF_TC(size);
+ATF_TC_HEAD(size, tc) {
+	atf_tc_set_md_var(tc, "descr", "segment sizes out of range are "
+				       "rejected");
+}
+ATF_TC_BODY(size, tc) {
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	result = ns_test_begin(NULL, false);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = ns_qlog_create(mctx, QLOGFILE, NS_QLOG_MINSIZE - 1,
+				ISC_LOG_ROLLINFINITE,
+				isc_log_rollsuffix_increment, &qlog);
+	ATF_CHECK_EQ(result, ISC_R_RANGE);
+	result = ns_qlog_create(mctx, QLOGFILE, NS_QLOG_MAXSIZE + 1,
+				ISC_LOG_ROLLINFINITE,
+				isc_log_rollsuffix_increment, &qlog);
+	ATF_CHECK_EQ(result, ISC_R_RANGE);
+	ATF_CHECK(qlog == NULL);
+
+	ns_test_end();
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, write);
+	ATF_TP_ADD_TC(tp, size);
+	return (atf_no_error());
+}
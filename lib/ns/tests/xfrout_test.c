@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) Internet Systems Consortium, Inc. ("ISC")
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * See the COPYRIGHT file distributed with this work for additional
+ * information regarding copyright ownership.
+ */
+
+/*! \file */
+
+#include <config.h>
+
+#include <atf-c.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <isc/buffer.h>
+#include <isc/util.h>
+
+#include <dns/db.h>
+#include <dns/message.h>
+#include <dns/view.h>
+#include <dns/zone.h>
+
+#include <ns/client.h>
+#include <ns/xfrout.h>
+
+#include "nstest.h"
+
+/*
+ * The AXFR message spools are internal to xfrout.c, so build it into
+ * the test.  It has its own CHECK() with a different label.
+ */
+#undef CHECK
+#include "../xfrout.c"
+
+#define TEST_ZONE	"example.com"
+#define TEST_ZONEFILE	"testdata/notify/zone1.db"
+
+static unsigned char txmem[65535];
+
+/*
+ * Set up 'xfr' as an AXFR of 'db' by 'client', far enough for the
+ * spool functions.
+ */
+static void
+xfr_init(xfrout_ctx_t *xfr, ns_client_t *client, dns_zone_t *zone,
+	 dns_db_t *db)
+{
+	memset(xfr, 0, sizeof(*xfr));
+	xfr->mctx = mctx;
+	xfr->client = client;
+	xfr->qname = dns_zone_getorigin(zone);
+	xfr->qtype = dns_rdatatype_axfr;
+	xfr->qclass = dns_rdataclass_in;
+	xfr->zone = zone;
+	xfr->db = db;
+	xfr->mnemonic = "AXFR";
+	isc_buffer_init(&xfr->txbuf, txmem, sizeof(txmem));
+}
+
+/*
+ * Return the number of spools held by the server's transfer cache.
+ */
+static unsigned int
+cached_spools(void) {
+	ns_xfrcache_t *cache = sctx->xfrcache;
+	xfrspool_t *spool;
+	unsigned int n = 0;
+
+	LOCK(&cache->lock);
+	for (spool = ISC_LIST_HEAD(cache->spools);
+	     spool != NULL;
+	     spool = ISC_LIST_NEXT(spool, link))
+	{
+		n++;
+	}
+	UNLOCK(&cache->lock);
+
+	return (n);
+}
+
+ATF_TC(xfrcache);
+ATF_TC_HEAD(xfrcache, tc) {
+	atf_tc_set_md_var(tc, "descr",
+			  "AXFR message spools are replayed for the same "
+			  "zone version and dropped when it changes");
+}
+ATF_TC_BODY(xfrcache, tc) {
+	unsigned char wire1[] = "first message answer section";
+	unsigned char wire2[] = "second";
+	isc_region_t r1 = { wire1, sizeof(wire1) };
+	isc_region_t r2 = { wire2, sizeof(wire2) };
+	ns_client_t *client = NULL;
+	dns_fixedname_t fname;
+	dns_name_t *name;
+	dns_zone_t *zone = NULL;
+	dns_db_t *db = NULL, *newdb = NULL;
+	dns_message_t *msg = NULL;
+	xfrout_ctx_t xfr;
+	xfrspool_t *spool;
+	xfrspoolmsg_t *m;
+	uint32_t serial;
+	bool last;
+	isc_result_t result;
+
+	UNUSED(tc);
+
+	result = ns_test_begin(NULL, true);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = ns_test_getclient(NULL, false, &client);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = ns_test_makeview("view", false, &client->view);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = ns_test_serve_zone(TEST_ZONE, TEST_ZONEFILE, client->view);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	name = dns_fixedname_initname(&fname);
+	result = dns_name_fromstring(name, TEST_ZONE, 0, NULL);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_view_findzone(client->view, name, &zone);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_zone_getdb(zone, &db);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	result = dns_db_getsoaserial(db, NULL, &serial);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	result = dns_message_create(mctx, DNS_MESSAGE_INTENTRENDER, &msg);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+
+	/*
+	 * The first transfer of a version records a spool.
+	 */
+	xfr_init(&xfr, client, zone, db);
+	spool_attach(&xfr, serial);
+	ATF_REQUIRE(xfr.spool != NULL);
+	ATF_REQUIRE(xfr.spoolrecord);
+	spool = xfr.spool;
+	spool_record(&xfr, &r1, 3, false);
+	ATF_CHECK(xfr.spool == spool);
+	spool_record(&xfr, &r2, 1, true);
+	ATF_CHECK(xfr.spool == NULL);
+	ATF_CHECK_EQ(cached_spools(), 1);
+
+	/*
+	 * A later transfer of the same version replays it, message
+	 * by message.
+	 */
+	xfr_init(&xfr, client, zone, db);
+	spool_attach(&xfr, serial);
+	ATF_REQUIRE(xfr.spool == spool);
+	ATF_CHECK(!xfr.spoolrecord);
+
+	result = spool_next(&xfr, msg, &m, &last);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_REQUIRE(m != NULL);
+	ATF_CHECK(!last);
+	ATF_CHECK_EQ(m->count, 3);
+	ATF_CHECK_EQ(m->length, r1.length);
+	ATF_CHECK(memcmp(m + 1, r1.base, r1.length) == 0);
+	xfr.nmsg++;
+
+	result = spool_next(&xfr, msg, &m, &last);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	ATF_REQUIRE(m != NULL);
+	ATF_CHECK(last);
+	ATF_CHECK_EQ(m->count, 1);
+	ATF_CHECK(memcmp(m + 1, r2.base, r2.length) == 0);
+	ATF_CHECK_EQ(xfr.spoolrrs, 4);
+	spool_detach(&xfr);
+	ATF_CHECK_EQ(cached_spools(), 1);
+
+	/*
+	 * Once the serial changes the spool is of no more use: the
+	 * next transfer drops it and records a new one.
+	 */
+	xfr_init(&xfr, client, zone, db);
+	spool_attach(&xfr, serial + 1);
+	ATF_REQUIRE(xfr.spool != NULL);
+	ATF_CHECK(xfr.spoolrecord);
+	ATF_CHECK_EQ(xfr.spool->serial, serial + 1);
+	ATF_CHECK(ISC_LIST_EMPTY(xfr.spool->msgs));
+	ATF_CHECK_EQ(cached_spools(), 1);
+	spool_record(&xfr, &r1, 3, true);
+	ATF_CHECK_EQ(cached_spools(), 1);
+
+	/*
+	 * So is a spool of a database that has since been reloaded,
+	 * even with the same serial.
+	 */
+	result = ns_test_loaddb(&newdb, dns_dbtype_zone, TEST_ZONE,
+				TEST_ZONEFILE);
+	ATF_REQUIRE_EQ(result, ISC_R_SUCCESS);
+	xfr_init(&xfr, client, zone, newdb);
+	spool_attach(&xfr, serial + 1);
+	ATF_REQUIRE(xfr.spool != NULL);
+	ATF_CHECK(xfr.spoolrecord);
+	ATF_CHECK(xfr.spool->db == newdb);
+	ATF_CHECK_EQ(cached_spools(), 1);
+
+	/*
+	 * A recording that does not finish is not kept.
+	 */
+	spool_detach(&xfr);
+	ATF_CHECK_EQ(cached_spools(), 0);
+	ATF_CHECK_EQ(sctx->xfrcache->size, 0);
+
+	dns_message_destroy(&msg);
+	dns_db_detach(&newdb);
+	dns_db_detach(&db);
+	dns_zone_detach(&zone);
+	ns_test_cleanup_zone();
+	ns_client_detach(&client);
+	ns_test_end();
+}
+
+/*
+ * Main
+ */
+ATF_TP_ADD_TCS(tp) {
+	ATF_TP_ADD_TC(tp, xfrcache);
+	return (atf_no_error());
+}
@@ -3209,12 +3209,24 @@ update_action(isc_task_t *task, isc_event_t *event) {
 
 		journalfile = dns_zone_getjournal(zone);
 		if (journalfile != NULL) {
+			unsigned int mode = DNS_JOURNAL_CREATE;
+			bool defersync;
+
 			update_log(client, zone, LOGLEVEL_DEBUG,
 				   "writing journal %s", journalfile);
 
+			/*
+			 * With a journal sync delay configured, leave
+			 * the fsync to the zone so that it covers every
+			 * update committed within the delay.
+			 */
+			defersync = (dns_zone_getjournalsyncdelay(zone) != 0);
+			if (defersync)
+				mode |= DNS_JOURNAL_DEFERSYNC;
+
 			journal = NULL;
 			result = dns_journal_open(mctx, journalfile,
-						  DNS_JOURNAL_CREATE, &journal);
+						  mode, &journal);
 			if (result != ISC_R_SUCCESS)
 				FAILS(result, "journal open failed");
 
@@ -3225,6 +3237,8 @@ update_action(isc_task_t *task, isc_event_t *event) {
 			}
 
 			dns_journal_destroy(&journal);
+			if (defersync)
+				dns_zone_journaldeferred(zone);
 		}
 
 		/*
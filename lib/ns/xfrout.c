@@ -16,9 +16,11 @@
 
 #include <isc/formatcheck.h>
 #include <isc/mem.h>
+#include <isc/mutex.h>
 #include <isc/timer.h>
 #include <isc/print.h>
 #include <isc/stats.h>
+#include <isc/string.h>
 #include <isc/util.h>
 
 #include <dns/db.h>
@@ -644,6 +646,66 @@ static rrstream_methods_t compound_rrstream_methods = {
 	compound_rrstream_destroy
 };
 
+/**************************************************************************/
+/*
+ * AXFR message spools.
+ *
+ * When a zone changes, many slaves tend to transfer the new version at
+ * about the same time, and rendering and compressing every message of
+ * every transfer is most of the work a master does for them.  The first
+ * AXFR of a zone version therefore records the answer section of each
+ * TCP message it sends in a spool held by the server's transfer cache;
+ * concurrent and later AXFRs of the same version replay the spool,
+ * rendering only the header, question, OPT and TSIG records themselves
+ * (so the message ID, EDNS options and TSIG are still per transfer).
+ *
+ * A spool is keyed by zone, database and SOA serial, and also by the
+ * exact question name and the message size limit, since they determine
+ * message boundaries and compression pointers in the recorded data may
+ * refer to the question.  A replaying transfer still has its own RR
+ * stream: if it catches up with a spool that is still being recorded,
+ * or was abandoned, it skips the stream past the RRs already replayed
+ * and continues rendering by itself.
+ */
+
+#define XFRCACHE_MAGIC		ISC_MAGIC('X', 'f', 'r', 'C')
+#define XFRCACHE_VALID(c)	ISC_MAGIC_VALID(c, XFRCACHE_MAGIC)
+
+typedef struct xfrspool xfrspool_t;
+typedef struct xfrspoolmsg xfrspoolmsg_t;
+
+struct xfrspoolmsg {
+	ISC_LINK(xfrspoolmsg_t)	link;
+	unsigned int		count;		/* Number of RRs */
+	unsigned int		length;		/* Length of wire data */
+	/* Answer section wire data follows. */
+};
+
+struct xfrspool {
+	ns_xfrcache_t		*cache;
+	unsigned int		references;	/* Locked by cache->lock */
+	ISC_LINK(xfrspool_t)	link;
+	bool		linked;		/* On cache->spools */
+	bool		complete;	/* All messages recorded */
+	dns_zone_t		*zone;		/* Not attached; key only */
+	dns_db_t		*db;
+	uint32_t		serial;
+	uint16_t		msgsize;
+	dns_fixedname_t		fqname;
+	dns_name_t		*qname;
+	size_t			size;
+	ISC_LIST(xfrspoolmsg_t)	msgs;
+};
+
+struct ns_xfrcache {
+	unsigned int		magic;
+	isc_mem_t		*mctx;
+	isc_mutex_t		lock;
+	size_t			size;		/* Total size of linked spools */
+	size_t			maxsize;
+	ISC_LIST(xfrspool_t)	spools;		/* Most recently used first */
+};
+
 /**************************************************************************/
 /*
  * An 'xfrout_ctx_t' contains the state of an outgoing AXFR or IXFR
@@ -677,6 +739,10 @@ typedef struct {
 	int			sends;		/* Send in progress */
 	bool		shuttingdown;
 	const char		*mnemonic;	/* Style of transfer */
+	xfrspool_t		*spool;		/* AXFR message spool */
+	xfrspoolmsg_t		*spoolpos;	/* Last message replayed */
+	bool		spoolrecord;	/* We are recording 'spool' */
+	unsigned int		spoolrrs;	/* RRs replayed from 'spool' */
 } xfrout_ctx_t;
 
 static isc_result_t
@@ -721,6 +787,366 @@ xfrout_log(xfrout_ctx_t *xfr, int level, const char *fmt, ...)
 
 /**************************************************************************/
 
+isc_result_t
+ns_xfrcache_create(isc_mem_t *mctx, ns_xfrcache_t **cachep) {
+	ns_xfrcache_t *cache;
+	isc_result_t result;
+
+	REQUIRE(cachep != NULL && *cachep == NULL);
+
+	cache = isc_mem_get(mctx, sizeof(*cache));
+	if (cache == NULL)
+		return (ISC_R_NOMEMORY);
+
+	result = isc_mutex_init(&cache->lock);
+	if (result != ISC_R_SUCCESS) {
+		isc_mem_put(mctx, cache, sizeof(*cache));
+		return (result);
+	}
+
+	cache->mctx = NULL;
+	isc_mem_attach(mctx, &cache->mctx);
+	cache->size = 0;
+	cache->maxsize = NS_XFRCACHE_DEFAULTSIZE;
+	ISC_LIST_INIT(cache->spools);
+	cache->magic = XFRCACHE_MAGIC;
+
+	*cachep = cache;
+	return (ISC_R_SUCCESS);
+}
+
+static void
+spool_free(xfrspool_t *spool) {
+	isc_mem_t *mctx = spool->cache->mctx;
+	xfrspoolmsg_t *m;
+
+	INSIST(spool->references == 0);
+	INSIST(!spool->linked);
+
+	while ((m = ISC_LIST_HEAD(spool->msgs)) != NULL) {
+		ISC_LIST_UNLINK(spool->msgs, m, link);
+		isc_mem_put(mctx, m, sizeof(*m) + m->length);
+	}
+	dns_db_detach(&spool->db);
+	isc_mem_put(mctx, spool, sizeof(*spool));
+}
+
+/*
+ * Remove 'spool' from the cache and drop the cache's reference to it.
+ * Transfers still replaying it keep it alive.  The cache must be locked.
+ */
+static void
+spool_unlink(ns_xfrcache_t *cache, xfrspool_t *spool) {
+	if (!spool->linked)
+		return;
+
+	ISC_LIST_UNLINK(cache->spools, spool, link);
+	spool->linked = false;
+	INSIST(cache->size >= spool->size);
+	cache->size -= spool->size;
+
+	INSIST(spool->references > 0);
+	if (--spool->references == 0)
+		spool_free(spool);
+}
+
+/*
+ * Evict least recently used spools other than 'keep' until the cache
+ * fits in its size limit.  The cache must be locked.
+ */
+static void
+cache_trim(ns_xfrcache_t *cache, xfrspool_t *keep) {
+	xfrspool_t *spool, *prev;
+
+	for (spool = ISC_LIST_TAIL(cache->spools);
+	     spool != NULL && cache->size > cache->maxsize;
+	     spool = prev)
+	{
+		prev = ISC_LIST_PREV(spool, link);
+		if (spool != keep)
+			spool_unlink(cache, spool);
+	}
+}
+
+void
+ns_xfrcache_setmaxsize(ns_xfrcache_t *cache, size_t maxsize) {
+	REQUIRE(XFRCACHE_VALID(cache));
+
+	LOCK(&cache->lock);
+	cache->maxsize = maxsize;
+	cache_trim(cache, NULL);
+	UNLOCK(&cache->lock);
+}
+
+void
+ns_xfrcache_flush(ns_xfrcache_t *cache) {
+	xfrspool_t *spool;
+
+	REQUIRE(XFRCACHE_VALID(cache));
+
+	LOCK(&cache->lock);
+	while ((spool = ISC_LIST_HEAD(cache->spools)) != NULL)
+		spool_unlink(cache, spool);
+	UNLOCK(&cache->lock);
+}
+
+void
+ns_xfrcache_flushdb(ns_xfrcache_t *cache, dns_db_t *db) {
+	xfrspool_t *spool, *next;
+
+	REQUIRE(XFRCACHE_VALID(cache));
+	REQUIRE(DNS_DB_VALID(db));
+
+	LOCK(&cache->lock);
+	for (spool = ISC_LIST_HEAD(cache->spools);
+	     spool != NULL;
+	     spool = next)
+	{
+		next = ISC_LIST_NEXT(spool, link);
+		if (spool->db == db)
+			spool_unlink(cache, spool);
+	}
+	UNLOCK(&cache->lock);
+}
+
+void
+ns_xfrcache_destroy(ns_xfrcache_t **cachep) {
+	ns_xfrcache_t *cache;
+
+	REQUIRE(cachep != NULL && XFRCACHE_VALID(*cachep));
+
+	cache = *cachep;
+	*cachep = NULL;
+
+	/*
+	 * Transfers hold a reference to the server context, so none
+	 * can be using a spool at this point.
+	 */
+	ns_xfrcache_flush(cache);
+	INSIST(cache->size == 0);
+
+	cache->magic = 0;
+	DESTROYLOCK(&cache->lock);
+	isc_mem_putanddetach(&cache->mctx, cache, sizeof(*cache));
+}
+
+/*
+ * Find a spool that 'xfr' can replay, or start recording a new one.
+ * Spools for other versions of the same zone are no longer useful
+ * and are dropped.  Failure to set up a spool is not an error; the
+ * transfer simply renders all of its messages itself.
+ */
+static void
+spool_attach(xfrout_ctx_t *xfr, uint32_t serial) {
+	ns_xfrcache_t *cache = xfr->client->sctx->xfrcache;
+	uint16_t msgsize = xfr->client->sctx->transfer_tcp_message_size;
+	xfrspool_t *spool, *next, *found = NULL;
+
+	REQUIRE(xfr->spool == NULL);
+
+	if (cache == NULL)
+		return;
+
+	LOCK(&cache->lock);
+	if (cache->maxsize == 0)
+		goto unlock;
+
+	for (spool = ISC_LIST_HEAD(cache->spools);
+	     spool != NULL;
+	     spool = next)
+	{
+		next = ISC_LIST_NEXT(spool, link);
+		if (spool->zone != xfr->zone)
+			continue;
+		if (spool->db != xfr->db || spool->serial != serial) {
+			spool_unlink(cache, spool);
+			continue;
+		}
+		if (spool->msgsize == msgsize &&
+		    dns_name_caseequal(spool->qname, xfr->qname))
+		{
+			found = spool;
+			break;
+		}
+	}
+
+	if (found != NULL) {
+		ISC_LIST_UNLINK(cache->spools, found, link);
+		ISC_LIST_PREPEND(cache->spools, found, link);
+		found->references++;
+		xfr->spool = found;
+		xfr->spoolrecord = false;
+		goto unlock;
+	}
+
+	spool = isc_mem_get(cache->mctx, sizeof(*spool));
+	if (spool == NULL)
+		goto unlock;
+	spool->cache = cache;
+	spool->references = 2;		/* The cache and 'xfr'. */
+	ISC_LINK_INIT(spool, link);
+	spool->linked = true;
+	spool->complete = false;
+	spool->zone = xfr->zone;
+	spool->db = NULL;
+	dns_db_attach(xfr->db, &spool->db);
+	spool->serial = serial;
+	spool->msgsize = msgsize;
+	spool->qname = dns_fixedname_initname(&spool->fqname);
+	dns_name_copy(xfr->qname, spool->qname, NULL);
+	spool->size = sizeof(*spool);
+	ISC_LIST_INIT(spool->msgs);
+
+	ISC_LIST_PREPEND(cache->spools, spool, link);
+	cache->size += spool->size;
+	xfr->spool = spool;
+	xfr->spoolrecord = true;
+
+ unlock:
+	UNLOCK(&cache->lock);
+
+	if (xfr->spool != NULL)
+		xfrout_log(xfr, ISC_LOG_DEBUG(3), "%s cached transfer",
+			   xfr->spoolrecord ? "recording" : "replaying");
+}
+
+/*
+ * Drop 'xfr's reference to its spool.  A spool whose recording did
+ * not finish is removed from the cache.
+ */
+static void
+spool_detach(xfrout_ctx_t *xfr) {
+	xfrspool_t *spool = xfr->spool;
+	ns_xfrcache_t *cache;
+
+	if (spool == NULL)
+		return;
+
+	cache = spool->cache;
+	xfr->spool = NULL;
+	xfr->spoolpos = NULL;
+
+	LOCK(&cache->lock);
+	if (xfr->spoolrecord && !spool->complete)
+		spool_unlink(cache, spool);
+	xfr->spoolrecord = false;
+	INSIST(spool->references > 0);
+	if (--spool->references == 0)
+		spool_free(spool);
+	UNLOCK(&cache->lock);
+}
+
+/*
+ * Add the answer section of a message just rendered by the recording
+ * transfer to its spool.  If the spool cannot be extended it is
+ * abandoned; transfers already replaying it will carry on by themselves.
+ */
+static void
+spool_record(xfrout_ctx_t *xfr, isc_region_t *r, unsigned int count,
+	     bool last)
+{
+	xfrspool_t *spool = xfr->spool;
+	ns_xfrcache_t *cache = spool->cache;
+	xfrspoolmsg_t *m;
+	size_t size = sizeof(*m) + r->length;
+	bool abandoned;
+
+	REQUIRE(xfr->spoolrecord);
+
+	m = isc_mem_get(cache->mctx, size);
+	if (m == NULL) {
+		spool_detach(xfr);
+		return;
+	}
+	ISC_LINK_INIT(m, link);
+	m->count = count;
+	m->length = r->length;
+	memmove(m + 1, r->base, r->length);
+
+	LOCK(&cache->lock);
+	ISC_LIST_APPEND(spool->msgs, m, link);
+	spool->complete = last;
+	spool->size += size;
+	if (spool->linked) {
+		cache->size += size;
+		cache_trim(cache, spool);
+		/*
+		 * The zone is too large to cache on its own.
+		 */
+		if (cache->size > cache->maxsize)
+			spool_unlink(cache, spool);
+	}
+	abandoned = !spool->linked;
+	UNLOCK(&cache->lock);
+
+	if (abandoned && !last)
+		xfrout_log(xfr, ISC_LOG_DEBUG(3), "cached transfer abandoned");
+	if (abandoned || last)
+		spool_detach(xfr);
+}
+
+/*
+ * Find the next recorded message for a replaying transfer.  Sets
+ * '*mp' to NULL if there is none yet or it would not fit in 'msg',
+ * in which case the transfer stops replaying and its RR stream is
+ * moved forward past the RRs sent so far.
+ */
+static isc_result_t
+spool_next(xfrout_ctx_t *xfr, dns_message_t *msg, xfrspoolmsg_t **mp,
+	   bool *lastp)
+{
+	xfrspool_t *spool = xfr->spool;
+	ns_xfrcache_t *cache = spool->cache;
+	xfrspoolmsg_t *m;
+	unsigned int need;
+	bool last = false;
+	isc_result_t result;
+
+	REQUIRE(!xfr->spoolrecord);
+
+	LOCK(&cache->lock);
+	if (xfr->spoolpos == NULL)
+		m = ISC_LIST_HEAD(spool->msgs);
+	else
+		m = ISC_LIST_NEXT(xfr->spoolpos, link);
+	if (m != NULL)
+		last = (spool->complete && ISC_LIST_NEXT(m, link) == NULL);
+	UNLOCK(&cache->lock);
+
+	if (m != NULL) {
+		need = DNS_MESSAGE_HEADERLEN + msg->reserved + m->length;
+		if (xfr->nmsg == 0)
+			need += xfr->qname->length + 4;
+		if (need > isc_buffer_length(&xfr->txbuf))
+			m = NULL;
+	}
+
+	if (m != NULL) {
+		xfr->spoolpos = m;
+		xfr->spoolrrs += m->count;
+		*mp = m;
+		*lastp = last;
+		return (ISC_R_SUCCESS);
+	}
+
+	xfrout_log(xfr, ISC_LOG_DEBUG(3),
+		   "cached transfer incomplete after %u RRs",
+		   xfr->spoolrrs);
+	spool_detach(xfr);
+	for (; xfr->spoolrrs > 0; xfr->spoolrrs--) {
+		result = xfr->stream->methods->next(xfr->stream);
+		if (result == ISC_R_NOMORE)
+			result = ISC_R_UNEXPECTED;
+		if (result != ISC_R_SUCCESS)
+			return (result);
+	}
+	*mp = NULL;
+	*lastp = false;
+	return (ISC_R_SUCCESS);
+}
+
+/**************************************************************************/
+
 void
 ns_xfr_start(ns_client_t *client, dns_rdatatype_t reqtype) {
 	isc_result_t result;
@@ -1063,6 +1489,15 @@ ns_xfr_start(ns_client_t *client, dns_rdatatype_t reqtype) {
 
 	CHECK(xfr->stream->methods->first(xfr->stream));
 
+	/*
+	 * Full zone transfers of a zone version are all alike, apart
+	 * from the things dns_message_renderend() adds; share the work
+	 * of rendering them.
+	 */
+	if (!is_dlz && !is_poll && !is_ixfr && xfr->many_answers &&
+	    (client->attributes & NS_CLIENTATTR_TCP) != 0)
+		spool_attach(xfr, current_serial);
+
 	if (xfr->tsigkey != NULL)
 		dns_name_format(&xfr->tsigkey->name, keyname, sizeof(keyname));
 	else
@@ -1190,6 +1625,10 @@ xfrout_ctx_create(isc_mem_t *mctx, ns_client_t *client, unsigned int id,
 	xfr->txmemlen = 0;
 	xfr->stream = NULL;
 	xfr->quota = NULL;
+	xfr->spool = NULL;
+	xfr->spoolpos = NULL;
+	xfr->spoolrecord = false;
+	xfr->spoolrrs = 0;
 
 	/*
 	 * Allocate a temporary buffer for the uncompressed response
@@ -1273,6 +1712,9 @@ sendstream(xfrout_ctx_t *xfr) {
 	dns_compress_t cctx;
 	bool cleanup_cctx = false;
 	bool is_tcp;
+	xfrspoolmsg_t *spoolmsg = NULL;
+	bool spoollast = false;
+	unsigned int answerstart;
 
 	int n_rrs;
 
@@ -1378,6 +1820,17 @@ sendstream(xfrout_ctx_t *xfr) {
 			isc_buffer_add(&xfr->buf, 12);
 			msg->tcp_continuation = 1;
 		}
+
+		/*
+		 * Replay the answer section from the spool if we can.
+		 */
+		if (xfr->spool != NULL && !xfr->spoolrecord) {
+			CHECK(spool_next(xfr, msg, &spoolmsg, &spoollast));
+			if (spoolmsg != NULL) {
+				xfr->end_of_stream = spoollast;
+				goto render;
+			}
+		}
 	}
 
 	/*
@@ -1494,13 +1947,32 @@ sendstream(xfrout_ctx_t *xfr) {
 			break;
 	}
 
+
+ render:
 	if (is_tcp) {
 		CHECK(dns_compress_init(&cctx, -1, xfr->mctx));
 		dns_compress_setsensitive(&cctx, true);
 		cleanup_cctx = true;
 		CHECK(dns_message_renderbegin(msg, &cctx, &xfr->txbuf));
 		CHECK(dns_message_rendersection(msg, DNS_SECTION_QUESTION, 0));
-		CHECK(dns_message_rendersection(msg, DNS_SECTION_ANSWER, 0));
+		if (spoolmsg != NULL) {
+			region.base = (unsigned char *)(spoolmsg + 1);
+			region.length = spoolmsg->length;
+			CHECK(dns_message_renderraw(msg, DNS_SECTION_ANSWER,
+						    &region, spoolmsg->count));
+		} else {
+			answerstart = isc_buffer_usedlength(&xfr->txbuf);
+			CHECK(dns_message_rendersection(msg,
+							DNS_SECTION_ANSWER,
+							0));
+			if (xfr->spoolrecord) {
+				isc_buffer_usedregion(&xfr->txbuf, &region);
+				isc_region_consume(&region, answerstart);
+				spool_record(xfr, &region,
+					     msg->counts[DNS_SECTION_ANSWER],
+					     xfr->end_of_stream);
+			}
+		}
 		CHECK(dns_message_renderend(msg));
 		dns_compress_invalidate(&cctx);
 		cleanup_cctx = false;
@@ -1574,6 +2046,7 @@ xfrout_ctx_destroy(xfrout_ctx_t **xfrp) {
 	xfr->client->shutdown = NULL;
 	xfr->client->shutdown_arg = NULL;
 
+	spool_detach(xfr);
 	if (xfr->stream != NULL)
 		xfr->stream->methods->destroy(&xfr->stream);
 	if (xfr->buf.base != NULL)